@@ -50,6 +50,15 @@ static inline int ar0134_write_reg(libusb_device_handle *devh, uint16_t reg,
         return esp770u_i2c_write(devh, AR0134_I2C_ADDR, reg, val);
 }
 
+/*
+ * Writes num register, value pairs in a single batch of control transfers.
+ */
+static inline int ar0134_write_regs(libusb_device_handle *devh,
+				    const uint16_t *regs, int num)
+{
+	return esp770u_i2c_write_regs(devh, AR0134_I2C_ADDR, regs, num);
+}
+
 int ar0134_init(libusb_device_handle *devh)
 {
 	uint16_t version, revision;
@@ -106,8 +115,41 @@ int ar0134_set_gain(libusb_device_handle *devh, uint16_t gain)
 	return ar0134_write_reg(devh, AR0134_GLOBAL_GAIN, gain);
 }
 
-static int ar0134_set_window(libusb_device_handle *devh, uint16_t x_start,
-			     uint16_t y_start, uint16_t x_end, uint16_t y_end)
+/*
+ * Sets the coarse integration time in lines and the fine integration time in
+ * pixel clocks.
+ */
+int ar0134_set_exposure(libusb_device_handle *devh, uint16_t coarse,
+			uint16_t fine)
+{
+	const uint16_t regs[] = {
+		AR0134_COARSE_INTEGRATION_TIME, coarse,
+		AR0134_FINE_INTEGRATION_TIME, fine,
+	};
+
+	return ar0134_write_regs(devh, regs, 2);
+}
+
+/*
+ * Sets coarse and fine integration time and global gain at once.
+ */
+int ar0134_set_exposure_gain(libusb_device_handle *devh, uint16_t coarse,
+			     uint16_t fine, uint16_t gain)
+{
+	const uint16_t regs[] = {
+		AR0134_COARSE_INTEGRATION_TIME, coarse,
+		AR0134_FINE_INTEGRATION_TIME, fine,
+		AR0134_GLOBAL_GAIN, gain,
+	};
+
+	return ar0134_write_regs(devh, regs, 3);
+}
+
+/*
+ * Sets the sensor window. The end coordinates are inclusive.
+ */
+int ar0134_set_window(libusb_device_handle *devh, uint16_t x_start,
+		      uint16_t y_start, uint16_t x_end, uint16_t y_end)
 {
 	const uint16_t regs[] = {
 		AR0134_Y_ADDR_START, y_start,
@@ -115,36 +157,23 @@ static int ar0134_set_window(libusb_device_handle *devh, uint16_t x_start,
 		AR0134_Y_ADDR_END, y_end,
 		AR0134_X_ADDR_END, x_end,
 	};
-	int ret;
-	int i;
-
-	for (i = 0; i < 4; i++) {
-		ret = ar0134_write_reg(devh, regs[2 * i], regs[2 * i + 1]);
-		if (ret < 0)
-			return ret;
-	}
 
-	return 0;
+	return ar0134_write_regs(devh, regs, 4);
 }
 
-int ar0134_set_timings(libusb_device_handle *devh, bool tight)
+#define AR0134_TIMING_REGS	9
+
+/*
+ * Reads the digital test register and fills regs with the register, value
+ * pairs for full frame readout with the minimal or default line length.
+ */
+static int ar0134_get_timing_regs(libusb_device_handle *devh, bool tight,
+				  uint16_t *regs)
 {
 	uint16_t val;
 	int ret;
+	int i = 0;
 
-	ret = ar0134_read_reg(devh, AR0134_LINE_LENGTH_PCK, &val);
-	if (ret < 0)
-		return ret;
-
-	ret = ar0134_set_window(devh, 0, 0, 1279, 959);
-	if (ret < 0)
-		return ret;
-
-	/* Set minimum supported pixel clocks per line */
-	ret = ar0134_write_reg(devh, AR0134_LINE_LENGTH_PCK,
-			       tight ? 1388 : 1498);
-	if (ret < 0)
-		return ret;
 	ret = ar0134_read_reg(devh, AR0134_DIGITAL_TEST, &val);
 	if (ret < 0)
 		return ret;
@@ -153,15 +182,27 @@ int ar0134_set_timings(libusb_device_handle *devh, bool tight)
 	if (tight)
 		val |= AR0134_ENABLE_SHORT_LLPCK_BIT;
 	else
-		val &= AR0134_ENABLE_SHORT_LLPCK_BIT;
-	ret = ar0134_write_reg(devh, AR0134_DIGITAL_TEST, val);
-	if (ret < 0)
-		return ret;
+		val &= ~AR0134_ENABLE_SHORT_LLPCK_BIT;
+
+	/* Full 1280x960 window */
+	regs[i++] = AR0134_Y_ADDR_START;
+	regs[i++] = 0;
+	regs[i++] = AR0134_X_ADDR_START;
+	regs[i++] = 0;
+	regs[i++] = AR0134_Y_ADDR_END;
+	regs[i++] = 959;
+	regs[i++] = AR0134_X_ADDR_END;
+	regs[i++] = 1279;
+
+	/* Set minimum supported pixel clocks per line */
+	regs[i++] = AR0134_LINE_LENGTH_PCK;
+	regs[i++] = tight ? 1388 : 1498;
+	regs[i++] = AR0134_DIGITAL_TEST;
+	regs[i++] = val;
 
 	/* Set minimum total number of lines, 23 lines vertical blanking */
-	ret = ar0134_write_reg(devh, AR0134_FRAME_LENGTH_LINES, 997);
-	if (ret < 0)
-		return ret;
+	regs[i++] = AR0134_FRAME_LENGTH_LINES;
+	regs[i++] = 997;
 
 	/*
 	 * Set coarse integration time (in multiples of line_length_pck) and
@@ -169,12 +210,24 @@ int ar0134_set_timings(libusb_device_handle *devh, bool tight)
 	 * At 74.25 MHz pixel clock and 1388 pclk per line, exposure time would
 	 * be (1388 * 26 + 646) / 74.25e6 = ~495 µs.
 	 */
-	ret = ar0134_write_reg(devh, AR0134_COARSE_INTEGRATION_TIME,
-			       tight ? 26 : 100);
+	regs[i++] = AR0134_COARSE_INTEGRATION_TIME;
+	regs[i++] = tight ? 26 : 100;
+	regs[i++] = AR0134_FINE_INTEGRATION_TIME;
+	regs[i++] = tight ? 646 : 0;
+
+	return 0;
+}
+
+int ar0134_set_timings(libusb_device_handle *devh, bool tight)
+{
+	uint16_t regs[2 * AR0134_TIMING_REGS];
+	int ret;
+
+	ret = ar0134_get_timing_regs(devh, tight, regs);
 	if (ret < 0)
 		return ret;
-	return ar0134_write_reg(devh, AR0134_FINE_INTEGRATION_TIME,
-				tight ? 646 : 0);
+
+	return ar0134_write_regs(devh, regs, AR0134_TIMING_REGS);
 }
 
 /*
@@ -183,12 +236,13 @@ int ar0134_set_timings(libusb_device_handle *devh, bool tight)
  */
 int ar0134_set_sync(libusb_device_handle *devh, bool enabled)
 {
+	uint16_t regs[2 * (AR0134_TIMING_REGS + 1)];
 	uint16_t val;
 	int ret;
 
 	printf("%sabling synchronisation\n", enabled ? "En" : "Dis");
 
-	ret = ar0134_set_timings(devh, true);
+	ret = ar0134_get_timing_regs(devh, true, regs);
 	if (ret < 0)
 		return ret;
 
@@ -197,5 +251,8 @@ int ar0134_set_sync(libusb_device_handle *devh, bool enabled)
 		return ret;
 	val &= ~(AR0134_FORCED_PLL_ON | AR0134_GPI_EN | AR0134_STREAM);
 	val |= enabled ? (AR0134_FORCED_PLL_ON | AR0134_GPI_EN) : AR0134_STREAM;
-	return ar0134_write_reg(devh, AR0134_RESET_REGISTER, val);
+	regs[2 * AR0134_TIMING_REGS] = AR0134_RESET_REGISTER;
+	regs[2 * AR0134_TIMING_REGS + 1] = val;
+
+	return ar0134_write_regs(devh, regs, AR0134_TIMING_REGS + 1);
 }
@@ -3,29 +3,83 @@
  * Copyright 2014-2015 Philipp Zabel
  * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
  */
+#include <glib.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "blobwatch.h"
 #include "debug.h"
 #include "flicker.h"
-
-struct leds;
+#include "jobs.h"
+#include "leds.h"
+#include "log.h"
+#include "trace.h"
 
 #include <stdio.h>
 
-#define THRESHOLD 0x9f
-
 #define NUM_FRAMES_HISTORY	2
-#define MAX_EXTENTS_PER_LINE	11
+#define MIN_BLOBS_PER_FRAME	42
+#define MAX_BLOBS_PER_FRAME	65534
+#define MIN_EXTENTS_PER_LINE	11
+#define MAX_BANDS		4
+#define MIN_BAND_HEIGHT		120
+#define ROI_PADDING		8
+#define GRID_CELL_SHIFT		5
+#define FULL_SCAN_INTERVAL	30
+#define MASK_CELL_SHIFT		3
+#define MAX_MASK_SPANS		16
+#define MASK_MIN_AREA		64
+#define MASK_LEARN_FRAMES	30
+#define MASK_RELEARN_INTERVAL	900
+/* motion filter gains and association gate limits in pixels */
+#define TRACK_VELOCITY_GAIN	0.5f
+#define TRACK_ACCEL_GAIN	0.1f
+#define TRACK_GATE_MIN		2.0f
+#define TRACK_GATE_INITIAL	8.0f
+#define TRACK_GATE_MAX		24.0f
+/* distance in pixels up to which unidentified blobs follow a nearby LED */
+#define TRACK_SHIFT_RADIUS	32.0f
 
 #define abs(x) ((x) >= 0 ? (x) : -(x))
 #define min(x, y) ((x) < (y) ? (x) : (y))
 #define max(x, y) ((x) > (y) ? (x) : (y))
 
+/*
+ * Intensity-weighted raw moments of a blob, in fixed point with the pixel
+ * values above threshold as weights.
+ */
+struct moments {
+	uint64_t w;
+	uint64_t x;
+	uint64_t y;
+	uint64_t xx;
+	uint64_t xy;
+	uint64_t yy;
+};
+
+/* Raw moments of band blobs, restored from their centroids */
+struct merge_moments {
+	double w;
+	double x;
+	double y;
+	double xx;
+	double xy;
+	double yy;
+};
+
 struct extent {
 	uint16_t start;
 	uint16_t end;
@@ -33,16 +87,90 @@ struct extent {
 	uint16_t top;
 	uint16_t left;
 	uint16_t right;
-	uint8_t index;
+	uint16_t index;
 	uint32_t area;
+	struct moments m;
 };
 
 struct extent_line {
-	struct extent extents[MAX_EXTENTS_PER_LINE];
+	struct extent *extents;
 	uint16_t num;
-	uint16_t padding[3];
 };
 
+/*
+ * Horizontal range of masked pixels [start, end)
+ */
+struct mask_span {
+	uint16_t start;
+	uint16_t end;
+};
+
+/*
+ * Masked spans of all rows of mask cells, MAX_MASK_SPANS per row
+ */
+struct mask_buffer {
+	struct mask_span *spans;
+	uint8_t *num_spans;
+};
+
+/* flags the published mask buffer as not yet picked up by the scan */
+#define MASK_BUFFER_NEW		4
+
+/*
+ * Background mask learning state of a cell of 8x8 pixels. The area of the
+ * blob covering the cell is compared over consecutive full frame scans.
+ */
+struct mask_cell {
+	uint32_t area;
+	uint16_t count;
+	uint16_t frame;
+	bool masked;
+};
+
+typedef int (*scan_fn)(const uint8_t *line, int x, int width,
+		       uint8_t threshold);
+
+struct blobwatch;
+struct blob;
+
+/*
+ * Frame kernel that collects the extents of the lines y to y_end - 1, see
+ * scan_lines.
+ */
+typedef int (*lines_fn)(struct blobwatch *bw, uint8_t *line, int y,
+			int y_end, int y_last, bool top, int index,
+			struct blob *blobs);
+
+/*
+ * Bump allocator for the per-instance arena. All buffers are laid out once
+ * in blobwatch_new, nothing is allocated while processing frames.
+ */
+struct arena {
+	uint8_t *base;
+	size_t used;
+};
+
+/*
+ * Horizontal stripe of the frame, processed independently as a job
+ */
+struct blob_band {
+	int y0;
+	int y1;
+	int num_blobs;
+	struct blob *blobs;
+	struct blobwatch *bw;
+	struct job job;
+};
+
+/*
+ * Region of interest around a predicted blob position, inclusive
+ */
+struct roi {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+};
 
 /*
  * Blob detector internal state
@@ -52,287 +180,1788 @@ struct blobwatch {
 	int height;
 	int last_observation;
 	struct blobservation history[NUM_FRAMES_HISTORY];
+
+	/* frame format */
+	int stride;
+	int pitch;
+	scan_fn find_bright;
+	scan_fn find_dark;
+	lines_fn scan_lines;
+
+	/* pixels must exceed the threshold, extents be at least this long */
+	uint8_t threshold;
+	int min_extent_length;
+
 	struct extent_line *el;
 	bool debug;
+
+	/* capacity */
+	int max_blobs;
+	int max_extents;
+	void *arena;
+
+	/* band merge scratch space */
+	int *left;
+	int *right;
+	int *top;
+	int *bottom;
+	int *parent;
+	uint32_t *area;
+	struct merge_moments *moments;
+
+	/* band-parallel detection */
+	int num_bands;
+	struct blob_band bands[MAX_BANDS];
+	uint8_t *frame;
+
+	/* predicted LED shifts of a single object, for the next frame only */
+	int shift_object;
+	int num_shifts;
+	struct blobwatch_led_shift shifts[BLOBWATCH_MAX_LED_SHIFTS];
+
+	/* predicted region of interest tracking */
+	bool roi_tracking;
+	int frames_since_full_scan;
+	int num_rois;
+	struct roi *rois;
+	struct blob *roi_blobs;
+
+	/*
+	 * Association grid over predicted positions of the last observation.
+	 * The positions are kept in separate arrays next to the grid links, so
+	 * that the association loop does not have to touch the blob records.
+	 */
+	int grid_cols;
+	int grid_rows;
+	int *grid;
+	int *grid_next;
+	int16_t *grid_x;
+	int16_t *grid_y;
+	float *grid_gate;
+	float grid_max_gate;
+
+	/* mask of static bright regions, skipped by the scanline search */
+	bool background_mask;
+	int mask_cols;
+	int mask_rows;
+	uint16_t mask_frame;
+	int mask_age;
+	/* set by the scanning thread to relearn the mask on the next frame */
+	bool mask_reset;
+	struct mask_cell *mask_cells;
+	/*
+	 * The masked spans are triple buffered: learning rebuilds the back
+	 * buffer and publishes it, and the scanline search picks up the last
+	 * published buffer at the start of each frame, so that the spans do
+	 * not change while a frame is scanned on another thread.
+	 */
+	struct mask_buffer mask_buffers[3];
+	int mask_back;
+	int mask_published;
+	int mask_front;
+	/* front mask buffer, used by the scanline search */
+	struct mask_span *mask_spans;
+	uint8_t *mask_num_spans;
+
+	/* incremental detection state */
+	uint8_t *stream_frame;
+	int stream_y;
+	int stream_index;
 };
 
-/* temporary global */
-bool rift_flicker;
+/* temporary global */
+bool rift_flicker;
+/* set while the blinking LEDs are kept steady, written by the Rift */
+static bool rift_leds_steady;
+
+/*
+ * Scanline search kernels. find_bright returns the position of the first
+ * pixel at or after x that exceeds the threshold, find_dark returns the
+ * position of the first pixel at or after x that does not. Both return width
+ * if there is no such pixel.
+ */
+typedef int (*scan_fn)(const uint8_t *line, int x, int width,
+		       uint8_t threshold);
+
+static int find_bright_scalar(const uint8_t *line, int x, int width,
+			      uint8_t threshold)
+{
+	while (x < width && line[x] <= threshold)
+		x++;
+	return x;
+}
+
+static int find_dark_scalar(const uint8_t *line, int x, int width,
+			    uint8_t threshold)
+{
+	while (x < width && line[x] > threshold)
+		x++;
+	return x;
+}
+
+/*
+ * YUYV variants of the scanline search kernels only look at the luma bytes.
+ */
+static int find_bright_yuyv_scalar(const uint8_t *line, int x, int width,
+				   uint8_t threshold)
+{
+	while (x < width && line[2 * x] <= threshold)
+		x++;
+	return x;
+}
+
+static int find_dark_yuyv_scalar(const uint8_t *line, int x, int width,
+				 uint8_t threshold)
+{
+	while (x < width && line[2 * x] > threshold)
+		x++;
+	return x;
+}
+
+#if defined(__SSE2__)
+/*
+ * There is no unsigned byte comparison in SSE2, so flip the sign bit of both
+ * operands and use the signed comparison instead.
+ */
+static inline int sse2_bright_mask(const uint8_t *p, uint8_t threshold)
+{
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m128i thresh = _mm_set1_epi8((char)(threshold ^ 0x80));
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+	return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_xor_si128(v, bias),
+						thresh));
+}
+
+static inline int find_bright_sse2(const uint8_t *line, int x, int width,
+				   uint8_t threshold)
+{
+	for (; x + 16 <= width; x += 16) {
+		int mask = sse2_bright_mask(line + x, threshold);
+		if (mask)
+			return x + __builtin_ctz(mask);
+	}
+	return find_bright_scalar(line, x, width, threshold);
+}
+
+static inline int find_dark_sse2(const uint8_t *line, int x, int width,
+				 uint8_t threshold)
+{
+	for (; x + 16 <= width; x += 16) {
+		int mask = ~sse2_bright_mask(line + x, threshold) & 0xffff;
+		if (mask)
+			return x + __builtin_ctz(mask);
+	}
+	return find_dark_scalar(line, x, width, threshold);
+}
+
+static int find_bright_yuyv_sse2(const uint8_t *line, int x, int width,
+				 uint8_t threshold)
+{
+	for (; x + 8 <= width; x += 8) {
+		int mask = sse2_bright_mask(line + 2 * x, threshold) & 0x5555;
+		if (mask)
+			return x + __builtin_ctz(mask) / 2;
+	}
+	return find_bright_yuyv_scalar(line, x, width, threshold);
+}
+
+static int find_dark_yuyv_sse2(const uint8_t *line, int x, int width,
+			       uint8_t threshold)
+{
+	for (; x + 8 <= width; x += 8) {
+		int mask = ~sse2_bright_mask(line + 2 * x, threshold) & 0x5555;
+		if (mask)
+			return x + __builtin_ctz(mask) / 2;
+	}
+	return find_dark_yuyv_scalar(line, x, width, threshold);
+}
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+__attribute__((target("avx2")))
+static inline uint32_t avx2_bright_mask(const uint8_t *p,
+					 uint8_t threshold)
+{
+	const __m256i bias = _mm256_set1_epi8((char)0x80);
+	const __m256i thresh = _mm256_set1_epi8((char)(threshold ^ 0x80));
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+
+	return _mm256_movemask_epi8(_mm256_cmpgt_epi8(
+					_mm256_xor_si256(v, bias), thresh));
+}
+
+__attribute__((target("avx2")))
+static inline int find_bright_avx2(const uint8_t *line, int x, int width,
+				   uint8_t threshold)
+{
+	/* Most of the frame is dark, check 64 pixels per iteration */
+	for (; x + 64 <= width; x += 64) {
+		uint64_t mask = avx2_bright_mask(line + x, threshold) |
+				(uint64_t)avx2_bright_mask(line + x + 32,
+							   threshold) << 32;
+		if (mask)
+			return x + __builtin_ctzll(mask);
+	}
+	for (; x + 32 <= width; x += 32) {
+		uint32_t mask = avx2_bright_mask(line + x, threshold);
+		if (mask)
+			return x + __builtin_ctz(mask);
+	}
+	return find_bright_scalar(line, x, width, threshold);
+}
+
+__attribute__((target("avx2")))
+static inline int find_dark_avx2(const uint8_t *line, int x, int width,
+				 uint8_t threshold)
+{
+	for (; x + 32 <= width; x += 32) {
+		uint32_t mask = ~avx2_bright_mask(line + x, threshold);
+		if (mask)
+			return x + __builtin_ctz(mask);
+	}
+	return find_dark_scalar(line, x, width, threshold);
+}
+
+__attribute__((target("avx2")))
+static int find_bright_yuyv_avx2(const uint8_t *line, int x, int width,
+				 uint8_t threshold)
+{
+	for (; x + 16 <= width; x += 16) {
+		uint32_t mask = avx2_bright_mask(line + 2 * x, threshold) &
+				0x55555555;
+		if (mask)
+			return x + __builtin_ctz(mask) / 2;
+	}
+	return find_bright_yuyv_scalar(line, x, width, threshold);
+}
+
+__attribute__((target("avx2")))
+static int find_dark_yuyv_avx2(const uint8_t *line, int x, int width,
+			       uint8_t threshold)
+{
+	for (; x + 16 <= width; x += 16) {
+		uint32_t mask = ~avx2_bright_mask(line + 2 * x, threshold) &
+				0x55555555;
+		if (mask)
+			return x + __builtin_ctz(mask) / 2;
+	}
+	return find_dark_yuyv_scalar(line, x, width, threshold);
+}
+#define HAVE_AVX2_KERNELS 1
+#endif
+
+#if defined(__ARM_NEON)
+/*
+ * NEON has no movemask, narrow the 16 comparison result bytes into a 64-bit
+ * value with four bits per pixel instead.
+ */
+static inline uint64_t neon_bright_mask(const uint8_t *p,
+					 uint8_t threshold)
+{
+	uint8x16_t cmp = vcgtq_u8(vld1q_u8(p), vdupq_n_u8(threshold));
+	uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+
+	return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+
+static inline int find_bright_neon(const uint8_t *line, int x, int width,
+				   uint8_t threshold)
+{
+	for (; x + 16 <= width; x += 16) {
+		uint64_t mask = neon_bright_mask(line + x, threshold);
+		if (mask)
+			return x + __builtin_ctzll(mask) / 4;
+	}
+	return find_bright_scalar(line, x, width, threshold);
+}
+
+static inline int find_dark_neon(const uint8_t *line, int x, int width,
+				 uint8_t threshold)
+{
+	for (; x + 16 <= width; x += 16) {
+		uint64_t mask = ~neon_bright_mask(line + x, threshold);
+		if (mask)
+			return x + __builtin_ctzll(mask) / 4;
+	}
+	return find_dark_scalar(line, x, width, threshold);
+}
+
+static int find_bright_yuyv_neon(const uint8_t *line, int x, int width,
+				 uint8_t threshold)
+{
+	for (; x + 8 <= width; x += 8) {
+		uint64_t mask = neon_bright_mask(line + 2 * x, threshold) &
+				0x0f0f0f0f0f0f0f0fULL;
+		if (mask)
+			return x + __builtin_ctzll(mask) / 8;
+	}
+	return find_bright_yuyv_scalar(line, x, width, threshold);
+}
+
+static int find_dark_yuyv_neon(const uint8_t *line, int x, int width,
+			       uint8_t threshold)
+{
+	for (; x + 8 <= width; x += 8) {
+		uint64_t mask = ~neon_bright_mask(line + 2 * x, threshold) &
+				0x0f0f0f0f0f0f0f0fULL;
+		if (mask)
+			return x + __builtin_ctzll(mask) / 8;
+	}
+	return find_dark_yuyv_scalar(line, x, width, threshold);
+}
+#endif
+
+static scan_fn find_bright = find_bright_scalar;
+static scan_fn find_dark = find_dark_scalar;
+static scan_fn find_bright_yuyv = find_bright_yuyv_scalar;
+static scan_fn find_dark_yuyv = find_dark_yuyv_scalar;
+
+/*
+ * Selects the fastest scanline kernels supported by the CPU.
+ */
+static void blobwatch_init_kernels(void)
+{
+	static gsize initialized;
+
+	if (!g_once_init_enter(&initialized))
+		return;
+
+#if defined(__ARM_NEON)
+	find_bright = find_bright_neon;
+	find_dark = find_dark_neon;
+	find_bright_yuyv = find_bright_yuyv_neon;
+	find_dark_yuyv = find_dark_yuyv_neon;
+#elif defined(__SSE2__)
+	find_bright = find_bright_sse2;
+	find_dark = find_dark_sse2;
+	find_bright_yuyv = find_bright_yuyv_sse2;
+	find_dark_yuyv = find_dark_yuyv_sse2;
+#endif
+#if defined(HAVE_AVX2_KERNELS)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		find_bright = find_bright_avx2;
+		find_dark = find_dark_avx2;
+		find_bright_yuyv = find_bright_yuyv_avx2;
+		find_dark_yuyv = find_dark_yuyv_avx2;
+	}
+#endif
+
+	g_once_init_leave(&initialized, 1);
+}
+
+/*
+ * Finds the next bright run on a greyscale scanline, using the default
+ * threshold and the same kernels as blob detection. Returns the position of
+ * the first pixel of the run at or after x, or width if there is none, and
+ * stores the position after the last pixel of the run in end.
+ */
+int blobwatch_find_run(const uint8_t *line, int x, int width, int *end)
+{
+	blobwatch_init_kernels();
+
+	x = find_bright(line, x, width, BLOBWATCH_DEFAULT_THRESHOLD);
+	*end = x < width ? find_dark(line, x + 1, width,
+				      BLOBWATCH_DEFAULT_THRESHOLD) : width;
+
+	return x;
+}
+
+void blobwatch_set_flicker(bool enable)
+{
+	rift_flicker = enable;
+}
+
+/*
+ * Suspends identifying blobs by their blinking pattern while the LEDs are
+ * kept steady. Blobs identified by reprojection meanwhile keep their LED
+ * ids, and pattern identification starts over once the LEDs blink again.
+ */
+void blobwatch_set_leds_steady(bool steady)
+{
+	__atomic_store_n(&rift_leds_steady, steady, __ATOMIC_RELAXED);
+}
+
+static void process_band(struct blobwatch *bw, struct blob_band *band,
+			 uint8_t *frame);
+static lines_fn blobwatch_select_lines_kernel(struct blobwatch *bw);
+
+/*
+ * Job function that processes one band of the current frame.
+ */
+static void blobwatch_band_job(void *data)
+{
+	struct blob_band *band = data;
+
+	process_band(band->bw, band, band->bw->frame);
+}
+
+/*
+ * Splits the frame into horizontal bands, at most one per processor. All
+ * bands but the first are submitted as jobs to the shared job scheduler,
+ * the first is processed by the calling thread.
+ */
+static void blobwatch_init_bands(struct blobwatch *bw)
+{
+	int num_bands = bw->height / MIN_BAND_HEIGHT;
+	int i;
+
+	num_bands = min(num_bands, MAX_BANDS);
+	num_bands = min(num_bands, (int)g_get_num_processors());
+	num_bands = max(num_bands, 1);
+
+	for (i = 0; i < num_bands; i++) {
+		bw->bands[i].y0 = bw->height * i / num_bands;
+		bw->bands[i].y1 = bw->height * (i + 1) / num_bands - 1;
+		bw->bands[i].bw = bw;
+	}
+	bw->num_bands = num_bands;
+}
+
+static void *arena_alloc(struct arena *arena, size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	arena->used = (arena->used + 15) & ~(size_t)15;
+	ptr = arena->base ? arena->base + arena->used : NULL;
+	arena->used += nmemb * size;
+
+	return ptr;
+}
+
+/*
+ * Distributes all buffers over the arena. With a NULL arena base this only
+ * calculates the required arena size.
+ *
+ * Returns the arena size.
+ */
+static size_t blobwatch_layout(struct blobwatch *bw, uint8_t *base)
+{
+	struct arena arena = { .base = base };
+	size_t n = MAX_BANDS * bw->max_blobs;
+	int i;
+
+	bw->el = arena_alloc(&arena, bw->height, sizeof(*bw->el));
+	for (i = 0; i < bw->height; i++) {
+		struct extent *extents = arena_alloc(&arena, bw->max_extents,
+						     sizeof(struct extent));
+		if (base)
+			bw->el[i].extents = extents;
+	}
+
+	for (i = 0; i < NUM_FRAMES_HISTORY; i++) {
+		struct blobservation *ob = &bw->history[i];
+
+		ob->max_blobs = bw->max_blobs;
+		ob->blobs = arena_alloc(&arena, bw->max_blobs,
+					sizeof(*ob->blobs));
+		ob->tracked = arena_alloc(&arena, bw->max_blobs,
+					  sizeof(*ob->tracked));
+	}
+
+	for (i = 0; i < MAX_BANDS; i++) {
+		bw->bands[i].blobs = arena_alloc(&arena, bw->max_blobs,
+						 sizeof(struct blob));
+	}
+
+	bw->left = arena_alloc(&arena, n, sizeof(*bw->left));
+	bw->right = arena_alloc(&arena, n, sizeof(*bw->right));
+	bw->top = arena_alloc(&arena, n, sizeof(*bw->top));
+	bw->bottom = arena_alloc(&arena, n, sizeof(*bw->bottom));
+	bw->parent = arena_alloc(&arena, n, sizeof(*bw->parent));
+	bw->area = arena_alloc(&arena, n, sizeof(*bw->area));
+	bw->moments = arena_alloc(&arena, n, sizeof(*bw->moments));
+
+	bw->rois = arena_alloc(&arena, bw->max_blobs, sizeof(*bw->rois));
+	bw->roi_blobs = arena_alloc(&arena, bw->max_blobs,
+				    sizeof(*bw->roi_blobs));
+
+	bw->grid = arena_alloc(&arena, bw->grid_cols * bw->grid_rows,
+			       sizeof(*bw->grid));
+	bw->grid_next = arena_alloc(&arena, bw->max_blobs,
+				    sizeof(*bw->grid_next));
+	bw->grid_x = arena_alloc(&arena, bw->max_blobs, sizeof(*bw->grid_x));
+	bw->grid_y = arena_alloc(&arena, bw->max_blobs, sizeof(*bw->grid_y));
+	bw->grid_gate = arena_alloc(&arena, bw->max_blobs,
+				    sizeof(*bw->grid_gate));
+
+	bw->mask_cells = arena_alloc(&arena, bw->mask_cols * bw->mask_rows,
+				     sizeof(*bw->mask_cells));
+	for (i = 0; i < 3; i++) {
+		struct mask_buffer *buf = &bw->mask_buffers[i];
+
+		buf->spans = arena_alloc(&arena, bw->mask_rows * MAX_MASK_SPANS,
+					 sizeof(*buf->spans));
+		buf->num_spans = arena_alloc(&arena, bw->mask_rows,
+					     sizeof(*buf->num_spans));
+	}
+
+	return arena.used;
+}
+
+/*
+ * Allocates and initializes blobwatch structure that can hold up to
+ * max_blobs blobs per frame and max_extents extents per scanline.
+ *
+ * Returns the newly allocated blobwatch structure.
+ */
+struct blobwatch *blobwatch_new_with_capacity(int width, int height,
+					      int max_blobs, int max_extents)
+{
+	struct blobwatch *bw = malloc(sizeof(*bw));
+	size_t size;
+
+	if (!bw)
+		return NULL;
+
+	blobwatch_init_kernels();
+
+	memset(bw, 0, sizeof(*bw));
+	bw->width = width;
+	bw->height = height;
+	bw->last_observation = -1;
+	bw->threshold = BLOBWATCH_DEFAULT_THRESHOLD;
+	bw->min_extent_length = BLOBWATCH_DEFAULT_MIN_EXTENT;
+	blobwatch_set_format(bw, BLOBWATCH_FORMAT_GREY);
+	bw->debug = true;
+	bw->max_blobs = min(max(max_blobs, 1), MAX_BLOBS_PER_FRAME);
+	bw->max_extents = min(max(max_extents, 1), width);
+	bw->grid_cols = ((width - 1) >> GRID_CELL_SHIFT) + 1;
+	bw->grid_rows = ((height - 1) >> GRID_CELL_SHIFT) + 1;
+	bw->mask_cols = ((width - 1) >> MASK_CELL_SHIFT) + 1;
+	bw->mask_rows = ((height - 1) >> MASK_CELL_SHIFT) + 1;
+
+	size = blobwatch_layout(bw, NULL);
+	bw->arena = calloc(1, size);
+	if (!bw->arena) {
+		free(bw);
+		return NULL;
+	}
+	blobwatch_layout(bw, bw->arena);
+
+	bw->mask_front = 0;
+	bw->mask_published = 1;
+	bw->mask_back = 2;
+	bw->mask_spans = bw->mask_buffers[0].spans;
+	bw->mask_num_spans = bw->mask_buffers[0].num_spans;
+
+	blobwatch_init_bands(bw);
+
+	return bw;
+}
+
+/*
+ * Allocates and initializes blobwatch structure with a blob capacity
+ * according to the frame size.
+ *
+ * Returns the newly allocated blobwatch structure.
+ */
+struct blobwatch *blobwatch_new(int width, int height)
+{
+	return blobwatch_new_with_capacity(width, height,
+			max(MIN_BLOBS_PER_FRAME, width * height / 4096),
+			max(MIN_EXTENTS_PER_LINE, width / 16));
+}
+
+/*
+ * Sets the pixel format of frames passed to the blob detector. For YUYV
+ * frames, only the luma bytes are thresholded.
+ */
+void blobwatch_set_format(struct blobwatch *bw, enum blobwatch_format format)
+{
+	if (format == BLOBWATCH_FORMAT_YUYV) {
+		bw->stride = 2;
+		bw->find_bright = find_bright_yuyv;
+		bw->find_dark = find_dark_yuyv;
+	} else {
+		bw->stride = 1;
+		bw->find_bright = find_bright;
+		bw->find_dark = find_dark;
+	}
+	bw->pitch = bw->width * bw->stride;
+	bw->scan_lines = blobwatch_select_lines_kernel(bw);
+}
+
+/*
+ * Enables or disables scanning only the regions around predicted blob
+ * positions, with periodic full frame scans.
+ */
+void blobwatch_set_roi_tracking(struct blobwatch *bw, bool enable)
+{
+	bw->roi_tracking = enable;
+	bw->frames_since_full_scan = 0;
+}
+
+/*
+ * Rebuilds the masked spans of a row of mask cells.
+ */
+static void update_mask_spans(struct blobwatch *bw, struct mask_buffer *buf,
+			      int row)
+{
+	struct mask_cell *cells = bw->mask_cells + row * bw->mask_cols;
+	struct mask_span *span = buf->spans + row * MAX_MASK_SPANS;
+	int n = 0;
+	int i, j;
+
+	for (i = 0; i < bw->mask_cols && n < MAX_MASK_SPANS; i = j) {
+		if (!cells[i].masked) {
+			j = i + 1;
+			continue;
+		}
+		for (j = i + 1; j < bw->mask_cols && cells[j].masked; j++)
+			;
+		span[n].start = i << MASK_CELL_SHIFT;
+		span[n].end = min(j << MASK_CELL_SHIFT, bw->width);
+		n++;
+	}
+
+	buf->num_spans[row] = n;
+}
+
+/*
+ * Rebuilds the masked spans of all rows in the back buffer and publishes
+ * it to the scanline search. The back buffer is replaced with the one that
+ * was published before, or with the one the scanline search let go of.
+ */
+static void blobwatch_publish_mask(struct blobwatch *bw)
+{
+	struct mask_buffer *buf = &bw->mask_buffers[bw->mask_back];
+	int row;
+
+	for (row = 0; row < bw->mask_rows; row++)
+		update_mask_spans(bw, buf, row);
+
+	bw->mask_back = __atomic_exchange_n(&bw->mask_published,
+					    bw->mask_back | MASK_BUFFER_NEW,
+					    __ATOMIC_ACQ_REL) &
+			~MASK_BUFFER_NEW;
+}
+
+/*
+ * Switches the scanline search to the last published mask buffer, if there
+ * is a new one. Called before each frame is scanned.
+ */
+static void blobwatch_acquire_mask(struct blobwatch *bw)
+{
+	struct mask_buffer *buf;
+
+	if (!(__atomic_load_n(&bw->mask_published, __ATOMIC_ACQUIRE) &
+	      MASK_BUFFER_NEW))
+		return;
+
+	bw->mask_front = __atomic_exchange_n(&bw->mask_published,
+					     bw->mask_front,
+					     __ATOMIC_ACQ_REL) &
+			 ~MASK_BUFFER_NEW;
+	buf = &bw->mask_buffers[bw->mask_front];
+	bw->mask_spans = buf->spans;
+	bw->mask_num_spans = buf->num_spans;
+}
+
+static void blobwatch_clear_mask(struct blobwatch *bw)
+{
+	memset(bw->mask_cells, 0, bw->mask_cols * bw->mask_rows *
+	       sizeof(*bw->mask_cells));
+	blobwatch_publish_mask(bw);
+	bw->mask_age = 0;
+}
+
+/*
+ * Enables or disables learning a mask of static, non-blinking bright regions
+ * such as lamps, windows, or reflections, which are skipped during detection.
+ * The mask is relearned periodically.
+ */
+void blobwatch_set_background_mask(struct blobwatch *bw, bool enable)
+{
+	bw->background_mask = enable;
+	blobwatch_clear_mask(bw);
+}
+
+/*
+ * Sets the brightness that pixels must exceed to be part of a blob, and the
+ * minimum length of bright runs on a scanline. The background mask is
+ * relearned when the next frame is tracked, since the static bright regions
+ * depend on the threshold. Must be called between frames, from the thread
+ * that scans them, which may differ from the one that tracks the blobs.
+ */
+void blobwatch_set_threshold(struct blobwatch *bw, int threshold,
+			     int min_extent_length)
+{
+	threshold = min(max(threshold, 0), 254);
+	min_extent_length = min(max(min_extent_length, 1), bw->width);
+
+	if (threshold == bw->threshold &&
+	    min_extent_length == bw->min_extent_length)
+		return;
+
+	bw->threshold = threshold;
+	bw->min_extent_length = min_extent_length;
+	__atomic_store_n(&bw->mask_reset, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Frees the blobwatch structure.
+ */
+void blobwatch_free(struct blobwatch *bw)
+{
+	if (!bw)
+		return;
+
+	free(bw->arena);
+	free(bw);
+}
+
+static inline void moments_add(struct moments *a, const struct moments *b)
+{
+	a->w += b->w;
+	a->x += b->x;
+	a->y += b->y;
+	a->xx += b->xx;
+	a->xy += b->xy;
+	a->yy += b->yy;
+}
+
+/*
+ * Calculates the sub-pixel centroid and the central second moments of the
+ * blob from its raw moments.
+ */
+static void blob_set_moments(struct blob *b, double w, double x, double y,
+			     double xx, double xy, double yy)
+{
+	double cx = x / w;
+	double cy = y / w;
+
+	b->cx = cx;
+	b->cy = cy;
+	b->mxx = xx / w - cx * cx;
+	b->mxy = xy / w - cx * cy;
+	b->myy = yy / w - cy * cy;
+	b->weight = w;
+}
+
+/*
+ * Stores blob information collected in the last extent e into the blob
+ * array b at index e->index.
+ */
+static inline void store_blob(struct extent *e, int y, struct blob *b)
+{
+	b += e->index;
+	blob_set_moments(b, e->m.w, e->m.x, e->m.y, e->m.xx, e->m.xy, e->m.yy);
+	b->x = (e->left + e->right) / 2;
+	b->y = (e->top + y) / 2;
+	b->vx = 0;
+	b->vy = 0;
+	b->fvx = 0.0f;
+	b->fvy = 0.0f;
+	b->fax = 0.0f;
+	b->fay = 0.0f;
+	b->gate = TRACK_GATE_INITIAL;
+	b->width = e->right - e->left + 1;
+	b->height = y - e->top + 1;
+	b->area = e->area;
+	b->age = 0;
+	b->track_index = -1;
+	b->pattern = 0;
+	b->led_id = -1;
+	b->object_id = -1;
+	b->pattern_bits = 0;
+}
+
+/*
+ * Marks the extent on line y with the same index as an overlapping extent of
+ * the previous line and accumulates the properties of the formed blob, or
+ * starts a new blob. Previous extents without significant overlap are the
+ * bottom of finished blobs and are stored on the way.
+ *
+ * Returns the next blob index.
+ */
+static inline __attribute__((always_inline)) int
+link_extent(struct blobwatch *bw, struct extent *extent, int y,
+	    struct extent **prev, struct extent *prev_end, int index,
+	    struct blob *blobs)
+{
+	struct extent *le = *prev;
+	int num_blobs = bw->max_blobs;
+	int center = (extent->start + extent->end) / 2;
+
+	extent->index = index;
+
+	if (le && index < num_blobs) {
+		/*
+		 * Previous extents without significant overlap are the
+		 * bottom of finished blobs. Store them into an array.
+		 */
+		while (le < prev_end && le->end < center &&
+		       le->index < num_blobs)
+			store_blob(le++, y, blobs);
+
+		/*
+		 * A previous extent with significant overlap is
+		 * considered to be part of the same blob.
+		 */
+		if (le < prev_end &&
+		    le->start <= center && le->end > center) {
+			extent->top = le->top;
+			extent->left = min(extent->start, le->left);
+			extent->right = max(extent->end, le->right);
+			extent->area += le->area;
+			moments_add(&extent->m, &le->m);
+			extent->index = le->index;
+			le++;
+		}
+	}
+
+	/*
+	 * If this extent is not part of a previous blob, increment the
+	 * blob index.
+	 */
+	if (extent->index == index) {
+		extent->top = y;
+		extent->left = extent->start;
+		extent->right = extent->end;
+		index++;
+	}
+
+	*prev = le;
+
+	return index;
+}
+
+/*
+ * Stores the blobs ending on the previous line after the last extent of line
+ * y was linked, and all blobs of the last line.
+ */
+static inline __attribute__((always_inline)) void
+finish_line(struct blobwatch *bw, struct extent_line *el, int y, int y_last,
+	    struct extent *le, struct extent *le_end, struct blob *blobs)
+{
+	struct extent *extent;
+	int num_blobs = bw->max_blobs;
+
+	if (le) {
+		/*
+		 * If there are no more extents on this line, all remaining
+		 * extents in the previous line are finished blobs. Store them.
+		 */
+		while (le < le_end && le->index < num_blobs)
+			store_blob(le++, y, blobs);
+	}
+
+	if (y == y_last) {
+		/* All extents of the last line are finished blobs, too. */
+		for (extent = el->extents; extent < el->extents + el->num;
+		     extent++) {
+			if (extent->index < num_blobs)
+				store_blob(extent, y, blobs);
+		}
+	}
+}
+
+/*
+ * Collects contiguous ranges of pixels with values larger than a threshold of
+ * 0x9f in a given scanline and stores them in extents. Processing stops after
+ * the maximum number of extents per line.
+ * Extents are marked with the same index as overlapping extents of the previous
+ * scanline, and properties of the formed blobs are accumulated.
+ *
+ * Returns the number of extents found.
+ */
+static inline __attribute__((always_inline)) int
+scan_line(struct blobwatch *bw, uint8_t *line, int width, int stride,
+	  int y_last, int y, struct extent_line *el,
+	  struct extent_line *prev_el, int index, struct blob *blobs,
+	  scan_fn find_bright, scan_fn find_dark,
+	  const struct mask_span *span, const struct mask_span *span_end)
+{
+	struct extent *le_end = NULL;
+	struct extent *le = NULL;
+	struct extent *extent = el->extents;
+	int num_extents = bw->max_extents;
+	int x, e = 0;
+
+	if (prev_el) {
+		le = prev_el->extents;
+		le_end = le + prev_el->num;
+	}
+
+	for (x = 0; x < width; x++) {
+		int limit = width;
+		uint64_t lw = 0, lx = 0, lxx = 0;
+		int start, end, i;
+
+		/* Skip to the first pixel value exceeding threshold */
+		x = find_bright(line, x, width, bw->threshold);
+		if (x == width)
+			break;
+
+		/* Skip masked static regions, and end extents in front of them */
+		while (span < span_end && span->end <= x)
+			span++;
+		if (span < span_end) {
+			if (x >= span->start) {
+				x = span->end - 1;
+				continue;
+			}
+			limit = span->start;
+		}
+
+		start = x++;
+
+		/* Skip to the first pixel value below threshold */
+		x = find_dark(line, x, limit, bw->threshold);
+
+		end = x - 1;
+		/* Filter out extents shorter than min_extent_length */
+		if (x - start < bw->min_extent_length)
+			continue;
+
+		extent->start = start;
+		extent->end = end;
+		extent->area = x - start;
+
+		/* Accumulate the intensity-weighted moments of this extent */
+		for (i = start; i <= end; i++) {
+			uint32_t w = line[stride * i] - bw->threshold;
+
+			lw += w;
+			lx += w * i;
+			lxx += (uint64_t)(w * i) * i;
+		}
+		extent->m.w = lw;
+		extent->m.x = lx;
+		extent->m.y = lw * y;
+		extent->m.xx = lxx;
+		extent->m.xy = lx * y;
+		extent->m.yy = lw * y * y;
+
+		index = link_extent(bw, extent, y, &le, le_end, index, blobs);
+
+		if (++e == num_extents)
+			break;
+		extent++;
+	}
+
+	el->num = e;
+
+	finish_line(bw, el, y, y_last, le, le_end, blobs);
+
+	return index;
+}
+
+/*
+ * Collects the extents of the lines y to y_end - 1 into the extent_line
+ * array. If top is set, y is the first line of a band or frame and has no
+ * preceding line to connect to.
+ *
+ * Returns the next blob index.
+ */
+static inline __attribute__((always_inline)) int
+scan_lines(struct blobwatch *bw, uint8_t *line, int width, int stride,
+	   int pitch, int y, int y_end, int y_last, bool top, int index,
+	   struct blob *blobs, scan_fn find_bright, scan_fn find_dark)
+{
+	struct extent_line *el = bw->el + y;
+
+	for (; y < y_end; y++, el++, line += pitch) {
+		int row = y >> MASK_CELL_SHIFT;
+		const struct mask_span *span = bw->mask_spans +
+					       row * MAX_MASK_SPANS;
+
+		index = scan_line(bw, line, width, stride, y_last, y, el,
+				  top ? NULL : el - 1, index, blobs,
+				  find_bright, find_dark, span,
+				  span + bw->mask_num_spans[row]);
+		top = false;
+	}
+
+	return index;
+}
+
+static int scan_lines_generic(struct blobwatch *bw, uint8_t *line, int y,
+			      int y_end, int y_last, bool top, int index,
+			      struct blob *blobs)
+{
+	return scan_lines(bw, line, bw->width, bw->stride, bw->pitch, y, y_end,
+			  y_last, top, index, blobs, bw->find_bright,
+			  bw->find_dark);
+}
+
+/*
+ * Frame kernels specialized for the greyscale sensors of known width, with
+ * constant line length and directly inlined search kernels, so that the
+ * compiler can drop the scalar tails and the indirect calls.
+ */
+#if defined(__ARM_NEON)
+#define find_bright_base	find_bright_neon
+#define find_dark_base		find_dark_neon
+#elif defined(__SSE2__)
+#define find_bright_base	find_bright_sse2
+#define find_dark_base		find_dark_sse2
+#else
+#define find_bright_base	find_bright_scalar
+#define find_dark_base		find_dark_scalar
+#endif
+
+#define SCAN_LINES_KERNEL(name, attr, w, bright, dark)			\
+attr static int name(struct blobwatch *bw, uint8_t *line, int y,	\
+		     int y_end, int y_last, bool top, int index,	\
+		     struct blob *blobs)				\
+{									\
+	return scan_lines(bw, line, w, 1, w, y, y_end, y_last, top,	\
+			  index, blobs, bright, dark);			\
+}
+
+/* Windows Mixed Reality and HoloLens tracking cameras */
+SCAN_LINES_KERNEL(scan_lines_640, , 640, find_bright_base, find_dark_base)
+/* DK2 Positional Tracker */
+SCAN_LINES_KERNEL(scan_lines_752, , 752, find_bright_base, find_dark_base)
+/* Rift CV1 Sensor */
+SCAN_LINES_KERNEL(scan_lines_1280, , 1280, find_bright_base, find_dark_base)
+
+#if defined(HAVE_AVX2_KERNELS)
+#define AVX2 __attribute__((target("avx2")))
+SCAN_LINES_KERNEL(scan_lines_640_avx2, AVX2, 640, find_bright_avx2,
+		  find_dark_avx2)
+SCAN_LINES_KERNEL(scan_lines_752_avx2, AVX2, 752, find_bright_avx2,
+		  find_dark_avx2)
+SCAN_LINES_KERNEL(scan_lines_1280_avx2, AVX2, 1280, find_bright_avx2,
+		  find_dark_avx2)
+#undef AVX2
+#endif
+
+static const struct {
+	int width;
+	lines_fn base;
+	lines_fn avx2;
+} lines_kernels[] = {
+#if defined(HAVE_AVX2_KERNELS)
+	{ 640, scan_lines_640, scan_lines_640_avx2 },
+	{ 752, scan_lines_752, scan_lines_752_avx2 },
+	{ 1280, scan_lines_1280, scan_lines_1280_avx2 },
+#else
+	{ 640, scan_lines_640, NULL },
+	{ 752, scan_lines_752, NULL },
+	{ 1280, scan_lines_1280, NULL },
+#endif
+};
+
+/*
+ * Selects a specialized frame kernel matching the frame width and the
+ * search kernels chosen for the CPU, or the generic one.
+ */
+static lines_fn blobwatch_select_lines_kernel(struct blobwatch *bw)
+{
+	unsigned int i;
+
+	if (bw->stride != 1)
+		return scan_lines_generic;
+
+	for (i = 0; i < sizeof(lines_kernels) / sizeof(lines_kernels[0]); i++) {
+		if (lines_kernels[i].width != bw->width)
+			continue;
+		if (bw->find_bright == find_bright_base)
+			return lines_kernels[i].base;
+		if (lines_kernels[i].avx2 && bw->find_bright == find_bright_avx2)
+			return lines_kernels[i].avx2;
+	}
+
+	return scan_lines_generic;
+}
+
+/*
+ * Collects extents from all scanlines in a band and stores them in the
+ * extent_line array el. Blobs are stored in the band with band local indices.
+ */
+static void process_band(struct blobwatch *bw, struct blob_band *band,
+			 uint8_t *frame)
+{
+	int index;
+
+	index = bw->scan_lines(bw, frame + band->y0 * bw->pitch, band->y0,
+			       band->y1 + 1, band->y1, true, 0, band->blobs);
+
+	band->num_blobs = min(bw->max_blobs, index);
+}
+
+static int find_root(int *parent, int i)
+{
+	while (parent[i] != i)
+		i = parent[i] = parent[parent[i]];
+	return i;
+}
+
+/*
+ * Joins blobs that cross band boundaries. The last scanline of each band is
+ * matched against the first scanline of the next band using the same overlap
+ * criterion as process_scanline, and the bounding boxes, areas and moments of
+ * joined blobs are combined.
+ */
+static void merge_bands(struct blobwatch *bw, struct blobservation *ob)
+{
+	int *left = bw->left;
+	int *right = bw->right;
+	int *top = bw->top;
+	int *bottom = bw->bottom;
+	uint32_t *area = bw->area;
+	struct merge_moments *m = bw->moments;
+	int *parent = bw->parent;
+	int offset[MAX_BANDS + 1];
+	int i, k, n = 0;
+
+	for (k = 0; k < bw->num_bands; k++) {
+		struct blob_band *band = &bw->bands[k];
+
+		offset[k] = n;
+		for (i = 0; i < band->num_blobs; i++, n++) {
+			struct blob *b = &band->blobs[i];
+
+			/* Recover the exact bounding box from store_blob */
+			left[n] = b->x - (b->width - 1) / 2;
+			right[n] = left[n] + b->width - 1;
+			top[n] = b->y - (b->height - 1) / 2;
+			bottom[n] = top[n] + b->height - 1;
+			area[n] = b->area;
+			m[n].w = b->weight;
+			m[n].x = b->weight * (double)b->cx;
+			m[n].y = b->weight * (double)b->cy;
+			m[n].xx = b->weight * (b->mxx + (double)b->cx * b->cx);
+			m[n].xy = b->weight * (b->mxy + (double)b->cx * b->cy);
+			m[n].yy = b->weight * (b->myy + (double)b->cy * b->cy);
+			parent[n] = n;
+		}
+	}
+	offset[k] = n;
+
+	for (k = 0; k < bw->num_bands - 1; k++) {
+		struct extent_line *upper = &bw->el[bw->bands[k].y1];
+		struct extent_line *lower = &bw->el[bw->bands[k + 1].y0];
+		struct extent *le = upper->extents;
+		struct extent *le_end = le + upper->num;
+		struct extent *e;
+
+		/*
+		 * process_scanline stores blobs finished on line y with the
+		 * following line as bottom, except on the last line. Blobs
+		 * ending at the bottom of a band are no exception.
+		 */
+		for (e = le; e < le_end; e++) {
+			if (e->index < offset[k + 1] - offset[k])
+				bottom[offset[k] + e->index]++;
+		}
+
+		for (e = lower->extents; e < lower->extents + lower->num; e++) {
+			int center = (e->start + e->end) / 2;
+			int a, b;
+
+			while (le < le_end && le->end < center)
+				le++;
+			if (le == le_end)
+				break;
+			if (le->start > center || le->end <= center)
+				continue;
+
+			if (le->index < offset[k + 1] - offset[k] &&
+			    e->index < offset[k + 2] - offset[k + 1]) {
+				a = find_root(parent, offset[k] + le->index);
+				b = find_root(parent, offset[k + 1] + e->index);
+				/* The earlier blob keeps its place */
+				if (a < b)
+					parent[b] = a;
+				else
+					parent[a] = b;
+			}
+			le++;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		int r = find_root(parent, i);
+
+		if (r == i)
+			continue;
+		left[r] = min(left[r], left[i]);
+		right[r] = max(right[r], right[i]);
+		top[r] = min(top[r], top[i]);
+		bottom[r] = max(bottom[r], bottom[i]);
+		area[r] += area[i];
+		m[r].w += m[i].w;
+		m[r].x += m[i].x;
+		m[r].y += m[i].y;
+		m[r].xx += m[i].xx;
+		m[r].xy += m[i].xy;
+		m[r].yy += m[i].yy;
+	}
+
+	ob->num_blobs = 0;
+	for (i = 0; i < n && ob->num_blobs < bw->max_blobs; i++) {
+		struct blob *b = &ob->blobs[ob->num_blobs];
+
+		if (parent[i] != i)
+			continue;
+
+		for (k = 0; offset[k + 1] <= i; k++)
+			;
+		*b = bw->bands[k].blobs[i - offset[k]];
+		b->x = (left[i] + right[i]) / 2;
+		b->y = (top[i] + bottom[i]) / 2;
+		b->width = right[i] - left[i] + 1;
+		b->height = bottom[i] - top[i] + 1;
+		b->area = area[i];
+		blob_set_moments(b, m[i].w, m[i].x, m[i].y, m[i].xx, m[i].xy,
+				 m[i].yy);
+		ob->num_blobs++;
+	}
+}
+
+/*
+ * Collects extents from all scanlines in a frame, distributing horizontal
+ * bands over the job scheduler, and stores the blobs found in ob.
+ *
+ * Large frames are scanned at full resolution, too. Max-pooling them for a
+ * coarse to fine search still reads every pixel, and this scan already is a
+ * SIMD threshold pass. On x86-64, a pyramid search of 1280x960 frames found
+ * the same blobs but took about twice as long.
+ */
+static void process_frame(struct blobwatch *bw, uint8_t *frame,
+			  struct blobservation *ob)
+{
+	int i;
+
+	bw->frame = frame;
+	for (i = 1; i < bw->num_bands; i++) {
+		job_init(&bw->bands[i].job, blobwatch_band_job, &bw->bands[i]);
+		job_submit(&bw->bands[i].job);
+	}
+
+	process_band(bw, &bw->bands[0], frame);
+
+	if (bw->num_bands == 1) {
+		ob->num_blobs = bw->bands[0].num_blobs;
+		memcpy(ob->blobs, bw->bands[0].blobs,
+		       ob->num_blobs * sizeof(struct blob));
+		return;
+	}
+
+	for (i = 1; i < bw->num_bands; i++)
+		job_wait(&bw->bands[i].job);
+
+	merge_bands(bw, ob);
+}
+
+static bool roi_overlaps(struct roi *a, struct roi *b)
+{
+	return a->x0 <= b->x1 && b->x0 <= a->x1 &&
+	       a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+/*
+ * Adds a region of interest to the list, merging it with all regions it
+ * overlaps, so that no pixel is scanned twice.
+ */
+static void add_roi(struct blobwatch *bw, struct roi *r)
+{
+	int i = 0;
+
+	while (i < bw->num_rois) {
+		struct roi *o = &bw->rois[i];
+
+		if (!roi_overlaps(r, o)) {
+			i++;
+			continue;
+		}
+
+		r->x0 = min(r->x0, o->x0);
+		r->y0 = min(r->y0, o->y0);
+		r->x1 = max(r->x1, o->x1);
+		r->y1 = max(r->y1, o->y1);
+		*o = bw->rois[--bw->num_rois];
+		/* The grown region may overlap earlier ones, start over */
+		i = 0;
+	}
+
+	bw->rois[bw->num_rois++] = *r;
+}
+
+/*
+ * Returns the predicted shift of the LED a blob was identified as or, for
+ * unidentified blobs, of the closest LED, or NULL if there is none.
+ */
+static const struct blobwatch_led_shift *
+blob_find_shift(const struct blobwatch *bw, const struct blob *b)
+{
+	const struct blobwatch_led_shift *shift = NULL;
+	float best = TRACK_SHIFT_RADIUS * TRACK_SHIFT_RADIUS;
+	int i;
+
+	if (!bw->num_shifts)
+		return NULL;
+
+	if (b->led_id >= 0) {
+		if (b->object_id != bw->shift_object ||
+		    b->led_id >= bw->num_shifts ||
+		    !bw->shifts[b->led_id].valid)
+			return NULL;
+		return &bw->shifts[b->led_id];
+	}
+
+	for (i = 0; i < bw->num_shifts; i++) {
+		float dx = bw->shifts[i].x - b->cx;
+		float dy = bw->shifts[i].y - b->cy;
+
+		if (bw->shifts[i].valid && dx * dx + dy * dy < best) {
+			best = dx * dx + dy * dy;
+			shift = &bw->shifts[i];
+		}
+	}
+
+	return shift;
+}
+
+/*
+ * Returns the position of the blob's centroid in the next frame, predicted
+ * from the shift of its LED, if known, or otherwise by its motion filter.
+ */
+static inline void blob_predict(const struct blobwatch *bw,
+				const struct blob *b, int *x, int *y)
+{
+	const struct blobwatch_led_shift *shift = blob_find_shift(bw, b);
+
+	if (shift) {
+		*x = lrintf(b->cx + shift->dx);
+		*y = lrintf(b->cy + shift->dy);
+		return;
+	}
+
+	*x = lrintf(b->cx + b->fvx + 0.5f * b->fax);
+	*y = lrintf(b->cy + b->fvy + 0.5f * b->fay);
+}
+
+/*
+ * Updates the motion filter of blob b2 from its predecessor b1 in the last
+ * frame. The position follows the measured centroid, while velocity and
+ * acceleration are corrected by the prediction error. The gate radius
+ * follows the smoothed prediction error, so that tracks with erratic motion
+ * are searched for in a larger area.
+ */
+static void blob_update_motion(struct blob *b2, const struct blob *b1)
+{
+	float rx, ry, err;
+
+	if (b1->age == 0) {
+		/* Second observation, only the velocity is known */
+		b2->fvx = b2->cx - b1->cx;
+		b2->fvy = b2->cy - b1->cy;
+		b2->fax = 0.0f;
+		b2->fay = 0.0f;
+		b2->gate = b1->gate;
+		return;
+	}
+
+	rx = b2->cx - (b1->cx + b1->fvx + 0.5f * b1->fax);
+	ry = b2->cy - (b1->cy + b1->fvy + 0.5f * b1->fay);
+	b2->fvx = b1->fvx + b1->fax + TRACK_VELOCITY_GAIN * rx;
+	b2->fvy = b1->fvy + b1->fay + TRACK_VELOCITY_GAIN * ry;
+	b2->fax = b1->fax + TRACK_ACCEL_GAIN * rx;
+	b2->fay = b1->fay + TRACK_ACCEL_GAIN * ry;
+
+	err = fmaxf(fabsf(rx), fabsf(ry));
+	b2->gate = 0.7f * b1->gate + 0.3f * (TRACK_GATE_MIN + 3.0f * err);
+	b2->gate = fminf(fmaxf(b2->gate, TRACK_GATE_MIN), TRACK_GATE_MAX);
+}
+
+/*
+ * Builds the list of regions of interest around the estimated next positions
+ * of all blobs in the previous observation.
+ */
+static void predict_rois(struct blobwatch *bw, struct blobservation *last_ob)
+{
+	int i;
+
+	bw->num_rois = 0;
+
+	for (i = 0; i < last_ob->num_blobs; i++) {
+		struct blob *b = &last_ob->blobs[i];
+		int x, y, pad_x, pad_y;
+		struct roi r;
 
-void blobwatch_set_flicker(bool enable)
-{
-	rift_flicker = enable;
+		blob_predict(bw, b, &x, &y);
+		pad_x = b->width / 2 + (int)b->gate + ROI_PADDING;
+		pad_y = b->height / 2 + (int)b->gate + ROI_PADDING;
+
+		r.x0 = max(x - pad_x, 0);
+		r.y0 = max(y - pad_y, 0);
+		r.x1 = min(x + pad_x, bw->width - 1);
+		r.y1 = min(y + pad_y, bw->height - 1);
+		if (r.x0 > r.x1 || r.y0 > r.y1)
+			continue;
+
+		add_roi(bw, &r);
+	}
 }
 
 /*
- * Allocates and initializes blobwatch structure.
+ * Translates the masked spans of line y into the coordinates of a region
+ * starting at x0.
  *
- * Returns the newly allocated blobwatch structure.
+ * Returns the number of spans overlapping the region.
  */
-struct blobwatch *blobwatch_new(int width, int height)
+static int roi_mask_spans(struct blobwatch *bw, int y, int x0, int width,
+			  struct mask_span *spans)
 {
-	struct blobwatch *bw = malloc(sizeof(*bw));
+	int row = y >> MASK_CELL_SHIFT;
+	const struct mask_span *span = bw->mask_spans + row * MAX_MASK_SPANS;
+	int i, n = 0;
 
-	if (!bw)
-		return NULL;
+	for (i = 0; i < bw->mask_num_spans[row]; i++) {
+		int start = span[i].start - x0;
+		int end = span[i].end - x0;
 
-	memset(bw, 0, sizeof(*bw));
-	bw->width = width;
-	bw->height = height;
-	bw->last_observation = -1;
-	bw->debug = true;
-	bw->el = calloc(height, sizeof(*bw->el));
+		if (end <= 0 || start >= width)
+			continue;
+		spans[n].start = max(start, 0);
+		spans[n].end = min(end, width);
+		n++;
+	}
 
-	return bw;
+	return n;
 }
 
 /*
- * Stores blob information collected in the last extent e into the blob
- * array b at index e->index.
+ * Collects blobs inside a single region of interest and appends them to the
+ * observation.
+ *
+ * Returns false if a blob touches the region boundary and may be clipped.
  */
-static inline void store_blob(struct extent *e, int y, struct blob *b)
+static bool process_roi(struct blobwatch *bw, uint8_t *frame, struct roi *r,
+			struct blobservation *ob)
 {
-	b += e->index;
-	b->x = (e->left + e->right) / 2;
-	b->y = (e->top + y) / 2;
-	b->vx = 0;
-	b->vy = 0;
-	b->width = e->right - e->left + 1;
-	b->height = y - e->top + 1;
-	b->area = e->area;
-	b->age = 0;
-	b->track_index = -1;
-	b->pattern = 0;
-	b->led_id = -1;
+	struct blob *blobs = bw->roi_blobs;
+	struct extent_line *el = bw->el + r->y0;
+	uint8_t *line = frame + r->y0 * bw->pitch + r->x0 * bw->stride;
+	int width = r->x1 - r->x0 + 1;
+	bool complete = true;
+	int index = 0;
+	int i, y;
+
+	for (y = r->y0; y <= r->y1; y++, line += bw->pitch, el++) {
+		struct mask_span spans[MAX_MASK_SPANS];
+		int n = roi_mask_spans(bw, y, r->x0, width, spans);
+
+		index = scan_line(bw, line, width, bw->stride, r->y1, y, el,
+				  y == r->y0 ? NULL : el - 1, index, blobs,
+				  bw->find_bright, bw->find_dark, spans,
+				  spans + n);
+	}
+
+	for (i = 0; i < min(index, bw->max_blobs); i++) {
+		struct blob *b = &blobs[i];
+		int left = b->x - (b->width - 1) / 2;
+		int right = left + b->width - 1;
+		int top = b->y - (b->height - 1) / 2;
+		int bottom = top + b->height - 1;
+
+		if ((left == 0 && r->x0 > 0) ||
+		    (right == width - 1 && r->x1 < bw->width - 1) ||
+		    (top == r->y0 && r->y0 > 0) ||
+		    (bottom >= r->y1 && r->y1 < bw->height - 1))
+			complete = false;
+
+		if (ob->num_blobs == bw->max_blobs)
+			return false;
+
+		b->x += r->x0;
+		b->cx += r->x0;
+		ob->blobs[ob->num_blobs++] = *b;
+	}
+
+	return complete;
 }
 
 /*
- * Collects contiguous ranges of pixels with values larger than a threshold of
- * 0x9f in a given scanline and stores them in extents. Processing stops after
- * num_extents.
- * Extents are marked with the same index as overlapping extents of the previous
- * scanline, and properties of the formed blobs are accumulated.
- *
- * Returns the number of extents found.
+ * Returns the number of blobs of the last observation that are expected to
+ * be found again in the current frame. Identified LEDs that their blinking
+ * pattern dims at the current phase may fall below the threshold, so they
+ * are not counted.
  */
-static int process_scanline(uint8_t *line, int width, int height, int y,
-			    struct extent_line *el, struct extent_line *prev_el,
-			    int index, struct blobservation *ob)
+static int expected_blobs(struct blobservation *last_ob,
+			  uint8_t led_pattern_phase, struct leds **leds,
+			  int num_objects)
 {
-	struct extent *le_end = prev_el->extents;
-	struct extent *le = prev_el->extents;
-	struct extent *extent = el->extents;
-	struct blob *blobs = ob->blobs;
-	int num_extents = MAX_EXTENTS_PER_LINE;
-	int num_blobs = MAX_BLOBS_PER_FRAME;
-	int center;
-	int x, e = 0;
+	int count = last_ob->num_blobs;
+	int i;
 
-	if (prev_el)
-		le_end += prev_el->num;
+	if (led_pattern_phase >= LED_PATTERN_BITS)
+		return count;
 
-	for (x = 0; x < width; x++) {
-		int start, end;
+	for (i = 0; i < last_ob->num_blobs; i++) {
+		struct blob *b = &last_ob->blobs[i];
 
-		/* Loop until pixel value exceeds threshold */
-		if (line[x] <= THRESHOLD)
+		if (b->led_id < 0 || b->led_id >= LED_MAX_CANDIDATES ||
+		    b->object_id >= num_objects)
 			continue;
+		if (leds[b->object_id]->bit_masks[led_pattern_phase][0] &
+		    (1ULL << b->led_id))
+			count--;
+	}
 
-		start = x++;
+	return count;
+}
+
+/*
+ * Scans only the regions around predicted blob positions.
+ *
+ * Returns false if blobs were lost or clipped, in which case the frame has to
+ * be scanned completely. Blinking LEDs that are expected to be dimmed in the
+ * current frame do not count as lost.
+ */
+static bool process_rois(struct blobwatch *bw, uint8_t *frame,
+			 struct blobservation *last_ob,
+			 struct blobservation *ob, uint8_t led_pattern_phase,
+			 struct leds **leds, int num_objects)
+{
+	int i;
 
-		/* Loop until pixel value falls below threshold */
-		while (x < width && line[x] > THRESHOLD)
-			x++;
+	predict_rois(bw, last_ob);
 
-		end = x - 1;
-		/* Filter out single pixel and two-pixel extents */
-		if (end < start + 2)
-			continue;
+	ob->num_blobs = 0;
+	for (i = 0; i < bw->num_rois; i++) {
+		if (!process_roi(bw, frame, &bw->rois[i], ob))
+			return false;
+	}
 
-		center = (start + end) / 2;
+	return ob->num_blobs >= expected_blobs(last_ob, led_pattern_phase,
+					       leds, num_objects);
+}
 
-		extent->start = start;
-		extent->end = end;
-		extent->index = index;
-		extent->area = x - start;
+static inline int grid_col(struct blobwatch *bw, int x)
+{
+	return min(max(x, 0) >> GRID_CELL_SHIFT, bw->grid_cols - 1);
+}
 
-		if (prev_el && index < num_blobs) {
-			/*
-			 * Previous extents without significant overlap are the
-			 * bottom of finished blobs. Store them into an array.
-			 */
-			while (le < le_end && le->end < center &&
-			       le->index < num_blobs)
-				store_blob(le++, y, blobs);
-
-			/*
-			 * A previous extent with significant overlap is
-			 * considered to be part of the same blob.
-			 */
-			if (le < le_end &&
-			    le->start <= center && le->end > center) {
-				extent->top = le->top;
-				extent->left = min(extent->start, le->left);
-				extent->right = max(extent->end, le->right);
-				extent->area += le->area;
-				extent->index = le->index;
-				le++;
-			}
-		}
+static inline int grid_row(struct blobwatch *bw, int y)
+{
+	return min(max(y, 0) >> GRID_CELL_SHIFT, bw->grid_rows - 1);
+}
 
-		/*
-		 * If this extent is not part of a previous blob, increment the
-		 * blob index.
-		 */
-		if (extent->index == index) {
-			extent->top = y;
-			extent->left = extent->start;
-			extent->right = extent->end;
-			index++;
-		}
+/*
+ * Sorts the blobs of the last observation into grid cells by their estimated
+ * next position. Blobs are inserted in reverse order, so that each cell lists
+ * its blobs in ascending index order.
+ */
+static void build_grid(struct blobwatch *bw, struct blobservation *last_ob)
+{
+	int i;
 
-		if (++e == num_extents)
-			break;
-		extent++;
-	}
+	for (i = 0; i < bw->grid_cols * bw->grid_rows; i++)
+		bw->grid[i] = -1;
 
-	if (prev_el) {
-		/*
-		 * If there are no more extents on this line, all remaining
-		 * extents in the previous line are finished blobs. Store them.
-		 */
-		while (le < le_end && le->index < num_blobs)
-			store_blob(le++, y, blobs);
-	}
+	bw->grid_max_gate = 0.0f;
+	for (i = last_ob->num_blobs - 1; i >= 0; i--) {
+		struct blob *b1 = &last_ob->blobs[i];
+		int x, y, cell;
 
-	el->num = e;
+		blob_predict(bw, b1, &x, &y);
+		cell = grid_row(bw, y) * bw->grid_cols + grid_col(bw, x);
 
-	if (y == height - 1) {
-		/* All extents of the last line are finished blobs, too. */
-		for (extent = el->extents; extent < el->extents + el->num;
-		     extent++) {
-			if (extent->index < num_blobs)
-				store_blob(extent, y, blobs);
-		}
+		bw->grid_x[i] = x;
+		bw->grid_y[i] = y;
+		bw->grid_gate[i] = b1->gate;
+		if (b1->gate > bw->grid_max_gate)
+			bw->grid_max_gate = b1->gate;
+		bw->grid_next[i] = bw->grid[cell];
+		bw->grid[cell] = i;
 	}
-
-	return index;
 }
 
 /*
- * Collects extents from all scanlines in a frame and stores them in
- * the extent_line array el.
+ * Finds the blob of the last observation whose predicted next position is
+ * closest to b2's centroid, among those within b2's bounding box enlarged
+ * by their gate radius. Only grid cells covered by the largest gate are
+ * checked.
+ *
+ * Returns the index of the blob in the last observation, or -1.
  */
-static void process_frame(uint8_t *lines, int width, int height,
-			  struct extent_line *el, struct blobservation *ob)
+static int find_predecessor(struct blobwatch *bw, struct blob *b2)
 {
-	struct extent_line *last_el;
-	int index = 0;
-	int y;
+	int gate = (int)ceilf(bw->grid_max_gate);
+	int x = lrintf(b2->cx);
+	int y = lrintf(b2->cy);
+	int col0 = grid_col(bw, x - b2->width / 2 - gate);
+	int col1 = grid_col(bw, x + b2->width / 2 + gate);
+	int row0 = grid_row(bw, y - b2->height / 2 - gate);
+	int row1 = grid_row(bw, y + b2->height / 2 + gate);
+	int best = INT32_MAX;
+	int found = -1;
+	int row, col, j;
 
-	ob->num_blobs = 0;
+	for (row = row0; row <= row1; row++) {
+		for (col = col0; col <= col1; col++) {
+			j = bw->grid[row * bw->grid_cols + col];
+			for (; j >= 0; j = bw->grid_next[j]) {
+				float g = bw->grid_gate[j];
+				int dx, dy;
 
-	index = process_scanline(lines, width, height, 0, el, NULL, 0, ob);
+				/* Distance to b1's predicted next position */
+				dx = abs(bw->grid_x[j] - x);
+				dy = abs(bw->grid_y[j] - y);
 
-	for (y = 1; y < height; y++) {
-		last_el = el++;
-		lines += width;
-		index = process_scanline(lines, width, height, y, el, last_el,
-					 index, ob);
+				/*
+				 * Check if b1's predicted next position falls
+				 * into b2's gated bounding box.
+				 */
+				if (dx > b2->width / 2 + g ||
+				    dy > b2->height / 2 + g)
+					continue;
+
+				if (dx * dx + dy * dy < best ||
+				    (dx * dx + dy * dy == best && j < found)) {
+					best = dx * dx + dy * dy;
+					found = j;
+				}
+			}
+		}
 	}
 
-	ob->num_blobs = min(MAX_BLOBS_PER_FRAME, index);
+	return found;
 }
 
 /*
- * Finds the first free tracking slot.
+ * Finds the first free tracking slot at or after *next_free. Slots are only
+ * taken, never released, during one frame, so the search position can be
+ * kept across calls.
  */
-static int find_free_track(uint8_t *tracked)
+static int find_free_track(uint16_t *tracked, int max_blobs, int *next_free)
 {
 	int i;
 
-	for (i = 0; i < MAX_BLOBS_PER_FRAME; i++) {
-		if (tracked[i] == 0)
+	for (i = *next_free; i < max_blobs; i++) {
+		if (tracked[i] == 0) {
+			*next_free = i + 1;
 			return i;
+		}
 	}
 
+	*next_free = max_blobs;
 	return -1;
 }
 
 /*
- * Detects blobs in the current frame and compares them with the observation
- * history.
+ * Masks the cells covered by compact blobs that were not identified as LEDs
+ * and did not change their area by more than 10%, as the blinking LEDs do,
+ * over a number of consecutive full frame scans.
  */
-void blobwatch_process(struct blobwatch *bw, uint8_t *frame,
-		       int width, int height, uint8_t led_pattern_phase,
-		       struct leds *leds, struct blobservation **output)
+static void learn_mask(struct blobwatch *bw, struct blobservation *ob)
+{
+	uint16_t frame = ++bw->mask_frame;
+	bool changed = false;
+	int i, col, row;
+
+	for (i = 0; i < ob->num_blobs; i++) {
+		struct blob *b = &ob->blobs[i];
+		int left = b->x - (b->width - 1) / 2;
+		int top = b->y - (b->height - 1) / 2;
+		int col0 = left >> MASK_CELL_SHIFT;
+		int col1 = (left + b->width - 1) >> MASK_CELL_SHIFT;
+		int row0 = top >> MASK_CELL_SHIFT;
+		int row1 = (top + b->height - 1) >> MASK_CELL_SHIFT;
+
+		if (b->led_id >= 0 || b->area < MASK_MIN_AREA ||
+		    2 * b->area < (uint32_t)b->width * b->height)
+			continue;
+
+		for (row = row0; row <= row1 && row < bw->mask_rows; row++) {
+			struct mask_cell *cells = bw->mask_cells +
+						  row * bw->mask_cols;
+
+			for (col = col0; col <= col1 && col < bw->mask_cols;
+			     col++) {
+				struct mask_cell *c = &cells[col];
+				bool stable = c->frame == (uint16_t)(frame - 1) &&
+					      b->area * 10 <= c->area * 11 &&
+					      b->area * 11 >= c->area * 10;
+
+				if (c->masked)
+					continue;
+				c->count = stable ? c->count + 1 : 1;
+				c->area = b->area;
+				c->frame = frame;
+				if (c->count >= MASK_LEARN_FRAMES) {
+					c->masked = true;
+					changed = true;
+				}
+			}
+		}
+	}
+
+	if (changed)
+		blobwatch_publish_mask(bw);
+}
+
+/*
+ * Compares the blobs detected in the current observation with the
+ * observation history.
+ */
+static void blobwatch_track(struct blobwatch *bw, uint8_t led_pattern_phase,
+			    struct leds **leds, int num_objects,
+			    struct blobservation **output)
 {
 	int last = bw->last_observation;
 	int current = (last + 1) % NUM_FRAMES_HISTORY;
 	struct blobservation *ob = &bw->history[current];
 	struct blobservation *last_ob = &bw->history[last];
-	struct extent_line *el = bw->el;
+	int next_free = 0;
 	int i, j;
 
-	process_frame(frame, width, height, el, ob);
-
 	/* If there is no previous observation, our work is done here */
 	if (bw->last_observation == -1) {
 		bw->last_observation = current;
+		bw->num_shifts = 0;
 		if (output)
 			*output = NULL;
 		return;
 	}
 
 	/* Otherwise track blobs over time */
-	memset(ob->tracked, 0, sizeof(uint8_t) * MAX_BLOBS_PER_FRAME);
+	memset(ob->tracked, 0, sizeof(*ob->tracked) * ob->max_blobs);
 
 	/*
 	 * Associate blobs found at a previous blobs' estimated next
 	 * positions with their predecessors.
 	 */
+	build_grid(bw, last_ob);
+
 	for (i = 0; i < ob->num_blobs; i++) {
 		struct blob *b2 = &ob->blobs[i];
+		struct blob *b1;
 
 		/* Filter out tall and wide (<= 1:2, >= 2:1) blobs */
 		if (2 * b2->width <= b2->height ||
 		    b2->width >= 2 * b2->height)
 			continue;
 
-		for (j = 0; j < last_ob->num_blobs; j++) {
-			struct blob *b1 = &last_ob->blobs[j];
-			int x, y, dx, dy;
-
-			/* Estimate b1's next position */
-			x = b1->x + b1->vx;
-			y = b1->y + b1->vy;
-
-			/* Absolute distance */
-			dx = abs(x - b2->x);
-			dy = abs(y - b2->y);
-
-			/*
-			 * Check if b1's estimated next position falls
-			 * into b2's bounding box.
-			 */
-			if (2 * dx > b2->width ||
-			    2 * dy > b2->height)
-				continue;
+		j = find_predecessor(bw, b2);
+		if (j < 0)
+			continue;
+		b1 = &last_ob->blobs[j];
 
-			b2->age = b1->age + 1;
-			if (b1->track_index >= 0 &&
-			    ob->tracked[b1->track_index] == 0) {
-				/* Only overwrite tracks that are not already set */
-				b2->track_index = b1->track_index;
-				ob->tracked[b2->track_index] = i + 1;
-				b2->pattern = b1->pattern;
-				b2->led_id = b1->led_id;
-			}
-			b2->vx = b2->x - b1->x;
-			b2->vy = b2->y - b1->y;
-			b2->last_area = b1->area;
-			break;
+		b2->age = b1->age + 1;
+		if (b1->track_index >= 0 &&
+		    ob->tracked[b1->track_index] == 0) {
+			/* Only overwrite tracks that are not already set */
+			b2->track_index = b1->track_index;
+			ob->tracked[b2->track_index] = i + 1;
+			b2->pattern = b1->pattern;
+			b2->pattern_bits = b1->pattern_bits;
+			memcpy(b2->candidates, b1->candidates,
+			       sizeof(b2->candidates));
+			b2->led_id = b1->led_id;
+			b2->object_id = b1->object_id;
 		}
+		blob_update_motion(b2, b1);
+		b2->vx = lrintf(b2->fvx);
+		b2->vy = lrintf(b2->fvy);
+		b2->last_area = b1->area;
 	}
 
 	/*
@@ -343,7 +1972,9 @@ void blobwatch_process(struct blobwatch *bw, uint8_t *frame,
 		struct blob *b2 = &ob->blobs[i];
 
 		if (b2->age > 0 && b2->track_index < 0)
-			b2->track_index = find_free_track(ob->tracked);
+			b2->track_index = find_free_track(ob->tracked,
+							  ob->max_blobs,
+							  &next_free);
 		if (b2->track_index >= 0)
 			ob->tracked[b2->track_index] = i + 1;
 	}
@@ -354,15 +1985,34 @@ void blobwatch_process(struct blobwatch *bw, uint8_t *frame,
 
 		if (b->track_index >= 0 &&
 		    ob->tracked[b->track_index] != i + 1) {
-			printf("Inconsistency! %d != %d\n",
-			       ob->tracked[b->track_index], i + 1);
+			log_ratelimited("Inconsistency! %d != %d\n",
+					ob->tracked[b->track_index], i + 1);
 		}
 	}
 
-	if (rift_flicker) {
+	if (rift_flicker &&
+	    __atomic_load_n(&rift_leds_steady, __ATOMIC_RELAXED)) {
+		/* Drop candidates recorded before the LEDs stopped blinking */
+		for (i = 0; i < ob->num_blobs; i++) {
+			ob->blobs[i].pattern_bits = 0;
+			memset(ob->blobs[i].candidates, 0,
+			       sizeof(ob->blobs[i].candidates));
+		}
+	} else if (rift_flicker) {
 		/* Identify blobs by their blinking pattern */
 		flicker_process(ob->blobs, ob->num_blobs, led_pattern_phase,
-				leds);
+				leds, num_objects);
+	}
+
+	if (bw->background_mask) {
+		/* Relearn after a number of frames, including ROI scans */
+		if (__atomic_exchange_n(&bw->mask_reset, false,
+					__ATOMIC_ACQ_REL) ||
+		    ++bw->mask_age >= MASK_RELEARN_INTERVAL)
+			blobwatch_clear_mask(bw);
+		/* Regions of interest do not cover static regions */
+		if (bw->frames_since_full_scan == 0)
+			learn_mask(bw, ob);
 	}
 
 	/* Return observed blobs */
@@ -370,4 +2020,243 @@ void blobwatch_process(struct blobwatch *bw, uint8_t *frame,
 		*output = ob;
 
 	bw->last_observation = current;
+	bw->num_shifts = 0;
+}
+
+/*
+ * Sets the predicted image space shifts of the LEDs of an object from the
+ * last frame to the next one, indexed by LED id. They are used to place
+ * the regions of interest and to associate blobs with their predecessors
+ * in the next processed frame only, instead of the per-track motion filter.
+ */
+void blobwatch_set_led_shifts(struct blobwatch *bw, int object_id,
+			      const struct blobwatch_led_shift *shifts,
+			      int num_leds)
+{
+	num_leds = min(max(num_leds, 0), BLOBWATCH_MAX_LED_SHIFTS);
+	if (!shifts)
+		num_leds = 0;
+
+	bw->shift_object = object_id;
+	bw->num_shifts = num_leds;
+	if (num_leds)
+		memcpy(bw->shifts, shifts, num_leds * sizeof(*shifts));
+}
+
+/*
+ * Detects blobs in the current frame and compares them with the observation
+ * history.
+ */
+void blobwatch_process(struct blobwatch *bw, uint8_t *frame,
+		       int width, int height, uint8_t led_pattern_phase,
+		       struct leds **leds, int num_objects,
+		       struct blobservation **output)
+{
+	int last = bw->last_observation;
+	int current = (last + 1) % NUM_FRAMES_HISTORY;
+	struct blobservation *ob = &bw->history[current];
+	struct blobservation *last_ob = &bw->history[last];
+
+	(void)width;
+	(void)height;
+
+	OUVRT_TRACE2(blobwatch_process_enter, bw, led_pattern_phase);
+
+	blobwatch_acquire_mask(bw);
+
+	if (bw->roi_tracking && last != -1 && last_ob->num_blobs > 0 &&
+	    bw->frames_since_full_scan < FULL_SCAN_INTERVAL &&
+	    process_rois(bw, frame, last_ob, ob, led_pattern_phase, leds,
+			 num_objects)) {
+		bw->frames_since_full_scan++;
+	} else {
+		process_frame(bw, frame, ob);
+		bw->frames_since_full_scan = 0;
+	}
+
+	blobwatch_track(bw, led_pattern_phase, leds, num_objects, output);
+
+	OUVRT_TRACE2(blobwatch_process_exit, bw, ob->num_blobs);
+}
+
+/*
+ * Starts incremental blob detection on a frame that is still being filled.
+ */
+void blobwatch_begin_frame(struct blobwatch *bw, uint8_t *frame)
+{
+	blobwatch_acquire_mask(bw);
+	bw->stream_frame = frame;
+	bw->stream_y = 0;
+	bw->stream_index = 0;
+}
+
+/*
+ * Collects extents from all scanlines that have been completed since the
+ * last call. num_lines is the total number of complete lines in the frame.
+ */
+void blobwatch_process_lines(struct blobwatch *bw, int num_lines)
+{
+	struct blob_band *band = &bw->bands[0];
+	int y = bw->stream_y;
+
+	if (!bw->stream_frame)
+		return;
+
+	num_lines = min(num_lines, bw->height);
+
+	if (y < num_lines) {
+		bw->stream_index = bw->scan_lines(bw,
+				bw->stream_frame + y * bw->pitch, y, num_lines,
+				bw->height - 1, y == 0, bw->stream_index,
+				band->blobs);
+	}
+
+	bw->stream_y = max(bw->stream_y, num_lines);
+}
+
+/*
+ * Processes the remaining scanlines of an incrementally detected frame and
+ * copies the detected blobs into the array blobs, which must be able to hold
+ * blobwatch_get_max_blobs() elements.
+ *
+ * Returns the number of blobs detected.
+ */
+int blobwatch_end_frame(struct blobwatch *bw, struct blob *blobs)
+{
+	struct blob_band *band = &bw->bands[0];
+	int num_blobs;
+
+	if (!bw->stream_frame)
+		return 0;
+
+	blobwatch_process_lines(bw, bw->height);
+	bw->stream_frame = NULL;
+
+	num_blobs = min(bw->max_blobs, bw->stream_index);
+	memcpy(blobs, band->blobs, num_blobs * sizeof(struct blob));
+
+	return num_blobs;
+}
+
+/*
+ * Compares previously detected blobs with the observation history. This
+ * only touches the observation history, so it may run on a different thread
+ * than the incremental detection of the next frame.
+ */
+void blobwatch_process_blobs(struct blobwatch *bw, struct blob *blobs,
+			     int num_blobs, uint8_t led_pattern_phase,
+			     struct leds **leds, int num_objects,
+			     struct blobservation **output)
+{
+	int current = (bw->last_observation + 1) % NUM_FRAMES_HISTORY;
+	struct blobservation *ob = &bw->history[current];
+
+	ob->num_blobs = min(bw->max_blobs, num_blobs);
+	memcpy(ob->blobs, blobs, ob->num_blobs * sizeof(struct blob));
+	bw->frames_since_full_scan = 0;
+
+	blobwatch_track(bw, led_pattern_phase, leds, num_objects, output);
+}
+
+/*
+ * Processes the remaining scanlines of an incrementally detected frame and
+ * compares the blobs with the observation history.
+ */
+void blobwatch_finish_frame(struct blobwatch *bw, uint8_t led_pattern_phase,
+			    struct leds **leds, int num_objects,
+			    struct blobservation **output)
+{
+	int num_blobs;
+
+	if (!bw->stream_frame) {
+		if (output)
+			*output = NULL;
+		return;
+	}
+
+	num_blobs = blobwatch_end_frame(bw, bw->roi_blobs);
+	blobwatch_process_blobs(bw, bw->roi_blobs, num_blobs,
+				led_pattern_phase, leds, num_objects, output);
+}
+
+/*
+ * Links bright runs that were already collected per scanline, for example by
+ * a GPU compute kernel, into blobs. runs contains runs_per_line entries for
+ * each line of the frame, of which num_runs[y] are valid on line y. The
+ * background mask is not applied to the runs.
+ *
+ * Returns the number of blobs stored in blobs, which must be able to hold
+ * blobwatch_get_max_blobs() elements.
+ */
+int blobwatch_process_runs(struct blobwatch *bw,
+			   const struct blobwatch_run *runs, int runs_per_line,
+			   const uint16_t *num_runs, struct blob *blobs)
+{
+	int index = 0;
+	int y;
+
+	for (y = 0; y < bw->height; y++, runs += runs_per_line) {
+		struct extent_line *el = bw->el + y;
+		struct extent *extent = el->extents;
+		struct extent *le_end = NULL;
+		struct extent *le = NULL;
+		int num = min(num_runs[y], bw->max_extents);
+		int i;
+
+		if (y > 0) {
+			le = el[-1].extents;
+			le_end = le + el[-1].num;
+		}
+
+		for (i = 0; i < num; i++, extent++) {
+			const struct blobwatch_run *r = &runs[i];
+
+			extent->start = r->start;
+			extent->end = r->end;
+			extent->area = r->end - r->start + 1;
+			extent->m.w = r->w;
+			extent->m.x = r->x;
+			extent->m.y = (uint64_t)r->w * y;
+			extent->m.xx = r->xx;
+			extent->m.xy = (uint64_t)r->x * y;
+			extent->m.yy = (uint64_t)r->w * y * y;
+
+			index = link_extent(bw, extent, y, &le, le_end, index,
+					    blobs);
+		}
+
+		el->num = num;
+
+		finish_line(bw, el, y, bw->height - 1, le, le_end, blobs);
+	}
+
+	return min(bw->max_blobs, index);
+}
+
+/*
+ * Resets the tracking state of a blob that was detected elsewhere, for
+ * example by a remote camera node, so that it enters tracking as new.
+ */
+void blobwatch_reset_blob(struct blob *b)
+{
+	b->vx = 0;
+	b->vy = 0;
+	b->fvx = 0.0f;
+	b->fvy = 0.0f;
+	b->fax = 0.0f;
+	b->fay = 0.0f;
+	b->gate = TRACK_GATE_INITIAL;
+	b->last_area = 0;
+	b->age = 0;
+	b->track_index = -1;
+	b->pattern = 0;
+	b->led_id = -1;
+	b->object_id = -1;
+	b->pattern_bits = 0;
+	memset(b->candidates, 0, sizeof(b->candidates));
+}
+
+int blobwatch_get_max_blobs(struct blobwatch *bw)
+{
+	return bw->max_blobs;
 }
@@ -11,7 +11,8 @@
 
 struct leds;
 
-#define MAX_BLOBS_PER_FRAME  42
+/* number of objects whose LEDs blobs can be identified as progressively */
+#define BLOB_MAX_OBJECTS	4
 
 struct blob {
 	/* center of bounding box */
@@ -24,28 +25,122 @@ struct blob {
 	uint16_t height;
 	uint32_t area;
 	uint32_t last_area;
+	/* intensity-weighted centroid and central second moments */
+	float cx;
+	float cy;
+	float mxx;
+	float mxy;
+	float myy;
+	/* sum of pixel values above threshold */
+	uint32_t weight;
 	uint32_t age;
+	/*
+	 * Constant acceleration motion filter of the track, with velocity and
+	 * acceleration in pixels per frame, and the association gate radius
+	 * around the predicted next position.
+	 */
+	float fvx;
+	float fvy;
+	float fax;
+	float fay;
+	float gate;
 	int16_t track_index;
 	uint16_t pattern;
 	int8_t led_id;
+	/* tracked object the LED belongs to, valid if led_id >= 0 */
+	int8_t object_id;
+	/* number of pattern bits known since the first brightness edge */
+	uint8_t pattern_bits;
+	/* LEDs of each object consistent with the known pattern bits */
+	uint64_t candidates[BLOB_MAX_OBJECTS];
 };
 
 /*
- * Stores all blobs observed in a single frame.
+ * Stores all blobs observed in a single frame. The tracked array contains
+ * the index + 1 of the blob occupying each tracking slot, or 0 if free.
  */
 struct blobservation {
 	int num_blobs;
-	struct blob blobs[MAX_BLOBS_PER_FRAME];
+	int max_blobs;
+	struct blob *blobs;
 	int tracked_blobs;
-	uint8_t tracked[MAX_BLOBS_PER_FRAME];
+	uint16_t *tracked;
 };
 
+/*
+ * Bright run [start, end] on a scanline with its intensity-weighted moments
+ * along the line, sums of w, w·x, and w·x² with the pixel values above
+ * threshold as weights w. The layout is shared with GPU compute kernels.
+ */
+struct blobwatch_run {
+	uint16_t start;
+	uint16_t end;
+	uint32_t w;
+	uint32_t x;
+	uint32_t reserved;
+	uint64_t xx;
+};
+
+/*
+ * Image position of an LED in the last frame and its predicted shift until
+ * the current frame, for example from the rotation measured by the IMU.
+ */
+struct blobwatch_led_shift {
+	bool valid;
+	float x;
+	float y;
+	float dx;
+	float dy;
+};
+
+/* maximum number of LEDs with predicted shifts */
+#define BLOBWATCH_MAX_LED_SHIFTS	64
+
 struct blobwatch;
 
+/* pixels brighter than this are part of blobs */
+#define BLOBWATCH_DEFAULT_THRESHOLD	0x9f
+/* shorter bright runs on a scanline are ignored */
+#define BLOBWATCH_DEFAULT_MIN_EXTENT	3
+
+enum blobwatch_format {
+	BLOBWATCH_FORMAT_GREY,
+	BLOBWATCH_FORMAT_YUYV,
+};
+
 struct blobwatch *blobwatch_new(int width, int height);
+struct blobwatch *blobwatch_new_with_capacity(int width, int height,
+					      int max_blobs, int max_extents);
+void blobwatch_free(struct blobwatch *bw);
 void blobwatch_process(struct blobwatch *bw, uint8_t *frame,
 		       int width, int height, uint8_t led_pattern_phase,
-		       struct leds *leds, struct blobservation **output);
+		       struct leds **leds, int num_objects,
+		       struct blobservation **output);
+void blobwatch_begin_frame(struct blobwatch *bw, uint8_t *frame);
+void blobwatch_process_lines(struct blobwatch *bw, int num_lines);
+int blobwatch_end_frame(struct blobwatch *bw, struct blob *blobs);
+void blobwatch_process_blobs(struct blobwatch *bw, struct blob *blobs,
+			     int num_blobs, uint8_t led_pattern_phase,
+			     struct leds **leds, int num_objects,
+			     struct blobservation **output);
+void blobwatch_finish_frame(struct blobwatch *bw, uint8_t led_pattern_phase,
+			    struct leds **leds, int num_objects,
+			    struct blobservation **output);
+int blobwatch_process_runs(struct blobwatch *bw,
+			   const struct blobwatch_run *runs, int runs_per_line,
+			   const uint16_t *num_runs, struct blob *blobs);
+void blobwatch_reset_blob(struct blob *b);
+int blobwatch_get_max_blobs(struct blobwatch *bw);
+void blobwatch_set_format(struct blobwatch *bw, enum blobwatch_format format);
+void blobwatch_set_roi_tracking(struct blobwatch *bw, bool enable);
+void blobwatch_set_background_mask(struct blobwatch *bw, bool enable);
+void blobwatch_set_threshold(struct blobwatch *bw, int threshold,
+			     int min_extent_length);
+void blobwatch_set_led_shifts(struct blobwatch *bw, int object_id,
+			      const struct blobwatch_led_shift *shifts,
+			      int num_leds);
 void blobwatch_set_flicker(bool enable);
+void blobwatch_set_leds_steady(bool steady);
+int blobwatch_find_run(const uint8_t *line, int x, int width, int *end);
 
 #endif /* __BLOBWATCH_H__*/
@@ -0,0 +1,162 @@
+/*
+ * Cache files in the user cache directory
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Calibration data read from devices and device state are cached in files
+ * below $XDG_CACHE_HOME/ouvrt, so that they do not have to be read from
+ * the device again.
+ */
+#include <glib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cache.h"
+
+/*
+ * Copy of the contents of a cache file to be written by the write pool
+ */
+struct cache_write {
+	char *filename;
+	gsize length;
+	char contents[];
+};
+
+/* single thread writing cache files in order, see ouvrt_cache_save_async */
+static GThreadPool *write_pool;
+static GMutex write_pool_lock;
+
+/*
+ * Returns the newly allocated path of the cache file with the given name,
+ * to be freed with g_free.
+ */
+char *ouvrt_cache_path(const char *format, ...)
+{
+	char *name, *filename;
+	va_list args;
+
+	va_start(args, format);
+	name = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	filename = g_build_filename(g_get_user_cache_dir(), "ouvrt", name,
+				    NULL);
+	g_free(name);
+
+	return filename;
+}
+
+/*
+ * Returns a newly allocated, NULL terminated array with the names of all
+ * cache files ending in suffix, to be freed with g_strfreev.
+ */
+char **ouvrt_cache_list(const char *suffix)
+{
+	GPtrArray *names = g_ptr_array_new();
+	const char *name;
+	char *path;
+	GDir *dir;
+
+	path = g_build_filename(g_get_user_cache_dir(), "ouvrt", NULL);
+	dir = g_dir_open(path, 0, NULL);
+	g_free(path);
+	if (dir) {
+		while ((name = g_dir_read_name(dir))) {
+			if (g_str_has_suffix(name, suffix))
+				g_ptr_array_add(names, g_strdup(name));
+		}
+		g_dir_close(dir);
+	}
+	g_ptr_array_add(names, NULL);
+
+	return (char **)g_ptr_array_free(names, FALSE);
+}
+
+/*
+ * Reads the contents of a cache file into a newly allocated, zero terminated
+ * buffer, to be freed with g_free. The length is optional.
+ *
+ * Returns true on success.
+ */
+bool ouvrt_cache_load(const char *filename, void *contents, size_t *length)
+{
+	gsize len;
+
+	if (!g_file_get_contents(filename, (gchar **)contents, &len, NULL))
+		return false;
+
+	if (length)
+		*length = len;
+
+	return true;
+}
+
+/*
+ * Writes a cache file, creating the cache directory if necessary. If length
+ * is -1, contents is a zero terminated string.
+ *
+ * Returns true on success.
+ */
+bool ouvrt_cache_save(const char *filename, const void *contents,
+		      gssize length)
+{
+	char *path;
+
+	path = g_path_get_dirname(filename);
+	g_mkdir_with_parents(path, 0755);
+	g_free(path);
+
+	return g_file_set_contents(filename, contents, length, NULL);
+}
+
+static void ouvrt_cache_write_worker(gpointer data,
+				     G_GNUC_UNUSED gpointer user_data)
+{
+	struct cache_write *job = data;
+
+	ouvrt_cache_save(job->filename, job->contents, job->length);
+
+	g_free(job->filename);
+	g_free(job);
+}
+
+/*
+ * Writes a copy of the contents to a cache file on a background thread, so
+ * that the caller does not block on the file system. Writes are completed
+ * in order, so a later write to the same file is never replaced by an
+ * earlier one. If length is -1, contents is a zero terminated string.
+ */
+void ouvrt_cache_save_async(const char *filename, const void *contents,
+			    gssize length)
+{
+	struct cache_write *job;
+	gsize len = length < 0 ? strlen(contents) : (gsize)length;
+
+	job = g_malloc(sizeof(*job) + len);
+	job->filename = g_strdup(filename);
+	job->length = len;
+	memcpy(job->contents, contents, len);
+
+	g_mutex_lock(&write_pool_lock);
+	if (!write_pool) {
+		write_pool = g_thread_pool_new(ouvrt_cache_write_worker, NULL,
+					       1, FALSE, NULL);
+	}
+	g_thread_pool_push(write_pool, job, NULL);
+	g_mutex_unlock(&write_pool_lock);
+}
+
+/*
+ * Waits until all cache files queued with ouvrt_cache_save_async are
+ * written and stops the write thread. Later writes start a new one.
+ */
+void ouvrt_cache_flush(void)
+{
+	g_mutex_lock(&write_pool_lock);
+	if (write_pool) {
+		g_thread_pool_free(write_pool, FALSE, TRUE);
+		write_pool = NULL;
+	}
+	g_mutex_unlock(&write_pool_lock);
+}
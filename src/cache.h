@@ -0,0 +1,21 @@
+/*
+ * Cache files in the user cache directory
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <glib.h>
+#include <stdbool.h>
+
+char *ouvrt_cache_path(const char *format, ...) G_GNUC_PRINTF(1, 2);
+char **ouvrt_cache_list(const char *suffix);
+bool ouvrt_cache_load(const char *filename, void *contents, size_t *length);
+bool ouvrt_cache_save(const char *filename, const void *contents,
+		      gssize length);
+void ouvrt_cache_save_async(const char *filename, const void *contents,
+			    gssize length);
+void ouvrt_cache_flush(void);
+
+#endif /* __CACHE_H__ */
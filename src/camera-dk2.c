@@ -13,31 +13,129 @@
 
 #include <glib-object.h>
 
+#include "cache.h"
 #include "camera-dk2.h"
 #include "camera-v4l2.h"
 #include "device.h"
 #include "esp570.h"
+#include "exposure.h"
 #include "mt9v034.h"
 
 #define WIDTH		752
 #define HEIGHT		480
 #define FRAMERATE	60
+/* maximum binning factor, multiplying the frame rate */
+#define BINNING_MAX	2
+
+/*
+ * Synchronised exposure limits in rows, and analog gain limits in 1/16
+ * steps (1x to 4x)
+ */
+#define EXPOSURE	11
+#define EXPOSURE_MIN	2
+#define EXPOSURE_MAX	22
+#define GAIN		16
+#define GAIN_MIN	16
+#define GAIN_MAX	64
 
 struct _OuvrtCameraDK2 {
 	OuvrtCameraV4L2 v4l2;
 
 	char *version;
 	bool sync;
+	struct exposure_control exposure;
+	/* binning factor of the current mode, and full resolution intrinsics */
+	int binning;
+	dmat3 full_camera_matrix;
 };
 
 G_DEFINE_TYPE(OuvrtCameraDK2, ouvrt_camera_dk2, OUVRT_TYPE_CAMERA_V4L2)
 
-static int camera_dk2_process_frame(G_GNUC_UNUSED OuvrtCamera *camera,
-				    G_GNUC_UNUSED void *raw)
+static int camera_dk2_binning = 1;
+/* frame rate of the mode the last started camera streams at */
+static int camera_dk2_framerate = FRAMERATE;
+
+/*
+ * Selects the binned high frame rate mode for all DK2 cameras started
+ * afterwards: factor 2 captures 376x240 frames at 120 Hz instead of 752x480
+ * at 60 Hz. This must be called before devices are started.
+ */
+void camera_dk2_set_binning(int factor)
 {
+	camera_dk2_binning = CLAMP(factor, 1, BINNING_MAX);
+	g_atomic_int_set(&camera_dk2_framerate,
+			 FRAMERATE * camera_dk2_binning);
+}
+
+/*
+ * Returns the frame rate of the mode the cameras actually stream at, to
+ * which the Rift DK2 exposure synchronisation signal must be set. This
+ * drops back to 60 Hz if a camera does not support the binned mode.
+ */
+int camera_dk2_get_framerate(void)
+{
+	return g_atomic_int_get(&camera_dk2_framerate);
+}
+
+/*
+ * Sets frame size and rate for the given binning factor, and scales the
+ * camera matrix to the binned pixel grid. Distortion is defined in
+ * normalized coordinates and does not change.
+ */
+static void camera_dk2_set_mode(OuvrtCameraDK2 *self, int binning)
+{
+	OuvrtCamera *camera = OUVRT_CAMERA(self);
+	const double * const A = self->full_camera_matrix.m;
+	double * const B = camera->camera_matrix.m;
+	int i;
+
+	self->binning = binning;
+	camera->width = WIDTH / binning;
+	camera->height = HEIGHT / binning;
+	camera->framerate = FRAMERATE * binning;
+
+	/* Binned pixel centers are at (x + 0.5) / binning - 0.5 */
+	for (i = 0; i < 9; i++)
+		B[i] = A[i];
+	B[0] = A[0] / binning;
+	B[2] = (A[2] + 0.5) / binning - 0.5;
+	B[4] = A[4] / binning;
+	B[5] = (A[5] + 0.5) / binning - 0.5;
+}
+
+/*
+ * Adjusts exposure and gain to keep the LED blobs small and bright, while
+ * exposure is synchronised to the Rift DK2 LEDs.
+ */
+static int camera_dk2_process_frame(OuvrtCamera *camera, void *raw,
+				    struct blobservation *ob)
+{
+	OuvrtCameraDK2 *self = OUVRT_CAMERA_DK2(camera);
+	struct exposure_control *ctl = &self->exposure;
+	int fd = camera->dev.fd;
+
+	if (!self->sync || !ob ||
+	    !exposure_control_update(ctl, raw, camera->width, camera->height,
+				     ob->blobs, ob->num_blobs))
+		return 0;
+
+	mt9v034_sensor_set_exposure(fd, ctl->exposure);
+	mt9v034_sensor_set_gain(fd, ctl->gain);
+
 	return 0;
 }
 
+/*
+ * Enables synchronised exposure and resets the exposure controller to the
+ * initial settings written by mt9v034_sensor_enable_sync().
+ */
+static void camera_dk2_enable_sync(OuvrtCameraDK2 *self, int fd)
+{
+	mt9v034_sensor_enable_sync(fd);
+	exposure_control_init(&self->exposure, EXPOSURE, EXPOSURE_MIN,
+			      EXPOSURE_MAX, GAIN, GAIN_MIN, GAIN_MAX);
+}
+
 /*
  * Starts streaming and sets up the sensor for the exposure synchronization
  * signal from the Rift DK2.
@@ -46,12 +144,31 @@ static int camera_dk2_process_frame(G_GNUC_UNUSED OuvrtCamera *camera,
  */
 static int camera_dk2_start(OuvrtDevice *dev)
 {
+	OuvrtDeviceClass *parent;
 	OuvrtCameraDK2 *self = OUVRT_CAMERA_DK2(dev);
 	int fd = self->v4l2.camera.dev.fd;
 	int ret;
 
-	/* Call camera_v4l2_start to start streaming */
-	ret = OUVRT_DEVICE_CLASS(ouvrt_camera_dk2_parent_class)->start(dev);
+	parent = OUVRT_DEVICE_CLASS(ouvrt_camera_dk2_parent_class);
+
+	/*
+	 * Configure sensor binning before the stream starts, so that the
+	 * first frames already arrive in the selected mode.
+	 */
+	camera_dk2_set_mode(self, camera_dk2_binning);
+	ret = mt9v034_sensor_set_binning(fd, self->binning);
+	if (ret == 0) {
+		/* Call camera_v4l2_start to start streaming */
+		ret = parent->start(dev);
+	}
+	if (ret < 0 && self->binning > 1) {
+		g_print("Camera DK2: Binned mode not supported, using %dx%d\n",
+			WIDTH, HEIGHT);
+		camera_dk2_set_mode(self, 1);
+		ret = mt9v034_sensor_set_binning(fd, 1);
+		if (ret == 0)
+			ret = parent->start(dev);
+	}
 	if (ret < 0)
 		return ret;
 
@@ -59,12 +176,15 @@ static int camera_dk2_start(OuvrtDevice *dev)
 	ret = mt9v034_sensor_setup(fd);
 	if (ret < 0) {
 		g_print("Camera DK2: Failed to initialize sensor: %d\n", ret);
-		OUVRT_DEVICE_CLASS(ouvrt_camera_dk2_parent_class)->stop(dev);
+		parent->stop(dev);
 		return ret;
 	}
 
+	/* Let the Rift DK2 follow the mode this camera streams at */
+	g_atomic_int_set(&camera_dk2_framerate, OUVRT_CAMERA(self)->framerate);
+
 	if (self->sync)
-		mt9v034_sensor_enable_sync(fd);
+		camera_dk2_enable_sync(self, fd);
 	else
 		mt9v034_sensor_disable_sync(fd);
 
@@ -82,6 +202,7 @@ static int camera_dk2_start(OuvrtDevice *dev)
 static void ouvrt_camera_dk2_finalize(GObject *object)
 {
 	free(OUVRT_CAMERA_DK2(object)->version);
+	distortion_free_map(&OUVRT_CAMERA(object)->distortion);
 	G_OBJECT_CLASS(ouvrt_camera_dk2_parent_class)->finalize(object);
 }
 
@@ -102,6 +223,57 @@ static void ouvrt_camera_dk2_init(OuvrtCameraDK2 *self)
 	camera->framerate = FRAMERATE;
 	self->v4l2.pixelformat = V4L2_PIX_FMT_GREY;
 	self->sync = FALSE;
+	self->binning = 1;
+}
+
+/*
+ * Reads the 128-byte calibration block in 4 32-byte blocks at EEPROM address
+ * 0x2000.
+ */
+static int camera_dk2_read_eeprom_calibration(int fd, char *buf)
+{
+	int ret;
+	int i;
+
+	for (i = 0; i < 128; i += 32) {
+		ret = esp570_eeprom_read(fd, 0x2000 + i, 32, buf + i);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Reads the calibration block from the cache, keyed by the camera serial
+ * number, or from EEPROM, in which case the cache is written.
+ */
+static int camera_dk2_read_calibration(OuvrtDevice *dev, char *buf)
+{
+	gchar *cached = NULL;
+	char *filename;
+	size_t length;
+	int ret;
+
+	if (!dev->serial)
+		return camera_dk2_read_eeprom_calibration(dev->fd, buf);
+
+	filename = ouvrt_cache_path("%s.dk2camera", dev->serial);
+
+	if (ouvrt_cache_load(filename, &cached, &length) && length == 128) {
+		memcpy(buf, cached, 128);
+		g_print("Camera DK2: Read cached calibration data\n");
+		ret = 0;
+	} else {
+		ret = camera_dk2_read_eeprom_calibration(dev->fd, buf);
+		if (ret == 0 && ouvrt_cache_save(filename, buf, 128))
+			g_print("Camera DK2: Wrote calibration data cache\n");
+	}
+
+	g_free(cached);
+	g_free(filename);
+
+	return ret;
 }
 
 static void camera_dk2_get_calibration(OuvrtCameraDK2 *self)
@@ -109,19 +281,13 @@ static void camera_dk2_get_calibration(OuvrtCameraDK2 *self)
 	OuvrtCamera *camera = OUVRT_CAMERA(self);
 	OuvrtDevice *dev = &camera->dev;
 	double * const A = camera->camera_matrix.m;
-	double * const k = camera->dist_coeffs;
+	double * const k = camera->distortion.k;
 	char buf[128];
 	double fx, fy, cx, cy;
 	double k1, k2, p1, p2, k3;
-	int ret;
-	int i;
 
-	/* Read 4 32-byte blocks at EEPROM address 0x2000 */
-	for (i = 0; i < 128; i += 32) {
-		ret = esp570_eeprom_read(dev->fd, 0x2000 + i, 32, buf + i);
-		if (ret < 0)
-			return;
-	}
+	if (camera_dk2_read_calibration(dev, buf) < 0)
+		return;
 
 	fx = *(double *)(buf + 18);
 	fy = *(double *)(buf + 30);
@@ -145,7 +311,16 @@ static void camera_dk2_get_calibration(OuvrtCameraDK2 *self)
 	/*
 	 * k = [ k₁ k₂, p₁, p₂, k₃ ]
 	 */
+	camera->distortion.model = DISTORTION_RADTAN;
 	k[0] = k1; k[1] = k2; k[2] = p1; k[3] = p2; k[4] = k3;
+	/*
+	 * Normalized coordinates do not depend on the binning, so the map
+	 * sampled at full resolution serves both modes.
+	 */
+	distortion_init_map(&camera->distortion, &camera->camera_matrix,
+			    WIDTH, HEIGHT);
+
+	self->full_camera_matrix = camera->camera_matrix;
 }
 
 /*
@@ -207,7 +382,7 @@ void ouvrt_camera_dk2_set_sync_exposure(OuvrtCameraDK2 *self, gboolean sync)
 		return;
 
 	if (sync) {
-		mt9v034_sensor_enable_sync(fd);
+		camera_dk2_enable_sync(self, fd);
 	} else {
 		mt9v034_sensor_disable_sync(fd);
 	}
@@ -220,5 +395,7 @@ void ouvrt_camera_dk2_set_tracker(OuvrtCameraDK2 *self, OuvrtTracker *tracker)
 	else if (!tracker && self->v4l2.camera.tracker)
 		ouvrt_camera_dk2_set_sync_exposure(self, FALSE);
 
+	if (tracker != self->v4l2.camera.tracker)
+		self->v4l2.camera.tracker_camera = -1;
 	g_set_object(&self->v4l2.camera.tracker, tracker);
 }
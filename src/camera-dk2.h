@@ -21,6 +21,9 @@ G_DECLARE_FINAL_TYPE(OuvrtCameraDK2, ouvrt_camera_dk2, OUVRT, CAMERA_DK2, \
 
 OuvrtDevice *camera_dk2_new(const char *devnode);
 
+void camera_dk2_set_binning(int factor);
+int camera_dk2_get_framerate(void);
+
 void ouvrt_camera_dk2_set_tracker(OuvrtCameraDK2 *self, OuvrtTracker *tracker);
 void ouvrt_camera_dk2_set_sync_exposure(OuvrtCameraDK2 *self, gboolean sync);
 
@@ -3,23 +3,77 @@
  * Copyright 2015 Philipp Zabel
  * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
  */
+#define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_UDMABUF
+#include <linux/udmabuf.h>
+#endif
 #include <linux/videodev2.h>
 #include <poll.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "camera-v4l2.h"
 #include "debug.h"
+#include "frame-memory.h"
+#include "frame-pool.h"
+#include "frame-queue.h"
+#include "recording.h"
+#include "remote-camera.h"
+#include "stats.h"
 #include "tracker.h"
 
+#define CAMERA_V4L2_NUM_BUFFERS	8
+/* maximum number of buffers held by the debug stream */
+#define CAMERA_V4L2_DEBUG_BUFFERS	2
+
+/*
+ * A dequeued frame being processed by the tracker, until its buffer is
+ * requeued or lent to the debug stream
+ */
+struct camera_v4l2_frame {
+	OuvrtCameraV4L2 *v4l2;
+	OuvrtTracker *tracker;
+	struct v4l2_buffer buf;
+	void *raw;
+	uint64_t sof_time;
+	double timestamps[4];
+	struct frame_latency *latency;
+	bool queued;
+};
+
 struct _OuvrtCameraV4L2Private {
-	uint32_t offset[3];
-	void *buf[3];
+	enum v4l2_memory memory;
+	unsigned int num_buffers;
+	size_t buf_size;
+	uint32_t offset[CAMERA_V4L2_NUM_BUFFERS];
+	void *buf[CAMERA_V4L2_NUM_BUFFERS];
+	int dmabuf[CAMERA_V4L2_NUM_BUFFERS];
+	/* buffers lent to the debug stream are requeued once released */
+	struct frame_pool *pool;
+	struct camera_v4l2_frame frames[CAMERA_V4L2_NUM_BUFFERS];
+	/* frames submitted to the tracker and not yet finished */
+	struct frame_queue *queue;
+	/* connection to the central tracker in remote camera node mode */
+	struct remote_camera *remote;
+
+	unsigned int num_frames;
+	unsigned int num_skipped;
+	unsigned int num_lost;
+	uint32_t sequence;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(OuvrtCameraV4L2, ouvrt_camera_v4l2,
@@ -62,6 +116,130 @@ static int ouvrt_camera_v4l2_open(OuvrtDevice *dev)
 	return 0;
 }
 
+#ifdef HAVE_UDMABUF
+/*
+ * Allocates a buffer from a sealed memfd and exports it as a dma-buf with
+ * udmabuf, so that it can be imported by the V4L2 device and shared with
+ * other consumers without copies. The memfd mapping stays valid after the
+ * memfd itself is closed.
+ *
+ * Returns the dma-buf file descriptor, or a negative error code.
+ */
+static int ouvrt_camera_v4l2_alloc_dmabuf(int udmabuf, size_t size,
+					  void **data)
+{
+	struct udmabuf_create create = {
+		.flags = UDMABUF_FLAGS_CLOEXEC,
+		.size = size,
+	};
+	int memfd, fd;
+
+	memfd = memfd_create("ouvrt-v4l2", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd < 0)
+		return -errno;
+
+	if (ftruncate(memfd, size) < 0 ||
+	    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+		fd = -errno;
+		goto out;
+	}
+
+	*data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (*data == MAP_FAILED) {
+		fd = -errno;
+		goto out;
+	}
+
+	create.memfd = memfd;
+	fd = ioctl(udmabuf, UDMABUF_CREATE, &create);
+	if (fd < 0) {
+		fd = -errno;
+		munmap(*data, size);
+	}
+out:
+	close(memfd);
+	return fd;
+}
+
+/*
+ * Allocates dma-bufs for all buffers.
+ *
+ * Returns 0 on success or a negative error code, in which case the caller
+ * should fall back to user pointers.
+ */
+static int ouvrt_camera_v4l2_alloc_dmabufs(OuvrtCameraV4L2Private *priv)
+{
+	unsigned int i;
+	int udmabuf;
+	int ret = 0;
+
+	udmabuf = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (udmabuf < 0)
+		return -errno;
+
+	for (i = 0; i < priv->num_buffers; i++) {
+		ret = ouvrt_camera_v4l2_alloc_dmabuf(udmabuf, priv->buf_size,
+						     &priv->buf[i]);
+		if (ret < 0)
+			break;
+		priv->dmabuf[i] = ret;
+		ret = 0;
+	}
+	if (ret < 0) {
+		while (i--) {
+			munmap(priv->buf[i], priv->buf_size);
+			close(priv->dmabuf[i]);
+			priv->buf[i] = NULL;
+		}
+	}
+
+	close(udmabuf);
+	return ret;
+}
+#endif
+
+/*
+ * Queues a buffer, filling in the user pointer or dma-buf file descriptor.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+static int ouvrt_camera_v4l2_qbuf(OuvrtCameraV4L2Private *priv, int fd,
+				  struct v4l2_buffer *buf)
+{
+	if (priv->memory == V4L2_MEMORY_USERPTR) {
+		buf->m.userptr = (unsigned long)priv->buf[buf->index];
+		buf->length = priv->buf_size;
+	} else if (priv->memory == V4L2_MEMORY_DMABUF) {
+		buf->m.fd = priv->dmabuf[buf->index];
+		buf->length = priv->buf_size;
+	}
+
+	return ioctl(fd, VIDIOC_QBUF, buf) < 0 ? -errno : 0;
+}
+
+/*
+ * Frees the buffers after streaming was stopped.
+ */
+static void ouvrt_camera_v4l2_free_buffers(OuvrtCameraV4L2Private *priv)
+{
+	unsigned int i;
+
+	for (i = 0; i < priv->num_buffers; i++) {
+		if (!priv->buf[i])
+			continue;
+		if (priv->memory == V4L2_MEMORY_MMAP) {
+			munmap(priv->buf[i], priv->buf_size);
+		} else if (priv->memory == V4L2_MEMORY_DMABUF) {
+			munmap(priv->buf[i], priv->buf_size);
+			close(priv->dmabuf[i]);
+		} else {
+			frame_memory_free(priv->buf[i]);
+		}
+		priv->buf[i] = NULL;
+	}
+	priv->num_buffers = 0;
+}
+
 /*
  * Requests buffers and starts streaming.
  *
@@ -93,7 +271,7 @@ static int ouvrt_camera_v4l2_start(OuvrtDevice *dev)
 		}
 	};
 	struct v4l2_requestbuffers reqbufs = {
-		.count = 3,
+		.count = CAMERA_V4L2_NUM_BUFFERS,
 		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
 		.memory = V4L2_MEMORY_MMAP,
 	};
@@ -114,61 +292,123 @@ static int ouvrt_camera_v4l2_start(OuvrtDevice *dev)
 		g_print("v4l2: S_FMT error: %d\n", errno);
 		return ret;
 	}
+	if (format.fmt.pix.width != (__u32)width ||
+	    format.fmt.pix.height != (__u32)height) {
+		g_print("v4l2: %dx%d not supported, got %dx%d\n", width, height,
+			format.fmt.pix.width, format.fmt.pix.height);
+		return -EINVAL;
+	}
 
 	ret = ioctl(fd, VIDIOC_S_PARM, &parm);
 	if (ret < 0)
 		g_print("v4l2: S_PARM error: %d\n", errno);
 
-	if (1 /* DEBUG */) {
-		reqbufs.memory = V4L2_MEMORY_USERPTR;
-		camera->sizeimage += sizeof(struct ouvrt_debug_attachment);
+	/*
+	 * Allocate the buffers ourselves, with room for the debug attachment
+	 * behind the frame. Prefer dma-bufs, so that frames can be shared
+	 * without copies, and fall back to user pointers.
+	 */
+	camera->sizeimage += sizeof(struct ouvrt_debug_attachment);
+	priv->buf_size = (camera->sizeimage + getpagesize() - 1) &
+			 ~(getpagesize() - 1);
+	priv->num_buffers = CAMERA_V4L2_NUM_BUFFERS;
+	reqbufs.memory = V4L2_MEMORY_USERPTR;
+#ifdef HAVE_UDMABUF
+	if (ouvrt_camera_v4l2_alloc_dmabufs(priv) == 0) {
+		priv->memory = V4L2_MEMORY_DMABUF;
+		reqbufs.memory = V4L2_MEMORY_DMABUF;
+		ret = ioctl(fd, VIDIOC_REQBUFS, &reqbufs);
+		if (ret < 0) {
+			ouvrt_camera_v4l2_free_buffers(priv);
+			priv->num_buffers = CAMERA_V4L2_NUM_BUFFERS;
+			reqbufs.count = CAMERA_V4L2_NUM_BUFFERS;
+			reqbufs.memory = V4L2_MEMORY_USERPTR;
+		}
 	}
+#endif
+	priv->memory = reqbufs.memory;
 
-	ret = ioctl(fd, VIDIOC_REQBUFS, &reqbufs);
-	if (ret < 0)
-		g_print("v4l2: REQBUFS error: %d\n", errno);
-	if (reqbufs.count > 3) {
+	if (priv->memory == V4L2_MEMORY_USERPTR) {
+		ret = ioctl(fd, VIDIOC_REQBUFS, &reqbufs);
+		if (ret < 0)
+			g_print("v4l2: REQBUFS error: %d\n", errno);
+	}
+	if (reqbufs.count < 2 || reqbufs.count > CAMERA_V4L2_NUM_BUFFERS) {
 		g_print("v4l2: REQBUFS error: %d buffers\n", reqbufs.count);
+		ouvrt_camera_v4l2_free_buffers(priv);
 		return -1;
 	}
+	if (priv->memory == V4L2_MEMORY_DMABUF) {
+		/* Release dma-bufs the driver did not accept */
+		for (i = reqbufs.count; i < priv->num_buffers; i++) {
+			munmap(priv->buf[i], priv->buf_size);
+			close(priv->dmabuf[i]);
+			priv->buf[i] = NULL;
+		}
+	}
+	priv->num_buffers = reqbufs.count;
+	priv->pool = frame_pool_new(priv->num_buffers,
+				    CAMERA_V4L2_DEBUG_BUFFERS);
+	if (!priv->pool) {
+		reqbufs.count = 0;
+		ioctl(fd, VIDIOC_REQBUFS, &reqbufs);
+		ouvrt_camera_v4l2_free_buffers(priv);
+		return -ENOMEM;
+	}
+	priv->num_frames = 0;
+	priv->num_skipped = 0;
+	priv->num_lost = 0;
 
-	g_print("v4l2: %dx%d %4.4s %d Hz, %d buffers à %d bytes\n",
+	g_print("v4l2: %dx%d %4.4s %d Hz, %d %s buffers à %d bytes\n",
 		format.fmt.pix.width, format.fmt.pix.height,
 		(char *)&format.fmt.pix.pixelformat,
 		parm.parm.capture.timeperframe.denominator /
 		parm.parm.capture.timeperframe.numerator,
-		reqbufs.count, format.fmt.pix.sizeimage);
+		reqbufs.count,
+		priv->memory == V4L2_MEMORY_DMABUF ? "dma-buf" : "userptr",
+		format.fmt.pix.sizeimage);
 
 	for (i = 0; i < reqbufs.count; i++) {
 		struct v4l2_buffer buf;
 
 		buf.index = i;
 		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = reqbufs.memory;
 		ret = ioctl(fd, VIDIOC_QUERYBUF, &buf);
 		if (ret < 0)
 			g_print("v4l2: QUERYBUF error\n");
 
 		if (reqbufs.memory == V4L2_MEMORY_MMAP) {
-			priv->buf[i] = mmap(NULL, camera->sizeimage,
+			priv->buf[i] = mmap(NULL, priv->buf_size,
 					    PROT_READ | PROT_WRITE,
 					    MAP_SHARED, dev->fd,
 					    buf.m.offset);
 			priv->offset[i] = buf.m.offset;
 		} else if (reqbufs.memory == V4L2_MEMORY_USERPTR) {
-			priv->buf[i] = malloc(camera->sizeimage);
-			buf.m.userptr = (unsigned long)priv->buf[i];
+			priv->buf[i] = frame_memory_alloc(priv->buf_size);
 		}
 
-		ret = ioctl(fd, VIDIOC_QBUF, &buf);
+		ret = ouvrt_camera_v4l2_qbuf(priv, fd, &buf);
 		if (ret < 0)
 			g_print("v4l2: QBUF error\n");
 	}
 
+	/* Set up the blob detector before the first frame arrives */
+	if (camera->tracker && camera->tracker_camera < 0) {
+		camera->tracker_camera = ouvrt_tracker_add_camera(
+				camera->tracker, width, height,
+				v4l2->pixelformat == V4L2_PIX_FMT_YUYV ?
+				BLOBWATCH_FORMAT_YUYV : BLOBWATCH_FORMAT_GREY);
+	}
+
 	ret = ioctl(fd, VIDIOC_STREAMON, &format.type);
 	if (ret < 0) {
 		g_print("v4l2: STREAMON error\n");
 		reqbufs.count = 0;
 		ioctl(fd, VIDIOC_REQBUFS, &reqbufs);
+		frame_pool_free(priv->pool);
+		priv->pool = NULL;
+		ouvrt_camera_v4l2_free_buffers(priv);
 	}
 
 	g_print("v4l2: Started streaming\n");
@@ -192,7 +432,24 @@ static void convert_yuyv_to_grayscale(uint8_t *frame, int width, int height)
 	int x, y;
 
 	for (y = 0, src = frame, dst = frame; y < height; y++) {
-		for (x = 0; x < width; x++)
+		x = 0;
+#if defined(__SSE2__)
+		/* Mask out chroma and pack 16 luma values at once */
+		const __m128i luma_mask = _mm_set1_epi16(0x00ff);
+		for (; x + 16 <= width; x += 16) {
+			__m128i a = _mm_loadu_si128((__m128i *)(src + 2 * x));
+			__m128i b = _mm_loadu_si128((__m128i *)(src + 2 * x + 16));
+
+			a = _mm_and_si128(a, luma_mask);
+			b = _mm_and_si128(b, luma_mask);
+			_mm_storeu_si128((__m128i *)(dst + x),
+					 _mm_packus_epi16(a, b));
+		}
+#elif defined(__ARM_NEON)
+		for (; x + 16 <= width; x += 16)
+			vst1q_u8(dst + x, vld2q_u8(src + 2 * x).val[0]);
+#endif
+		for (; x < width; x++)
 			dst[x] = src[2 * x];
 
 		src += 2 * width;
@@ -204,7 +461,135 @@ static dquat rot;
 static dvec3 trans;
 
 /*
- * Receives frames from the camera and processes them.
+ * Counts the frames lost by the driver before a dequeued buffer, as reported
+ * by gaps in the sequence numbers, and advances the sequence.
+ */
+static void ouvrt_camera_v4l2_count_lost(OuvrtCameraV4L2Private *priv,
+					 const struct v4l2_buffer *buf)
+{
+	if ((priv->num_frames || priv->num_skipped) &&
+	    buf->sequence - priv->sequence > 1)
+		priv->num_lost += buf->sequence - priv->sequence - 1;
+	priv->sequence = buf->sequence;
+}
+
+/*
+ * Dequeues all ready buffers and immediately requeues all but the newest one,
+ * so that processing never falls behind on stale frames. Frames skipped this
+ * way, and frames lost by the driver as reported by gaps in the sequence
+ * numbers, are counted.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+static int ouvrt_camera_v4l2_dqbuf_latest(OuvrtCameraV4L2Private *priv,
+					  int fd, struct v4l2_buffer *buf)
+{
+	struct v4l2_buffer next;
+	int ret;
+
+	if (ioctl(fd, VIDIOC_DQBUF, buf) < 0)
+		return -errno;
+	ouvrt_camera_v4l2_count_lost(priv, buf);
+
+	for (;;) {
+		next.type = buf->type;
+		next.memory = buf->memory;
+		if (ioctl(fd, VIDIOC_DQBUF, &next) < 0)
+			break;
+
+		ret = ouvrt_camera_v4l2_qbuf(priv, fd, buf);
+		if (ret < 0)
+			return ret;
+		priv->num_skipped++;
+		*buf = next;
+		/* Skipped frames are not counted as lost */
+		ouvrt_camera_v4l2_count_lost(priv, buf);
+	}
+
+	priv->num_frames++;
+
+	return 0;
+}
+
+/*
+ * Finishes a frame after the tracker processed it, or right away without
+ * tracker: runs the camera specific processing, and either lends the buffer
+ * to the debug stream or requeues it. With tracker, this is called from a
+ * worker thread, in frame order.
+ */
+static void ouvrt_camera_v4l2_frame_done(struct blobservation *ob,
+					 const dquat *frame_rot,
+					 const dvec3 *frame_trans, void *data)
+{
+	struct camera_v4l2_frame *frame = data;
+	OuvrtCameraV4L2 *v4l2 = frame->v4l2;
+	OuvrtCameraV4L2Private *priv = v4l2->priv;
+	OuvrtCamera *camera = OUVRT_CAMERA(v4l2);
+	OuvrtDevice *dev = OUVRT_DEVICE(v4l2);
+	struct frame_pool_ref *ref = NULL;
+	struct timespec tp;
+	int ret;
+
+	/* Frames leave the tracker stage in the order they were queued */
+	if (frame->queued) {
+		frame_queue_pop(priv->queue);
+		frame_queue_done(priv->queue);
+		frame->queued = false;
+	}
+
+	if (frame_rot && frame_trans) {
+		rot = *frame_rot;
+		trans = *frame_trans;
+	}
+
+	if (ob && priv->remote)
+		remote_camera_send(priv->remote, frame->sof_time,
+				   &camera->camera_matrix, &camera->distortion,
+				   ob->blobs, ob->num_blobs);
+
+	/* Blob detection and pose estimation finish together */
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	frame->timestamps[2] = tp.tv_sec + 1e-9 * tp.tv_nsec;
+	frame->timestamps[3] = frame->timestamps[2];
+	frame_latency_add(frame->latency, frame->timestamps);
+
+	ret = OUVRT_CAMERA_GET_CLASS(dev)->process_frame(camera, frame->raw,
+							 ob);
+	/*
+	 * Lend the buffer to the debug stream unless it already holds
+	 * too many, in which case the debug frame is dropped. Lent
+	 * buffers are only requeued after they are released.
+	 */
+	if (ret == 0 && debug_stream_connected(camera->debug))
+		ref = frame_pool_acquire(priv->pool, frame->buf.index);
+	if (ref) {
+		struct debug_imu_fifo *imu_fifo =
+			ouvrt_tracker_get_debug_imu_fifo(frame->tracker);
+
+		/* The debug stream expects grayscale frames */
+		if (v4l2->pixelformat == V4L2_PIX_FMT_YUYV)
+			convert_yuyv_to_grayscale(frame->raw, camera->width,
+						  camera->height);
+
+		if (!debug_stream_frame_push(camera->debug, frame->raw,
+					     camera->sizeimage,
+					     camera->width * camera->height,
+					     ob, &rot, &trans,
+					     frame->timestamps, imu_fifo,
+					     frame_pool_release, ref))
+			frame_pool_release(ref);
+		return;
+	}
+
+	ret = ouvrt_camera_v4l2_qbuf(priv, dev->fd, &frame->buf);
+	if (ret < 0) {
+		g_print("v4l2: QBUF error: %d, disabling camera\n", -ret);
+		dev->active = FALSE;
+	}
+}
+
+/*
+ * Receives frames from the camera and submits them to the tracker.
  */
 static void ouvrt_camera_v4l2_thread(OuvrtDevice *dev)
 {
@@ -214,19 +599,55 @@ static void ouvrt_camera_v4l2_thread(OuvrtDevice *dev)
 	struct v4l2_buffer buf;
 	int width = camera->width;
 	int height = camera->height;
+	enum frame_queue_policy policy = frame_queue_get_default_policy();
+	struct frame_latency latency;
 	double timestamps[4];
 	struct timespec tp;
 	struct pollfd pfd;
+	int recording_stream;
+	char *name;
 	void *raw;
 	int ret;
 
+	frame_latency_init(&latency, dev->name);
+	/*
+	 * Frames already submitted to the tracker can not be withdrawn, so
+	 * instead of the oldest frame the new one is dropped. Stale frames
+	 * are already skipped when dequeuing the latest frame.
+	 */
+	if (policy == FRAME_QUEUE_DROP_OLDEST)
+		policy = FRAME_QUEUE_DROP_NEWEST;
+	name = g_strdup_printf("%s tracker", dev->name);
+	priv->queue = frame_queue_new(name, TRACKER_MAX_FRAMES_IN_FLIGHT,
+				      policy);
+	g_free(name);
+	recording_stream = recording_add_stream(dev->name,
+						RECORDING_INDEX_FRAMES, -1);
+	if (remote_camera_enabled())
+		priv->remote = remote_camera_new(dev->serial, width, height);
+
 	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	buf.memory = priv->offset[1] ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+	buf.memory = priv->memory;
 
 	pfd.fd = dev->fd;
 	pfd.events = POLLIN;
 
 	while (dev->active) {
+		int index;
+
+		/* Requeue buffers released by the debug stream */
+		while ((index = frame_pool_pop_released(priv->pool)) >= 0) {
+			struct v4l2_buffer released = {
+				.index = index,
+				.type = buf.type,
+				.memory = buf.memory,
+			};
+
+			ret = ouvrt_camera_v4l2_qbuf(priv, dev->fd, &released);
+			if (ret < 0)
+				g_print("v4l2: QBUF error: %d\n", -ret);
+		}
+
 		ret = poll(&pfd, 1, 1000);
 		if (ret == -1 || ret == 0) {
 			if (ret == -1)
@@ -237,13 +658,22 @@ static void ouvrt_camera_v4l2_thread(OuvrtDevice *dev)
 		if (pfd.events & (POLLERR | POLLHUP | POLLNVAL))
 			break;
 
-		ret = ioctl(dev->fd, VIDIOC_DQBUF, &buf);
+		if (v4l2->latest_frame) {
+			ret = ouvrt_camera_v4l2_dqbuf_latest(priv, dev->fd,
+							     &buf);
+		} else {
+			ret = ioctl(dev->fd, VIDIOC_DQBUF, &buf);
+			if (ret < 0)
+				ret = -errno;
+		}
+		if (ret == -EAGAIN)
+			continue;
 		if (ret < 0) {
-			if (errno == ENODEV)
+			if (ret == -ENODEV)
 				g_print("v4l2: camera disconnected, disabling\n");
 			else
 				g_print("v4l2: DQBUF error: %d, disabling camera\n",
-				        errno);
+				        -ret);
 			break;
 		}
 
@@ -251,7 +681,9 @@ static void ouvrt_camera_v4l2_thread(OuvrtDevice *dev)
 		timestamps[0] = buf.timestamp.tv_sec + 1e-6 * buf.timestamp.tv_usec;
 		timestamps[1] = tp.tv_sec + 1e-9 * tp.tv_nsec;
 
-		if (buf.memory == V4L2_MEMORY_MMAP) {
+		if (buf.index >= priv->num_buffers) {
+			raw = NULL;
+		} else if (buf.memory == V4L2_MEMORY_MMAP) {
 			raw = priv->buf[buf.index];
 			if (buf.m.offset != priv->offset[buf.index])
 				raw = NULL;
@@ -259,6 +691,8 @@ static void ouvrt_camera_v4l2_thread(OuvrtDevice *dev)
 			raw = (void *)buf.m.userptr;
 			if (raw != priv->buf[buf.index])
 				raw = NULL;
+		} else if (buf.memory == V4L2_MEMORY_DMABUF) {
+			raw = priv->buf[buf.index];
 		} else {
 			raw = NULL;
 		}
@@ -269,60 +703,99 @@ static void ouvrt_camera_v4l2_thread(OuvrtDevice *dev)
 			break;
 		}
 
-		if (v4l2->pixelformat == V4L2_PIX_FMT_YUYV)
-			convert_yuyv_to_grayscale(raw, width, height);
+		recording_write_frame(RECORDING_CHUNK_V4L2_FRAME,
+				      recording_stream, 0, width, height,
+				      v4l2->pixelformat,
+				      buf.timestamp.tv_sec * 1000000000ULL +
+				      buf.timestamp.tv_usec * 1000ULL,
+				      raw, buf.bytesused);
 
 		camera->sequence = buf.sequence;
 
 		/*
 		 * Find bright blobs in the camera image and identify individual LEDs
 		 * using the estimated pose at time of exposure or, if that is not
-		 * available, using the LED blinking pattern.
+		 * available, using the LED blinking pattern. The tracker finishes
+		 * the frame asynchronously, so that the next one can be dequeued
+		 * in the meantime.
 		 */
-		struct blobservation *ob = NULL;
-		if (camera->tracker) {
-			uint64_t sof_time = buf.timestamp.tv_sec * 1000000000 +
-					    buf.timestamp.tv_usec * 1000;
-
-			ouvrt_tracker_process_frame(camera->tracker,
-						    raw, width, height,
-						    sof_time, &ob);
-		}
-
-		clock_gettime(CLOCK_MONOTONIC, &tp);
-		timestamps[2] = tp.tv_sec + 1e-9 * tp.tv_nsec;
-
-		if (ob && camera->tracker) {
+		struct camera_v4l2_frame *frame = &priv->frames[buf.index];
+		OuvrtTracker *tracker = camera->tracker;
+		uint64_t sof_time = buf.timestamp.tv_sec * 1000000000 +
+				    buf.timestamp.tv_usec * 1000;
+		/* Skip tracking work while nobody uses the tracker */
+		if (tracker && !ouvrt_tracker_is_active(tracker))
+			tracker = NULL;
+		if (tracker && camera->tracker_camera < 0) {
 			/*
-			 * If we got an observation, calculate the pose from
-			 * blob detector output, intrinsic camera parameters,
-			 * and the known LED positions.
+			 * Let the blob detector read the luma bytes of YUYV
+			 * frames directly.
 			 */
-			ouvrt_tracker_process_blobs(camera->tracker, ob->blobs,
-						    ob->num_blobs,
-						    &camera->camera_matrix,
-						    camera->dist_coeffs,
-						    &rot, &trans);
+			camera->tracker_camera = ouvrt_tracker_add_camera(
+				tracker, width, height,
+				v4l2->pixelformat == V4L2_PIX_FMT_YUYV ?
+				BLOBWATCH_FORMAT_YUYV : BLOBWATCH_FORMAT_GREY);
 		}
+		/* Resting devices are tracked at a reduced frame rate */
+		if (tracker && ouvrt_tracker_skip_frame(tracker,
+							camera->tracker_camera,
+							sof_time))
+			tracker = NULL;
+
+		frame->v4l2 = v4l2;
+		frame->tracker = tracker;
+		frame->buf = buf;
+		frame->raw = raw;
+		frame->sof_time = sof_time;
+		memcpy(frame->timestamps, timestamps, sizeof(timestamps));
+		frame->latency = &latency;
+		frame->queued = false;
 
-		clock_gettime(CLOCK_MONOTONIC, &tp);
-		timestamps[3] = tp.tv_sec + 1e-9 * tp.tv_nsec;
-
-		ret = OUVRT_CAMERA_GET_CLASS(dev)->process_frame(camera, raw);
-		if (ret == 0) {
-			debug_stream_frame_push(camera->debug, raw,
-						camera->sizeimage, width * height,
-						ob, &rot, &trans, timestamps);
+		/*
+		 * Skip the frame entirely if the tracker can not keep up and
+		 * the queue policy drops new frames.
+		 */
+		if (tracker && priv->queue) {
+			if (frame_queue_push(priv->queue, frame)) {
+				ret = ouvrt_camera_v4l2_qbuf(priv, dev->fd, &buf);
+				if (ret < 0) {
+					g_print("v4l2: QBUF error: %d, disabling camera\n",
+						-ret);
+					break;
+				}
+				continue;
+			}
+			frame->queued = true;
 		}
 
-		ret = ioctl(dev->fd, VIDIOC_QBUF, &buf);
-		if (ret < 0) {
-			g_print("v4l2: QBUF error: %d, disabling camera\n",
-				errno);
-			dev->active = FALSE;
-			break;
-		}
+		if (tracker &&
+		    ouvrt_tracker_process_frame(tracker, camera->tracker_camera,
+						raw, sof_time,
+						&camera->camera_matrix,
+						&camera->distortion,
+						ouvrt_camera_v4l2_frame_done,
+						frame) == 0)
+			continue;
+
+		/* Keep frame order if the tracker was just deactivated */
+		if (camera->tracker && camera->tracker_camera >= 0)
+			ouvrt_tracker_flush_frames(camera->tracker,
+						   camera->tracker_camera);
+		ouvrt_camera_v4l2_frame_done(NULL, NULL, NULL, frame);
+	}
+
+	/* Wait for the tracker to finish all frames before stopping */
+	if (camera->tracker && camera->tracker_camera >= 0) {
+		ouvrt_tracker_remove_camera(camera->tracker,
+					    camera->tracker_camera);
+		camera->tracker_camera = -1;
 	}
+
+	frame_queue_free(priv->queue);
+	priv->queue = NULL;
+	remote_camera_free(priv->remote);
+	priv->remote = NULL;
+	frame_latency_fini(&latency);
 }
 
 /*
@@ -340,34 +813,30 @@ static void ouvrt_camera_v4l2_stop(OuvrtDevice *dev)
 	};
 	__u32 prio = V4L2_PRIORITY_BACKGROUND;
 	int ret;
-	int i;
 
 	ret = ioctl(dev->fd, VIDIOC_S_PRIORITY, &prio);
 	if (ret < 0)
 		g_print("v4l2: S_PRIORITY error\n");
 
-	if (priv->offset[1]) {
-		for (i = 0; i < 3; i++) {
-			munmap(priv->buf[i], camera->sizeimage);
-			priv->buf[i] = NULL;
-		}
-	} else {
-		reqbufs.memory = V4L2_MEMORY_USERPTR;
-		for (i = 0; i < 3; i++) {
-			free(priv->buf[i]);
-			priv->buf[i] = NULL;
-		}
-	}
-
 	ret = ioctl(dev->fd, VIDIOC_STREAMOFF, &reqbufs.type);
 	if (ret < 0 && errno != ENODEV)
 		g_print("v4l2: STREAMOFF error: %d\n", errno);
 
+	reqbufs.memory = priv->memory;
 	ret = ioctl(dev->fd, VIDIOC_REQBUFS, &reqbufs);
 	if (ret < 0 && errno != ENODEV)
 		g_print("v4l2: REQBUFS error: %d\n", errno);
 
-	g_print("v4l2: Stopped streaming\n");
+	g_print("v4l2: Stopped streaming, %u frames, %u skipped, %u lost, %u debug frames dropped\n",
+		priv->num_frames, priv->num_skipped, priv->num_lost,
+		frame_pool_get_dropped(priv->pool));
+
+	/* Buffers still held by the debug stream can not be freed */
+	if (frame_pool_free(priv->pool))
+		ouvrt_camera_v4l2_free_buffers(priv);
+	else
+		g_print("v4l2: Debug stream did not release buffers\n");
+	priv->pool = NULL;
 
 	/* TODO: move up to camera */
 	camera->debug = debug_stream_unref(camera->debug);
@@ -381,6 +850,9 @@ static void ouvrt_camera_v4l2_class_init(OuvrtCameraV4L2Class *klass)
 	device_class->start = ouvrt_camera_v4l2_start;
 	device_class->thread = ouvrt_camera_v4l2_thread;
 	device_class->stop = ouvrt_camera_v4l2_stop;
+	device_class->sched_policy = SCHED_RR;
+	device_class->sched_priority = 10;
+	device_class->lock_memory = TRUE;
 }
 
 /*
@@ -391,4 +863,5 @@ static void ouvrt_camera_v4l2_class_init(OuvrtCameraV4L2Class *klass)
 static void ouvrt_camera_v4l2_init(OuvrtCameraV4L2 *self)
 {
         self->priv = ouvrt_camera_v4l2_get_instance_private(self);
+	self->latest_frame = TRUE;
 }
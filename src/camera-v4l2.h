@@ -36,6 +36,8 @@ struct _OuvrtCameraV4L2 {
 	OuvrtCamera camera;
 
 	uint32_t pixelformat;
+	/* only process the newest frame, skipping stale ones */
+	gboolean latest_frame;
 
 	OuvrtCameraV4L2Private *priv;
 };
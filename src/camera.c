@@ -21,4 +21,5 @@ static void ouvrt_camera_class_init(G_GNUC_UNUSED OuvrtCameraClass *klass)
 static void ouvrt_camera_init(OuvrtCamera *camera)
 {
 	camera->dev.type = DEVICE_TYPE_CAMERA;
+	camera->tracker_camera = -1;
 }
@@ -9,6 +9,7 @@
 #include <glib-object.h>
 
 #include "device.h"
+#include "distortion.h"
 #include "tracker.h"
 #include "maths.h"
 
@@ -32,12 +33,13 @@ typedef struct _OuvrtCameraClass	OuvrtCameraClass;
 struct _OuvrtCamera {
 	OuvrtDevice dev;
 	OuvrtTracker *tracker;
+	int tracker_camera;
 
 	int width;
 	int height;
 	int framerate;
 	dmat3 camera_matrix;
-	double dist_coeffs[5];
+	struct distortion distortion;
 	int sizeimage;
 	int sequence;
 	struct debug_stream *debug;
@@ -45,7 +47,8 @@ struct _OuvrtCamera {
 
 struct _OuvrtCameraClass {
 	OuvrtDeviceClass parent_class;
-	int (*process_frame)(OuvrtCamera *camera, void *frame);
+	int (*process_frame)(OuvrtCamera *camera, void *frame,
+			     struct blobservation *ob);
 };
 
 GType ouvrt_camera_get_type(void);
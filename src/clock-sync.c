@@ -0,0 +1,190 @@
+/*
+ * Device to host clock synchronization
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Device timestamps are observed on the host only after a variable, but
+ * strictly positive transfer latency. The clock model is a line fitted to
+ * the earlier arriving half of the recent observations, which is then moved
+ * down to the earliest arrival, so that USB and scheduling jitter does not
+ * leak into the converted timestamps.
+ */
+#include <math.h>
+#include <string.h>
+
+#include "clock-sync.h"
+
+/* observations further off than this restart the model */
+#define CLOCK_SYNC_MAX_ERROR	0.1	/* s */
+/* only the earliest arrival per interval is kept, to extend the window */
+#define CLOCK_SYNC_INTERVAL	0.05	/* s */
+
+/*
+ * Initializes the clock model for a device clock with the given nominal
+ * rate in ticks per second. Deviations from the nominal rate are tracked.
+ */
+void clock_sync_init(struct clock_sync *sync, double rate)
+{
+	memset(sync, 0, sizeof(*sync));
+	sync->rate = rate;
+	sync->skew = 1.0;
+}
+
+/*
+ * Fits host = offset + skew * device through the observations selected by
+ * mask. Returns false if the device times are too close together.
+ */
+static bool clock_sync_fit(struct clock_sync *sync, const bool *mask,
+			   double *skew, double *offset)
+{
+	double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	double d;
+	int i, n = 0;
+
+	for (i = 0; i < sync->num_points; i++) {
+		if (mask && !mask[i])
+			continue;
+		sx += sync->device[i];
+		sy += sync->host[i];
+		n++;
+	}
+	if (n < 2)
+		return false;
+	sx /= n;
+	sy /= n;
+
+	for (i = 0; i < sync->num_points; i++) {
+		double dx, dy;
+
+		if (mask && !mask[i])
+			continue;
+		dx = sync->device[i] - sx;
+		dy = sync->host[i] - sy;
+		sxx += dx * dx;
+		sxy += dx * dy;
+	}
+
+	/* Require at least about a millisecond of spread */
+	if (sxx < n * 1e-7)
+		return false;
+
+	d = sxy / sxx;
+	*skew = d;
+	*offset = sy - d * sx;
+
+	return true;
+}
+
+static void clock_sync_update(struct clock_sync *sync)
+{
+	double residual[CLOCK_SYNC_WINDOW], sorted[CLOCK_SYNC_WINDOW];
+	bool mask[CLOCK_SYNC_WINDOW] = { false };
+	double skew, offset, median, min;
+	int i, j, n = sync->num_points;
+
+	if (!clock_sync_fit(sync, NULL, &skew, &offset)) {
+		/* Too few observations, only track the offset */
+		skew = 1.0;
+		offset = INFINITY;
+		for (i = 0; i < n; i++)
+			offset = fmin(offset, sync->host[i] - sync->device[i]);
+		sync->skew = skew;
+		sync->offset = offset;
+		sync->valid = true;
+		sync->fitted = false;
+		return;
+	}
+
+	/* Select the observations that arrived earlier than the median */
+	for (i = 0; i < n; i++) {
+		residual[i] = sync->host[i] - (offset + skew * sync->device[i]);
+		for (j = i; j > 0 && sorted[j - 1] > residual[i]; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = residual[i];
+	}
+	median = sorted[n / 2];
+	for (i = 0; i < n; i++)
+		mask[i] = residual[i] <= median;
+
+	clock_sync_fit(sync, mask, &skew, &offset);
+
+	/* Move the line down to the earliest arrival */
+	min = INFINITY;
+	for (i = 0; i < n; i++) {
+		if (mask[i])
+			min = fmin(min, sync->host[i] -
+				   (offset + skew * sync->device[i]));
+	}
+
+	sync->skew = skew;
+	sync->offset = offset + min;
+	sync->valid = true;
+	sync->fitted = true;
+}
+
+/*
+ * Adds an observation of the device clock at device_time, in device ticks,
+ * that arrived on the host at host_time, in CLOCK_MONOTONIC nanoseconds.
+ */
+void clock_sync_add_sample(struct clock_sync *sync, uint64_t device_time,
+			   uint64_t host_time)
+{
+	double x, y;
+
+	if (sync->num_points == 0) {
+		sync->device_base = device_time;
+		sync->host_base = host_time;
+	}
+
+	x = (int64_t)(device_time - sync->device_base) / sync->rate;
+	y = (int64_t)(host_time - sync->host_base) * 1e-9;
+
+	if (sync->fitted &&
+	    fabs(y - (sync->offset + sync->skew * x)) > CLOCK_SYNC_MAX_ERROR) {
+		/* The device was reset or the host was suspended, restart */
+		clock_sync_init(sync, sync->rate);
+		clock_sync_add_sample(sync, device_time, host_time);
+		return;
+	}
+
+	if (sync->num_points) {
+		int last = (sync->next + CLOCK_SYNC_WINDOW - 1) %
+			   CLOCK_SYNC_WINDOW;
+
+		if (x - sync->device[last] < CLOCK_SYNC_INTERVAL) {
+			/* Replace the last observation if this arrived earlier */
+			if (y - x >= sync->host[last] - sync->device[last])
+				return;
+			sync->device[last] = x;
+			sync->host[last] = y;
+			clock_sync_update(sync);
+			return;
+		}
+	}
+
+	sync->device[sync->next] = x;
+	sync->host[sync->next] = y;
+	sync->next = (sync->next + 1) % CLOCK_SYNC_WINDOW;
+	if (sync->num_points < CLOCK_SYNC_WINDOW)
+		sync->num_points++;
+
+	clock_sync_update(sync);
+}
+
+/*
+ * Converts a device timestamp, in device ticks, into CLOCK_MONOTONIC
+ * nanoseconds.
+ *
+ * Returns 0 if there are no observations yet.
+ */
+uint64_t clock_sync_to_host(struct clock_sync *sync, uint64_t device_time)
+{
+	double x;
+
+	if (!sync->valid)
+		return 0;
+
+	x = (int64_t)(device_time - sync->device_base) / sync->rate;
+
+	return sync->host_base + llround((sync->offset + sync->skew * x) * 1e9);
+}
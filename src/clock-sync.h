@@ -0,0 +1,37 @@
+/*
+ * Device to host clock synchronization
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __CLOCK_SYNC_H__
+#define __CLOCK_SYNC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CLOCK_SYNC_WINDOW	64
+
+/*
+ * Linear model of a device clock in terms of CLOCK_MONOTONIC, fitted to the
+ * lower envelope of the most recent (device time, host arrival time) pairs.
+ */
+struct clock_sync {
+	double rate;
+	bool valid;
+	bool fitted;
+	uint64_t device_base;
+	uint64_t host_base;
+	int num_points;
+	int next;
+	double device[CLOCK_SYNC_WINDOW];
+	double host[CLOCK_SYNC_WINDOW];
+	double skew;
+	double offset;
+};
+
+void clock_sync_init(struct clock_sync *sync, double rate);
+void clock_sync_add_sample(struct clock_sync *sync, uint64_t device_time,
+			   uint64_t host_time);
+uint64_t clock_sync_to_host(struct clock_sync *sync, uint64_t device_time);
+
+#endif /* __CLOCK_SYNC_H__ */
@@ -0,0 +1,701 @@
+/*
+ * Pose acquisition by LED constellation matching
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Triplets of neighbouring LEDs are indexed by the shape of the triangle they
+ * form when seen from a few view directions around their normals, from which
+ * all three LEDs are visible. The shape is described by the side lengths
+ * relative to the longest side and by the winding of the vertices, which do
+ * not change with image plane rotation, scale, and translation, and hardly
+ * change under perspective projection of small clusters.
+ *
+ * To acquire a pose without any LED ids, blobs are grouped with their closest
+ * neighbours into triangles, whose shapes are looked up in the index. Each
+ * LED triplet of similar shape yields pose hypotheses via P3P, and the
+ * hypothesis whose projected LEDs explain the most blobs is refined. This
+ * finds the pose in a single frame, without waiting for blinking patterns.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blobwatch.h"
+#include "constellation.h"
+#include "distortion.h"
+#include "maths.h"
+#include "pnp.h"
+#include "tracking-model.h"
+
+#define CONSTELLATION_MAX_LEDS		64
+/* number of closest LEDs that each LED forms triplets with */
+#define CONSTELLATION_NEIGHBOURS	6
+/* view directions per triplet, along the mean normal and on two rings */
+#define CONSTELLATION_RING_VIEWS	6
+#define CONSTELLATION_NUM_VIEWS		(1 + 2 * CONSTELLATION_RING_VIEWS)
+/* quantization steps of each relative side length */
+#define CONSTELLATION_STEPS		12
+#define CONSTELLATION_NUM_BINS		(2 * CONSTELLATION_STEPS * \
+					 CONSTELLATION_STEPS)
+/* cosine of the largest angle between LED normal and view direction, 75° */
+#define CONSTELLATION_MIN_FACING	0.26
+/* minimum triangle height relative to the longest side */
+#define CONSTELLATION_MIN_HEIGHT	0.1
+/* number of blobs, and of closest blobs that each blob forms triangles with */
+#define CONSTELLATION_MAX_BLOBS		32
+#define CONSTELLATION_BLOB_NEIGHBOURS	3
+/* upper bound on the number of P3P solves per search */
+#define CONSTELLATION_MAX_HYPOTHESES	4096
+/*
+ * maximum distance in pixels between blobs and LEDs projected at a pose
+ * hypothesis, and at the hypothesis refined over the blobs it explains
+ */
+#define CONSTELLATION_INLIER_DISTANCE	6.0
+#define CONSTELLATION_REFINED_DISTANCE	2.0
+/* poses must explain at least this many blobs, and half of all blobs */
+#define CONSTELLATION_MIN_INLIERS	6
+#define CONSTELLATION_REFINE_ITERATIONS	5
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
+
+/*
+ * Three LEDs ordered as the vertices of their triangle shape.
+ */
+struct constellation_triplet {
+	uint8_t leds[3];
+};
+
+/*
+ * Triangle shape, with the vertices ordered by decreasing length of the
+ * opposite side, the lengths of the two shorter sides relative to the
+ * longest, and the winding of the ordered vertices.
+ */
+struct constellation_shape {
+	int order[3];
+	double r1;
+	double r2;
+	int winding;
+};
+
+struct constellation {
+	int num_leds;
+	dvec3 points[CONSTELLATION_MAX_LEDS];
+	dvec3 normals[CONSTELLATION_MAX_LEDS];
+	/* the triplets of each bin b start at triplets[bin_start[b]] */
+	unsigned int bin_start[CONSTELLATION_NUM_BINS + 1];
+	struct constellation_triplet *triplets;
+};
+
+/*
+ * State of a search, with the best hypothesis so far.
+ */
+struct constellation_query {
+	const struct constellation *c;
+	double (*image)[2];
+	int num_blobs;
+	/* inlier distances in normalized image coordinates */
+	double threshold;
+	double refined_threshold;
+	double focal_length;
+	int *leds;
+	int hypotheses;
+	/* number of explained blobs that ends the search early */
+	int enough;
+	int best;
+	dquat rot;
+	dvec3 trans;
+};
+
+/*
+ * Describes the shape of the 2D triangle p.
+ *
+ * Returns false if the triangle is too flat for its shape to be
+ * distinctive.
+ */
+static bool constellation_shape(const double p[3][2],
+				struct constellation_shape *s)
+{
+	int *o = s->order;
+	double l[3];
+	double cross;
+	int i, j, t;
+
+	for (i = 0; i < 3; i++) {
+		const double *a = p[(i + 1) % 3];
+		const double *b = p[(i + 2) % 3];
+
+		l[i] = hypot(b[0] - a[0], b[1] - a[1]);
+		o[i] = i;
+	}
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 2 - i; j++) {
+			if (l[o[j + 1]] > l[o[j]]) {
+				t = o[j];
+				o[j] = o[j + 1];
+				o[j + 1] = t;
+			}
+		}
+	}
+
+	if (l[o[0]] < 1e-12)
+		return false;
+
+	cross = (p[o[1]][0] - p[o[0]][0]) * (p[o[2]][1] - p[o[0]][1]) -
+		(p[o[1]][1] - p[o[0]][1]) * (p[o[2]][0] - p[o[0]][0]);
+	if (fabs(cross) < CONSTELLATION_MIN_HEIGHT * l[o[0]] * l[o[0]])
+		return false;
+
+	s->r1 = l[o[1]] / l[o[0]];
+	s->r2 = l[o[2]] / l[o[0]];
+	s->winding = cross > 0;
+
+	return true;
+}
+
+/*
+ * Returns the bin of the shape, offset by the given number of steps in both
+ * relative side lengths, or -1 if the offset bin does not exist.
+ */
+static int constellation_bin(const struct constellation_shape *s, int d1,
+			     int d2)
+{
+	int i = min((int)(s->r1 * CONSTELLATION_STEPS),
+		    CONSTELLATION_STEPS - 1) + d1;
+	int j = min((int)(s->r2 * CONSTELLATION_STEPS),
+		    CONSTELLATION_STEPS - 1) + d2;
+
+	if (i < 0 || i >= CONSTELLATION_STEPS ||
+	    j < 0 || j >= CONSTELLATION_STEPS)
+		return -1;
+
+	return (s->winding * CONSTELLATION_STEPS + i) * CONSTELLATION_STEPS + j;
+}
+
+/*
+ * Builds the axes e1 and e2 of an image plane looked at from direction d,
+ * such that e1, e2, and -d form a right-handed frame, like the x, y, and z
+ * axes of a camera looking along -d.
+ */
+static void constellation_view_axes(const dvec3 *d, dvec3 *e1, dvec3 *e2)
+{
+	const dvec3 a = fabs(d->x) < 0.6 ? (dvec3){ 1, 0, 0 } :
+					   (dvec3){ 0, 1, 0 };
+
+	dvec3_cross(e1, d, &a);
+	dvec3_normalize(e1);
+	dvec3_cross(e2, e1, d);
+}
+
+/*
+ * Stores the shapes of the triplet as seen from view directions around the
+ * mean normal of its LEDs, from which all three LEDs are visible, with their
+ * bins. Each bin only receives each vertex order once.
+ *
+ * Returns the number of entries stored.
+ */
+static int constellation_add_views(const struct constellation *c,
+				   const int leds[3],
+				   struct constellation_triplet *triplets,
+				   int *bins)
+{
+	const double tilts[2] = { 25.0 * M_PI / 180.0, 50.0 * M_PI / 180.0 };
+	dvec3 m = { 0, 0, 0 };
+	dvec3 u, w;
+	int num = 0;
+	int i, k, v;
+
+	for (i = 0; i < 3; i++) {
+		m.x += c->normals[leds[i]].x;
+		m.y += c->normals[leds[i]].y;
+		m.z += c->normals[leds[i]].z;
+	}
+	if (dvec3_dot(&m, &m) < 1e-6)
+		return 0;
+	dvec3_normalize(&m);
+	constellation_view_axes(&m, &u, &w);
+
+	for (v = 0; v < CONSTELLATION_NUM_VIEWS; v++) {
+		struct constellation_triplet t;
+		struct constellation_shape s;
+		dvec3 d = m, e1, e2;
+		double p[3][2];
+		int bin;
+
+		if (v > 0) {
+			int ring = (v - 1) / CONSTELLATION_RING_VIEWS;
+			double tilt = tilts[ring];
+			double azimuth = M_PI * (2 * ((v - 1) %
+					 CONSTELLATION_RING_VIEWS) + ring) /
+					 CONSTELLATION_RING_VIEWS;
+			double cu = sin(tilt) * cos(azimuth);
+			double cw = sin(tilt) * sin(azimuth);
+
+			d.x = cos(tilt) * m.x + cu * u.x + cw * w.x;
+			d.y = cos(tilt) * m.y + cu * u.y + cw * w.y;
+			d.z = cos(tilt) * m.z + cu * u.z + cw * w.z;
+		}
+
+		for (i = 0; i < 3; i++) {
+			if (dvec3_dot(&c->normals[leds[i]], &d) <
+			    CONSTELLATION_MIN_FACING)
+				break;
+		}
+		if (i < 3)
+			continue;
+
+		constellation_view_axes(&d, &e1, &e2);
+		for (i = 0; i < 3; i++) {
+			p[i][0] = dvec3_dot(&c->points[leds[i]], &e1);
+			p[i][1] = dvec3_dot(&c->points[leds[i]], &e2);
+		}
+		if (!constellation_shape(p, &s))
+			continue;
+
+		bin = constellation_bin(&s, 0, 0);
+		for (i = 0; i < 3; i++)
+			t.leds[i] = leds[s.order[i]];
+		for (k = 0; k < num; k++) {
+			if (bins[k] == bin &&
+			    memcmp(&triplets[k], &t, sizeof(t)) == 0)
+				break;
+		}
+		if (k < num)
+			continue;
+
+		triplets[num] = t;
+		bins[num++] = bin;
+	}
+
+	return num;
+}
+
+/*
+ * Stores the indices of the up to num smallest of the n squared distances in
+ * neighbours, closest first. Negative distances are skipped.
+ *
+ * Returns the number of neighbours stored.
+ */
+static int constellation_closest(const double *dist2, int n, int *neighbours,
+				 int num)
+{
+	double d[CONSTELLATION_NEIGHBOURS];
+	int count = 0;
+	int i, k;
+
+	for (i = 0; i < n; i++) {
+		if (dist2[i] < 0.0)
+			continue;
+		for (k = count; k > 0 && d[k - 1] > dist2[i]; k--) {
+			if (k < num) {
+				d[k] = d[k - 1];
+				neighbours[k] = neighbours[k - 1];
+			}
+		}
+		if (k < num) {
+			d[k] = dist2[i];
+			neighbours[k] = i;
+			count = min(count + 1, num);
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Builds the index of LED triplets for the tracking model. Each LED forms
+ * triplets with pairs of its closest neighbours that face in a similar
+ * direction, so that they can be seen together.
+ *
+ * Returns the index, or NULL if the model has too few or too many LEDs, or
+ * no normals.
+ */
+struct constellation *constellation_new(const struct tracking_model *model)
+{
+	int neighbours[CONSTELLATION_MAX_LEDS][CONSTELLATION_NEIGHBOURS];
+	int num_neighbours[CONSTELLATION_MAX_LEDS];
+	unsigned int fill[CONSTELLATION_NUM_BINS];
+	struct constellation_triplet *triplets;
+	double dist2[CONSTELLATION_MAX_LEDS];
+	struct constellation *c;
+	uint64_t *seen;
+	int num_entries = 0;
+	int max_entries;
+	int *bins;
+	int i, j, k, n;
+
+	n = model->num_points;
+	if (n < 4 || n > CONSTELLATION_MAX_LEDS || !model->normals)
+		return NULL;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	c->num_leds = n;
+	for (i = 0; i < n; i++) {
+		c->points[i] = (dvec3){ model->points[i].x, model->points[i].y,
+					model->points[i].z };
+		c->normals[i] = (dvec3){ model->normals[i].x,
+					 model->normals[i].y,
+					 model->normals[i].z };
+	}
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			dvec3 d = { c->points[j].x - c->points[i].x,
+				    c->points[j].y - c->points[i].y,
+				    c->points[j].z - c->points[i].z };
+
+			dist2[j] = (j == i || dvec3_dot(&c->normals[i],
+							 &c->normals[j]) <= 0.0) ?
+				   -1.0 : dvec3_dot(&d, &d);
+		}
+		num_neighbours[i] = constellation_closest(dist2, n,
+							  neighbours[i],
+							  CONSTELLATION_NEIGHBOURS);
+	}
+
+	max_entries = n * CONSTELLATION_NEIGHBOURS *
+		      (CONSTELLATION_NEIGHBOURS - 1) / 2 *
+		      CONSTELLATION_NUM_VIEWS;
+	triplets = malloc(max_entries * sizeof(*triplets));
+	bins = malloc(max_entries * sizeof(*bins));
+	seen = calloc(CONSTELLATION_MAX_LEDS * CONSTELLATION_MAX_LEDS,
+		      sizeof(*seen));
+	if (!triplets || !bins || !seen)
+		goto err_free;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < num_neighbours[i]; j++) {
+			for (k = j + 1; k < num_neighbours[i]; k++) {
+				int leds[3] = { i, neighbours[i][j],
+						neighbours[i][k] };
+				int lo = min(min(leds[0], leds[1]), leds[2]);
+				int hi = max(max(leds[0], leds[1]), leds[2]);
+				int mid = leds[0] + leds[1] + leds[2] - lo - hi;
+				uint64_t *word = &seen[lo * CONSTELLATION_MAX_LEDS +
+						       mid];
+
+				if (*word & (1ULL << hi))
+					continue;
+				*word |= 1ULL << hi;
+
+				num_entries += constellation_add_views(c, leds,
+						triplets + num_entries,
+						bins + num_entries);
+			}
+		}
+	}
+
+	/* Sort the entries into their bins */
+	c->triplets = malloc(max(num_entries, 1) * sizeof(*c->triplets));
+	if (!c->triplets)
+		goto err_free;
+	for (i = 0; i < num_entries; i++)
+		c->bin_start[bins[i] + 1]++;
+	for (i = 0; i < CONSTELLATION_NUM_BINS; i++) {
+		c->bin_start[i + 1] += c->bin_start[i];
+		fill[i] = c->bin_start[i];
+	}
+	for (i = 0; i < num_entries; i++)
+		c->triplets[fill[bins[i]]++] = triplets[i];
+
+	free(seen);
+	free(bins);
+	free(triplets);
+
+	return c;
+
+err_free:
+	free(seen);
+	free(bins);
+	free(triplets);
+	free(c);
+	return NULL;
+}
+
+void constellation_free(struct constellation *c)
+{
+	if (!c)
+		return;
+
+	free(c->triplets);
+	free(c);
+}
+
+/*
+ * Projects the LEDs facing the camera at the given pose and assigns each blob
+ * the closest projected LED within the threshold, in normalized image
+ * coordinates. Each LED is assigned to one blob at most.
+ *
+ * Returns the number of blobs assigned to an LED.
+ */
+static int constellation_match(const struct constellation *c,
+			       double (*image)[2], int num_blobs,
+			       const dquat *rot, const dvec3 *trans,
+			       double threshold, int *leds)
+{
+	double proj[CONSTELLATION_MAX_LEDS][2];
+	uint64_t visible = 0;
+	int num = 0;
+	int i, j;
+
+	for (j = 0; j < c->num_leds; j++) {
+		dvec3 p, n;
+
+		dquat_rotate(&p, rot, &c->points[j]);
+		p.x += trans->x;
+		p.y += trans->y;
+		p.z += trans->z;
+		if (p.z <= 1e-6)
+			continue;
+
+		dquat_rotate(&n, rot, &c->normals[j]);
+		if (dvec3_dot(&n, &p) >= 0.0)
+			continue;
+
+		proj[j][0] = p.x / p.z;
+		proj[j][1] = p.y / p.z;
+		visible |= 1ULL << j;
+	}
+
+	for (i = 0; i < num_blobs; i++) {
+		double best = threshold * threshold;
+		int id = -1;
+
+		for (j = 0; j < c->num_leds; j++) {
+			double dx, dy;
+
+			if (!(visible & (1ULL << j)))
+				continue;
+
+			dx = image[i][0] - proj[j][0];
+			dy = image[i][1] - proj[j][1];
+			if (dx * dx + dy * dy < best) {
+				best = dx * dx + dy * dy;
+				id = j;
+			}
+		}
+
+		leds[i] = id;
+		if (id >= 0) {
+			visible &= ~(1ULL << id);
+			num++;
+		}
+	}
+
+	return num;
+}
+
+/*
+ * Refines a pose hypothesis over the blobs it explains, and again with the
+ * tighter threshold to drop blobs matched to the wrong LED.
+ *
+ * Returns the number of blobs explained by the refined pose.
+ */
+static int constellation_refine(struct constellation_query *q, dquat *rot,
+				dvec3 *trans)
+{
+	const struct constellation *c = q->c;
+	struct pnp_problem pnp;
+	int round, i;
+
+	pnp.focal_length = q->focal_length;
+	for (round = 0; round < 2; round++) {
+		pnp.num_points = constellation_match(c, q->image, q->num_blobs,
+				rot, trans, round ? q->refined_threshold :
+						    q->threshold, q->leds);
+		if (pnp.num_points < CONSTELLATION_MIN_INLIERS)
+			return 0;
+
+		pnp.num_points = 0;
+		for (i = 0; i < q->num_blobs; i++) {
+			if (q->leds[i] < 0)
+				continue;
+			pnp.object[pnp.num_points] = c->points[q->leds[i]];
+			pnp.image[pnp.num_points][0] = q->image[i][0];
+			pnp.image[pnp.num_points][1] = q->image[i][1];
+			pnp.num_points++;
+		}
+
+		pnp_refine(&pnp, rot, trans, NULL,
+			   CONSTELLATION_REFINE_ITERATIONS);
+	}
+
+	return constellation_match(c, q->image, q->num_blobs, rot, trans,
+				   q->refined_threshold, q->leds);
+}
+
+/*
+ * Looks up the shape of a triangle of blobs in the index, including the
+ * neighbouring bins to tolerate noise and perspective distortion, and tests
+ * the pose hypotheses of all LED triplets of similar shape. Hypotheses
+ * that could explain more blobs than the best so far are refined, and the
+ * refined pose that explains the most blobs is kept.
+ */
+static void constellation_try_triangle(struct constellation_query *q,
+				       const int tri[3])
+{
+	const struct constellation *c = q->c;
+	struct constellation_shape s;
+	double p[3][2];
+	dvec3 rays[3];
+	int d1, d2, i;
+
+	for (i = 0; i < 3; i++) {
+		p[i][0] = q->image[tri[i]][0];
+		p[i][1] = q->image[tri[i]][1];
+	}
+	if (!constellation_shape(p, &s))
+		return;
+
+	for (i = 0; i < 3; i++) {
+		rays[i] = (dvec3){ p[s.order[i]][0], p[s.order[i]][1], 1.0 };
+		dvec3_normalize(&rays[i]);
+	}
+
+	for (d1 = -1; d1 <= 1; d1++) {
+		for (d2 = -1; d2 <= 1; d2++) {
+			int bin = constellation_bin(&s, d1, d2);
+			unsigned int e;
+
+			if (bin < 0)
+				continue;
+
+			for (e = c->bin_start[bin]; e < c->bin_start[bin + 1];
+			     e++) {
+				const struct constellation_triplet *t =
+					&c->triplets[e];
+				dquat rots[4];
+				dvec3 transs[4];
+				dvec3 points[3];
+				int num, count;
+
+				if (q->hypotheses == CONSTELLATION_MAX_HYPOTHESES ||
+				    q->best >= q->enough)
+					return;
+				q->hypotheses++;
+
+				for (i = 0; i < 3; i++)
+					points[i] = c->points[t->leds[i]];
+
+				num = pnp_p3p(points, rays, rots, transs);
+				for (i = 0; i < num; i++) {
+					count = constellation_match(c, q->image,
+							q->num_blobs, &rots[i],
+							&transs[i],
+							q->threshold, q->leds);
+					if (count <= q->best)
+						continue;
+
+					count = constellation_refine(q,
+							&rots[i], &transs[i]);
+					if (count > q->best) {
+						q->best = count;
+						q->rot = rots[i];
+						q->trans = transs[i];
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Searches the pose of the object from blobs that are not identified as LEDs
+ * of other objects, without using any LED ids. The result is stored in rot
+ * and trans.
+ *
+ * Returns the number of blobs explained by the pose, or a negative error code
+ * if no pose was found, in which case rot and trans are left unchanged.
+ */
+int constellation_search(const struct constellation *c, struct blob *blobs,
+			 int num_blobs, int object_id, dmat3 *camera_matrix,
+			 const struct distortion *distortion, dquat *rot,
+			 dvec3 *trans)
+{
+	const double fx = camera_matrix->m[0];
+	const double cx = camera_matrix->m[2];
+	const double fy = camera_matrix->m[4];
+	const double cy = camera_matrix->m[5];
+	int neighbours[CONSTELLATION_BLOB_NEIGHBOURS];
+	double image[CONSTELLATION_MAX_BLOBS][2];
+	double dist2[CONSTELLATION_MAX_BLOBS];
+	uint64_t tried[CONSTELLATION_MAX_BLOBS * CONSTELLATION_MAX_BLOBS *
+		       CONSTELLATION_MAX_BLOBS / 64];
+	int leds[CONSTELLATION_MAX_BLOBS];
+	struct constellation_query q = {
+		.c = c,
+		.image = image,
+		.leds = leds,
+	};
+	int a, i, j, n = 0;
+
+	if (!c)
+		return -EINVAL;
+
+	for (i = 0; i < num_blobs && n < CONSTELLATION_MAX_BLOBS; i++) {
+		if (blobs[i].led_id >= 0 && blobs[i].object_id != object_id)
+			continue;
+
+		distortion_undistort(distortion, (blobs[i].cx - cx) / fx,
+				     (blobs[i].cy - cy) / fy, &image[n][0],
+				     &image[n][1]);
+		n++;
+	}
+	if (n < CONSTELLATION_MIN_INLIERS)
+		return -EINVAL;
+
+	q.num_blobs = n;
+	q.enough = max(CONSTELLATION_MIN_INLIERS, n * 3 / 4);
+	q.focal_length = 0.5 * (fx + fy);
+	q.threshold = CONSTELLATION_INLIER_DISTANCE / q.focal_length;
+	q.refined_threshold = CONSTELLATION_REFINED_DISTANCE / q.focal_length;
+	memset(tried, 0, sizeof(tried));
+
+	/*
+	 * Each blob forms triangles with pairs of its closest neighbours,
+	 * like each LED with its closest neighbours in the index.
+	 */
+	for (a = 0; a < n; a++) {
+		int num_neighbours;
+
+		for (i = 0; i < n; i++) {
+			double dx = image[i][0] - image[a][0];
+			double dy = image[i][1] - image[a][1];
+
+			dist2[i] = i == a ? -1.0 : dx * dx + dy * dy;
+		}
+		num_neighbours = constellation_closest(dist2, n, neighbours,
+						CONSTELLATION_BLOB_NEIGHBOURS);
+
+		for (i = 0; i < num_neighbours; i++) {
+			for (j = i + 1; j < num_neighbours; j++) {
+				int tri[3] = { a, neighbours[i], neighbours[j] };
+				int lo = min(min(tri[0], tri[1]), tri[2]);
+				int hi = max(max(tri[0], tri[1]), tri[2]);
+				int mid = tri[0] + tri[1] + tri[2] - lo - hi;
+				int key = (lo * CONSTELLATION_MAX_BLOBS + mid) *
+					  CONSTELLATION_MAX_BLOBS + hi;
+
+				if (tried[key / 64] & (1ULL << (key % 64)))
+					continue;
+				tried[key / 64] |= 1ULL << (key % 64);
+
+				constellation_try_triangle(&q, tri);
+			}
+		}
+	}
+
+	if (q.best < CONSTELLATION_MIN_INLIERS || 2 * q.best < n)
+		return -ENOENT;
+
+	*rot = q.rot;
+	*trans = q.trans;
+
+	return q.best;
+}
@@ -0,0 +1,24 @@
+/*
+ * Pose acquisition by LED constellation matching
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __CONSTELLATION_H__
+#define __CONSTELLATION_H__
+
+#include "maths.h"
+
+struct blob;
+struct constellation;
+struct distortion;
+struct tracking_model;
+
+struct constellation *constellation_new(const struct tracking_model *model);
+void constellation_free(struct constellation *c);
+
+int constellation_search(const struct constellation *c, struct blob *blobs,
+			 int num_blobs, int object_id, dmat3 *camera_matrix,
+			 const struct distortion *distortion, dquat *rot,
+			 dvec3 *trans);
+
+#endif /* __CONSTELLATION_H__ */
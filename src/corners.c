@@ -0,0 +1,346 @@
+/*
+ * FAST corner detection
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "corners.h"
+
+#define CORNER_DEFAULT_THRESHOLD	20
+#define CORNER_BORDER			3
+
+struct corner_detector {
+	int width;
+	int height;
+	int max_keypoints;
+	uint8_t threshold;
+	int cells_x;
+	int cells_y;
+	struct keypoint *cells;
+};
+
+/* Bresenham circle of radius 3 around the center pixel, clockwise from top */
+static const int8_t circle[16][2] = {
+	{ 0, -3 }, { 1, -3 }, { 2, -2 }, { 3, -1 },
+	{ 3, 0 }, { 3, 1 }, { 2, 2 }, { 1, 3 },
+	{ 0, 3 }, { -1, 3 }, { -2, 2 }, { -3, 1 },
+	{ -3, 0 }, { -3, -1 }, { -2, -2 }, { -1, -3 },
+};
+
+struct corner_detector *corner_detector_new(int width, int height,
+					    int max_keypoints)
+{
+	struct corner_detector *cd;
+
+	cd = calloc(1, sizeof(*cd));
+	if (!cd)
+		return NULL;
+
+	cd->width = width;
+	cd->height = height;
+	cd->max_keypoints = max_keypoints;
+	cd->threshold = CORNER_DEFAULT_THRESHOLD;
+	cd->cells_x = (width + CORNER_CELL_SIZE - 1) / CORNER_CELL_SIZE;
+	cd->cells_y = (height + CORNER_CELL_SIZE - 1) / CORNER_CELL_SIZE;
+	cd->cells = calloc(cd->cells_x * cd->cells_y, sizeof(*cd->cells));
+	if (!cd->cells) {
+		free(cd);
+		return NULL;
+	}
+
+	return cd;
+}
+
+void corner_detector_free(struct corner_detector *cd)
+{
+	if (!cd)
+		return;
+
+	free(cd->cells);
+	free(cd);
+}
+
+/*
+ * Sets the minimum intensity difference between the center pixel and the
+ * circle pixels.
+ */
+void corner_detector_set_threshold(struct corner_detector *cd,
+				   uint8_t threshold)
+{
+	cd->threshold = threshold;
+}
+
+uint8_t corner_detector_get_threshold(struct corner_detector *cd)
+{
+	return cd->threshold;
+}
+
+/*
+ * Returns true if the 16-bit circular mask contains 9 contiguous bits.
+ */
+static inline bool has_arc9(uint32_t mask)
+{
+	mask |= mask << 16;
+	mask &= mask >> 1;
+	mask &= mask >> 2;
+	mask &= mask >> 4;
+	mask &= mask >> 1;
+
+	return mask != 0;
+}
+
+/*
+ * Runs the full FAST-9 segment test on a candidate pixel. Returns the sum of
+ * absolute differences beyond the threshold over the brighter or darker
+ * circle pixels, whichever is larger, or 0 if the pixel is not a corner.
+ */
+static int fast9_score(const uint8_t *p, int stride, int threshold)
+{
+	int v = p[0];
+	uint32_t bright = 0;
+	uint32_t dark = 0;
+	int sum_bright = 0;
+	int sum_dark = 0;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		int c = p[circle[i][1] * stride + circle[i][0]];
+
+		if (c > v + threshold) {
+			bright |= 1 << i;
+			sum_bright += c - v - threshold;
+		} else if (c < v - threshold) {
+			dark |= 1 << i;
+			sum_dark += v - c - threshold;
+		}
+	}
+
+	if (!has_arc9(bright))
+		sum_bright = 0;
+	if (!has_arc9(dark))
+		sum_dark = 0;
+
+	return sum_bright > sum_dark ? sum_bright : sum_dark;
+}
+
+/*
+ * Keeps the candidate if it is the best corner in its cell so far.
+ */
+static inline void corner_test(struct corner_detector *cd,
+			       const uint8_t *frame, int stride, int x, int y)
+{
+	struct keypoint *cell;
+	int score;
+
+	score = fast9_score(frame + y * stride + x, stride, cd->threshold);
+	if (!score)
+		return;
+
+	cell = &cd->cells[(y / CORNER_CELL_SIZE) * cd->cells_x +
+			  x / CORNER_CELL_SIZE];
+	if (score > cell->score) {
+		cell->x = x;
+		cell->y = y;
+		cell->score = score;
+	}
+}
+
+/*
+ * Any arc of 9 contiguous circle pixels contains two neighboring compass
+ * points. Returns true if a pair of neighboring compass pixels is brighter
+ * or darker than the center pixel.
+ */
+static inline bool fast9_precheck(const uint8_t *p, int stride, int threshold)
+{
+	int v = p[0];
+	int c0 = p[-3 * stride];
+	int c4 = p[3];
+	int c8 = p[3 * stride];
+	int c12 = p[-3];
+	int b = (c0 > v + threshold) | (c4 > v + threshold) << 1 |
+		(c8 > v + threshold) << 2 | (c12 > v + threshold) << 3;
+	int d = (c0 < v - threshold) | (c4 < v - threshold) << 1 |
+		(c8 < v - threshold) << 2 | (c12 < v - threshold) << 3;
+
+	b &= (b >> 1) | (b << 3);
+	d &= (d >> 1) | (d << 3);
+
+	return (b | d) & 0xf;
+}
+
+static void corner_scan_line(struct corner_detector *cd,
+			     const uint8_t *frame, int stride, int y)
+{
+	const uint8_t *line = frame + y * stride;
+	int x = CORNER_BORDER;
+	int end = cd->width - CORNER_BORDER;
+
+#if defined(__SSE2__)
+	const __m128i t = _mm_set1_epi8(cd->threshold);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; x + 16 <= end; x += 16) {
+		const uint8_t *p = line + x;
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i hi = _mm_adds_epu8(v, t);
+		__m128i lo = _mm_subs_epu8(v, t);
+		__m128i c0 = _mm_loadu_si128((const __m128i *)(p - 3 * stride));
+		__m128i c4 = _mm_loadu_si128((const __m128i *)(p + 3));
+		__m128i c8 = _mm_loadu_si128((const __m128i *)(p + 3 * stride));
+		__m128i c12 = _mm_loadu_si128((const __m128i *)(p - 3));
+		/* c > hi and c < lo, as 0x00 in bytes where true */
+		__m128i b0 = _mm_cmpeq_epi8(_mm_subs_epu8(c0, hi), zero);
+		__m128i b4 = _mm_cmpeq_epi8(_mm_subs_epu8(c4, hi), zero);
+		__m128i b8 = _mm_cmpeq_epi8(_mm_subs_epu8(c8, hi), zero);
+		__m128i b12 = _mm_cmpeq_epi8(_mm_subs_epu8(c12, hi), zero);
+		__m128i d0 = _mm_cmpeq_epi8(_mm_subs_epu8(lo, c0), zero);
+		__m128i d4 = _mm_cmpeq_epi8(_mm_subs_epu8(lo, c4), zero);
+		__m128i d8 = _mm_cmpeq_epi8(_mm_subs_epu8(lo, c8), zero);
+		__m128i d12 = _mm_cmpeq_epi8(_mm_subs_epu8(lo, c12), zero);
+		/* No neighboring pair brighter or darker, as 0xff */
+		__m128i reject = _mm_and_si128(
+			_mm_and_si128(_mm_or_si128(b0, b4),
+				      _mm_or_si128(b4, b8)),
+			_mm_and_si128(_mm_or_si128(b8, b12),
+				      _mm_or_si128(b12, b0)));
+		reject = _mm_and_si128(reject, _mm_and_si128(
+			_mm_and_si128(_mm_or_si128(d0, d4),
+				      _mm_or_si128(d4, d8)),
+			_mm_and_si128(_mm_or_si128(d8, d12),
+				      _mm_or_si128(d12, d0))));
+		unsigned int mask = ~_mm_movemask_epi8(reject) & 0xffff;
+
+		while (mask) {
+			int i = __builtin_ctz(mask);
+
+			corner_test(cd, frame, stride, x + i, y);
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; x < end; x++) {
+		if (fast9_precheck(line + x, stride, cd->threshold))
+			corner_test(cd, frame, stride, x, y);
+	}
+}
+
+/*
+ * Calculates the orientation from the intensity centroid of the patch
+ * around the keypoint.
+ */
+static float corner_angle(const uint8_t *frame, int stride,
+			  const struct keypoint *kp)
+{
+	int m01 = 0;
+	int m10 = 0;
+	int dx, dy;
+
+	for (dy = -3; dy <= 3; dy++) {
+		const uint8_t *line = frame + (kp->y + dy) * stride + kp->x;
+
+		for (dx = -3; dx <= 3; dx++) {
+			if (dx * dx + dy * dy > 10)
+				continue;
+			m10 += dx * line[dx];
+			m01 += dy * line[dx];
+		}
+	}
+
+	return atan2f(m01, m10);
+}
+
+static int keypoint_compare_score(const void *a, const void *b)
+{
+	const struct keypoint *ka = a;
+	const struct keypoint *kb = b;
+
+	return kb->score - ka->score;
+}
+
+/*
+ * Sorts the occupied cells by descending score and stores the orientation of
+ * the best max_keypoints corners.
+ */
+static int corner_select(struct corner_detector *cd, const uint8_t *frame,
+			 int stride, struct keypoint *keypoints)
+{
+	int num_cells = cd->cells_x * cd->cells_y;
+	int num = 0;
+	int i;
+
+	/* Compact the occupied cells in place */
+	for (i = 0; i < num_cells; i++) {
+		if (cd->cells[i].score)
+			cd->cells[num++] = cd->cells[i];
+	}
+
+	qsort(cd->cells, num, sizeof(*cd->cells), keypoint_compare_score);
+	if (num > cd->max_keypoints)
+		num = cd->max_keypoints;
+
+	for (i = 0; i < num; i++) {
+		keypoints[i] = cd->cells[i];
+		keypoints[i].angle = corner_angle(frame, stride, &keypoints[i]);
+	}
+
+	return num;
+}
+
+/*
+ * Finds up to max_keypoints corners in a frame, keeping only the best corner
+ * of each cell, and the cells with the highest scoring corners. The frame is
+ * width x height pixels of 8-bit luma, with lines stride bytes apart.
+ *
+ * Returns the number of keypoints stored, sorted by descending score.
+ */
+int corner_detector_process(struct corner_detector *cd,
+			    const uint8_t *frame, int stride,
+			    struct keypoint *keypoints)
+{
+	int y;
+
+	memset(cd->cells, 0, cd->cells_x * cd->cells_y * sizeof(*cd->cells));
+
+	for (y = CORNER_BORDER; y < cd->height - CORNER_BORDER; y++)
+		corner_scan_line(cd, frame, stride, y);
+
+	return corner_select(cd, frame, stride, keypoints);
+}
+
+/*
+ * Selects keypoints from the best corner of each cell that was already
+ * found elsewhere, for example by a GPU compute kernel. cells contains one
+ * CORNER_CELL_PACK() value per cell, in row-major order, or 0 for cells
+ * without corners. The frame is only read to calculate the orientations.
+ *
+ * Returns the number of keypoints stored, sorted by descending score.
+ */
+int corner_detector_process_cells(struct corner_detector *cd,
+				  const uint8_t *frame, int stride,
+				  const uint32_t *cells,
+				  struct keypoint *keypoints)
+{
+	int i;
+
+	for (i = 0; i < cd->cells_x * cd->cells_y; i++) {
+		struct keypoint *cell = &cd->cells[i];
+		int offset = 255 - (cells[i] & 0xff);
+
+		cell->score = cells[i] >> 8;
+		cell->x = (i % cd->cells_x) * CORNER_CELL_SIZE +
+			  offset % CORNER_CELL_SIZE;
+		cell->y = (i / cd->cells_x) * CORNER_CELL_SIZE +
+			  offset / CORNER_CELL_SIZE;
+	}
+
+	return corner_select(cd, frame, stride, keypoints);
+}
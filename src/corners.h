@@ -0,0 +1,51 @@
+/*
+ * FAST corner detection
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __CORNERS_H__
+#define __CORNERS_H__
+
+#include <stdint.h>
+
+/*
+ * A corner found by the FAST-9 segment test, with its score and the ORB
+ * style orientation of the intensity centroid around it, in radians.
+ */
+struct keypoint {
+	uint16_t x;
+	uint16_t y;
+	uint16_t score;
+	float angle;
+};
+
+/* The best corner of each cell is kept, to spread keypoints over the image */
+#define CORNER_CELL_SIZE		16
+
+/*
+ * Packs the score and cell local position of a corner into a value that
+ * compares larger for higher scores, and for earlier positions in row-major
+ * order at equal scores.
+ */
+#define CORNER_CELL_PACK(score, x, y) \
+	((uint32_t)(score) << 8 | (255 - ((y) % CORNER_CELL_SIZE * \
+					  CORNER_CELL_SIZE + \
+					  (x) % CORNER_CELL_SIZE)))
+
+struct corner_detector;
+
+struct corner_detector *corner_detector_new(int width, int height,
+					    int max_keypoints);
+void corner_detector_free(struct corner_detector *cd);
+void corner_detector_set_threshold(struct corner_detector *cd,
+				   uint8_t threshold);
+uint8_t corner_detector_get_threshold(struct corner_detector *cd);
+int corner_detector_process(struct corner_detector *cd,
+			    const uint8_t *frame, int stride,
+			    struct keypoint *keypoints);
+int corner_detector_process_cells(struct corner_detector *cd,
+				  const uint8_t *frame, int stride,
+				  const uint32_t *cells,
+				  struct keypoint *keypoints);
+
+#endif /* __CORNERS_H__ */
@@ -3,19 +3,68 @@
  * Copyright 2015 Philipp Zabel
  * SPDX-License-Identifier:	GPL-2.0+
  */
+#include <errno.h>
 #include <glib.h>
 #include <gio/gio.h>
 #include <gio/gunixfdlist.h>
+#include <unistd.h>
 
 #include "camera.h"
 #include "camera-dk2.h"
 #include "device.h"
+#include "frame-queue.h"
 #include "gdbus-generated.h"
+#include "motion-controller.h"
 #include "ouvrtd.h"
 #include "rift.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "telemetry-shm.h"
+#include "tracker.h"
+
+/* interval in seconds at which the calibrated camera poses are published */
+#define OUVRT_DBUS_CAMERA_POSES_INTERVAL	1
 
 static GDBusObjectManagerServer *manager = NULL;
 
+/* A tracker acquired by a single bus client */
+struct tracker_client {
+	gchar *key;
+	OuvrtTracker *tracker;
+	guint watcher_id;
+};
+
+/* Maps unique bus name and device node to struct tracker_client */
+static GHashTable *tracker_clients = NULL;
+
+/* Telemetry subscriptions made by a single bus client */
+struct telemetry_client {
+	guint watcher_id;
+	GArray *subscriptions;
+};
+
+struct telemetry_subscription {
+	gint device;
+	guint32 types;
+};
+
+/* Maps unique bus names to struct telemetry_client */
+static GHashTable *telemetry_clients = NULL;
+
+/* Maps devices to their exported Device1 objects */
+static GHashTable *device_objects = NULL;
+static guint num_device_objects;
+
+static void tracker_client_free(gpointer data)
+{
+	struct tracker_client *client = data;
+
+	ouvrt_tracker_release(client->tracker);
+	g_object_unref(client->tracker);
+	g_bus_unwatch_name(client->watcher_id);
+	g_free(client);
+}
+
 /*
  * Creates the object manager when the D-Bus connection is available.
  */
@@ -30,16 +79,28 @@ static void ouvrt_dbus_on_bus_acquired(GDBusConnection *connection,
 		g_warning("ouvrtd: Unix FD passing not supported!\n");
 	}
 
+	tracker_clients = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, tracker_client_free);
+	device_objects = g_hash_table_new_full(NULL, NULL, NULL,
+					       g_object_unref);
+
 	/* org.freedesktop.DBus.ObjectManager */
 	manager = g_dbus_object_manager_server_new("/de/phfuenf/ouvrt");
 	g_dbus_object_manager_server_set_connection(manager, connection);
 }
 
+/*
+ * Releases the tracker acquired by a client that left the bus without
+ * calling Release.
+ */
 static void sender_vanished_handler(G_GNUC_UNUSED GDBusConnection *connection,
 				    const gchar *name,
-				    G_GNUC_UNUSED gpointer user_data)
+				    gpointer user_data)
 {
+	struct tracker_client *client = user_data;
+
 	g_print("Watched name %s disappeared from the bus\n", name);
+	g_hash_table_remove(tracker_clients, client->key);
 }
 
 static gboolean ouvrt_tracker1_on_handle_acquire(OuvrtTracker1 *object,
@@ -48,8 +109,11 @@ static gboolean ouvrt_tracker1_on_handle_acquire(OuvrtTracker1 *object,
 						 gpointer user_data)
 {
 	OuvrtDevice *dev = OUVRT_DEVICE(user_data);
+	struct tracker_client *client;
+	OuvrtTracker *tracker;
 	GError *error = NULL;
 	const gchar *sender;
+	gchar *key;
 	int fd;
 
 	if (fd_list != NULL) {
@@ -57,29 +121,53 @@ static gboolean ouvrt_tracker1_on_handle_acquire(OuvrtTracker1 *object,
 		g_object_unref(fd_list);
 	}
 
+	if (!OUVRT_IS_RIFT(dev)) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+				"Device %s has no pose output", dev->devnode);
+		return TRUE;
+	}
+
+	tracker = ouvrt_rift_get_tracker(OUVRT_RIFT(dev));
+	fd = ouvrt_tracker_get_pose_fd(tracker);
+	if (fd < 0) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR, g_io_error_from_errno(-fd),
+				"Failed to create pose output: %d", fd);
+		return TRUE;
+	}
+
 	sender = g_dbus_method_invocation_get_sender(invocation);
 
 	g_print("Tracker1 interface of device %s acquired by %s\n",
 		dev->devnode, sender);
 
-	/* Add a watch on sender */
-	guint watcher_id = g_bus_watch_name(G_BUS_TYPE_SESSION, sender,
-					    G_BUS_NAME_WATCHER_FLAGS_NONE,
-					    NULL, /* name_appeared_handler */
-					    sender_vanished_handler,
-					    NULL, /* user_data */
-					    NULL); /* user_data_free_func */
-
-	(void)watcher_id;
-
-	/* FIXME */
-	fd = 1; /* stdout */
+	/* Keep the pipeline running until the client releases or leaves */
+	key = g_strdup_printf("%s %s", sender, dev->devnode);
+	if (!g_hash_table_contains(tracker_clients, key)) {
+		client = g_new0(struct tracker_client, 1);
+		client->key = key;
+		client->tracker = g_object_ref(tracker);
+		ouvrt_tracker_acquire(tracker);
+		g_hash_table_insert(tracker_clients, key, client);
+
+		/* Add a watch on sender */
+		client->watcher_id = g_bus_watch_name(G_BUS_TYPE_SESSION,
+					sender, G_BUS_NAME_WATCHER_FLAGS_NONE,
+					NULL, /* name_appeared_handler */
+					sender_vanished_handler, client,
+					NULL); /* user_data_free_func */
+	} else {
+		g_free(key);
+	}
 
-	fd_list = NULL;
 	fd_list = g_unix_fd_list_new();
 	g_unix_fd_list_append(fd_list, fd, &error);
+	/* The fd list holds its own duplicate */
+	close(fd);
 
 	ouvrt_tracker1_complete_acquire(object, invocation, fd_list);
+	g_object_unref(fd_list);
 
 	return TRUE;
 }
@@ -90,12 +178,17 @@ static gboolean ouvrt_tracker1_on_handle_release(OuvrtTracker1 *object,
 {
 	OuvrtDevice *dev = OUVRT_DEVICE(user_data);
 	const gchar *sender;
+	gchar *key;
 
 	sender = g_dbus_method_invocation_get_sender(invocation);
 
 	g_print("Tracker1 interface of device %s released by %s\n",
 		dev->devnode, sender);
 
+	key = g_strdup_printf("%s %s", sender, dev->devnode);
+	g_hash_table_remove(tracker_clients, key);
+	g_free(key);
+
 	ouvrt_tracker1_complete_release(object, invocation);
 
 	return TRUE;
@@ -154,19 +247,181 @@ static void ouvrt_tracker1_on_flicker_changed(GObject *object,
 	}
 }
 
+/*
+ * Signal change notification for the Tracker1 prediction-horizon property.
+ */
+static void ouvrt_tracker1_on_prediction_horizon_changed(GObject *object,
+							 GParamSpec *spec,
+							 gpointer user_data)
+{
+	OuvrtTracker1 *tracker = OUVRT_TRACKER1(object);
+	OuvrtDevice *dev = user_data;
+	gdouble horizon, applied;
+
+	if (!OUVRT_IS_RIFT(dev))
+		return;
+
+	if (g_strcmp0(g_param_spec_get_name(spec), "prediction-horizon") != 0)
+		return;
+
+	horizon = ouvrt_tracker1_get_prediction_horizon(tracker);
+	applied = ouvrt_tracker_set_prediction_horizon(
+			ouvrt_rift_get_tracker(OUVRT_RIFT(dev)), horizon);
+	/* Report the clamped value, this notifies again with no change */
+	if (applied != horizon) {
+		ouvrt_tracker1_set_prediction_horizon(tracker, applied);
+		return;
+	}
+	g_print("Prediction horizon set to %.1f ms\n", horizon * 1e3);
+}
+
+/*
+ * Updates the TrackingParameters1 properties from the tracker.
+ */
+static void ouvrt_tracking_parameters1_update(OuvrtTrackingParameters1 *object,
+					      OuvrtTracker *tracker)
+{
+	struct tracker_params params;
+
+	ouvrt_tracker_get_params(tracker, &params);
+	ouvrt_tracking_parameters1_set_threshold(object, params.threshold);
+	ouvrt_tracking_parameters1_set_min_extent_length(object,
+						params.min_extent_length);
+	ouvrt_tracking_parameters1_set_ransac_iterations(object,
+						params.pnp.ransac_iterations);
+	ouvrt_tracking_parameters1_set_reprojection_error(object,
+						params.pnp.reprojection_error);
+	ouvrt_tracking_parameters1_set_confidence(object,
+						  params.pnp.confidence);
+	ouvrt_tracking_parameters1_set_transfers(object, params.num_transfers);
+}
+
+/*
+ * Handles the TrackingParameters1.Set method: updates all given parameters
+ * at once, or none if any of them is unknown or invalid.
+ */
+static gboolean
+ouvrt_tracking_parameters1_on_handle_set(OuvrtTrackingParameters1 *object,
+					 GDBusMethodInvocation *invocation,
+					 GVariant *parameters,
+					 gpointer user_data)
+{
+	OuvrtTracker *tracker = ouvrt_rift_get_tracker(OUVRT_RIFT(user_data));
+	struct tracker_params params;
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *value;
+
+	ouvrt_tracker_get_params(tracker, &params);
+
+	g_variant_iter_init(&iter, parameters);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+		gboolean valid = TRUE;
+
+		if (g_strcmp0(key, "Threshold") == 0 &&
+		    g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32))
+			params.threshold = MIN(g_variant_get_uint32(value), 255);
+		else if (g_strcmp0(key, "MinExtentLength") == 0 &&
+			 g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32))
+			params.min_extent_length = MIN(g_variant_get_uint32(value),
+						       G_MAXINT);
+		else if (g_strcmp0(key, "RansacIterations") == 0 &&
+			 g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32))
+			params.pnp.ransac_iterations =
+				MIN(g_variant_get_uint32(value), G_MAXINT);
+		else if (g_strcmp0(key, "ReprojectionError") == 0 &&
+			 g_variant_is_of_type(value, G_VARIANT_TYPE_DOUBLE))
+			params.pnp.reprojection_error = g_variant_get_double(value);
+		else if (g_strcmp0(key, "Confidence") == 0 &&
+			 g_variant_is_of_type(value, G_VARIANT_TYPE_DOUBLE))
+			params.pnp.confidence = g_variant_get_double(value);
+		else if (g_strcmp0(key, "Transfers") == 0 &&
+			 g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32))
+			params.num_transfers = MIN(g_variant_get_uint32(value),
+						   G_MAXINT);
+		else
+			valid = FALSE;
+		g_variant_unref(value);
+
+		if (!valid) {
+			g_dbus_method_invocation_return_error(invocation,
+					G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+					"Unknown parameter or wrong type: %s",
+					key);
+			return TRUE;
+		}
+	}
+
+	if (ouvrt_tracker_set_params(tracker, &params) < 0) {
+		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+						      G_DBUS_ERROR_INVALID_ARGS,
+						      "Parameter out of range");
+		return TRUE;
+	}
+
+	ouvrt_tracking_parameters1_update(object, tracker);
+	g_print("Tracking parameters: threshold %d, min extent %d, "
+		"%d iterations, %.1f px, confidence %.3f, %d transfers\n",
+		params.threshold, params.min_extent_length,
+		params.pnp.ransac_iterations, params.pnp.reprojection_error,
+		params.pnp.confidence, params.num_transfers);
+
+	ouvrt_tracking_parameters1_complete_set(object, invocation);
+	return TRUE;
+}
+
+/*
+ * Publishes the world space poses of all calibrated cameras in the Tracker1
+ * CameraPoses property. Only changes are signalled on the bus.
+ */
+static gboolean ouvrt_tracker1_update_camera_poses(gpointer user_data)
+{
+	OuvrtTracker1 *tracker1 = OUVRT_TRACKER1(user_data);
+	OuvrtTracker *tracker = g_object_get_data(G_OBJECT(tracker1),
+						  "tracker");
+	GVariantBuilder builder;
+	struct dpose pose;
+	int i, ret;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(uddddddd)"));
+	for (i = 0; ; i++) {
+		ret = ouvrt_tracker_get_camera_pose(tracker, i, &pose);
+		if (ret == -EINVAL)
+			break;
+		if (ret < 0)
+			continue;
+		g_variant_builder_add(&builder, "(uddddddd)", i,
+				      pose.translation.x, pose.translation.y,
+				      pose.translation.z, pose.rotation.x,
+				      pose.rotation.y, pose.rotation.z,
+				      pose.rotation.w);
+	}
+	ouvrt_tracker1_set_camera_poses(tracker1,
+					g_variant_builder_end(&builder));
+
+	return G_SOURCE_CONTINUE;
+}
+
 /*
  * Exports a Tracker1 interface via D-Bus.
  */
 static void ouvrt_dbus_export_tracker1_interface(OuvrtDevice *dev)
 {
+	OuvrtTrackingParameters1 *parameters;
 	OuvrtObjectSkeleton *object;
 	OuvrtTracker1 *tracker;
+	GObject *device_object;
+	guint timeout;
 
 	g_print("Exporting Tracker1 interface for device %s\n", dev->devnode);
 
 	tracker = ouvrt_tracker1_skeleton_new();
 	ouvrt_tracker1_set_tracking(tracker, FALSE);
 	ouvrt_tracker1_set_flicker(tracker, TRUE);
+	ouvrt_tracker1_set_prediction_horizon(tracker, 0.0);
+	ouvrt_tracker1_set_camera_poses(tracker,
+			g_variant_new_array(G_VARIANT_TYPE("(uddddddd)"),
+					    NULL, 0));
 
 	g_signal_connect(tracker, "handle-acquire",
 			 G_CALLBACK(ouvrt_tracker1_on_handle_acquire), dev);
@@ -176,13 +431,46 @@ static void ouvrt_dbus_export_tracker1_interface(OuvrtDevice *dev)
 			 G_CALLBACK(ouvrt_tracker1_on_tracking_changed), dev);
 	g_signal_connect(tracker, "notify::flicker",
 			 G_CALLBACK(ouvrt_tracker1_on_flicker_changed), dev);
+	g_signal_connect(tracker, "notify::prediction-horizon",
+			 G_CALLBACK(ouvrt_tracker1_on_prediction_horizon_changed),
+			 dev);
 
 	object = ouvrt_object_skeleton_new("/de/phfuenf/ouvrt/tracker0");
 	ouvrt_object_skeleton_set_tracker1(object, tracker);
 	g_object_unref(tracker);
 
+	if (OUVRT_IS_RIFT(dev)) {
+		parameters = ouvrt_tracking_parameters1_skeleton_new();
+		ouvrt_tracking_parameters1_update(parameters,
+				ouvrt_rift_get_tracker(OUVRT_RIFT(dev)));
+		g_signal_connect(parameters, "handle-set",
+				 G_CALLBACK(ouvrt_tracking_parameters1_on_handle_set),
+				 dev);
+		ouvrt_object_skeleton_set_tracking_parameters1(object,
+							       parameters);
+		g_object_unref(parameters);
+
+		g_object_set_data_full(G_OBJECT(tracker), "tracker",
+				g_object_ref(ouvrt_rift_get_tracker(OUVRT_RIFT(dev))),
+				g_object_unref);
+		/* Updates the CameraPoses property until unexported */
+		timeout = g_timeout_add_seconds_full(G_PRIORITY_DEFAULT_IDLE,
+				OUVRT_DBUS_CAMERA_POSES_INTERVAL,
+				ouvrt_tracker1_update_camera_poses,
+				g_object_ref(tracker), g_object_unref);
+		g_object_set_data(G_OBJECT(object), "camera-poses-timeout",
+				  GUINT_TO_POINTER(timeout));
+	}
+
 	g_dbus_object_manager_server_export(manager,
 					    G_DBUS_OBJECT_SKELETON(object));
+
+	/* The Tracker1 object is unexported together with the device */
+	device_object = g_hash_table_lookup(device_objects, dev);
+	if (device_object) {
+		g_object_set_data_full(device_object, "tracker-object",
+				       g_object_ref(object), g_object_unref);
+	}
 	g_object_unref(object);
 }
 
@@ -233,11 +521,11 @@ static void ouvrt_dbus_export_camera1_interface(OuvrtDevice *dev)
 					       A[3], A[4], A[5],
 					       A[6], A[7], A[8]);
 	ouvrt_camera1_set_camera_matrix(camera1, variant);
-	variant = g_variant_new("(ddddd)", camera->dist_coeffs[0],
-					   camera->dist_coeffs[1],
-					   camera->dist_coeffs[2],
-					   camera->dist_coeffs[3],
-					   camera->dist_coeffs[4]);
+	variant = g_variant_new("(ddddd)", camera->distortion.k[0],
+					   camera->distortion.k[1],
+					   camera->distortion.k[2],
+					   camera->distortion.k[3],
+					   camera->distortion.k[4]);
 	ouvrt_camera1_set_distortion_coefficients(camera1, variant);
 
 	caps = "video/x-raw,format=GRAY8,width=752,height=480,framerate=60/1";
@@ -258,13 +546,251 @@ static void ouvrt_dbus_export_camera1_interface(OuvrtDevice *dev)
 	g_object_unref(object);
 }
 
-static void ouvrt_dbus_export_device_interface(gpointer data,
+static gboolean ouvrt_telemetry1_on_handle_open(OuvrtTelemetry1 *object,
+					       GDBusMethodInvocation *invocation,
+					       GUnixFDList *fd_list,
 					       G_GNUC_UNUSED gpointer user_data)
 {
-	OuvrtDevice *dev = OUVRT_DEVICE(data);
+	GError *error = NULL;
+	int fd;
+
+	if (fd_list != NULL) {
+		g_warning("Telemetry1.Open ignoring received fd list\n");
+		g_object_unref(fd_list);
+	}
+
+	fd = telemetry_shm_get_fd();
+	if (fd < 0) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR, g_io_error_from_errno(-fd),
+				"Failed to open telemetry ring: %d", fd);
+		return TRUE;
+	}
+
+	fd_list = g_unix_fd_list_new();
+	g_unix_fd_list_append(fd_list, fd, &error);
+	/* The fd list holds its own duplicate */
+	close(fd);
+
+	ouvrt_telemetry1_complete_open(object, invocation, fd_list);
+	g_object_unref(fd_list);
+
+	return TRUE;
+}
+
+static void telemetry_client_free(gpointer data)
+{
+	struct telemetry_client *client = data;
+	struct telemetry_subscription *sub;
+	guint i;
+
+	for (i = 0; i < client->subscriptions->len; i++) {
+		sub = &g_array_index(client->subscriptions,
+				     struct telemetry_subscription, i);
+		telemetry_unsubscribe(sub->device, sub->types);
+	}
+	g_array_free(client->subscriptions, TRUE);
+	g_bus_unwatch_name(client->watcher_id);
+	g_free(client);
+}
+
+/*
+ * Drops all telemetry subscriptions of a client that left the bus.
+ */
+static void telemetry_client_vanished(G_GNUC_UNUSED GDBusConnection *connection,
+				      const gchar *name,
+				      G_GNUC_UNUSED gpointer user_data)
+{
+	g_print("Telemetry client %s disappeared from the bus\n", name);
+	g_hash_table_remove(telemetry_clients, name);
+}
+
+static gboolean ouvrt_telemetry1_on_handle_subscribe(OuvrtTelemetry1 *object,
+						     GDBusMethodInvocation *invocation,
+						     gint device, guint types,
+						     G_GNUC_UNUSED gpointer user_data)
+{
+	struct telemetry_subscription sub = { device, types };
+	struct telemetry_client *client;
+	const gchar *sender;
+	int ret;
+
+	ret = telemetry_subscribe(device, types);
+	if (ret < 0) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+				"Invalid telemetry subscription");
+		return TRUE;
+	}
+
+	sender = g_dbus_method_invocation_get_sender(invocation);
+	client = g_hash_table_lookup(telemetry_clients, sender);
+	if (!client) {
+		client = g_new0(struct telemetry_client, 1);
+		client->subscriptions = g_array_new(FALSE, FALSE,
+				sizeof(struct telemetry_subscription));
+		client->watcher_id = g_bus_watch_name(G_BUS_TYPE_SESSION,
+				sender, G_BUS_NAME_WATCHER_FLAGS_NONE,
+				NULL, telemetry_client_vanished, NULL, NULL);
+		g_hash_table_insert(telemetry_clients, g_strdup(sender),
+				    client);
+	}
+	g_array_append_val(client->subscriptions, sub);
+
+	ouvrt_telemetry1_complete_subscribe(object, invocation);
+
+	return TRUE;
+}
+
+static gboolean ouvrt_telemetry1_on_handle_unsubscribe(OuvrtTelemetry1 *object,
+						       GDBusMethodInvocation *invocation,
+						       gint device, guint types,
+						       G_GNUC_UNUSED gpointer user_data)
+{
+	struct telemetry_subscription *sub;
+	struct telemetry_client *client;
+	const gchar *sender;
+	guint i;
+
+	sender = g_dbus_method_invocation_get_sender(invocation);
+	client = g_hash_table_lookup(telemetry_clients, sender);
+	for (i = 0; client && i < client->subscriptions->len; i++) {
+		sub = &g_array_index(client->subscriptions,
+				     struct telemetry_subscription, i);
+		if (sub->device == device && sub->types == types) {
+			telemetry_unsubscribe(device, types);
+			g_array_remove_index_fast(client->subscriptions, i);
+			break;
+		}
+	}
+
+	ouvrt_telemetry1_complete_unsubscribe(object, invocation);
+
+	return TRUE;
+}
+
+static void ouvrt_stats1_add_histogram(const struct histogram_stats *stats,
+				       void *data)
+{
+	GVariantBuilder *builder = data;
+	GVariantBuilder buckets;
+	int i;
+
+	g_variant_builder_init(&buckets, G_VARIANT_TYPE("au"));
+	for (i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+		g_variant_builder_add(&buckets, "u", stats->buckets[i]);
+
+	g_variant_builder_add(builder, "(sttuau)", stats->name, stats->count,
+			      stats->sum_us, stats->max_us, &buckets);
+}
+
+static gboolean ouvrt_stats1_on_handle_get_histograms(OuvrtStats1 *object,
+						      GDBusMethodInvocation *invocation,
+						      G_GNUC_UNUSED gpointer user_data)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(sttuau)"));
+	stats_foreach(ouvrt_stats1_add_histogram, &builder);
+
+	ouvrt_stats1_complete_get_histograms(object, invocation,
+					     g_variant_builder_end(&builder));
+
+	return TRUE;
+}
+
+static void ouvrt_stats1_add_queue(const struct frame_queue_stats *stats,
+				   void *data)
+{
+	GVariantBuilder *builder = data;
+
+	g_variant_builder_add(builder, "(ssuuutt)", stats->name,
+			      stats->policy, stats->capacity, stats->depth,
+			      stats->max_depth, stats->pushed, stats->dropped);
+}
+
+static gboolean ouvrt_stats1_on_handle_get_queues(OuvrtStats1 *object,
+						  GDBusMethodInvocation *invocation,
+						  G_GNUC_UNUSED gpointer user_data)
+{
+	GVariantBuilder builder;
 
-	g_debug("TODO: register %s with DBus\n", dev->devnode);
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(ssuuutt)"));
+	frame_queue_foreach(ouvrt_stats1_add_queue, &builder);
 
+	ouvrt_stats1_complete_get_queues(object, invocation,
+					 g_variant_builder_end(&builder));
+
+	return TRUE;
+}
+
+/*
+ * Exports a Stats1 interface via D-Bus.
+ */
+static void ouvrt_dbus_export_stats1_interface(void)
+{
+	OuvrtObjectSkeleton *object;
+	OuvrtStats1 *stats;
+
+	g_print("Exporting Stats1 interface\n");
+
+	stats = ouvrt_stats1_skeleton_new();
+
+	g_signal_connect(stats, "handle-get-histograms",
+			 G_CALLBACK(ouvrt_stats1_on_handle_get_histograms),
+			 NULL);
+	g_signal_connect(stats, "handle-get-queues",
+			 G_CALLBACK(ouvrt_stats1_on_handle_get_queues), NULL);
+
+	object = ouvrt_object_skeleton_new("/de/phfuenf/ouvrt/stats0");
+	ouvrt_object_skeleton_set_stats1(object, stats);
+	g_object_unref(stats);
+
+	g_dbus_object_manager_server_export(manager,
+					    G_DBUS_OBJECT_SKELETON(object));
+	g_object_unref(object);
+}
+
+/*
+ * Exports a Telemetry1 interface via D-Bus.
+ */
+static void ouvrt_dbus_export_telemetry1_interface(void)
+{
+	OuvrtObjectSkeleton *object;
+	OuvrtTelemetry1 *telemetry;
+
+	g_print("Exporting Telemetry1 interface\n");
+
+	telemetry_clients = g_hash_table_new_full(g_str_hash, g_str_equal,
+						  g_free,
+						  telemetry_client_free);
+
+	telemetry = ouvrt_telemetry1_skeleton_new();
+	ouvrt_telemetry1_set_ring_size(telemetry, telemetry_shm_get_size());
+
+	g_signal_connect(telemetry, "handle-open",
+			 G_CALLBACK(ouvrt_telemetry1_on_handle_open), NULL);
+	g_signal_connect(telemetry, "handle-subscribe",
+			 G_CALLBACK(ouvrt_telemetry1_on_handle_subscribe),
+			 NULL);
+	g_signal_connect(telemetry, "handle-unsubscribe",
+			 G_CALLBACK(ouvrt_telemetry1_on_handle_unsubscribe),
+			 NULL);
+
+	object = ouvrt_object_skeleton_new("/de/phfuenf/ouvrt/telemetry0");
+	ouvrt_object_skeleton_set_telemetry1(object, telemetry);
+	g_object_unref(telemetry);
+
+	g_dbus_object_manager_server_export(manager,
+					    G_DBUS_OBJECT_SKELETON(object));
+	g_object_unref(object);
+}
+
+/*
+ * Exports the device specific interfaces of a running device.
+ */
+static void ouvrt_dbus_export_device_interfaces(OuvrtDevice *dev)
+{
 	if (dev->type == DEVICE_TYPE_HMD) {
 		/* Export a Tracker1 interface */
 		ouvrt_dbus_export_tracker1_interface(dev);
@@ -277,8 +803,161 @@ static void ouvrt_dbus_export_device_interface(gpointer data,
 }
 
 /*
- * Exports Tracker1 and Camera1 interfaces via D-Bus as soon as the
- * Ouvrtd name was acquired on the bus.
+ * Returns a read-only file descriptor of a pose output of the device, which
+ * is updated at IMU rate.
+ */
+static gboolean ouvrt_device1_on_handle_open_pose(OuvrtDevice1 *object,
+						  GDBusMethodInvocation *invocation,
+						  GUnixFDList *fd_list,
+						  guint index,
+						  gpointer user_data)
+{
+	OuvrtDevice *dev = OUVRT_DEVICE(user_data);
+	GError *error = NULL;
+	int fd;
+
+	if (fd_list != NULL) {
+		g_warning("Device1.OpenPose ignoring received fd list\n");
+		g_object_unref(fd_list);
+	}
+
+	if (OUVRT_IS_RIFT(dev)) {
+		fd = ouvrt_rift_get_pose_fd(OUVRT_RIFT(dev), index);
+	} else if (OUVRT_IS_MOTION_CONTROLLER(dev) && index == 0) {
+		fd = ouvrt_motion_controller_get_pose_fd(
+				OUVRT_MOTION_CONTROLLER(dev));
+	} else {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+				"Device %s has no pose output %u",
+				dev->devnode, index);
+		return TRUE;
+	}
+	if (fd < 0) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_IO_ERROR, g_io_error_from_errno(-fd),
+				"Failed to create pose output: %d", fd);
+		return TRUE;
+	}
+
+	fd_list = g_unix_fd_list_new();
+	g_unix_fd_list_append(fd_list, fd, &error);
+	/* The fd list holds its own duplicate */
+	close(fd);
+
+	ouvrt_device1_complete_open_pose(object, invocation, fd_list);
+	g_object_unref(fd_list);
+
+	return TRUE;
+}
+
+/*
+ * Exports a Device1 interface via D-Bus, and the device specific interfaces
+ * if the device is already running. Devices detected before the name was
+ * acquired are exported from ouvrt_dbus_on_name_acquired.
+ */
+void ouvrt_dbus_export_device(OuvrtDevice *dev)
+{
+	OuvrtObjectSkeleton *object;
+	OuvrtDevice1 *device1;
+	gchar *path;
+
+	if (!manager || g_hash_table_contains(device_objects, dev))
+		return;
+
+	g_print("Exporting Device1 interface for device %s\n", dev->devnode);
+
+	device1 = ouvrt_device1_skeleton_new();
+	ouvrt_device1_set_name(device1, dev->name);
+	ouvrt_device1_set_serial(device1, dev->serial ? dev->serial : "");
+	ouvrt_device1_set_ready(device1, dev->active);
+	g_signal_connect(device1, "handle-open-pose",
+			 G_CALLBACK(ouvrt_device1_on_handle_open_pose), dev);
+
+	path = g_strdup_printf("/de/phfuenf/ouvrt/device%u",
+			       num_device_objects++);
+	object = ouvrt_object_skeleton_new(path);
+	g_free(path);
+	ouvrt_object_skeleton_set_device1(object, device1);
+	g_object_unref(device1);
+
+	g_dbus_object_manager_server_export(manager,
+					    G_DBUS_OBJECT_SKELETON(object));
+	g_hash_table_insert(device_objects, dev, object);
+
+	if (dev->active)
+		ouvrt_dbus_export_device_interfaces(dev);
+}
+
+/*
+ * Removes the Device1 object of a disconnected device, and its Tracker1
+ * object, if any.
+ */
+void ouvrt_dbus_unexport_device(OuvrtDevice *dev)
+{
+	GDBusObject *tracker_object;
+	GDBusObject *object;
+
+	if (!manager)
+		return;
+
+	object = g_hash_table_lookup(device_objects, dev);
+	if (!object)
+		return;
+
+	tracker_object = g_object_get_data(G_OBJECT(object), "tracker-object");
+	if (tracker_object) {
+		guint timeout = GPOINTER_TO_UINT(g_object_get_data(
+				G_OBJECT(tracker_object),
+				"camera-poses-timeout"));
+
+		if (timeout)
+			g_source_remove(timeout);
+		g_dbus_object_manager_server_unexport(manager,
+				g_dbus_object_get_object_path(tracker_object));
+	}
+
+	g_dbus_object_manager_server_unexport(manager,
+					      g_dbus_object_get_object_path(object));
+	g_hash_table_remove(device_objects, dev);
+}
+
+/*
+ * Signals that a device has finished starting by setting the Device1 Ready
+ * property, and exports its device specific interfaces.
+ */
+void ouvrt_dbus_device_ready(OuvrtDevice *dev)
+{
+	OuvrtObject *object;
+	OuvrtDevice1 *device1;
+
+	if (!manager)
+		return;
+
+	/*
+	 * Devices are exported when added, or when the name is acquired.
+	 * Unexported devices were removed and must not be exported again.
+	 */
+	object = g_hash_table_lookup(device_objects, dev);
+	if (!object)
+		return;
+
+	device1 = ouvrt_object_get_device1(object);
+	ouvrt_device1_set_ready(device1, TRUE);
+	g_object_unref(device1);
+
+	ouvrt_dbus_export_device_interfaces(dev);
+}
+
+static void ouvrt_dbus_export_device_interface(gpointer data,
+					       G_GNUC_UNUSED gpointer user_data)
+{
+	ouvrt_dbus_export_device(OUVRT_DEVICE(data));
+}
+
+/*
+ * Exports Device1, and for running devices Tracker1 and Camera1 interfaces
+ * via D-Bus as soon as the Ouvrtd name was acquired on the bus.
  */
 static void ouvrt_dbus_on_name_acquired(G_GNUC_UNUSED GDBusConnection *connection,
 					const gchar *name,
@@ -287,6 +966,8 @@ static void ouvrt_dbus_on_name_acquired(G_GNUC_UNUSED GDBusConnection *connectio
 	g_print("ouvrtd: Acquired name \"%s\"\n", name);
 
 	/* Now we are ready to serve our objects */
+	ouvrt_dbus_export_telemetry1_interface();
+	ouvrt_dbus_export_stats1_interface();
 	g_list_foreach(device_list, ouvrt_dbus_export_device_interface,
 		       NULL); /* user_data */
 }
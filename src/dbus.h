@@ -6,6 +6,11 @@
 #ifndef __DBUS_H__
 #define __DBUS_H__
 
+#include "device.h"
+
 guint ouvrt_dbus_own_name(void);
+void ouvrt_dbus_export_device(OuvrtDevice *dev);
+void ouvrt_dbus_unexport_device(OuvrtDevice *dev);
+void ouvrt_dbus_device_ready(OuvrtDevice *dev);
 
 #endif /* __DBUS_H__ */
@@ -16,8 +16,42 @@ struct debug_stream {
 	GstElement *pipeline;
 	GstElement *appsrc;
 	gboolean connected;
+	/* IMU sample fifo this stream is attached to as consumer */
+	struct debug_imu_fifo *imu_fifo;
+	/* full frame size */
+	int width;
+	int height;
+	/* only send a thumbnail and the blob windows */
+	bool crop;
 };
 
+/* if set, debug streams created afterwards use the crop mode */
+static bool debug_stream_crop;
+
+/* set once GStreamer is initialized */
+static gsize debug_gst_initialized;
+
+/*
+ * Initializes GStreamer on first use, with the GStreamer command line
+ * options if they were passed to debug_stream_init().
+ */
+static void debug_gst_init(int *argc, char **argv[])
+{
+	if (g_once_init_enter(&debug_gst_initialized)) {
+		gst_init(argc, argv);
+		g_once_init_leave(&debug_gst_initialized, 1);
+	}
+}
+
+/*
+ * Makes debug streams created afterwards only send a downscaled thumbnail
+ * and the windows around the blobs, instead of the full frames.
+ */
+void debug_stream_set_crop(bool crop)
+{
+	debug_stream_crop = crop;
+}
+
 /*
  * Enables the output of debug frames whenever a GStreamer shmsrc connects to
  * the ouvrtd-gst socket.
@@ -41,13 +75,18 @@ static void debug_gst_client_disconnected(G_GNUC_UNUSED GstElement *sink,
 					  gpointer data)
 {
 	struct debug_stream *gst = data;
+	struct debug_imu_fifo *fifo;
 
 	gst->connected = FALSE;
-	printf("debug: disconnected\n");
+	fifo = __atomic_exchange_n(&gst->imu_fifo, NULL, __ATOMIC_ACQ_REL);
+	debug_imu_fifo_detach(fifo, gst);
+	printf("debug: disconnected, %u IMU samples dropped\n",
+	       debug_imu_fifo_get_overflows(fifo));
 }
 
 /*
- * Enables GStreamer debug output of GRAY8 frames into a shmsink.
+ * Enables GStreamer debug output of GRAY8 frames into a shmsink. In crop
+ * mode, the GRAY8 frames are thumbnails downscaled by DEBUG_CROP_SCALE.
  */
 struct debug_stream *debug_stream_new(int width, int height, int framerate)
 {
@@ -67,8 +106,20 @@ struct debug_stream *debug_stream_new(int width, int height, int framerate)
 	if (!filename)
 		return NULL;
 
+	debug_gst_init(NULL, NULL);
 	pipeline = gst_pipeline_new(NULL);
 
+	gst = malloc(sizeof(*gst));
+	if (!gst)
+		return NULL;
+	gst->width = width;
+	gst->height = height;
+	gst->crop = debug_stream_crop;
+	if (gst->crop) {
+		width /= DEBUG_CROP_SCALE;
+		height /= DEBUG_CROP_SCALE;
+	}
+
 	src = gst_element_factory_make("appsrc", "src");
 	sink = gst_element_factory_make("shmsink", "sink");
 	if (src == NULL || sink == NULL)
@@ -92,12 +143,10 @@ struct debug_stream *debug_stream_new(int width, int height, int framerate)
 	gst_bin_add_many(GST_BIN(pipeline), src, sink, NULL);
 	gst_element_link_many(src, sink, NULL);
 
-	gst = malloc(sizeof(*gst));
-	if (!gst)
-		return NULL;
 	gst->pipeline = pipeline;
 	gst->appsrc = src;
 	gst->connected = FALSE;
+	gst->imu_fifo = NULL;
 
 	g_signal_connect(G_OBJECT(sink), "client-connected",
 			 G_CALLBACK(debug_gst_client_connected), gst);
@@ -113,37 +162,71 @@ struct debug_stream *debug_stream_unref(struct debug_stream *gst)
 {
 	gst_element_set_state(gst->pipeline, GST_STATE_NULL);
 	gst_object_unref(gst->pipeline);
+	debug_imu_fifo_detach(gst->imu_fifo, gst);
 	free(gst);
 
 	return NULL;
 }
 
 /*
- * Allocates a GstBuffer that wraps the frame and pushes it into the
- * GStreamer pipeline.
+ * Returns true if a client is connected to the debug stream.
  */
-void debug_stream_frame_push(struct debug_stream *gst, void *src, size_t size,
-			     size_t attach_offset, struct blobservation *ob,
-			     dquat *rot, dvec3 *trans, double timestamps[3])
+bool debug_stream_connected(struct debug_stream *gst)
+{
+	return gst && gst->connected;
+}
+
+/*
+ * Copies the first blobs and tracking slots into the fixed size debug
+ * attachment layout.
+ */
+static void debug_copy_blobservation(struct ouvrt_debug_blobservation *dst,
+				     struct blobservation *ob)
+{
+	int num = MIN(ob->num_blobs, DEBUG_MAX_BLOBS);
+	int i;
+
+	dst->num_blobs = num;
+	memcpy(dst->blobs, ob->blobs, num * sizeof(struct blob));
+	dst->tracked_blobs = ob->tracked_blobs;
+	memset(dst->tracked, 0, sizeof(dst->tracked));
+	for (i = 0; i < MIN(ob->max_blobs, DEBUG_MAX_BLOBS); i++)
+		dst->tracked[i] = ob->tracked[i] <= num ? ob->tracked[i] : 0;
+}
+
+/*
+ * Fills in the attachment with blobs, pose, timestamps, and the IMU samples
+ * received since the last frame, which are taken from imu_fifo unless another
+ * debug stream is already attached to it.
+ */
+static void debug_fill_attachment(struct debug_stream *gst,
+				  struct ouvrt_debug_attachment *attach,
+				  struct blobservation *ob, dquat *rot,
+				  dvec3 *trans, double timestamps[3],
+				  struct debug_imu_fifo *imu_fifo)
 {
-	struct ouvrt_debug_attachment *attach = src + attach_offset;
 	unsigned int num;
-	GstBuffer *buf;
-	int ret;
 
-	if (!gst->connected)
-		return;
+	memset(&attach->crop, 0, sizeof(attach->crop));
 
 	if (ob) {
 		/* Copy blobs and flicker history */
-		memcpy(&attach->blobservation, ob, sizeof(*ob));
+		debug_copy_blobservation(&attach->blobservation, ob);
 
 		/* Copy rotation and translation */
 		memcpy(&attach->rot, rot, sizeof(dquat));
 		memcpy(&attach->trans, trans, sizeof(dvec3));
 
 		/* Copy raw IMU sensor readings */
-		num = debug_imu_fifo_out(attach->imu_samples, 32);
+		num = 0;
+		if (gst->imu_fifo != imu_fifo)
+			debug_imu_fifo_detach(gst->imu_fifo, gst);
+		if (debug_imu_fifo_attach(imu_fifo, gst)) {
+			__atomic_store_n(&gst->imu_fifo, imu_fifo,
+					 __ATOMIC_RELEASE);
+			num = debug_imu_fifo_out(imu_fifo, attach->imu_samples,
+						 32);
+		}
 		attach->num_imu_samples = num;
 
 		if (timestamps) {
@@ -151,23 +234,173 @@ void debug_stream_frame_push(struct debug_stream *gst, void *src, size_t size,
 			       4 * sizeof(double));
 		}
 	}
+}
+
+/*
+ * Downscales the frame into a thumbnail, keeping the brightest pixel of each
+ * group on every DEBUG_CROP_SCALE-th line, so that the blobs stay visible
+ * while only a fraction of the frame is read.
+ */
+static void debug_crop_thumbnail(uint8_t *dst, const uint8_t *src, int width,
+				 int height)
+{
+	int tw = width / DEBUG_CROP_SCALE;
+	int th = height / DEBUG_CROP_SCALE;
+	int x, y, i;
+
+	for (y = 0; y < th; y++) {
+		const uint8_t *line = src + y * DEBUG_CROP_SCALE * width;
+
+		for (x = 0; x < tw; x++) {
+			uint8_t max = 0;
+
+			for (i = 0; i < DEBUG_CROP_SCALE; i++)
+				max = MAX(max, line[x * DEBUG_CROP_SCALE + i]);
+			*dst++ = max;
+		}
+	}
+}
+
+/*
+ * Copies a thumbnail, the attachment, and the padded blob windows into a
+ * newly allocated buffer and pushes it into the GStreamer pipeline. The frame
+ * is released right away.
+ */
+static bool debug_stream_crop_push(struct debug_stream *gst, uint8_t *src,
+				   struct blobservation *ob, dquat *rot,
+				   dvec3 *trans, double timestamps[3],
+				   struct debug_imu_fifo *imu_fifo,
+				   void (*release)(void *data), void *data)
+{
+	struct ouvrt_debug_window windows[DEBUG_MAX_BLOBS];
+	size_t thumb_size = (gst->width / DEBUG_CROP_SCALE) *
+			    (gst->height / DEBUG_CROP_SCALE);
+	struct ouvrt_debug_attachment *attach;
+	size_t size = thumb_size + sizeof(*attach);
+	int num_windows = 0;
+	uint8_t *dst;
+	GstBuffer *buf;
+	int i, y, ret;
+
+	for (i = 0; ob && i < MIN(ob->num_blobs, DEBUG_MAX_BLOBS); i++) {
+		const struct blob *b = &ob->blobs[i];
+		int x0 = MAX(b->x - b->width / 2 - DEBUG_CROP_PADDING, 0);
+		int y0 = MAX(b->y - b->height / 2 - DEBUG_CROP_PADDING, 0);
+		int x1 = MIN(b->x + b->width / 2 + DEBUG_CROP_PADDING + 1,
+			     gst->width);
+		int y1 = MIN(b->y + b->height / 2 + DEBUG_CROP_PADDING + 1,
+			     gst->height);
+		struct ouvrt_debug_window *w = &windows[num_windows];
+
+		if (x1 <= x0 || y1 <= y0)
+			continue;
+		w->x = x0;
+		w->y = y0;
+		w->width = x1 - x0;
+		w->height = y1 - y0;
+		w->offset = size;
+		size += w->width * w->height;
+		num_windows++;
+	}
+
+	dst = g_malloc(size);
+	debug_crop_thumbnail(dst, src, gst->width, gst->height);
+
+	attach = (struct ouvrt_debug_attachment *)(dst + thumb_size);
+	memset(attach, 0, sizeof(*attach));
+	debug_fill_attachment(gst, attach, ob, rot, trans, timestamps,
+			      imu_fifo);
+	attach->crop.width = gst->width;
+	attach->crop.height = gst->height;
+	attach->crop.scale = DEBUG_CROP_SCALE;
+	attach->crop.num_windows = num_windows;
+	memcpy(attach->crop.windows, windows,
+	       num_windows * sizeof(windows[0]));
+
+	for (i = 0; i < num_windows; i++) {
+		const struct ouvrt_debug_window *w = &windows[i];
+
+		for (y = 0; y < w->height; y++) {
+			memcpy(dst + w->offset + y * w->width,
+			       src + (w->y + y) * gst->width + w->x, w->width);
+		}
+	}
+
+	release(data);
+
+	buf = gst_buffer_new_wrapped_full(0, dst, size, 0, size, dst, g_free);
+	if (!buf) {
+		g_free(dst);
+		return true;
+	}
+
+	g_signal_emit_by_name(gst->appsrc, "push-buffer", buf, &ret);
+	gst_buffer_unref(buf);
+
+	return true;
+}
+
+/*
+ * Allocates a GstBuffer that wraps the frame and pushes it into the
+ * GStreamer pipeline. The frame must stay valid until release is called with
+ * data, which happens from a GStreamer thread once the buffer is freed. In
+ * crop mode, the frame is copied in parts and released before this returns.
+ *
+ * The IMU samples received since the last frame are taken from imu_fifo,
+ * unless another debug stream is already attached to it.
+ *
+ * Returns true if the frame was pushed. Otherwise release is not called.
+ */
+bool debug_stream_frame_push(struct debug_stream *gst, void *src, size_t size,
+			     size_t attach_offset, struct blobservation *ob,
+			     dquat *rot, dvec3 *trans, double timestamps[3],
+			     struct debug_imu_fifo *imu_fifo,
+			     void (*release)(void *data), void *data)
+{
+	GstBuffer *buf;
+	int ret;
+
+	if (!gst || !gst->connected)
+		return false;
+
+	if (gst->crop) {
+		return debug_stream_crop_push(gst, src, ob, rot, trans,
+					      timestamps, imu_fifo, release,
+					      data);
+	}
+
+	debug_fill_attachment(gst, src + attach_offset, ob, rot, trans,
+			      timestamps, imu_fifo);
 
 	buf = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, src,
-					  size, 0, size, NULL, NULL);
+					  size, 0, size, data, release);
 	if (!buf)
-		return;
+		return false;
 
 //	GST_BUFFER_TIMESTAMP(buffer) = ...
 //	GST_BUFFER_DURATION(buffer) = ...
 	g_signal_emit_by_name(gst->appsrc, "push-buffer", buf, &ret);
 	gst_buffer_unref(buf);
+
+	return true;
 }
 
+/*
+ * Removes stale debug sockets. GStreamer is only initialized when the first
+ * debug stream is created, unless GStreamer options are given on the command
+ * line, which have to be removed before the remaining options are parsed.
+ */
 void debug_stream_init(int *argc, char **argv[])
 {
 	guint i;
+	int j;
 
-	gst_init(argc, argv);
+	for (j = 1; j < *argc; j++) {
+		if (g_str_has_prefix((*argv)[j], "--gst-")) {
+			debug_gst_init(argc, argv);
+			break;
+		}
+	}
 
 	for (i = 0; i < 10; i++) {
 		gchar *filename = g_strdup_printf("/tmp/ouvrtd-gst-%u", i);
@@ -179,5 +412,6 @@ void debug_stream_init(int *argc, char **argv[])
 
 void debug_stream_deinit(void)
 {
-	gst_deinit();
+	if (debug_gst_initialized)
+		gst_deinit();
 }
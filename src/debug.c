@@ -3,6 +3,7 @@
  * Copyright 2015 Philipp Zabel
  * SPDX-License-Identifier:	GPL-2.0+
  */
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -13,41 +14,143 @@
 
 int debug_mode = 0;
 
-#define IMU_FIFO_LEN 32
-static struct imu_state imu_fifo[IMU_FIFO_LEN];
-static unsigned int fifo_in = 0;
-static unsigned int fifo_out = 0;
+/*
+ * Single producer, single consumer ring of IMU samples, written by the IMU
+ * thread of a device and read by the debug stream of one camera. Samples are
+ * only written while a consumer is attached.
+ */
+struct debug_imu_fifo {
+	unsigned int size;
+	/* written by the producer */
+	unsigned int head;
+	unsigned int overflows;
+	/* written by the consumer */
+	unsigned int tail;
+	void *consumer;
+	struct imu_state samples[];
+};
+
+/*
+ * Allocates an IMU sample fifo. The size is rounded up to a power of two.
+ */
+struct debug_imu_fifo *debug_imu_fifo_new(unsigned int size)
+{
+	struct debug_imu_fifo *fifo;
+	unsigned int n = 1;
+
+	while (n < size)
+		n <<= 1;
+
+	fifo = calloc(1, sizeof(*fifo) + n * sizeof(fifo->samples[0]));
+	if (!fifo)
+		return NULL;
+
+	fifo->size = n;
+
+	return fifo;
+}
+
+void debug_imu_fifo_free(struct debug_imu_fifo *fifo)
+{
+	free(fifo);
+}
 
-unsigned int debug_imu_fifo_in(struct imu_state *samples, unsigned int n)
+/*
+ * Attaches a consumer to the fifo, discarding old samples. Only a single
+ * consumer can be attached at a time.
+ *
+ * Returns true if the given consumer is attached.
+ */
+bool debug_imu_fifo_attach(struct debug_imu_fifo *fifo, void *consumer)
 {
-	int i = 0;
-
-	while (n--) {
-		if (((fifo_out + 1) % IMU_FIFO_LEN) == (fifo_in % IMU_FIFO_LEN))
-			return i;
-		imu_fifo[fifo_out % IMU_FIFO_LEN] = *samples;
-		__sync_synchronize();
-		fifo_out++;
-		samples++;
-		i++;
-	}
+	void *expected = NULL;
+
+	if (!fifo)
+		return false;
+
+	if (__atomic_load_n(&fifo->consumer, __ATOMIC_ACQUIRE) == consumer)
+		return true;
+
+	if (!__atomic_compare_exchange_n(&fifo->consumer, &expected, consumer,
+					 false, __ATOMIC_ACQ_REL,
+					 __ATOMIC_ACQUIRE))
+		return false;
+
+	/* The producer did not write while detached, skip stale samples */
+	__atomic_store_n(&fifo->tail,
+			 __atomic_load_n(&fifo->head, __ATOMIC_ACQUIRE),
+			 __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/*
+ * Detaches the consumer, after which the producer stops writing samples.
+ */
+void debug_imu_fifo_detach(struct debug_imu_fifo *fifo, void *consumer)
+{
+	if (!fifo)
+		return;
+
+	__atomic_compare_exchange_n(&fifo->consumer, &consumer, NULL, false,
+				    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Writes up to n samples into the fifo if a consumer is attached. Samples
+ * that do not fit are counted as overflows. Called from the producer thread.
+ *
+ * Returns the number of samples written.
+ */
+unsigned int debug_imu_fifo_in(struct debug_imu_fifo *fifo,
+			       const struct imu_state *samples, unsigned int n)
+{
+	unsigned int head, tail, i;
+
+	if (!fifo || !__atomic_load_n(&fifo->consumer, __ATOMIC_ACQUIRE))
+		return 0;
+
+	head = fifo->head;
+	tail = __atomic_load_n(&fifo->tail, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < n && head - tail < fifo->size; i++, head++)
+		fifo->samples[head & (fifo->size - 1)] = samples[i];
+
+	__atomic_store_n(&fifo->head, head, __ATOMIC_RELEASE);
+	if (i < n)
+		__atomic_fetch_add(&fifo->overflows, n - i, __ATOMIC_RELAXED);
 
 	return i;
 }
 
-unsigned int debug_imu_fifo_out(struct imu_state *samples, unsigned int n)
+/*
+ * Reads up to n samples from the fifo. Called from the consumer thread.
+ *
+ * Returns the number of samples read.
+ */
+unsigned int debug_imu_fifo_out(struct debug_imu_fifo *fifo,
+				struct imu_state *samples, unsigned int n)
 {
-	int i = 0;
-
-	while (n--) {
-		if ((fifo_in % IMU_FIFO_LEN) == (fifo_out % IMU_FIFO_LEN))
-			return i;
-		*samples = imu_fifo[fifo_in % IMU_FIFO_LEN];
-		__sync_synchronize();
-		fifo_in++;
-		samples++;
-		i++;
-	}
+	unsigned int head, tail, i;
+
+	if (!fifo)
+		return 0;
+
+	head = __atomic_load_n(&fifo->head, __ATOMIC_ACQUIRE);
+	tail = fifo->tail;
+
+	for (i = 0; i < n && tail != head; i++, tail++)
+		samples[i] = fifo->samples[tail & (fifo->size - 1)];
+
+	__atomic_store_n(&fifo->tail, tail, __ATOMIC_RELEASE);
 
 	return i;
 }
+
+/*
+ * Returns the number of samples dropped because the fifo was full.
+ */
+unsigned int debug_imu_fifo_get_overflows(struct debug_imu_fifo *fifo)
+{
+	return fifo ? __atomic_load_n(&fifo->overflows, __ATOMIC_RELAXED) : 0;
+}
@@ -6,6 +6,7 @@
 #ifndef __DEBUG_H__
 #define __DEBUG_H__
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
 
@@ -21,34 +22,93 @@ extern int debug_mode;
 
 struct debug_stream;
 
+#define DEBUG_MAX_BLOBS	42
+/* thumbnail downscaling factor and blob window padding in crop mode */
+#define DEBUG_CROP_SCALE	8
+#define DEBUG_CROP_PADDING	8
+
+/*
+ * Fixed size copy of the first blobs of a struct blobservation
+ */
+struct ouvrt_debug_blobservation {
+	int num_blobs;
+	struct blob blobs[DEBUG_MAX_BLOBS];
+	int tracked_blobs;
+	uint8_t tracked[DEBUG_MAX_BLOBS];
+};
+
+/*
+ * Blob window copied behind the attachment in crop mode, in full frame
+ * coordinates. The window pixels are stored line by line without padding,
+ * starting at offset bytes from the start of the buffer.
+ */
+struct ouvrt_debug_window {
+	uint16_t x;
+	uint16_t y;
+	uint16_t width;
+	uint16_t height;
+	uint32_t offset;
+};
+
+/*
+ * In crop mode, the image in front of the attachment is a thumbnail of the
+ * full frame downscaled by scale. Otherwise width, height, and num_windows
+ * are zero.
+ */
+struct ouvrt_debug_crop {
+	uint16_t width;
+	uint16_t height;
+	uint16_t scale;
+	uint16_t num_windows;
+	struct ouvrt_debug_window windows[DEBUG_MAX_BLOBS];
+};
+
 struct ouvrt_debug_attachment {
-	struct blobservation blobservation;
+	struct ouvrt_debug_blobservation blobservation;
 	dquat rot;
 	dvec3 trans;
 	int num_imu_samples;
 	struct imu_state imu_samples[32];
 	double timestamps[4];
+	struct ouvrt_debug_crop crop;
 };
 
 int debug_parse_arg(const char *arg);
 
-unsigned int debug_imu_fifo_in(struct imu_state *samples, unsigned int n);
-unsigned int debug_imu_fifo_out(struct imu_state *samples, unsigned int n);
+struct debug_imu_fifo;
+
+struct debug_imu_fifo *debug_imu_fifo_new(unsigned int size);
+void debug_imu_fifo_free(struct debug_imu_fifo *fifo);
+bool debug_imu_fifo_attach(struct debug_imu_fifo *fifo, void *consumer);
+void debug_imu_fifo_detach(struct debug_imu_fifo *fifo, void *consumer);
+unsigned int debug_imu_fifo_in(struct debug_imu_fifo *fifo,
+			       const struct imu_state *samples, unsigned int n);
+unsigned int debug_imu_fifo_out(struct debug_imu_fifo *fifo,
+				struct imu_state *samples, unsigned int n);
+unsigned int debug_imu_fifo_get_overflows(struct debug_imu_fifo *fifo);
 
 #ifdef HAVE_DEBUG_STREAM
 void debug_stream_init(int *argc, char **argv[]);
+void debug_stream_set_crop(bool crop);
 struct debug_stream *debug_stream_new(int width, int height, int framerate);
 struct debug_stream *debug_stream_unref(struct debug_stream *gst);
-void debug_stream_frame_push(struct debug_stream *stream,
+bool debug_stream_connected(struct debug_stream *gst);
+bool debug_stream_frame_push(struct debug_stream *stream,
 			     void *frame, size_t size, size_t attach_offset,
 			     struct blobservation *ob, dquat *rot,
-			     dvec3 *trans, double timestamps[3]);
+			     dvec3 *trans, double timestamps[3],
+			     struct debug_imu_fifo *imu_fifo,
+			     void (*release)(void *data), void *data);
 void debug_stream_deinit(void);
 #else
 static inline void debug_stream_init(int *argc, char **argv[])
 {
 }
 
+static inline void debug_stream_set_crop(bool crop)
+{
+}
+
 static inline struct debug_stream *debug_stream_new(int width, int height,
 					      int framerate)
 {
@@ -60,12 +120,21 @@ static inline struct debug_stream *debug_stream_unref(struct debug_stream *gst)
 	return NULL;
 }
 
-static inline void debug_stream_frame_push(struct debug_stream *stream,
+static inline bool debug_stream_connected(struct debug_stream *gst)
+{
+	return false;
+}
+
+static inline bool debug_stream_frame_push(struct debug_stream *stream,
 					   void *frame, size_t size,
 					   size_t attach_offset,
 					   struct blobservation *ob, dquat *rot,
-					   dvec3 *trans, double timestamps[3])
+					   dvec3 *trans, double timestamps[3],
+					   struct debug_imu_fifo *imu_fifo,
+					   void (*release)(void *data),
+					   void *data)
 {
+	return false;
 }
 
 static inline void debug_stream_deinit(void)
@@ -3,22 +3,70 @@
  * Copyright 2015 Philipp Zabel
  * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
  */
+#define _GNU_SOURCE
 #include <glib.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "cache.h"
 #include "device.h"
+#include "reactor.h"
+#include "recording.h"
+#include "telemetry.h"
+
+#define DEVICE_STATE_MAGIC	0x54534455	/* "UDST" */
+#define DEVICE_STATE_VERSION	1
+#define DEVICE_STATE_MAX_SIZE	4096
+/* interval in seconds between state checkpoints */
+#define DEVICE_STATE_INTERVAL	5
+
+/*
+ * Header of the state cache files, followed by the device specific state
+ */
+struct device_state_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t reserved;
+};
 
 struct _OuvrtDevicePrivate {
 	GThread *thread;
+	/* reactor sources, used instead of the thread if enabled */
+	struct reactor_source *sources[3];
+	struct reactor_source *timer;
+	unsigned int reports;
+	unsigned int last_reports;
+	/*
+	 * set from run until stop, independent of active, which is cleared
+	 * on disconnect while the device still has to be stopped and closed
+	 */
+	gboolean running;
+	/* background start, see ouvrt_device_start_async */
+	gboolean starting;
+	/* set under start_lock once the device was unplugged */
+	GMutex start_lock;
+	gboolean removed;
+	int start_ret;
+	OuvrtDeviceStartedFunc started;
+	gpointer started_data;
+	/* periodic state checkpoint timeout source */
+	guint state_timeout;
 };
 
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE(OuvrtDevice, ouvrt_device, G_TYPE_OBJECT)
 
 static GHashTable *serial_to_id_table;
+static GThreadPool *start_pool;
 
 /*
  * Stops the device before disposing of it
@@ -40,6 +88,7 @@ static void ouvrt_device_finalize(GObject *object)
 
 	if (dev->fd != -1)
 		close(dev->fd);
+	g_mutex_clear(&dev->priv->start_lock);
 	free(dev->devnode);
 	free(dev->name);
 	free(dev->serial);
@@ -88,6 +137,8 @@ static void ouvrt_device_class_init(OuvrtDeviceClass *klass)
 	G_OBJECT_CLASS(klass)->dispose = ouvrt_device_dispose;
 	klass->open = ouvrt_device_open_default;
 	klass->close = ouvrt_device_close_default;
+	klass->sched_policy = SCHED_OTHER;
+	klass->cpu = -1;
 }
 
 /*
@@ -106,7 +157,125 @@ static void ouvrt_device_init(OuvrtDevice *self)
 	self->fds[1] = -1;
 	self->fds[2] = -1;
 	self->priv = ouvrt_device_get_instance_private(self);
-	self->priv->thread = NULL;
+	memset(self->priv, 0, sizeof(*self->priv));
+	g_mutex_init(&self->priv->start_lock);
+}
+
+/*
+ * Polls all file descriptors of a device without its own thread function
+ * and dispatches incoming reports to the device specific handler.
+ */
+static void ouvrt_device_poll_loop(OuvrtDevice *dev)
+{
+	OuvrtDeviceClass *klass = OUVRT_DEVICE_GET_CLASS(dev);
+	struct pollfd fds[3];
+	struct timespec ts;
+	int index[3];
+	int num_fds = 0;
+	int ret, i;
+
+	for (i = 0; i < 3; i++) {
+		if (dev->fds[i] == -1)
+			continue;
+		fds[num_fds].fd = dev->fds[i];
+		fds[num_fds].events = POLLIN;
+		index[num_fds] = i;
+		num_fds++;
+	}
+
+	while (dev->active) {
+		for (i = 0; i < num_fds; i++)
+			fds[i].revents = 0;
+
+		ret = poll(fds, num_fds, 1000);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (ret == -1) {
+			g_print("%s: Poll failure: %d\n", dev->name, errno);
+			continue;
+		}
+
+		if (ret == 0) {
+			if (klass->timeout)
+				klass->timeout(dev);
+			continue;
+		}
+
+		for (i = 0; i < num_fds; i++) {
+			if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+				g_print("%s: Disconnected\n", dev->name);
+				dev->active = FALSE;
+				return;
+			}
+		}
+
+		for (i = 0; i < num_fds; i++) {
+			if (fds[i].revents & POLLIN)
+				klass->dispatch(dev, index[i], &ts);
+		}
+
+		/* Send the telemetry records of all reports at once */
+		telemetry_flush();
+	}
+}
+
+/*
+ * Applies the scheduling policy, priority, and CPU affinity requested by the
+ * device class to the calling thread. Without CAP_SYS_NICE or a sufficient
+ * RLIMIT_RTPRIO, the thread keeps running at normal priority.
+ */
+static void ouvrt_device_setup_thread(OuvrtDevice *dev)
+{
+	OuvrtDeviceClass *klass = OUVRT_DEVICE_GET_CLASS(dev);
+	int ret;
+
+	if (klass->sched_policy != SCHED_OTHER) {
+		struct sched_param param = {
+			.sched_priority = klass->sched_priority,
+		};
+
+		ret = pthread_setschedparam(pthread_self(), klass->sched_policy,
+					    &param);
+		if (ret) {
+			g_print("%s: Failed to set %s priority %d: %d, using normal priority\n",
+				dev->name, klass->sched_policy == SCHED_FIFO ?
+				"SCHED_FIFO" : "SCHED_RR",
+				klass->sched_priority, ret);
+		}
+	}
+
+	if (klass->cpu >= 0) {
+		cpu_set_t cpuset;
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(klass->cpu, &cpuset);
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset),
+					     &cpuset);
+		if (ret) {
+			g_print("%s: Failed to pin to CPU %d: %d\n", dev->name,
+				klass->cpu, ret);
+		}
+	}
+}
+
+/*
+ * Locks all currently mapped memory, including the frame buffers allocated
+ * by the device start function, once per process.
+ */
+static void ouvrt_device_lock_memory(OuvrtDevice *dev)
+{
+	static gboolean locked;
+	gboolean expected = FALSE;
+
+	/* Devices started concurrently only try once, a failure is retried */
+	if (!__atomic_compare_exchange_n(&locked, &expected, TRUE, FALSE,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return;
+
+	if (mlockall(MCL_CURRENT) < 0) {
+		g_print("%s: Failed to lock memory: %d, frame buffers may be paged out\n",
+			dev->name, errno);
+		__atomic_store_n(&locked, FALSE, __ATOMIC_RELEASE);
+	}
 }
 
 /*
@@ -115,12 +284,127 @@ static void ouvrt_device_init(OuvrtDevice *self)
 static gpointer device_start_routine(gpointer data)
 {
 	OuvrtDevice *dev = OUVRT_DEVICE(data);
+	OuvrtDeviceClass *klass = OUVRT_DEVICE_GET_CLASS(dev);
+
+	ouvrt_device_setup_thread(dev);
 
-	OUVRT_DEVICE_GET_CLASS(dev)->thread(dev);
+	if (klass->thread)
+		klass->thread(dev);
+	else
+		ouvrt_device_poll_loop(dev);
 
 	return NULL;
 }
 
+/*
+ * Removes a reactor source and clears its pointer. The source is only
+ * removed once if the reactor thread and stop race to remove it.
+ */
+static void ouvrt_device_remove_source(struct reactor_source **source)
+{
+	struct reactor_source *old;
+
+	old = __atomic_exchange_n(source, NULL, __ATOMIC_ACQ_REL);
+	if (old)
+		reactor_remove(old);
+}
+
+/*
+ * Removes all reactor sources of the device.
+ */
+static void ouvrt_device_remove_sources(OuvrtDevice *dev)
+{
+	OuvrtDevicePrivate *priv = dev->priv;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		ouvrt_device_remove_source(&priv->sources[i]);
+	ouvrt_device_remove_source(&priv->timer);
+}
+
+/*
+ * Reactor callback that dispatches a single report of the device.
+ */
+static void ouvrt_device_reactor_func(struct reactor_source *source,
+				      uint32_t events, void *data)
+{
+	OuvrtDevice *dev = OUVRT_DEVICE(data);
+	OuvrtDevicePrivate *priv = dev->priv;
+	struct timespec ts;
+	int index;
+
+	for (index = 0; index < 3; index++) {
+		if (__atomic_load_n(&priv->sources[index],
+				    __ATOMIC_ACQUIRE) == source)
+			break;
+	}
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		g_print("%s: Disconnected\n", dev->name);
+		dev->active = FALSE;
+		ouvrt_device_remove_sources(dev);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	priv->reports++;
+	OUVRT_DEVICE_GET_CLASS(dev)->dispatch(dev, index, &ts);
+	telemetry_flush();
+}
+
+/*
+ * Reactor timer callback that calls the device timeout handler if no reports
+ * arrived since the last timer expiration.
+ */
+static void ouvrt_device_timer_func(G_GNUC_UNUSED struct reactor_source *source,
+				    G_GNUC_UNUSED uint32_t events, void *data)
+{
+	OuvrtDevice *dev = OUVRT_DEVICE(data);
+	OuvrtDevicePrivate *priv = dev->priv;
+	OuvrtDeviceClass *klass = OUVRT_DEVICE_GET_CLASS(dev);
+
+	if (priv->reports == priv->last_reports && klass->timeout)
+		klass->timeout(dev);
+	priv->last_reports = priv->reports;
+}
+
+/*
+ * Adds all file descriptors of the device and a one second timeout timer to
+ * the same reactor.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+static int ouvrt_device_add_sources(OuvrtDevice *dev)
+{
+	OuvrtDevicePrivate *priv = dev->priv;
+	struct reactor *reactor = reactor_get();
+	int i;
+
+	if (!reactor)
+		return -ENODEV;
+
+	for (i = 0; i < 3; i++) {
+		if (dev->fds[i] == -1)
+			continue;
+		priv->sources[i] = reactor_add_fd(reactor, dev->fds[i],
+						  ouvrt_device_reactor_func,
+						  dev);
+		if (!priv->sources[i])
+			goto err_remove;
+	}
+
+	priv->timer = reactor_add_timer(reactor, 1000,
+					ouvrt_device_timer_func, dev);
+	if (!priv->timer)
+		goto err_remove;
+
+	return 0;
+
+err_remove:
+	ouvrt_device_remove_sources(dev);
+	return -ENOMEM;
+}
+
 /*
  * Creates or returns an existing stable id for a given serial number.
  */
@@ -155,45 +439,304 @@ int ouvrt_device_open(OuvrtDevice *dev)
 }
 
 /*
- * Starts the device and its worker thread.
+ * Opens the device and calls the device specific start operation, which may
+ * block for a long time reading configuration data. This does not touch any
+ * global state and may be called from a worker thread.
  */
-int ouvrt_device_start(OuvrtDevice *dev)
+static int ouvrt_device_setup(OuvrtDevice *dev)
 {
 	int ret;
 
-	if (dev->active)
-		return 0;
-
 	ret = ouvrt_device_open(dev);
 	if (ret < 0)
 		return ret;
 
+	/* Record everything read from the device, including in start */
+	if (recording_enabled()) {
+		int i;
+
+		for (i = 0; i < 3; i++) {
+			if (dev->fds[i] != -1 &&
+			    !(recording_fd_flags(dev->fds[i]) &
+			      RECORDING_FD_REPLAY))
+				recording_add_stream(dev->name, i, dev->fds[i]);
+		}
+	}
+
 	ret = OUVRT_DEVICE_GET_CLASS(dev)->start(dev);
 	if (ret < 0)
 		return ret;
 
+	return 0;
+}
+
+/*
+ * Returns the state cache file name of the device, or NULL if it has no
+ * state or serial, or is replayed from a recording.
+ */
+static char *ouvrt_device_state_filename(OuvrtDevice *dev)
+{
+	OuvrtDeviceClass *klass = OUVRT_DEVICE_GET_CLASS(dev);
+	int i;
+
+	if (!klass->save_state || !dev->serial)
+		return NULL;
+
+	for (i = 0; i < 3; i++) {
+		if (dev->fds[i] != -1 &&
+		    (recording_fd_flags(dev->fds[i]) & RECORDING_FD_REPLAY))
+			return NULL;
+	}
+
+	return ouvrt_cache_path("%s_%s.state", dev->serial,
+				G_OBJECT_TYPE_NAME(dev));
+}
+
+/*
+ * Takes a snapshot of the current device state and queues it to be written
+ * into the state cache, so that the main loop does not block on the file
+ * system.
+ */
+static void ouvrt_device_save_state(OuvrtDevice *dev)
+{
+	struct device_state_header *header;
+	char *filename;
+	gsize size;
+
+	filename = ouvrt_device_state_filename(dev);
+	if (!filename)
+		return;
+
+	header = g_malloc0(sizeof(*header) + DEVICE_STATE_MAX_SIZE);
+	size = OUVRT_DEVICE_GET_CLASS(dev)->save_state(dev, header + 1,
+						       DEVICE_STATE_MAX_SIZE);
+	if (size) {
+		header->magic = DEVICE_STATE_MAGIC;
+		header->version = DEVICE_STATE_VERSION;
+		header->size = size;
+
+		ouvrt_cache_save_async(filename, header,
+				       sizeof(*header) + size);
+	}
+
+	g_free(header);
+	g_free(filename);
+}
+
+static gboolean ouvrt_device_state_timeout(gpointer data)
+{
+	ouvrt_device_save_state(OUVRT_DEVICE(data));
+
+	return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Restores the device state saved before a restart, if there is any, and
+ * starts checkpointing the state periodically.
+ */
+static void ouvrt_device_restore_state(OuvrtDevice *dev)
+{
+	struct device_state_header *header;
+	char *filename;
+	size_t length;
+
+	filename = ouvrt_device_state_filename(dev);
+	if (!filename)
+		return;
+
+	if (OUVRT_DEVICE_GET_CLASS(dev)->restore_state &&
+	    ouvrt_cache_load(filename, &header, &length)) {
+		if (length >= sizeof(*header) &&
+		    header->magic == DEVICE_STATE_MAGIC &&
+		    header->version == DEVICE_STATE_VERSION &&
+		    header->size == length - sizeof(*header)) {
+			g_print("%s: Restoring cached state\n", dev->name);
+			OUVRT_DEVICE_GET_CLASS(dev)->restore_state(dev,
+					header + 1, header->size);
+		}
+		g_free(header);
+	}
+	g_free(filename);
+
+	dev->priv->state_timeout = g_timeout_add_seconds(DEVICE_STATE_INTERVAL,
+						ouvrt_device_state_timeout,
+						dev);
+}
+
+/*
+ * Claims the device id and starts the worker thread of a device that was
+ * set up successfully. Must be called from the main loop.
+ */
+static void ouvrt_device_run(OuvrtDevice *dev)
+{
+	if (OUVRT_DEVICE_GET_CLASS(dev)->lock_memory)
+		ouvrt_device_lock_memory(dev);
+
 	if (dev->serial)
 		dev->id = ouvrt_device_claim_id(dev, dev->serial);
 
+	ouvrt_device_restore_state(dev);
+
+	dev->priv->running = TRUE;
 	dev->active = TRUE;
+
+	/* Devices with report handlers share the reactor threads, if enabled */
+	if (!OUVRT_DEVICE_GET_CLASS(dev)->thread && reactor_enabled() &&
+	    ouvrt_device_add_sources(dev) == 0)
+		return;
+
 	dev->priv->thread = g_thread_new(NULL, device_start_routine, dev);
+}
+
+/*
+ * Starts the device and its worker thread.
+ */
+int ouvrt_device_start(OuvrtDevice *dev)
+{
+	int ret;
+
+	if (dev->priv->running || dev->priv->starting)
+		return 0;
+
+	ret = ouvrt_device_setup(dev);
+	if (ret < 0)
+		return ret;
+
+	ouvrt_device_run(dev);
 
 	return 0;
 }
 
 /*
- * Stops the device and its worker thread.
+ * Marks a device as unplugged, so that a background start still in progress
+ * neither runs nor reports the device. Must be called from the main loop
+ * before the device is dropped.
+ */
+void ouvrt_device_set_removed(OuvrtDevice *dev)
+{
+	g_mutex_lock(&dev->priv->start_lock);
+	dev->priv->removed = TRUE;
+	g_mutex_unlock(&dev->priv->start_lock);
+}
+
+static gboolean ouvrt_device_is_removed(OuvrtDevice *dev)
+{
+	gboolean removed;
+
+	g_mutex_lock(&dev->priv->start_lock);
+	removed = dev->priv->removed;
+	g_mutex_unlock(&dev->priv->start_lock);
+
+	return removed;
+}
+
+/*
+ * Main loop callback that finishes a background device start. A device that
+ * was unplugged meanwhile is closed again, and reported as gone.
+ */
+static gboolean ouvrt_device_start_done(gpointer data)
+{
+	OuvrtDevice *dev = OUVRT_DEVICE(data);
+	OuvrtDevicePrivate *priv = dev->priv;
+	int ret = priv->start_ret;
+
+	priv->starting = FALSE;
+	if (ret == 0 && ouvrt_device_is_removed(dev)) {
+		int i;
+
+		OUVRT_DEVICE_GET_CLASS(dev)->stop(dev);
+		for (i = 0; i < 3; i++)
+			recording_unregister_fd(dev->fds[i]);
+		OUVRT_DEVICE_GET_CLASS(dev)->close(dev);
+		ret = -ENODEV;
+	} else if (ret == 0) {
+		ouvrt_device_run(dev);
+	}
+
+	if (priv->started)
+		priv->started(dev, ret, priv->started_data);
+
+	g_object_unref(dev);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * GFunc that sets up a single device on a start pool thread.
+ */
+static void ouvrt_device_start_worker(gpointer data,
+				      G_GNUC_UNUSED gpointer user_data)
+{
+	OuvrtDevice *dev = OUVRT_DEVICE(data);
+
+	if (ouvrt_device_is_removed(dev))
+		dev->priv->start_ret = -ENODEV;
+	else
+		dev->priv->start_ret = ouvrt_device_setup(dev);
+	g_main_context_invoke(NULL, ouvrt_device_start_done, dev);
+}
+
+/*
+ * Starts the device in the background. Opening the device and reading its
+ * configuration happens on a pool thread, concurrently with other devices,
+ * and func is called from the main loop when the device is running.
+ */
+void ouvrt_device_start_async(OuvrtDevice *dev, OuvrtDeviceStartedFunc func,
+			      gpointer user_data)
+{
+	OuvrtDevicePrivate *priv = dev->priv;
+
+	if (priv->running || priv->starting)
+		return;
+
+	if (!start_pool) {
+		start_pool = g_thread_pool_new(ouvrt_device_start_worker, NULL,
+					       -1, FALSE, NULL);
+	}
+
+	priv->starting = TRUE;
+	priv->started = func;
+	priv->started_data = user_data;
+
+	/* Keep the device alive until the start has finished */
+	g_thread_pool_push(start_pool, g_object_ref(dev), NULL);
+}
+
+/*
+ * Stops the device and its worker thread. A device that was disconnected
+ * meanwhile is still stopped and closed.
  */
 void ouvrt_device_stop(OuvrtDevice *dev)
 {
-	if (!dev->active)
+	int i;
+
+	if (!dev->priv->running)
 		return;
 
+	dev->priv->running = FALSE;
 	dev->active = FALSE;
 
-	g_thread_join(dev->priv->thread);
-	dev->priv->thread = NULL;
+	if (dev->priv->thread) {
+		if (OUVRT_DEVICE_GET_CLASS(dev)->wakeup)
+			OUVRT_DEVICE_GET_CLASS(dev)->wakeup(dev);
+		g_thread_join(dev->priv->thread);
+		dev->priv->thread = NULL;
+	} else {
+		ouvrt_device_remove_sources(dev);
+	}
+
+	/*
+	 * Keep the final state for the next start. On exit, main waits for
+	 * it to be written with ouvrt_cache_flush.
+	 */
+	if (dev->priv->state_timeout) {
+		g_source_remove(dev->priv->state_timeout);
+		dev->priv->state_timeout = 0;
+		ouvrt_device_save_state(dev);
+	}
 
 	OUVRT_DEVICE_GET_CLASS(dev)->stop(dev);
+	for (i = 0; i < 3; i++)
+		recording_unregister_fd(dev->fds[i]);
 	OUVRT_DEVICE_GET_CLASS(dev)->close(dev);
 }
@@ -8,6 +8,7 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <time.h>
 
 enum device_type {
 	DEVICE_TYPE_HMD,
@@ -58,17 +59,60 @@ struct _OuvrtDeviceClass {
 	int (*open)(OuvrtDevice *dev);
 	int (*start)(OuvrtDevice *dev);
 	void (*thread)(OuvrtDevice *dev);
+	/*
+	 * Optionally wakes up a thread function that waits for active to be
+	 * cleared. Called by ouvrt_device_stop before the thread is joined.
+	 */
+	void (*wakeup)(OuvrtDevice *dev);
+	/*
+	 * Devices without a thread function instead handle reports that
+	 * arrive on fds[index] in dispatch, with ts set to the wakeup time,
+	 * and get timeout called if no reports arrived for a second.
+	 */
+	void (*dispatch)(OuvrtDevice *dev, int index,
+			 const struct timespec *ts);
+	void (*timeout)(OuvrtDevice *dev);
 	void (*stop)(OuvrtDevice *dev);
 	void (*close)(OuvrtDevice *dev);
+	/*
+	 * Optional state that is periodically checkpointed to the user cache
+	 * and restored when a device with the same serial starts again.
+	 * save_state copies up to size bytes into buf and returns the length,
+	 * or 0 if there is nothing to save. restore_state is called before
+	 * the device thread starts. Both are called from the main loop.
+	 */
+	gsize (*save_state)(OuvrtDevice *dev, void *buf, gsize size);
+	void (*restore_state)(OuvrtDevice *dev, const void *buf, gsize len);
+
+	/*
+	 * Scheduling policy and priority of the device thread, the CPU it is
+	 * pinned to or -1, and whether memory should be locked after start
+	 * to avoid page faults on frame buffers.
+	 */
+	int sched_policy;
+	int sched_priority;
+	int cpu;
+	gboolean lock_memory;
 };
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(OuvrtDevice, g_object_unref);
 
+/*
+ * Called from the main loop when a device started with
+ * ouvrt_device_start_async() is running, or failed to start with a negative
+ * error code in ret.
+ */
+typedef void (*OuvrtDeviceStartedFunc)(OuvrtDevice *dev, int ret,
+				       gpointer user_data);
+
 GType ouvrt_device_get_type(void);
 
 unsigned long ouvrt_device_claim_id(OuvrtDevice *dev, const char *serial);
 int ouvrt_device_open(OuvrtDevice *dev);
 int ouvrt_device_start(OuvrtDevice *dev);
+void ouvrt_device_start_async(OuvrtDevice *dev, OuvrtDeviceStartedFunc func,
+			      gpointer user_data);
+void ouvrt_device_set_removed(OuvrtDevice *dev);
 void ouvrt_device_stop(OuvrtDevice *dev);
 void ouvrt_device_close(OuvrtDevice *dev);
 
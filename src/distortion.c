@@ -0,0 +1,96 @@
+/*
+ * Lens distortion lookup tables
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#include <glib.h>
+#include <math.h>
+
+#include "distortion.h"
+
+/* grid spacing in pixels of the undistortion lookup table */
+#define DISTORTION_MAP_STEP		8
+/* maximum interpolation error in pixels at the center of a valid cell */
+#define DISTORTION_MAP_TOLERANCE	0.01
+
+/*
+ * Samples the undistortion of the whole image, with a margin of two grid
+ * cells, so that blob centroids are undistorted by a bicubic interpolation
+ * instead of iterations. Replaces an existing lookup table. To be called
+ * whenever the calibration of a camera changes, before its frames are
+ * processed.
+ */
+void distortion_init_map(struct distortion *d, const dmat3 *camera_matrix,
+			 int width, int height)
+{
+	const double fx = camera_matrix->m[0];
+	const double cx = camera_matrix->m[2];
+	const double fy = camera_matrix->m[4];
+	const double cy = camera_matrix->m[5];
+	const double focal_length = 0.5 * (fx + fy);
+	struct distortion_map *map;
+	const double step_x = DISTORTION_MAP_STEP / fx;
+	const double step_y = DISTORTION_MAP_STEP / fy;
+	int i, j;
+
+	distortion_free_map(d);
+	if (fx <= 0.0 || fy <= 0.0 || width <= 0 || height <= 0)
+		return;
+
+	map = g_new0(struct distortion_map, 1);
+	map->x0 = -cx / fx - 2 * step_x;
+	map->y0 = -cy / fy - 2 * step_y;
+	map->inv_step_x = 1.0 / step_x;
+	map->inv_step_y = 1.0 / step_y;
+	map->width = (width + DISTORTION_MAP_STEP - 1) / DISTORTION_MAP_STEP + 5;
+	map->height = (height + DISTORTION_MAP_STEP - 1) / DISTORTION_MAP_STEP +
+		      5;
+	map->points = g_malloc_n(map->width * map->height,
+				 sizeof(*map->points));
+	map->valid = g_new0(uint8_t, (map->width - 1) * (map->height - 1));
+
+	/* d->map is still NULL, so this uses the iterative undistortion */
+	for (j = 0; j < map->height; j++) {
+		for (i = 0; i < map->width; i++) {
+			double x, y;
+
+			distortion_undistort(d, map->x0 + i * step_x,
+					     map->y0 + j * step_y, &x, &y);
+			map->points[j * map->width + i][0] = x;
+			map->points[j * map->width + i][1] = y;
+		}
+	}
+
+	for (j = 0; j < map->height - 1; j++) {
+		for (i = 0; i < map->width - 1; i++) {
+			double xd = map->x0 + (i + 0.5) * step_x;
+			double yd = map->y0 + (j + 0.5) * step_y;
+			double x, y, xi, yi;
+
+			distortion_undistort(d, xd, yd, &x, &y);
+			map->valid[j * (map->width - 1) + i] = 1;
+			/* Border cells without a full 4x4 neighborhood */
+			if (!distortion_map_lookup(map, xd, yd, &xi, &yi)) {
+				map->valid[j * (map->width - 1) + i] = 0;
+				continue;
+			}
+			map->valid[j * (map->width - 1) + i] =
+				isfinite(xi) && isfinite(yi) &&
+				hypot(xi - x, yi - y) * focal_length <=
+				DISTORTION_MAP_TOLERANCE;
+		}
+	}
+
+	d->map = map;
+}
+
+void distortion_free_map(struct distortion *d)
+{
+	if (!d->map)
+		return;
+
+	g_free(d->map->points);
+	g_free(d->map->valid);
+	g_free(d->map);
+	d->map = NULL;
+}
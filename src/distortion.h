@@ -0,0 +1,218 @@
+/*
+ * Lens distortion models
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __DISTORTION_H__
+#define __DISTORTION_H__
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "maths.h"
+
+/*
+ * The DK2 camera uses the radial-tangential model with coefficients
+ * k = [ k₁ k₂ p₁ p₂ k₃ ], the Rift CV1 sensor uses the equidistant fisheye
+ * model with coefficients k = [ k₁ k₂ k₃ k₄ ].
+ */
+enum distortion_model {
+	DISTORTION_RADTAN = 0,
+	DISTORTION_FISHEYE,
+};
+
+/*
+ * Undistorted, normalized image coordinates sampled on a regular grid in
+ * distorted, normalized image coordinates. Cells in which bicubic
+ * interpolation is not accurate enough, such as close to the fisheye
+ * horizon, are marked invalid.
+ */
+struct distortion_map {
+	double x0;
+	double y0;
+	double inv_step_x;
+	double inv_step_y;
+	int width;
+	int height;
+	float (*points)[2];
+	/* one entry per grid cell, of (width - 1) x (height - 1) */
+	uint8_t *valid;
+};
+
+struct distortion {
+	enum distortion_model model;
+	double k[5];
+	/* optional lookup table, owned by the camera */
+	struct distortion_map *map;
+};
+
+#define DISTORTION_UNDISTORT_ITERATIONS	5
+
+void distortion_init_map(struct distortion *d, const dmat3 *camera_matrix,
+			 int width, int height);
+void distortion_free_map(struct distortion *d);
+
+/*
+ * Applies the lens distortion to normalized image coordinates. No distortion
+ * is applied if d is NULL.
+ */
+static inline void distortion_distort(const struct distortion *d, double x,
+				      double y, double *xd, double *yd)
+{
+	const double *k;
+
+	if (!d) {
+		*xd = x;
+		*yd = y;
+		return;
+	}
+
+	k = d->k;
+	if (d->model == DISTORTION_FISHEYE) {
+		double r = sqrt(x * x + y * y);
+		double theta, theta2, theta_d;
+
+		if (r < 1e-9) {
+			*xd = x;
+			*yd = y;
+			return;
+		}
+
+		/* θd = θ (1 + k₁θ² + k₂θ⁴ + k₃θ⁶ + k₄θ⁸) */
+		theta = atan(r);
+		theta2 = theta * theta;
+		theta_d = theta * (1 + theta2 * (k[0] + theta2 * (k[1] +
+				   theta2 * (k[2] + theta2 * k[3]))));
+
+		*xd = x * theta_d / r;
+		*yd = y * theta_d / r;
+	} else {
+		double r2 = x * x + y * y;
+		double radial = 1 + r2 * (k[0] + r2 * (k[1] + r2 * k[4]));
+
+		*xd = x * radial + 2 * k[2] * x * y + k[3] * (r2 + 2 * x * x);
+		*yd = y * radial + k[2] * (r2 + 2 * y * y) + 2 * k[3] * x * y;
+	}
+}
+
+/*
+ * Catmull-Rom spline weights at position t between the second and third of
+ * four equidistant samples
+ */
+static inline void distortion_map_weights(double t, double w[4])
+{
+	w[0] = 0.5 * ((2.0 - t) * t - 1.0) * t;
+	w[1] = 0.5 * ((3.0 * t - 5.0) * t * t + 2.0);
+	w[2] = 0.5 * ((4.0 - 3.0 * t) * t + 1.0) * t;
+	w[3] = 0.5 * (t - 1.0) * t * t;
+}
+
+/*
+ * Interpolates the undistorted coordinates from the lookup table with a
+ * bicubic spline.
+ *
+ * Returns false if the point is outside of the table or in an invalid cell.
+ */
+static inline bool distortion_map_lookup(const struct distortion_map *map,
+					 double xd, double yd, double *x,
+					 double *y)
+{
+	const double gx = (xd - map->x0) * map->inv_step_x;
+	const double gy = (yd - map->y0) * map->inv_step_y;
+	const float (*p)[2];
+	double wx[4], wy[4];
+	double sx = 0.0, sy = 0.0;
+	int i, j, ix, iy;
+
+	if (!(gx >= 1.0 && gy >= 1.0 && gx < map->width - 2 &&
+	      gy < map->height - 2))
+		return false;
+
+	ix = gx;
+	iy = gy;
+	if (!map->valid[iy * (map->width - 1) + ix])
+		return false;
+
+	distortion_map_weights(gx - ix, wx);
+	distortion_map_weights(gy - iy, wy);
+	p = (const float (*)[2])map->points + (iy - 1) * map->width + ix - 1;
+	for (j = 0; j < 4; j++, p += map->width) {
+		double rx = 0.0, ry = 0.0;
+
+		for (i = 0; i < 4; i++) {
+			rx += wx[i] * p[i][0];
+			ry += wx[i] * p[i][1];
+		}
+		sx += wy[j] * rx;
+		sy += wy[j] * ry;
+	}
+	*x = sx;
+	*y = sy;
+
+	return true;
+}
+
+/*
+ * Removes the lens distortion from normalized image coordinates, using the
+ * lookup table if there is one. Otherwise, the fisheye model is inverted
+ * with Newton iterations on the incidence angle, the radial-tangential model
+ * with fixed point iterations.
+ */
+static inline void distortion_undistort(const struct distortion *d,
+					double xd, double yd, double *x,
+					double *y)
+{
+	const double *k;
+	int i;
+
+	*x = xd;
+	*y = yd;
+	if (!d)
+		return;
+
+	if (d->map && distortion_map_lookup(d->map, xd, yd, x, y))
+		return;
+
+	k = d->k;
+	if (d->model == DISTORTION_FISHEYE) {
+		double theta_d = sqrt(xd * xd + yd * yd);
+		double theta = theta_d;
+		double scale;
+
+		if (theta_d < 1e-9)
+			return;
+
+		for (i = 0; i < DISTORTION_UNDISTORT_ITERATIONS; i++) {
+			double t2 = theta * theta;
+			double f = theta * (1 + t2 * (k[0] + t2 * (k[1] +
+					    t2 * (k[2] + t2 * k[3])))) - theta_d;
+			double df = 1 + t2 * (3 * k[0] + t2 * (5 * k[1] +
+					      t2 * (7 * k[2] + t2 * 9 * k[3])));
+
+			theta -= f / df;
+		}
+
+		/* Points at 90° or more would lie behind the camera */
+		theta = fmin(theta, M_PI_2 - 1e-6);
+
+		scale = tan(theta) / theta_d;
+		*x = xd * scale;
+		*y = yd * scale;
+	} else {
+		for (i = 0; i < DISTORTION_UNDISTORT_ITERATIONS; i++) {
+			double r2 = *x * *x + *y * *y;
+			double radial = 1 + r2 * (k[0] + r2 * (k[1] +
+							       r2 * k[4]));
+			double dx = 2 * k[2] * *x * *y +
+				    k[3] * (r2 + 2 * *x * *x);
+			double dy = k[2] * (r2 + 2 * *y * *y) +
+				    2 * k[3] * *x * *y;
+
+			*x = (xd - dx) / radial;
+			*y = (yd - dy) / radial;
+		}
+	}
+}
+
+#endif /* __DISTORTION_H__ */
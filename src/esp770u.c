@@ -114,20 +114,12 @@ static int esp770u_set_counter(libusb_device_handle *devh, uint8_t count)
 }
 
 /*
- * Reads a buffer from the flash storage.
+ * Fills in the control request that starts a flash read.
  */
-int esp770u_flash_read(libusb_device_handle *devh, uint32_t addr,
-		       uint8_t *data, uint16_t len)
+static void esp770u_flash_read_control(uint8_t *control, uint8_t count,
+				       uint32_t addr, uint16_t len)
 {
-	uint8_t control[16];
-	uint8_t count;
-	int ret;
-
-	ret = esp770u_get_counter(devh, &count);
-	if (ret < 0)
-		return ret;
-
-	memset(control, 0, sizeof control);
+	memset(control, 0, 16);
 	control[0] = count;
 	control[1] = 0x41;
 	control[2] = 0x03;
@@ -139,6 +131,23 @@ int esp770u_flash_read(libusb_device_handle *devh, uint32_t addr,
 
 	control[8] = len >> 8;
 	control[9] = len & 0xff;
+}
+
+/*
+ * Reads a buffer from the flash storage.
+ */
+int esp770u_flash_read(libusb_device_handle *devh, uint32_t addr,
+		       uint8_t *data, uint16_t len)
+{
+	uint8_t control[16];
+	uint8_t count;
+	int ret;
+
+	ret = esp770u_get_counter(devh, &count);
+	if (ret < 0)
+		return ret;
+
+	esp770u_flash_read_control(control, count, addr, len);
 
 	ret = uvc_set_cur(devh, 0, ESP770U_EXTENSION_UNIT,
 			  ESP770U_SELECTOR_CONTROL, control, sizeof control);
@@ -154,6 +163,145 @@ int esp770u_flash_read(libusb_device_handle *devh, uint32_t addr,
 	return esp770u_set_counter(devh, count);
 }
 
+/* Each flash block read takes four requests */
+#define ESP770U_FLASH_BATCH_READS	(UVC_CONTROL_BATCH_MAX / 4)
+#define ESP770U_FLASH_BLOCK_SIZE	128
+
+/*
+ * Queues the requests of up to ESP770U_FLASH_BATCH_READS block reads,
+ * starting at addr. Each block read consists of the same counter read,
+ * control write, data read, and counter write back requests as
+ * esp770u_flash_read.
+ *
+ * Returns the number of bytes queued, or a negative error code.
+ */
+static int esp770u_flash_queue_reads(struct uvc_control_batch *batch,
+				     uint8_t count, uint32_t addr,
+				     uint32_t len, uint16_t block_size)
+{
+	uint8_t control[16];
+	uint32_t queued = 0;
+	uint16_t n;
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < ESP770U_FLASH_BATCH_READS && queued < len; i++) {
+		n = (len - queued < block_size) ? len - queued : block_size;
+		esp770u_flash_read_control(control, count, addr + queued, n);
+
+		ret = uvc_control_batch_get_cur(batch, 0, ESP770U_EXTENSION_UNIT,
+						ESP770U_SELECTOR_COUNTER, 1);
+		if (ret >= 0)
+			ret = uvc_control_batch_set_cur(batch, 0,
+						ESP770U_EXTENSION_UNIT,
+						ESP770U_SELECTOR_CONTROL,
+						control, sizeof control);
+		if (ret >= 0)
+			ret = uvc_control_batch_get_cur(batch, 0,
+						ESP770U_EXTENSION_UNIT,
+						ESP770U_SELECTOR_DATA, n);
+		if (ret >= 0)
+			ret = uvc_control_batch_set_cur(batch, 0,
+						ESP770U_EXTENSION_UNIT,
+						ESP770U_SELECTOR_COUNTER,
+						&count, 1);
+		if (ret < 0)
+			return ret;
+
+		queued += n;
+	}
+
+	return queued;
+}
+
+/*
+ * Copies the data read by a completed batch of block reads into data.
+ */
+static void esp770u_flash_copy_reads(struct uvc_control_batch *batch,
+				     uint8_t *data, uint32_t len,
+				     uint16_t block_size)
+{
+	uint32_t copied = 0;
+	uint16_t n;
+	int i;
+
+	for (i = 0; copied < len; i++) {
+		n = (len - copied < block_size) ? len - copied : block_size;
+		memcpy(data + copied, uvc_control_batch_get_data(batch,
+								 4 * i + 2), n);
+		copied += n;
+	}
+}
+
+/*
+ * Reads a large range of the flash storage. The block reads are queued in
+ * batches of asynchronous control transfers, with the next batch already
+ * queued while the previous one completes, so that the requests follow each
+ * other back to back instead of waiting for a full round trip each. The
+ * device handle must belong to a libusb context that is serviced by an event
+ * thread.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int esp770u_flash_read_bulk(libusb_device_handle *devh, uint32_t addr,
+			    uint8_t *data, uint32_t len)
+{
+	struct uvc_control_batch *batch[2] = { NULL, NULL };
+	uint32_t queued[2] = { 0, 0 };
+	uint32_t done = 0;
+	uint32_t offset = 0;
+	uint16_t block_size;
+	uint8_t count;
+	int cur = 0;
+	int ret;
+
+	ret = uvc_get_len(devh, 0, ESP770U_EXTENSION_UNIT,
+			  ESP770U_SELECTOR_DATA, &block_size);
+	if (ret < 0 || block_size == 0)
+		block_size = ESP770U_FLASH_BLOCK_SIZE;
+
+	ret = esp770u_get_counter(devh, &count);
+	if (ret < 0)
+		return ret;
+
+	while (done < len) {
+		/* Queue the next batch before waiting for the previous one */
+		if (offset < len) {
+			batch[cur] = uvc_control_batch_new(devh);
+			ret = esp770u_flash_queue_reads(batch[cur], count,
+							addr + offset,
+							len - offset,
+							block_size);
+			if (ret < 0)
+				break;
+			queued[cur] = ret;
+			offset += ret;
+			uvc_control_batch_start(batch[cur]);
+		}
+
+		cur ^= 1;
+		if (!batch[cur])
+			continue;
+
+		ret = uvc_control_batch_wait(batch[cur]);
+		if (ret < 0)
+			break;
+		esp770u_flash_copy_reads(batch[cur], data + done, queued[cur],
+					 block_size);
+		done += queued[cur];
+		uvc_control_batch_free(batch[cur]);
+		batch[cur] = NULL;
+	}
+
+	/* Let the other batch finish before freeing it */
+	if (batch[cur ^ 1])
+		uvc_control_batch_wait(batch[cur ^ 1]);
+	uvc_control_batch_free(batch[0]);
+	uvc_control_batch_free(batch[1]);
+
+	return ret < 0 ? ret : 0;
+}
+
 static int esp770u_spi_set_control(libusb_device_handle *devh, uint8_t a,
 				   size_t len)
 {
@@ -360,6 +508,31 @@ int esp770u_i2c_read(libusb_device_handle *devh, uint8_t addr, uint16_t reg,
 	return 0;
 }
 
+/* Each write takes a SET_CUR and a GET_CUR request */
+#define ESP770U_I2C_BATCH_WRITES	(UVC_CONTROL_BATCH_MAX / 2)
+
+/*
+ * Checks the GET_CUR response to a 16-bit I2C write operation.
+ */
+static int esp770u_i2c_write_check(const uint8_t *buf, uint8_t addr,
+				   uint16_t reg, uint16_t val)
+{
+	if (buf[0] != 0x06 || buf[1] != addr || buf[2] != (reg >> 8) ||
+	    buf[3] != (reg & 0xff)) {
+		printf("%s(%04x, %04x): %02x %02x %02x %02x %02x %02x\n",
+		       "esp770u_i2c_write", reg, val, buf[0], buf[1], buf[2],
+		       buf[3], buf[4], buf[5]);
+		return -1;
+	}
+
+	if (buf[4] != (val >> 8) || buf[5] != (val & 0xff)) {
+		printf("%s(%04x, %04x): read back 0x%04x\n",
+		       "esp770u_i2c_write", reg, val, (buf[4] << 8) | buf[5]);
+	}
+
+	return 0;
+}
+
 /*
  * Performs a 16-bit write operation on the I2C bus.
  */
@@ -377,20 +550,64 @@ int esp770u_i2c_write(libusb_device_handle *devh, uint8_t addr, uint16_t reg,
 	if (ret < 0)
 		return ret;
 
-	if (buf[0] != 0x06 || buf[1] != addr || buf[2] != (reg >> 8) ||
-	    buf[3] != (reg & 0xff)) {
-		printf("%s(%04x, %04x): %02x %02x %02x %02x %02x %02x\n",
-		       __func__, reg, val, buf[0], buf[1], buf[2], buf[3],
-		       buf[4], buf[5]);
-		return -1;
-	}
+	return esp770u_i2c_write_check(buf, addr, reg, val);
+}
 
-	if (buf[4] != (val >> 8) || buf[5] != (val & 0xff)) {
-		printf("%s(%04x, %04x): read back 0x%04x\n", __func__, reg,
-		       val, (buf[4] << 8) | buf[5]);
+/*
+ * Performs a sequence of 16-bit write operations on the I2C bus, given as
+ * num pairs of register and value in regs. The SET_CUR and GET_CUR requests
+ * of all writes are queued at once, and the read back values are verified
+ * after all of them have completed.
+ */
+int esp770u_i2c_write_regs(libusb_device_handle *devh, uint8_t addr,
+			   const uint16_t *regs, int num)
+{
+	struct uvc_control_batch *batch;
+	int ret = 0;
+	int i, n;
+
+	while (num > 0 && ret == 0) {
+		n = (num < ESP770U_I2C_BATCH_WRITES) ? num :
+		    ESP770U_I2C_BATCH_WRITES;
+
+		batch = uvc_control_batch_new(devh);
+		for (i = 0; i < n; i++) {
+			uint16_t reg = regs[2 * i];
+			uint16_t val = regs[2 * i + 1];
+			uint8_t buf[6] = {
+				0x06, addr,
+				reg >> 8, reg & 0xff,
+				val >> 8, val & 0xff,
+			};
+
+			ret = uvc_control_batch_set_cur(batch, 0,
+							ESP770U_EXTENSION_UNIT,
+							ESP770U_SELECTOR_I2C,
+							buf, sizeof buf);
+			if (ret >= 0)
+				ret = uvc_control_batch_get_cur(batch, 0,
+						ESP770U_EXTENSION_UNIT,
+						ESP770U_SELECTOR_I2C,
+						sizeof buf);
+			if (ret < 0)
+				break;
+		}
+
+		if (ret >= 0)
+			ret = uvc_control_batch_submit(batch);
+		for (i = 0; i < n && ret == 0; i++) {
+			ret = esp770u_i2c_write_check(
+					uvc_control_batch_get_data(batch,
+								   2 * i + 1),
+					addr, regs[2 * i], regs[2 * i + 1]);
+		}
+		uvc_control_batch_free(batch);
+
+		regs += 2 * n;
+		num -= n;
 	}
 
-	return 0;
+	return ret;
 }
 
 /*
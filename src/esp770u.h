@@ -11,10 +11,14 @@
 
 int esp770u_flash_read(libusb_device_handle *devh, uint32_t addr,
 		       uint8_t *data, uint16_t len);
+int esp770u_flash_read_bulk(libusb_device_handle *devh, uint32_t addr,
+			    uint8_t *data, uint32_t len);
 int esp770u_i2c_read(libusb_device_handle *devh, uint8_t addr, uint16_t reg,
 		     uint16_t *val);
 int esp770u_i2c_write(libusb_device_handle *devh, uint8_t addr, uint16_t reg,
 		      uint16_t val);
+int esp770u_i2c_write_regs(libusb_device_handle *devh, uint8_t addr,
+			   const uint16_t *regs, int num);
 
 int esp770u_query_firmware_version(libusb_device_handle *devh, uint8_t *val);
 int esp770u_init_radio(libusb_device_handle *devh);
@@ -0,0 +1,190 @@
+/*
+ * Blob-driven exposure and gain control
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Adjusts the sensor exposure time and gain in synchronised exposure mode so
+ * that the LED blobs stay small and well separated, but bright enough to be
+ * detected reliably above the blob detection threshold. The statistics are
+ * gathered from the blobs found by blobwatch: the median blob area and the
+ * brightest pixel inside each blob's bounding box.
+ */
+#include <stdlib.h>
+
+#include "exposure.h"
+
+/* number of blobs sampled per frame */
+#define EXPOSURE_MAX_SAMPLES	64
+/* median peak below which the LEDs are too close to the blob threshold */
+#define EXPOSURE_PEAK_LOW	0xc0
+#define EXPOSURE_SATURATED	0xff
+/* median blob area in pixels above which blobs start to merge */
+#define EXPOSURE_AREA_HIGH	64
+/* median blob area in pixels below which saturation is harmless */
+#define EXPOSURE_AREA_LOW	9
+/* frames to wait after a change for the new settings to take effect */
+#define EXPOSURE_SETTLE_FRAMES	3
+
+static void sort_values(int *values, int num)
+{
+	int i, j, val;
+
+	for (i = 1; i < num; i++) {
+		val = values[i];
+		for (j = i; j > 0 && values[j - 1] > val; j--)
+			values[j] = values[j - 1];
+		values[j] = val;
+	}
+}
+
+/*
+ * Returns the brightest pixel value inside the bounding box of the blob.
+ */
+static int blob_peak(const uint8_t *frame, int width, int height,
+		     const struct blob *b)
+{
+	int x0 = b->x - (b->width - 1) / 2;
+	int y0 = b->y - (b->height - 1) / 2;
+	int x1 = x0 + b->width;
+	int y1 = y0 + b->height;
+	int peak = 0;
+	int x, y;
+
+	if (x0 < 0)
+		x0 = 0;
+	if (y0 < 0)
+		y0 = 0;
+	if (x1 > width)
+		x1 = width;
+	if (y1 > height)
+		y1 = height;
+
+	for (y = y0; y < y1; y++) {
+		const uint8_t *line = frame + y * width;
+
+		for (x = x0; x < x1; x++) {
+			if (line[x] > peak)
+				peak = line[x];
+		}
+	}
+
+	return peak;
+}
+
+/*
+ * Changes the total brightness by one step, preferring short exposure with
+ * low gain: exposure time is raised before gain, and gain is lowered before
+ * exposure time. Returns true if the settings were changed.
+ */
+static bool exposure_control_step(struct exposure_control *ctl, bool up)
+{
+	int step;
+
+	if (up) {
+		if (ctl->exposure < ctl->exposure_max) {
+			step = ctl->exposure / 8 > 1 ? ctl->exposure / 8 : 1;
+			ctl->exposure += step;
+			if (ctl->exposure > ctl->exposure_max)
+				ctl->exposure = ctl->exposure_max;
+		} else if (ctl->gain < ctl->gain_max) {
+			step = ctl->gain / 8 > 1 ? ctl->gain / 8 : 1;
+			ctl->gain += step;
+			if (ctl->gain > ctl->gain_max)
+				ctl->gain = ctl->gain_max;
+		} else {
+			return false;
+		}
+	} else {
+		if (ctl->gain > ctl->gain_min) {
+			step = ctl->gain / 8 > 1 ? ctl->gain / 8 : 1;
+			ctl->gain -= step;
+			if (ctl->gain < ctl->gain_min)
+				ctl->gain = ctl->gain_min;
+		} else if (ctl->exposure > ctl->exposure_min) {
+			step = ctl->exposure / 8 > 1 ? ctl->exposure / 8 : 1;
+			ctl->exposure -= step;
+			if (ctl->exposure < ctl->exposure_min)
+				ctl->exposure = ctl->exposure_min;
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Initializes the controller with the current sensor settings and limits.
+ */
+void exposure_control_init(struct exposure_control *ctl, int exposure,
+			   int exposure_min, int exposure_max, int gain,
+			   int gain_min, int gain_max)
+{
+	ctl->exposure = exposure;
+	ctl->exposure_min = exposure_min;
+	ctl->exposure_max = exposure_max;
+	ctl->gain = gain;
+	ctl->gain_min = gain_min;
+	ctl->gain_max = gain_max;
+	ctl->settle = EXPOSURE_SETTLE_FRAMES;
+}
+
+/*
+ * Updates exposure and gain from the blobs detected in a greyscale frame.
+ * Without blobs, the settings are kept, as the LEDs may just be occluded
+ * or out of view.
+ *
+ * Returns true if exposure or gain were changed and should be written to
+ * the sensor.
+ */
+bool exposure_control_update(struct exposure_control *ctl,
+			     const uint8_t *frame, int width, int height,
+			     const struct blob *blobs, int num_blobs)
+{
+	int areas[EXPOSURE_MAX_SAMPLES];
+	int peaks[EXPOSURE_MAX_SAMPLES];
+	int num_saturated = 0;
+	int area, peak;
+	int num, i;
+
+	if (ctl->settle > 0) {
+		ctl->settle--;
+		return false;
+	}
+
+	num = num_blobs < EXPOSURE_MAX_SAMPLES ? num_blobs :
+						 EXPOSURE_MAX_SAMPLES;
+	if (num == 0)
+		return false;
+
+	for (i = 0; i < num; i++) {
+		areas[i] = blobs[i].area;
+		peaks[i] = blob_peak(frame, width, height, &blobs[i]);
+		if (peaks[i] >= EXPOSURE_SATURATED)
+			num_saturated++;
+	}
+
+	sort_values(areas, num);
+	sort_values(peaks, num);
+	area = areas[num / 2];
+	peak = peaks[num / 2];
+
+	/*
+	 * Large or mostly saturated blobs bloom into each other, dim blobs
+	 * risk dropping below the detection threshold.
+	 */
+	if (area > EXPOSURE_AREA_HIGH ||
+	    (4 * num_saturated > 3 * num && area > EXPOSURE_AREA_LOW)) {
+		if (!exposure_control_step(ctl, false))
+			return false;
+	} else if (peak < EXPOSURE_PEAK_LOW) {
+		if (!exposure_control_step(ctl, true))
+			return false;
+	} else {
+		return false;
+	}
+
+	ctl->settle = EXPOSURE_SETTLE_FRAMES;
+
+	return true;
+}
@@ -0,0 +1,36 @@
+/*
+ * Blob-driven exposure and gain control
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __EXPOSURE_H__
+#define __EXPOSURE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "blobwatch.h"
+
+/*
+ * Exposure and gain in sensor specific register units, with the limits
+ * supported by the sensor in synchronised exposure mode.
+ */
+struct exposure_control {
+	int exposure;
+	int exposure_min;
+	int exposure_max;
+	int gain;
+	int gain_min;
+	int gain_max;
+	/* frames to skip until the last change has taken effect */
+	int settle;
+};
+
+void exposure_control_init(struct exposure_control *ctl, int exposure,
+			   int exposure_min, int exposure_max, int gain,
+			   int gain_min, int gain_max);
+bool exposure_control_update(struct exposure_control *ctl,
+			     const uint8_t *frame, int width, int height,
+			     const struct blob *blobs, int num_blobs);
+
+#endif /* __EXPOSURE_H__ */
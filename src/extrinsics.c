@@ -0,0 +1,443 @@
+/*
+ * Background refinement of camera extrinsics
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Observations of the tracked device by multiple cameras in the same
+ * exposure are collected by the frame jobs and handed to a low priority
+ * thread in batches. The world space pose jointly refined from all views of
+ * an observation serves as reference for the camera pose measured by each
+ * single view. Since the references are fixed per batch, the cameras are
+ * independent of each other: each camera pose is corrected by a single
+ * Gauss-Newton step on its own 6x6 normal equations, regularized by the
+ * decayed information of previous batches, instead of solving the whole
+ * problem again. The first camera is kept fixed as reference.
+ */
+#define _GNU_SOURCE
+#include <glib.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "extrinsics.h"
+#include "maths.h"
+
+/* observations per batch, more are dropped until the batch is taken */
+#define EXTRINSICS_BATCH_SIZE		64
+/* minimum number of views of a camera in a batch to update its pose */
+#define EXTRINSICS_MIN_VIEWS		8
+/* fraction of a CPU the estimator may use on average */
+#define EXTRINSICS_CPU_BUDGET		0.01
+/* decay of the information per batch, so that bumped cameras are followed */
+#define EXTRINSICS_FORGET		0.9
+/* rotation in rad and translation in m beyond which views are outliers */
+#define EXTRINSICS_MAX_ROTATION		0.05
+#define EXTRINSICS_MAX_TRANSLATION	0.05
+/* view noise in rad, and in m per m of distance along the viewing ray */
+#define EXTRINSICS_SIGMA_ROTATION	0.005
+#define EXTRINSICS_SIGMA_DEPTH		0.01
+
+/*
+ * Views of the tracked device in a single exposure, with its jointly
+ * refined world space pose
+ */
+struct extrinsics_sample {
+	struct dpose pose;
+	int num_views;
+	struct extrinsics_view views[EXTRINSICS_MAX_CAMERAS];
+};
+
+/*
+ * Estimate of a single camera pose, only accessed by the estimator thread
+ */
+struct extrinsics_camera {
+	bool valid;
+	struct dpose pose;
+	/* information of the pose error, rotation first */
+	double info[6][6];
+};
+
+/*
+ * Camera pose published to the tracker
+ */
+struct extrinsics_result {
+	struct dpose pose;
+	unsigned int generation;
+};
+
+struct extrinsics {
+	GThread *thread;
+	/* serializes access to the batches and results */
+	GMutex lock;
+	GCond cond;
+	bool quit;
+	/* batch filled by the frame jobs, and batch being processed */
+	struct extrinsics_sample *batch;
+	struct extrinsics_sample *work;
+	int num_samples;
+	struct extrinsics_result results[EXTRINSICS_MAX_CAMERAS];
+	/* cameras removed since the last batch was taken */
+	uint32_t removed_mask;
+
+	struct extrinsics_camera cameras[EXTRINSICS_MAX_CAMERAS];
+	/* index of the camera kept fixed, or -1 */
+	int reference;
+};
+
+/*
+ * Adds the camera pose measured by a single view to the normal equations of
+ * that camera, linearized at the current estimate. The view's rotation error
+ * shifts the measured camera position laterally, while its depth error moves
+ * it along the viewing ray.
+ *
+ * Returns false if the view is an outlier.
+ */
+static bool extrinsics_add_view(const struct extrinsics_camera *camera,
+				const struct dpose *pose,
+				const struct extrinsics_view *view,
+				double info[6][6], double b[6])
+{
+	dquat rot_inv = { -view->rot.x, -view->rot.y, -view->rot.z,
+			  view->rot.w };
+	dquat cam_inv = { -camera->pose.rotation.x, -camera->pose.rotation.y,
+			  -camera->pose.rotation.z, camera->pose.rotation.w };
+	double r[6], rot_info, lat_info, depth_info, dist, sign;
+	dquat rot, dq;
+	double d[3];
+	dvec3 a;
+	int i, j;
+
+	dist = sqrt(dvec3_dot(&view->trans, &view->trans));
+	if (dist < 0.1 || view->num_inliers <= 0)
+		return false;
+
+	/* Measured camera pose: the object pose times the inverse view */
+	dquat_mult(&rot, &pose->rotation, &rot_inv);
+	dquat_rotate(&a, &rot, &view->trans);
+
+	dquat_mult(&dq, &rot, &cam_inv);
+	sign = dq.w < 0 ? -2.0 : 2.0;
+	r[0] = sign * dq.x;
+	r[1] = sign * dq.y;
+	r[2] = sign * dq.z;
+	r[3] = pose->translation.x - a.x - camera->pose.translation.x;
+	r[4] = pose->translation.y - a.y - camera->pose.translation.y;
+	r[5] = pose->translation.z - a.z - camera->pose.translation.z;
+
+	if (r[0] * r[0] + r[1] * r[1] + r[2] * r[2] >
+	    EXTRINSICS_MAX_ROTATION * EXTRINSICS_MAX_ROTATION ||
+	    r[3] * r[3] + r[4] * r[4] + r[5] * r[5] >
+	    EXTRINSICS_MAX_TRANSLATION * EXTRINSICS_MAX_TRANSLATION)
+		return false;
+
+	d[0] = a.x / dist;
+	d[1] = a.y / dist;
+	d[2] = a.z / dist;
+	rot_info = view->num_inliers /
+		   (EXTRINSICS_SIGMA_ROTATION * EXTRINSICS_SIGMA_ROTATION);
+	lat_info = rot_info / (dist * dist);
+	depth_info = view->num_inliers /
+		     (EXTRINSICS_SIGMA_DEPTH * EXTRINSICS_SIGMA_DEPTH *
+		      dist * dist);
+
+	for (i = 0; i < 3; i++) {
+		info[i][i] += rot_info;
+		b[i] += rot_info * r[i];
+	}
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			double w = (depth_info - lat_info) * d[i] * d[j];
+
+			if (i == j)
+				w += lat_info;
+			info[3 + i][3 + j] += w;
+			b[3 + i] += w * r[3 + j];
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Applies the pose error x solved from the normal equations to the camera
+ * pose estimate.
+ */
+static void extrinsics_apply(struct extrinsics_camera *camera,
+			     const double x[6])
+{
+	dvec3 axis = { .x = x[0], .y = x[1], .z = x[2] };
+	double angle = sqrt(dvec3_dot(&axis, &axis));
+	dquat dq, rot;
+
+	if (angle > 1e-12) {
+		axis.x /= angle;
+		axis.y /= angle;
+		axis.z /= angle;
+		dquat_from_axis_angle(&dq, &axis, angle);
+		dquat_mult(&rot, &dq, &camera->pose.rotation);
+		dquat_normalize(&rot);
+		camera->pose.rotation = rot;
+	}
+	camera->pose.translation.x += x[3];
+	camera->pose.translation.y += x[4];
+	camera->pose.translation.z += x[5];
+}
+
+/*
+ * Refines the camera poses with a batch of observations and publishes the
+ * updated poses.
+ */
+static void extrinsics_update(struct extrinsics *ext,
+			      const struct extrinsics_sample *samples,
+			      int num_samples, uint32_t removed_mask)
+{
+	double info[EXTRINSICS_MAX_CAMERAS][6][6];
+	double b[EXTRINSICS_MAX_CAMERAS][6];
+	int num_views[EXTRINSICS_MAX_CAMERAS];
+	bool updated[EXTRINSICS_MAX_CAMERAS];
+	int i, j, k;
+
+	memset(info, 0, sizeof(info));
+	memset(b, 0, sizeof(b));
+	memset(num_views, 0, sizeof(num_views));
+	memset(updated, 0, sizeof(updated));
+
+	/* Start over with cameras whose index was freed */
+	for (i = 0; i < EXTRINSICS_MAX_CAMERAS; i++) {
+		if (!(removed_mask & (1 << i)))
+			continue;
+		memset(&ext->cameras[i], 0, sizeof(ext->cameras[i]));
+		if (ext->reference == i)
+			ext->reference = -1;
+	}
+
+	for (i = 0; i < num_samples; i++) {
+		const struct extrinsics_sample *s = &samples[i];
+
+		for (j = 0; j < s->num_views; j++) {
+			const struct extrinsics_view *v = &s->views[j];
+			struct extrinsics_camera *camera;
+
+			if (v->camera < 0 ||
+			    v->camera >= EXTRINSICS_MAX_CAMERAS ||
+			    removed_mask & (1 << v->camera))
+				continue;
+			camera = &ext->cameras[v->camera];
+
+			/* Start from the pose the tracker initialized */
+			if (!camera->valid) {
+				camera->pose = v->camera_pose;
+				camera->valid = true;
+				if (ext->reference < 0)
+					ext->reference = v->camera;
+			}
+			if (v->camera == ext->reference)
+				continue;
+
+			if (extrinsics_add_view(camera, &s->pose, v,
+						info[v->camera], b[v->camera]))
+				num_views[v->camera]++;
+		}
+	}
+
+	for (i = 0; i < EXTRINSICS_MAX_CAMERAS; i++) {
+		struct extrinsics_camera *camera = &ext->cameras[i];
+		double a[6][6];
+
+		if (num_views[i] < EXTRINSICS_MIN_VIEWS)
+			continue;
+
+		for (j = 0; j < 6; j++) {
+			for (k = 0; k < 6; k++) {
+				info[i][j][k] += EXTRINSICS_FORGET *
+						 camera->info[j][k];
+			}
+		}
+		memcpy(a, info[i], sizeof(a));
+		if (!cholesky_solve6(a, b[i]))
+			continue;
+
+		extrinsics_apply(camera, b[i]);
+		memcpy(camera->info, info[i], sizeof(camera->info));
+		updated[i] = true;
+	}
+
+	g_mutex_lock(&ext->lock);
+	for (i = 0; i < EXTRINSICS_MAX_CAMERAS; i++) {
+		/* Cameras removed meanwhile are reset with the next batch */
+		if (!updated[i] || ext->removed_mask & (1 << i))
+			continue;
+		ext->results[i].pose = ext->cameras[i].pose;
+		ext->results[i].generation++;
+	}
+	g_mutex_unlock(&ext->lock);
+}
+
+/*
+ * Runs the estimator only when the CPU is otherwise idle, so that it never
+ * delays the real-time tracking threads.
+ */
+static void extrinsics_lower_priority(void)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	int ret;
+
+	ret = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+	if (ret)
+		g_print("Extrinsics: Failed to set SCHED_IDLE: %d\n", ret);
+}
+
+static uint64_t extrinsics_cpu_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Processes full batches, sleeping after each one long enough to stay
+ * within the CPU budget. Observations arriving meanwhile are dropped.
+ */
+static gpointer extrinsics_thread(gpointer data)
+{
+	struct extrinsics *ext = data;
+	struct extrinsics_sample *work;
+	uint32_t removed_mask;
+	uint64_t start, used;
+	gint64 end_time;
+	int num;
+
+	extrinsics_lower_priority();
+
+	g_mutex_lock(&ext->lock);
+	while (!ext->quit) {
+		if (ext->num_samples < EXTRINSICS_BATCH_SIZE) {
+			g_cond_wait(&ext->cond, &ext->lock);
+			continue;
+		}
+
+		work = ext->batch;
+		ext->batch = ext->work;
+		ext->work = work;
+		num = ext->num_samples;
+		ext->num_samples = 0;
+		removed_mask = ext->removed_mask;
+		ext->removed_mask = 0;
+		g_mutex_unlock(&ext->lock);
+
+		start = extrinsics_cpu_time();
+		extrinsics_update(ext, work, num, removed_mask);
+		used = extrinsics_cpu_time() - start;
+
+		end_time = g_get_monotonic_time() +
+			   used * (1.0 / EXTRINSICS_CPU_BUDGET - 1.0);
+		g_mutex_lock(&ext->lock);
+		while (!ext->quit &&
+		       g_cond_wait_until(&ext->cond, &ext->lock, end_time))
+			;
+	}
+	g_mutex_unlock(&ext->lock);
+
+	return NULL;
+}
+
+/*
+ * Adds an observation of the tracked device by multiple cameras, with its
+ * jointly refined world space pose. Called from the frame jobs, never
+ * blocks on the estimator.
+ */
+void extrinsics_add_observation(struct extrinsics *ext,
+				const struct extrinsics_view *views,
+				int num_views, const struct dpose *pose)
+{
+	struct extrinsics_sample *s;
+
+	if (!ext || num_views < 2)
+		return;
+
+	g_mutex_lock(&ext->lock);
+	if (ext->num_samples < EXTRINSICS_BATCH_SIZE) {
+		s = &ext->batch[ext->num_samples++];
+		s->pose = *pose;
+		s->num_views = MIN(num_views, EXTRINSICS_MAX_CAMERAS);
+		memcpy(s->views, views, s->num_views * sizeof(*views));
+		if (ext->num_samples == EXTRINSICS_BATCH_SIZE)
+			g_cond_signal(&ext->cond);
+	}
+	g_mutex_unlock(&ext->lock);
+}
+
+/*
+ * Discards the pose estimate of a camera removed from the tracker, so that
+ * the next camera added with the same index starts from scratch, with
+ * generation 0.
+ */
+void extrinsics_remove_camera(struct extrinsics *ext, int camera)
+{
+	if (!ext || camera < 0 || camera >= EXTRINSICS_MAX_CAMERAS)
+		return;
+
+	g_mutex_lock(&ext->lock);
+	ext->removed_mask |= 1 << camera;
+	ext->results[camera].generation = 0;
+	g_mutex_unlock(&ext->lock);
+}
+
+/*
+ * Returns the refined pose of a camera, if it changed since the given
+ * generation, and updates the generation.
+ */
+bool extrinsics_get_camera(struct extrinsics *ext, int camera,
+			   struct dpose *pose, unsigned int *generation)
+{
+	bool changed = false;
+
+	if (!ext || camera < 0 || camera >= EXTRINSICS_MAX_CAMERAS)
+		return false;
+
+	g_mutex_lock(&ext->lock);
+	if (ext->results[camera].generation != *generation) {
+		*pose = ext->results[camera].pose;
+		*generation = ext->results[camera].generation;
+		changed = true;
+	}
+	g_mutex_unlock(&ext->lock);
+
+	return changed;
+}
+
+struct extrinsics *extrinsics_new(void)
+{
+	struct extrinsics *ext = g_new0(struct extrinsics, 1);
+
+	g_mutex_init(&ext->lock);
+	g_cond_init(&ext->cond);
+	ext->batch = g_new0(struct extrinsics_sample, EXTRINSICS_BATCH_SIZE);
+	ext->work = g_new0(struct extrinsics_sample, EXTRINSICS_BATCH_SIZE);
+	ext->reference = -1;
+	ext->thread = g_thread_new("extrinsics", extrinsics_thread, ext);
+
+	return ext;
+}
+
+void extrinsics_free(struct extrinsics *ext)
+{
+	if (!ext)
+		return;
+
+	g_mutex_lock(&ext->lock);
+	ext->quit = true;
+	g_cond_signal(&ext->cond);
+	g_mutex_unlock(&ext->lock);
+	g_thread_join(ext->thread);
+
+	g_cond_clear(&ext->cond);
+	g_mutex_clear(&ext->lock);
+	g_free(ext->batch);
+	g_free(ext->work);
+	g_free(ext);
+}
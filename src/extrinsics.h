@@ -0,0 +1,41 @@
+/*
+ * Background refinement of camera extrinsics
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __EXTRINSICS_H__
+#define __EXTRINSICS_H__
+
+#include <stdbool.h>
+
+#include "imu.h"
+#include "maths.h"
+
+/* camera indices must be below this */
+#define EXTRINSICS_MAX_CAMERAS	8
+
+/*
+ * Camera space pose of the tracked device seen by one camera, with the world
+ * space camera pose that was used for this view and its number of inliers.
+ */
+struct extrinsics_view {
+	int camera;
+	struct dpose camera_pose;
+	dquat rot;
+	dvec3 trans;
+	int num_inliers;
+};
+
+struct extrinsics;
+
+struct extrinsics *extrinsics_new(void);
+void extrinsics_free(struct extrinsics *ext);
+
+void extrinsics_add_observation(struct extrinsics *ext,
+				const struct extrinsics_view *views,
+				int num_views, const struct dpose *pose);
+void extrinsics_remove_camera(struct extrinsics *ext, int camera);
+bool extrinsics_get_camera(struct extrinsics *ext, int camera,
+			   struct dpose *pose, unsigned int *generation);
+
+#endif /* __EXTRINSICS_H__ */
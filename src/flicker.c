@@ -47,19 +47,158 @@ static int pattern_find_id(uint16_t *patterns, int num_patterns,
 	return -2;
 }
 
+/*
+ * Finds the LED with the given blinking pattern among all tracked objects,
+ * preferring exact matches. Each object has its own pattern namespace, so
+ * the LED id is only meaningful together with the object id.
+ *
+ * Returns the match score.
+ */
+static int pattern_find_object_id(struct leds **leds, int num_objects,
+				  uint16_t pattern, int8_t *object_id,
+				  int8_t *led_id)
+{
+	int best = -2;
+	int i;
+
+	for (i = 0; i < num_objects && best < 2; i++) {
+		int8_t id = -1;
+		int score;
+
+		if (!leds[i]->patterns)
+			continue;
+
+		if (leds[i]->pattern_table) {
+			struct led_pattern_match *match;
+
+			match = &leds[i]->pattern_table[pattern];
+			id = match->id;
+			score = match->score;
+		} else {
+			score = pattern_find_id(leds[i]->patterns,
+						leds[i]->model.num_points,
+						pattern, &id);
+		}
+
+		if (score > best) {
+			best = score;
+			*object_id = i;
+			*led_id = id;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Restricts the LED candidates of a blob to those whose blinking pattern has
+ * the given bit value at the given phase.
+ */
+static void flicker_constrain(struct blob *b, struct leds **leds,
+			      int num_objects, int phase, int bit)
+{
+	int i;
+
+	for (i = 0; i < num_objects && i < BLOB_MAX_OBJECTS; i++)
+		b->candidates[i] &= leds[i]->bit_masks[phase][bit];
+}
+
+/*
+ * Starts progressive identification with all LEDs of all objects that have
+ * known blinking patterns as candidates.
+ */
+static void flicker_reset_candidates(struct blob *b, struct leds **leds,
+				     int num_objects)
+{
+	int i;
+
+	memset(b->candidates, 0, sizeof(b->candidates));
+	for (i = 0; i < num_objects && i < BLOB_MAX_OBJECTS; i++) {
+		int n = leds[i]->model.num_points;
+
+		if (!leds[i]->patterns || n > LED_MAX_CANDIDATES)
+			continue;
+		b->candidates[i] = n == 64 ? ~0ULL : (1ULL << n) - 1;
+	}
+}
+
+/*
+ * Returns the number of LED candidates left for a blob, and the single
+ * candidate if there is only one.
+ */
+static int flicker_count_candidates(const struct blob *b, int8_t *object_id,
+				    int8_t *led_id)
+{
+	int count = 0;
+	int i;
+
+	for (i = 0; i < BLOB_MAX_OBJECTS; i++) {
+		if (!b->candidates[i])
+			continue;
+		count += __builtin_popcountll(b->candidates[i]);
+		*object_id = i;
+		*led_id = __builtin_ctzll(b->candidates[i]);
+	}
+
+	return count;
+}
+
+/*
+ * Removes LEDs that are uniquely identified as one blob from the candidates
+ * of all other blobs, repeating as long as this identifies further blobs.
+ */
+static void flicker_eliminate(struct blob *blobs, int num_blobs)
+{
+	struct blob *b, *b2;
+	bool changed = true;
+	int iterations;
+
+	for (iterations = 0; changed && iterations < num_blobs; iterations++) {
+		changed = false;
+		for (b = blobs; b < blobs + num_blobs; b++) {
+			int8_t object_id, led_id;
+			uint64_t bit;
+
+			if (!b->pattern_bits ||
+			    flicker_count_candidates(b, &object_id,
+						     &led_id) != 1)
+				continue;
+
+			bit = 1ULL << led_id;
+			for (b2 = blobs; b2 < blobs + num_blobs; b2++) {
+				if (b2 == b || !b2->pattern_bits ||
+				    !(b2->candidates[object_id] & bit))
+					continue;
+				b2->candidates[object_id] &= ~bit;
+				changed = true;
+			}
+		}
+	}
+}
+
 /*
  * Records blob blinking patterns and compares against the blinking patterns
- * stored in the Rift DK2 to determine the corresponding LED IDs.
+ * stored in the tracked devices to determine the corresponding LED IDs.
+ *
+ * Each new pattern bit, at the known phase, narrows down the set of LEDs
+ * whose patterns are consistent with all bits seen so far, so that a blob
+ * is identified as soon as a single candidate is left, usually well before
+ * a full pattern is recorded. If noise leaves no candidate, identification
+ * starts over at the next brightness edge, and blobs with a full pattern
+ * are still matched allowing for a single bit error.
  */
 void flicker_process(struct blob *blobs, int num_blobs,
-		     uint8_t led_pattern_phase, struct leds *leds)
+		     uint8_t led_pattern_phase, struct leds **leds,
+		     int num_objects)
 {
 	struct blob *b;
 	int success = 0;
 	int phase = (led_pattern_phase + 1) % 10;
 
 	for (b = blobs; b < blobs + num_blobs; b++) {
+		bool edge = true;
 		uint16_t pattern;
+		int bit;
 
 		/* Update pattern only if blob was observed previously */
 		if (b->age < 1)
@@ -71,27 +210,78 @@ void flicker_process(struct blob *blobs, int num_blobs,
 		 * new brightness level as MSB.
 		 */
 		pattern = (b->pattern >> 1) & 0x1ff;
-		if (b->area * 10 > b->last_area * 11)
+		if (b->area * 10 > b->last_area * 11) {
 			pattern |= (1 << 9);
-		else if (b->area * 11 < b->last_area * 10)
+		} else if (b->area * 11 < b->last_area * 10) {
 			pattern |= (0 << 9);
-		else
+		} else {
 			pattern |= b->pattern & (1 << 9);
+			edge = false;
+		}
 		b->pattern = pattern;
+		bit = pattern >> 9;
 
 		/*
-		 * Determine LED ID only if a full pattern was recorded and
-		 * consensus about the blinking phase is established
+		 * The brightness level is only known after the first edge,
+		 * which also tells the level in the previous frame. The new
+		 * bit corresponds to the LED pattern bit at the current phase.
+		 */
+		if (!b->pattern_bits) {
+			if (!edge)
+				continue;
+			flicker_reset_candidates(b, leds, num_objects);
+			flicker_constrain(b, leds, num_objects,
+					  (led_pattern_phase + 9) % 10, !bit);
+			b->pattern_bits = 1;
+		}
+		flicker_constrain(b, leds, num_objects, led_pattern_phase, bit);
+		if (b->pattern_bits < LED_PATTERN_BITS)
+			b->pattern_bits++;
+	}
+
+	flicker_eliminate(blobs, num_blobs);
+
+	for (b = blobs; b < blobs + num_blobs; b++) {
+		int8_t object_id = -1, led_id = -1;
+		uint16_t pattern;
+		int score;
+
+		if (b->age < 1)
+			continue;
+
+		if (b->pattern_bits) {
+			int count = flicker_count_candidates(b, &object_id,
+							     &led_id);
+
+			if (count == 1) {
+				b->object_id = object_id;
+				b->led_id = led_id;
+				success += 2;
+				continue;
+			}
+			/* Inconsistent with all LEDs, start over */
+			if (count == 0)
+				b->pattern_bits = 0;
+		}
+
+		/*
+		 * Fall back to matching the full pattern once it is recorded
+		 * and consensus about the blinking phase is established
 		 */
 		if (b->age < 9 || phase < 0)
 			continue;
 
 		/* Rotate the pattern bits according to the phase */
+		pattern = b->pattern;
 		pattern = ((pattern >> (10 - phase)) | (pattern << phase)) &
 			  0x3ff;
 
-		success += pattern_find_id(leds->patterns,
-					   leds->model.num_points, pattern,
-					   &b->led_id);
+		score = pattern_find_object_id(leds, num_objects, pattern,
+					       &object_id, &led_id);
+		if (score > 0) {
+			b->object_id = object_id;
+			b->led_id = led_id;
+		}
+		success += score;
 	}
 }
@@ -13,6 +13,7 @@ struct blob;
 struct leds;
 
 void flicker_process(struct blob *blobs, int num_blobs,
-		     uint8_t led_pattern_phase, struct leds *leds);
+		     uint8_t led_pattern_phase, struct leds **leds,
+		     int num_objects);
 
 #endif /* __BLOBWATCH_H__*/
@@ -0,0 +1,154 @@
+/*
+ * Hugepage backed, locked frame buffer memory
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Provides the capture buffers of all cameras from one process wide pool.
+ * Buffers are mapped from explicit hugepages if the system has reserved any,
+ * otherwise transparent hugepages are requested. All buffers are locked into
+ * memory and prefaulted, so that neither capture nor the debug stream ever
+ * take page faults on frame data, and a frame spans only a few TLB entries.
+ * Freed buffers are kept in the pool and handed out again when a stream is
+ * restarted, instead of being unmapped.
+ */
+#define _GNU_SOURCE
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "frame-memory.h"
+
+#define FRAME_MEMORY_HUGEPAGE_SIZE	(2 * 1024 * 1024)
+
+struct frame_memory_block {
+	void *data;
+	size_t size;
+	size_t locked;
+	bool in_use;
+};
+
+static GMutex frame_memory_lock;
+static GArray *frame_memory_blocks;
+static bool frame_memory_lock_warned;
+
+/*
+ * Locks and prefaults the first length bytes of a block.
+ */
+static void frame_memory_lock_range(void *data, size_t length)
+{
+	if (mlock(data, length) < 0 && !frame_memory_lock_warned) {
+		g_print("Failed to lock frame buffers, check RLIMIT_MEMLOCK\n");
+		frame_memory_lock_warned = true;
+	}
+
+	/* Fault in all pages now instead of during the first captures */
+	memset(data, 0, length);
+}
+
+/*
+ * Maps a new block of hugepage aligned size, preferably from explicit
+ * hugepages.
+ *
+ * Returns the block's address, or NULL on failure.
+ */
+static void *frame_memory_map(size_t size)
+{
+	void *data;
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (data == MAP_FAILED) {
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data == MAP_FAILED)
+			return NULL;
+		madvise(data, size, MADV_HUGEPAGE);
+	}
+
+	return data;
+}
+
+/*
+ * Returns a zeroed buffer of at least size bytes from the pool, mapping a
+ * new block if no free block is large enough. Blocks are mapped in
+ * hugepage sized units, but only the requested length is locked.
+ */
+void *frame_memory_alloc(size_t size)
+{
+	struct frame_memory_block *block;
+	struct frame_memory_block new_block;
+	size_t length = size;
+	size_t locked = 0;
+	unsigned int i;
+	void *data = NULL;
+
+	size = (size + FRAME_MEMORY_HUGEPAGE_SIZE - 1) &
+	       ~(size_t)(FRAME_MEMORY_HUGEPAGE_SIZE - 1);
+
+	g_mutex_lock(&frame_memory_lock);
+	if (!frame_memory_blocks) {
+		frame_memory_blocks = g_array_new(FALSE, FALSE,
+						  sizeof(struct frame_memory_block));
+	}
+
+	for (i = 0; i < frame_memory_blocks->len; i++) {
+		block = &g_array_index(frame_memory_blocks,
+				       struct frame_memory_block, i);
+		if (!block->in_use && block->size == size) {
+			block->in_use = true;
+			data = block->data;
+			locked = block->locked;
+			if (length > block->locked)
+				block->locked = length;
+			break;
+		}
+	}
+	g_mutex_unlock(&frame_memory_lock);
+
+	if (data) {
+		if (length > locked)
+			frame_memory_lock_range(data, length);
+		else
+			memset(data, 0, length);
+		return data;
+	}
+
+	data = frame_memory_map(size);
+	if (!data)
+		return NULL;
+	frame_memory_lock_range(data, length);
+
+	new_block.data = data;
+	new_block.size = size;
+	new_block.locked = length;
+	new_block.in_use = true;
+	g_mutex_lock(&frame_memory_lock);
+	g_array_append_val(frame_memory_blocks, new_block);
+	g_mutex_unlock(&frame_memory_lock);
+
+	return data;
+}
+
+/*
+ * Returns a buffer to the pool. The memory stays mapped and locked for reuse.
+ */
+void frame_memory_free(void *data)
+{
+	struct frame_memory_block *block;
+	unsigned int i;
+
+	if (!data)
+		return;
+
+	g_mutex_lock(&frame_memory_lock);
+	for (i = 0; i < frame_memory_blocks->len; i++) {
+		block = &g_array_index(frame_memory_blocks,
+				       struct frame_memory_block, i);
+		if (block->data == data) {
+			block->in_use = false;
+			break;
+		}
+	}
+	g_mutex_unlock(&frame_memory_lock);
+}
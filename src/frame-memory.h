@@ -0,0 +1,14 @@
+/*
+ * Hugepage backed, locked frame buffer memory
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __FRAME_MEMORY_H__
+#define __FRAME_MEMORY_H__
+
+#include <stddef.h>
+
+void *frame_memory_alloc(size_t size);
+void frame_memory_free(void *data);
+
+#endif /* __FRAME_MEMORY_H__ */
@@ -0,0 +1,195 @@
+/*
+ * Reference counted frame buffer pool
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Keeps track of capture buffers that are lent to a consumer running in
+ * another thread, such as the GStreamer debug stream, so that they are not
+ * handed back to the driver or overwritten before the consumer releases them.
+ * The number of frames held at the same time is bounded: if the consumer
+ * falls behind, further frames are not lent to it, so capture never stalls.
+ */
+#include <glib.h>
+#include <stdlib.h>
+
+#include "frame-pool.h"
+
+/* time to wait for the consumer to release all frames before freeing */
+#define FRAME_POOL_FREE_TIMEOUT	G_TIME_SPAN_SECOND
+
+struct frame_pool_ref {
+	struct frame_pool *pool;
+	int index;
+	bool held;
+	bool released;
+};
+
+struct frame_pool {
+	GMutex lock;
+	GCond cond;
+	int num_frames;
+	int max_held;
+	int num_held;
+	unsigned int num_dropped;
+	struct frame_pool_ref refs[];
+};
+
+/*
+ * Creates a pool tracking num_frames buffers, of which at most max_held can
+ * be held by the consumer at the same time.
+ */
+struct frame_pool *frame_pool_new(int num_frames, int max_held)
+{
+	struct frame_pool *pool;
+	int i;
+
+	pool = calloc(1, sizeof(*pool) + num_frames * sizeof(pool->refs[0]));
+	if (!pool)
+		return NULL;
+
+	g_mutex_init(&pool->lock);
+	g_cond_init(&pool->cond);
+	pool->num_frames = num_frames;
+	pool->max_held = max_held;
+	for (i = 0; i < num_frames; i++) {
+		pool->refs[i].pool = pool;
+		pool->refs[i].index = i;
+	}
+
+	return pool;
+}
+
+/*
+ * Waits for the consumer to release all held frames and frees the pool.
+ *
+ * Returns false if frames are still held after a timeout. In that case the
+ * pool is leaked, and the caller must not free the frame buffers either.
+ */
+bool frame_pool_free(struct frame_pool *pool)
+{
+	gint64 end_time = g_get_monotonic_time() + FRAME_POOL_FREE_TIMEOUT;
+
+	if (!pool)
+		return true;
+
+	g_mutex_lock(&pool->lock);
+	while (pool->num_held) {
+		if (!g_cond_wait_until(&pool->cond, &pool->lock, end_time))
+			break;
+	}
+	if (pool->num_held) {
+		g_mutex_unlock(&pool->lock);
+		return false;
+	}
+	g_mutex_unlock(&pool->lock);
+
+	g_cond_clear(&pool->cond);
+	g_mutex_clear(&pool->lock);
+	free(pool);
+
+	return true;
+}
+
+/*
+ * Lends the frame at index to the consumer, which must pass the returned
+ * reference to frame_pool_release() when it is done with the frame.
+ *
+ * Returns NULL and counts the frame as dropped if the consumer already holds
+ * the maximum number of frames.
+ */
+struct frame_pool_ref *frame_pool_acquire(struct frame_pool *pool, int index)
+{
+	struct frame_pool_ref *ref = NULL;
+
+	if (!pool || index < 0 || index >= pool->num_frames)
+		return NULL;
+
+	g_mutex_lock(&pool->lock);
+	if (!pool->refs[index].held && pool->num_held < pool->max_held) {
+		ref = &pool->refs[index];
+		ref->held = true;
+		ref->released = false;
+		pool->num_held++;
+	} else {
+		pool->num_dropped++;
+	}
+	g_mutex_unlock(&pool->lock);
+
+	return ref;
+}
+
+/*
+ * Returns a frame lent to the consumer. This can be called from any thread.
+ */
+void frame_pool_release(void *data)
+{
+	struct frame_pool_ref *ref = data;
+	struct frame_pool *pool = ref->pool;
+
+	g_mutex_lock(&pool->lock);
+	ref->held = false;
+	ref->released = true;
+	pool->num_held--;
+	g_cond_signal(&pool->cond);
+	g_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Returns true if the frame at index is held by the consumer.
+ */
+bool frame_pool_is_held(struct frame_pool *pool, int index)
+{
+	bool held;
+
+	if (!pool)
+		return false;
+
+	g_mutex_lock(&pool->lock);
+	held = pool->refs[index].held;
+	g_mutex_unlock(&pool->lock);
+
+	return held;
+}
+
+/*
+ * Returns the index of a frame released by the consumer since the last call,
+ * so that it can be reused, or -1 if there is none.
+ */
+int frame_pool_pop_released(struct frame_pool *pool)
+{
+	int index = -1;
+	int i;
+
+	if (!pool)
+		return -1;
+
+	g_mutex_lock(&pool->lock);
+	for (i = 0; i < pool->num_frames; i++) {
+		if (pool->refs[i].released) {
+			pool->refs[i].released = false;
+			index = i;
+			break;
+		}
+	}
+	g_mutex_unlock(&pool->lock);
+
+	return index;
+}
+
+/*
+ * Returns the number of frames that were not lent to the consumer because it
+ * fell behind.
+ */
+unsigned int frame_pool_get_dropped(struct frame_pool *pool)
+{
+	unsigned int num_dropped;
+
+	if (!pool)
+		return 0;
+
+	g_mutex_lock(&pool->lock);
+	num_dropped = pool->num_dropped;
+	g_mutex_unlock(&pool->lock);
+
+	return num_dropped;
+}
@@ -0,0 +1,22 @@
+/*
+ * Reference counted frame buffer pool
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __FRAME_POOL_H__
+#define __FRAME_POOL_H__
+
+#include <stdbool.h>
+
+struct frame_pool;
+struct frame_pool_ref;
+
+struct frame_pool *frame_pool_new(int num_frames, int max_held);
+bool frame_pool_free(struct frame_pool *pool);
+struct frame_pool_ref *frame_pool_acquire(struct frame_pool *pool, int index);
+void frame_pool_release(void *data);
+bool frame_pool_is_held(struct frame_pool *pool, int index);
+int frame_pool_pop_released(struct frame_pool *pool);
+unsigned int frame_pool_get_dropped(struct frame_pool *pool);
+
+#endif /* __FRAME_POOL_H__ */
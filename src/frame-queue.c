@@ -0,0 +1,315 @@
+/*
+ * Bounded frame queues between pipeline stages
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Connects a producing stage, such as a capture thread, to a consuming stage
+ * running in another thread. The queue holds a bounded number of frames, so
+ * latency can not pile up if the consumer falls behind. Instead, depending on
+ * the queue's policy, the oldest queued frame or the new frame is dropped, or
+ * the producer blocks until there is space. Each queue counts pushed and
+ * dropped frames and tracks its depth, and the time frames spend waiting in
+ * the queue is added to a latency histogram, so that the stage that can not
+ * keep up can be identified.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame-queue.h"
+#include "stats.h"
+
+struct frame_queue_entry {
+	void *frame;
+	gint64 time;
+};
+
+struct frame_queue {
+	char *name;
+	enum frame_queue_policy policy;
+	GMutex lock;
+	GCond cond;
+	bool closed;
+	/* frame taken by the consumer, until it is done */
+	void *current;
+	unsigned int head;
+	unsigned int depth;
+	unsigned int capacity;
+	unsigned int max_depth;
+	uint64_t pushed;
+	uint64_t dropped;
+	struct histogram *wait;
+	struct frame_queue_entry entries[];
+};
+
+static const char *frame_queue_policy_names[] = {
+	[FRAME_QUEUE_DROP_OLDEST] = "drop-oldest",
+	[FRAME_QUEUE_DROP_NEWEST] = "drop-newest",
+	[FRAME_QUEUE_BLOCK] = "block",
+};
+
+static enum frame_queue_policy frame_queue_default_policy;
+
+/* protects the registry, not the queue contents */
+static GMutex frame_queue_lock;
+static GList *frame_queues;
+
+/*
+ * Sets the policy used by all capture pipelines created afterwards.
+ */
+void frame_queue_set_default_policy(enum frame_queue_policy policy)
+{
+	frame_queue_default_policy = CLAMP(policy, FRAME_QUEUE_DROP_OLDEST,
+					   FRAME_QUEUE_BLOCK);
+}
+
+enum frame_queue_policy frame_queue_get_default_policy(void)
+{
+	return frame_queue_default_policy;
+}
+
+/*
+ * Returns the policy with the given name, or -EINVAL.
+ */
+int frame_queue_parse_policy(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(frame_queue_policy_names); i++) {
+		if (strcmp(name, frame_queue_policy_names[i]) == 0)
+			return i;
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Creates a new, registered queue holding up to capacity frames.
+ *
+ * Returns the queue, or NULL on failure.
+ */
+struct frame_queue *frame_queue_new(const char *name, unsigned int capacity,
+				    enum frame_queue_policy policy)
+{
+	struct frame_queue *q;
+	char *wait_name;
+
+	if (!capacity)
+		return NULL;
+
+	q = calloc(1, sizeof(*q) + capacity * sizeof(q->entries[0]));
+	if (!q)
+		return NULL;
+
+	q->name = strdup(name);
+	q->policy = policy;
+	q->capacity = capacity;
+	g_mutex_init(&q->lock);
+	g_cond_init(&q->cond);
+	wait_name = g_strdup_printf("%s queue", name);
+	q->wait = histogram_new(wait_name);
+	g_free(wait_name);
+
+	g_mutex_lock(&frame_queue_lock);
+	frame_queues = g_list_append(frame_queues, q);
+	g_mutex_unlock(&frame_queue_lock);
+
+	return q;
+}
+
+/*
+ * Unregisters and frees a queue. Neither producer nor consumer may use it
+ * anymore.
+ */
+void frame_queue_free(struct frame_queue *q)
+{
+	if (!q)
+		return;
+
+	g_mutex_lock(&frame_queue_lock);
+	frame_queues = g_list_remove(frame_queues, q);
+	g_mutex_unlock(&frame_queue_lock);
+
+	histogram_free(q->wait);
+	g_cond_clear(&q->cond);
+	g_mutex_clear(&q->lock);
+	free(q->name);
+	free(q);
+}
+
+/*
+ * Pushes a frame into the queue. If the queue is full, the frame to drop is
+ * chosen according to the queue's policy, or the producer waits until the
+ * consumer takes a frame. Frames pushed into a closed queue are dropped.
+ *
+ * Returns the dropped frame, which the producer may reuse immediately, or
+ * NULL if no frame was dropped.
+ */
+void *frame_queue_push(struct frame_queue *q, void *frame)
+{
+	struct frame_queue_entry *entry;
+	void *dropped = NULL;
+
+	g_mutex_lock(&q->lock);
+	if (q->policy == FRAME_QUEUE_BLOCK) {
+		while (q->depth == q->capacity && !q->closed)
+			g_cond_wait(&q->cond, &q->lock);
+	}
+	if (q->closed) {
+		g_mutex_unlock(&q->lock);
+		return frame;
+	}
+
+	q->pushed++;
+	if (q->depth == q->capacity) {
+		q->dropped++;
+		if (q->policy == FRAME_QUEUE_DROP_NEWEST) {
+			g_mutex_unlock(&q->lock);
+			return frame;
+		}
+		dropped = q->entries[q->head].frame;
+		q->head = (q->head + 1) % q->capacity;
+		q->depth--;
+	}
+
+	entry = &q->entries[(q->head + q->depth) % q->capacity];
+	entry->frame = frame;
+	entry->time = g_get_monotonic_time();
+	q->depth++;
+	if (q->depth > q->max_depth)
+		q->max_depth = q->depth;
+	g_cond_broadcast(&q->cond);
+	g_mutex_unlock(&q->lock);
+
+	return dropped;
+}
+
+/*
+ * Waits for the oldest queued frame and takes it. The frame counts as
+ * contained in the queue until the consumer calls frame_queue_done, so that
+ * the producer does not overwrite it in the meantime.
+ *
+ * Returns the frame, or NULL if the queue was closed.
+ */
+void *frame_queue_pop(struct frame_queue *q)
+{
+	struct frame_queue_entry *entry;
+	gint64 time;
+
+	g_mutex_lock(&q->lock);
+	while (!q->depth && !q->closed)
+		g_cond_wait(&q->cond, &q->lock);
+	if (!q->depth) {
+		g_mutex_unlock(&q->lock);
+		return NULL;
+	}
+
+	entry = &q->entries[q->head];
+	q->current = entry->frame;
+	time = entry->time;
+	q->head = (q->head + 1) % q->capacity;
+	q->depth--;
+	g_cond_broadcast(&q->cond);
+	g_mutex_unlock(&q->lock);
+
+	histogram_add_us(q->wait, g_get_monotonic_time() - time);
+
+	return q->current;
+}
+
+/*
+ * Marks the frame last taken by the consumer as finished.
+ */
+void frame_queue_done(struct frame_queue *q)
+{
+	g_mutex_lock(&q->lock);
+	q->current = NULL;
+	g_mutex_unlock(&q->lock);
+}
+
+/*
+ * Returns true if the frame is queued or still being processed by the
+ * consumer.
+ */
+bool frame_queue_contains(struct frame_queue *q, const void *frame)
+{
+	bool found;
+	unsigned int i;
+
+	g_mutex_lock(&q->lock);
+	found = q->current == frame;
+	for (i = 0; i < q->depth && !found; i++)
+		found = q->entries[(q->head + i) % q->capacity].frame == frame;
+	g_mutex_unlock(&q->lock);
+
+	return found;
+}
+
+/*
+ * Wakes up the consumer and blocked producers. Queued frames are discarded,
+ * and frames pushed afterwards are dropped until the queue is reopened. A
+ * frame the consumer is still processing stays contained in the queue until
+ * the consumer calls frame_queue_done.
+ */
+void frame_queue_close(struct frame_queue *q)
+{
+	g_mutex_lock(&q->lock);
+	q->closed = true;
+	q->depth = 0;
+	g_cond_broadcast(&q->cond);
+	g_mutex_unlock(&q->lock);
+}
+
+/*
+ * Lets a closed queue accept frames again.
+ */
+void frame_queue_reopen(struct frame_queue *q)
+{
+	g_mutex_lock(&q->lock);
+	q->closed = false;
+	g_mutex_unlock(&q->lock);
+}
+
+/*
+ * Calls func with a snapshot of each registered queue.
+ */
+void frame_queue_foreach(frame_queue_func func, void *data)
+{
+	struct frame_queue_stats stats;
+	struct frame_queue *q;
+	GList *l;
+
+	g_mutex_lock(&frame_queue_lock);
+	for (l = frame_queues; l; l = l->next) {
+		q = l->data;
+		g_mutex_lock(&q->lock);
+		stats.name = q->name;
+		stats.policy = frame_queue_policy_names[q->policy];
+		stats.capacity = q->capacity;
+		stats.depth = q->depth;
+		stats.max_depth = q->max_depth;
+		stats.pushed = q->pushed;
+		stats.dropped = q->dropped;
+		g_mutex_unlock(&q->lock);
+		func(&stats, data);
+	}
+	g_mutex_unlock(&frame_queue_lock);
+}
+
+static void frame_queue_print(const struct frame_queue_stats *stats,
+			      G_GNUC_UNUSED void *data)
+{
+	g_print("%s: %s, depth %u/%u, max %u, %" G_GUINT64_FORMAT
+		" frames, %" G_GUINT64_FORMAT " dropped\n", stats->name,
+		stats->policy, stats->depth, stats->capacity, stats->max_depth,
+		stats->pushed, stats->dropped);
+}
+
+/*
+ * Prints the counters of all registered queues.
+ */
+void frame_queue_dump(void)
+{
+	frame_queue_foreach(frame_queue_print, NULL);
+}
@@ -0,0 +1,54 @@
+/*
+ * Bounded frame queues between pipeline stages
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __FRAME_QUEUE_H__
+#define __FRAME_QUEUE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* what to do with a frame pushed into a full queue */
+enum frame_queue_policy {
+	FRAME_QUEUE_DROP_OLDEST,
+	FRAME_QUEUE_DROP_NEWEST,
+	FRAME_QUEUE_BLOCK,
+};
+
+struct frame_queue;
+
+/*
+ * Snapshot of a queue, passed to frame_queue_foreach callbacks.
+ */
+struct frame_queue_stats {
+	const char *name;
+	const char *policy;
+	unsigned int capacity;
+	unsigned int depth;
+	unsigned int max_depth;
+	uint64_t pushed;
+	uint64_t dropped;
+};
+
+typedef void (*frame_queue_func)(const struct frame_queue_stats *stats,
+				 void *data);
+
+void frame_queue_set_default_policy(enum frame_queue_policy policy);
+enum frame_queue_policy frame_queue_get_default_policy(void);
+int frame_queue_parse_policy(const char *name);
+
+struct frame_queue *frame_queue_new(const char *name, unsigned int capacity,
+				    enum frame_queue_policy policy);
+void frame_queue_free(struct frame_queue *q);
+void *frame_queue_push(struct frame_queue *q, void *frame);
+void *frame_queue_pop(struct frame_queue *q);
+void frame_queue_done(struct frame_queue *q);
+bool frame_queue_contains(struct frame_queue *q, const void *frame);
+void frame_queue_close(struct frame_queue *q);
+void frame_queue_reopen(struct frame_queue *q);
+
+void frame_queue_foreach(frame_queue_func func, void *data);
+void frame_queue_dump(void);
+
+#endif /* __FRAME_QUEUE_H__ */
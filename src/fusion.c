@@ -0,0 +1,644 @@
+/*
+ * IMU and optical pose sensor fusion
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Error-state Kalman filter that propagates position, velocity, orientation,
+ * and gyroscope and accelerometer biases with every IMU sample. Optical pose
+ * measurements arrive with a delay of a few frames. They are applied to the
+ * filter state at the time of exposure, and the IMU samples received since
+ * then are replayed on top of the corrected state.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fusion.h"
+#include "imu.h"
+#include "maths.h"
+
+/* enough for 128 ms of IMU samples at 1 kHz */
+#define FUSION_HISTORY			128
+
+#define FUSION_GRAVITY			9.80665
+
+/* noise densities of the IMU measurements and bias random walks */
+#define FUSION_GYRO_NOISE		1e-2	/* rad/s/√Hz */
+#define FUSION_ACCEL_NOISE		1e-1	/* m/s²/√Hz */
+#define FUSION_GYRO_BIAS_NOISE		1e-4	/* rad/s²/√Hz */
+#define FUSION_ACCEL_BIAS_NOISE		1e-3	/* m/s³/√Hz */
+
+/* standard deviations of the optical pose measurements */
+#define FUSION_POSITION_NOISE		5e-3	/* m */
+#define FUSION_ORIENTATION_NOISE	1e-2	/* rad */
+
+/* stop integrating position without optical corrections after this */
+#define FUSION_POSITION_TIMEOUT		0.5	/* s */
+
+/* restored orientations must agree with gravity within this angle */
+#define FUSION_RESTORE_MAX_TILT		0.1	/* rad */
+
+/* error state vector layout */
+enum {
+	ERR_P = 0,
+	ERR_V = 3,
+	ERR_TH = 6,
+	ERR_BG = 9,
+	ERR_BA = 12,
+	ERR_N = 15,
+};
+
+struct fusion_state {
+	double time;
+	struct imu_sample sample;
+	dvec3 position;
+	dvec3 velocity;
+	dquat orientation;
+	dvec3 gyro_bias;
+	dvec3 accel_bias;
+	double cov[ERR_N][ERR_N];
+};
+
+struct fusion {
+	/* ring buffer of filter states after each IMU sample */
+	struct fusion_state history[FUSION_HISTORY];
+	int head;
+	int count;
+	/* time of the last optical correction, or negative if none */
+	double position_time;
+	/* applied to the initial state with the first IMU sample */
+	bool restore;
+	struct fusion_snapshot snapshot;
+};
+
+struct fusion *fusion_new(void)
+{
+	struct fusion *f;
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+
+	f->position_time = -1.0;
+
+	return f;
+}
+
+void fusion_free(struct fusion *f)
+{
+	free(f);
+}
+
+static inline struct fusion_state *fusion_state(struct fusion *f, int i)
+{
+	return &f->history[(f->head + FUSION_HISTORY - i) % FUSION_HISTORY];
+}
+
+/*
+ * Initializes the orientation from the direction of gravity, with unknown
+ * yaw, zero velocity and biases.
+ */
+static void fusion_state_init(struct fusion_state *s, double time,
+			      const struct imu_sample *sample)
+{
+	vec3 accel = sample->acceleration;
+	const vec3 up = { 0.0, 1.0, 0.0 };
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->time = time;
+	s->sample = *sample;
+	vec3_normalize(&accel);
+	dquat_from_axes(&s->orientation, &accel, &up);
+
+	for (i = 0; i < 3; i++) {
+		s->cov[ERR_P + i][ERR_P + i] = 1.0;
+		s->cov[ERR_V + i][ERR_V + i] = 1.0;
+		s->cov[ERR_TH + i][ERR_TH + i] = 1e-2;
+		s->cov[ERR_BG + i][ERR_BG + i] = 1e-4;
+		s->cov[ERR_BA + i][ERR_BA + i] = 1e-2;
+	}
+	/* yaw is unknown */
+	s->cov[ERR_TH + 1][ERR_TH + 1] = 10.0;
+}
+
+/*
+ * Moves the initial state to the biases and, if it agrees with the measured
+ * gravity, to the pose of a snapshot, with reduced uncertainty. The device
+ * might have been moved while it was not tracked, so the pose uncertainty
+ * stays large enough for the first optical corrections to take over.
+ */
+static void fusion_state_restore(struct fusion_state *s,
+				 const struct fusion_snapshot *snapshot)
+{
+	const dvec3 up = { 0.0, 1.0, 0.0 };
+	dvec3 accel = {
+		s->sample.acceleration.x, s->sample.acceleration.y,
+		s->sample.acceleration.z,
+	};
+	dvec3 a;
+	int i;
+
+	s->gyro_bias = snapshot->gyro_bias;
+	s->accel_bias = snapshot->accel_bias;
+	for (i = 0; i < 3; i++) {
+		s->cov[ERR_BG + i][ERR_BG + i] = 1e-6;
+		s->cov[ERR_BA + i][ERR_BA + i] = 1e-4;
+	}
+
+	if (!snapshot->pose_valid)
+		return;
+
+	dvec3_normalize(&accel);
+	dquat_rotate(&a, &snapshot->pose.rotation, &accel);
+	if (dvec3_dot(&a, &up) < cos(FUSION_RESTORE_MAX_TILT))
+		return;
+
+	s->orientation = snapshot->pose.rotation;
+	s->position = snapshot->pose.translation;
+	for (i = 0; i < 3; i++) {
+		s->cov[ERR_P + i][ERR_P + i] = 1e-2;
+		s->cov[ERR_TH + i][ERR_TH + i] = 1e-2;
+	}
+	s->cov[ERR_TH + 1][ERR_TH + 1] = 1e-1;
+}
+
+/* Stores the skew-symmetric cross product matrix of v, scaled by s. */
+static void skew(double m[3][3], const dvec3 *v, double s)
+{
+	m[0][0] = 0.0;       m[0][1] = -v->z * s; m[0][2] = v->y * s;
+	m[1][0] = v->z * s;  m[1][1] = 0.0;       m[1][2] = -v->x * s;
+	m[2][0] = -v->y * s; m[2][1] = v->x * s;  m[2][2] = 0.0;
+}
+
+/*
+ * Propagates the filter state from prev by the IMU sample taken at time
+ * and stores the result in s.
+ */
+static void fusion_predict(struct fusion_state *s,
+			   const struct fusion_state *prev, double time,
+			   const struct imu_sample *sample, bool position)
+{
+	const double dt = time - prev->time;
+	const dvec3 omega = {
+		sample->angular_velocity.x - prev->gyro_bias.x,
+		sample->angular_velocity.y - prev->gyro_bias.y,
+		sample->angular_velocity.z - prev->gyro_bias.z,
+	};
+	const dvec3 accel = {
+		sample->acceleration.x - prev->accel_bias.x,
+		sample->acceleration.y - prev->accel_bias.y,
+		sample->acceleration.z - prev->accel_bias.z,
+	};
+	dquat orientation = prev->orientation;
+	double f[ERR_N][ERR_N], fp[ERR_N][ERR_N];
+	double r[3][3], ra[3][3];
+	double angle;
+	dmat3 rot;
+	dvec3 a;
+	dquat dq;
+	int i, j, k;
+
+	s->time = time;
+	s->sample = *sample;
+	s->gyro_bias = prev->gyro_bias;
+	s->accel_bias = prev->accel_bias;
+
+	/* Nominal state */
+	dquat_rotate(&a, &prev->orientation, &accel);
+	a.y -= FUSION_GRAVITY;
+
+	if (position) {
+		s->position.x = prev->position.x + (prev->velocity.x +
+				0.5 * a.x * dt) * dt;
+		s->position.y = prev->position.y + (prev->velocity.y +
+				0.5 * a.y * dt) * dt;
+		s->position.z = prev->position.z + (prev->velocity.z +
+				0.5 * a.z * dt) * dt;
+		s->velocity.x = prev->velocity.x + a.x * dt;
+		s->velocity.y = prev->velocity.y + a.y * dt;
+		s->velocity.z = prev->velocity.z + a.z * dt;
+	} else {
+		s->position = prev->position;
+		s->velocity = (dvec3){ 0.0, 0.0, 0.0 };
+	}
+
+	angle = sqrt(dvec3_dot(&omega, &omega)) * dt;
+	if (angle > 1e-12) {
+		dvec3 axis = omega;
+
+		dvec3_normalize(&axis);
+		dquat_from_axis_angle(&dq, &axis, angle);
+		dquat_mult(&s->orientation, &orientation, &dq);
+		dquat_normalize(&s->orientation);
+	} else {
+		s->orientation = prev->orientation;
+	}
+
+	/* Error state transition */
+	dmat3_from_dquat(&rot, &prev->orientation);
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 3; j++)
+			r[i][j] = rot.m[3 * i + j];
+	skew(ra, &accel, 1.0);
+
+	memset(f, 0, sizeof(f));
+	for (i = 0; i < ERR_N; i++)
+		f[i][i] = 1.0;
+	for (i = 0; i < 3; i++) {
+		f[ERR_P + i][ERR_V + i] = dt;
+		f[ERR_TH + i][ERR_BG + i] = -dt;
+		for (j = 0; j < 3; j++) {
+			double rax = 0.0;
+
+			for (k = 0; k < 3; k++)
+				rax += r[i][k] * ra[k][j];
+			f[ERR_V + i][ERR_TH + j] = -rax * dt;
+			f[ERR_V + i][ERR_BA + j] = -r[i][j] * dt;
+		}
+	}
+	skew(ra, &omega, -dt);
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 3; j++)
+			f[ERR_TH + i][ERR_TH + j] += ra[i][j];
+
+	/* cov = F * cov * F^T + Q */
+	for (i = 0; i < ERR_N; i++) {
+		for (j = 0; j < ERR_N; j++) {
+			double sum = 0.0;
+
+			for (k = 0; k < ERR_N; k++)
+				sum += f[i][k] * prev->cov[k][j];
+			fp[i][j] = sum;
+		}
+	}
+	for (i = 0; i < ERR_N; i++) {
+		for (j = 0; j <= i; j++) {
+			double sum = 0.0;
+
+			for (k = 0; k < ERR_N; k++)
+				sum += fp[i][k] * f[j][k];
+			s->cov[i][j] = sum;
+			s->cov[j][i] = sum;
+		}
+	}
+	for (i = 0; i < 3; i++) {
+		s->cov[ERR_V + i][ERR_V + i] += FUSION_ACCEL_NOISE *
+					FUSION_ACCEL_NOISE * dt;
+		s->cov[ERR_TH + i][ERR_TH + i] += FUSION_GYRO_NOISE *
+					  FUSION_GYRO_NOISE * dt;
+		s->cov[ERR_BG + i][ERR_BG + i] += FUSION_GYRO_BIAS_NOISE *
+					  FUSION_GYRO_BIAS_NOISE * dt;
+		s->cov[ERR_BA + i][ERR_BA + i] += FUSION_ACCEL_BIAS_NOISE *
+					  FUSION_ACCEL_BIAS_NOISE * dt;
+	}
+}
+
+/*
+ * Propagates the filter with an IMU sample taken at the given device time,
+ * in seconds.
+ */
+void fusion_add_imu_sample(struct fusion *f, double time,
+			   const struct imu_sample *sample)
+{
+	struct fusion_state *prev = fusion_state(f, 0);
+	struct fusion_state *s;
+	bool position;
+
+	if (f->count == 0) {
+		fusion_state_init(prev, time, sample);
+		if (f->restore)
+			fusion_state_restore(prev, &f->snapshot);
+		f->restore = false;
+		f->count = 1;
+		return;
+	}
+
+	if (time <= prev->time)
+		return;
+
+	position = f->position_time >= 0.0 &&
+		   time - f->position_time < FUSION_POSITION_TIMEOUT;
+
+	f->head = (f->head + 1) % FUSION_HISTORY;
+	s = fusion_state(f, 0);
+	fusion_predict(s, prev, time, sample, position);
+	if (f->count < FUSION_HISTORY)
+		f->count++;
+}
+
+/*
+ * Decomposes the symmetric positive definite 6x6 matrix a into its lower
+ * triangular Cholesky factor, in place.
+ */
+static bool cholesky6(double a[6][6])
+{
+	int i, j, k;
+
+	for (j = 0; j < 6; j++) {
+		double d = a[j][j];
+
+		for (k = 0; k < j; k++)
+			d -= a[j][k] * a[j][k];
+		if (d <= 0.0)
+			return false;
+		a[j][j] = sqrt(d);
+
+		for (i = j + 1; i < 6; i++) {
+			double s = a[i][j];
+
+			for (k = 0; k < j; k++)
+				s -= a[i][k] * a[j][k];
+			a[i][j] = s / a[j][j];
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Solves l l^T x = b in place, given the Cholesky factor l.
+ */
+static void cholesky6_solve(double l[6][6], double b[6])
+{
+	int i, k;
+
+	for (i = 0; i < 6; i++) {
+		for (k = 0; k < i; k++)
+			b[i] -= l[i][k] * b[k];
+		b[i] /= l[i][i];
+	}
+	for (i = 5; i >= 0; i--) {
+		for (k = i + 1; k < 6; k++)
+			b[i] -= l[k][i] * b[k];
+		b[i] /= l[i][i];
+	}
+}
+
+/*
+ * Corrects the filter state with a measurement of position and orientation.
+ */
+static int fusion_correct(struct fusion_state *s, const struct dpose *pose)
+{
+	const int sel[6] = {
+		ERR_P, ERR_P + 1, ERR_P + 2, ERR_TH, ERR_TH + 1, ERR_TH + 2
+	};
+	double y[6], sm[6][6], k[ERR_N][6], hp[6][ERR_N];
+	double dx[ERR_N];
+	dquat q_inv, dq;
+	int i, j, m;
+
+	y[0] = pose->translation.x - s->position.x;
+	y[1] = pose->translation.y - s->position.y;
+	y[2] = pose->translation.z - s->position.z;
+
+	/* local orientation error, q_meas = q * exp(dtheta) */
+	q_inv = (dquat){ -s->orientation.x, -s->orientation.y,
+			 -s->orientation.z, s->orientation.w };
+	dquat_mult(&dq, &q_inv, &pose->rotation);
+	if (dq.w < 0)
+		dq = (dquat){ -dq.x, -dq.y, -dq.z, -dq.w };
+	y[3] = 2.0 * dq.x;
+	y[4] = 2.0 * dq.y;
+	y[5] = 2.0 * dq.z;
+
+	/* S = H * cov * H^T + R */
+	for (i = 0; i < 6; i++)
+		for (j = 0; j < 6; j++)
+			sm[i][j] = s->cov[sel[i]][sel[j]];
+	for (i = 0; i < 3; i++) {
+		sm[i][i] += FUSION_POSITION_NOISE * FUSION_POSITION_NOISE;
+		sm[3 + i][3 + i] += FUSION_ORIENTATION_NOISE *
+				    FUSION_ORIENTATION_NOISE;
+	}
+	if (!cholesky6(sm))
+		return -EINVAL;
+
+	/* K = cov * H^T * S^-1, computed row by row since S is symmetric */
+	for (i = 0; i < ERR_N; i++) {
+		for (j = 0; j < 6; j++)
+			k[i][j] = s->cov[i][sel[j]];
+		cholesky6_solve(sm, k[i]);
+	}
+
+	/* dx = K * y */
+	for (i = 0; i < ERR_N; i++) {
+		dx[i] = 0.0;
+		for (j = 0; j < 6; j++)
+			dx[i] += k[i][j] * y[j];
+	}
+
+	/* cov = cov - K * H * cov */
+	for (i = 0; i < 6; i++)
+		for (j = 0; j < ERR_N; j++)
+			hp[i][j] = s->cov[sel[i]][j];
+	for (i = 0; i < ERR_N; i++) {
+		for (j = 0; j <= i; j++) {
+			double sum = 0.0;
+
+			for (m = 0; m < 6; m++)
+				sum += k[i][m] * hp[m][j];
+			s->cov[i][j] -= sum;
+			if (j < i)
+				s->cov[j][i] = s->cov[i][j];
+		}
+	}
+
+	/* Inject the error state into the nominal state */
+	s->position.x += dx[ERR_P];
+	s->position.y += dx[ERR_P + 1];
+	s->position.z += dx[ERR_P + 2];
+	s->velocity.x += dx[ERR_V];
+	s->velocity.y += dx[ERR_V + 1];
+	s->velocity.z += dx[ERR_V + 2];
+	s->gyro_bias.x += dx[ERR_BG];
+	s->gyro_bias.y += dx[ERR_BG + 1];
+	s->gyro_bias.z += dx[ERR_BG + 2];
+	s->accel_bias.x += dx[ERR_BA];
+	s->accel_bias.y += dx[ERR_BA + 1];
+	s->accel_bias.z += dx[ERR_BA + 2];
+
+	dq = (dquat){ 0.5 * dx[ERR_TH], 0.5 * dx[ERR_TH + 1],
+		      0.5 * dx[ERR_TH + 2], 1.0 };
+	dquat_normalize(&dq);
+	dquat_mult(&q_inv, &s->orientation, &dq);
+	s->orientation = q_inv;
+	dquat_normalize(&s->orientation);
+
+	return 0;
+}
+
+/*
+ * Applies an optical pose measurement of the exposure at the given device
+ * time, in seconds, and replays all IMU samples received after it.
+ *
+ * Returns 0 on success, or a negative error code if the measurement is
+ * older than the IMU sample history or could not be applied.
+ */
+int fusion_add_pose(struct fusion *f, double time, const struct dpose *pose)
+{
+	struct fusion_state *s;
+	bool position;
+	int i, ret;
+
+	if (f->count == 0)
+		return -EAGAIN;
+
+	/* Find the last state before the exposure */
+	for (i = 0; i < f->count; i++) {
+		if (fusion_state(f, i)->time <= time)
+			break;
+	}
+	if (i == f->count)
+		return -ERANGE;
+
+	s = fusion_state(f, i);
+	if (f->position_time < 0.0 ||
+	    s->time - f->position_time >= FUSION_POSITION_TIMEOUT) {
+		/* (Re)start position tracking from the measurement */
+		int j, k;
+
+		s->position = pose->translation;
+		s->velocity = (dvec3){ 0.0, 0.0, 0.0 };
+		for (j = 0; j < 6; j++) {
+			for (k = 0; k < ERR_N; k++) {
+				s->cov[ERR_P + j][k] = 0.0;
+				s->cov[k][ERR_P + j] = 0.0;
+			}
+		}
+		for (j = 0; j < 3; j++) {
+			s->cov[ERR_P + j][ERR_P + j] = FUSION_POSITION_NOISE *
+						       FUSION_POSITION_NOISE;
+			s->cov[ERR_V + j][ERR_V + j] = 1.0;
+		}
+	}
+
+	ret = fusion_correct(s, pose);
+	if (ret < 0)
+		return ret;
+
+	if (time > f->position_time)
+		f->position_time = time;
+
+	for (i--; i >= 0; i--) {
+		struct fusion_state *next = fusion_state(f, i);
+
+		position = next->time - f->position_time <
+			   FUSION_POSITION_TIMEOUT;
+		fusion_predict(next, s, next->time, &next->sample, position);
+		s = next;
+	}
+
+	return 0;
+}
+
+/*
+ * Stores the fused pose at the last IMU sample taken before or at the given
+ * device time in pose. A negative time returns the most recent pose.
+ *
+ * Returns false if there is no pose for the given time.
+ */
+bool fusion_get_pose(struct fusion *f, double time, struct dpose *pose)
+{
+	struct fusion_state *s = NULL;
+	int i;
+
+	for (i = 0; i < f->count; i++) {
+		s = fusion_state(f, i);
+		if (time < 0.0 || s->time <= time)
+			break;
+	}
+	if (i == f->count)
+		return false;
+
+	pose->rotation = s->orientation;
+	pose->translation = s->position;
+
+	return true;
+}
+
+/*
+ * Stores the most recent fused pose, the linear velocity and acceleration,
+ * and the bias corrected angular velocity in state.
+ *
+ * Returns false if no IMU sample was received yet.
+ */
+bool fusion_get_state(struct fusion *f, struct imu_state *state)
+{
+	struct fusion_state *s;
+
+	if (f->count == 0)
+		return false;
+
+	s = fusion_state(f, 0);
+	memset(state, 0, sizeof(*state));
+	state->sample = s->sample;
+	state->sample.time = s->time;
+	state->pose.rotation = s->orientation;
+	state->pose.translation = s->position;
+	state->angular_velocity.x = s->sample.angular_velocity.x -
+				    s->gyro_bias.x;
+	state->angular_velocity.y = s->sample.angular_velocity.y -
+				    s->gyro_bias.y;
+	state->angular_velocity.z = s->sample.angular_velocity.z -
+				    s->gyro_bias.z;
+	state->linear_velocity.x = s->velocity.x;
+	state->linear_velocity.y = s->velocity.y;
+	state->linear_velocity.z = s->velocity.z;
+
+	if (f->position_time >= 0.0 &&
+	    s->time - f->position_time < FUSION_POSITION_TIMEOUT) {
+		const dvec3 accel = {
+			s->sample.acceleration.x - s->accel_bias.x,
+			s->sample.acceleration.y - s->accel_bias.y,
+			s->sample.acceleration.z - s->accel_bias.z,
+		};
+		dvec3 a;
+
+		dquat_rotate(&a, &s->orientation, &accel);
+		state->linear_acceleration.x = a.x;
+		state->linear_acceleration.y = a.y - FUSION_GRAVITY;
+		state->linear_acceleration.z = a.z;
+	}
+
+	return true;
+}
+
+/*
+ * Stores the IMU biases and the last optically corrected pose in snapshot.
+ *
+ * Returns false if there is no filter state yet.
+ */
+bool fusion_get_snapshot(struct fusion *f, struct fusion_snapshot *snapshot)
+{
+	struct fusion_state *s;
+
+	if (f->count == 0)
+		return false;
+
+	s = fusion_state(f, 0);
+	snapshot->pose_valid = f->position_time >= 0.0 &&
+			       s->time - f->position_time <
+			       FUSION_POSITION_TIMEOUT;
+	snapshot->pose.rotation = s->orientation;
+	snapshot->pose.translation = s->position;
+	snapshot->gyro_bias = s->gyro_bias;
+	snapshot->accel_bias = s->accel_bias;
+
+	return true;
+}
+
+/*
+ * Starts the filter from a snapshot taken before a restart instead of from
+ * scratch. Must be called before the first IMU sample is added.
+ */
+void fusion_restore_snapshot(struct fusion *f,
+			     const struct fusion_snapshot *snapshot)
+{
+	if (f->count)
+		return;
+
+	f->snapshot = *snapshot;
+	f->restore = true;
+}
@@ -0,0 +1,40 @@
+/*
+ * IMU and optical pose sensor fusion
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __FUSION_H__
+#define __FUSION_H__
+
+#include <stdbool.h>
+
+#include "imu.h"
+#include "maths.h"
+
+struct fusion;
+
+/*
+ * Filter state worth keeping across restarts: the IMU biases, and the last
+ * pose, if it was corrected by optical tracking.
+ */
+struct fusion_snapshot {
+	bool pose_valid;
+	struct dpose pose;
+	dvec3 gyro_bias;
+	dvec3 accel_bias;
+};
+
+struct fusion *fusion_new(void);
+void fusion_free(struct fusion *f);
+
+void fusion_add_imu_sample(struct fusion *f, double time,
+			   const struct imu_sample *sample);
+int fusion_add_pose(struct fusion *f, double time, const struct dpose *pose);
+
+bool fusion_get_pose(struct fusion *f, double time, struct dpose *pose);
+bool fusion_get_state(struct fusion *f, struct imu_state *state);
+bool fusion_get_snapshot(struct fusion *f, struct fusion_snapshot *snapshot);
+void fusion_restore_snapshot(struct fusion *f,
+			     const struct fusion_snapshot *snapshot);
+
+#endif /* __FUSION_H__ */
@@ -3,23 +3,54 @@
 
 #include <errno.h>
 #include <linux/hidraw.h>
+#include <stdint.h>
 #include <sys/ioctl.h>
 #include <time.h>
+#include <unistd.h>
+
+#include "recording.h"
+#include "replay.h"
+
+#define HID_MAX_BATCH	16
+
+/*
+ * Input reports read from a non-blocking HID device in a single wakeup.
+ */
+struct hid_report_batch {
+	int num;
+	int len[HID_MAX_BATCH];
+	unsigned char buf[HID_MAX_BATCH][64];
+};
 
 /*
- * Receives a feature report from the HID device.
+ * Receives a feature report from the HID device. Replayed devices get the
+ * recorded feature report instead.
  */
 static inline int hid_get_feature_report(int fd, void *data, size_t length)
 {
-	return ioctl(fd, HIDIOCGFEATURE(length), data);
+	int flags = recording_fd_flags(fd);
+	int ret;
+
+	if (flags & RECORDING_FD_REPLAY)
+		return replay_get_feature_report(fd, data, length);
+
+	ret = ioctl(fd, HIDIOCGFEATURE(length), data);
+	if (ret > 0 && (flags & RECORDING_FD_RECORD))
+		recording_write_fd(RECORDING_CHUNK_HID_FEATURE, fd, 0, data,
+				   ret);
+
+	return ret;
 }
 
 /*
- * Sends a feature report to the HID device.
+ * Sends a feature report to the HID device. Replayed devices ignore it.
  */
 static inline int hid_send_feature_report(int fd, const void *data,
 					  size_t length)
 {
+	if (recording_fd_flags(fd) & RECORDING_FD_REPLAY)
+		return length;
+
 	return ioctl(fd, HIDIOCSFEATURE(length), data);
 }
 
@@ -47,4 +78,51 @@ static inline int hid_get_feature_report_timeout(int fd, void *buf, size_t len,
 	return ret;
 }
 
+/*
+ * Reads all pending input reports from the non-blocking HID device, until
+ * the read would block or the batch is full.
+ *
+ * Returns the number of reports read, or a negative error code if the first
+ * read fails.
+ */
+static inline int hid_read_batch(int fd, struct hid_report_batch *batch)
+{
+	int ret;
+
+	for (batch->num = 0; batch->num < HID_MAX_BATCH; batch->num++) {
+		ret = read(fd, batch->buf[batch->num], 64);
+		if (ret == -1) {
+			if (batch->num == 0 && errno != EAGAIN)
+				return -errno;
+			break;
+		}
+		batch->len[batch->num] = ret;
+	}
+
+	if (batch->num && (recording_fd_flags(fd) & RECORDING_FD_RECORD)) {
+		int i;
+
+		for (i = 0; i < batch->num; i++) {
+			recording_write_fd(RECORDING_CHUNK_HID_REPORT, fd, 0,
+					   batch->buf[i], batch->len[i]);
+		}
+	}
+
+	return batch->num;
+}
+
+/*
+ * Returns the host arrival time of report i in the batch in nanoseconds.
+ * Only the last report arrived at the wakeup time ts; reports queued before
+ * it are assumed to have arrived at the nominal report interval.
+ */
+static inline uint64_t hid_batch_report_time(const struct hid_report_batch *batch,
+					     int i, const struct timespec *ts,
+					     uint64_t interval_ns)
+{
+	uint64_t time = ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+
+	return time - (batch->num - 1 - i) * interval_ns;
+}
+
 #endif /* __HIDRAW_H__ */
@@ -15,24 +15,177 @@
 #include <glib-object.h>
 
 #include "hololens-camera.h"
+#include "blobwatch.h"
 #include "camera-v4l2.h"
+#include "corners.h"
 #include "device.h"
+#include "jobs.h"
+#include "opencl.h"
 
 #define HOLOLENS_CAMERA_WIDTH		1280
 #define HOLOLENS_CAMERA_HEIGHT		481
 #define HOLOLENS_CAMERA_FRAMERATE	90
 
+/* Two 640x480 cameras side by side, below a line of metadata */
+#define HOLOLENS_CAMERA_VIEW_WIDTH	640
+#define HOLOLENS_CAMERA_VIEW_HEIGHT	480
+
+/*
+ * Corner detection on a single view of a bright frame, run as a job on the
+ * shared worker threads.
+ */
+struct hololens_camera_job {
+	struct job job;
+	struct corner_detector *detector;
+	const uint8_t *view;
+	struct keypoint *keypoints;
+	int num_keypoints;
+};
+
 struct _OuvrtHoloLensCamera {
 	OuvrtCameraV4L2 v4l2;
+
+	struct corner_detector *detector[2];
+	struct blobwatch *bw;
+	/* optional GPU offload of the FAST segment test */
+	struct opencl_compute *cl;
+
+	GMutex lock;
+	struct keypoint keypoints[2][HOLOLENS_CAMERA_MAX_KEYPOINTS];
+	int num_keypoints[2];
+	struct blob blobs[2][HOLOLENS_CAMERA_MAX_BLOBS];
+	int num_blobs[2];
 };
 
 G_DEFINE_TYPE(OuvrtHoloLensCamera, ouvrt_hololens_camera, \
 	      OUVRT_TYPE_CAMERA_V4L2)
 
-static int hololens_camera_process_frame(G_GNUC_UNUSED OuvrtCamera *camera,
-					 void *frame)
+static void hololens_camera_job_func(void *data)
 {
+	struct hololens_camera_job *job = data;
+
+	job->num_keypoints = corner_detector_process(job->detector, job->view,
+						     HOLOLENS_CAMERA_WIDTH,
+						     job->keypoints);
+}
+
+/*
+ * Detects corners in both views of a bright frame, the right view as a job
+ * and the left view on the calling thread.
+ */
+static void hololens_camera_detect_corners(OuvrtHoloLensCamera *self,
+					   const uint8_t *image,
+					   struct keypoint keypoints[2][HOLOLENS_CAMERA_MAX_KEYPOINTS],
+					   int num_keypoints[2])
+{
+	struct hololens_camera_job jobs[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		jobs[i].detector = self->detector[i];
+		jobs[i].view = image + i * HOLOLENS_CAMERA_VIEW_WIDTH;
+		jobs[i].keypoints = keypoints[i];
+	}
+
+	job_init(&jobs[1].job, hololens_camera_job_func, &jobs[1]);
+	job_submit(&jobs[1].job);
+
+	hololens_camera_job_func(&jobs[0]);
+
+	job_wait(&jobs[1].job);
+
+	num_keypoints[0] = jobs[0].num_keypoints;
+	num_keypoints[1] = jobs[1].num_keypoints;
+}
+
+/*
+ * Detects corners in both views of a bright frame, running the segment test
+ * on the GPU.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+static int hololens_camera_detect_corners_gpu(OuvrtHoloLensCamera *self,
+					      const uint8_t *buf,
+					      struct keypoint keypoints[2][HOLOLENS_CAMERA_MAX_KEYPOINTS],
+					      int num_keypoints[2])
+{
+	uint32_t cells[(HOLOLENS_CAMERA_VIEW_WIDTH / CORNER_CELL_SIZE) *
+		       (HOLOLENS_CAMERA_VIEW_HEIGHT / CORNER_CELL_SIZE)];
+	int i, ret;
+
+	for (i = 0; i < 2; i++) {
+		int offset = HOLOLENS_CAMERA_WIDTH +
+			     i * HOLOLENS_CAMERA_VIEW_WIDTH;
+
+		ret = opencl_compute_find_corners(self->cl, buf,
+						  HOLOLENS_CAMERA_WIDTH *
+						  HOLOLENS_CAMERA_HEIGHT,
+						  offset,
+						  HOLOLENS_CAMERA_VIEW_WIDTH,
+						  HOLOLENS_CAMERA_VIEW_HEIGHT,
+						  HOLOLENS_CAMERA_WIDTH,
+						  corner_detector_get_threshold(self->detector[i]),
+						  cells);
+		if (ret < 0)
+			return ret;
+
+		num_keypoints[i] = corner_detector_process_cells(
+				self->detector[i], buf + offset,
+				HOLOLENS_CAMERA_WIDTH, cells, keypoints[i]);
+	}
+
+	return 0;
+}
+
+/*
+ * Detects LED blobs in a dark frame, over the full width of both views, and
+ * splits them by view.
+ */
+static void hololens_camera_detect_blobs(OuvrtHoloLensCamera *self,
+					 uint8_t *image,
+					 struct blob blobs[2][HOLOLENS_CAMERA_MAX_BLOBS],
+					 int num_blobs[2])
+{
+	struct blobservation *ob = NULL;
+	int i;
+
+	num_blobs[0] = 0;
+	num_blobs[1] = 0;
+
+	blobwatch_process(self->bw, image, HOLOLENS_CAMERA_WIDTH,
+			  HOLOLENS_CAMERA_VIEW_HEIGHT, 0, NULL, 0, &ob);
+	if (!ob)
+		return;
+
+	for (i = 0; i < ob->num_blobs; i++) {
+		struct blob *b = &ob->blobs[i];
+		int view = b->x >= HOLOLENS_CAMERA_VIEW_WIDTH;
+
+		if (num_blobs[view] == HOLOLENS_CAMERA_MAX_BLOBS)
+			continue;
+		blobs[view][num_blobs[view]] = *b;
+		if (view) {
+			blobs[view][num_blobs[view]].x -= HOLOLENS_CAMERA_VIEW_WIDTH;
+			blobs[view][num_blobs[view]].cx -= HOLOLENS_CAMERA_VIEW_WIDTH;
+		}
+		num_blobs[view]++;
+	}
+}
+
+/*
+ * Extracts corners from bright, headset tracking frames and LED blobs from
+ * dark, controller tracking frames.
+ */
+static int hololens_camera_process_frame(OuvrtCamera *camera, void *frame,
+					 G_GNUC_UNUSED struct blobservation *ob)
+{
+	OuvrtHoloLensCamera *self = OUVRT_HOLOLENS_CAMERA(camera);
+	struct keypoint keypoints[2][HOLOLENS_CAMERA_MAX_KEYPOINTS];
+	struct blob blobs[2][HOLOLENS_CAMERA_MAX_BLOBS];
+	int num_keypoints[2];
+	int num_blobs[2];
 	uint8_t *buf = frame;
+	uint8_t *image = buf + HOLOLENS_CAMERA_WIDTH;
 	uint16_t gain; /* or could be additional exposure time */
 
 	/* The first line contains metadata, possibly register values */
@@ -41,8 +194,27 @@ static int hololens_camera_process_frame(G_GNUC_UNUSED OuvrtCamera *camera,
 	if (gain == 155 || /* 30 fps */
 	    gain == 300) { /* 90 fps */
 		/* Bright frame, headset tracking */
+		if (!self->cl ||
+		    hololens_camera_detect_corners_gpu(self, buf, keypoints,
+						       num_keypoints) < 0) {
+			hololens_camera_detect_corners(self, image, keypoints,
+						       num_keypoints);
+		}
+
+		g_mutex_lock(&self->lock);
+		memcpy(self->keypoints, keypoints, sizeof(keypoints));
+		memcpy(self->num_keypoints, num_keypoints,
+		       sizeof(num_keypoints));
+		g_mutex_unlock(&self->lock);
 	} else if (gain == 0) {
 		/* Dark frame, controller tracking */
+		hololens_camera_detect_blobs(self, image, blobs, num_blobs);
+
+		g_mutex_lock(&self->lock);
+		memcpy(self->blobs, blobs, sizeof(blobs));
+		memcpy(self->num_blobs, num_blobs, sizeof(num_blobs));
+		g_mutex_unlock(&self->lock);
+
 		return 1; /* do not push into debug pipeline */
 	} else {
 		g_print("Unexpected gain: %u\n", gain);
@@ -51,8 +223,25 @@ static int hololens_camera_process_frame(G_GNUC_UNUSED OuvrtCamera *camera,
 	return 0;
 }
 
+/*
+ * Frees the feature detectors and the compute context.
+ */
+static void ouvrt_hololens_camera_finalize(GObject *object)
+{
+	OuvrtHoloLensCamera *self = OUVRT_HOLOLENS_CAMERA(object);
+
+	corner_detector_free(self->detector[0]);
+	corner_detector_free(self->detector[1]);
+	blobwatch_free(self->bw);
+	opencl_compute_free(self->cl);
+	g_mutex_clear(&self->lock);
+
+	G_OBJECT_CLASS(ouvrt_hololens_camera_parent_class)->finalize(object);
+}
+
 static void ouvrt_hololens_camera_class_init(OuvrtHoloLensCameraClass *klass)
 {
+	G_OBJECT_CLASS(klass)->finalize = ouvrt_hololens_camera_finalize;
 	OUVRT_CAMERA_CLASS(klass)->process_frame = hololens_camera_process_frame;
 }
 
@@ -67,6 +256,19 @@ static void ouvrt_hololens_camera_init(OuvrtHoloLensCamera *self)
 	camera->height = HOLOLENS_CAMERA_HEIGHT;
 	camera->framerate = HOLOLENS_CAMERA_FRAMERATE;
 	self->v4l2.pixelformat = V4L2_PIX_FMT_GREY;
+
+	self->detector[0] = corner_detector_new(HOLOLENS_CAMERA_VIEW_WIDTH,
+						HOLOLENS_CAMERA_VIEW_HEIGHT,
+						HOLOLENS_CAMERA_MAX_KEYPOINTS);
+	self->detector[1] = corner_detector_new(HOLOLENS_CAMERA_VIEW_WIDTH,
+						HOLOLENS_CAMERA_VIEW_HEIGHT,
+						HOLOLENS_CAMERA_MAX_KEYPOINTS);
+	self->bw = blobwatch_new(HOLOLENS_CAMERA_WIDTH,
+				 HOLOLENS_CAMERA_VIEW_HEIGHT);
+	if (opencl_compute_enabled())
+		self->cl = opencl_compute_new(HOLOLENS_CAMERA_WIDTH,
+					      HOLOLENS_CAMERA_HEIGHT);
+	g_mutex_init(&self->lock);
 }
 
 /*
@@ -96,3 +298,41 @@ OuvrtDevice *hololens_camera_new(const char *devnode)
 
 	return &camera->v4l2.camera.dev;
 }
+
+/*
+ * Copies the keypoints of the last bright frame seen by one of the two views
+ * into keypoints, which must have space for HOLOLENS_CAMERA_MAX_KEYPOINTS.
+ *
+ * Returns the number of keypoints.
+ */
+int ouvrt_hololens_camera_get_keypoints(OuvrtHoloLensCamera *self, int view,
+					struct keypoint *keypoints)
+{
+	int num;
+
+	g_mutex_lock(&self->lock);
+	num = self->num_keypoints[view];
+	memcpy(keypoints, self->keypoints[view], num * sizeof(*keypoints));
+	g_mutex_unlock(&self->lock);
+
+	return num;
+}
+
+/*
+ * Copies the LED blobs of the last dark frame seen by one of the two views
+ * into blobs, which must have space for HOLOLENS_CAMERA_MAX_BLOBS.
+ *
+ * Returns the number of blobs.
+ */
+int ouvrt_hololens_camera_get_blobs(OuvrtHoloLensCamera *self, int view,
+				    struct blob *blobs)
+{
+	int num;
+
+	g_mutex_lock(&self->lock);
+	num = self->num_blobs[view];
+	memcpy(blobs, self->blobs[view], num * sizeof(*blobs));
+	g_mutex_unlock(&self->lock);
+
+	return num;
+}
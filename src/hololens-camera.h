@@ -9,16 +9,25 @@
 #include <glib.h>
 #include <glib-object.h>
 
+#include "blobwatch.h"
 #include "camera-v4l2.h"
+#include "corners.h"
 #include "device.h"
 
 G_BEGIN_DECLS
 
+#define HOLOLENS_CAMERA_MAX_KEYPOINTS	256
+#define HOLOLENS_CAMERA_MAX_BLOBS	64
+
 #define OUVRT_TYPE_HOLOLENS_CAMERA (ouvrt_hololens_camera_get_type())
 G_DECLARE_FINAL_TYPE(OuvrtHoloLensCamera, ouvrt_hololens_camera, \
 		     OUVRT, HOLOLENS_CAMERA, OuvrtCameraV4L2)
 
 OuvrtDevice *hololens_camera_new(const char *devnode);
+int ouvrt_hololens_camera_get_keypoints(OuvrtHoloLensCamera *self, int view,
+					struct keypoint *keypoints);
+int ouvrt_hololens_camera_get_blobs(OuvrtHoloLensCamera *self, int view,
+				    struct blob *blobs);
 
 G_END_DECLS
 
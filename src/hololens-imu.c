@@ -6,12 +6,21 @@
 #include <asm/byteorder.h>
 #include <errno.h>
 #include <poll.h>
+#include <stddef.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "hololens-imu.h"
 #include "hololens-hid-reports.h"
 #include "device.h"
@@ -41,9 +50,90 @@ static int hololens_imu_send_command(OuvrtDevice *dev, uint8_t command)
 	return ret < 0 ? ret : 0;
 }
 
+#define HOLOLENS_GYRO_SUBSAMPLES	8
+
+/*
+ * Converts the 8 kHz little-endian gyro samples of an IMU report into float,
+ * still in units of 10⁻³ rad/s, eight samples at a time.
+ */
+static void hololens_imu_decode_gyro(const struct hololens_imu_report *report,
+				     float out[3][32])
+{
+	/* The gyro samples are unaligned, at offset 41 in the packed report */
+	const uint8_t *gyro = (const uint8_t *)report +
+			      offsetof(struct hololens_imu_report, gyro);
+	int i, j;
+
+#if defined(__SSE2__)
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 32; j += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i *)
+						    (gyro + 2 * (32 * i + j)));
+			/* Sign extend by shifting into the upper half */
+			__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+			__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+			_mm_storeu_ps(&out[i][j], _mm_cvtepi32_ps(lo));
+			_mm_storeu_ps(&out[i][j + 4], _mm_cvtepi32_ps(hi));
+		}
+	}
+#elif defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 32; j += 8) {
+			int16x8_t v = vreinterpretq_s16_u8(
+					vld1q_u8(gyro + 2 * (32 * i + j)));
+
+			vst1q_f32(&out[i][j],
+				  vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))));
+			vst1q_f32(&out[i][j + 4],
+				  vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))));
+		}
+	}
+#else
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 32; j++) {
+			const uint8_t *p = gyro + 2 * (32 * i + j);
+
+			out[i][j] = (int16_t)(p[0] | p[1] << 8);
+		}
+	}
+#endif
+}
+
+/*
+ * Transform from IMU coordinate system into common coordinate system:
+ *
+ *   -y                                y
+ *    |          ⎡ 0 -1  0 ⎤ ⎡x⎤       |
+ *    +-- -x ->  ⎢-1  0  0 ⎥ ⎢y⎥  ->   +-- x
+ *   /           ⎣ 0  0 -1 ⎦ ⎣z⎦      /
+ * -z                                z
+ *
+ * Acceleration is reported in units of 10⁻³ m/s², angular velocity is the
+ * sum of eight samples in units of 10⁻³ rad/s.
+ */
+static const struct imu_calibration hololens_imu_calibration = {
+	.acc_matrix = {
+		{ 0, -1e-3, 0 },
+		{ -1e-3, 0, 0 },
+		{ 0, 0, -1e-3 },
+	},
+	.gyro_matrix = {
+		{ 0, -1e-3 / 8.0, 0 },
+		{ -1e-3 / 8.0, 0, 0 },
+		{ 0, 0, -1e-3 / 8.0 },
+	},
+};
+
 static int hololens_imu_handle_imu_report(OuvrtHoloLensIMU *self,
 					  struct hololens_imu_report *report)
 {
+	vec3 angular_velocity[HOLOLENS_GYRO_SUBSAMPLES];
+	struct raw_imu_sample raw[4];
+	struct imu_sample imu[4];
+	float gyro[3][32];
+	int i, j;
+
 	if (memcmp(report->gyro_timestamp,
 		   report->accel_timestamp,
 		   sizeof report->gyro_timestamp)) {
@@ -51,77 +141,66 @@ static int hololens_imu_handle_imu_report(OuvrtHoloLensIMU *self,
 			self->dev.name);
 	}
 
-	for (int i = 0; i < 4; i++) {
-		struct raw_imu_sample raw;
-		struct imu_sample imu;
-		uint16_t temperature;
-		int64_t dt;
+	/* Angular velocity in 10⁻³ rad/s @ 8 kHz */
+	hololens_imu_decode_gyro(report, gyro);
+
+	for (i = 0; i < 4; i++) {
+		float sum[3] = { 0 };
 
-		/* Temperature in 10⁻² °C */
-		temperature = __le16_to_cpu(report->temperature[i]);
 		/* Time in 10⁻⁷ s @ 1 kHz */
-		raw.time = __le64_to_cpu(report->gyro_timestamp[i]);
+		raw[i].time = __le64_to_cpu(report->gyro_timestamp[i]);
 		/* Acceleration in 10⁻³ m/s² @ 1 kHz */
-		raw.acc[0] = (int32_t)__le32_to_cpu(report->accel[0][i]);
-		raw.acc[1] = (int32_t)__le32_to_cpu(report->accel[1][i]);
-		raw.acc[2] = (int32_t)__le32_to_cpu(report->accel[2][i]);
-		/* Angular velocity in 10⁻³ rad/s @ 8 kHz */
-		raw.gyro[0] = (int16_t)__le16_to_cpu(report->gyro[0][8 * i + 0]) +
-			      (int16_t)__le16_to_cpu(report->gyro[0][8 * i + 1]) +
-			      (int16_t)__le16_to_cpu(report->gyro[0][8 * i + 2]) +
-			      (int16_t)__le16_to_cpu(report->gyro[0][8 * i + 3]) +
-			      (int16_t)__le16_to_cpu(report->gyro[0][8 * i + 4]) +
-			      (int16_t)__le16_to_cpu(report->gyro[0][8 * i + 5]) +
-			      (int16_t)__le16_to_cpu(report->gyro[0][8 * i + 6]) +
-			      (int16_t)__le16_to_cpu(report->gyro[0][8 * i + 7]),
-		raw.gyro[1] = (int16_t)__le16_to_cpu(report->gyro[1][8 * i + 0]) +
-			      (int16_t)__le16_to_cpu(report->gyro[1][8 * i + 1]) +
-			      (int16_t)__le16_to_cpu(report->gyro[1][8 * i + 2]) +
-			      (int16_t)__le16_to_cpu(report->gyro[1][8 * i + 3]) +
-			      (int16_t)__le16_to_cpu(report->gyro[1][8 * i + 4]) +
-			      (int16_t)__le16_to_cpu(report->gyro[1][8 * i + 5]) +
-			      (int16_t)__le16_to_cpu(report->gyro[1][8 * i + 6]) +
-			      (int16_t)__le16_to_cpu(report->gyro[1][8 * i + 7]);
-		raw.gyro[2] = (int16_t)__le16_to_cpu(report->gyro[2][8 * i + 0]) +
-			      (int16_t)__le16_to_cpu(report->gyro[2][8 * i + 1]) +
-			      (int16_t)__le16_to_cpu(report->gyro[2][8 * i + 2]) +
-			      (int16_t)__le16_to_cpu(report->gyro[2][8 * i + 3]) +
-			      (int16_t)__le16_to_cpu(report->gyro[2][8 * i + 4]) +
-			      (int16_t)__le16_to_cpu(report->gyro[2][8 * i + 5]) +
-			      (int16_t)__le16_to_cpu(report->gyro[2][8 * i + 6]) +
-			      (int16_t)__le16_to_cpu(report->gyro[2][8 * i + 7]);
-
-		telemetry_send_raw_imu_sample(self->dev.id, &raw);
-
-		dt = raw.time - self->last_timestamp;
-
-		/*
-		 * Transform from IMU coordinate system into common coordinate
-		 * system:
-		 *
-		 *   -y                                y
-		 *    |          ⎡ 0 -1  0 ⎤ ⎡x⎤       |
-		 *    +-- -x ->  ⎢-1  0  0 ⎥ ⎢y⎥  ->   +-- x
-		 *   /           ⎣ 0  0 -1 ⎦ ⎣z⎦      /
-		 * -z                                z
-		 *
-		 */
-		imu.acceleration.x = raw.acc[1] * -1e-3;
-		imu.acceleration.y = raw.acc[0] * -1e-3;
-		imu.acceleration.z = raw.acc[2] * -1e-3;
-		imu.angular_velocity.x = raw.gyro[1] * -(1e-3 / 8.0);
-		imu.angular_velocity.y = raw.gyro[0] * -(1e-3 / 8.0);
-		imu.angular_velocity.z = raw.gyro[2] * -(1e-3 / 8.0);
-		imu.temperature = temperature * 0.01;
-		imu.time = raw.time * 1e-7;
-
-		telemetry_send_imu_sample(self->dev.id, &imu);
-
-		pose_update(1e-7 * dt, &self->imu.pose, &imu);
+		raw[i].acc[0] = (int32_t)__le32_to_cpu(report->accel[0][i]);
+		raw[i].acc[1] = (int32_t)__le32_to_cpu(report->accel[1][i]);
+		raw[i].acc[2] = (int32_t)__le32_to_cpu(report->accel[2][i]);
+
+		for (j = 0; j < HOLOLENS_GYRO_SUBSAMPLES; j++) {
+			int k = HOLOLENS_GYRO_SUBSAMPLES * i + j;
+
+			sum[0] += gyro[0][k];
+			sum[1] += gyro[1][k];
+			sum[2] += gyro[2][k];
+		}
+
+		/* The sum of eight 16-bit samples is exact in float */
+		raw[i].gyro[0] = sum[0];
+		raw[i].gyro[1] = sum[1];
+		raw[i].gyro[2] = sum[2];
+	}
+
+	imu_calibrate_samples(&hololens_imu_calibration, raw, imu, 4);
+
+	for (i = 0; i < 4; i++) {
+		int64_t dt;
+
+		telemetry_send_raw_imu_sample(self->dev.id, &raw[i]);
+
+		dt = raw[i].time - self->last_timestamp;
+
+		/* Temperature in 10⁻² °C */
+		imu[i].temperature = __le16_to_cpu(report->temperature[i]) *
+				     0.01;
+		imu[i].time = raw[i].time * 1e-7;
+
+		/* Telemetry is decimated to the 1 kHz accelerometer rate */
+		telemetry_send_imu_sample(self->dev.id, &imu[i]);
+
+		/* Individual gyro samples, with the same axis transform */
+		for (j = 0; j < HOLOLENS_GYRO_SUBSAMPLES; j++) {
+			int k = HOLOLENS_GYRO_SUBSAMPLES * i + j;
+
+			angular_velocity[j].x = gyro[1][k] * -1e-3f;
+			angular_velocity[j].y = gyro[0][k] * -1e-3f;
+			angular_velocity[j].z = gyro[2][k] * -1e-3f;
+		}
+
+		pose_update_subsamples(1e-7 * dt, &self->imu.pose, &imu[i],
+				       angular_velocity,
+				       HOLOLENS_GYRO_SUBSAMPLES);
 
 		telemetry_send_pose(self->dev.id, &self->imu.pose);
 
-		self->last_timestamp = raw.time;
+		self->last_timestamp = raw[i].time;
 	}
 
 	if (report->message[0].code)
@@ -318,44 +397,23 @@ static int hololens_imu_start(OuvrtDevice *dev)
 }
 
 /*
- * Handles HoloLens IMU messages
+ * Handles all pending HoloLens IMU or control reports.
  */
-static void hololens_imu_thread(OuvrtDevice *dev)
+static void hololens_imu_dispatch(OuvrtDevice *dev, G_GNUC_UNUSED int index,
+				  G_GNUC_UNUSED const struct timespec *ts)
 {
 	OuvrtHoloLensIMU *self = OUVRT_HOLOLENS_IMU(dev);
 	unsigned char buf[HOLOLENS_IMU_REPORT_SIZE];
-	struct pollfd fds;
-	int ret;
-
-	while (dev->active) {
-		fds.fd = dev->fd;
-		fds.events = POLLIN;
-		fds.revents = 0;
-
-		ret = poll(&fds, 1, 1000);
-		if (ret == -1) {
-			g_print("%s: Poll failure: %d\n", dev->name, errno);
-			continue;
-		}
-
-		if (ret == 0)
-			continue;
-
-		if (fds.revents & (POLLERR | POLLHUP | POLLNVAL)) {
-			dev->active = FALSE;
-			break;
-		}
-
-		if (!(fds.revents & POLLIN)) {
-			g_print("%s: Unhandled poll event: 0x%x\n", dev->name,
-				fds.revents);
-			continue;
-		}
+	int ret, i;
 
+	/* IMU reports are too large for a HID report batch */
+	for (i = 0; i < HID_MAX_BATCH; i++) {
 		ret = read(dev->fd, buf, sizeof(buf));
 		if (ret == -1) {
-			g_print("%s: Read error: %d\n", dev->name, errno);
-			continue;
+			if (errno != EAGAIN)
+				g_print("%s: Read error: %d\n", dev->name,
+					errno);
+			return;
 		}
 
 		if (ret == HOLOLENS_IMU_REPORT_SIZE &&
@@ -367,7 +425,6 @@ static void hololens_imu_thread(OuvrtDevice *dev)
 		} else {
 			g_print("%s: Error, invalid %d-byte report 0x%02x\n",
 				dev->name, ret, buf[0]);
-			continue;
 		}
 	}
 }
@@ -392,8 +449,10 @@ ouvrt_hololens_imu_class_init(OuvrtHoloLensIMUClass *klass)
 {
 	G_OBJECT_CLASS(klass)->finalize = ouvrt_hololens_imu_finalize;
 	OUVRT_DEVICE_CLASS(klass)->start = hololens_imu_start;
-	OUVRT_DEVICE_CLASS(klass)->thread = hololens_imu_thread;
+	OUVRT_DEVICE_CLASS(klass)->dispatch = hololens_imu_dispatch;
 	OUVRT_DEVICE_CLASS(klass)->stop = hololens_imu_stop;
+	OUVRT_DEVICE_CLASS(klass)->sched_policy = SCHED_FIFO;
+	OUVRT_DEVICE_CLASS(klass)->sched_priority = 20;
 }
 
 static void ouvrt_hololens_imu_init(OuvrtHoloLensIMU *self)
@@ -0,0 +1,181 @@
+/*
+ * Timestamped IMU state history
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Each entry is protected by its own sequence counter. The writer makes the
+ * counter odd while updating an entry, and readers retry if the counter was
+ * odd or changed while they copied the entry.
+ */
+#include <string.h>
+
+#include "imu.h"
+#include "imu-history.h"
+#include "maths.h"
+
+void imu_history_init(struct imu_history *history)
+{
+	memset(history, 0, sizeof(*history));
+}
+
+/*
+ * Appends a new state to the history, overwriting the oldest entry. The
+ * sample time must increase monotonically.
+ */
+void imu_history_push(struct imu_history *history,
+		      const struct imu_state *state)
+{
+	uint32_t count = history->count;
+	struct imu_history_entry *entry;
+
+	entry = &history->entries[count % IMU_HISTORY_LEN];
+
+	__atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	entry->state = *state;
+	__atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&history->count, count + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies the entry written as the n-th state into state.
+ *
+ * Returns false if the entry was overwritten in the meantime.
+ */
+static bool imu_history_read(struct imu_history *history, uint32_t n,
+			     struct imu_state *state)
+{
+	struct imu_history_entry *entry;
+	uint32_t seq;
+
+	entry = &history->entries[n % IMU_HISTORY_LEN];
+
+	do {
+		seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		*state = entry->state;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+		 seq != __atomic_load_n(&entry->seq, __ATOMIC_RELAXED));
+
+	/* The entry is reused once n + IMU_HISTORY_LEN states were pushed */
+	return n + IMU_HISTORY_LEN > __atomic_load_n(&history->count,
+						     __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Copies the most recent state into state.
+ *
+ * Returns false if the history is empty.
+ */
+bool imu_history_get_latest(struct imu_history *history,
+			    struct imu_state *state)
+{
+	uint32_t count = __atomic_load_n(&history->count, __ATOMIC_ACQUIRE);
+
+	if (count == 0)
+		return false;
+
+	return imu_history_read(history, count - 1, state);
+}
+
+static void vec3_lerp(vec3 *r, const vec3 *a, const vec3 *b, float t)
+{
+	r->x = a->x + (b->x - a->x) * t;
+	r->y = a->y + (b->y - a->y) * t;
+	r->z = a->z + (b->z - a->z) * t;
+}
+
+/*
+ * Interpolates between two consecutive states. Since they are only a single
+ * sample interval apart, normalized linear interpolation of the orientation
+ * is sufficient.
+ */
+static void imu_state_interpolate(struct imu_state *r,
+				  const struct imu_state *a,
+				  const struct imu_state *b, double time)
+{
+	const double t = (time - a->sample.time) /
+			 (b->sample.time - a->sample.time);
+	const double s = dquat_dot(&a->pose.rotation, &b->pose.rotation) < 0 ?
+			 -1.0 : 1.0;
+	const dquat *qa = &a->pose.rotation;
+	const dquat *qb = &b->pose.rotation;
+	const dvec3 *pa = &a->pose.translation;
+	const dvec3 *pb = &b->pose.translation;
+
+	*r = t < 0.5 ? *a : *b;
+	r->sample.time = time;
+
+	r->pose.rotation.x = qa->x + (s * qb->x - qa->x) * t;
+	r->pose.rotation.y = qa->y + (s * qb->y - qa->y) * t;
+	r->pose.rotation.z = qa->z + (s * qb->z - qa->z) * t;
+	r->pose.rotation.w = qa->w + (s * qb->w - qa->w) * t;
+	dquat_normalize(&r->pose.rotation);
+
+	r->pose.translation.x = pa->x + (pb->x - pa->x) * t;
+	r->pose.translation.y = pa->y + (pb->y - pa->y) * t;
+	r->pose.translation.z = pa->z + (pb->z - pa->z) * t;
+
+	vec3_lerp(&r->angular_velocity, &a->angular_velocity,
+		  &b->angular_velocity, t);
+	vec3_lerp(&r->linear_velocity, &a->linear_velocity,
+		  &b->linear_velocity, t);
+}
+
+/*
+ * Looks up the state at the given sample time, interpolating between the
+ * two closest entries. Times after the most recent entry return the most
+ * recent state.
+ *
+ * Returns false if the time is older than the history.
+ */
+bool imu_history_lookup(struct imu_history *history, double time,
+			struct imu_state *state)
+{
+	uint32_t count = __atomic_load_n(&history->count, __ATOMIC_ACQUIRE);
+	uint32_t lo, hi;
+	struct imu_state a, b;
+
+	if (count == 0)
+		return false;
+
+	if (!imu_history_read(history, count - 1, &b))
+		return false;
+	if (time >= b.sample.time) {
+		*state = b;
+		return true;
+	}
+
+	/*
+	 * Binary search for the last entry not after time, skipping the
+	 * oldest entry, which is overwritten next.
+	 */
+	lo = count >= IMU_HISTORY_LEN ? count - IMU_HISTORY_LEN + 1 : 0;
+	hi = count - 1;
+	if (!imu_history_read(history, lo, &a) || a.sample.time > time)
+		return false;
+
+	while (hi - lo > 1) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		struct imu_state m;
+
+		if (!imu_history_read(history, mid, &m))
+			return false;
+		if (m.sample.time <= time) {
+			lo = mid;
+			a = m;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (!imu_history_read(history, hi, &b))
+		return false;
+
+	imu_state_interpolate(state, &a, &b, time);
+
+	return true;
+}
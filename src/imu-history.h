@@ -0,0 +1,40 @@
+/*
+ * Timestamped IMU state history
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __IMU_HISTORY_H__
+#define __IMU_HISTORY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "imu.h"
+
+/* about a quarter second at 1 kHz */
+#define IMU_HISTORY_LEN	256
+
+struct imu_history_entry {
+	uint32_t seq;
+	struct imu_state state;
+};
+
+/*
+ * Ring buffer of IMU states, ordered by sample time. There must be only a
+ * single writer, but any number of threads may read concurrently without
+ * taking a lock.
+ */
+struct imu_history {
+	uint32_t count;
+	struct imu_history_entry entries[IMU_HISTORY_LEN];
+};
+
+void imu_history_init(struct imu_history *history);
+void imu_history_push(struct imu_history *history,
+		      const struct imu_state *state);
+bool imu_history_get_latest(struct imu_history *history,
+			    struct imu_state *state);
+bool imu_history_lookup(struct imu_history *history, double time,
+			struct imu_state *state);
+
+#endif /* __IMU_HISTORY_H__ */
@@ -28,6 +28,52 @@ void dquat_from_accel(dquat *q, vec3 *accel)
 	dquat_from_axes(q, &a, &up);
 }
 
+/*
+ * Applies the calibration to num raw samples at once, writing acceleration
+ * and angular velocity of the calibrated samples. All other fields are left
+ * to the caller.
+ */
+void imu_calibrate_samples(const struct imu_calibration *calibration,
+			   const struct raw_imu_sample *raw,
+			   struct imu_sample *samples, int num)
+{
+	const struct imu_calibration *c = calibration;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		const float a[3] = { raw[i].acc[0], raw[i].acc[1],
+				     raw[i].acc[2] };
+		const float g[3] = { raw[i].gyro[0], raw[i].gyro[1],
+				     raw[i].gyro[2] };
+		struct imu_sample *s = &samples[i];
+
+		s->acceleration.x = c->acc_matrix[0][0] * a[0] +
+				    c->acc_matrix[0][1] * a[1] +
+				    c->acc_matrix[0][2] * a[2] +
+				    c->acc_offset[0];
+		s->acceleration.y = c->acc_matrix[1][0] * a[0] +
+				    c->acc_matrix[1][1] * a[1] +
+				    c->acc_matrix[1][2] * a[2] +
+				    c->acc_offset[1];
+		s->acceleration.z = c->acc_matrix[2][0] * a[0] +
+				    c->acc_matrix[2][1] * a[1] +
+				    c->acc_matrix[2][2] * a[2] +
+				    c->acc_offset[2];
+		s->angular_velocity.x = c->gyro_matrix[0][0] * g[0] +
+					c->gyro_matrix[0][1] * g[1] +
+					c->gyro_matrix[0][2] * g[2] +
+					c->gyro_offset[0];
+		s->angular_velocity.y = c->gyro_matrix[1][0] * g[0] +
+					c->gyro_matrix[1][1] * g[1] +
+					c->gyro_matrix[1][2] * g[2] +
+					c->gyro_offset[1];
+		s->angular_velocity.z = c->gyro_matrix[2][0] * g[0] +
+					c->gyro_matrix[2][1] * g[1] +
+					c->gyro_matrix[2][2] * g[2] +
+					c->gyro_offset[2];
+	}
+}
+
 /*
  * Updates the rotational part of the pose, given a time interval and angular
  * velocity measurement.
@@ -49,3 +95,62 @@ void pose_update(double dt, struct dpose *pose, struct imu_sample *sample)
 
 	pose->rotation = q;
 }
+
+/*
+ * Updates the rotational part of the pose from num angular velocity
+ * measurements, evenly spaced over the time interval dt. In accelerometer
+ * only mode, the sample acceleration is used instead.
+ */
+void pose_update_subsamples(double dt, struct dpose *pose,
+			    struct imu_sample *sample,
+			    const vec3 *angular_velocity, int num)
+{
+	dquat q, r, dq;
+	int i;
+
+	if (mode != GYRO_ONLY || num <= 0) {
+		pose_update(dt, pose, sample);
+		return;
+	}
+
+	q = pose->rotation;
+	dt /= num;
+	for (i = 0; i < num; i++) {
+		dquat_from_gyro(&dq, &angular_velocity[i], dt);
+		dquat_mult(&r, &q, &dq);
+		q = r;
+	}
+	dquat_normalize(&q);
+
+	pose->rotation = q;
+}
+
+/*
+ * Extrapolates the pose of the IMU state dt seconds into the future, assuming
+ * constant angular velocity and linear acceleration.
+ */
+void imu_state_predict(const struct imu_state *state, double dt,
+		       struct dpose *pose)
+{
+	const vec3 *w = &state->angular_velocity;
+	const vec3 *v = &state->linear_velocity;
+	const vec3 *a = &state->linear_acceleration;
+	const double angle = vec3_norm(w) * dt;
+	dquat q = state->pose.rotation;
+	dquat dq;
+
+	*pose = state->pose;
+
+	if (angle > 1e-12) {
+		dvec3 axis = { w->x, w->y, w->z };
+
+		dvec3_normalize(&axis);
+		dquat_from_axis_angle(&dq, &axis, angle);
+		dquat_mult(&pose->rotation, &q, &dq);
+		dquat_normalize(&pose->rotation);
+	}
+
+	pose->translation.x += (v->x + 0.5 * a->x * dt) * dt;
+	pose->translation.y += (v->y + 0.5 * a->y * dt) * dt;
+	pose->translation.z += (v->z + 0.5 * a->z * dt) * dt;
+}
@@ -34,6 +34,19 @@ struct imu_sample {
 	double time;
 };
 
+/*
+ * IMU calibration - transforms raw samples into calibrated acceleration (in
+ * m/s²) and angular velocity (in rad/s) in the common coordinate system:
+ * v = matrix · raw + offset. The matrices include unit conversion, scale,
+ * and the axis permutation from the IMU coordinate system.
+ */
+struct imu_calibration {
+	float acc_matrix[3][3];
+	float acc_offset[3];
+	float gyro_matrix[3][3];
+	float gyro_offset[3];
+};
+
 /*
  * Pose - a transform consisting of rotation and translation.
  */
@@ -55,6 +68,14 @@ struct imu_state {
 	vec3 linear_acceleration;
 };
 
+void imu_calibrate_samples(const struct imu_calibration *calibration,
+			   const struct raw_imu_sample *raw,
+			   struct imu_sample *samples, int num);
 void pose_update(double dt, struct dpose *pose, struct imu_sample *sample);
+void pose_update_subsamples(double dt, struct dpose *pose,
+			    struct imu_sample *sample,
+			    const vec3 *angular_velocity, int num);
+void imu_state_predict(const struct imu_state *state, double dt,
+		       struct dpose *pose);
 
 #endif /* __IMU_H__ */
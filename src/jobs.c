@@ -0,0 +1,305 @@
+/*
+ * Work-stealing job scheduler
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Runs jobs on one worker thread per processor. Each worker has its own
+ * queue, from which it takes the newest job first, so that the jobs a job
+ * submits run next on the same core while their data is still in cache.
+ * Idle workers steal the oldest job from the other queues. Jobs submitted
+ * by threads outside of the scheduler, such as device threads, go into a
+ * shared queue that all workers steal from. Threads waiting for a job help
+ * running queued jobs in the meantime.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <stdio.h>
+
+#include "jobs.h"
+
+/* Jobs beyond this per queue run immediately on the submitting thread */
+#define JOB_QUEUE_SIZE		256
+
+struct job_queue {
+	GMutex lock;
+	/* oldest job at head, newest job at tail */
+	unsigned int head;
+	unsigned int tail;
+	struct job *jobs[JOB_QUEUE_SIZE];
+};
+
+struct job_scheduler {
+	int num_workers;
+	/* one queue per worker, and the shared queue last */
+	struct job_queue *queues;
+	/* protects done flags, dependencies, and sleeping threads */
+	GMutex lock;
+	GCond cond;
+	int num_queued;
+	int num_sleeping;
+	int num_waiting;
+};
+
+/* index of the queue owned by the current thread, plus one */
+static GPrivate job_queue_index;
+
+static struct job_scheduler *job_scheduler_get(void);
+
+/*
+ * Returns the queue of the current worker, or the shared queue.
+ */
+static int job_current_queue(struct job_scheduler *js)
+{
+	int index = GPOINTER_TO_INT(g_private_get(&job_queue_index));
+
+	return index ? index - 1 : js->num_workers;
+}
+
+static void job_push(struct job_scheduler *js, struct job *job);
+
+/*
+ * Runs a job, marks it done, and makes successors without further
+ * dependencies ready to run. The job may be reused by its owner as soon as
+ * it is marked done, so the successors are copied before.
+ */
+static void job_run(struct job_scheduler *js, struct job *job)
+{
+	struct job *successors[JOB_MAX_SUCCESSORS];
+	int num_successors;
+	int i;
+
+	job->func(job->data);
+
+	g_mutex_lock(&js->lock);
+	num_successors = job->num_successors;
+	for (i = 0; i < num_successors; i++)
+		successors[i] = job->successors[i];
+	job->done = true;
+	if (js->num_waiting)
+		g_cond_broadcast(&js->cond);
+	g_mutex_unlock(&js->lock);
+
+	for (i = 0; i < num_successors; i++) {
+		if (__atomic_sub_fetch(&successors[i]->pending, 1,
+				       __ATOMIC_ACQ_REL) == 0)
+			job_push(js, successors[i]);
+	}
+}
+
+/*
+ * Queues a job that is ready to run on the current thread's queue, and wakes
+ * up a sleeping thread. If the queue is full, the job is run immediately.
+ */
+static void job_push(struct job_scheduler *js, struct job *job)
+{
+	struct job_queue *q = &js->queues[job_current_queue(js)];
+
+	g_mutex_lock(&q->lock);
+	if (q->tail - q->head == JOB_QUEUE_SIZE) {
+		g_mutex_unlock(&q->lock);
+		job_run(js, job);
+		return;
+	}
+	q->jobs[q->tail++ % JOB_QUEUE_SIZE] = job;
+	g_mutex_unlock(&q->lock);
+
+	__atomic_add_fetch(&js->num_queued, 1, __ATOMIC_SEQ_CST);
+	g_mutex_lock(&js->lock);
+	if (js->num_sleeping)
+		g_cond_signal(&js->cond);
+	g_mutex_unlock(&js->lock);
+}
+
+/*
+ * Takes the newest job from the own queue, or steals the oldest job from
+ * another queue.
+ *
+ * Returns NULL if all queues are empty.
+ */
+static struct job *job_take(struct job_scheduler *js)
+{
+	int num_queues = js->num_workers + 1;
+	int index = job_current_queue(js);
+	struct job *job = NULL;
+	int i;
+
+	if (!__atomic_load_n(&js->num_queued, __ATOMIC_SEQ_CST))
+		return NULL;
+
+	for (i = 0; i < num_queues && !job; i++) {
+		struct job_queue *q = &js->queues[(index + i) % num_queues];
+
+		g_mutex_lock(&q->lock);
+		if (q->head != q->tail) {
+			if (i == 0)
+				job = q->jobs[--q->tail % JOB_QUEUE_SIZE];
+			else
+				job = q->jobs[q->head++ % JOB_QUEUE_SIZE];
+		}
+		g_mutex_unlock(&q->lock);
+	}
+
+	if (job)
+		__atomic_sub_fetch(&js->num_queued, 1, __ATOMIC_SEQ_CST);
+
+	return job;
+}
+
+static gpointer job_worker_thread(gpointer data)
+{
+	struct job_scheduler *js = job_scheduler_get();
+	struct job *job;
+
+	g_private_set(&job_queue_index, data);
+
+	for (;;) {
+		job = job_take(js);
+		if (job) {
+			job_run(js, job);
+			continue;
+		}
+
+		g_mutex_lock(&js->lock);
+		js->num_sleeping++;
+		while (!__atomic_load_n(&js->num_queued, __ATOMIC_SEQ_CST))
+			g_cond_wait(&js->cond, &js->lock);
+		js->num_sleeping--;
+		g_mutex_unlock(&js->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns the scheduler shared by all trackers and cameras, with one worker
+ * thread per processor.
+ */
+static struct job_scheduler *job_scheduler_get(void)
+{
+	static struct job_scheduler scheduler;
+	static gsize initialized;
+
+	if (g_once_init_enter(&initialized)) {
+		struct job_scheduler *js = &scheduler;
+		char name[24];
+		int i;
+
+		js->num_workers = g_get_num_processors();
+		js->queues = g_new0(struct job_queue, js->num_workers + 1);
+		for (i = 0; i <= js->num_workers; i++)
+			g_mutex_init(&js->queues[i].lock);
+		g_mutex_init(&js->lock);
+		g_cond_init(&js->cond);
+		/* Workers look up the scheduler once it is initialized */
+		g_once_init_leave(&initialized, 1);
+
+		for (i = 0; i < js->num_workers; i++) {
+			snprintf(name, sizeof(name), "job-worker-%d", i);
+			g_thread_unref(g_thread_new(name, job_worker_thread,
+						    GINT_TO_POINTER(i + 1)));
+		}
+	}
+
+	return &scheduler;
+}
+
+/*
+ * Starts the worker threads ahead of the first submitted job, so that they
+ * are not created while processing the first frame.
+ */
+void job_start_workers(void)
+{
+	job_scheduler_get();
+}
+
+/*
+ * Initializes a job that calls func with data once it was submitted and all
+ * its dependencies are done.
+ */
+void job_init(struct job *job, void (*func)(void *data), void *data)
+{
+	job->func = func;
+	job->data = data;
+	job->pending = 1;
+	job->done = false;
+	job->num_successors = 0;
+}
+
+/*
+ * Lets the job wait for another job to finish before it runs. This must be
+ * called before the job is submitted.
+ *
+ * Returns 0 on success, or -ENOSPC if the other job has too many successors.
+ */
+int job_add_dependency(struct job *job, struct job *dependency)
+{
+	struct job_scheduler *js = job_scheduler_get();
+	int ret = 0;
+
+	g_mutex_lock(&js->lock);
+	if (!dependency->done) {
+		if (dependency->num_successors == JOB_MAX_SUCCESSORS) {
+			ret = -ENOSPC;
+		} else {
+			dependency->successors[dependency->num_successors++] =
+									job;
+			__atomic_add_fetch(&job->pending, 1, __ATOMIC_ACQ_REL);
+		}
+	}
+	g_mutex_unlock(&js->lock);
+
+	return ret;
+}
+
+/*
+ * Submits a job, which runs on any thread once all its dependencies are done.
+ */
+void job_submit(struct job *job)
+{
+	struct job_scheduler *js = job_scheduler_get();
+
+	if (__atomic_sub_fetch(&job->pending, 1, __ATOMIC_ACQ_REL) == 0)
+		job_push(js, job);
+}
+
+/*
+ * Waits until a submitted job is done, running queued jobs in the meantime.
+ */
+void job_wait(struct job *job)
+{
+	struct job_scheduler *js = job_scheduler_get();
+	struct job *other;
+
+	for (;;) {
+		g_mutex_lock(&js->lock);
+		if (job->done) {
+			g_mutex_unlock(&js->lock);
+			return;
+		}
+		g_mutex_unlock(&js->lock);
+
+		other = job_take(js);
+		if (other) {
+			job_run(js, other);
+			continue;
+		}
+
+		g_mutex_lock(&js->lock);
+		js->num_sleeping++;
+		js->num_waiting++;
+		while (!job->done &&
+		       !__atomic_load_n(&js->num_queued, __ATOMIC_SEQ_CST))
+			g_cond_wait(&js->cond, &js->lock);
+		js->num_waiting--;
+		js->num_sleeping--;
+		/*
+		 * The wakeup may have been meant for a queued job. If this
+		 * thread returns instead of running it, pass it on to another
+		 * sleeping thread.
+		 */
+		if (job->done && js->num_sleeping &&
+		    __atomic_load_n(&js->num_queued, __ATOMIC_SEQ_CST))
+			g_cond_signal(&js->cond);
+		g_mutex_unlock(&js->lock);
+	}
+}
@@ -0,0 +1,33 @@
+/*
+ * Work-stealing job scheduler
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include <stdbool.h>
+
+#define JOB_MAX_SUCCESSORS	4
+
+/*
+ * A unit of work that runs once all jobs it depends on have finished. Jobs
+ * are owned by the caller, which must keep them alive until they are done.
+ */
+struct job {
+	void (*func)(void *data);
+	void *data;
+	/* unfinished dependencies, plus one until the job is submitted */
+	int pending;
+	bool done;
+	int num_successors;
+	struct job *successors[JOB_MAX_SUCCESSORS];
+};
+
+void job_start_workers(void);
+void job_init(struct job *job, void (*func)(void *data), void *data);
+int job_add_dependency(struct job *job, struct job *dependency);
+void job_submit(struct job *job);
+void job_wait(struct job *job);
+
+#endif /* __JOBS_H__ */
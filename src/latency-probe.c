@@ -0,0 +1,343 @@
+/*
+ * Motion-to-photon latency measurement
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Correlates physical events with their appearance in camera frames and in
+ * the published pose, to measure the end-to-end latency from the sensors to
+ * the application. Two kinds of events are used: the tracked device's IR
+ * LEDs being switched on or off, and a sudden rotation after the device was
+ * resting, as seen by the IMU. For each event, the time until the exposure
+ * of the first frame showing it, until blob detection on that frame is
+ * finished, and until a pose corrected by such a frame is published is
+ * added to a latency histogram. Sudden rotations additionally measure the
+ * time from the IMU sample to the pose published from it.
+ *
+ * The LEDs of other tracked objects, such as Touch controllers, stay lit
+ * while the tracked device's LEDs are switched off. Blobs identified as
+ * their LEDs are not counted, and a toggle is shown by the remaining blob
+ * count halving or doubling relative to the frame before the toggle, so
+ * that their blobs that are not identified yet do not hide it.
+ */
+#include <glib.h>
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "blobwatch.h"
+#include "imu.h"
+#include "latency-probe.h"
+#include "stats.h"
+
+/* events not observed within this time, in ns, are discarded */
+#define LATENCY_PROBE_TIMEOUT		1000000000ULL
+/* angular speeds in rad/s below which the device rests, above which it turns */
+#define LATENCY_PROBE_REST_SPEED	0.1f
+#define LATENCY_PROBE_TURN_SPEED	1.0f
+/* time in ns the device must rest before a rotation counts as an event */
+#define LATENCY_PROBE_REST_TIME		500000000ULL
+/* blob motion in pixels per frame showing the rotation in the camera */
+#define LATENCY_PROBE_BLOB_MOTION	3
+
+enum latency_probe_state {
+	LATENCY_PROBE_IDLE,
+	LATENCY_PROBE_WAIT_FRAME,
+	LATENCY_PROBE_WAIT_POSE,
+	LATENCY_PROBE_WAIT_PUBLISH,
+};
+
+struct latency_probe_event {
+	enum latency_probe_state state;
+	/* host time in ns of the event */
+	uint64_t time;
+	/* start of exposure of the first frame showing the event */
+	uint64_t sof_time;
+	struct histogram *exposure;
+	struct histogram *detection;
+	struct histogram *pose;
+};
+
+struct latency_probe {
+	GMutex lock;
+	bool leds_on;
+	/* blobs not identified as LEDs of other objects, in the last frame */
+	int num_blobs;
+	/* num_blobs at the last LED toggle */
+	int toggle_blobs;
+	struct latency_probe_event led;
+	struct latency_probe_event motion;
+	uint64_t rest_time;
+	bool resting;
+	bool imu_pending;
+	struct histogram *imu_pose;
+};
+
+static bool latency_probe_is_enabled;
+
+/*
+ * Enables the latency measurement mode for all devices started afterwards.
+ */
+void latency_probe_set_enabled(bool enabled)
+{
+	latency_probe_is_enabled = enabled;
+}
+
+bool latency_probe_enabled(void)
+{
+	return latency_probe_is_enabled;
+}
+
+static uint64_t latency_probe_now(void)
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+
+	return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static void latency_probe_add(struct histogram *h, uint64_t start,
+			      uint64_t end)
+{
+	histogram_add_us(h, end > start ? (end - start) / 1000 : 0);
+}
+
+static void latency_probe_event_init(struct latency_probe_event *event,
+				     const char *name, const char *type)
+{
+	char *stage_name;
+
+	stage_name = g_strdup_printf("%s %s to exposure", name, type);
+	event->exposure = histogram_new(stage_name);
+	g_free(stage_name);
+	stage_name = g_strdup_printf("%s %s to detection", name, type);
+	event->detection = histogram_new(stage_name);
+	g_free(stage_name);
+	stage_name = g_strdup_printf("%s %s to pose", name, type);
+	event->pose = histogram_new(stage_name);
+	g_free(stage_name);
+}
+
+static void latency_probe_event_fini(struct latency_probe_event *event)
+{
+	histogram_free(event->exposure);
+	histogram_free(event->detection);
+	histogram_free(event->pose);
+}
+
+/*
+ * Starts measuring an event that happened at the given host time. A
+ * previous event that is still being measured is discarded.
+ */
+static void latency_probe_event_start(struct latency_probe_event *event,
+				      uint64_t time)
+{
+	event->state = LATENCY_PROBE_WAIT_FRAME;
+	event->time = time;
+}
+
+/*
+ * Records exposure and detection latency if the frame started after the
+ * event and shows it. Events that are shown by frames but are not expected
+ * to result in a pose, such as LEDs switched off, are finished here.
+ */
+static void latency_probe_event_frame(struct latency_probe_event *event,
+				      uint64_t sof_time, bool shown,
+				      bool expect_pose, uint64_t now)
+{
+	if (event->state == LATENCY_PROBE_IDLE)
+		return;
+	if (now - event->time > LATENCY_PROBE_TIMEOUT) {
+		event->state = LATENCY_PROBE_IDLE;
+		return;
+	}
+	if (event->state != LATENCY_PROBE_WAIT_FRAME ||
+	    sof_time < event->time || !shown)
+		return;
+
+	latency_probe_add(event->exposure, event->time, sof_time);
+	latency_probe_add(event->detection, event->time, now);
+	event->sof_time = sof_time;
+	event->state = expect_pose ? LATENCY_PROBE_WAIT_POSE :
+				     LATENCY_PROBE_IDLE;
+}
+
+/*
+ * Creates the latency histograms for a device.
+ *
+ * Returns the probe, or NULL on failure.
+ */
+struct latency_probe *latency_probe_new(const char *name)
+{
+	struct latency_probe *probe;
+	char *stage_name;
+
+	probe = calloc(1, sizeof(*probe));
+	if (!probe)
+		return NULL;
+
+	g_mutex_init(&probe->lock);
+	probe->leds_on = true;
+	latency_probe_event_init(&probe->led, name, "led");
+	latency_probe_event_init(&probe->motion, name, "motion");
+	stage_name = g_strdup_printf("%s motion to imu pose", name);
+	probe->imu_pose = histogram_new(stage_name);
+	g_free(stage_name);
+
+	return probe;
+}
+
+void latency_probe_free(struct latency_probe *probe)
+{
+	if (!probe)
+		return;
+
+	latency_probe_event_fini(&probe->led);
+	latency_probe_event_fini(&probe->motion);
+	histogram_free(probe->imu_pose);
+	g_mutex_clear(&probe->lock);
+	free(probe);
+}
+
+/*
+ * Starts measuring the IR LEDs being switched on or off at the given host
+ * time, in ns.
+ */
+void latency_probe_led_toggle(struct latency_probe *probe, bool on,
+			      uint64_t time)
+{
+	if (!probe)
+		return;
+
+	g_mutex_lock(&probe->lock);
+	probe->leds_on = on;
+	probe->toggle_blobs = probe->num_blobs;
+	latency_probe_event_start(&probe->led, time);
+	g_mutex_unlock(&probe->lock);
+}
+
+/*
+ * Detects the start of a sudden rotation after the device was resting, in
+ * an IMU sample taken at the given host time, in ns. Must be called before
+ * the pose is updated with the sample.
+ */
+void latency_probe_imu_sample(struct latency_probe *probe,
+			      const struct imu_sample *sample, uint64_t time)
+{
+	const vec3 *w = &sample->angular_velocity;
+	float speed;
+
+	if (!probe)
+		return;
+
+	speed = sqrtf(w->x * w->x + w->y * w->y + w->z * w->z);
+
+	g_mutex_lock(&probe->lock);
+	if (speed < LATENCY_PROBE_REST_SPEED) {
+		if (!probe->resting)
+			probe->rest_time = time;
+		probe->resting = true;
+	} else if (speed > LATENCY_PROBE_TURN_SPEED && probe->resting) {
+		if (time - probe->rest_time >= LATENCY_PROBE_REST_TIME) {
+			latency_probe_event_start(&probe->motion, time);
+			probe->imu_pending = true;
+		}
+		probe->resting = false;
+	} else if (speed >= LATENCY_PROBE_REST_SPEED) {
+		probe->resting = false;
+	}
+	g_mutex_unlock(&probe->lock);
+}
+
+/*
+ * Checks whether the blobs detected in a frame started at sof_time show an
+ * LED toggle or a rotation. Must be called right after blob detection.
+ */
+void latency_probe_frame(struct latency_probe *probe, uint64_t sof_time,
+			 const struct blob *blobs, int num_blobs)
+{
+	uint64_t now = latency_probe_now();
+	bool moved = false;
+	bool toggled;
+	int own = 0;
+	int i;
+
+	if (!probe)
+		return;
+
+	for (i = 0; i < num_blobs; i++) {
+		if (abs(blobs[i].vx) >= LATENCY_PROBE_BLOB_MOTION ||
+		    abs(blobs[i].vy) >= LATENCY_PROBE_BLOB_MOTION)
+			moved = true;
+		if (blobs[i].led_id < 0 || blobs[i].object_id == 0)
+			own++;
+	}
+
+	g_mutex_lock(&probe->lock);
+	if (probe->leds_on)
+		toggled = own > 2 * probe->toggle_blobs;
+	else
+		toggled = probe->toggle_blobs > 0 &&
+			  own <= probe->toggle_blobs / 2;
+	probe->num_blobs = own;
+	latency_probe_event_frame(&probe->led, sof_time, toggled,
+				  probe->leds_on, now);
+	latency_probe_event_frame(&probe->motion, sof_time, moved, true, now);
+	g_mutex_unlock(&probe->lock);
+}
+
+/*
+ * Notes that a pose estimated from a frame started at sof_time was fed into
+ * the fusion filter, to be published with the next IMU sample.
+ */
+void latency_probe_optical_pose(struct latency_probe *probe,
+				uint64_t sof_time)
+{
+	struct latency_probe_event *events[2];
+	int i;
+
+	if (!probe)
+		return;
+
+	g_mutex_lock(&probe->lock);
+	events[0] = &probe->led;
+	events[1] = &probe->motion;
+	for (i = 0; i < 2; i++) {
+		if (events[i]->state == LATENCY_PROBE_WAIT_POSE &&
+		    sof_time >= events[i]->sof_time)
+			events[i]->state = LATENCY_PROBE_WAIT_PUBLISH;
+	}
+	g_mutex_unlock(&probe->lock);
+}
+
+/*
+ * Records the pose latencies of all events that are included in the pose
+ * just published to clients.
+ */
+void latency_probe_pose_published(struct latency_probe *probe)
+{
+	struct latency_probe_event *events[2];
+	uint64_t now;
+	int i;
+
+	if (!probe)
+		return;
+
+	now = latency_probe_now();
+
+	g_mutex_lock(&probe->lock);
+	if (probe->imu_pending) {
+		latency_probe_add(probe->imu_pose, probe->motion.time, now);
+		probe->imu_pending = false;
+	}
+	events[0] = &probe->led;
+	events[1] = &probe->motion;
+	for (i = 0; i < 2; i++) {
+		if (events[i]->state == LATENCY_PROBE_WAIT_PUBLISH) {
+			latency_probe_add(events[i]->pose, events[i]->time,
+					  now);
+			events[i]->state = LATENCY_PROBE_IDLE;
+		}
+	}
+	g_mutex_unlock(&probe->lock);
+}
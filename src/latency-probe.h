@@ -0,0 +1,32 @@
+/*
+ * Motion-to-photon latency measurement
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __LATENCY_PROBE_H__
+#define __LATENCY_PROBE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct blob;
+struct imu_sample;
+struct latency_probe;
+
+void latency_probe_set_enabled(bool enabled);
+bool latency_probe_enabled(void);
+
+struct latency_probe *latency_probe_new(const char *name);
+void latency_probe_free(struct latency_probe *probe);
+
+void latency_probe_led_toggle(struct latency_probe *probe, bool on,
+			      uint64_t time);
+void latency_probe_imu_sample(struct latency_probe *probe,
+			      const struct imu_sample *sample, uint64_t time);
+void latency_probe_frame(struct latency_probe *probe, uint64_t sof_time,
+			 const struct blob *blobs, int num_blobs);
+void latency_probe_optical_pose(struct latency_probe *probe,
+				uint64_t sof_time);
+void latency_probe_pose_published(struct latency_probe *probe);
+
+#endif /* __LATENCY_PROBE_H__ */
@@ -15,10 +15,14 @@ void leds_init(struct leds *leds, int num_leds)
 {
 	tracking_model_init(&leds->model, num_leds);
 	leds->patterns = malloc(num_leds * sizeof(uint16_t));
+	leds->pattern_table = NULL;
+	memset(leds->bit_masks, 0, sizeof(leds->bit_masks));
 }
 
 void leds_fini(struct leds *leds)
 {
+	free(leds->pattern_table);
+	leds->pattern_table = NULL;
 	free(leds->patterns);
 	leds->patterns = NULL;
 	tracking_model_fini(&leds->model);
@@ -30,6 +34,67 @@ void leds_copy(struct leds *dst, struct leds *src)
 
 	tracking_model_copy(&dst->model, &src->model);
 	free(dst->patterns);
+	dst->patterns = NULL;
+	free(dst->pattern_table);
+	dst->pattern_table = NULL;
+
+	/* LEDs without known blinking patterns can only be identified by pose */
+	if (!src->patterns)
+		return;
+
 	dst->patterns = malloc(size);
 	memcpy(dst->patterns, src->patterns, size);
+
+	leds_build_pattern_table(dst);
+}
+
+/*
+ * Builds a table that maps each possible blinking pattern to the first LED
+ * whose pattern matches exactly or with a single bit error, and the per
+ * phase bitsets used to narrow down LED candidates from partial patterns.
+ */
+void leds_build_pattern_table(struct leds *leds)
+{
+	unsigned int i;
+	int pattern;
+
+	memset(leds->bit_masks, 0, sizeof(leds->bit_masks));
+	if (leds->model.num_points <= LED_MAX_CANDIDATES) {
+		for (i = 0; i < leds->model.num_points; i++) {
+			for (pattern = 0; pattern < LED_PATTERN_BITS; pattern++) {
+				int v = (leds->patterns[i] >> pattern) & 1;
+
+				leds->bit_masks[pattern][v] |= 1ULL << i;
+			}
+		}
+	}
+
+	if (!leds->pattern_table) {
+		leds->pattern_table = malloc(LED_NUM_PATTERNS *
+					     sizeof(*leds->pattern_table));
+		if (!leds->pattern_table)
+			return;
+	}
+
+	for (pattern = 0; pattern < LED_NUM_PATTERNS; pattern++) {
+		struct led_pattern_match *match = &leds->pattern_table[pattern];
+
+		match->id = -1;
+		match->score = -2;
+
+		for (i = 0; i < leds->model.num_points; i++) {
+			uint16_t diff = pattern ^ leds->patterns[i];
+
+			if (diff == 0) {
+				match->id = i;
+				match->score = 2;
+				break;
+			}
+			if (__builtin_popcount(diff) < 2) {
+				match->id = i;
+				match->score = 1;
+				break;
+			}
+		}
+	}
 }
@@ -10,14 +10,36 @@
 
 #include "tracking-model.h"
 
+#define LED_PATTERN_BITS	10
+#define LED_NUM_PATTERNS	(1 << LED_PATTERN_BITS)
+/* maximum number of LEDs per object for progressive identification */
+#define LED_MAX_CANDIDATES	64
+
+/*
+ * LED id for a recorded blinking pattern, with a score of 2 for an exact
+ * match, 1 for a single bit error, or -2 if no LED matches.
+ */
+struct led_pattern_match {
+	int8_t id;
+	int8_t score;
+};
+
 struct leds {
 	struct tracking_model model;
 	uint16_t *patterns;
+	struct led_pattern_match *pattern_table;
+	/*
+	 * Bitsets of the LEDs whose blinking pattern has bit value v at
+	 * phase p in bit_masks[p][v], for objects with up to
+	 * LED_MAX_CANDIDATES LEDs.
+	 */
+	uint64_t bit_masks[LED_PATTERN_BITS][2];
 };
 
 void leds_init(struct leds *leds, int num_leds);
 void leds_fini(struct leds *leds);
 void leds_copy(struct leds *dst, struct leds *src);
+void leds_build_pattern_table(struct leds *leds);
 
 void leds_dump_obj(struct leds *leds);
 
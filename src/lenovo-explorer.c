@@ -5,7 +5,6 @@
  */
 #include <asm/byteorder.h>
 #include <errno.h>
-#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -32,54 +31,28 @@ static int lenovo_explorer_start(G_GNUC_UNUSED OuvrtDevice *dev)
 }
 
 /*
- * Handles Lenovo Explorer messages.
+ * Handles a single Lenovo Explorer proximity report.
  */
-static void lenovo_explorer_thread(OuvrtDevice *dev)
+static void lenovo_explorer_dispatch(OuvrtDevice *dev, G_GNUC_UNUSED int index,
+				     G_GNUC_UNUSED const struct timespec *ts)
 {
 	OuvrtLenovoExplorer *self = OUVRT_LENOVO_EXPLORER(dev);
 	unsigned char buf[64];
-	struct pollfd fds;
 	int ret;
 
-	while (dev->active) {
-		fds.fd = dev->fd;
-		fds.events = POLLIN;
-		fds.revents = 0;
-
-		ret = poll(&fds, 1, 1000);
-		if (ret == -1) {
-			g_print("%s: Poll failure: %d\n", dev->name, errno);
-			continue;
-		}
-
-		if (ret == 0)
-			continue;
-
-		if (fds.revents & (POLLERR | POLLHUP | POLLNVAL)) {
-			dev->active = FALSE;
-			break;
-		}
-
-		if (!(fds.revents & POLLIN)) {
-			g_print("%s: Unhandled poll event: 0x%x\n", dev->name,
-				fds.revents);
-			continue;
-		}
-
-		ret = read(dev->fd, buf, sizeof(buf));
-		if (ret == -1) {
-			g_print("%s: Read error: %d\n", dev->name, errno);
-			continue;
-		}
-		if (ret != 2 || buf[0] != 0x01) {
-			g_print("%s: Error, invalid %d-byte report 0x%02x\n",
-				dev->name, ret, buf[0]);
-			continue;
-		}
-
-		self->proximity = buf[1];
-		g_print("%s: Proximity: %d\n", dev->name, buf[1]);
+	ret = read(dev->fd, buf, sizeof(buf));
+	if (ret == -1) {
+		g_print("%s: Read error: %d\n", dev->name, errno);
+		return;
 	}
+	if (ret != 2 || buf[0] != 0x01) {
+		g_print("%s: Error, invalid %d-byte report 0x%02x\n",
+			dev->name, ret, buf[0]);
+		return;
+	}
+
+	self->proximity = buf[1];
+	g_print("%s: Proximity: %d\n", dev->name, buf[1]);
 }
 
 /*
@@ -102,7 +75,7 @@ ouvrt_lenovo_explorer_class_init(OuvrtLenovoExplorerClass *klass)
 {
 	G_OBJECT_CLASS(klass)->finalize = ouvrt_lenovo_explorer_finalize;
 	OUVRT_DEVICE_CLASS(klass)->start = lenovo_explorer_start;
-	OUVRT_DEVICE_CLASS(klass)->thread = lenovo_explorer_thread;
+	OUVRT_DEVICE_CLASS(klass)->dispatch = lenovo_explorer_dispatch;
 	OUVRT_DEVICE_CLASS(klass)->stop = lenovo_explorer_stop;
 }
 
@@ -0,0 +1,408 @@
+/*
+ * Lighthouse sweep based pose estimation
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Estimates the pose of a tracked device in the coordinate system of each
+ * lighthouse base station, with x pointing right, y up, and z forward out of
+ * the base station. Rotor 0 sweeps horizontally and measures the azimuth
+ * atan(x/z), rotor 1 sweeps vertically and measures the elevation atan(y/z).
+ *
+ * The solver runs after every single sweep. It combines the new angles with
+ * those of the other rotor's previous sweep, so that the pose is updated at
+ * the sweep rate instead of once per pair of sweeps.
+ */
+#include <errno.h>
+#include <string.h>
+
+#include "lighthouse.h"
+#include "lighthouse-solver.h"
+#include "tracking-model.h"
+
+/* The rotors spin at 60 Hz, so half a turn takes 400000 ticks at 48 MHz */
+#define LIGHTHOUSE_TICKS_PER_PI			400000.0
+#define LIGHTHOUSE_TICKS_CENTER			200000.0
+
+/* maximum age of the other rotor's sweep to be combined, in ticks */
+#define LIGHTHOUSE_SOLVER_MAX_AGE		1000000
+#define LIGHTHOUSE_SOLVER_MIN_ANGLES		6
+/* minimum number of angles per rotor, as a single rotor can't fix the pose */
+#define LIGHTHOUSE_SOLVER_MIN_ROTOR_ANGLES	3
+/* maximum RMS residual of an accepted pose, in radians */
+#define LIGHTHOUSE_SOLVER_MAX_ERROR		0.002
+#define LIGHTHOUSE_SOLVER_ITERATIONS		5
+#define LIGHTHOUSE_SOLVER_INIT_ITERATIONS	30
+#define LIGHTHOUSE_SOLVER_INIT_DISTANCE		2.0
+/* sine of the largest angle a hit sensor may face away from the base */
+#define LIGHTHOUSE_SOLVER_MAX_FACING_AWAY	0.3
+
+struct sweep_angle {
+	int sensor;
+	int rotor;
+	double angle;
+};
+
+struct lighthouse_problem {
+	const struct tracking_model *model;
+	const struct lighthouse_base_calibration *calibration;
+	struct sweep_angle angles[64];
+	int num_angles;
+};
+
+/*
+ * Predicts the angle measured by the given rotor for the point p in base
+ * station coordinates, applying the rotor calibration if available, and
+ * returns the derivative of the predicted angle with respect to p in grad.
+ *
+ * The calibrated angle is modelled as
+ *
+ *   atan(a) - phase - tan(tilt) b - curve b² - gibmag sin(gibphase + atan(a))
+ *
+ * where a and b are the normalized coordinates along and across the sweep.
+ */
+static double predict_angle(const struct lighthouse_base_calibration *calib,
+			    int rotor, const dvec3 *p, dvec3 *grad)
+{
+	const double iz = 1.0 / p->z;
+	const double u = p->x * iz;
+	const double v = p->y * iz;
+	const double a = rotor ? v : u;
+	const double b = rotor ? u : v;
+	const double theta = atan(a);
+	double angle = theta;
+	double da = 1.0 / (1.0 + a * a);
+	double db = 0.0;
+
+	if (calib) {
+		const struct lighthouse_rotor_calibration *c;
+
+		c = &calib->rotor[rotor];
+		angle -= c->phase + tan(c->tilt) * b + c->curve * b * b +
+			 c->gibmag * sin(c->gibphase + theta);
+		da *= 1.0 - c->gibmag * cos(c->gibphase + theta);
+		db = -tan(c->tilt) - 2.0 * c->curve * b;
+	}
+
+	/* du/dp = (1/z, 0, -u/z), dv/dp = (0, 1/z, -v/z) */
+	if (rotor) {
+		grad->x = db * iz;
+		grad->y = da * iz;
+	} else {
+		grad->x = da * iz;
+		grad->y = db * iz;
+	}
+	grad->z = -(grad->x * u + grad->y * v);
+
+	return angle;
+}
+
+/*
+ * Accumulates the Gauss-Newton normal equations for all sweep angles, with
+ * the rotation perturbed from the left.
+ *
+ * Returns the sum of squared angle residuals.
+ */
+static double normal_equations(const struct lighthouse_problem *problem,
+			       const dquat *rot, const dvec3 *trans,
+			       double h[6][6], double g[6])
+{
+	const struct tracking_model *model = problem->model;
+	double cost = 0.0;
+	int i, j, k;
+
+	memset(h, 0, 36 * sizeof(double));
+	memset(g, 0, 6 * sizeof(double));
+
+	for (i = 0; i < problem->num_angles; i++) {
+		const struct sweep_angle *s = &problem->angles[i];
+		const vec3 *point = &model->points[s->sensor];
+		const dvec3 m = { point->x, point->y, point->z };
+		double jac[6];
+		dvec3 q, p, grad;
+		double r;
+
+		dquat_rotate(&q, rot, &m);
+		p.x = q.x + trans->x;
+		p.y = q.y + trans->y;
+		p.z = q.z + trans->z;
+		if (p.z <= 1e-6) {
+			/* Keep points behind the base station expensive */
+			cost += 1.0;
+			continue;
+		}
+
+		r = predict_angle(problem->calibration, s->rotor, &p, &grad) -
+		    s->angle;
+		cost += r * r;
+
+		/* dp/d(omega, t) = [-[q]x | I] */
+		jac[0] = -grad.y * q.z + grad.z * q.y;
+		jac[1] = grad.x * q.z - grad.z * q.x;
+		jac[2] = -grad.x * q.y + grad.y * q.x;
+		jac[3] = grad.x;
+		jac[4] = grad.y;
+		jac[5] = grad.z;
+
+		for (j = 0; j < 6; j++) {
+			g[j] += jac[j] * r;
+			for (k = 0; k <= j; k++)
+				h[j][k] += jac[j] * jac[k];
+		}
+	}
+
+	for (j = 0; j < 6; j++)
+		for (k = j + 1; k < 6; k++)
+			h[j][k] = h[k][j];
+
+	return cost;
+}
+
+/*
+ * Refines the pose with Levenberg-Marquardt iterations over all sweep angles.
+ *
+ * Returns the RMS angle residual in radians.
+ */
+static double lighthouse_refine(const struct lighthouse_problem *problem,
+				dquat *rot, dvec3 *trans, int iterations)
+{
+	double lambda = 1e-3;
+	double h[6][6], g[6];
+	double cost;
+	int iter, i;
+
+	cost = normal_equations(problem, rot, trans, h, g);
+
+	for (iter = 0; iter < iterations; iter++) {
+		double a[6][6], delta[6];
+		double new_cost, angle;
+		double nh[6][6], ng[6];
+		dquat drot, new_rot;
+		dvec3 new_trans, axis;
+
+		memcpy(a, h, sizeof(a));
+		for (i = 0; i < 6; i++) {
+			a[i][i] *= 1.0 + lambda;
+			delta[i] = -g[i];
+		}
+		if (!cholesky_solve6(a, delta))
+			break;
+
+		axis = (dvec3){ delta[0], delta[1], delta[2] };
+		angle = sqrt(dvec3_dot(&axis, &axis));
+		if (angle > 1e-12) {
+			dvec3_normalize(&axis);
+			dquat_from_axis_angle(&drot, &axis, angle);
+		} else {
+			drot = (dquat){ 0, 0, 0, 1 };
+		}
+		dquat_mult(&new_rot, &drot, rot);
+		dquat_normalize(&new_rot);
+		new_trans.x = trans->x + delta[3];
+		new_trans.y = trans->y + delta[4];
+		new_trans.z = trans->z + delta[5];
+
+		new_cost = normal_equations(problem, &new_rot, &new_trans, nh,
+					    ng);
+		if (new_cost < cost) {
+			*rot = new_rot;
+			*trans = new_trans;
+			memcpy(h, nh, sizeof(h));
+			memcpy(g, ng, sizeof(g));
+			lambda *= 0.1;
+			if (cost - new_cost < 1e-12 * cost) {
+				cost = new_cost;
+				break;
+			}
+			cost = new_cost;
+		} else {
+			lambda *= 10.0;
+		}
+	}
+
+	return sqrt(cost / problem->num_angles);
+}
+
+/*
+ * Returns true if all hit sensors face the base station at the given pose,
+ * allowing for sensors seeing the sweep at a grazing angle.
+ */
+static bool lighthouse_sensors_facing(const struct lighthouse_problem *problem,
+				      const dquat *rot, const dvec3 *trans)
+{
+	const struct tracking_model *model = problem->model;
+	int i;
+
+	if (!model->normals)
+		return true;
+
+	for (i = 0; i < problem->num_angles; i++) {
+		const int id = problem->angles[i].sensor;
+		const dvec3 m = { model->points[id].x, model->points[id].y,
+				  model->points[id].z };
+		const dvec3 on = { model->normals[id].x, model->normals[id].y,
+				   model->normals[id].z };
+		dvec3 p, n;
+
+		dquat_rotate(&p, rot, &m);
+		p.x += trans->x;
+		p.y += trans->y;
+		p.z += trans->z;
+		dquat_rotate(&n, rot, &on);
+		if (dvec3_dot(&n, &p) > LIGHTHOUSE_SOLVER_MAX_FACING_AWAY *
+					sqrt(dvec3_dot(&p, &p)))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Searches the pose from scratch, starting from the 24 axis aligned
+ * orientations at a fixed distance in the direction of the mean sweep angles.
+ *
+ * Returns the RMS angle residual of the best pose found.
+ */
+static double lighthouse_search(const struct lighthouse_problem *problem,
+				dquat *rot, dvec3 *trans)
+{
+	static const dvec3 axes[3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+	static const struct {
+		int axis;
+		double angle;
+	} faces[6] = {
+		{ 0, 0.0 }, { 0, M_PI_2 }, { 0, M_PI }, { 0, -M_PI_2 },
+		{ 1, M_PI_2 }, { 1, -M_PI_2 },
+	};
+	double best = DBL_MAX;
+	double tan_mean[2] = { 0.0, 0.0 };
+	int num[2] = { 0, 0 };
+	dvec3 t0;
+	int i, j;
+
+	for (i = 0; i < problem->num_angles; i++) {
+		tan_mean[problem->angles[i].rotor] +=
+			tan(problem->angles[i].angle);
+		num[problem->angles[i].rotor]++;
+	}
+	for (i = 0; i < 2; i++)
+		if (num[i])
+			tan_mean[i] /= num[i];
+	t0 = (dvec3){ tan_mean[0], tan_mean[1], 1.0 };
+	dvec3_normalize(&t0);
+	t0.x *= LIGHTHOUSE_SOLVER_INIT_DISTANCE;
+	t0.y *= LIGHTHOUSE_SOLVER_INIT_DISTANCE;
+	t0.z *= LIGHTHOUSE_SOLVER_INIT_DISTANCE;
+
+	for (i = 0; i < 6; i++) {
+		for (j = 0; j < 4; j++) {
+			dquat face, roll, r;
+			dvec3 t = t0;
+			double err;
+
+			dquat_from_axis_angle(&face, &axes[faces[i].axis],
+					      faces[i].angle);
+			dquat_from_axis_angle(&roll, &axes[2], j * M_PI_2);
+			dquat_mult(&r, &roll, &face);
+
+			err = lighthouse_refine(problem, &r, &t,
+						LIGHTHOUSE_SOLVER_INIT_ITERATIONS);
+			if (err < best && t.z > 0.0 &&
+			    lighthouse_sensors_facing(problem, &r, &t)) {
+				best = err;
+				*rot = r;
+				*trans = t;
+			}
+		}
+	}
+
+	return best;
+}
+
+void lighthouse_solver_init(struct lighthouse_solver *solver)
+{
+	memset(solver, 0, sizeof(*solver));
+}
+
+/*
+ * Stores the sweep angles of the finished frame of the given rotor and
+ * updates the device pose relative to the base station from them and from
+ * the last sweep of the other rotor, if it is recent enough. A tracked pose
+ * is refined, otherwise a new pose is searched.
+ *
+ * Returns the number of sweep angles used, or a negative error code if the
+ * pose could not be determined.
+ */
+int lighthouse_solver_update(struct lighthouse_solver *solver, int index,
+			     const struct tracking_model *model,
+			     const struct lighthouse_base_calibration *calibration,
+			     int rotor, const struct lighthouse_frame *frame)
+{
+	struct lighthouse_solver_base *base = &solver->base[index];
+	struct lighthouse_problem problem = {
+		.model = model,
+		.calibration = calibration,
+	};
+	uint32_t mask = model->num_points >= 32 ? 0xffffffff :
+			(1U << model->num_points) - 1;
+	uint32_t age;
+	dquat rot = base->rot;
+	dvec3 trans = base->trans;
+	double err;
+	int r, i;
+
+	base->sweep_ids[rotor] = frame->sweep_ids & mask;
+	base->sync_timestamp[rotor] = frame->sync_timestamp;
+	for (i = 0; i < 32; i++) {
+		if (!(base->sweep_ids[rotor] & (1U << i)))
+			continue;
+		base->angle[rotor][i] = (frame->sweep_offset[i] +
+					 0.5 * frame->sweep_duration[i] -
+					 LIGHTHOUSE_TICKS_CENTER) *
+					M_PI / LIGHTHOUSE_TICKS_PER_PI;
+	}
+
+	age = frame->sync_timestamp - base->sync_timestamp[!rotor];
+	for (r = 0; r < 2; r++) {
+		int start = problem.num_angles;
+
+		if (r != rotor && age > LIGHTHOUSE_SOLVER_MAX_AGE)
+			return -EINVAL;
+		for (i = 0; i < 32; i++) {
+			struct sweep_angle *s;
+
+			if (!(base->sweep_ids[r] & (1U << i)))
+				continue;
+			s = &problem.angles[problem.num_angles++];
+			s->sensor = i;
+			s->rotor = r;
+			s->angle = base->angle[r][i];
+		}
+		if (problem.num_angles - start <
+		    LIGHTHOUSE_SOLVER_MIN_ROTOR_ANGLES)
+			return -EINVAL;
+	}
+
+	if (problem.num_angles < LIGHTHOUSE_SOLVER_MIN_ANGLES)
+		return -EINVAL;
+
+	if (base->tracking) {
+		err = lighthouse_refine(&problem, &rot, &trans,
+					LIGHTHOUSE_SOLVER_ITERATIONS);
+		if (err > LIGHTHOUSE_SOLVER_MAX_ERROR ||
+		    !lighthouse_sensors_facing(&problem, &rot, &trans))
+			base->tracking = false;
+	}
+
+	if (!base->tracking) {
+		err = lighthouse_search(&problem, &rot, &trans);
+		if (err > LIGHTHOUSE_SOLVER_MAX_ERROR)
+			return -EINVAL;
+		base->tracking = true;
+	}
+
+	base->rot = rot;
+	base->trans = trans;
+	base->rms_error = err;
+
+	return problem.num_angles;
+}
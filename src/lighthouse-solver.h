@@ -0,0 +1,42 @@
+/*
+ * Lighthouse sweep based pose estimation
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __LIGHTHOUSE_SOLVER_H__
+#define __LIGHTHOUSE_SOLVER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "maths.h"
+
+struct lighthouse_base_calibration;
+struct lighthouse_frame;
+struct tracking_model;
+
+/*
+ * The latest sweep angles of both rotors of a single base station, and the
+ * device pose in the base station coordinate system estimated from them.
+ */
+struct lighthouse_solver_base {
+	double angle[2][32];
+	uint32_t sweep_ids[2];
+	uint32_t sync_timestamp[2];
+	dquat rot;
+	dvec3 trans;
+	bool tracking;
+	double rms_error;
+};
+
+struct lighthouse_solver {
+	struct lighthouse_solver_base base[2];
+};
+
+void lighthouse_solver_init(struct lighthouse_solver *solver);
+int lighthouse_solver_update(struct lighthouse_solver *solver, int index,
+			     const struct tracking_model *model,
+			     const struct lighthouse_base_calibration *calibration,
+			     int rotor, const struct lighthouse_frame *frame);
+
+#endif /* __LIGHTHOUSE_SOLVER_H__ */
@@ -8,9 +8,13 @@
 #include <stdint.h>
 #include <string.h>
 #include <zlib.h>
+#include "cache.h"
+#include "imu.h"
 #include "lighthouse.h"
+#include "log.h"
 #include "maths.h"
 #include "telemetry.h"
+#include "trace.h"
 
 struct lighthouse_ootx_report {
 	__le16 version;
@@ -25,6 +29,16 @@ struct lighthouse_ootx_report {
 	__le16 gibmag[2];
 } __attribute__((packed));
 
+#define LIGHTHOUSE_BASE_CACHE_MAGIC	0x5342484c /* "LHBS" */
+
+struct lighthouse_base_cache {
+	uint32_t magic;
+	uint32_t serial;
+	int32_t firmware_version;
+	int32_t model_id;
+	struct lighthouse_base_calibration calibration;
+};
+
 static unsigned int watchman_id;
 
 static inline float __le16_to_float(__le16 le16)
@@ -61,12 +75,87 @@ static inline gboolean pulse_in_sweep_window(int32_t dt, uint16_t duration)
 	return dt > (55555 - 1000) && (dt + duration) < (346667 + 1000);
 }
 
+/*
+ * Returns the cache file name for the base station with the given serial
+ * number or, if serial is zero, for the last base station seen on the given
+ * channel.
+ */
+static char *lighthouse_base_cache_filename(uint32_t serial, char channel)
+{
+	if (serial)
+		return ouvrt_cache_path("%X.lighthouse", serial);
+	else
+		return ouvrt_cache_path("channel-%c.lighthouse", channel);
+}
+
+/*
+ * Initializes the base station serial number and calibration from the cache,
+ * to be verified by the next received OOTX frame.
+ *
+ * Returns true if a matching cache entry was found.
+ */
+static bool lighthouse_base_load_cache(struct lighthouse_base *base,
+				       uint32_t serial)
+{
+	struct lighthouse_base_cache *cache;
+	char *filename;
+	size_t length;
+	bool found = false;
+
+	filename = lighthouse_base_cache_filename(serial, base->channel);
+	if (ouvrt_cache_load(filename, &cache, &length)) {
+		if (length == sizeof(*cache) &&
+		    cache->magic == LIGHTHOUSE_BASE_CACHE_MAGIC &&
+		    cache->serial && (!serial || cache->serial == serial)) {
+			base->serial = cache->serial;
+			base->firmware_version = cache->firmware_version;
+			base->model_id = cache->model_id;
+			base->calibration = cache->calibration;
+			base->calibrated = true;
+			base->verified = false;
+			found = true;
+		}
+		g_free(cache);
+	}
+	g_free(filename);
+
+	return found;
+}
+
+/*
+ * Writes the base station calibration to the cache, keyed both by serial
+ * number and by the channel it was last seen on.
+ */
+static void lighthouse_base_store_cache(struct lighthouse_base *base)
+{
+	struct lighthouse_base_cache cache = {
+		.magic = LIGHTHOUSE_BASE_CACHE_MAGIC,
+		.serial = base->serial,
+		.firmware_version = base->firmware_version,
+		.model_id = base->model_id,
+		.calibration = base->calibration,
+	};
+	char *filename;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		filename = lighthouse_base_cache_filename(i ? 0 : base->serial,
+							  base->channel);
+		ouvrt_cache_save_async(filename, &cache, sizeof(cache));
+		g_free(filename);
+	}
+
+	g_print("Lighthouse Base %X: writing calibration cache\n", base->serial);
+}
+
 static void lighthouse_base_handle_ootx_frame(struct lighthouse_base *base)
 {
 	struct lighthouse_ootx_report *report = (void *)(base->ootx + 2);
 	uint16_t len = __le16_to_cpup((__le16 *)base->ootx);
 	uint32_t crc = crc32(0L, Z_NULL, 0);
+	struct lighthouse_base_calibration calibration;
 	gboolean serial_changed = FALSE;
+	int firmware_version;
 	uint32_t ootx_crc;
 	uint16_t version;
 	int ootx_version;
@@ -95,17 +184,18 @@ static void lighthouse_base_handle_ootx_frame(struct lighthouse_base *base)
 		return;
 	}
 
-	base->firmware_version = version >> 6;
+	firmware_version = version >> 6;
 
 	if (base->serial != __le32_to_cpu(report->serial)) {
 		base->serial = __le32_to_cpu(report->serial);
+		base->verified = false;
 		serial_changed = TRUE;
 	}
 
 	for (i = 0; i < 2; i++) {
 		struct lighthouse_rotor_calibration *rotor;
 
-		rotor = &base->calibration.rotor[i];
+		rotor = &calibration.rotor[i];
 		rotor->tilt = __le16_to_float(report->tilt[i]);
 		rotor->phase = __le16_to_float(report->phase[i]);
 		rotor->curve = __le16_to_float(report->curve[i]);
@@ -113,7 +203,33 @@ static void lighthouse_base_handle_ootx_frame(struct lighthouse_base *base)
 		rotor->gibmag = __le16_to_float(report->gibmag[i]);
 	}
 
-	base->model_id = report->model_id;
+	/*
+	 * Update the cache once per base station, unless the cached
+	 * calibration was correct.
+	 */
+	if (!base->verified) {
+		bool stale = !base->calibrated ||
+			     base->firmware_version != firmware_version ||
+			     base->model_id != report->model_id ||
+			     memcmp(&base->calibration, &calibration,
+				    sizeof(calibration)) != 0;
+
+		base->firmware_version = firmware_version;
+		base->model_id = report->model_id;
+		base->calibration = calibration;
+		base->calibrated = true;
+		base->verified = true;
+
+		if (stale)
+			lighthouse_base_store_cache(base);
+		else
+			g_print("Lighthouse Base %X: verified cached calibration\n",
+				base->serial);
+	} else {
+		base->firmware_version = firmware_version;
+		base->model_id = report->model_id;
+		base->calibration = calibration;
+	}
 
 	if (serial_changed) {
 		g_print("Lighthouse Base %X: firmware version: %d, model id: %d, channel: %c\n",
@@ -179,6 +295,14 @@ lighthouse_base_handle_ootx_data_word(struct lighthouse_watchman *watchman,
 		if (ootx_version == 6 && serial != base->serial) {
 			g_print("%s: spotted Lighthouse Base %X\n",
 				watchman->name, serial);
+
+			if (lighthouse_base_load_cache(base, serial)) {
+				g_print("%s: using cached calibration of Lighthouse Base %X\n",
+					watchman->name, serial);
+			} else {
+				base->calibrated = false;
+				base->verified = false;
+			}
 		}
 	}
 	if (len == 33 && base->data_word == 20) { /* (len + 3)/4 * 2 + 2 */
@@ -242,8 +366,6 @@ static void lighthouse_base_handle_frame(struct lighthouse_watchman *watchman,
 {
 	struct lighthouse_frame *frame = &base->frame[base->active_rotor];
 
-	(void)watchman;
-
 	if (!frame->sweep_ids)
 		return;
 
@@ -257,6 +379,26 @@ static void lighthouse_base_handle_frame(struct lighthouse_watchman *watchman,
 		return;
 
 	telemetry_send_lighthouse_frame(watchman->id, frame);
+
+	/*
+	 * Update the pose after each sweep. Poses relative to the second
+	 * base station are kept, but not reported, as the relative pose of
+	 * the base stations is not known.
+	 */
+	if (lighthouse_solver_update(&watchman->solver, base - watchman->base,
+				     &watchman->model,
+				     base->calibrated ? &base->calibration :
+							NULL,
+				     base->active_rotor, frame) >= 0 &&
+	    base == &watchman->base[0]) {
+		struct lighthouse_solver_base *solved;
+		struct dpose pose;
+
+		solved = &watchman->solver.base[0];
+		pose.rotation = solved->rot;
+		pose.translation = solved->trans;
+		telemetry_send_pose(watchman->id, &pose);
+	}
 }
 
 /*
@@ -285,6 +427,9 @@ static void lighthouse_handle_sync_pulse(struct lighthouse_watchman *watchman,
 	if (!sync->duration)
 		return;
 
+	OUVRT_TRACE3(lighthouse_handle_sync_pulse, watchman->id,
+		     sync->timestamp, sync->duration);
+
 	if (sync->duration < 2750 || sync->duration > 6750) {
 		g_print("%s: Unknown pulse length: %d\n", watchman->name,
 			sync->duration);
@@ -326,6 +471,18 @@ static void lighthouse_handle_sync_pulse(struct lighthouse_watchman *watchman,
 
 	base = &watchman->base[channel == 'C'];
 	base->channel = channel;
+
+	/*
+	 * Until the OOTX frame identifies the base station, assume it is the
+	 * one last seen on this channel.
+	 */
+	if (!base->cache_checked) {
+		base->cache_checked = true;
+		if (!base->calibrated && lighthouse_base_load_cache(base, 0)) {
+			g_print("%s: assuming Lighthouse Base %X on channel %c, using cached calibration\n",
+				watchman->name, base->serial, channel);
+		}
+	}
 	base->last_sync_timestamp = sync->timestamp;
 	lighthouse_base_handle_ootx_data_bit(watchman, base, (code & DATA_BIT));
 	lighthouse_base_handle_frame(watchman, base, sync->timestamp);
@@ -367,8 +524,9 @@ static void lighthouse_handle_sweep_pulse(struct lighthouse_watchman *watchman,
 		return;
 
 	if (!pulse_in_sweep_window(offset, duration)) {
-		g_print("%s: sweep offset out of range: rotor %u offset %u duration %u\n",
-			watchman->name, base->active_rotor, offset, duration);
+		log_ratelimited("%s: sweep offset out of range: rotor %u offset %u duration %u\n",
+				watchman->name, base->active_rotor, offset,
+				duration);
 		return;
 	}
 
@@ -437,9 +595,9 @@ void lighthouse_watchman_handle_pulse(struct lighthouse_watchman *watchman,
 				g_print("%s: late pulse, lost sync\n",
 					watchman->name);
 			} else {
-				g_print("%s: spurious pulse: %08x (%02x %d %u)\n",
-					watchman->name, timestamp, id, dt,
-					duration);
+				log_ratelimited("%s: spurious pulse: %08x (%02x %d %u)\n",
+						watchman->name, timestamp, id,
+						dt, duration);
 			}
 			watchman->seen_by = 0;
 		}
@@ -471,6 +629,62 @@ void lighthouse_watchman_handle_pulse(struct lighthouse_watchman *watchman,
 	}
 }
 
+/*
+ * Handles all pulses of a report at once. The devices may report pulses out
+ * of order, which the sync pulse accumulation would mistake for spurious or
+ * late pulses, so the pulses are sorted first. Only the order of pulses that
+ * belong to different sync floods or sweeps matters, so pulses closer than
+ * the longest sync pulse are left in the order they were reported. While
+ * locked onto the sync signal, pulses that continue the current sync flood or
+ * the current sweep are handled directly. Only pulses that start a new sync
+ * or sweep, or can not be classified, take the per-pulse path.
+ */
+void lighthouse_watchman_handle_pulses(struct lighthouse_watchman *watchman,
+				       struct lighthouse_pulse *pulses,
+				       int num_pulses)
+{
+	int i, j;
+
+	/* Insertion sort, the reports contain no more than 9 pulses */
+	for (i = 1; i < num_pulses; i++) {
+		struct lighthouse_pulse pulse = pulses[i];
+
+		for (j = i; j > 0 &&
+		     (int32_t)(pulses[j - 1].timestamp - pulse.timestamp) > 6750;
+		     j--)
+			pulses[j] = pulses[j - 1];
+		pulses[j] = pulse;
+	}
+
+	for (i = 0; i < num_pulses; i++) {
+		const struct lighthouse_pulse *pulse = &pulses[i];
+		int32_t dt = pulse->timestamp - watchman->last_sync.timestamp;
+
+		if (watchman->sync_lock) {
+			if (watchman->seen_by &&
+			    dt <= watchman->last_sync.duration &&
+			    pulse_in_this_sync_window(dt, pulse->duration)) {
+				accumulate_sync_pulse(watchman, pulse->id,
+						      pulse->timestamp,
+						      pulse->duration);
+				continue;
+			}
+			if (!watchman->seen_by &&
+			    pulse_in_sweep_window(dt, pulse->duration)) {
+				lighthouse_handle_sweep_pulse(watchman,
+							      pulse->id,
+							      pulse->timestamp,
+							      pulse->duration);
+				continue;
+			}
+		}
+
+		lighthouse_watchman_handle_pulse(watchman, pulse->id,
+						 pulse->duration,
+						 pulse->timestamp);
+	}
+}
+
 void lighthouse_watchman_init(struct lighthouse_watchman *watchman)
 {
 	watchman->id = watchman_id++;
@@ -479,4 +693,5 @@ void lighthouse_watchman_init(struct lighthouse_watchman *watchman)
 	watchman->last_timestamp = 0;
 	watchman->last_sync.timestamp = 0;
 	watchman->last_sync.duration = 0;
+	lighthouse_solver_init(&watchman->solver);
 }
@@ -13,6 +13,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "lighthouse-solver.h"
 #include "maths.h"
 #include "tracking-model.h"
 
@@ -47,6 +48,11 @@ struct lighthouse_base {
 	int firmware_version;
 	uint32_t serial;
 	struct lighthouse_base_calibration calibration;
+	/* calibration is valid, possibly loaded from the cache */
+	bool calibrated;
+	/* calibration was confirmed by a received OOTX frame */
+	bool verified;
+	bool cache_checked;
 	vec3 gravity;
 	char channel;
 	int model_id;
@@ -81,11 +87,15 @@ struct lighthouse_watchman {
 	struct lighthouse_sensor sensor[32];
 	struct lighthouse_pulse last_sync;
 	bool sync_lock;
+	struct lighthouse_solver solver;
 };
 
 void lighthouse_watchman_handle_pulse(struct lighthouse_watchman *watchman,
 				      uint8_t id, uint16_t duration,
 				      uint32_t timestamp);
+void lighthouse_watchman_handle_pulses(struct lighthouse_watchman *watchman,
+				       struct lighthouse_pulse *pulses,
+				       int num_pulses);
 void lighthouse_watchman_init(struct lighthouse_watchman *watchman);
 
 #endif /* __LIGHTHOUSE_H__ */
@@ -0,0 +1,172 @@
+/*
+ * Rate-limited, non-blocking logging
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Device threads must not block on stdout or the journal when error
+ * conditions occur in bursts. Messages from hot paths are formatted into
+ * the slots of a bounded multi-producer queue and printed from the main
+ * loop. If the queue is full, messages are dropped and counted.
+ */
+#include <glib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+
+#define LOG_BUFFER_SLOTS		64
+#define LOG_LINE_SIZE			192
+/* messages printed per call site and interval before suppression */
+#define LOG_RATELIMIT_BURST		5
+#define LOG_RATELIMIT_INTERVAL		G_TIME_SPAN_SECOND
+/* interval in ms at which the main loop prints queued messages */
+#define LOG_DRAIN_INTERVAL		100
+
+/*
+ * A slot is free for the producer at position pos if seq == pos, and holds
+ * a message for the consumer at position pos if seq == pos + 1.
+ */
+struct log_slot {
+	uint32_t seq;
+	char text[LOG_LINE_SIZE];
+};
+
+static struct log_slot log_slots[LOG_BUFFER_SLOTS];
+static uint32_t log_head;
+static uint32_t log_tail;
+static int log_dropped;
+static guint log_source_id;
+static bool log_enabled;
+
+static void log_push(const char *text)
+{
+	struct log_slot *slot;
+	uint32_t pos, seq;
+	int32_t diff;
+
+	pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &log_slots[pos % LOG_BUFFER_SLOTS];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (int32_t)(seq - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&log_head, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* The queue is full */
+			__atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	g_strlcpy(slot->text, text, LOG_LINE_SIZE);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Prints all queued messages from the main loop.
+ */
+static gboolean log_drain(G_GNUC_UNUSED gpointer user_data)
+{
+	struct log_slot *slot;
+	int dropped;
+
+	for (;;) {
+		slot = &log_slots[log_tail % LOG_BUFFER_SLOTS];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) !=
+		    log_tail + 1)
+			break;
+		g_print("%s", slot->text);
+		__atomic_store_n(&slot->seq, log_tail + LOG_BUFFER_SLOTS,
+				 __ATOMIC_RELEASE);
+		log_tail++;
+	}
+
+	dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped)
+		g_print("Log buffer full, %d messages dropped\n", dropped);
+
+	return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Prints a message unless the call site exceeded its rate limit. Before
+ * log_init is called, or after log_deinit, messages are printed directly.
+ */
+void log_site_print(struct log_site *site, const char *format, ...)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 begin = __atomic_load_n(&site->begin, __ATOMIC_RELAXED);
+	char text[LOG_LINE_SIZE];
+	int suppressed = 0;
+	va_list args;
+	int len;
+
+	if (now - begin >= LOG_RATELIMIT_INTERVAL &&
+	    __atomic_compare_exchange_n(&site->begin, &begin, now, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		suppressed = __atomic_exchange_n(&site->suppressed, 0,
+						 __ATOMIC_RELAXED);
+		__atomic_store_n(&site->printed, 0, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_add_fetch(&site->printed, 1, __ATOMIC_RELAXED) >
+	    LOG_RATELIMIT_BURST) {
+		__atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	va_start(args, format);
+	len = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	if (suppressed && len >= 0 && len < (int)sizeof(text)) {
+		snprintf(text + len, sizeof(text) - len,
+			 " (%d similar messages suppressed)\n", suppressed);
+		/* Move the suffix in front of the message's newline */
+		if (len > 0 && text[len - 1] == '\n')
+			memmove(text + len - 1, text + len,
+				strlen(text + len) + 1);
+	}
+
+	if (__atomic_load_n(&log_enabled, __ATOMIC_ACQUIRE))
+		log_push(text);
+	else
+		g_print("%s", text);
+}
+
+/*
+ * Starts printing queued messages from the default main context.
+ */
+void log_init(void)
+{
+	int i;
+
+	for (i = 0; i < LOG_BUFFER_SLOTS; i++)
+		log_slots[i].seq = i;
+	log_head = 0;
+	log_tail = 0;
+
+	log_source_id = g_timeout_add(LOG_DRAIN_INTERVAL, log_drain, NULL);
+	__atomic_store_n(&log_enabled, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Prints the remaining queued messages. Device threads must be stopped.
+ */
+void log_deinit(void)
+{
+	__atomic_store_n(&log_enabled, false, __ATOMIC_RELEASE);
+	if (log_source_id)
+		g_source_remove(log_source_id);
+	log_source_id = 0;
+	log_drain(NULL);
+}
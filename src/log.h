@@ -0,0 +1,37 @@
+/*
+ * Rate-limited, non-blocking logging
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <glib.h>
+
+/*
+ * Suppression state of a single log call site.
+ */
+struct log_site {
+	gint64 begin;
+	int printed;
+	int suppressed;
+};
+
+/*
+ * Logs a message from a hot path. Each call site prints at most a few
+ * messages per second and counts the suppressed ones. Messages are queued
+ * into a lock-free buffer that is printed by the main loop, so the calling
+ * thread never blocks on the output.
+ */
+#define log_ratelimited(...) do {				\
+		static struct log_site __log_site;		\
+		log_site_print(&__log_site, __VA_ARGS__);	\
+	} while (0)
+
+void log_site_print(struct log_site *site, const char *format, ...)
+	G_GNUC_PRINTF(2, 3);
+
+void log_init(void);
+void log_deinit(void);
+
+#endif /* __LOG_H__ */
@@ -51,6 +51,52 @@ float f16_to_float(uint16_t f16)
 	return u.f32;
 }
 
+/*
+ * Converts to half precision, rounding to nearest. Values too large for
+ * half precision are converted to infinity.
+ */
+uint16_t float_to_f16(float f)
+{
+	union {
+		float f32;
+		uint32_t u32;
+	} u = { .f32 = f };
+	uint16_t sign = (u.u32 >> 16) & 0x8000;
+	int exponent = (u.u32 >> 23) & 0xff;
+	uint32_t mantissa = u.u32 & 0x7fffffu;
+	uint16_t f16;
+	int shift;
+
+	if (exponent == 255) {
+		/* infinite or NaN */
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+	}
+
+	exponent += 15 - 127;
+	if (exponent >= 31) {
+		/* overflow */
+		return sign | 0x7c00;
+	}
+
+	if (exponent <= 0) {
+		/* subnormal or zero */
+		if (exponent < -10)
+			return sign;
+		mantissa |= 1 << 23;
+		shift = 14 - exponent;
+		f16 = mantissa >> shift;
+		if (mantissa & (1 << (shift - 1)))
+			f16++;
+		return sign | f16;
+	}
+
+	/* normal, a rounding carry correctly overflows into the exponent */
+	f16 = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		f16++;
+	return f16;
+}
+
 /*
  * Returns the rotation around the normalized vector axis, about the given
  * angle in quaternion q.
@@ -105,3 +151,122 @@ void dquat_from_gyro(dquat *q, const vec3 *gyro, double dt)
 	q->y = y + x * z;
 	q->z = z - x * y;
 }
+
+/*
+ * Returns the rotation described by the row-major rotation matrix m in
+ * quaternion q.
+ */
+void dquat_from_dmat3(dquat *q, const dmat3 *m)
+{
+	const double *r = m->m;
+	const double trace = r[0] + r[4] + r[8];
+	double s;
+
+	if (trace > 0.0) {
+		s = 0.5 / sqrt(trace + 1.0);
+		q->w = 0.25 / s;
+		q->x = (r[7] - r[5]) * s;
+		q->y = (r[2] - r[6]) * s;
+		q->z = (r[3] - r[1]) * s;
+	} else if (r[0] > r[4] && r[0] > r[8]) {
+		s = 2.0 * sqrt(1.0 + r[0] - r[4] - r[8]);
+		q->w = (r[7] - r[5]) / s;
+		q->x = 0.25 * s;
+		q->y = (r[1] + r[3]) / s;
+		q->z = (r[2] + r[6]) / s;
+	} else if (r[4] > r[8]) {
+		s = 2.0 * sqrt(1.0 + r[4] - r[0] - r[8]);
+		q->w = (r[2] - r[6]) / s;
+		q->x = (r[1] + r[3]) / s;
+		q->y = 0.25 * s;
+		q->z = (r[5] + r[7]) / s;
+	} else {
+		s = 2.0 * sqrt(1.0 + r[8] - r[0] - r[4]);
+		q->w = (r[3] - r[1]) / s;
+		q->x = (r[2] + r[6]) / s;
+		q->y = (r[5] + r[7]) / s;
+		q->z = 0.25 * s;
+	}
+
+	dquat_normalize(q);
+}
+
+/*
+ * Returns the row-major rotation matrix for the normalized quaternion q in m.
+ */
+void dmat3_from_dquat(dmat3 *m, const dquat *q)
+{
+	const double xx = q->x * q->x, yy = q->y * q->y, zz = q->z * q->z;
+	const double xy = q->x * q->y, xz = q->x * q->z, yz = q->y * q->z;
+	const double wx = q->w * q->x, wy = q->w * q->y, wz = q->w * q->z;
+
+	m->m[0] = 1.0 - 2.0 * (yy + zz);
+	m->m[1] = 2.0 * (xy - wz);
+	m->m[2] = 2.0 * (xz + wy);
+	m->m[3] = 2.0 * (xy + wz);
+	m->m[4] = 1.0 - 2.0 * (xx + zz);
+	m->m[5] = 2.0 * (yz - wx);
+	m->m[6] = 2.0 * (xz - wy);
+	m->m[7] = 2.0 * (yz + wx);
+	m->m[8] = 1.0 - 2.0 * (xx + yy);
+}
+
+/*
+ * Rotates vector v by the normalized quaternion q and returns the result in r.
+ */
+void dquat_rotate(dvec3 *r, const dquat *q, const dvec3 *v)
+{
+	const dvec3 u = { q->x, q->y, q->z };
+	dvec3 t, c;
+
+	/* t = 2 * cross(u, v), r = v + w * t + cross(u, t) */
+	dvec3_cross(&t, &u, v);
+	t.x *= 2.0;
+	t.y *= 2.0;
+	t.z *= 2.0;
+	dvec3_cross(&c, &u, &t);
+
+	r->x = v->x + q->w * t.x + c.x;
+	r->y = v->y + q->w * t.y + c.y;
+	r->z = v->z + q->w * t.z + c.z;
+}
+
+/*
+ * Solves the symmetric positive definite 6x6 system a x = b in place using
+ * Cholesky decomposition.
+ */
+bool cholesky_solve6(double a[6][6], double b[6])
+{
+	int i, j, k;
+
+	for (j = 0; j < 6; j++) {
+		double d = a[j][j];
+
+		for (k = 0; k < j; k++)
+			d -= a[j][k] * a[j][k];
+		if (d <= 0.0)
+			return false;
+		a[j][j] = sqrt(d);
+
+		for (i = j + 1; i < 6; i++) {
+			double s = a[i][j];
+
+			for (k = 0; k < j; k++)
+				s -= a[i][k] * a[j][k];
+			a[i][j] = s / a[j][j];
+		}
+	}
+
+	for (i = 0; i < 6; i++) {
+		for (k = 0; k < i; k++)
+			b[i] -= a[i][k] * b[k];
+		b[i] /= a[i][i];
+	}
+	for (i = 5; i >= 0; i--) {
+		for (k = i + 1; k < 6; k++)
+			b[i] -= a[k][i] * b[k];
+		b[i] /= a[i][i];
+	}
+
+	return true;
+}
@@ -8,8 +8,17 @@
 
 #include <math.h>
 #include <float.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MATHS_NEON_F64 1
+#endif
+
 typedef struct {
 	float x, y, z;
 } vec3;
@@ -27,6 +36,7 @@ typedef struct {
 } dmat3;
 
 float f16_to_float(uint16_t f16);
+uint16_t float_to_f16(float f);
 
 static inline double vec3_dot(const vec3 *a, const vec3 *b)
 {
@@ -64,26 +74,129 @@ static inline double dquat_norm(const dquat *q)
 	return sqrt(dquat_dot(q, q));
 }
 
+/*
+ * Quaternion normalization and multiplication run for every IMU sample.
+ * The SIMD variants keep the quaternion in two registers of (x, y) and
+ * (z, w) double pairs.
+ */
 static inline void dquat_normalize(dquat *q)
 {
+#if defined(__SSE2__)
+	__m128d xy = _mm_loadu_pd(&q->x);
+	__m128d zw = _mm_loadu_pd(&q->z);
+	__m128d sq = _mm_add_pd(_mm_mul_pd(xy, xy), _mm_mul_pd(zw, zw));
+	__m128d inv_norm;
+
+	sq = _mm_add_sd(sq, _mm_unpackhi_pd(sq, sq));
+	inv_norm = _mm_div_sd(_mm_set_sd(1.0), _mm_sqrt_sd(sq, sq));
+	inv_norm = _mm_unpacklo_pd(inv_norm, inv_norm);
+	_mm_storeu_pd(&q->x, _mm_mul_pd(xy, inv_norm));
+	_mm_storeu_pd(&q->z, _mm_mul_pd(zw, inv_norm));
+#elif defined(MATHS_NEON_F64)
+	float64x2_t xy = vld1q_f64(&q->x);
+	float64x2_t zw = vld1q_f64(&q->z);
+	float64x2_t sq = vfmaq_f64(vmulq_f64(xy, xy), zw, zw);
+	const double inv_norm = 1.0 / sqrt(vaddvq_f64(sq));
+
+	vst1q_f64(&q->x, vmulq_n_f64(xy, inv_norm));
+	vst1q_f64(&q->z, vmulq_n_f64(zw, inv_norm));
+#else
 	const double inv_norm = 1.0 / dquat_norm(q);
 
 	q->w *= inv_norm;
 	q->x *= inv_norm;
 	q->y *= inv_norm;
 	q->z *= inv_norm;
+#endif
 }
 
-static inline void dquat_mult(dquat *r, dquat *p, const dquat *q)
+static inline void dquat_mult(dquat *r, const dquat *p, const dquat *q)
 {
+#if defined(__SSE2__)
+	/* Flip the sign of the high or low double */
+	const __m128d neg_hi = _mm_castsi128_pd(_mm_set_epi32(0x80000000, 0,
+							       0, 0));
+	const __m128d neg_lo = _mm_castsi128_pd(_mm_set_epi32(0, 0,
+							       0x80000000, 0));
+	const __m128d q_xy = _mm_loadu_pd(&q->x);
+	const __m128d q_zw = _mm_loadu_pd(&q->z);
+	const __m128d q_yx = _mm_shuffle_pd(q_xy, q_xy, 1);
+	const __m128d q_wz = _mm_shuffle_pd(q_zw, q_zw, 1);
+	const __m128d px = _mm_set1_pd(p->x);
+	const __m128d py = _mm_set1_pd(p->y);
+	const __m128d pz = _mm_set1_pd(p->z);
+	const __m128d pw = _mm_set1_pd(p->w);
+	__m128d xy, zw;
+
+	/* (x, y) = pw * (qx, qy) + px * (qw, -qz) + py * (qz, qw) + pz * (-qy, qx) */
+	xy = _mm_mul_pd(pw, q_xy);
+	xy = _mm_add_pd(xy, _mm_mul_pd(px, _mm_xor_pd(q_wz, neg_hi)));
+	xy = _mm_add_pd(xy, _mm_mul_pd(py, q_zw));
+	xy = _mm_add_pd(xy, _mm_mul_pd(pz, _mm_xor_pd(q_yx, neg_lo)));
+	/* (z, w) = pw * (qz, qw) + px * (qy, -qx) - py * (qx, qy) + pz * (qw, -qz) */
+	zw = _mm_mul_pd(pw, q_zw);
+	zw = _mm_add_pd(zw, _mm_mul_pd(px, _mm_xor_pd(q_yx, neg_hi)));
+	zw = _mm_sub_pd(zw, _mm_mul_pd(py, q_xy));
+	zw = _mm_add_pd(zw, _mm_mul_pd(pz, _mm_xor_pd(q_wz, neg_hi)));
+
+	_mm_storeu_pd(&r->x, xy);
+	_mm_storeu_pd(&r->z, zw);
+#elif defined(MATHS_NEON_F64)
+	const float64x2_t sign_hi = { 1.0, -1.0 };
+	const float64x2_t sign_lo = { -1.0, 1.0 };
+	const float64x2_t q_xy = vld1q_f64(&q->x);
+	const float64x2_t q_zw = vld1q_f64(&q->z);
+	const float64x2_t q_yx = vextq_f64(q_xy, q_xy, 1);
+	const float64x2_t q_wz = vextq_f64(q_zw, q_zw, 1);
+	float64x2_t xy, zw;
+
+	xy = vmulq_n_f64(q_xy, p->w);
+	xy = vfmaq_n_f64(xy, vmulq_f64(q_wz, sign_hi), p->x);
+	xy = vfmaq_n_f64(xy, q_zw, p->y);
+	xy = vfmaq_n_f64(xy, vmulq_f64(q_yx, sign_lo), p->z);
+	zw = vmulq_n_f64(q_zw, p->w);
+	zw = vfmaq_n_f64(zw, vmulq_f64(q_yx, sign_hi), p->x);
+	zw = vfmsq_n_f64(zw, q_xy, p->y);
+	zw = vfmaq_n_f64(zw, vmulq_f64(q_wz, sign_hi), p->z);
+
+	vst1q_f64(&r->x, xy);
+	vst1q_f64(&r->z, zw);
+#else
 	r->w = p->w * q->w - p->x * q->x - p->y * q->y - p->z * q->z;
 	r->x = p->w * q->x + p->x * q->w + p->y * q->z - p->z * q->y;
 	r->y = p->w * q->y + p->y * q->w + p->z * q->x - p->x * q->z;
 	r->z = p->w * q->z + p->z * q->w + p->x * q->y - p->y * q->x;
+#endif
+}
+
+static inline double dvec3_dot(const dvec3 *a, const dvec3 *b)
+{
+	return a->x * b->x + a->y * b->y + a->z * b->z;
+}
+
+static inline void dvec3_cross(dvec3 *c, const dvec3 *a, const dvec3 *b)
+{
+	c->x = a->y * b->z - b->y * a->z;
+	c->y = a->z * b->x - b->z * a->x;
+	c->z = a->x * b->y - b->x * a->y;
+}
+
+static inline void dvec3_normalize(dvec3 *v)
+{
+	const double inv_norm = 1.0 / sqrt(dvec3_dot(v, v));
+
+	v->x *= inv_norm;
+	v->y *= inv_norm;
+	v->z *= inv_norm;
 }
 
 void dquat_from_axis_angle(dquat *quat, const dvec3 *axis, double angle);
 void dquat_from_axes(dquat *q, const vec3 *a, const vec3 *b);
 void dquat_from_gyro(dquat *q, const vec3 *gyro, double dt);
+void dquat_from_dmat3(dquat *q, const dmat3 *m);
+void dmat3_from_dquat(dmat3 *m, const dquat *q);
+void dquat_rotate(dvec3 *r, const dquat *q, const dvec3 *v);
+
+bool cholesky_solve6(double a[6][6], double b[6]);
 
 #endif /* __MATHS_H__ */
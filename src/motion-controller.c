@@ -5,7 +5,7 @@
  */
 #include <asm/byteorder.h>
 #include <errno.h>
-#include <poll.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -15,18 +15,23 @@
 #include "device.h"
 #include "hidraw.h"
 #include "imu.h"
+#include "pose-shm.h"
 #include "telemetry.h"
 
 struct _OuvrtMotionController {
 	OuvrtDevice dev;
 
 	bool missing;
+	bool have_timestamp;
 	uint64_t last_timestamp;
 	uint8_t buttons;
 	uint8_t battery;
 	uint8_t touchpad[2];
+	uint16_t stick[2];
+	uint8_t trigger;
 
 	struct imu_state imu;
+	struct pose_shm *pose_shm;
 };
 
 G_DEFINE_TYPE(OuvrtMotionController, ouvrt_motion_controller, OUVRT_TYPE_DEVICE)
@@ -47,6 +52,29 @@ static const struct button_map motion_controller_button_map[6] = {
 	{ MOTION_CONTROLLER_BUTTON_PAD_TOUCH, OUVRT_TOUCH_THUMB },
 };
 
+/*
+ * Longest interval between two IMU samples, in 10⁻⁷ s, that is still
+ * integrated.
+ */
+#define MOTION_CONTROLLER_MAX_IMU_INTERVAL	500000
+
+/*
+ * Acceleration is reported in units of g/506200, angular velocity in units
+ * of 10⁻⁵ rad/s.
+ */
+static const struct imu_calibration motion_controller_imu_calibration = {
+	.acc_matrix = {
+		{ 9.81 / 506200., 0, 0 },
+		{ 0, 9.81 / 506200., 0 },
+		{ 0, 0, 9.81 / 506200. },
+	},
+	.gyro_matrix = {
+		{ 1e-5, 0, 0 },
+		{ 0, 1e-5, 0 },
+		{ 0, 0, 1e-5 },
+	},
+};
+
 static void motion_controller_decode_message(OuvrtMotionController *self,
 					     const unsigned char *buf,
 					     G_GNUC_UNUSED const struct timespec *ts)
@@ -56,16 +84,31 @@ static void motion_controller_decode_message(OuvrtMotionController *self,
 		buf[2] | ((buf[3] & 0xf) << 8),
 		((buf[3] & 0xf0) >> 4) | (buf[4] << 4),
 	};
-	float joy[2] = {
-		stick[0] * 2.0 / 4095 - 1.0,
-		stick[1] * 2.0 / 4095 - 1.0,
-	};
-
-	telemetry_send_axis(self->dev.id, 0, joy, 2);
+	uint8_t trigger = buf[5];
+	struct raw_imu_sample raw;
+	struct imu_sample sample = { 0 };
+	bool integrate = self->have_timestamp;
+	uint32_t time;
+	int32_t dt;
+
+	/* Only send axis updates if the values changed */
+	if (stick[0] != self->stick[0] || stick[1] != self->stick[1]) {
+		float joy[2] = {
+			stick[0] * 2.0 / 4095 - 1.0,
+			stick[1] * 2.0 / 4095 - 1.0,
+		};
+
+		telemetry_send_axis(self->dev.id, 0, joy, 2);
+		self->stick[0] = stick[0];
+		self->stick[1] = stick[1];
+	}
 
-	float trigger = buf[5] / 255.0;
+	if (trigger != self->trigger) {
+		float t = trigger / 255.0;
 
-	telemetry_send_axis(self->dev.id, 1, &trigger, 1);
+		telemetry_send_axis(self->dev.id, 1, &t, 1);
+		self->trigger = trigger;
+	}
 
 	if (self->touchpad[0] != buf[6] || self->touchpad[1] != buf[7]) {
 		self->touchpad[0] = buf[6];
@@ -76,50 +119,48 @@ static void motion_controller_decode_message(OuvrtMotionController *self,
 		self->battery = buf[8];
 	}
 
-	int32_t accel[3] = {
-		buf[9] | (buf[10] << 8) | ((int8_t)buf[11] << 16),
-		buf[12] | (buf[13] << 8) | ((int8_t)buf[14] << 16),
-		buf[15] | (buf[16] << 8) | ((int8_t)buf[17] << 16),
-	};
-
-	int32_t gyro[3] = {
-		buf[20] | (buf[21] << 8) | ((int8_t)buf[22] << 16),
-		buf[23] | (buf[24] << 8) | ((int8_t)buf[25] << 16),
-		buf[26] | (buf[27] << 8) | ((int8_t)buf[28] << 16),
-	};
+	raw.acc[0] = buf[9] | (buf[10] << 8) | ((int8_t)buf[11] << 16);
+	raw.acc[1] = buf[12] | (buf[13] << 8) | ((int8_t)buf[14] << 16);
+	raw.acc[2] = buf[15] | (buf[16] << 8) | ((int8_t)buf[17] << 16);
+	raw.gyro[0] = buf[20] | (buf[21] << 8) | ((int8_t)buf[22] << 16);
+	raw.gyro[1] = buf[23] | (buf[24] << 8) | ((int8_t)buf[25] << 16);
+	raw.gyro[2] = buf[26] | (buf[27] << 8) | ((int8_t)buf[28] << 16);
 
-	uint32_t time = buf[29] | (buf[30] << 8) | (buf[31] << 16) | (buf[32] << 24);
-	int32_t dt = time - self->last_timestamp;
+	/* 10⁻⁷ s, extended to 64 bits */
+	time = buf[29] | (buf[30] << 8) | (buf[31] << 16) | (buf[32] << 24);
+	dt = time - (uint32_t)self->last_timestamp;
 	self->last_timestamp += dt;
+	self->have_timestamp = true;
+	raw.time = self->last_timestamp;
 
-	struct raw_imu_sample raw = {
-		.time = self->last_timestamp,
-		.acc = { accel[0], accel[1], accel[2] },
-		.gyro = { gyro[0], gyro[1], gyro[2] },
-	};
+	/* Do not integrate the first sample or across dropped reports */
+	if (dt <= 0 || dt > MOTION_CONTROLLER_MAX_IMU_INTERVAL)
+		integrate = false;
 
-	struct imu_sample sample = {
-		.time = raw.time * 1e-7,
-		.acceleration = {
-			.x = accel[0] * 9.81 / 506200.,
-			.y = accel[1] * 9.81 / 506200.,
-			.z = accel[2] * 9.81 / 506200.,
-		},
-		.angular_velocity = {
-			.x = gyro[0] * 1e-5,
-			.y = gyro[1] * 1e-5,
-			.z = gyro[2] * 1e-5,
-		},
-	};
+	if (telemetry_wants(self->dev.id, TELEMETRY_PACKET_RAW_IMU_SAMPLE))
+		telemetry_send_raw_imu_sample(self->dev.id, &raw);
+
+	imu_calibrate_samples(&motion_controller_imu_calibration, &raw,
+			      &sample, 1);
+	sample.time = raw.time * 1e-7;
 
-	telemetry_send_imu_sample(self->dev.id, &sample);
+	if (telemetry_wants(self->dev.id, TELEMETRY_PACKET_IMU_SAMPLE))
+		telemetry_send_imu_sample(self->dev.id, &sample);
 
-	pose_update(dt * 1e-7, &self->imu.pose, &sample);
+	if (integrate) {
+		pose_update(dt * 1e-7, &self->imu.pose, &sample);
 
-	self->imu.pose.translation.x = 0.0;
-	self->imu.pose.translation.y = 0.0;
-	self->imu.pose.translation.z = 0.0;
-	telemetry_send_pose(self->dev.id, &self->imu.pose);
+		self->imu.sample = sample;
+		self->imu.angular_velocity = sample.angular_velocity;
+		self->imu.pose.translation.x = 0.0;
+		self->imu.pose.translation.y = 0.0;
+		self->imu.pose.translation.z = 0.0;
+
+		pose_shm_write(__atomic_load_n(&self->pose_shm,
+					       __ATOMIC_ACQUIRE), &self->imu);
+		if (telemetry_wants(self->dev.id, TELEMETRY_PACKET_POSE))
+			telemetry_send_pose(self->dev.id, &self->imu.pose);
+	}
 
 	if (buttons != self->buttons) {
 		ouvrt_handle_buttons(self->dev.id, buttons, self->buttons,
@@ -137,60 +178,40 @@ static int motion_controller_start(G_GNUC_UNUSED OuvrtDevice *dev)
 }
 
 /*
- * Handles Motion Controller messages.
+ * Handles all pending Motion Controller reports.
  */
-static void motion_controller_thread(OuvrtDevice *dev)
+static void motion_controller_dispatch(OuvrtDevice *dev,
+				       G_GNUC_UNUSED int index,
+				       const struct timespec *ts)
 {
 	OuvrtMotionController *self = OUVRT_MOTION_CONTROLLER(dev);
-	unsigned char buf[64];
-	struct timespec ts;
-	struct pollfd fds;
-	int ret;
-
-	while (dev->active) {
-		fds.fd = dev->fd;
-		fds.events = POLLIN;
-		fds.revents = 0;
-
-		ret = poll(&fds, 1, 1000);
-		clock_gettime(CLOCK_MONOTONIC, &ts);
-		if (ret == -1) {
-			g_print("%s: Poll failure: %d\n", dev->name, errno);
-			continue;
-		}
+	struct hid_report_batch batch;
+	int ret, i;
 
-		if (ret == 0) {
-			if (!self->missing) {
-				g_print("%s: Device stopped sending\n",
-					dev->name);
-				self->missing = true;
-			}
-			continue;
-		}
-
-		if (fds.revents & (POLLERR | POLLHUP | POLLNVAL)) {
-			dev->active = FALSE;
-			break;
-		}
-
-		if (!(fds.revents & POLLIN)) {
-			g_print("%s: Unhandled poll event: 0x%x\n", dev->name,
-				fds.revents);
-			continue;
-		}
+	ret = hid_read_batch(dev->fd, &batch);
+	if (ret < 0) {
+		g_print("%s: Read error: %d\n", dev->name, ret);
+		return;
+	}
 
-		ret = read(dev->fd, buf, sizeof(buf));
-		if (ret == -1) {
-			g_print("%s: Read error: %d\n", dev->name, errno);
-			continue;
-		}
-		if (ret != 45 || buf[0] != 0x01) {
+	for (i = 0; i < batch.num; i++) {
+		if (batch.len[i] != 45 || batch.buf[i][0] != 0x01) {
 			g_print("%s: Error, invalid %d-byte report 0x%02x\n",
-				dev->name, ret, buf[0]);
+				dev->name, batch.len[i], batch.buf[i][0]);
 			continue;
 		}
 
-		motion_controller_decode_message(self, buf, &ts);
+		motion_controller_decode_message(self, batch.buf[i], ts);
+	}
+}
+
+static void motion_controller_timeout(OuvrtDevice *dev)
+{
+	OuvrtMotionController *self = OUVRT_MOTION_CONTROLLER(dev);
+
+	if (!self->missing) {
+		g_print("%s: Device stopped sending\n", dev->name);
+		self->missing = true;
 	}
 }
 
@@ -206,6 +227,9 @@ static void motion_controller_stop(G_GNUC_UNUSED OuvrtDevice *dev)
  */
 static void ouvrt_motion_controller_finalize(GObject *object)
 {
+	OuvrtMotionController *self = OUVRT_MOTION_CONTROLLER(object);
+
+	pose_shm_free(self->pose_shm);
 	G_OBJECT_CLASS(ouvrt_motion_controller_parent_class)->finalize(object);
 }
 
@@ -214,8 +238,11 @@ ouvrt_motion_controller_class_init(OuvrtMotionControllerClass *klass)
 {
 	G_OBJECT_CLASS(klass)->finalize = ouvrt_motion_controller_finalize;
 	OUVRT_DEVICE_CLASS(klass)->start = motion_controller_start;
-	OUVRT_DEVICE_CLASS(klass)->thread = motion_controller_thread;
+	OUVRT_DEVICE_CLASS(klass)->dispatch = motion_controller_dispatch;
+	OUVRT_DEVICE_CLASS(klass)->timeout = motion_controller_timeout;
 	OUVRT_DEVICE_CLASS(klass)->stop = motion_controller_stop;
+	OUVRT_DEVICE_CLASS(klass)->sched_policy = SCHED_FIFO;
+	OUVRT_DEVICE_CLASS(klass)->sched_priority = 15;
 }
 
 static void ouvrt_motion_controller_init(OuvrtMotionController *self)
@@ -234,3 +261,12 @@ OuvrtDevice *motion_controller_new(G_GNUC_UNUSED const char *devnode)
 	return OUVRT_DEVICE(g_object_new(OUVRT_TYPE_MOTION_CONTROLLER,
 					 NULL));
 }
+
+/*
+ * Returns a file descriptor for the shared memory pose output of the motion
+ * controller, creating it on first use.
+ */
+int ouvrt_motion_controller_get_pose_fd(OuvrtMotionController *self)
+{
+	return pose_shm_open(&self->pose_shm);
+}
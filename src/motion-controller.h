@@ -16,5 +16,6 @@ G_DECLARE_FINAL_TYPE(OuvrtMotionController, ouvrt_motion_controller, \
 		     OUVRT, MOTION_CONTROLLER, OuvrtDevice)
 
 OuvrtDevice *motion_controller_new(const char *devnode);
+int ouvrt_motion_controller_get_pose_fd(OuvrtMotionController *self);
 
 #endif /* __MOTION_CONTROLLER_H__ */
@@ -32,6 +32,7 @@
 #define MT9V034_FINE_SHUTTER_WIDTH_TOTAL	0xd5
 
 #define MT9V034_ANALOG_GAIN_MIN			16
+#define MT9V034_ANALOG_GAIN_MAX			64
 
 #define MT9V034_CHIP_CONTROL_MASTER_MODE	(1 << 3)
 #define MT9V034_CHIP_CONTROL_SNAPSHOT_MODE	(3 << 3)
@@ -39,6 +40,8 @@
 #define MT9V034_CHIP_CONTROL_SEQUENTIAL		(1 << 8)
 
 #define MT9V032_READ_MODE_RESERVED		0x300
+#define MT9V034_READ_MODE_ROW_BIN_MASK		(3 << 0)
+#define MT9V034_READ_MODE_COLUMN_BIN_MASK	(3 << 2)
 #define MT9V034_READ_MODE_ROW_FLIP		(1 << 4)
 #define MT9V034_READ_MODE_COLUMN_FLIP		(1 << 5)
 
@@ -143,3 +146,64 @@ int mt9v034_sensor_disable_sync(int fd)
 
 	return 0;
 }
+
+/*
+ * Sets the integration time in number of rows, keeping the fine shutter
+ * width.
+ */
+int mt9v034_sensor_set_exposure(int fd, uint16_t rows)
+{
+	uint8_t addr = 0x4c << 1;
+
+	return i2c_write(fd, addr, MT9V034_COARSE_SHUTTER_WIDTH_TOTAL, rows);
+}
+
+/*
+ * Sets the analog gain in multiples of 1/16, between 1x and 4x.
+ */
+int mt9v034_sensor_set_gain(int fd, uint16_t gain)
+{
+	uint8_t addr = 0x4c << 1;
+
+	if (gain < MT9V034_ANALOG_GAIN_MIN || gain > MT9V034_ANALOG_GAIN_MAX)
+		return -EINVAL;
+
+	return i2c_write(fd, addr, MT9V034_ANALOG_GAIN, gain);
+}
+
+/*
+ * Enables 2x or 4x row and column binning, or disables binning if factor is
+ * 1. The window stays at full size, the output frame size and readout time
+ * are reduced by the binning factor in both directions.
+ */
+int mt9v034_sensor_set_binning(int fd, int factor)
+{
+	uint16_t read_mode;
+	uint8_t addr = 0x4c << 1;
+	int bin;
+	int ret;
+
+	switch (factor) {
+	case 1:
+		bin = 0;
+		break;
+	case 2:
+		bin = 1;
+		break;
+	case 4:
+		bin = 2;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ret = i2c_read(fd, addr, MT9V034_READ_MODE, &read_mode);
+	if (ret < 0)
+		return ret;
+
+	read_mode &= ~(MT9V034_READ_MODE_ROW_BIN_MASK |
+		       MT9V034_READ_MODE_COLUMN_BIN_MASK);
+	read_mode |= bin | (bin << 2);
+
+	return i2c_write(fd, addr, MT9V034_READ_MODE, read_mode);
+}
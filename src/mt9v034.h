@@ -6,8 +6,13 @@
 #ifndef __MT9V034_H__
 #define __MT9V034_H__
 
+#include <stdint.h>
+
 int mt9v034_sensor_setup(int fd);
 int mt9v034_sensor_enable_sync(int fd);
 int mt9v034_sensor_disable_sync(int fd);
+int mt9v034_sensor_set_exposure(int fd, uint16_t rows);
+int mt9v034_sensor_set_gain(int fd, uint16_t gain);
+int mt9v034_sensor_set_binning(int fd, int factor);
 
 #endif /* __MT9V034_H__ */
@@ -0,0 +1,517 @@
+/*
+ * Blob and corner detection using OpenCL
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Runs the per-pixel parts of blob and corner detection on the GPU: for
+ * blobs, collecting bright runs and their moments on each line, for corners,
+ * the FAST-9 segment test and the per cell maximum. Linking runs into blobs,
+ * and sorting and orienting the corners is left to the CPU, which only has
+ * to touch the compact results.
+ */
+#define CL_TARGET_OPENCL_VERSION 120
+#include <CL/cl.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "corners.h"
+#include "opencl.h"
+
+/* Number of frame buffers kept imported, V4L2 and USB queues use less */
+#define OPENCL_MAX_FRAMES	8
+
+static const char *opencl_source =
+"struct run {\n"
+"	ushort start;\n"
+"	ushort end;\n"
+"	uint w;\n"
+"	uint x;\n"
+"	uint reserved;\n"
+"	ulong xx;\n"
+"};\n"
+"\n"
+"/*\n"
+" * Collects runs of pixels brighter than the threshold on one line each,\n"
+" * dropping runs shorter than min_length like the CPU blob detector.\n"
+" */\n"
+"__kernel void find_runs(__global const uchar *frame, int width,\n"
+"			int max_runs, __global struct run *runs,\n"
+"			__global ushort *num_runs, uchar threshold,\n"
+"			int min_length)\n"
+"{\n"
+"	int y = get_global_id(0);\n"
+"	__global const uchar *line = frame + y * width;\n"
+"	__global struct run *r = runs + y * max_runs;\n"
+"	int n = 0;\n"
+"	int x = 0;\n"
+"\n"
+"	while (x < width && n < max_runs) {\n"
+"		ulong xx = 0;\n"
+"		uint w = 0;\n"
+"		uint sx = 0;\n"
+"		int start;\n"
+"\n"
+"		if (line[x] <= threshold) {\n"
+"			x++;\n"
+"			continue;\n"
+"		}\n"
+"\n"
+"		for (start = x; x < width && line[x] > threshold; x++) {\n"
+"			uint p = line[x] - threshold;\n"
+"\n"
+"			w += p;\n"
+"			sx += p * x;\n"
+"			xx += (ulong)(p * x) * x;\n"
+"		}\n"
+"		if (x - start < min_length)\n"
+"			continue;\n"
+"\n"
+"		r[n].start = start;\n"
+"		r[n].end = x - 1;\n"
+"		r[n].w = w;\n"
+"		r[n].x = sx;\n"
+"		r[n].reserved = 0;\n"
+"		r[n].xx = xx;\n"
+"		n++;\n"
+"	}\n"
+"\n"
+"	num_runs[y] = n;\n"
+"}\n"
+"\n"
+"__constant int2 circle[16] = {\n"
+"	(int2)(0, -3), (int2)(1, -3), (int2)(2, -2), (int2)(3, -1),\n"
+"	(int2)(3, 0), (int2)(3, 1), (int2)(2, 2), (int2)(1, 3),\n"
+"	(int2)(0, 3), (int2)(-1, 3), (int2)(-2, 2), (int2)(-3, 1),\n"
+"	(int2)(-3, 0), (int2)(-3, -1), (int2)(-2, -2), (int2)(-1, -3),\n"
+"};\n"
+"\n"
+"bool has_arc9(uint mask)\n"
+"{\n"
+"	mask |= mask << 16;\n"
+"	mask &= mask >> 1;\n"
+"	mask &= mask >> 2;\n"
+"	mask &= mask >> 4;\n"
+"	mask &= mask >> 1;\n"
+"\n"
+"	return mask != 0;\n"
+"}\n"
+"\n"
+"/*\n"
+" * Runs the FAST-9 segment test on one pixel each and keeps the packed\n"
+" * score and position of the best corner per cell.\n"
+" */\n"
+"__kernel void find_corners(__global const uchar *frame, int offset,\n"
+"			   int width, int height, int stride,\n"
+"			   int threshold, int cells_x,\n"
+"			   __global volatile uint *cells)\n"
+"{\n"
+"	int x = get_global_id(0);\n"
+"	int y = get_global_id(1);\n"
+"	__global const uchar *p;\n"
+"	uint bright = 0;\n"
+"	uint dark = 0;\n"
+"	int sum_bright = 0;\n"
+"	int sum_dark = 0;\n"
+"	int score;\n"
+"	int v, i;\n"
+"\n"
+"	if (x < 3 || y < 3 || x >= width - 3 || y >= height - 3)\n"
+"		return;\n"
+"\n"
+"	p = frame + offset + y * stride + x;\n"
+"	v = p[0];\n"
+"	for (i = 0; i < 16; i++) {\n"
+"		int c = p[circle[i].y * stride + circle[i].x];\n"
+"\n"
+"		if (c > v + threshold) {\n"
+"			bright |= 1 << i;\n"
+"			sum_bright += c - v - threshold;\n"
+"		} else if (c < v - threshold) {\n"
+"			dark |= 1 << i;\n"
+"			sum_dark += v - c - threshold;\n"
+"		}\n"
+"	}\n"
+"\n"
+"	if (!has_arc9(bright))\n"
+"		sum_bright = 0;\n"
+"	if (!has_arc9(dark))\n"
+"		sum_dark = 0;\n"
+"	score = max(sum_bright, sum_dark);\n"
+"	if (!score)\n"
+"		return;\n"
+"\n"
+"	atomic_max(&cells[(y / CELL_SIZE) * cells_x + x / CELL_SIZE],\n"
+"		   (uint)score << 8 | (255 - (y % CELL_SIZE * CELL_SIZE +\n"
+"					     x % CELL_SIZE)));\n"
+"}\n";
+
+/*
+ * Frame buffer imported into the OpenCL context without copying
+ */
+struct opencl_frame {
+	const uint8_t *ptr;
+	size_t size;
+	cl_mem mem;
+};
+
+struct opencl_compute {
+	cl_context context;
+	cl_command_queue queue;
+	cl_program program;
+	cl_kernel find_runs;
+	cl_kernel find_corners;
+	int width;
+	int height;
+	cl_mem runs;
+	cl_mem num_runs;
+	cl_mem cells;
+	size_t max_cells;
+	struct opencl_frame frames[OPENCL_MAX_FRAMES];
+	int next_frame;
+};
+
+/* if set, frame processing is offloaded to the GPU where supported */
+static bool opencl_enabled;
+
+/*
+ * Enables GPU offload for cameras that are added afterwards.
+ */
+void opencl_compute_set_enabled(bool enabled)
+{
+	opencl_enabled = enabled;
+}
+
+bool opencl_compute_enabled(void)
+{
+	return opencl_enabled;
+}
+
+/*
+ * Returns the first GPU device of any platform.
+ */
+static int opencl_get_device(cl_device_id *device)
+{
+	cl_platform_id platforms[4];
+	cl_uint num_platforms;
+	cl_int err;
+	cl_uint i;
+
+	err = clGetPlatformIDs(G_N_ELEMENTS(platforms), platforms,
+			       &num_platforms);
+	if (err != CL_SUCCESS)
+		return -ENODEV;
+
+	num_platforms = MIN(num_platforms, G_N_ELEMENTS(platforms));
+	for (i = 0; i < num_platforms; i++) {
+		err = clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU, 1,
+				     device, NULL);
+		if (err == CL_SUCCESS)
+			return 0;
+	}
+
+	return -ENODEV;
+}
+
+static int opencl_build_program(struct opencl_compute *cl,
+				cl_device_id device)
+{
+	char options[32];
+	char *log;
+	size_t len;
+	cl_int err;
+
+	cl->program = clCreateProgramWithSource(cl->context, 1, &opencl_source,
+						NULL, &err);
+	if (err != CL_SUCCESS)
+		return -ENOMEM;
+
+	snprintf(options, sizeof(options), "-DCELL_SIZE=%d", CORNER_CELL_SIZE);
+	err = clBuildProgram(cl->program, 1, &device, options, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		clGetProgramBuildInfo(cl->program, device, CL_PROGRAM_BUILD_LOG,
+				      0, NULL, &len);
+		log = g_malloc0(len + 1);
+		clGetProgramBuildInfo(cl->program, device, CL_PROGRAM_BUILD_LOG,
+				      len, log, NULL);
+		g_print("OpenCL: Failed to build program: %d\n%s\n", err, log);
+		g_free(log);
+		return -EINVAL;
+	}
+
+	cl->find_runs = clCreateKernel(cl->program, "find_runs", &err);
+	if (err != CL_SUCCESS)
+		return -EINVAL;
+	cl->find_corners = clCreateKernel(cl->program, "find_corners", &err);
+	if (err != CL_SUCCESS)
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Creates a compute context on the first GPU, for frames of width x height
+ * 8-bit grayscale pixels.
+ *
+ * Returns NULL if there is no usable OpenCL device.
+ */
+struct opencl_compute *opencl_compute_new(int width, int height)
+{
+	struct opencl_compute *cl;
+	cl_device_id device;
+	cl_int err;
+
+	if (opencl_get_device(&device) < 0) {
+		g_print("OpenCL: No GPU device found\n");
+		return NULL;
+	}
+
+	cl = g_new0(struct opencl_compute, 1);
+	cl->width = width;
+	cl->height = height;
+
+	cl->context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+	if (err != CL_SUCCESS)
+		goto err_free;
+	cl->queue = clCreateCommandQueue(cl->context, device, 0, &err);
+	if (err != CL_SUCCESS)
+		goto err_free;
+	if (opencl_build_program(cl, device) < 0)
+		goto err_free;
+
+	/* Results are mapped for reading, which is free on shared memory */
+	cl->runs = clCreateBuffer(cl->context,
+				  CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+				  height * OPENCL_MAX_RUNS_PER_LINE *
+				  sizeof(struct blobwatch_run), NULL, &err);
+	if (err != CL_SUCCESS)
+		goto err_free;
+	cl->num_runs = clCreateBuffer(cl->context,
+				      CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+				      height * sizeof(uint16_t), NULL, &err);
+	if (err != CL_SUCCESS)
+		goto err_free;
+	cl->max_cells = ((width + CORNER_CELL_SIZE - 1) / CORNER_CELL_SIZE) *
+			((height + CORNER_CELL_SIZE - 1) / CORNER_CELL_SIZE);
+	cl->cells = clCreateBuffer(cl->context,
+				   CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+				   cl->max_cells * sizeof(uint32_t), NULL, &err);
+	if (err != CL_SUCCESS)
+		goto err_free;
+
+	return cl;
+
+err_free:
+	g_print("OpenCL: Failed to initialize compute context: %d\n", err);
+	opencl_compute_free(cl);
+	return NULL;
+}
+
+void opencl_compute_free(struct opencl_compute *cl)
+{
+	int i;
+
+	if (!cl)
+		return;
+
+	for (i = 0; i < OPENCL_MAX_FRAMES; i++) {
+		if (cl->frames[i].mem)
+			clReleaseMemObject(cl->frames[i].mem);
+	}
+	if (cl->cells)
+		clReleaseMemObject(cl->cells);
+	if (cl->num_runs)
+		clReleaseMemObject(cl->num_runs);
+	if (cl->runs)
+		clReleaseMemObject(cl->runs);
+	if (cl->find_corners)
+		clReleaseKernel(cl->find_corners);
+	if (cl->find_runs)
+		clReleaseKernel(cl->find_runs);
+	if (cl->program)
+		clReleaseProgram(cl->program);
+	if (cl->queue)
+		clReleaseCommandQueue(cl->queue);
+	if (cl->context)
+		clReleaseContext(cl->context);
+	g_free(cl);
+}
+
+/*
+ * Returns the buffer object wrapping the frame memory. Frames are received
+ * into a fixed set of page aligned buffers, so the buffer objects are created
+ * once per frame buffer and reused. The map/unmap pair makes the new frame
+ * contents visible to the device, which does not copy if the device shares
+ * memory with the CPU.
+ */
+static cl_mem opencl_import_frame(struct opencl_compute *cl,
+				  const uint8_t *frame, size_t size)
+{
+	struct opencl_frame *f = NULL;
+	cl_int err;
+	void *ptr;
+	int i;
+
+	for (i = 0; i < OPENCL_MAX_FRAMES; i++) {
+		if (cl->frames[i].ptr == frame && cl->frames[i].size == size) {
+			f = &cl->frames[i];
+			break;
+		}
+	}
+
+	if (!f) {
+		f = &cl->frames[cl->next_frame];
+		cl->next_frame = (cl->next_frame + 1) % OPENCL_MAX_FRAMES;
+		if (f->mem)
+			clReleaseMemObject(f->mem);
+		f->ptr = frame;
+		f->size = size;
+		f->mem = clCreateBuffer(cl->context,
+					CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+					size, (void *)frame, &err);
+		if (err != CL_SUCCESS) {
+			f->ptr = NULL;
+			f->mem = NULL;
+			return NULL;
+		}
+	}
+
+	ptr = clEnqueueMapBuffer(cl->queue, f->mem, CL_TRUE, CL_MAP_WRITE, 0,
+				 size, 0, NULL, NULL, &err);
+	if (err != CL_SUCCESS)
+		return NULL;
+	clEnqueueUnmapMemObject(cl->queue, f->mem, ptr, 0, NULL, NULL);
+
+	return f->mem;
+}
+
+/*
+ * Collects the bright runs on all lines of the frame. runs must be able to
+ * hold OPENCL_MAX_RUNS_PER_LINE entries per line, of which the first
+ * num_runs[y] are stored for line y, to be passed to blobwatch_process_runs().
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int opencl_compute_find_runs(struct opencl_compute *cl, const uint8_t *frame,
+			     size_t size, uint8_t threshold, int min_length,
+			     struct blobwatch_run *runs, uint16_t *num_runs)
+{
+	size_t global_size = cl->height;
+	cl_int max_runs = OPENCL_MAX_RUNS_PER_LINE;
+	cl_int width = cl->width;
+	struct blobwatch_run *mapped_runs;
+	uint16_t *mapped_num;
+	cl_mem mem;
+	cl_int err;
+	int y;
+
+	if (size < (size_t)cl->width * cl->height)
+		return -EINVAL;
+
+	mem = opencl_import_frame(cl, frame, size);
+	if (!mem)
+		return -ENOMEM;
+
+	clSetKernelArg(cl->find_runs, 0, sizeof(cl_mem), &mem);
+	clSetKernelArg(cl->find_runs, 1, sizeof(cl_int), &width);
+	clSetKernelArg(cl->find_runs, 2, sizeof(cl_int), &max_runs);
+	clSetKernelArg(cl->find_runs, 3, sizeof(cl_mem), &cl->runs);
+	clSetKernelArg(cl->find_runs, 4, sizeof(cl_mem), &cl->num_runs);
+	clSetKernelArg(cl->find_runs, 5, sizeof(cl_uchar), &threshold);
+	clSetKernelArg(cl->find_runs, 6, sizeof(cl_int), &min_length);
+	err = clEnqueueNDRangeKernel(cl->queue, cl->find_runs, 1, NULL,
+				     &global_size, NULL, 0, NULL, NULL);
+	if (err != CL_SUCCESS)
+		return -EIO;
+
+	mapped_num = clEnqueueMapBuffer(cl->queue, cl->num_runs, CL_FALSE,
+					CL_MAP_READ, 0,
+					cl->height * sizeof(uint16_t), 0,
+					NULL, NULL, &err);
+	if (err != CL_SUCCESS)
+		return -EIO;
+	mapped_runs = clEnqueueMapBuffer(cl->queue, cl->runs, CL_TRUE,
+					 CL_MAP_READ, 0, cl->height *
+					 OPENCL_MAX_RUNS_PER_LINE *
+					 sizeof(struct blobwatch_run), 0,
+					 NULL, NULL, &err);
+	if (err != CL_SUCCESS) {
+		clEnqueueUnmapMemObject(cl->queue, cl->num_runs, mapped_num,
+					0, NULL, NULL);
+		return -EIO;
+	}
+
+	/* Only copy the valid runs of each line */
+	memcpy(num_runs, mapped_num, cl->height * sizeof(uint16_t));
+	for (y = 0; y < cl->height; y++) {
+		int offset = y * OPENCL_MAX_RUNS_PER_LINE;
+
+		memcpy(runs + offset, mapped_runs + offset,
+		       num_runs[y] * sizeof(struct blobwatch_run));
+	}
+
+	clEnqueueUnmapMemObject(cl->queue, cl->runs, mapped_runs, 0, NULL,
+				NULL);
+	clEnqueueUnmapMemObject(cl->queue, cl->num_runs, mapped_num, 0, NULL,
+				NULL);
+
+	return 0;
+}
+
+/*
+ * Runs the FAST-9 segment test on a width x height view starting at offset
+ * bytes into the frame, with lines stride bytes apart. The best corner per
+ * cell is stored in cells as CORNER_CELL_PACK() value, in the format expected
+ * by corner_detector_process_cells().
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int opencl_compute_find_corners(struct opencl_compute *cl,
+				const uint8_t *frame, size_t size,
+				int offset, int width, int height, int stride,
+				uint8_t threshold, uint32_t *cells)
+{
+	size_t global_size[2] = { width, height };
+	cl_int cells_x = (width + CORNER_CELL_SIZE - 1) / CORNER_CELL_SIZE;
+	cl_int cells_y = (height + CORNER_CELL_SIZE - 1) / CORNER_CELL_SIZE;
+	size_t num_cells = cells_x * cells_y;
+	cl_int t = threshold;
+	cl_uint zero = 0;
+	cl_mem mem;
+	cl_int err;
+
+	if (num_cells > cl->max_cells ||
+	    (size_t)offset + (size_t)(height - 1) * stride + width > size)
+		return -EINVAL;
+
+	mem = opencl_import_frame(cl, frame, size);
+	if (!mem)
+		return -ENOMEM;
+
+	err = clEnqueueFillBuffer(cl->queue, cl->cells, &zero, sizeof(zero),
+				  0, num_cells * sizeof(uint32_t), 0, NULL,
+				  NULL);
+	if (err != CL_SUCCESS)
+		return -EIO;
+
+	clSetKernelArg(cl->find_corners, 0, sizeof(cl_mem), &mem);
+	clSetKernelArg(cl->find_corners, 1, sizeof(cl_int), &offset);
+	clSetKernelArg(cl->find_corners, 2, sizeof(cl_int), &width);
+	clSetKernelArg(cl->find_corners, 3, sizeof(cl_int), &height);
+	clSetKernelArg(cl->find_corners, 4, sizeof(cl_int), &stride);
+	clSetKernelArg(cl->find_corners, 5, sizeof(cl_int), &t);
+	clSetKernelArg(cl->find_corners, 6, sizeof(cl_int), &cells_x);
+	clSetKernelArg(cl->find_corners, 7, sizeof(cl_mem), &cl->cells);
+	err = clEnqueueNDRangeKernel(cl->queue, cl->find_corners, 2, NULL,
+				     global_size, NULL, 0, NULL, NULL);
+	if (err != CL_SUCCESS)
+		return -EIO;
+
+	err = clEnqueueReadBuffer(cl->queue, cl->cells, CL_TRUE, 0,
+				  num_cells * sizeof(uint32_t), cells, 0, NULL,
+				  NULL);
+	if (err != CL_SUCCESS)
+		return -EIO;
+
+	return 0;
+}
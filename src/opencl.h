@@ -0,0 +1,95 @@
+/*
+ * Blob and corner detection using OpenCL
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __OPENCL_H__
+#define __OPENCL_H__
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blobwatch.h"
+
+/* Maximum number of bright runs collected per line by the GPU */
+#define OPENCL_MAX_RUNS_PER_LINE	32
+
+struct opencl_compute;
+
+#if HAVE_OPENCL
+void opencl_compute_set_enabled(bool enabled);
+bool opencl_compute_enabled(void);
+struct opencl_compute *opencl_compute_new(int width, int height);
+void opencl_compute_free(struct opencl_compute *cl);
+int opencl_compute_find_runs(struct opencl_compute *cl, const uint8_t *frame,
+			     size_t size, uint8_t threshold, int min_length,
+			     struct blobwatch_run *runs, uint16_t *num_runs);
+int opencl_compute_find_corners(struct opencl_compute *cl,
+				const uint8_t *frame, size_t size,
+				int offset, int width, int height, int stride,
+				uint8_t threshold, uint32_t *cells);
+#else
+static inline void opencl_compute_set_enabled(bool enabled)
+{
+	(void)enabled;
+}
+
+static inline bool opencl_compute_enabled(void)
+{
+	return false;
+}
+
+static inline struct opencl_compute *opencl_compute_new(int width, int height)
+{
+	(void)width;
+	(void)height;
+
+	return NULL;
+}
+
+static inline void opencl_compute_free(struct opencl_compute *cl)
+{
+	(void)cl;
+}
+
+static inline int opencl_compute_find_runs(struct opencl_compute *cl,
+					   const uint8_t *frame, size_t size,
+					   uint8_t threshold, int min_length,
+					   struct blobwatch_run *runs,
+					   uint16_t *num_runs)
+{
+	(void)cl;
+	(void)frame;
+	(void)size;
+	(void)threshold;
+	(void)min_length;
+	(void)runs;
+	(void)num_runs;
+
+	return -ENOSYS;
+}
+
+static inline int opencl_compute_find_corners(struct opencl_compute *cl,
+					      const uint8_t *frame,
+					      size_t size, int offset,
+					      int width, int height,
+					      int stride, uint8_t threshold,
+					      uint32_t *cells)
+{
+	(void)cl;
+	(void)frame;
+	(void)size;
+	(void)offset;
+	(void)width;
+	(void)height;
+	(void)stride;
+	(void)threshold;
+	(void)cells;
+
+	return -ENOSYS;
+}
+#endif /* HAVE_OPENCL */
+
+#endif /* __OPENCL_H__ */
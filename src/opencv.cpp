@@ -11,6 +11,7 @@ extern "C" {
 #include "blobwatch.h"
 #include "leds.h"
 #include "maths.h"
+#include "trace.h"
 }
 
 
@@ -26,7 +27,7 @@ extern "C" void estimate_initial_pose(struct blob *blobs, int num_blobs,
 	int flags = CV_ITERATIVE;
 	cv::Mat inliers;
 	int iterationsCount = 50;
-	float reprojectionError = 1.0;
+	float reprojectionError = 0.5;
 	float confidence = 0.95;
 	cv::Mat A = cv::Mat(3, 3, CV_64FC1, camera_matrix->m);
 	cv::Mat distCoeffs = cv::Mat(5, 1, CV_64FC1, dist_coeffs);
@@ -61,15 +62,19 @@ extern "C" void estimate_initial_pose(struct blob *blobs, int num_blobs,
 		list_points3d[j].x = leds[blobs[i].led_id].x;
 		list_points3d[j].y = leds[blobs[i].led_id].y;
 		list_points3d[j].z = leds[blobs[i].led_id].z;
-		list_points2d[j].x = blobs[i].x;
-		list_points2d[j].y = blobs[i].y;
+		list_points2d[j].x = blobs[i].cx;
+		list_points2d[j].y = blobs[i].cy;
 		j++;
 	}
 
+	OUVRT_TRACE2(estimate_initial_pose_enter, num_blobs, num_leds);
+
 	cv::solvePnPRansac(list_points3d, list_points2d, A, distCoeffs, rvec, tvec,
 			   use_extrinsic_guess, iterationsCount, reprojectionError,
 			   confidence, inliers, flags);
 
+	OUVRT_TRACE1(estimate_initial_pose_exit, inliers.rows);
+
 	dvec3 v;
 	double angle = sqrt(rvec.dot(rvec));
 	double inorm = 1.0f / angle;
@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <getopt.h>
 #include <glib.h>
+#include <glib-unix.h>
 #include <gio/gio.h>
 #include <libudev.h>
 #include <locale.h>
@@ -15,19 +16,32 @@
 #include <stdlib.h>
 #include <sys/fcntl.h>
 
+#include "cache.h"
 #include "dbus.h"
 #include "debug.h"
 #include "device.h"
+#include "frame-queue.h"
 #include "usb-ids.h"
 #include "psvr.h"
+#include "reactor.h"
+#include "recording.h"
+#include "remote-camera.h"
+#include "replay.h"
 #include "rift.h"
 #include "rift-sensor.h"
+#include "stats.h"
 #include "camera-dk2.h"
 #include "hololens-camera.h"
 #include "hololens-imu.h"
+#include "latency-probe.h"
 #include "motion-controller.h"
 #include "lenovo-explorer.h"
+#include "log.h"
+#include "opencl.h"
 #include "telemetry.h"
+#include "telemetry-shm.h"
+#include "tracker.h"
+#include "usb-device.h"
 #include "vive-headset.h"
 #include "vive-headset-mainboard.h"
 #include "vive-controller.h"
@@ -154,6 +168,10 @@ static const struct device_match device_matches[NUM_MATCHES] = {
 GMainLoop *loop = NULL;
 GList *device_list = NULL;
 static int num_devices;
+static int num_starting;
+/* tracker of the local cameras in remote camera node mode */
+static OuvrtTracker *remote_node_tracker;
+static gint64 start_time;
 
 /*
  * Compares the device's parent against a given parent.
@@ -251,6 +269,66 @@ static void ouvrt_link_rift_cv1(OuvrtDevice *dev)
 	}
 }
 
+/*
+ * In remote camera node mode, lets all local cameras detect and track blobs
+ * with a common tracker, to send them to the central tracker. Otherwise
+ * feeds blobs received from remote cameras into the tracker of the Rift.
+ *
+ * Returns TRUE if the device was linked as a remote camera.
+ */
+static gboolean ouvrt_link_remote(OuvrtDevice *dev)
+{
+	if (!remote_camera_enabled()) {
+		if (OUVRT_IS_RIFT(dev))
+			remote_camera_server_set_tracker(
+				ouvrt_rift_get_tracker(OUVRT_RIFT(dev)));
+		return FALSE;
+	}
+
+	if (!remote_node_tracker)
+		remote_node_tracker = ouvrt_tracker_new();
+
+	if (OUVRT_IS_RIFT_SENSOR(dev)) {
+		ouvrt_rift_sensor_set_tracker(OUVRT_RIFT_SENSOR(dev),
+					      remote_node_tracker);
+	} else if (OUVRT_IS_CAMERA_DK2(dev)) {
+		ouvrt_camera_dk2_set_tracker(OUVRT_CAMERA_DK2(dev),
+					     remote_node_tracker);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Reports a device that finished starting in the background via D-Bus, and
+ * the total start time once all pending devices are running.
+ */
+static void ouvrtd_device_started(OuvrtDevice *dev, int ret,
+				  G_GNUC_UNUSED gpointer user_data)
+{
+	if (ret < 0)
+		g_print("%s: Failed to start: %d\n", dev->name, ret);
+	else
+		ouvrt_dbus_device_ready(dev);
+
+	if (--num_starting == 0) {
+		g_print("ouvrtd: All devices started in %.3f s\n",
+			(g_get_monotonic_time() - start_time) * 1e-6);
+	}
+}
+
+/*
+ * Starts the device on a worker thread, so that multiple devices reading
+ * their configuration start concurrently.
+ */
+static void ouvrtd_device_start(OuvrtDevice *dev)
+{
+	if (num_starting++ == 0)
+		start_time = g_get_monotonic_time();
+
+	ouvrt_device_start_async(dev, ouvrtd_device_started, NULL);
+}
+
 /*
  * Check if an added device matches the table of known hardware, if yes create
  * a new device structure and start the device.
@@ -407,7 +485,7 @@ static void ouvrtd_device_add(struct udev_device *dev)
 					break;
 			}
 			if (j == device_matches[i].num_interfaces)
-				ouvrt_device_start(d);
+				ouvrtd_device_start(d);
 
 			return;
 		}
@@ -432,21 +510,23 @@ static void ouvrtd_device_add(struct udev_device *dev)
 		if (serial)
 			d->serial = strdup(serial);
 	}
-	if (d->serial) {
+	if (d->serial)
 		g_print("%s: Serial %s\n", device_matches[i].name, d->serial);
 
-		ouvrt_link_rift_dk2(d);
+	if (!ouvrt_link_remote(d)) {
+		if (d->serial)
+			ouvrt_link_rift_dk2(d);
+		ouvrt_link_rift_cv1(d);
 	}
 
-	ouvrt_link_rift_cv1(d);
-
 	device_list = g_list_append(device_list, d);
+	ouvrt_dbus_export_device(d);
 
 	for (j = 0; j < device_matches[i].num_interfaces; j++)
 		if (d->devnodes[j] == NULL)
 			break;
 	if (j == device_matches[i].num_interfaces)
-		ouvrt_device_start(d);
+		ouvrtd_device_start(d);
 }
 
 /*
@@ -474,6 +554,8 @@ static int ouvrtd_device_remove(struct udev_device *dev)
 
 	g_print("Removing device: %s\n", devnode);
 	device_list = g_list_remove_link(device_list, link);
+	ouvrt_device_set_removed(OUVRT_DEVICE(link->data));
+	ouvrt_dbus_unexport_device(OUVRT_DEVICE(link->data));
 	g_object_unref(OUVRT_DEVICE(link->data));
 	g_list_free_1(link);
 	num_devices--;
@@ -607,6 +689,69 @@ static void ouvrtd_startup(struct udev *udev)
 	g_source_unref(&source->base);
 }
 
+/*
+ * Creates the device for a recorded HID device and attaches it to the
+ * replay instead of its hidraw device nodes.
+ */
+static void ouvrtd_replay_device_add(gpointer data, gpointer user_data)
+{
+	OuvrtReplay *replay = user_data;
+	const char *name = data;
+	const char *subsystem;
+	OuvrtDevice *d;
+	int i;
+
+	for (i = 0; i < NUM_MATCHES; i++) {
+		subsystem = device_matches[i].num_interfaces ?
+			    device_matches[i].interfaces[0].subsystem :
+			    device_matches[i].subsystem;
+		if (g_strcmp0(subsystem, "hidraw") == 0 &&
+		    g_strcmp0(device_matches[i].name, name) == 0)
+			break;
+	}
+	if (i == NUM_MATCHES) {
+		g_print("Replay: No driver for %s\n", name);
+		return;
+	}
+
+	d = device_matches[i].new(NULL);
+	if (d == NULL)
+		return;
+	if (d->name == NULL)
+		d->name = strdup(device_matches[i].name);
+
+	if (ouvrt_replay_attach(replay, d) < 0) {
+		g_object_unref(d);
+		return;
+	}
+
+	if (!ouvrt_link_remote(d))
+		ouvrt_link_rift_cv1(d);
+
+	device_list = g_list_append(device_list, d);
+	ouvrt_device_start(d);
+}
+
+/*
+ * Replays a recorded session through the device drivers instead of
+ * monitoring the connected hardware.
+ */
+static int ouvrtd_replay(const char *path, gboolean max_speed)
+{
+	OuvrtDevice *replay;
+
+	replay = replay_new(path, max_speed);
+	if (!replay)
+		return -EINVAL;
+
+	ouvrt_replay_foreach_device(OUVRT_REPLAY(replay),
+				    ouvrtd_replay_device_add, replay);
+
+	device_list = g_list_append(device_list, replay);
+
+	return ouvrt_device_start(replay);
+}
+
 static void device_stop(gpointer data, G_GNUC_UNUSED gpointer user_data)
 {
 	ouvrt_device_stop(data);
@@ -623,15 +768,70 @@ static void ouvrtd_signal_handler(int sig)
 	g_main_loop_quit(loop);
 }
 
+/*
+ * Prints all latency histograms and frame queue counters on SIGUSR1.
+ */
+static gboolean ouvrtd_dump_stats(G_GNUC_UNUSED gpointer user_data)
+{
+	stats_dump();
+	frame_queue_dump();
+
+	return G_SOURCE_CONTINUE;
+}
+
 static void ouvrtd_usage(void)
 {
 	g_print("ouvrtd [OPTIONS...] ...\n\n"
 		"Positional tracking daemon for Oculus VR Rift DK2.\n\n"
-		"  -h --help          Show this help\n");
+		"  -b --dk2-binning   Capture 2x binned DK2 camera frames at 120 Hz\n"
+		"  -c --compact       Use the compact telemetry encoding\n"
+		"  -d --on-demand     Only track while a client acquired the tracker\n"
+		"  -D --debug-crop    Only send thumbnails and blob windows to the\n"
+		"                     debug stream\n"
+		"  -g --gpu-compute   Offload blob and corner detection to the GPU\n"
+		"  -h --help          Show this help\n"
+		"  -l --measure-latency Measure motion-to-photon latency by blinking\n"
+		"                     the tracking LEDs\n"
+		"  -m --max-speed     Replay as fast as possible\n"
+		"  -n --remote-tracker=HOST[:PORT] Run as remote camera node,\n"
+		"                     sending blobs to the tracker at HOST\n"
+		"  -N --remote-cameras[=[HOST:]PORT] Receive blobs from remote\n"
+		"                     camera nodes on UDP address HOST:PORT,\n"
+		"                     localhost only unless HOST is given\n"
+		"  -p --replay=FILE   Replay recorded HID devices from FILE,\n"
+		"                     without camera frames\n"
+		"  -P --psvr-transfers=N Keep N PSVR sensor transfers in flight\n"
+		"  -q --queue-policy=POLICY Handle frames the tracker can not keep up\n"
+		"                     with: drop-oldest (default), drop-newest,\n"
+		"                     or block, which USB cameras treat as\n"
+		"                     drop-oldest\n"
+		"  -r --reactors=N    Dispatch HID reports from N shared threads\n"
+		"  -R --record=FILE   Record raw sensor data into FILE\n"
+		"  -S --record-sparse Only record bright pixel runs of greyscale\n"
+		"                     frames, with periodic full keyframes\n"
+		"  -t --telemetry-shm Write telemetry into a shared memory ring\n"
+		"  -u --usb-threads=N Handle USB transfers in N shared threads\n");
 }
 
 static const struct option ouvrtd_options[] = {
+	{ "compact", no_argument, NULL, 'c' },
+	{ "debug-crop", no_argument, NULL, 'D' },
+	{ "dk2-binning", no_argument, NULL, 'b' },
+	{ "gpu-compute", no_argument, NULL, 'g' },
 	{ "help", no_argument, NULL, 'h' },
+	{ "max-speed", no_argument, NULL, 'm' },
+	{ "measure-latency", no_argument, NULL, 'l' },
+	{ "on-demand", no_argument, NULL, 'd' },
+	{ "psvr-transfers", required_argument, NULL, 'P' },
+	{ "queue-policy", required_argument, NULL, 'q' },
+	{ "reactors", required_argument, NULL, 'r' },
+	{ "record", required_argument, NULL, 'R' },
+	{ "record-sparse", no_argument, NULL, 'S' },
+	{ "remote-cameras", optional_argument, NULL, 'N' },
+	{ "remote-tracker", required_argument, NULL, 'n' },
+	{ "replay", required_argument, NULL, 'p' },
+	{ "telemetry-shm", no_argument, NULL, 't' },
+	{ "usb-threads", required_argument, NULL, 'u' },
 	{ NULL }
 };
 
@@ -643,19 +843,92 @@ int main(int argc, char *argv[])
 {
 	struct udev *udev;
 	guint owner_id;
+	int num_reactors = 0;
+	gboolean telemetry_shm = FALSE;
+	const char *record = NULL;
+	const char *replay = NULL;
+	gboolean max_speed = FALSE;
+	gboolean remote_cameras = FALSE;
+	const char *remote_address = NULL;
 	int longind;
 	int ret;
 
 	setlocale(LC_CTYPE, "");
 
 	debug_stream_init(&argc, &argv);
-	telemetry_init(&argc, &argv);
 
 	do {
-		ret = getopt_long(argc, argv, "h", ouvrtd_options, &longind);
+		ret = getopt_long(argc, argv, "bcdDghlmn:N::p:P:q:r:R:Stu:", ouvrtd_options,
+				  &longind);
 		switch (ret) {
 		case -1:
 			break;
+		case 'b':
+			camera_dk2_set_binning(2);
+			break;
+		case 'c':
+			telemetry_set_compact(true);
+			break;
+		case 'd':
+			ouvrt_tracker_set_on_demand(true);
+			break;
+		case 'D':
+			debug_stream_set_crop(true);
+			break;
+		case 'g':
+#if HAVE_OPENCL
+			opencl_compute_set_enabled(true);
+#else
+			g_print("ouvrtd: Built without OpenCL support\n");
+#endif
+			break;
+		case 'l':
+			latency_probe_set_enabled(true);
+			break;
+		case 'm':
+			max_speed = TRUE;
+			break;
+		case 'n':
+			if (remote_camera_set_server(optarg) < 0) {
+				g_print("ouvrtd: Invalid remote tracker: %s\n",
+					optarg);
+				exit(1);
+			}
+			break;
+		case 'N':
+			remote_cameras = TRUE;
+			remote_address = optarg;
+			break;
+		case 'p':
+			replay = optarg;
+			break;
+		case 'P':
+			ouvrt_psvr_set_num_sensor_transfers(atoi(optarg));
+			break;
+		case 'q':
+			ret = frame_queue_parse_policy(optarg);
+			if (ret < 0) {
+				g_print("ouvrtd: Unknown queue policy: %s\n",
+					optarg);
+				exit(1);
+			}
+			frame_queue_set_default_policy(ret);
+			break;
+		case 'r':
+			num_reactors = atoi(optarg);
+			break;
+		case 'R':
+			record = optarg;
+			break;
+		case 'S':
+			recording_set_sparse_frames(true);
+			break;
+		case 't':
+			telemetry_shm = TRUE;
+			break;
+		case 'u':
+			ouvrt_usb_device_set_num_event_threads(atoi(optarg));
+			break;
 		case 'h':
 		default:
 			ouvrtd_usage();
@@ -663,21 +936,61 @@ int main(int argc, char *argv[])
 		}
 	} while (ret != -1);
 
+	if (telemetry_shm) {
+		ret = telemetry_shm_init(TELEMETRY_RING_DEFAULT_SIZE);
+		if (ret < 0)
+			g_print("ouvrtd: Failed to create telemetry ring: %d\n",
+				ret);
+	} else {
+		telemetry_init(&argc, &argv);
+	}
+
 	signal(SIGINT, ouvrtd_signal_handler);
+	g_unix_signal_add(SIGUSR1, ouvrtd_dump_stats, NULL);
 
 	udev = udev_new();
 	if (!udev)
 		return -1;
 
 	loop = g_main_loop_new(NULL, TRUE);
+	log_init();
 	owner_id = ouvrt_dbus_own_name();
 
-	ouvrtd_startup(udev);
+	if (record) {
+		ret = recording_start(record);
+		if (ret < 0)
+			g_print("ouvrtd: Failed to start recording: %d\n", ret);
+	}
+
+	if (remote_cameras) {
+		ret = remote_camera_server_start(remote_address);
+		if (ret < 0)
+			g_print("ouvrtd: Failed to receive remote cameras: %d\n",
+				ret);
+	}
+
+	reactor_init(num_reactors);
+	if (replay) {
+		ret = ouvrtd_replay(replay, max_speed);
+		if (ret < 0)
+			g_print("ouvrtd: Failed to replay %s: %d\n", replay, ret);
+	} else {
+		ouvrtd_startup(udev);
+	}
 	g_main_loop_run(loop);
 
+	/* Write the cache files queued by the stopped devices */
+	ouvrt_cache_flush();
+
 	g_bus_unown_name(owner_id);
 	udev_unref(udev);
 	g_main_loop_unref(loop);
+	reactor_deinit();
+	remote_camera_server_stop();
+	g_clear_object(&remote_node_tracker);
+	recording_stop();
+	log_deinit();
+	telemetry_shm_deinit();
 	telemetry_deinit();
 	debug_stream_deinit();
 
@@ -0,0 +1,720 @@
+/*
+ * Perspective-n-Point pose estimation
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Pose hypotheses are generated from random minimal sets of three
+ * correspondences using Grunert's P3P solution, and the best hypothesis is
+ * refined with Levenberg-Marquardt over all inliers. All data lives in fixed
+ * size arrays, nothing is allocated.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "blobwatch.h"
+#include "maths.h"
+#include "pnp.h"
+#include "trace.h"
+
+#define PNP_RANSAC_ITERATIONS		50
+#define PNP_REPROJECTION_ERROR		1.0
+#define PNP_CONFIDENCE			1.0
+#define PNP_REFINE_ITERATIONS		10
+#define PNP_GUESS_REFINE_ITERATIONS	5
+
+const struct pnp_params pnp_default_params = {
+	.ransac_iterations = PNP_RANSAC_ITERATIONS,
+	.reprojection_error = PNP_REPROJECTION_ERROR,
+	.confidence = PNP_CONFIDENCE,
+};
+
+/*
+ * Converts a distorted pixel position into normalized, undistorted image
+ * coordinates.
+ */
+static void undistort_point(const dmat3 *camera_matrix,
+			    const struct distortion *distortion, double u,
+			    double v, double *xn, double *yn)
+{
+	const double fx = camera_matrix->m[0];
+	const double cx = camera_matrix->m[2];
+	const double fy = camera_matrix->m[4];
+	const double cy = camera_matrix->m[5];
+
+	distortion_undistort(distortion, (u - cx) / fx, (v - cy) / fy, xn, yn);
+}
+
+/*
+ * Collects the correspondences between blobs identified as LEDs of the given
+ * object and their LED positions. Each LED is used only once.
+ *
+ * Returns the number of correspondences.
+ */
+int pnp_problem_init(struct pnp_problem *pnp, struct blob *blobs,
+		     int num_blobs, int object_id, vec3 *leds, int num_leds,
+		     dmat3 *camera_matrix,
+		     const struct distortion *distortion)
+{
+	uint64_t taken[2] = { 0, 0 };
+	int i, n = 0;
+
+	for (i = 0; i < num_blobs && n < PNP_MAX_POINTS; i++) {
+		int id = blobs[i].led_id;
+
+		if (blobs[i].object_id != object_id)
+			continue;
+		if (id < 0 || id >= num_leds || id >= 128)
+			continue;
+		if (taken[id / 64] & (1ULL << (id % 64)))
+			continue;
+		taken[id / 64] |= 1ULL << (id % 64);
+
+		pnp->object[n].x = leds[id].x;
+		pnp->object[n].y = leds[id].y;
+		pnp->object[n].z = leds[id].z;
+		undistort_point(camera_matrix, distortion, blobs[i].cx,
+				blobs[i].cy, &pnp->image[n][0],
+				&pnp->image[n][1]);
+		n++;
+	}
+
+	pnp->num_points = n;
+	pnp->focal_length = 0.5 * (camera_matrix->m[0] + camera_matrix->m[4]);
+
+	return n;
+}
+
+static double poly_eval(const double *c, int degree, double x)
+{
+	double y = c[degree];
+	int i;
+
+	for (i = degree - 1; i >= 0; i--)
+		y = y * x + c[i];
+
+	return y;
+}
+
+/*
+ * Finds all real roots of the polynomial c[0] + c[1] x + ... + c[n] x^n by
+ * bisecting the monotonic intervals between the roots of its derivative.
+ *
+ * Returns the number of roots stored in roots, in ascending order.
+ */
+static int poly_real_roots(const double *c, int degree, double *roots)
+{
+	double deriv[4] = { 0 };
+	double crit[4];
+	double bound = 0.0;
+	double lo, hi;
+	int num_crit, num = 0;
+	int i, j;
+
+	while (degree > 0 && fabs(c[degree]) < 1e-14)
+		degree--;
+	if (degree == 0)
+		return 0;
+	if (degree == 1) {
+		roots[0] = -c[0] / c[1];
+		return 1;
+	}
+
+	for (i = 0; i < degree; i++)
+		bound = fmax(bound, fabs(c[i] / c[degree]));
+	bound += 1.0;
+
+	for (i = 1; i <= degree; i++)
+		deriv[i - 1] = i * c[i];
+	num_crit = poly_real_roots(deriv, degree - 1, crit);
+
+	lo = -bound;
+	for (i = 0; i <= num_crit; i++) {
+		double flo, fhi;
+
+		hi = (i < num_crit) ? fmin(fmax(crit[i], -bound), bound) : bound;
+		flo = poly_eval(c, degree, lo);
+		fhi = poly_eval(c, degree, hi);
+
+		if (flo == 0.0) {
+			if (num == 0 || roots[num - 1] != lo)
+				roots[num++] = lo;
+		} else if (flo * fhi < 0.0) {
+			double a = lo, b = hi, fa = flo;
+
+			for (j = 0; j < 100; j++) {
+				double m = 0.5 * (a + b);
+				double fm = poly_eval(c, degree, m);
+
+				if (fm == 0.0 || b - a < 1e-13)
+					break;
+				if (fa * fm < 0.0) {
+					b = m;
+				} else {
+					a = m;
+					fa = fm;
+				}
+			}
+			roots[num++] = 0.5 * (a + b);
+		}
+		lo = hi;
+	}
+
+	if (poly_eval(c, degree, bound) == 0.0)
+		roots[num++] = bound;
+
+	return num;
+}
+
+static void dvec3_sub(dvec3 *r, const dvec3 *a, const dvec3 *b)
+{
+	r->x = a->x - b->x;
+	r->y = a->y - b->y;
+	r->z = a->z - b->z;
+}
+
+static double dvec3_dist2(const dvec3 *a, const dvec3 *b)
+{
+	dvec3 d;
+
+	dvec3_sub(&d, a, b);
+	return dvec3_dot(&d, &d);
+}
+
+/*
+ * Builds an orthonormal frame from the triangle p0, p1, p2 and stores its
+ * axes in the columns of the row-major matrix m.
+ */
+static bool triad_frame(dmat3 *m, const dvec3 *p0, const dvec3 *p1,
+			const dvec3 *p2)
+{
+	dvec3 e1, e2, e3, d;
+
+	dvec3_sub(&e1, p1, p0);
+	dvec3_sub(&d, p2, p0);
+	dvec3_cross(&e3, &e1, &d);
+	if (dvec3_dot(&e3, &e3) < 1e-20)
+		return false;
+	dvec3_normalize(&e1);
+	dvec3_normalize(&e3);
+	dvec3_cross(&e2, &e3, &e1);
+
+	m->m[0] = e1.x; m->m[1] = e2.x; m->m[2] = e3.x;
+	m->m[3] = e1.y; m->m[4] = e2.y; m->m[5] = e3.y;
+	m->m[6] = e1.z; m->m[7] = e2.z; m->m[8] = e3.z;
+
+	return true;
+}
+
+/*
+ * Determines the rigid transformation that maps the object points p onto the
+ * camera space points q, using the frames spanned by both triangles.
+ */
+static bool absolute_orientation(const dvec3 p[3], const dvec3 q[3],
+				 dquat *rot, dvec3 *trans)
+{
+	dmat3 fp, fq, r;
+	dvec3 rp;
+	int i, j, k;
+
+	if (!triad_frame(&fp, &p[0], &p[1], &p[2]) ||
+	    !triad_frame(&fq, &q[0], &q[1], &q[2]))
+		return false;
+
+	/* r = fq * fp^T */
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			r.m[3 * i + j] = 0.0;
+			for (k = 0; k < 3; k++)
+				r.m[3 * i + j] += fq.m[3 * i + k] *
+						  fp.m[3 * j + k];
+		}
+	}
+
+	dquat_from_dmat3(rot, &r);
+	dquat_rotate(&rp, rot, &p[0]);
+	dvec3_sub(trans, &q[0], &rp);
+
+	return true;
+}
+
+/*
+ * Solves the perspective-three-point problem for object points p and image
+ * rays j, following Grunert's solution as presented by Haralick et al.
+ *
+ * Returns the number of solutions, up to four.
+ */
+int pnp_p3p(const dvec3 p[3], const dvec3 j[3], dquat rots[4],
+	    dvec3 trans[4])
+{
+	const double a2 = dvec3_dist2(&p[1], &p[2]);
+	const double b2 = dvec3_dist2(&p[0], &p[2]);
+	const double c2 = dvec3_dist2(&p[0], &p[1]);
+	const double cos_alpha = dvec3_dot(&j[1], &j[2]);
+	const double cos_beta = dvec3_dot(&j[0], &j[2]);
+	const double cos_gamma = dvec3_dot(&j[0], &j[1]);
+	double amc, apc, bmc, bma;
+	double coeffs[5];
+	double roots[4];
+	int num_roots, num = 0;
+	int i;
+
+	if (b2 < 1e-12)
+		return 0;
+
+	amc = (a2 - c2) / b2;
+	apc = (a2 + c2) / b2;
+	bmc = (b2 - c2) / b2;
+	bma = (b2 - a2) / b2;
+
+	coeffs[4] = (amc - 1) * (amc - 1) -
+		    4 * c2 / b2 * cos_alpha * cos_alpha;
+	coeffs[3] = 4 * (amc * (1 - amc) * cos_beta -
+			 (1 - apc) * cos_alpha * cos_gamma +
+			 2 * c2 / b2 * cos_alpha * cos_alpha * cos_beta);
+	coeffs[2] = 2 * (amc * amc - 1 +
+			 2 * amc * amc * cos_beta * cos_beta +
+			 2 * bmc * cos_alpha * cos_alpha -
+			 4 * apc * cos_alpha * cos_beta * cos_gamma +
+			 2 * bma * cos_gamma * cos_gamma);
+	coeffs[1] = 4 * (-amc * (1 + amc) * cos_beta +
+			 2 * a2 / b2 * cos_gamma * cos_gamma * cos_beta -
+			 (1 - apc) * cos_alpha * cos_gamma);
+	coeffs[0] = (1 + amc) * (1 + amc) -
+		    4 * a2 / b2 * cos_gamma * cos_gamma;
+
+	num_roots = poly_real_roots(coeffs, 4, roots);
+
+	for (i = 0; i < num_roots; i++) {
+		const double v = roots[i];
+		double denom = 2 * (cos_gamma - v * cos_alpha);
+		double u, s1, s2, s3, d;
+		dvec3 q[3];
+
+		if (v <= 0 || fabs(denom) < 1e-12)
+			continue;
+
+		u = ((-1 + amc) * v * v - 2 * amc * cos_beta * v + 1 + amc) /
+		    denom;
+		if (u <= 0)
+			continue;
+
+		d = 1 + u * u - 2 * u * cos_gamma;
+		if (d <= 0)
+			continue;
+
+		s1 = sqrt(c2 / d);
+		s2 = u * s1;
+		s3 = v * s1;
+
+		q[0] = (dvec3){ j[0].x * s1, j[0].y * s1, j[0].z * s1 };
+		q[1] = (dvec3){ j[1].x * s2, j[1].y * s2, j[1].z * s2 };
+		q[2] = (dvec3){ j[2].x * s3, j[2].y * s3, j[2].z * s3 };
+
+		if (absolute_orientation(p, q, &rots[num], &trans[num]))
+			num++;
+	}
+
+	return num;
+}
+
+/*
+ * Returns the squared reprojection error of correspondence i in normalized
+ * image coordinates, or a large value if the point is behind the camera.
+ */
+static double reprojection_error2(struct pnp_problem *pnp, int i,
+				  const dquat *rot, const dvec3 *trans)
+{
+	dvec3 q;
+	double dx, dy;
+
+	dquat_rotate(&q, rot, &pnp->object[i]);
+	q.x += trans->x;
+	q.y += trans->y;
+	q.z += trans->z;
+
+	if (q.z <= 1e-6)
+		return DBL_MAX;
+
+	dx = q.x / q.z - pnp->image[i][0];
+	dy = q.y / q.z - pnp->image[i][1];
+
+	return dx * dx + dy * dy;
+}
+
+/*
+ * Marks correspondences with a reprojection error below threshold pixels as
+ * inliers.
+ *
+ * Returns the number of inliers.
+ */
+int pnp_count_inliers(struct pnp_problem *pnp, dquat *rot, dvec3 *trans,
+		      double threshold, bool *inliers)
+{
+	const double t = threshold / pnp->focal_length;
+	int i, num = 0;
+
+	for (i = 0; i < pnp->num_points; i++) {
+		bool inlier = reprojection_error2(pnp, i, rot, trans) < t * t;
+
+		if (inliers)
+			inliers[i] = inlier;
+		num += inlier;
+	}
+
+	return num;
+}
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+/*
+ * Returns the number of iterations after which a sample of three inliers
+ * has been drawn with the given confidence, if num of n correspondences are
+ * inliers.
+ */
+static int pnp_ransac_iterations(double confidence, int num, int n,
+				 int max_iterations)
+{
+	double w3 = pow((double)num / n, 3);
+	double k;
+
+	if (confidence >= 1.0 || w3 <= 0.0)
+		return max_iterations;
+	if (w3 >= 1.0)
+		return 0;
+
+	k = log(1.0 - confidence) / log(1.0 - w3);
+
+	return k < max_iterations ? (int)ceil(k) : max_iterations;
+}
+
+/*
+ * Generates pose hypotheses from random sets of three correspondences and
+ * refines the hypothesis with the most inliers. The result is stored in rot
+ * and trans, and inlying correspondences are marked in inliers.
+ *
+ * Returns the number of inliers, or a negative error code.
+ */
+int pnp_ransac(struct pnp_problem *pnp, const struct pnp_params *params,
+	       dquat *rot, dvec3 *trans, bool *inliers)
+{
+	const int n = pnp->num_points;
+	const double t = params->reprojection_error;
+	int max_iterations = params->ransac_iterations;
+	uint32_t state = 0x9e3779b9;
+	dquat best_rot = { 0, 0, 0, 1 };
+	dvec3 best_trans = { 0, 0, 0 };
+	int best = 0;
+	int iter, i;
+
+	if (n < 4)
+		return -EINVAL;
+
+	for (iter = 0; iter < max_iterations && best < n; iter++) {
+		dquat rots[4];
+		dvec3 transs[4];
+		dvec3 p[3], j[3];
+		int idx[3];
+		int num;
+
+		idx[0] = xorshift32(&state) % n;
+		do {
+			idx[1] = xorshift32(&state) % n;
+		} while (idx[1] == idx[0]);
+		do {
+			idx[2] = xorshift32(&state) % n;
+		} while (idx[2] == idx[0] || idx[2] == idx[1]);
+
+		for (i = 0; i < 3; i++) {
+			p[i] = pnp->object[idx[i]];
+			j[i].x = pnp->image[idx[i]][0];
+			j[i].y = pnp->image[idx[i]][1];
+			j[i].z = 1.0;
+			dvec3_normalize(&j[i]);
+		}
+
+		num = pnp_p3p(p, j, rots, transs);
+		for (i = 0; i < num; i++) {
+			int count = pnp_count_inliers(pnp, &rots[i],
+						      &transs[i], t, NULL);
+			if (count > best) {
+				best = count;
+				best_rot = rots[i];
+				best_trans = transs[i];
+				max_iterations = pnp_ransac_iterations(
+						params->confidence, best, n,
+						params->ransac_iterations);
+			}
+		}
+	}
+
+	if (best < 4)
+		return -ENOENT;
+
+	pnp_count_inliers(pnp, &best_rot, &best_trans, t, inliers);
+	pnp_refine(pnp, &best_rot, &best_trans, inliers,
+		   PNP_REFINE_ITERATIONS);
+
+	*rot = best_rot;
+	*trans = best_trans;
+
+	return pnp_count_inliers(pnp, rot, trans, t, inliers);
+}
+
+/*
+ * Accumulates the Gauss-Newton normal equations for all inliers of all views,
+ * with the rotation perturbed from the left in world space. Residuals are
+ * scaled to pixels, so that views with different focal lengths are weighted
+ * by their resolution.
+ *
+ * Returns the sum of squared reprojection errors in pixels.
+ */
+static double normal_equations(struct pnp_view *views, int num_views,
+			       const dquat *rot, const dvec3 *trans,
+			       double h[6][6], double g[6])
+{
+	double cost = 0.0;
+	int v, i, j, k;
+
+	memset(h, 0, 36 * sizeof(double));
+	memset(g, 0, 6 * sizeof(double));
+
+	for (v = 0; v < num_views; v++) {
+		struct pnp_problem *pnp = views[v].pnp;
+		const bool *inliers = views[v].inliers;
+		const double f = pnp->focal_length;
+		const dquat *cam_rot = &views[v].camera_rotation;
+		const dquat cam_inv = { -cam_rot->x, -cam_rot->y, -cam_rot->z,
+					cam_rot->w };
+		const dvec3 *cam_trans = &views[v].camera_translation;
+
+		for (i = 0; i < pnp->num_points; i++) {
+			double jac[2][6];
+			double a[2][3], b[2][3];
+			double r[2];
+			dvec3 q, w, p, col;
+			double iz;
+
+			if (inliers && !inliers[i])
+				continue;
+
+			dquat_rotate(&q, rot, &pnp->object[i]);
+			w.x = q.x + trans->x - cam_trans->x;
+			w.y = q.y + trans->y - cam_trans->y;
+			w.z = q.z + trans->z - cam_trans->z;
+			dquat_rotate(&p, &cam_inv, &w);
+			if (p.z <= 1e-6)
+				continue;
+			iz = 1.0 / p.z;
+
+			r[0] = f * (p.x * iz - pnp->image[i][0]);
+			r[1] = f * (p.y * iz - pnp->image[i][1]);
+			cost += r[0] * r[0] + r[1] * r[1];
+
+			/* d(x/z, y/z)/dp, scaled to pixels */
+			a[0][0] = f * iz;
+			a[0][1] = 0.0;
+			a[0][2] = -f * p.x * iz * iz;
+			a[1][0] = 0.0;
+			a[1][1] = f * iz;
+			a[1][2] = -f * p.y * iz * iz;
+
+			/* dp/dw is the inverse camera rotation */
+			for (k = 0; k < 3; k++) {
+				dvec3 e = { k == 0, k == 1, k == 2 };
+
+				dquat_rotate(&col, &cam_inv, &e);
+				for (j = 0; j < 2; j++)
+					b[j][k] = a[j][0] * col.x +
+						  a[j][1] * col.y +
+						  a[j][2] * col.z;
+			}
+
+			/* dw/d(omega, t) = [-[q]x | I] */
+			for (j = 0; j < 2; j++) {
+				jac[j][0] = -b[j][1] * q.z + b[j][2] * q.y;
+				jac[j][1] = b[j][0] * q.z - b[j][2] * q.x;
+				jac[j][2] = -b[j][0] * q.y + b[j][1] * q.x;
+				jac[j][3] = b[j][0];
+				jac[j][4] = b[j][1];
+				jac[j][5] = b[j][2];
+			}
+
+			for (j = 0; j < 6; j++) {
+				g[j] += jac[0][j] * r[0] + jac[1][j] * r[1];
+				for (k = 0; k <= j; k++)
+					h[j][k] += jac[0][j] * jac[0][k] +
+						   jac[1][j] * jac[1][k];
+			}
+		}
+	}
+
+	for (j = 0; j < 6; j++)
+		for (k = j + 1; k < 6; k++)
+			h[j][k] = h[k][j];
+
+	return cost;
+}
+
+/*
+ * Refines the world space pose with Levenberg-Marquardt iterations over all
+ * inliers of all views. Each view contains the correspondences observed by
+ * one camera and the pose of that camera in world space.
+ *
+ * Returns the RMS reprojection error in pixels.
+ */
+double pnp_refine_views(struct pnp_view *views, int num_views, dquat *rot,
+			dvec3 *trans, int iterations)
+{
+	double lambda = 1e-3;
+	double h[6][6], g[6];
+	double cost;
+	int num = 0;
+	int iter, i, v;
+
+	for (v = 0; v < num_views; v++) {
+		for (i = 0; i < views[v].pnp->num_points; i++)
+			num += !views[v].inliers || views[v].inliers[i];
+	}
+	if (num == 0)
+		return DBL_MAX;
+
+	cost = normal_equations(views, num_views, rot, trans, h, g);
+
+	for (iter = 0; iter < iterations; iter++) {
+		double a[6][6], delta[6];
+		double new_cost, angle;
+		double nh[6][6], ng[6];
+		dquat drot, new_rot;
+		dvec3 new_trans, axis;
+
+		memcpy(a, h, sizeof(a));
+		for (i = 0; i < 6; i++) {
+			a[i][i] *= 1.0 + lambda;
+			delta[i] = -g[i];
+		}
+		if (!cholesky_solve6(a, delta))
+			break;
+
+		axis = (dvec3){ delta[0], delta[1], delta[2] };
+		angle = sqrt(dvec3_dot(&axis, &axis));
+		if (angle > 1e-12) {
+			dvec3_normalize(&axis);
+			dquat_from_axis_angle(&drot, &axis, angle);
+		} else {
+			drot = (dquat){ 0, 0, 0, 1 };
+		}
+		dquat_mult(&new_rot, &drot, rot);
+		dquat_normalize(&new_rot);
+		new_trans.x = trans->x + delta[3];
+		new_trans.y = trans->y + delta[4];
+		new_trans.z = trans->z + delta[5];
+
+		new_cost = normal_equations(views, num_views, &new_rot,
+					    &new_trans, nh, ng);
+		if (new_cost < cost) {
+			*rot = new_rot;
+			*trans = new_trans;
+			memcpy(h, nh, sizeof(h));
+			memcpy(g, ng, sizeof(g));
+			lambda *= 0.1;
+			if (cost - new_cost < 1e-12 * cost) {
+				cost = new_cost;
+				break;
+			}
+			cost = new_cost;
+		} else {
+			lambda *= 10.0;
+		}
+	}
+
+	return sqrt(cost / num);
+}
+
+/*
+ * Refines the pose with Levenberg-Marquardt iterations over all inliers, or
+ * over all correspondences if inliers is NULL.
+ *
+ * Returns the RMS reprojection error in pixels.
+ */
+double pnp_refine(struct pnp_problem *pnp, dquat *rot, dvec3 *trans,
+		  bool *inliers, int iterations)
+{
+	struct pnp_view view = {
+		.pnp = pnp,
+		.inliers = inliers,
+		.camera_rotation = { 0, 0, 0, 1 },
+	};
+
+	return pnp_refine_views(&view, 1, rot, trans, iterations);
+}
+
+/*
+ * Estimates the pose of the LED constellation from identified blobs. With
+ * use_extrinsic_guess, the pose passed in rot and trans is refined first and
+ * only if that fails to explain the blobs, a new pose is searched. If params
+ * is NULL, the default search parameters are used.
+ *
+ * Returns the number of inliers, or a negative error code if no pose was
+ * found, in which case rot and trans are left unchanged.
+ */
+int estimate_pose(struct blob *blobs, int num_blobs, int object_id,
+		  vec3 *leds, int num_leds,
+		  dmat3 *camera_matrix, const struct distortion *distortion,
+		  const struct pnp_params *params, dquat *rot, dvec3 *trans,
+		  bool use_extrinsic_guess)
+{
+	struct pnp_problem pnp;
+	bool inliers[PNP_MAX_POINTS];
+	dquat r;
+	dvec3 t;
+	int num;
+
+	OUVRT_TRACE3(estimate_pose_enter, object_id, num_blobs,
+		     use_extrinsic_guess);
+
+	num = pnp_problem_init(&pnp, blobs, num_blobs, object_id, leds,
+			       num_leds, camera_matrix, distortion);
+	if (num < 4)
+		return -EINVAL;
+
+	if (!params)
+		params = &pnp_default_params;
+
+	if (use_extrinsic_guess && trans->z > 0 && dquat_norm(rot) > 0.5) {
+		r = *rot;
+		dquat_normalize(&r);
+		t = *trans;
+
+		pnp_refine(&pnp, &r, &t, NULL, PNP_GUESS_REFINE_ITERATIONS);
+		num = pnp_count_inliers(&pnp, &r, &t,
+					params->reprojection_error, inliers);
+		if (num == pnp.num_points) {
+			*rot = r;
+			*trans = t;
+			OUVRT_TRACE2(estimate_pose_exit, object_id, num);
+			return num;
+		}
+	}
+
+	num = pnp_ransac(&pnp, params, &r, &t, inliers);
+	OUVRT_TRACE2(estimate_pose_exit, object_id, num);
+	if (num < 0)
+		return num;
+
+	*rot = r;
+	*trans = t;
+
+	return num;
+}
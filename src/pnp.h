@@ -0,0 +1,77 @@
+/*
+ * Perspective-n-Point pose estimation
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __PNP_H__
+#define __PNP_H__
+
+#include <stdbool.h>
+
+#include "distortion.h"
+#include "maths.h"
+
+#define PNP_MAX_POINTS	64
+
+struct blob;
+
+/*
+ * Parameters of the full pose search. Hypotheses are generated until the
+ * maximum number of iterations is reached, or until the probability of
+ * having drawn at least one sample of inliers only exceeds the confidence.
+ * A confidence of 1 only stops early if all correspondences are inliers.
+ */
+struct pnp_params {
+	int ransac_iterations;
+	/* in pixels, below which correspondences count as inliers */
+	double reprojection_error;
+	double confidence;
+};
+
+extern const struct pnp_params pnp_default_params;
+
+/*
+ * Correspondences between model points and undistorted, normalized image
+ * coordinates, prepared for the solver.
+ */
+struct pnp_problem {
+	int num_points;
+	dvec3 object[PNP_MAX_POINTS];
+	double image[PNP_MAX_POINTS][2];
+	/* focal length used to convert normalized errors into pixels */
+	double focal_length;
+};
+
+/*
+ * Correspondences observed by one camera, with the pose of that camera in
+ * world space, for joint pose refinement across multiple cameras.
+ */
+struct pnp_view {
+	struct pnp_problem *pnp;
+	bool *inliers;
+	dquat camera_rotation;
+	dvec3 camera_translation;
+};
+
+int pnp_problem_init(struct pnp_problem *pnp, struct blob *blobs,
+		     int num_blobs, int object_id, vec3 *leds, int num_leds,
+		     dmat3 *camera_matrix,
+		     const struct distortion *distortion);
+int pnp_p3p(const dvec3 p[3], const dvec3 j[3], dquat rots[4],
+	    dvec3 trans[4]);
+int pnp_ransac(struct pnp_problem *pnp, const struct pnp_params *params,
+	       dquat *rot, dvec3 *trans, bool *inliers);
+double pnp_refine(struct pnp_problem *pnp, dquat *rot, dvec3 *trans,
+		  bool *inliers, int iterations);
+double pnp_refine_views(struct pnp_view *views, int num_views, dquat *rot,
+			dvec3 *trans, int iterations);
+int pnp_count_inliers(struct pnp_problem *pnp, dquat *rot, dvec3 *trans,
+		      double threshold, bool *inliers);
+
+int estimate_pose(struct blob *blobs, int num_blobs, int object_id,
+		  vec3 *leds, int num_leds,
+		  dmat3 *camera_matrix, const struct distortion *distortion,
+		  const struct pnp_params *params, dquat *rot, dvec3 *trans,
+		  bool use_extrinsic_guess);
+
+#endif /* __PNP_H__ */
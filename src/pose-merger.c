@@ -0,0 +1,147 @@
+/*
+ * Timestamp ordered merging of optical pose measurements
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Measurements of different cameras arrive with different processing delays.
+ * The consumer only releases the oldest pending measurement once every ring
+ * that is active has a pending one, so that no older measurement can still
+ * arrive, or once the measurement is older than the reordering window given
+ * by the consumer. Rings become active with their first measurement, and
+ * inactive when their producer is removed or has been idle for a while.
+ */
+#include <string.h>
+
+#include "pose-merger.h"
+
+void pose_merger_init(struct pose_merger *merger)
+{
+	memset(merger, 0, sizeof(*merger));
+}
+
+/*
+ * Appends a measurement to the given ring. Each ring must only be filled by
+ * a single thread at a time.
+ *
+ * Returns false if the ring is full and the measurement was dropped.
+ */
+bool pose_merger_push(struct pose_merger *merger, int ring,
+		      const struct pose_event *event)
+{
+	struct pose_ring *r;
+	uint32_t head;
+
+	if (ring < 0 || ring >= POSE_MERGER_MAX_RINGS)
+		return false;
+
+	r = &merger->rings[ring];
+	head = r->head;
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >=
+	    POSE_MERGER_RING_LEN)
+		return false;
+
+	r->events[head % POSE_MERGER_RING_LEN] = *event;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_SEQ_CST);
+	__atomic_fetch_or(&merger->active_mask, 1u << ring, __ATOMIC_SEQ_CST);
+
+	return true;
+}
+
+/*
+ * Stops waiting for the given ring, and drops its pending measurements.
+ * Must be called after its producer has stopped pushing, before the ring is
+ * reused by a new producer.
+ */
+void pose_merger_remove_ring(struct pose_merger *merger, int ring)
+{
+	struct pose_ring *r;
+
+	if (ring < 0 || ring >= POSE_MERGER_MAX_RINGS)
+		return;
+
+	r = &merger->rings[ring];
+	__atomic_fetch_and(&merger->active_mask, ~(1u << ring),
+			   __ATOMIC_SEQ_CST);
+	__atomic_store_n(&r->discard_head,
+			 __atomic_load_n(&r->head, __ATOMIC_ACQUIRE),
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&r->discard, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Stops waiting for an empty ring. The ring becomes active again with its
+ * next measurement, also if that was pushed concurrently.
+ *
+ * Returns true if the ring is still active.
+ */
+static bool pose_merger_deactivate(struct pose_merger *merger, int ring)
+{
+	struct pose_ring *r = &merger->rings[ring];
+
+	__atomic_fetch_and(&merger->active_mask, ~(1u << ring),
+			   __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == r->tail)
+		return false;
+
+	__atomic_fetch_or(&merger->active_mask, 1u << ring, __ATOMIC_SEQ_CST);
+	return true;
+}
+
+/*
+ * Removes the oldest pending measurement across all rings and stores it in
+ * event, if it can be released. Measurements taken at or before
+ * release_time are released without waiting for the other rings. Must only
+ * be called from the consumer thread.
+ *
+ * Returns false if there is no measurement to be released.
+ */
+bool pose_merger_pop(struct pose_merger *merger, double release_time,
+		     struct pose_event *event)
+{
+	uint32_t active_mask = __atomic_load_n(&merger->active_mask,
+					       __ATOMIC_ACQUIRE);
+	struct pose_ring *best = NULL;
+	bool waiting = false;
+	int i;
+
+	for (i = 0; i < POSE_MERGER_MAX_RINGS; i++) {
+		struct pose_ring *r = &merger->rings[i];
+		struct pose_event *e;
+
+		if (__atomic_load_n(&r->discard, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&r->tail, r->discard_head,
+					 __ATOMIC_RELEASE);
+			__atomic_store_n(&r->discard, false, __ATOMIC_RELAXED);
+		}
+
+		if (!(active_mask & (1u << i)))
+			continue;
+
+		if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail) {
+			/* Do not wait for cameras that stopped delivering */
+			if (r->last_time >= release_time -
+					    POSE_MERGER_IDLE_TIMEOUT ||
+			    pose_merger_deactivate(merger, i))
+				waiting = true;
+			continue;
+		}
+
+		e = &r->events[r->tail % POSE_MERGER_RING_LEN];
+		if (!best ||
+		    e->time < best->events[best->tail %
+					   POSE_MERGER_RING_LEN].time)
+			best = r;
+	}
+
+	if (!best)
+		return false;
+
+	*event = best->events[best->tail % POSE_MERGER_RING_LEN];
+	if (waiting && event->time > release_time)
+		return false;
+
+	__atomic_store_n(&best->tail, best->tail + 1, __ATOMIC_RELEASE);
+	best->last_time = event->time;
+
+	return true;
+}
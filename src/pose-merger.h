@@ -0,0 +1,59 @@
+/*
+ * Timestamp ordered merging of optical pose measurements
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __POSE_MERGER_H__
+#define __POSE_MERGER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "imu.h"
+
+/* number of producers, one per camera */
+#define POSE_MERGER_MAX_RINGS	8
+/* measurements per producer not yet consumed, must be a power of two */
+#define POSE_MERGER_RING_LEN	16
+/* seconds without measurements after which an empty ring is not waited for */
+#define POSE_MERGER_IDLE_TIMEOUT	0.5
+
+/* Pose measured at the exposure at the given device time, in seconds */
+struct pose_event {
+	double time;
+	struct dpose pose;
+};
+
+/*
+ * Single producer, single consumer ring buffer. The head is only written by
+ * the producer, the tail only by the consumer. Measurements up to
+ * discard_head are dropped by the consumer once discard is set.
+ */
+struct pose_ring {
+	uint32_t head;
+	uint32_t tail;
+	bool discard;
+	uint32_t discard_head;
+	/* time of the last measurement released, only used by the consumer */
+	double last_time;
+	struct pose_event events[POSE_MERGER_RING_LEN];
+};
+
+/*
+ * Lock-free rings of pose measurements, each filled in time order by its own
+ * producer thread, and drained in time order across all rings by a single
+ * consumer thread.
+ */
+struct pose_merger {
+	uint32_t active_mask;
+	struct pose_ring rings[POSE_MERGER_MAX_RINGS];
+};
+
+void pose_merger_init(struct pose_merger *merger);
+bool pose_merger_push(struct pose_merger *merger, int ring,
+		      const struct pose_event *event);
+void pose_merger_remove_ring(struct pose_merger *merger, int ring);
+bool pose_merger_pop(struct pose_merger *merger, double release_time,
+		     struct pose_event *event);
+
+#endif /* __POSE_MERGER_H__ */
@@ -0,0 +1,166 @@
+/*
+ * Shared memory pose output
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Publishes the latest fused state of a tracked device in a memfd backed
+ * page protected by a seqlock. Applications map the page read-only and can
+ * read the current pose every frame without any syscall or IPC round trip.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "imu.h"
+#include "pose-shm.h"
+
+struct pose_shm {
+	struct pose_shm_page *page;
+	size_t size;
+	int fd;
+};
+
+/*
+ * Creates a new page, sealed against resizing so that readers' mappings
+ * stay valid.
+ *
+ * Returns the new pose output, or NULL on failure.
+ */
+struct pose_shm *pose_shm_new(void)
+{
+	struct pose_shm *shm;
+	void *map;
+
+	shm = calloc(1, sizeof(*shm));
+	if (!shm)
+		return NULL;
+
+	shm->size = getpagesize();
+	shm->fd = memfd_create("ouvrt-pose", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (shm->fd < 0)
+		goto err_free;
+
+	if (ftruncate(shm->fd, shm->size) < 0 ||
+	    fcntl(shm->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+		goto err_close;
+
+	map = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   shm->fd, 0);
+	if (map == MAP_FAILED)
+		goto err_close;
+
+	shm->page = map;
+	shm->page->magic = POSE_SHM_MAGIC;
+	shm->page->version = POSE_SHM_VERSION;
+	__atomic_store_n(&shm->page->seq, 0, __ATOMIC_RELEASE);
+
+	return shm;
+
+err_close:
+	close(shm->fd);
+err_free:
+	free(shm);
+	return NULL;
+}
+
+void pose_shm_free(struct pose_shm *shm)
+{
+	if (!shm)
+		return;
+
+	munmap(shm->page, shm->size);
+	close(shm->fd);
+	free(shm);
+}
+
+/*
+ * Returns a new read-only file descriptor for the page, to be passed to an
+ * application, or a negative error code.
+ */
+int pose_shm_get_fd(struct pose_shm *shm)
+{
+	char path[32];
+	int fd;
+
+	if (!shm)
+		return -ENODEV;
+
+	/* Reopen the memfd, so that readers can not write into the page */
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", shm->fd);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	return fd < 0 ? -errno : fd;
+}
+
+/*
+ * Returns a new read-only file descriptor for the pose output stored in
+ * *shm, creating it on first use, or a negative error code. Concurrent
+ * callers agree on a single page, which the writer picks up with an acquire
+ * load of *shm.
+ */
+int pose_shm_open(struct pose_shm **shm)
+{
+	struct pose_shm *old = __atomic_load_n(shm, __ATOMIC_ACQUIRE);
+	struct pose_shm *new;
+
+	if (!old) {
+		new = pose_shm_new();
+		if (!new)
+			return -ENOMEM;
+		if (__atomic_compare_exchange_n(shm, &old, new, false,
+						__ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE))
+			old = new;
+		else
+			pose_shm_free(new);
+	}
+
+	return pose_shm_get_fd(old);
+}
+
+/*
+ * Publishes a new fused state. Must only be called from a single thread.
+ */
+void pose_shm_write(struct pose_shm *shm, const struct imu_state *state)
+{
+	struct pose_shm_page *page;
+	struct pose_shm_state *s;
+	uint32_t seq;
+
+	if (!shm)
+		return;
+
+	page = shm->page;
+	s = &page->state;
+	seq = __atomic_load_n(&page->seq, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	s->time = state->sample.time;
+	s->rotation[0] = state->pose.rotation.x;
+	s->rotation[1] = state->pose.rotation.y;
+	s->rotation[2] = state->pose.rotation.z;
+	s->rotation[3] = state->pose.rotation.w;
+	s->translation[0] = state->pose.translation.x;
+	s->translation[1] = state->pose.translation.y;
+	s->translation[2] = state->pose.translation.z;
+	s->angular_velocity[0] = state->angular_velocity.x;
+	s->angular_velocity[1] = state->angular_velocity.y;
+	s->angular_velocity[2] = state->angular_velocity.z;
+	s->linear_velocity[0] = state->linear_velocity.x;
+	s->linear_velocity[1] = state->linear_velocity.y;
+	s->linear_velocity[2] = state->linear_velocity.z;
+	s->angular_acceleration[0] = state->angular_acceleration.x;
+	s->angular_acceleration[1] = state->angular_acceleration.y;
+	s->angular_acceleration[2] = state->angular_acceleration.z;
+	s->linear_acceleration[0] = state->linear_acceleration.x;
+	s->linear_acceleration[1] = state->linear_acceleration.y;
+	s->linear_acceleration[2] = state->linear_acceleration.z;
+
+	__atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,75 @@
+/*
+ * Shared memory pose output
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __POSE_SHM_H__
+#define __POSE_SHM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define POSE_SHM_MAGIC		0x45534f50 /* "POSE" */
+#define POSE_SHM_VERSION	1
+
+struct imu_state;
+struct pose_shm;
+
+/*
+ * Latest fused state of a tracked device. Time is the device time of the
+ * IMU sample in seconds, the rotation quaternion is stored as x, y, z, w.
+ */
+struct pose_shm_state {
+	double time;
+	double rotation[4];
+	double translation[3];
+	float angular_velocity[3];
+	float linear_velocity[3];
+	float angular_acceleration[3];
+	float linear_acceleration[3];
+};
+
+/*
+ * Layout of the shared memory page. seq is odd while the daemon is writing
+ * state, and incremented by two with every update.
+ */
+struct pose_shm_page {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;
+	uint32_t reserved;
+	struct pose_shm_state state;
+};
+
+/*
+ * Copies the latest state out of a read-only mapping of the shared memory
+ * page. This never blocks the daemon, and only retries if an update is
+ * written concurrently.
+ *
+ * Returns false if no state has been written yet.
+ */
+static inline bool pose_shm_read(const struct pose_shm_page *shm,
+				 struct pose_shm_state *state)
+{
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		__builtin_memcpy(state, (const void *)&shm->state,
+				 sizeof(*state));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+		 seq != __atomic_load_n(&shm->seq, __ATOMIC_RELAXED));
+
+	return seq != 0;
+}
+
+struct pose_shm *pose_shm_new(void);
+void pose_shm_free(struct pose_shm *shm);
+int pose_shm_get_fd(struct pose_shm *shm);
+int pose_shm_open(struct pose_shm **shm);
+void pose_shm_write(struct pose_shm *shm, const struct imu_state *state);
+
+#endif /* __POSE_SHM_H__ */
@@ -26,12 +26,17 @@
 #define PSVR_ENDPOINT_SENSOR		3
 #define PSVR_ENDPOINT_CONTROL		4
 
+#define PSVR_SENSOR_TRANSFER_SIZE	64
+
+static int psvr_num_sensor_transfers = 4;
+
 struct _OuvrtPSVR {
 	OuvrtDevice dev;
 
 	libusb_device_handle *devh;
 	int num_transfers;
 	struct libusb_transfer **transfer;
+	GAsyncQueue *sensor_queue;
 	uint8_t sensor_endpoint;
 	uint8_t control_endpoint;
 
@@ -142,6 +147,31 @@ static void psvr_set_mode(OuvrtPSVR *psvr, int mode)
 	}
 }
 
+/*
+ * Transform from IMU coordinate system into common coordinate system:
+ *
+ *    x                                y
+ *    |          ⎡ 0  1  0 ⎤ ⎡x⎤       |
+ *    +-- y  ->  ⎢ 1  0  0 ⎥ ⎢y⎥  ->   +-- x
+ *   /           ⎣ 0  0 -1 ⎦ ⎣z⎦      /
+ * -z                                z
+ *
+ * Acceleration is reported in units of g/16384, angular velocity in units
+ * of 16/16384 rad/s.
+ */
+static const struct imu_calibration psvr_imu_calibration = {
+	.acc_matrix = {
+		{ 0, 9.81 / 16384, 0 },
+		{ 9.81 / 16384, 0, 0 },
+		{ 0, 0, -9.81 / 16384 },
+	},
+	.gyro_matrix = {
+		{ 0, 16.0 / 16384, 0 },
+		{ 16.0 / 16384, 0, 0 },
+		{ 0, 0, -16.0 / 16384 },
+	},
+};
+
 static void psvr_decode_sensor_message(OuvrtPSVR *self,
 				       const unsigned char *buf,
 				       G_GNUC_UNUSED size_t len)
@@ -150,8 +180,8 @@ static void psvr_decode_sensor_message(OuvrtPSVR *self,
 	uint16_t volume = __le16_to_cpu(message->volume);
 	uint16_t button_raw = __be16_to_cpu(message->button_raw);
 	uint16_t proximity = __le16_to_cpu(message->proximity);
-	struct raw_imu_sample raw;
-	struct imu_sample imu;
+	struct raw_imu_sample raw[2];
+	struct imu_sample imu[2];
 	int32_t dt;
 	int i;
 
@@ -159,13 +189,19 @@ static void psvr_decode_sensor_message(OuvrtPSVR *self,
 		int i;
 		int num_buttons = 0;
 		uint8_t btns[4];
-		for (i = 0; i < 4; i++) {
-			if ((self->button ^ message->button) & (1 << i)) {
-				btns[num_buttons++] = i |
-					((message->button & (1 << i)) ? 0x80 : 0);
+
+		if (telemetry_wants(self->dev.id, TELEMETRY_PACKET_BUTTONS)) {
+			for (i = 0; i < 4; i++) {
+				if ((self->button ^ message->button) &
+				    (1 << i)) {
+					btns[num_buttons++] = i |
+						((message->button & (1 << i)) ?
+						 0x80 : 0);
+				}
 			}
+			telemetry_send_buttons(self->dev.id, btns,
+					       num_buttons);
 		}
-		telemetry_send_buttons(self->dev.id, btns, num_buttons);
 
 		self->button = message->button;
 	}
@@ -186,58 +222,49 @@ static void psvr_decode_sensor_message(OuvrtPSVR *self,
 			self->vrmode = false;
 	}
 
-	memset(&imu, 0, sizeof(imu));
+	memset(imu, 0, sizeof(imu));
 
 	for (i = 0; i < 2; i++) {
 		const struct psvr_imu_sample *sample = &message->sample[i];
 
-		raw.time = __le32_to_cpu(sample->timestamp);
-		raw.acc[0] = (int16_t)__le16_to_cpu(sample->accel[0]);
-		raw.acc[1] = (int16_t)__le16_to_cpu(sample->accel[1]);
-		raw.acc[2] = (int16_t)__le16_to_cpu(sample->accel[2]);
-		raw.gyro[0] = (int16_t)__le16_to_cpu(sample->gyro[0]);
-		raw.gyro[1] = (int16_t)__le16_to_cpu(sample->gyro[1]);
-		raw.gyro[2] = (int16_t)__le16_to_cpu(sample->gyro[2]);
+		raw[i].time = __le32_to_cpu(sample->timestamp);
+		raw[i].acc[0] = (int16_t)__le16_to_cpu(sample->accel[0]);
+		raw[i].acc[1] = (int16_t)__le16_to_cpu(sample->accel[1]);
+		raw[i].acc[2] = (int16_t)__le16_to_cpu(sample->accel[2]);
+		raw[i].gyro[0] = (int16_t)__le16_to_cpu(sample->gyro[0]);
+		raw[i].gyro[1] = (int16_t)__le16_to_cpu(sample->gyro[1]);
+		raw[i].gyro[2] = (int16_t)__le16_to_cpu(sample->gyro[2]);
+	}
+
+	imu_calibrate_samples(&psvr_imu_calibration, raw, imu, 2);
 
-		telemetry_send_raw_imu_sample(self->dev.id, &raw);
+	for (i = 0; i < 2; i++) {
+		if (telemetry_wants(self->dev.id,
+				    TELEMETRY_PACKET_RAW_IMU_SAMPLE))
+			telemetry_send_raw_imu_sample(self->dev.id, &raw[i]);
 
-		dt = raw.time - self->last_timestamp;
+		dt = raw[i].time - self->last_timestamp;
 		if (dt < 0)
 			dt += (1 << 24);
 
 		if (dt < 440 || dt > 560) {
 			if (self->last_timestamp == 0) {
-				self->last_timestamp = raw.time;
+				self->last_timestamp = raw[i].time;
 				break;
 			}
 		}
 
-		/*
-		 * Transform from IMU coordinate system into common coordinate
-		 * system:
-		 *
-		 *    x                                y
-		 *    |          ⎡ 0  1  0 ⎤ ⎡x⎤       |
-		 *    +-- y  ->  ⎢ 1  0  0 ⎥ ⎢y⎥  ->   +-- x
-		 *   /           ⎣ 0  0 -1 ⎦ ⎣z⎦      /
-		 * -z                                z
-		 *
-		 */
-		imu.acceleration.x = raw.acc[1] *  (9.81 / 16384);
-		imu.acceleration.y = raw.acc[0] *  (9.81 / 16384);
-		imu.acceleration.z = raw.acc[2] * -(9.81 / 16384);
-		imu.angular_velocity.x = raw.gyro[1] *  (16.0 / 16384);
-		imu.angular_velocity.y = raw.gyro[0] *  (16.0 / 16384);
-		imu.angular_velocity.z = raw.gyro[2] * -(16.0 / 16384);
-		imu.time = 1e-6 * raw.time;
-
-		telemetry_send_imu_sample(self->dev.id, &imu);
-
-		pose_update(1e-6 * dt, &self->imu.pose, &imu);
-
-		telemetry_send_pose(self->dev.id, &self->imu.pose);
-
-		self->last_timestamp = raw.time;
+		imu[i].time = 1e-6 * raw[i].time;
+
+		if (telemetry_wants(self->dev.id, TELEMETRY_PACKET_IMU_SAMPLE))
+			telemetry_send_imu_sample(self->dev.id, &imu[i]);
+
+		pose_update(1e-6 * dt, &self->imu.pose, &imu[i]);
+
+		if (telemetry_wants(self->dev.id, TELEMETRY_PACKET_POSE))
+			telemetry_send_pose(self->dev.id, &self->imu.pose);
+
+		self->last_timestamp = raw[i].time;
 	}
 
 	self->last_seq = message->sequence;
@@ -365,10 +392,13 @@ static void psvr_control_transfer_callback(struct libusb_transfer *transfer)
 	}
 }
 
+/*
+ * Hands completed sensor transfers over to the device thread for decoding,
+ * so that the libusb event thread is not blocked.
+ */
 static void psvr_sensor_transfer_callback(struct libusb_transfer *transfer)
 {
 	OuvrtPSVR *psvr = transfer->user_data;
-	int ret;
 
 	if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
 		if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
@@ -382,14 +412,53 @@ static void psvr_sensor_transfer_callback(struct libusb_transfer *transfer)
 		return;
 	}
 
-	psvr_decode_sensor_message(psvr, transfer->buffer,
-				   transfer->actual_length);
+	g_async_queue_push(psvr->sensor_queue, transfer);
+}
+
+/*
+ * Copies the sensor message out of a completed transfer and resubmits it
+ * right away, keeping the configured number of transfers in flight while
+ * the message is decoded.
+ */
+static void psvr_handle_sensor_transfer(OuvrtPSVR *psvr,
+					struct libusb_transfer *transfer)
+{
+	unsigned char buf[PSVR_SENSOR_TRANSFER_SIZE];
+	int len = transfer->actual_length;
+	int ret;
+
+	memcpy(buf, transfer->buffer, len);
 
-	/* Resubmit transfer */
 	ret = libusb_submit_transfer(transfer);
 	if (ret < 0) {
 		g_print("PSVR: Failed to resubmit sensor transfer: %d\n", ret);
 	}
+
+	psvr_decode_sensor_message(psvr, buf, len);
+}
+
+/*
+ * Decodes sensor messages as the event thread completes sensor transfers.
+ * All queued messages are decoded before telemetry is flushed.
+ */
+static void psvr_thread(OuvrtDevice *dev)
+{
+	OuvrtPSVR *psvr = OUVRT_PSVR(dev);
+	struct libusb_transfer *transfer;
+
+	while (dev->active) {
+		transfer = g_async_queue_timeout_pop(psvr->sensor_queue,
+						     100000);
+		if (!transfer)
+			continue;
+
+		do {
+			psvr_handle_sensor_transfer(psvr, transfer);
+			transfer = g_async_queue_try_pop(psvr->sensor_queue);
+		} while (transfer);
+
+		telemetry_flush();
+	}
 }
 
 static int psvr_parse_config_descriptor(OuvrtPSVR *psvr)
@@ -516,22 +585,24 @@ static int psvr_start(OuvrtDevice *dev)
 	psvr_set_headset_power(psvr, true);
 	g_print("PSVR: Sent power on message\n");
 
-	/* Submit one sensor transfer and one control transfer */
-	psvr->num_transfers = 2;
+	/* Submit the sensor transfers and one control transfer */
+	psvr->num_transfers = psvr_num_sensor_transfers + 1;
 	psvr->transfer = calloc(psvr->num_transfers, sizeof(*psvr->transfer));
 	if (!psvr->transfer)
 		return -ENOMEM;
 
 	for (i = 0; i < psvr->num_transfers; i++) {
+		bool control = i == psvr_num_sensor_transfers;
+
 		psvr->transfer[i] = libusb_alloc_transfer(0);
 		void *buf = calloc(1, 64);
-		bEndpointAddress = (i ? psvr->control_endpoint :
-					psvr->sensor_endpoint) |
+		bEndpointAddress = (control ? psvr->control_endpoint :
+					      psvr->sensor_endpoint) |
 				   LIBUSB_ENDPOINT_IN;
 		libusb_fill_bulk_transfer(psvr->transfer[i], devh,
 					  bEndpointAddress, buf, 64,
-					  (i ? psvr_control_transfer_callback :
-					       psvr_sensor_transfer_callback),
+					  (control ? psvr_control_transfer_callback :
+						     psvr_sensor_transfer_callback),
 					  psvr, 0);
 
 		ret = libusb_submit_transfer(psvr->transfer[i]);
@@ -563,6 +634,9 @@ static void psvr_stop(OuvrtDevice *dev)
  */
 static void ouvrt_psvr_finalize(GObject *object)
 {
+	OuvrtPSVR *self = OUVRT_PSVR(object);
+
+	g_async_queue_unref(self->sensor_queue);
 	G_OBJECT_CLASS(ouvrt_psvr_parent_class)->finalize(object);
 }
 
@@ -570,6 +644,7 @@ static void ouvrt_psvr_class_init(OuvrtPSVRClass *klass)
 {
 	G_OBJECT_CLASS(klass)->finalize = ouvrt_psvr_finalize;
 	OUVRT_DEVICE_CLASS(klass)->start = psvr_start;
+	OUVRT_DEVICE_CLASS(klass)->thread = psvr_thread;
 	OUVRT_DEVICE_CLASS(klass)->stop = psvr_stop;
 }
 
@@ -585,6 +660,7 @@ static void ouvrt_psvr_init(OuvrtPSVR *self)
 
 	self->status_flags = 0;
 	self->volume = 0;
+	self->sensor_queue = g_async_queue_new();
 }
 
 /*
@@ -596,3 +672,12 @@ OuvrtDevice *psvr_new(G_GNUC_UNUSED const char *devnode)
 {
 	return OUVRT_DEVICE(g_object_new(OUVRT_TYPE_PSVR, NULL));
 }
+
+/*
+ * Sets the number of sensor transfers kept in flight for each headset.
+ */
+void ouvrt_psvr_set_num_sensor_transfers(int num_transfers)
+{
+	psvr_num_sensor_transfers = CLAMP(num_transfers, 1,
+					  PSVR_MAX_SENSOR_TRANSFERS);
+}
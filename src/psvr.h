@@ -13,10 +13,13 @@
 
 G_BEGIN_DECLS
 
+#define PSVR_MAX_SENSOR_TRANSFERS	16
+
 #define OUVRT_TYPE_PSVR (ouvrt_psvr_get_type())
 G_DECLARE_FINAL_TYPE(OuvrtPSVR, ouvrt_psvr, OUVRT, PSVR, OuvrtUSBDevice)
 
 OuvrtDevice *psvr_new(const char *devnode);
+void ouvrt_psvr_set_num_sensor_transfers(int num_transfers);
 
 G_END_DECLS
 
@@ -0,0 +1,333 @@
+/*
+ * Shared epoll event dispatch threads
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Instead of running a poll loop in a separate thread per device, devices
+ * can register their file descriptors with one of a small number of reactor
+ * threads. Each reactor thread waits on an epoll instance and calls the
+ * handler of every ready source. Periodic timeouts are implemented with
+ * timerfds on the same epoll instance.
+ *
+ * All sources of a device should be added to the same reactor, so that its
+ * handlers are never called concurrently.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <glib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "reactor.h"
+
+#define REACTOR_MAX_EVENTS	16
+
+struct reactor_source {
+	struct reactor *reactor;
+	int fd;
+	bool timer;
+	bool removed;
+	reactor_func func;
+	void *data;
+	/* list of removed sources to be freed after the current dispatch */
+	struct reactor_source *next;
+};
+
+struct reactor {
+	int index;
+	int epoll_fd;
+	int wake_fd;
+	GThread *thread;
+	/* held while dispatching the events returned by a single wait */
+	GMutex lock;
+	struct reactor_source *removed;
+};
+
+static struct reactor reactors[REACTOR_MAX_THREADS];
+static int num_reactors;
+static int next_reactor;
+static bool reactor_running;
+
+/*
+ * Pins the calling reactor thread to a single CPU, spreading the reactors
+ * over all CPUs.
+ */
+static void reactor_pin_thread(struct reactor *reactor)
+{
+	cpu_set_t cpuset;
+	int cpu = reactor->index % g_get_num_processors();
+	int ret;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	if (ret)
+		g_print("Reactor %d: Failed to pin to CPU %d: %d\n",
+			reactor->index, cpu, ret);
+}
+
+static void reactor_free_removed(struct reactor *reactor)
+{
+	struct reactor_source *source;
+
+	while (reactor->removed) {
+		source = reactor->removed;
+		reactor->removed = source->next;
+		free(source);
+	}
+}
+
+static gpointer reactor_thread(gpointer data)
+{
+	struct reactor *reactor = data;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	int num, i;
+
+	reactor_pin_thread(reactor);
+
+	while (__atomic_load_n(&reactor_running, __ATOMIC_ACQUIRE)) {
+		num = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS,
+				 -1);
+		if (num < 0) {
+			if (errno == EINTR)
+				continue;
+			g_print("Reactor %d: Wait failure: %d\n",
+				reactor->index, errno);
+			break;
+		}
+
+		g_mutex_lock(&reactor->lock);
+		for (i = 0; i < num; i++) {
+			struct reactor_source *source = events[i].data.ptr;
+			uint64_t expirations;
+
+			/* The wake eventfd has no source */
+			if (!source || source->removed)
+				continue;
+
+			if (source->timer &&
+			    read(source->fd, &expirations,
+				 sizeof(expirations)) != sizeof(expirations))
+				continue;
+
+			source->func(source, events[i].events, source->data);
+		}
+		reactor_free_removed(reactor);
+		g_mutex_unlock(&reactor->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Starts the given number of reactor threads. Without reactor threads,
+ * devices run their own poll loop threads.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int reactor_init(int num_threads)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+	int i;
+
+	if (num_reactors)
+		return -EBUSY;
+	if (num_threads <= 0)
+		return 0;
+
+	num_threads = MIN(num_threads, REACTOR_MAX_THREADS);
+	__atomic_store_n(&reactor_running, true, __ATOMIC_RELEASE);
+
+	for (i = 0; i < num_threads; i++) {
+		struct reactor *reactor = &reactors[i];
+
+		reactor->index = i;
+		reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (reactor->epoll_fd < 0)
+			break;
+		reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (reactor->wake_fd < 0 ||
+		    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD,
+			      reactor->wake_fd, &event) < 0) {
+			if (reactor->wake_fd >= 0)
+				close(reactor->wake_fd);
+			close(reactor->epoll_fd);
+			break;
+		}
+		g_mutex_init(&reactor->lock);
+		reactor->removed = NULL;
+		reactor->thread = g_thread_new("reactor", reactor_thread,
+					       reactor);
+	}
+
+	num_reactors = i;
+	if (num_reactors == 0) {
+		g_print("Reactor: Failed to create epoll instance: %d\n",
+			errno);
+		return -errno;
+	}
+
+	g_print("Reactor: Dispatching device events from %d thread%s\n",
+		num_reactors, num_reactors > 1 ? "s" : "");
+
+	return 0;
+}
+
+/*
+ * Stops all reactor threads. All sources must have been removed before.
+ */
+void reactor_deinit(void)
+{
+	uint64_t one = 1;
+	int i;
+
+	__atomic_store_n(&reactor_running, false, __ATOMIC_RELEASE);
+
+	for (i = 0; i < num_reactors; i++) {
+		struct reactor *reactor = &reactors[i];
+
+		if (write(reactor->wake_fd, &one, sizeof(one)) != sizeof(one))
+			g_print("Reactor %d: Failed to wake: %d\n", i, errno);
+		g_thread_join(reactor->thread);
+		reactor_free_removed(reactor);
+		g_mutex_clear(&reactor->lock);
+		close(reactor->wake_fd);
+		close(reactor->epoll_fd);
+	}
+
+	num_reactors = 0;
+}
+
+/*
+ * Returns true if reactor threads are running.
+ */
+bool reactor_enabled(void)
+{
+	return num_reactors > 0;
+}
+
+/*
+ * Returns the next reactor, distributing devices evenly over all reactor
+ * threads, or NULL if no reactor threads are running.
+ */
+struct reactor *reactor_get(void)
+{
+	int index;
+
+	if (!num_reactors)
+		return NULL;
+
+	index = __atomic_fetch_add(&next_reactor, 1, __ATOMIC_RELAXED);
+
+	return &reactors[index % num_reactors];
+}
+
+static struct reactor_source *reactor_add_source(struct reactor *reactor,
+						 int fd, bool timer,
+						 reactor_func func, void *data)
+{
+	struct epoll_event event = { .events = EPOLLIN };
+	struct reactor_source *source;
+
+	source = calloc(1, sizeof(*source));
+	if (!source)
+		return NULL;
+
+	source->reactor = reactor;
+	source->fd = fd;
+	source->timer = timer;
+	source->func = func;
+	source->data = data;
+
+	event.data.ptr = source;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		g_print("Reactor %d: Failed to add fd %d: %d\n",
+			reactor->index, fd, errno);
+		free(source);
+		return NULL;
+	}
+
+	return source;
+}
+
+/*
+ * Calls func from the reactor thread whenever fd is readable or an error
+ * condition occurs on it.
+ *
+ * Returns the new source, or NULL on failure.
+ */
+struct reactor_source *reactor_add_fd(struct reactor *reactor, int fd,
+				      reactor_func func, void *data)
+{
+	return reactor_add_source(reactor, fd, false, func, data);
+}
+
+/*
+ * Calls func from the reactor thread every interval_ms milliseconds.
+ *
+ * Returns the new source, or NULL on failure.
+ */
+struct reactor_source *reactor_add_timer(struct reactor *reactor,
+					 int interval_ms, reactor_func func,
+					 void *data)
+{
+	struct itimerspec spec = {
+		.it_interval = {
+			.tv_sec = interval_ms / 1000,
+			.tv_nsec = (interval_ms % 1000) * 1000000,
+		},
+	};
+	struct reactor_source *source;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	spec.it_value = spec.it_interval;
+	if (timerfd_settime(fd, 0, &spec, NULL) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	source = reactor_add_source(reactor, fd, true, func, data);
+	if (!source)
+		close(fd);
+
+	return source;
+}
+
+/*
+ * Removes a source from its reactor. Once this returns, the handler is not
+ * called anymore. This may be called from the handler itself.
+ */
+void reactor_remove(struct reactor_source *source)
+{
+	struct reactor *reactor = source->reactor;
+	bool in_reactor = g_thread_self() == reactor->thread;
+
+	/* Wait until the reactor has finished dispatching */
+	if (!in_reactor)
+		g_mutex_lock(&reactor->lock);
+
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+	if (source->timer)
+		close(source->fd);
+
+	/*
+	 * The reactor thread may already have received events for this
+	 * source, so it is only freed after the next dispatch.
+	 */
+	source->removed = true;
+	source->next = reactor->removed;
+	reactor->removed = source;
+
+	if (!in_reactor)
+		g_mutex_unlock(&reactor->lock);
+}
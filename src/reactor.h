@@ -0,0 +1,35 @@
+/*
+ * Shared epoll event dispatch threads
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define REACTOR_MAX_THREADS	8
+
+struct reactor;
+struct reactor_source;
+
+/*
+ * Called from the reactor thread with the epoll events of the source.
+ */
+typedef void (*reactor_func)(struct reactor_source *source, uint32_t events,
+			     void *data);
+
+int reactor_init(int num_threads);
+void reactor_deinit(void);
+bool reactor_enabled(void);
+
+struct reactor *reactor_get(void);
+struct reactor_source *reactor_add_fd(struct reactor *reactor, int fd,
+				      reactor_func func, void *data);
+struct reactor_source *reactor_add_timer(struct reactor *reactor,
+					 int interval_ms, reactor_func func,
+					 void *data);
+void reactor_remove(struct reactor_source *source);
+
+#endif /* __REACTOR_H__ */
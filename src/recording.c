@@ -0,0 +1,550 @@
+/*
+ * Raw sensor session recording
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Records HID input and feature reports, raw camera frames, and exposure
+ * events with their host arrival times into a chunked file, so that sessions
+ * can be replayed through the device drivers later. The file is memory
+ * mapped and grown in large steps, so that appending a chunk from the device
+ * threads is just a copy.
+ *
+ * Optionally, greyscale frames are stored sparsely, as the runs of pixels
+ * above the blob detection threshold, with a full keyframe at regular
+ * intervals. Since all other pixels are ignored by blob detection anyway,
+ * replaying sparse frames produces the same blobs as the raw frames.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blobwatch.h"
+#include "recording.h"
+
+#define RECORDING_GROW_SIZE	(64 * 1024 * 1024)
+
+struct recording {
+	int fd;
+	uint8_t *map;
+	size_t size;
+	size_t offset;
+	int num_streams;
+	/* frames per stream, each stream is written by a single thread */
+	unsigned int num_frames[RECORDING_MAX_STREAMS];
+	bool failed;
+	GMutex lock;
+};
+
+struct recording_reader {
+	uint8_t *map;
+	size_t size;
+	size_t offset;
+};
+
+bool recording_active;
+struct recording_fd recording_fds[RECORDING_MAX_FDS];
+
+static struct recording recording = { .fd = -1 };
+static bool recording_sparse;
+
+static uint64_t recording_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Makes room for len more bytes at the end of the mapping. Called with the
+ * lock held.
+ */
+static int recording_reserve(size_t len)
+{
+	size_t size = recording.size;
+	void *map;
+
+	if (recording.offset + len <= size)
+		return 0;
+
+	while (recording.offset + len > size)
+		size += RECORDING_GROW_SIZE;
+
+	if (ftruncate(recording.fd, size) < 0)
+		return -errno;
+
+	map = mremap(recording.map, recording.size, size, MREMAP_MAYMOVE);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	recording.map = map;
+	recording.size = size;
+
+	return 0;
+}
+
+/*
+ * Enables sparse storage of greyscale frames for recordings started
+ * afterwards.
+ */
+void recording_set_sparse_frames(bool enable)
+{
+	recording_sparse = enable;
+}
+
+/*
+ * Starts recording into a new file at path.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int recording_start(const char *path)
+{
+	struct recording_header *header;
+	int ret;
+
+	if (recording.fd != -1)
+		return -EBUSY;
+
+	recording.fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+			    0644);
+	if (recording.fd < 0)
+		return -errno;
+
+	if (ftruncate(recording.fd, RECORDING_GROW_SIZE) < 0)
+		goto err_close;
+
+	recording.map = mmap(NULL, RECORDING_GROW_SIZE, PROT_READ | PROT_WRITE,
+			     MAP_SHARED, recording.fd, 0);
+	if (recording.map == MAP_FAILED)
+		goto err_close;
+
+	recording.size = RECORDING_GROW_SIZE;
+	recording.offset = sizeof(*header);
+	recording.num_streams = 0;
+	memset(recording.num_frames, 0, sizeof(recording.num_frames));
+	recording.failed = false;
+
+	header = (struct recording_header *)recording.map;
+	memcpy(header->magic, RECORDING_MAGIC, sizeof(header->magic));
+	header->version = __cpu_to_le32(RECORDING_VERSION);
+	header->reserved = 0;
+
+	__atomic_store_n(&recording_active, true, __ATOMIC_RELEASE);
+
+	g_print("Recording: Writing session to %s\n", path);
+
+	return 0;
+
+err_close:
+	ret = -errno;
+	close(recording.fd);
+	recording.fd = -1;
+	return ret;
+}
+
+/*
+ * Stops recording and truncates the file to the recorded chunks. Devices
+ * should be stopped before.
+ */
+void recording_stop(void)
+{
+	if (recording.fd == -1)
+		return;
+
+	__atomic_store_n(&recording_active, false, __ATOMIC_RELEASE);
+
+	g_mutex_lock(&recording.lock);
+	munmap(recording.map, recording.size);
+	if (ftruncate(recording.fd, recording.offset) < 0)
+		g_print("Recording: Failed to truncate: %d\n", errno);
+	close(recording.fd);
+	recording.fd = -1;
+	recording.map = NULL;
+	recording.size = 0;
+	g_mutex_unlock(&recording.lock);
+
+	g_print("Recording: Wrote %zu bytes\n", recording.offset);
+}
+
+/*
+ * Reserves a chunk of len payload bytes and fills in its header. On success,
+ * returns with the lock held and the chunk to be filled.
+ */
+static struct recording_chunk *
+recording_begin_chunk(enum recording_chunk_type type, int stream,
+		      uint64_t time, size_t len)
+{
+	struct recording_chunk *chunk;
+	size_t size = (sizeof(*chunk) + len + 7) & ~7;
+
+	if (!time)
+		time = recording_now();
+
+	g_mutex_lock(&recording.lock);
+	if (recording.fd == -1 || recording.failed ||
+	    recording_reserve(size) < 0) {
+		if (recording.fd != -1 && !recording.failed)
+			g_print("Recording: Failed to grow file, stopping\n");
+		recording.failed = true;
+		g_mutex_unlock(&recording.lock);
+		return NULL;
+	}
+
+	chunk = (struct recording_chunk *)(recording.map + recording.offset);
+	/* Clear the padding before the header and payload are filled in */
+	memset((uint8_t *)chunk + size - 8, 0, 8);
+	chunk->type = __cpu_to_le32(type);
+	chunk->len = __cpu_to_le32(len);
+	chunk->time = __cpu_to_le64(time);
+	chunk->stream = __cpu_to_le16(stream);
+	memset(chunk->reserved, 0, sizeof(chunk->reserved));
+	recording.offset += size;
+
+	return chunk;
+}
+
+/*
+ * Appends a chunk. A zero time is replaced with the current host time.
+ */
+void recording_write(enum recording_chunk_type type, int stream,
+		     uint64_t time, const void *data, size_t len)
+{
+	struct recording_chunk *chunk;
+
+	if (!recording_enabled())
+		return;
+
+	chunk = recording_begin_chunk(type, stream, time, len);
+	if (!chunk)
+		return;
+	memcpy(chunk + 1, data, len);
+	g_mutex_unlock(&recording.lock);
+}
+
+/*
+ * Appends a chunk to the stream registered for the file descriptor.
+ */
+void recording_write_fd(enum recording_chunk_type type, int fd,
+			uint64_t time, const void *data, size_t len)
+{
+	if (!(recording_fd_flags(fd) & RECORDING_FD_RECORD))
+		return;
+
+	recording_write(type, recording_fds[fd].stream, time, data, len);
+}
+
+static void recording_fill_frame(struct recording_frame *frame, int width,
+				 int height, uint32_t fourcc,
+				 uint64_t device_time)
+{
+	frame->width = __cpu_to_le16(width);
+	frame->height = __cpu_to_le16(height);
+	frame->fourcc = __cpu_to_le32(fourcc);
+	frame->device_time = __cpu_to_le64(device_time);
+}
+
+/*
+ * Appends a sparse frame chunk. The frame is scanned twice, first to size
+ * the chunk and then to copy the runs directly into the mapping.
+ */
+static void recording_write_sparse_frame(enum recording_chunk_type type,
+					 int stream, uint64_t time, int width,
+					 int height, uint64_t device_time,
+					 const uint8_t *data)
+{
+	struct recording_chunk *chunk;
+	struct recording_frame *frame;
+	struct recording_sparse_frame *sparse;
+	struct recording_run *run;
+	const uint8_t *line;
+	uint8_t *pixels;
+	size_t num_runs = 0;
+	size_t num_pixels = 0;
+	int x, y, end;
+
+	for (y = 0, line = data; y < height; y++, line += width) {
+		for (x = blobwatch_find_run(line, 0, width, &end); x < width;
+		     x = blobwatch_find_run(line, end, width, &end)) {
+			num_runs++;
+			num_pixels += end - x;
+		}
+	}
+
+	chunk = recording_begin_chunk(RECORDING_CHUNK_SPARSE_FRAME, stream,
+				      time, sizeof(*frame) + sizeof(*sparse) +
+				      num_runs * sizeof(*run) + num_pixels);
+	if (!chunk)
+		return;
+	frame = (struct recording_frame *)(chunk + 1);
+	recording_fill_frame(frame, width, height, RECORDING_FOURCC_GREY,
+			     device_time);
+	sparse = (struct recording_sparse_frame *)(frame + 1);
+	sparse->type = __cpu_to_le32(type);
+	sparse->num_runs = __cpu_to_le32(num_runs);
+	run = (struct recording_run *)(sparse + 1);
+	pixels = (uint8_t *)(run + num_runs);
+
+	for (y = 0, line = data; y < height; y++, line += width) {
+		for (x = blobwatch_find_run(line, 0, width, &end); x < width;
+		     x = blobwatch_find_run(line, end, width, &end), run++) {
+			run->x = __cpu_to_le16(x);
+			run->y = __cpu_to_le16(y);
+			run->len = __cpu_to_le16(end - x);
+			memcpy(pixels, line + x, end - x);
+			pixels += end - x;
+		}
+	}
+	g_mutex_unlock(&recording.lock);
+}
+
+/*
+ * Appends a camera frame chunk, with the frame header and pixel data copied
+ * directly into the mapping. In sparse mode, greyscale frames between
+ * keyframes are stored as sparse frame chunks instead.
+ */
+void recording_write_frame(enum recording_chunk_type type, int stream,
+			   uint64_t time, int width, int height,
+			   uint32_t fourcc, uint64_t device_time,
+			   const void *data, size_t len)
+{
+	struct recording_chunk *chunk;
+	struct recording_frame *frame;
+
+	if (!recording_enabled() || stream < 0)
+		return;
+
+	if (recording_sparse && fourcc == RECORDING_FOURCC_GREY &&
+	    stream < RECORDING_MAX_STREAMS && len >= (size_t)width * height &&
+	    recording.num_frames[stream]++ % RECORDING_KEYFRAME_INTERVAL) {
+		recording_write_sparse_frame(type, stream, time, width, height,
+					     device_time, data);
+		return;
+	}
+
+	chunk = recording_begin_chunk(type, stream, time,
+				      sizeof(*frame) + len);
+	if (!chunk)
+		return;
+	frame = (struct recording_frame *)(chunk + 1);
+	recording_fill_frame(frame, width, height, fourcc, device_time);
+	memcpy(frame + 1, data, len);
+	g_mutex_unlock(&recording.lock);
+}
+
+/*
+ * Adds a stream for the fd index of the named device and, if fd is valid,
+ * records the HID reports read from it into the new stream.
+ *
+ * Returns the stream id, or -1 if not recording.
+ */
+int recording_add_stream(const char *name, int index, int fd)
+{
+	struct recording_stream stream = {
+		.index = __cpu_to_le16(index),
+	};
+	int id;
+
+	if (!recording_enabled())
+		return -1;
+
+	g_mutex_lock(&recording.lock);
+	if (recording.num_streams == RECORDING_MAX_STREAMS) {
+		g_mutex_unlock(&recording.lock);
+		return -1;
+	}
+	id = recording.num_streams++;
+	g_mutex_unlock(&recording.lock);
+
+	stream.id = __cpu_to_le16(id);
+	g_strlcpy(stream.name, name, sizeof(stream.name));
+	recording_write(RECORDING_CHUNK_STREAM, id, 0, &stream, sizeof(stream));
+
+	if (fd >= 0)
+		recording_register_fd(fd, id, RECORDING_FD_RECORD);
+
+	return id;
+}
+
+/*
+ * Associates a file descriptor with a stream, for recording or replay.
+ */
+void recording_register_fd(int fd, int stream, int flags)
+{
+	if (fd < 0 || fd >= RECORDING_MAX_FDS)
+		return;
+
+	recording_fds[fd].stream = stream;
+	__atomic_store_n(&recording_fds[fd].flags, flags, __ATOMIC_RELEASE);
+}
+
+/*
+ * Removes the stream association of a file descriptor before it is closed.
+ */
+void recording_unregister_fd(int fd)
+{
+	if (fd < 0 || fd >= RECORDING_MAX_FDS)
+		return;
+
+	__atomic_store_n(&recording_fds[fd].flags, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Maps a recorded session read-only.
+ *
+ * Returns the new reader, or NULL on failure.
+ */
+struct recording_reader *recording_reader_open(const char *path)
+{
+	const struct recording_header *header;
+	struct recording_reader *reader;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		g_print("Recording: Failed to open %s: %d\n", path, errno);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+		g_print("Recording: %s is too short\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		g_print("Recording: Failed to map %s: %d\n", path, errno);
+		return NULL;
+	}
+
+	header = map;
+	if (memcmp(header->magic, RECORDING_MAGIC, sizeof(header->magic)) ||
+	    __le32_to_cpu(header->version) != RECORDING_VERSION) {
+		g_print("Recording: %s is not a version %d recording\n", path,
+			RECORDING_VERSION);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	reader = g_new0(struct recording_reader, 1);
+	reader->map = map;
+	reader->size = st.st_size;
+	reader->offset = sizeof(*header);
+
+	return reader;
+}
+
+void recording_reader_close(struct recording_reader *reader)
+{
+	if (!reader)
+		return;
+
+	munmap(reader->map, reader->size);
+	g_free(reader);
+}
+
+/*
+ * Restarts iteration at the first chunk.
+ */
+void recording_reader_rewind(struct recording_reader *reader)
+{
+	reader->offset = sizeof(struct recording_header);
+}
+
+/*
+ * Returns the next complete chunk, or NULL at the end of the recording.
+ */
+const struct recording_chunk *
+recording_reader_next(struct recording_reader *reader)
+{
+	const struct recording_chunk *chunk;
+	size_t size;
+
+	if (reader->offset + sizeof(*chunk) > reader->size)
+		return NULL;
+
+	chunk = (const struct recording_chunk *)(reader->map + reader->offset);
+	size = (sizeof(*chunk) + __le32_to_cpu(chunk->len) + 7) & ~7;
+	if (__le32_to_cpu(chunk->len) > reader->size - reader->offset -
+					sizeof(*chunk))
+		return NULL;
+
+	reader->offset += size;
+
+	return chunk;
+}
+
+/*
+ * Decodes the greyscale frame of a full or sparse frame chunk into a buffer
+ * of size bytes.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int recording_decode_frame(const struct recording_chunk *chunk,
+			   uint8_t *frame, size_t size)
+{
+	const struct recording_frame *rec = recording_chunk_data(chunk);
+	const struct recording_sparse_frame *sparse;
+	const struct recording_run *run;
+	const uint8_t *pixels;
+	uint32_t type = __le32_to_cpu(chunk->type);
+	size_t len = __le32_to_cpu(chunk->len);
+	size_t frame_size, num_runs, i;
+	int width, height;
+
+	if (len < sizeof(*rec) ||
+	    __le32_to_cpu(rec->fourcc) != RECORDING_FOURCC_GREY)
+		return -EINVAL;
+
+	width = __le16_to_cpu(rec->width);
+	height = __le16_to_cpu(rec->height);
+	frame_size = (size_t)width * height;
+	if (size < frame_size)
+		return -ENOSPC;
+	len -= sizeof(*rec);
+
+	if (type == RECORDING_CHUNK_SENSOR_FRAME ||
+	    type == RECORDING_CHUNK_V4L2_FRAME) {
+		if (len < frame_size)
+			return -EINVAL;
+		memcpy(frame, rec + 1, frame_size);
+		return 0;
+	}
+
+	if (type != RECORDING_CHUNK_SPARSE_FRAME || len < sizeof(*sparse))
+		return -EINVAL;
+
+	sparse = (const struct recording_sparse_frame *)(rec + 1);
+	num_runs = __le32_to_cpu(sparse->num_runs);
+	len -= sizeof(*sparse);
+	if (num_runs > len / sizeof(*run))
+		return -EINVAL;
+	len -= num_runs * sizeof(*run);
+	run = (const struct recording_run *)(sparse + 1);
+	pixels = (const uint8_t *)(run + num_runs);
+
+	memset(frame, 0, frame_size);
+	for (i = 0; i < num_runs; i++, run++) {
+		int x = __le16_to_cpu(run->x);
+		int y = __le16_to_cpu(run->y);
+		size_t n = __le16_to_cpu(run->len);
+
+		if (x + n > (size_t)width || y >= height || n > len)
+			return -EINVAL;
+		memcpy(frame + y * width + x, pixels, n);
+		pixels += n;
+		len -= n;
+	}
+
+	return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * Raw sensor session recording
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __RECORDING_H__
+#define __RECORDING_H__
+
+#include <asm/byteorder.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RECORDING_MAGIC		"OUVRTREC"
+#define RECORDING_VERSION	1
+
+#define RECORDING_MAX_FDS	1024
+#define RECORDING_MAX_STREAMS	64
+/* stream id of chunks that do not belong to a device */
+#define RECORDING_NO_STREAM	0xffff
+/* stream index of camera frames, after the up to three device fds */
+#define RECORDING_INDEX_FRAMES	3
+/* V4L2_PIX_FMT_GREY */
+#define RECORDING_FOURCC_GREY	0x59455247
+/* every this many frames of a stream, sparse recording stores a full frame */
+#define RECORDING_KEYFRAME_INTERVAL	256
+
+enum recording_chunk_type {
+	/* struct recording_stream */
+	RECORDING_CHUNK_STREAM = 1,
+	/* HID input report as read from the device */
+	RECORDING_CHUNK_HID_REPORT,
+	/* HID feature report as received from the device */
+	RECORDING_CHUNK_HID_FEATURE,
+	/* struct recording_frame followed by the raw Rift sensor frame */
+	RECORDING_CHUNK_SENSOR_FRAME,
+	/* struct recording_frame followed by the raw V4L2 buffer */
+	RECORDING_CHUNK_V4L2_FRAME,
+	/* struct recording_exposure */
+	RECORDING_CHUNK_EXPOSURE,
+	/*
+	 * struct recording_frame and struct recording_sparse_frame, followed
+	 * by the run table and the concatenated pixels of all runs
+	 */
+	RECORDING_CHUNK_SPARSE_FRAME,
+};
+
+struct recording_header {
+	char magic[8];
+	__le32 version;
+	__le32 reserved;
+} __attribute__((packed));
+
+/*
+ * Every chunk starts at an 8-byte aligned offset, with the host time in
+ * CLOCK_MONOTONIC nanoseconds at which its data arrived.
+ */
+struct recording_chunk {
+	__le32 type;
+	__le32 len;
+	__le64 time;
+	__le16 stream;
+	__le16 reserved[3];
+} __attribute__((packed));
+
+/*
+ * Names the device and fd index of a stream. Chunks of the stream refer to
+ * it by its id.
+ */
+struct recording_stream {
+	__le16 id;
+	__le16 index;
+	__le32 reserved;
+	char name[56];
+} __attribute__((packed));
+
+struct recording_frame {
+	__le16 width;
+	__le16 height;
+	__le32 fourcc;
+	__le64 device_time;
+} __attribute__((packed));
+
+/*
+ * Greyscale frame stored as the runs of pixels above the blob detection
+ * threshold. All other pixels are zero. The type is the chunk type the full
+ * frame would have been recorded with.
+ */
+struct recording_sparse_frame {
+	__le32 type;
+	__le32 num_runs;
+} __attribute__((packed));
+
+struct recording_run {
+	__le16 x;
+	__le16 y;
+	__le16 len;
+} __attribute__((packed));
+
+struct recording_exposure {
+	__le32 device_timestamp;
+	__le16 count;
+	__u8 led_pattern_phase;
+	__u8 reserved;
+} __attribute__((packed));
+
+/* Flags of registered file descriptors */
+#define RECORDING_FD_RECORD	0x1
+#define RECORDING_FD_REPLAY	0x2
+
+struct recording_fd {
+	uint16_t stream;
+	uint8_t flags;
+};
+
+extern bool recording_active;
+extern struct recording_fd recording_fds[RECORDING_MAX_FDS];
+
+static inline bool recording_enabled(void)
+{
+	return __atomic_load_n(&recording_active, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns the registration flags of the file descriptor.
+ */
+static inline int recording_fd_flags(int fd)
+{
+	if (fd < 0 || fd >= RECORDING_MAX_FDS)
+		return 0;
+	return recording_fds[fd].flags;
+}
+
+void recording_set_sparse_frames(bool enable);
+
+int recording_start(const char *path);
+void recording_stop(void);
+
+int recording_add_stream(const char *name, int index, int fd);
+void recording_register_fd(int fd, int stream, int flags);
+void recording_unregister_fd(int fd);
+void recording_write(enum recording_chunk_type type, int stream,
+		     uint64_t time, const void *data, size_t len);
+void recording_write_fd(enum recording_chunk_type type, int fd,
+			uint64_t time, const void *data, size_t len);
+void recording_write_frame(enum recording_chunk_type type, int stream,
+			   uint64_t time, int width, int height,
+			   uint32_t fourcc, uint64_t device_time,
+			   const void *data, size_t len);
+
+struct recording_reader;
+
+struct recording_reader *recording_reader_open(const char *path);
+void recording_reader_close(struct recording_reader *reader);
+void recording_reader_rewind(struct recording_reader *reader);
+const struct recording_chunk *
+recording_reader_next(struct recording_reader *reader);
+int recording_decode_frame(const struct recording_chunk *chunk,
+			   uint8_t *frame, size_t size);
+
+/*
+ * Returns the payload following a chunk header.
+ */
+static inline const void *recording_chunk_data(const struct recording_chunk *chunk)
+{
+	return chunk + 1;
+}
+
+#endif /* __RECORDING_H__ */
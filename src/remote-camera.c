@@ -0,0 +1,776 @@
+/*
+ * Remote camera nodes
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * A capture node runs the cameras and blob detection locally and sends only
+ * the blobs detected in each frame, with the node time of its start of
+ * exposure, to the central tracker via UDP. The central tracker feeds them
+ * into a tracker camera per remote camera, where they are tracked and
+ * identified against the exposures of the tracked devices just like the
+ * blobs of local cameras. Node clocks are aligned to the central clock with
+ * the send times of all received packets.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <glib.h>
+#include <math.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blobwatch.h"
+#include "clock-sync.h"
+#include "distortion.h"
+#include "log.h"
+#include "remote-camera.h"
+
+/* the node repeats the camera info every this many frames */
+#define REMOTE_CAMERA_INFO_INTERVAL	64
+#define REMOTE_CAMERA_MAX_CAMERAS	8
+/* image size limits of the supported sensors */
+#define REMOTE_CAMERA_MIN_SIZE		64
+#define REMOTE_CAMERA_MAX_WIDTH		2048
+#define REMOTE_CAMERA_MAX_HEIGHT	2048
+/* time in ns without packets after which a remote camera is forgotten */
+#define REMOTE_CAMERA_TIMEOUT		10000000000ULL
+#define REMOTE_CAMERA_PACKET_SIZE	(sizeof(struct remote_camera_blobs) + \
+					 REMOTE_CAMERA_MAX_BLOBS * \
+					 sizeof(struct remote_camera_blob))
+
+struct remote_camera {
+	int fd;
+	char serial[32];
+	int width;
+	int height;
+	uint32_t sequence;
+	unsigned int frames_since_info;
+	uint32_t radio_address;
+	uint8_t packet[REMOTE_CAMERA_PACKET_SIZE];
+};
+
+/* Central tracker side state of a remote camera */
+struct remote_camera_entry {
+	char serial[32];
+	/* host time in ns of the last packet received */
+	uint64_t last_time;
+	bool info_valid;
+	int width;
+	int height;
+	dmat3 camera_matrix;
+	struct distortion distortion;
+	bool calibrated;
+	struct clock_sync clock;
+	/* holds a reference while the tracker camera exists */
+	OuvrtTracker *tracker;
+	int tracker_camera;
+	struct blob blobs[REMOTE_CAMERA_MAX_BLOBS];
+};
+
+struct remote_camera_server {
+	int fd;
+	GThread *thread;
+	bool running;
+	GMutex lock;
+	OuvrtTracker *tracker;
+	int num_cameras;
+	struct remote_camera_entry cameras[REMOTE_CAMERA_MAX_CAMERAS];
+	uint8_t packet[REMOTE_CAMERA_PACKET_SIZE];
+};
+
+static struct sockaddr_in remote_camera_server_addr;
+static bool remote_camera_server_addr_valid;
+static struct remote_camera_server server = { .fd = -1 };
+
+static uint64_t remote_camera_now(void)
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+
+	return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static inline __le32 __float_to_le32(float f)
+{
+	union { float f; uint32_t u; } v = { .f = f };
+
+	return __cpu_to_le32(v.u);
+}
+
+static inline float __le32_to_float(__le32 l)
+{
+	union { float f; uint32_t u; } v = { .u = __le32_to_cpu(l) };
+
+	return v.f;
+}
+
+static void remote_camera_header_init(struct remote_camera_header *header,
+				      enum remote_camera_packet_type type,
+				      const char *serial)
+{
+	header->magic = __cpu_to_le32(REMOTE_CAMERA_MAGIC);
+	header->type = __cpu_to_le16(type);
+	header->version = __cpu_to_le16(REMOTE_CAMERA_VERSION);
+	header->time = __cpu_to_le64(remote_camera_now());
+	memset(header->serial, 0, sizeof(header->serial));
+	g_strlcpy(header->serial, serial, sizeof(header->serial));
+}
+
+/*
+ * Checks the header of a received packet of len bytes.
+ *
+ * Returns the packet type, or a negative error code if the packet is invalid.
+ */
+static int remote_camera_header_check(const struct remote_camera_header *header,
+				      size_t len)
+{
+	if (len < sizeof(*header) ||
+	    __le32_to_cpu(header->magic) != REMOTE_CAMERA_MAGIC ||
+	    __le16_to_cpu(header->version) != REMOTE_CAMERA_VERSION)
+		return -EINVAL;
+
+	return __le16_to_cpu(header->type);
+}
+
+/*
+ * Resolves an address given as host[:port] into addr. An address that only
+ * consists of a port number refers to default_host, if given.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+static int remote_camera_resolve(const char *address,
+				 const char *default_host,
+				 struct sockaddr_in *addr)
+{
+	struct addrinfo hints = {
+		.ai_family = AF_INET,
+		.ai_socktype = SOCK_DGRAM,
+	};
+	struct addrinfo *result;
+	char *host, *port;
+	int port_num = REMOTE_CAMERA_DEFAULT_PORT;
+	int ret;
+
+	if (default_host && address[0] &&
+	    strspn(address, "0123456789") == strlen(address)) {
+		host = g_strdup(default_host);
+		port_num = atoi(address);
+	} else {
+		host = g_strdup(address);
+		port = strrchr(host, ':');
+		if (port) {
+			*port++ = '\0';
+			port_num = atoi(port);
+		}
+	}
+
+	ret = getaddrinfo(host, NULL, &hints, &result);
+	g_free(host);
+	if (ret != 0)
+		return -EINVAL;
+	if (port_num <= 0 || port_num > 65535) {
+		freeaddrinfo(result);
+		return -EINVAL;
+	}
+
+	memcpy(addr, result->ai_addr, sizeof(*addr));
+	freeaddrinfo(result);
+	addr->sin_port = htons(port_num);
+
+	return 0;
+}
+
+/*
+ * Sets the address of the central tracker as host[:port]. All cameras
+ * started afterwards send their blobs there instead of tracking locally.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int remote_camera_set_server(const char *address)
+{
+	int ret;
+
+	ret = remote_camera_resolve(address, NULL,
+				    &remote_camera_server_addr);
+	if (ret < 0)
+		return ret;
+
+	remote_camera_server_addr_valid = true;
+
+	return 0;
+}
+
+/*
+ * Returns true if cameras should send their blobs to a central tracker.
+ */
+bool remote_camera_enabled(void)
+{
+	return remote_camera_server_addr_valid;
+}
+
+/*
+ * Creates a connection to the central tracker for the camera with the given
+ * serial number and image size.
+ *
+ * Returns the remote camera, or NULL on failure.
+ */
+struct remote_camera *remote_camera_new(const char *serial, int width,
+					int height)
+{
+	struct remote_camera *remote;
+
+	if (!remote_camera_server_addr_valid)
+		return NULL;
+
+	remote = calloc(1, sizeof(*remote));
+	if (!remote)
+		return NULL;
+
+	remote->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (remote->fd < 0 ||
+	    connect(remote->fd, (struct sockaddr *)&remote_camera_server_addr,
+		    sizeof(remote_camera_server_addr)) < 0) {
+		g_print("Remote camera: Failed to connect: %d\n", errno);
+		if (remote->fd >= 0)
+			close(remote->fd);
+		free(remote);
+		return NULL;
+	}
+
+	g_strlcpy(remote->serial, serial ? serial : "", sizeof(remote->serial));
+	remote->width = width;
+	remote->height = height;
+
+	return remote;
+}
+
+void remote_camera_free(struct remote_camera *remote)
+{
+	if (!remote)
+		return;
+
+	close(remote->fd);
+	free(remote);
+}
+
+static void remote_camera_send_info(struct remote_camera *remote,
+				    const dmat3 *camera_matrix,
+				    const struct distortion *distortion)
+{
+	struct remote_camera_info info = {
+		.width = __cpu_to_le16(remote->width),
+		.height = __cpu_to_le16(remote->height),
+	};
+	int i;
+
+	remote_camera_header_init(&info.header, REMOTE_CAMERA_PACKET_INFO,
+				  remote->serial);
+	if (camera_matrix) {
+		info.fx = __float_to_le32(camera_matrix->m[0]);
+		info.cx = __float_to_le32(camera_matrix->m[2]);
+		info.fy = __float_to_le32(camera_matrix->m[4]);
+		info.cy = __float_to_le32(camera_matrix->m[5]);
+	}
+	if (distortion) {
+		info.distortion_model = __cpu_to_le32(distortion->model);
+		for (i = 0; i < 5; i++)
+			info.k[i] = __float_to_le32(distortion->k[i]);
+	}
+
+	if (send(remote->fd, &info, sizeof(info), MSG_DONTWAIT) < 0 &&
+	    errno != EAGAIN && errno != ECONNREFUSED)
+		g_print("Remote camera: Failed to send info: %d\n", errno);
+}
+
+/*
+ * Picks up configuration replies from the central tracker without blocking.
+ */
+static void remote_camera_receive_config(struct remote_camera *remote)
+{
+	struct remote_camera_config config;
+	ssize_t len;
+
+	while ((len = recv(remote->fd, &config, sizeof(config),
+			   MSG_DONTWAIT)) > 0) {
+		if (remote_camera_header_check(&config.header, len) !=
+		    REMOTE_CAMERA_PACKET_CONFIG ||
+		    len < (ssize_t)sizeof(config) ||
+		    strncmp(config.header.serial, remote->serial,
+			    sizeof(config.header.serial)) != 0)
+			continue;
+		remote->radio_address = __le32_to_cpu(config.radio_address);
+	}
+}
+
+/*
+ * Sends the blobs detected in a frame that started exposure at sof_time, in
+ * CLOCK_MONOTONIC ns, to the central tracker. The camera calibration, which
+ * may be NULL if unknown, is repeated periodically.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int remote_camera_send(struct remote_camera *remote, uint64_t sof_time,
+		       const dmat3 *camera_matrix,
+		       const struct distortion *distortion,
+		       const struct blob *blobs, int num_blobs)
+{
+	struct remote_camera_blobs *packet = (void *)remote->packet;
+	struct remote_camera_blob *b = (void *)(packet + 1);
+	size_t len;
+	int i;
+
+	if (!remote)
+		return -EINVAL;
+
+	if (remote->frames_since_info == 0)
+		remote_camera_send_info(remote, camera_matrix, distortion);
+	remote->frames_since_info = (remote->frames_since_info + 1) %
+				    REMOTE_CAMERA_INFO_INTERVAL;
+
+	if (num_blobs > REMOTE_CAMERA_MAX_BLOBS)
+		num_blobs = REMOTE_CAMERA_MAX_BLOBS;
+
+	remote_camera_header_init(&packet->header, REMOTE_CAMERA_PACKET_BLOBS,
+				  remote->serial);
+	packet->sof_time = __cpu_to_le64(sof_time);
+	packet->sequence = __cpu_to_le32(remote->sequence++);
+	packet->num_blobs = __cpu_to_le16(num_blobs);
+	packet->reserved = 0;
+	for (i = 0; i < num_blobs; i++) {
+		b[i].x = __cpu_to_le16(blobs[i].x);
+		b[i].y = __cpu_to_le16(blobs[i].y);
+		b[i].width = __cpu_to_le16(blobs[i].width);
+		b[i].height = __cpu_to_le16(blobs[i].height);
+		b[i].area = __cpu_to_le32(blobs[i].area);
+		b[i].weight = __cpu_to_le32(blobs[i].weight);
+		b[i].cx = __float_to_le32(blobs[i].cx);
+		b[i].cy = __float_to_le32(blobs[i].cy);
+		b[i].mxx = __float_to_le32(blobs[i].mxx);
+		b[i].mxy = __float_to_le32(blobs[i].mxy);
+		b[i].myy = __float_to_le32(blobs[i].myy);
+	}
+	len = sizeof(*packet) + num_blobs * sizeof(*b);
+
+	remote_camera_receive_config(remote);
+
+	if (send(remote->fd, packet, len, MSG_DONTWAIT) < 0) {
+		/* Nobody listening yet, or the socket buffer is full */
+		if (errno != ECONNREFUSED && errno != EAGAIN)
+			g_print("Remote camera: Failed to send blobs: %d\n",
+				errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the radio address received from the central tracker, or 0 if
+ * none was received yet.
+ */
+uint32_t remote_camera_get_radio_address(struct remote_camera *remote)
+{
+	return remote ? remote->radio_address : 0;
+}
+
+/*
+ * Looks up the central state of the remote camera with the given serial,
+ * or creates it. Called from the server thread.
+ *
+ * Returns the camera entry, or NULL if there are too many remote cameras.
+ */
+static struct remote_camera_entry *
+remote_camera_server_get_camera(const struct remote_camera_header *header)
+{
+	struct remote_camera_entry *entry;
+	int i;
+
+	for (i = 0; i < server.num_cameras; i++) {
+		entry = &server.cameras[i];
+		if (strncmp(entry->serial, header->serial,
+			    sizeof(entry->serial)) == 0)
+			return entry;
+	}
+
+	if (server.num_cameras == REMOTE_CAMERA_MAX_CAMERAS) {
+		log_ratelimited("Remote camera: Ignoring camera %.32s\n",
+				header->serial);
+		return NULL;
+	}
+
+	entry = &server.cameras[server.num_cameras++];
+	memset(entry, 0, sizeof(*entry));
+	memcpy(entry->serial, header->serial, sizeof(entry->serial));
+	entry->serial[sizeof(entry->serial) - 1] = '\0';
+	entry->tracker_camera = -1;
+	clock_sync_init(&entry->clock, 1e9);
+	g_print("Remote camera: New camera %s\n", entry->serial);
+
+	return entry;
+}
+
+/*
+ * Removes the tracker camera of a remote camera, if it was added. Called
+ * from the server thread, which submits the remote camera's blobs.
+ */
+static void
+remote_camera_entry_remove_tracker(struct remote_camera_entry *entry)
+{
+	if (entry->tracker && entry->tracker_camera >= 0)
+		ouvrt_tracker_remove_camera(entry->tracker,
+					    entry->tracker_camera);
+	entry->tracker_camera = -1;
+	g_clear_object(&entry->tracker);
+}
+
+static void remote_camera_entry_fini(struct remote_camera_entry *entry)
+{
+	remote_camera_entry_remove_tracker(entry);
+	distortion_free_map(&entry->distortion);
+}
+
+/*
+ * Forgets remote cameras that did not send any packets for a while, so that
+ * their tracker cameras and entries are freed for other cameras.
+ */
+static void remote_camera_server_expire(uint64_t now)
+{
+	int i;
+
+	for (i = server.num_cameras - 1; i >= 0; i--) {
+		struct remote_camera_entry *entry = &server.cameras[i];
+
+		if (now - entry->last_time < REMOTE_CAMERA_TIMEOUT)
+			continue;
+
+		g_print("Remote camera: Camera %s timed out\n", entry->serial);
+		remote_camera_entry_fini(entry);
+		if (i != --server.num_cameras)
+			*entry = server.cameras[server.num_cameras];
+	}
+}
+
+static void remote_camera_server_info(struct remote_camera_entry *entry,
+				      const struct remote_camera_info *info)
+{
+	double *A = entry->camera_matrix.m;
+	int width = __le16_to_cpu(info->width);
+	int height = __le16_to_cpu(info->height);
+	dmat3 old_matrix = entry->camera_matrix;
+	struct distortion old = entry->distortion;
+	bool resized;
+	int i;
+
+	if (width < REMOTE_CAMERA_MIN_SIZE || width > REMOTE_CAMERA_MAX_WIDTH ||
+	    height < REMOTE_CAMERA_MIN_SIZE ||
+	    height > REMOTE_CAMERA_MAX_HEIGHT) {
+		log_ratelimited("Remote camera: %s: Invalid size %dx%d\n",
+				entry->serial, width, height);
+		return;
+	}
+
+	/*
+	 * The tracker camera can not be resized, it is replaced, reusing its
+	 * index, with the next blobs.
+	 */
+	resized = width != entry->width || height != entry->height;
+	if (entry->info_valid && resized)
+		remote_camera_entry_remove_tracker(entry);
+	entry->width = width;
+	entry->height = height;
+
+	memset(A, 0, sizeof(entry->camera_matrix));
+	A[0] = __le32_to_float(info->fx);
+	A[2] = __le32_to_float(info->cx);
+	A[4] = __le32_to_float(info->fy);
+	A[5] = __le32_to_float(info->cy);
+	A[8] = 1.0;
+	entry->distortion.model = __le32_to_cpu(info->distortion_model);
+	entry->calibrated = isfinite(A[2]) && isfinite(A[5]) &&
+			    isfinite(A[0]) && A[0] > 0.0 &&
+			    isfinite(A[4]) && A[4] > 0.0;
+	for (i = 0; i < 5; i++) {
+		entry->distortion.k[i] = __le32_to_float(info->k[i]);
+		if (!isfinite(entry->distortion.k[i]))
+			entry->calibrated = false;
+	}
+
+	/* Sample the undistortion again only if the calibration changed */
+	if (!entry->calibrated) {
+		distortion_free_map(&entry->distortion);
+	} else if (!entry->distortion.map || resized ||
+		   memcmp(&old_matrix, &entry->camera_matrix,
+			  sizeof(old_matrix)) != 0 ||
+		   old.model != entry->distortion.model ||
+		   memcmp(old.k, entry->distortion.k, sizeof(old.k)) != 0) {
+		distortion_init_map(&entry->distortion, &entry->camera_matrix,
+				    width, height);
+	}
+	entry->info_valid = true;
+}
+
+/*
+ * Feeds the received blobs into the tracker camera of the remote camera,
+ * which is added to the tracker on first use.
+ */
+static void remote_camera_server_blobs(struct remote_camera_entry *entry,
+				       const struct remote_camera_blobs *packet,
+				       size_t len, OuvrtTracker *tracker)
+{
+	const struct remote_camera_blob *b = (const void *)(packet + 1);
+	struct blobservation *ob = NULL;
+	uint64_t sof_time;
+	int num_blobs;
+	dquat rot;
+	dvec3 trans;
+	int i;
+
+	num_blobs = __le16_to_cpu(packet->num_blobs);
+	if (num_blobs > REMOTE_CAMERA_MAX_BLOBS ||
+	    len < sizeof(*packet) + num_blobs * sizeof(*b))
+		return;
+
+	if (!entry->info_valid || !tracker ||
+	    !ouvrt_tracker_is_active(tracker))
+		return;
+
+	if (entry->tracker != tracker) {
+		remote_camera_entry_remove_tracker(entry);
+		entry->tracker = g_object_ref(tracker);
+		entry->tracker_camera = ouvrt_tracker_add_camera(tracker,
+				entry->width, entry->height,
+				BLOBWATCH_FORMAT_GREY);
+		if (entry->tracker_camera < 0)
+			g_print("Remote camera: Failed to add %s: %d\n",
+				entry->serial, entry->tracker_camera);
+	}
+	if (entry->tracker_camera < 0)
+		return;
+
+	sof_time = clock_sync_to_host(&entry->clock,
+				      __le64_to_cpu(packet->sof_time));
+	if (!sof_time)
+		return;
+
+	for (i = 0; i < num_blobs; i++) {
+		struct blob *blob = &entry->blobs[i];
+
+		blobwatch_reset_blob(blob);
+		blob->x = __le16_to_cpu(b[i].x);
+		blob->y = __le16_to_cpu(b[i].y);
+		blob->width = __le16_to_cpu(b[i].width);
+		blob->height = __le16_to_cpu(b[i].height);
+		/* Blobs must lie within the image */
+		if (blob->x + blob->width > entry->width ||
+		    blob->y + blob->height > entry->height)
+			return;
+		blob->area = __le32_to_cpu(b[i].area);
+		blob->weight = __le32_to_cpu(b[i].weight);
+		blob->cx = __le32_to_float(b[i].cx);
+		blob->cy = __le32_to_float(b[i].cy);
+		blob->mxx = __le32_to_float(b[i].mxx);
+		blob->mxy = __le32_to_float(b[i].mxy);
+		blob->myy = __le32_to_float(b[i].myy);
+		/* NaN or Inf would poison the pose estimation */
+		if (!isfinite(blob->cx) || !isfinite(blob->cy) ||
+		    !isfinite(blob->mxx) || !isfinite(blob->mxy) ||
+		    !isfinite(blob->myy))
+			return;
+	}
+
+	ouvrt_tracker_track_blobs(tracker, entry->tracker_camera, entry->blobs,
+				  num_blobs, sof_time,
+				  entry->calibrated ? &entry->camera_matrix :
+				  NULL, &entry->distortion, &ob);
+	if (ob && entry->calibrated) {
+		ouvrt_tracker_process_blobs(tracker, entry->tracker_camera,
+					    ob->blobs, ob->num_blobs, sof_time,
+					    &entry->camera_matrix,
+					    &entry->distortion, &rot, &trans);
+	}
+}
+
+/*
+ * Answers camera info with the radio address of the central tracker, so
+ * that remote Rift sensors synchronise to the tracked devices.
+ */
+static void remote_camera_server_reply(const struct remote_camera_entry *entry,
+				       const struct sockaddr_in *addr,
+				       OuvrtTracker *tracker)
+{
+	struct remote_camera_config config = {};
+
+	if (!tracker)
+		return;
+
+	remote_camera_header_init(&config.header, REMOTE_CAMERA_PACKET_CONFIG,
+				  entry->serial);
+	config.radio_address =
+		__cpu_to_le32(ouvrt_tracker_get_radio_address(tracker));
+
+	sendto(server.fd, &config, sizeof(config), MSG_DONTWAIT,
+	       (const struct sockaddr *)addr, sizeof(*addr));
+}
+
+static gpointer remote_camera_server_thread(G_GNUC_UNUSED gpointer data)
+{
+	struct remote_camera_header *header = (void *)server.packet;
+	struct remote_camera_entry *entry;
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	OuvrtTracker *tracker;
+	struct pollfd pfd = {
+		.fd = server.fd,
+		.events = POLLIN,
+	};
+	ssize_t len;
+	uint64_t now;
+	int type;
+
+	while (__atomic_load_n(&server.running, __ATOMIC_ACQUIRE)) {
+		remote_camera_server_expire(remote_camera_now());
+		if (poll(&pfd, 1, 1000) <= 0)
+			continue;
+
+		addrlen = sizeof(addr);
+		len = recvfrom(server.fd, server.packet, sizeof(server.packet),
+			       MSG_DONTWAIT, (struct sockaddr *)&addr,
+			       &addrlen);
+		if (len < 0)
+			continue;
+
+		type = remote_camera_header_check(header, len);
+		if (type < 0)
+			continue;
+		entry = remote_camera_server_get_camera(header);
+		if (!entry)
+			continue;
+
+		/*
+		 * The earliest arriving packets bound the node clock offset,
+		 * up to the minimum network latency.
+		 */
+		now = remote_camera_now();
+		entry->last_time = now;
+		clock_sync_add_sample(&entry->clock,
+				      __le64_to_cpu(header->time), now);
+
+		g_mutex_lock(&server.lock);
+		tracker = server.tracker ? g_object_ref(server.tracker) : NULL;
+		g_mutex_unlock(&server.lock);
+
+		switch (type) {
+		case REMOTE_CAMERA_PACKET_INFO:
+			if (len < (ssize_t)sizeof(struct remote_camera_info))
+				break;
+			remote_camera_server_info(entry, (void *)header);
+			remote_camera_server_reply(entry, &addr, tracker);
+			break;
+		case REMOTE_CAMERA_PACKET_BLOBS:
+			if (len < (ssize_t)sizeof(struct remote_camera_blobs))
+				break;
+			remote_camera_server_blobs(entry, (void *)header, len,
+						   tracker);
+			break;
+		default:
+			break;
+		}
+
+		if (tracker)
+			g_object_unref(tracker);
+	}
+
+	return NULL;
+}
+
+/*
+ * Starts receiving blobs from remote camera nodes on the given UDP address,
+ * as host[:port] or port. Without address, or without host, only nodes on
+ * the local host are received, as the packets are not authenticated.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int remote_camera_server_start(const char *address)
+{
+	struct sockaddr_in local_addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(REMOTE_CAMERA_DEFAULT_PORT),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	char name[INET_ADDRSTRLEN];
+	int fd, ret;
+
+	if (server.thread)
+		return -EBUSY;
+
+	if (address) {
+		ret = remote_camera_resolve(address, "localhost", &local_addr);
+		if (ret < 0)
+			return ret;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (bind(fd, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+		close(fd);
+		return -errno;
+	}
+
+	g_mutex_init(&server.lock);
+	server.fd = fd;
+	server.num_cameras = 0;
+	__atomic_store_n(&server.running, true, __ATOMIC_RELEASE);
+	server.thread = g_thread_new("remote-camera",
+				     remote_camera_server_thread, NULL);
+
+	inet_ntop(AF_INET, &local_addr.sin_addr, name, sizeof(name));
+	g_print("Remote camera: Listening on %s:%d\n", name,
+		ntohs(local_addr.sin_port));
+
+	return 0;
+}
+
+/*
+ * Sets the tracker that blobs received from remote cameras are fed into.
+ */
+void remote_camera_server_set_tracker(OuvrtTracker *tracker)
+{
+	if (!server.thread)
+		return;
+
+	g_mutex_lock(&server.lock);
+	g_set_object(&server.tracker, tracker);
+	g_mutex_unlock(&server.lock);
+}
+
+/*
+ * Stops receiving blobs from remote camera nodes.
+ */
+void remote_camera_server_stop(void)
+{
+	int i;
+
+	if (!server.thread)
+		return;
+
+	__atomic_store_n(&server.running, false, __ATOMIC_RELEASE);
+	g_thread_join(server.thread);
+	server.thread = NULL;
+	close(server.fd);
+	server.fd = -1;
+	for (i = 0; i < server.num_cameras; i++)
+		remote_camera_entry_fini(&server.cameras[i]);
+	server.num_cameras = 0;
+	g_clear_object(&server.tracker);
+	g_mutex_clear(&server.lock);
+}
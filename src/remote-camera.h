@@ -0,0 +1,107 @@
+/*
+ * Remote camera nodes
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __REMOTE_CAMERA_H__
+#define __REMOTE_CAMERA_H__
+
+#include <asm/byteorder.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "maths.h"
+#include "tracker.h"
+
+#define REMOTE_CAMERA_MAGIC		0x4354524f	/* "ORTC" */
+#define REMOTE_CAMERA_VERSION		1
+#define REMOTE_CAMERA_DEFAULT_PORT	7119
+/* blobs beyond this number are not sent */
+#define REMOTE_CAMERA_MAX_BLOBS		128
+
+enum remote_camera_packet_type {
+	/* struct remote_camera_info, node to central tracker */
+	REMOTE_CAMERA_PACKET_INFO = 1,
+	/*
+	 * struct remote_camera_blobs followed by num_blobs struct
+	 * remote_camera_blob, node to central tracker
+	 */
+	REMOTE_CAMERA_PACKET_BLOBS,
+	/* struct remote_camera_config, central tracker to node */
+	REMOTE_CAMERA_PACKET_CONFIG,
+};
+
+/*
+ * Every packet starts with the sender's CLOCK_MONOTONIC time in ns at which
+ * it was sent, and the serial number of the camera it is about.
+ */
+struct remote_camera_header {
+	__le32 magic;
+	__le16 type;
+	__le16 version;
+	__le64 time;
+	char serial[32];
+} __attribute__((packed));
+
+/* Image size and intrinsic calibration, floats are sent as their bits */
+struct remote_camera_info {
+	struct remote_camera_header header;
+	__le16 width;
+	__le16 height;
+	__le32 distortion_model;
+	__le32 fx;
+	__le32 fy;
+	__le32 cx;
+	__le32 cy;
+	__le32 k[5];
+} __attribute__((packed));
+
+/* Blobs detected in a frame, with the node time of its start of exposure */
+struct remote_camera_blobs {
+	struct remote_camera_header header;
+	__le64 sof_time;
+	__le32 sequence;
+	__le16 num_blobs;
+	__le16 reserved;
+} __attribute__((packed));
+
+struct remote_camera_blob {
+	__le16 x;
+	__le16 y;
+	__le16 width;
+	__le16 height;
+	__le32 area;
+	__le32 weight;
+	__le32 cx;
+	__le32 cy;
+	__le32 mxx;
+	__le32 mxy;
+	__le32 myy;
+} __attribute__((packed));
+
+/* Radio address the node should synchronise its sensor exposures to */
+struct remote_camera_config {
+	struct remote_camera_header header;
+	__le32 radio_address;
+	__le32 reserved;
+} __attribute__((packed));
+
+struct remote_camera;
+
+int remote_camera_set_server(const char *address);
+bool remote_camera_enabled(void);
+
+struct remote_camera *remote_camera_new(const char *serial, int width,
+					int height);
+void remote_camera_free(struct remote_camera *remote);
+int remote_camera_send(struct remote_camera *remote, uint64_t sof_time,
+		       const dmat3 *camera_matrix,
+		       const struct distortion *distortion,
+		       const struct blob *blobs, int num_blobs);
+uint32_t remote_camera_get_radio_address(struct remote_camera *remote);
+
+int remote_camera_server_start(const char *address);
+void remote_camera_server_set_tracker(OuvrtTracker *tracker);
+void remote_camera_server_stop(void);
+
+#endif /* __REMOTE_CAMERA_H__ */
@@ -0,0 +1,376 @@
+/*
+ * Replay of recorded raw sensor sessions
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Feeds recorded HID reports back through the unmodified device drivers.
+ * Each replayed device gets one end of a SOCK_SEQPACKET socket pair instead
+ * of its hidraw file descriptor, which preserves report boundaries, so the
+ * driver reads and dispatches the reports just like from the hardware. The
+ * feature reports requested by the driver are answered from the recorded
+ * ones.
+ *
+ * Recorded camera frames are not replayed: the cameras receive them through
+ * libusb isochronous transfers or V4L2 buffer queues, which are not
+ * emulated. Use tracking-bench to run the optical tracking over them.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "recording.h"
+#include "replay.h"
+
+struct replay_stream {
+	char name[56];
+	int index;
+	bool hid;
+	/* number of recorded camera frames, which are not replayed */
+	unsigned int num_frames;
+	/* socket end written by the replay thread */
+	int fd;
+	GPtrArray *features;
+	uint16_t served[256];
+};
+
+struct _OuvrtReplay {
+	OuvrtDevice dev;
+
+	struct recording_reader *reader;
+	gboolean max_speed;
+	int num_streams;
+	struct replay_stream streams[RECORDING_MAX_STREAMS];
+};
+
+G_DEFINE_TYPE(OuvrtReplay, ouvrt_replay, OUVRT_TYPE_DEVICE)
+
+/* Only a single recording can be replayed at a time */
+static OuvrtReplay *replay;
+
+/*
+ * Answers a feature report request on a replayed file descriptor with the
+ * recorded response to the next request for the same report id. Once all
+ * recorded responses are used up, the last one is repeated.
+ *
+ * Returns the length of the report, or -1 with errno set to EPIPE if no
+ * response was recorded.
+ */
+int replay_get_feature_report(int fd, void *data, size_t length)
+{
+	const struct recording_chunk *chunk = NULL;
+	struct replay_stream *stream;
+	uint8_t id = *(uint8_t *)data;
+	unsigned int n = 0;
+	size_t len;
+	guint i;
+
+	if (!replay || !(recording_fd_flags(fd) & RECORDING_FD_REPLAY)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	stream = &replay->streams[recording_fds[fd].stream];
+	for (i = 0; i < stream->features->len; i++) {
+		const struct recording_chunk *c;
+
+		c = g_ptr_array_index(stream->features, i);
+		if (*(const uint8_t *)recording_chunk_data(c) != id)
+			continue;
+		chunk = c;
+		if (n++ == stream->served[id])
+			break;
+	}
+
+	if (!chunk) {
+		errno = EPIPE;
+		return -1;
+	}
+
+	if (stream->served[id] < G_MAXUINT16)
+		stream->served[id]++;
+
+	len = MIN(__le32_to_cpu(chunk->len), length);
+	memcpy(data, recording_chunk_data(chunk), len);
+
+	return len;
+}
+
+/*
+ * Calls func with the name of every recorded HID device.
+ */
+void ouvrt_replay_foreach_device(OuvrtReplay *self, GFunc func,
+				 gpointer user_data)
+{
+	int i;
+
+	for (i = 0; i < self->num_streams; i++) {
+		if (self->streams[i].hid && self->streams[i].index == 0)
+			func(self->streams[i].name, user_data);
+	}
+}
+
+/*
+ * Hands the next unattached recorded streams with the target device's name
+ * to the target, in place of its device file descriptors.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int ouvrt_replay_attach(OuvrtReplay *self, OuvrtDevice *target)
+{
+	struct replay_stream *stream;
+	int sv[2];
+	int i, j;
+
+	for (i = 0; i < self->num_streams; i++) {
+		stream = &self->streams[i];
+		if (stream->hid && stream->index == 0 && stream->fd == -1 &&
+		    strcmp(stream->name, target->name) == 0)
+			break;
+	}
+	if (i == self->num_streams)
+		return -ENOENT;
+
+	/* The fds of a device are registered one after another */
+	for (j = i; j < self->num_streams && j < i + 3; j++) {
+		stream = &self->streams[j];
+		if (!stream->hid || stream->index != j - i ||
+		    strcmp(stream->name, target->name) != 0)
+			break;
+
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK |
+			       SOCK_CLOEXEC, 0, sv) < 0)
+			return -errno;
+
+		stream->fd = sv[0];
+		target->fds[stream->index] = sv[1];
+		g_free(target->devnodes[stream->index]);
+		target->devnodes[stream->index] =
+			g_strdup_printf("replay:%d", j);
+		recording_register_fd(sv[1], j, RECORDING_FD_REPLAY);
+	}
+
+	g_print("Replay: Attached %s\n", target->name);
+
+	return 0;
+}
+
+static int replay_start(G_GNUC_UNUSED OuvrtDevice *dev)
+{
+	return 0;
+}
+
+/*
+ * Writes a single report into the socket, waiting while the driver falls
+ * behind.
+ */
+static void replay_write_report(OuvrtReplay *self, struct replay_stream *stream,
+				const void *data, size_t len)
+{
+	struct pollfd pfd = { .fd = stream->fd, .events = POLLOUT };
+
+	while (self->dev.active) {
+		if (send(stream->fd, data, len, MSG_NOSIGNAL) >= 0)
+			return;
+		if (errno != EAGAIN) {
+			g_print("Replay: Failed to write %s report: %d\n",
+				stream->name, errno);
+			return;
+		}
+		poll(&pfd, 1, 100);
+	}
+}
+
+/*
+ * Closes the replay ends of all sockets, which makes the drivers notice the
+ * disconnect.
+ */
+static void replay_close_streams(OuvrtReplay *self)
+{
+	int i;
+
+	for (i = 0; i < self->num_streams; i++) {
+		if (self->streams[i].fd != -1)
+			close(self->streams[i].fd);
+		self->streams[i].fd = -1;
+	}
+}
+
+/*
+ * Replays the recorded input reports at the recorded rate, or as fast as the
+ * drivers read them in max speed mode.
+ */
+static void replay_thread(OuvrtDevice *dev)
+{
+	OuvrtReplay *self = OUVRT_REPLAY(dev);
+	const struct recording_chunk *chunk;
+	struct replay_stream *stream;
+	uint64_t first = 0, start;
+	unsigned long num = 0;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	start = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	recording_reader_rewind(self->reader);
+	while (dev->active && (chunk = recording_reader_next(self->reader))) {
+		uint64_t time = __le64_to_cpu(chunk->time);
+		int id = __le16_to_cpu(chunk->stream);
+
+		if (__le32_to_cpu(chunk->type) != RECORDING_CHUNK_HID_REPORT ||
+		    id >= self->num_streams || self->streams[id].fd == -1)
+			continue;
+		stream = &self->streams[id];
+
+		if (!first)
+			first = time;
+
+		if (!self->max_speed) {
+			time = start + (time - first);
+			ts.tv_sec = time / 1000000000ULL;
+			ts.tv_nsec = time % 1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+					NULL);
+		}
+
+		replay_write_report(self, stream, recording_chunk_data(chunk),
+				    __le32_to_cpu(chunk->len));
+		num++;
+	}
+
+	g_print("Replay: Finished after %lu reports\n", num);
+
+	replay_close_streams(self);
+}
+
+static void replay_stop(OuvrtDevice *dev)
+{
+	replay_close_streams(OUVRT_REPLAY(dev));
+}
+
+/*
+ * Reads the stream table and indexes the recorded feature reports.
+ */
+static int replay_parse(OuvrtReplay *self)
+{
+	const struct recording_chunk *chunk;
+	int i;
+
+	while ((chunk = recording_reader_next(self->reader))) {
+		int type = __le32_to_cpu(chunk->type);
+		int id = __le16_to_cpu(chunk->stream);
+
+		if (type == RECORDING_CHUNK_STREAM) {
+			const struct recording_stream *s;
+
+			/* Streams added concurrently may appear out of order */
+			if (id >= RECORDING_MAX_STREAMS ||
+			    __le32_to_cpu(chunk->len) < sizeof(*s))
+				return -EINVAL;
+
+			s = recording_chunk_data(chunk);
+			/* The name in the file need not be zero terminated */
+			memcpy(self->streams[id].name, s->name,
+			       sizeof(s->name) - 1);
+			self->streams[id].name[sizeof(s->name) - 1] = '\0';
+			self->streams[id].index = __le16_to_cpu(s->index);
+			self->num_streams = MAX(self->num_streams, id + 1);
+			continue;
+		}
+
+		if (id >= self->num_streams)
+			continue;
+
+		if (type == RECORDING_CHUNK_SENSOR_FRAME ||
+		    type == RECORDING_CHUNK_V4L2_FRAME ||
+		    type == RECORDING_CHUNK_SPARSE_FRAME) {
+			self->streams[id].num_frames++;
+		} else if (type == RECORDING_CHUNK_HID_REPORT) {
+			self->streams[id].hid = true;
+		} else if (type == RECORDING_CHUNK_HID_FEATURE &&
+			   __le32_to_cpu(chunk->len) > 0) {
+			self->streams[id].hid = true;
+			g_ptr_array_add(self->streams[id].features,
+					(gpointer)chunk);
+		}
+	}
+
+	for (i = 0; i < self->num_streams; i++) {
+		/* Indices above 2 are frame streams */
+		if (self->streams[i].index > 2)
+			self->streams[i].hid = false;
+		if (self->streams[i].num_frames) {
+			g_print("Replay: Skipping %u %s frames, camera frames can not be replayed\n",
+				self->streams[i].num_frames,
+				self->streams[i].name);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Frees the device structure and its contents.
+ */
+static void ouvrt_replay_finalize(GObject *object)
+{
+	OuvrtReplay *self = OUVRT_REPLAY(object);
+	int i;
+
+	if (replay == self)
+		replay = NULL;
+	for (i = 0; i < RECORDING_MAX_STREAMS; i++)
+		g_ptr_array_free(self->streams[i].features, TRUE);
+	recording_reader_close(self->reader);
+	G_OBJECT_CLASS(ouvrt_replay_parent_class)->finalize(object);
+}
+
+static void ouvrt_replay_class_init(OuvrtReplayClass *klass)
+{
+	G_OBJECT_CLASS(klass)->finalize = ouvrt_replay_finalize;
+	OUVRT_DEVICE_CLASS(klass)->start = replay_start;
+	OUVRT_DEVICE_CLASS(klass)->thread = replay_thread;
+	OUVRT_DEVICE_CLASS(klass)->stop = replay_stop;
+}
+
+static void ouvrt_replay_init(OuvrtReplay *self)
+{
+	int i;
+
+	for (i = 0; i < RECORDING_MAX_STREAMS; i++) {
+		self->streams[i].fd = -1;
+		self->streams[i].features = g_ptr_array_new();
+	}
+}
+
+/*
+ * Opens a recorded session for replay.
+ *
+ * Returns the newly allocated replay device, or NULL on failure.
+ */
+OuvrtDevice *replay_new(const char *path, gboolean max_speed)
+{
+	OuvrtReplay *self;
+
+	if (replay)
+		return NULL;
+
+	self = g_object_new(OUVRT_TYPE_REPLAY, NULL);
+	self->dev.name = strdup("Replay");
+	self->max_speed = max_speed;
+	self->reader = recording_reader_open(path);
+	if (!self->reader || replay_parse(self) < 0) {
+		if (self->reader)
+			g_print("Replay: Invalid stream table in %s\n", path);
+		g_object_unref(self);
+		return NULL;
+	}
+
+	replay = self;
+
+	return OUVRT_DEVICE(self);
+}
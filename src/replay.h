@@ -0,0 +1,26 @@
+/*
+ * Replay of recorded raw sensor sessions
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <glib.h>
+#include <glib-object.h>
+#include <stddef.h>
+
+#include "device.h"
+
+#define OUVRT_TYPE_REPLAY (ouvrt_replay_get_type())
+G_DECLARE_FINAL_TYPE(OuvrtReplay, ouvrt_replay, OUVRT, REPLAY, OuvrtDevice)
+
+OuvrtDevice *replay_new(const char *path, gboolean max_speed);
+
+void ouvrt_replay_foreach_device(OuvrtReplay *self, GFunc func,
+				 gpointer user_data);
+int ouvrt_replay_attach(OuvrtReplay *self, OuvrtDevice *target);
+
+int replay_get_feature_report(int fd, void *data, size_t length);
+
+#endif /* __REPLAY_H__ */
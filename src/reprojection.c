@@ -0,0 +1,240 @@
+/*
+ * LED identification by tracking model reprojection
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Given a pose estimate, the LEDs of the tracking model that face the camera
+ * are projected into the image and sorted into a coarse grid. Unidentified
+ * blobs are then assigned the id of the closest projected LED, without
+ * waiting for the blinking pattern to be recorded.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "blobwatch.h"
+#include "distortion.h"
+#include "leds.h"
+#include "maths.h"
+#include "reprojection.h"
+
+#define REPROJECTION_MAX_LEDS		128
+#define REPROJECTION_CELL_SHIFT		5
+/* maximum distance in pixels between blob center and projected LED */
+#define REPROJECTION_MAX_DISTANCE	((1 << REPROJECTION_CELL_SHIFT) / 2)
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
+
+struct reprojection {
+	int width;
+	int height;
+	int cols;
+	int rows;
+	int *grid;
+	int next[REPROJECTION_MAX_LEDS];
+	float u[REPROJECTION_MAX_LEDS];
+	float v[REPROJECTION_MAX_LEDS];
+	/* closest blob claiming each LED, and its squared distance */
+	int claim[REPROJECTION_MAX_LEDS];
+	float claim_dist2[REPROJECTION_MAX_LEDS];
+};
+
+/*
+ * Allocates the reprojection grid for a camera of the given frame size.
+ */
+struct reprojection *reprojection_new(int width, int height)
+{
+	struct reprojection *rp;
+
+	rp = calloc(1, sizeof(*rp));
+	if (!rp)
+		return NULL;
+
+	rp->width = width;
+	rp->height = height;
+	rp->cols = ((width - 1) >> REPROJECTION_CELL_SHIFT) + 1;
+	rp->rows = ((height - 1) >> REPROJECTION_CELL_SHIFT) + 1;
+	rp->grid = malloc(rp->cols * rp->rows * sizeof(*rp->grid));
+	if (!rp->grid) {
+		free(rp);
+		return NULL;
+	}
+
+	return rp;
+}
+
+void reprojection_free(struct reprojection *rp)
+{
+	if (!rp)
+		return;
+
+	free(rp->grid);
+	free(rp);
+}
+
+/*
+ * Projects the camera space point p into the image, applying the lens
+ * distortion.
+ */
+static void project_point(const dmat3 *camera_matrix,
+			  const struct distortion *distortion, const dvec3 *p,
+			  float *u, float *v)
+{
+	double x, y;
+
+	distortion_distort(distortion, p->x / p->z, p->y / p->z, &x, &y);
+
+	*u = camera_matrix->m[0] * x + camera_matrix->m[2];
+	*v = camera_matrix->m[4] * y + camera_matrix->m[5];
+}
+
+/*
+ * Projects all LEDs facing the camera and sorts them into grid cells.
+ * LEDs that are already assigned to an identified blob are left out.
+ */
+static void build_grid(struct reprojection *rp, struct leds *leds,
+		       const bool *taken, dmat3 *camera_matrix,
+		       const struct distortion *distortion,
+		       const dquat *rot, const dvec3 *trans)
+{
+	const int num_leds = min((int)leds->model.num_points,
+				 REPROJECTION_MAX_LEDS);
+	int i;
+
+	for (i = 0; i < rp->cols * rp->rows; i++)
+		rp->grid[i] = -1;
+
+	for (i = 0; i < num_leds; i++) {
+		const vec3 *point = &leds->model.points[i];
+		const vec3 *normal = &leds->model.normals[i];
+		const dvec3 op = { point->x, point->y, point->z };
+		const dvec3 on = { normal->x, normal->y, normal->z };
+		dvec3 p, n;
+		int col, row, cell;
+
+		if (taken[i])
+			continue;
+
+		dquat_rotate(&p, rot, &op);
+		p.x += trans->x;
+		p.y += trans->y;
+		p.z += trans->z;
+		if (p.z <= 0.0)
+			continue;
+
+		/* Cull LEDs pointing away from the camera */
+		dquat_rotate(&n, rot, &on);
+		if (dvec3_dot(&n, &p) > 0.0)
+			continue;
+
+		project_point(camera_matrix, distortion, &p, &rp->u[i],
+			      &rp->v[i]);
+		if (rp->u[i] < 0 || rp->u[i] >= rp->width ||
+		    rp->v[i] < 0 || rp->v[i] >= rp->height)
+			continue;
+
+		col = (int)rp->u[i] >> REPROJECTION_CELL_SHIFT;
+		row = (int)rp->v[i] >> REPROJECTION_CELL_SHIFT;
+		cell = row * rp->cols + col;
+		rp->next[i] = rp->grid[cell];
+		rp->grid[cell] = i;
+	}
+}
+
+/*
+ * Finds the closest projected LED within the maximum distance to the blob,
+ * checking the grid cells around it.
+ */
+static int find_closest_led(struct reprojection *rp, const struct blob *b,
+			    float *dist2)
+{
+	const int r = REPROJECTION_MAX_DISTANCE;
+	const int col0 = max(b->x - r, 0) >> REPROJECTION_CELL_SHIFT;
+	const int col1 = min(b->x + r, rp->width - 1) >> REPROJECTION_CELL_SHIFT;
+	const int row0 = max(b->y - r, 0) >> REPROJECTION_CELL_SHIFT;
+	const int row1 = min(b->y + r, rp->height - 1) >>
+			 REPROJECTION_CELL_SHIFT;
+	float best = r * r;
+	int closest = -1;
+	int row, col, i;
+
+	for (row = row0; row <= row1; row++) {
+		for (col = col0; col <= col1; col++) {
+			i = rp->grid[row * rp->cols + col];
+			for (; i >= 0; i = rp->next[i]) {
+				float du = rp->u[i] - b->cx;
+				float dv = rp->v[i] - b->cy;
+				float d2 = du * du + dv * dv;
+
+				if (d2 < best) {
+					best = d2;
+					closest = i;
+				}
+			}
+		}
+	}
+
+	*dist2 = best;
+	return closest;
+}
+
+/*
+ * Assigns LED ids of the given object to unidentified blobs by projecting its
+ * tracking model at the given pose. If multiple blobs are closest to the same
+ * LED, only the nearest one is identified.
+ *
+ * Returns the number of newly identified blobs.
+ */
+int reprojection_identify_blobs(struct reprojection *rp, int object_id,
+				struct leds *leds, struct blob *blobs,
+				int num_blobs, dmat3 *camera_matrix,
+				const struct distortion *distortion,
+				const dquat *rot, const dvec3 *trans)
+{
+	bool taken[REPROJECTION_MAX_LEDS] = { false };
+	int num_leds = min((int)leds->model.num_points, REPROJECTION_MAX_LEDS);
+	int i, num = 0;
+
+	if (!leds->model.normals)
+		return 0;
+
+	for (i = 0; i < num_blobs; i++) {
+		if (blobs[i].object_id == object_id &&
+		    blobs[i].led_id >= 0 && blobs[i].led_id < num_leds)
+			taken[blobs[i].led_id] = true;
+	}
+
+	build_grid(rp, leds, taken, camera_matrix, distortion, rot, trans);
+
+	for (i = 0; i < num_leds; i++)
+		rp->claim[i] = -1;
+
+	for (i = 0; i < num_blobs; i++) {
+		float dist2;
+		int led;
+
+		if (blobs[i].led_id >= 0)
+			continue;
+
+		led = find_closest_led(rp, &blobs[i], &dist2);
+		if (led < 0)
+			continue;
+
+		if (rp->claim[led] < 0 || dist2 < rp->claim_dist2[led]) {
+			rp->claim[led] = i;
+			rp->claim_dist2[led] = dist2;
+		}
+	}
+
+	for (i = 0; i < num_leds; i++) {
+		if (rp->claim[i] < 0)
+			continue;
+
+		blobs[rp->claim[i]].object_id = object_id;
+		blobs[rp->claim[i]].led_id = i;
+		num++;
+	}
+
+	return num;
+}
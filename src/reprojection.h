@@ -0,0 +1,26 @@
+/*
+ * LED identification by tracking model reprojection
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __REPROJECTION_H__
+#define __REPROJECTION_H__
+
+#include "maths.h"
+
+struct blob;
+struct distortion;
+struct leds;
+struct reprojection;
+
+struct reprojection *reprojection_new(int width, int height);
+void reprojection_free(struct reprojection *rp);
+
+int reprojection_identify_blobs(struct reprojection *rp, int object_id,
+				struct leds *leds, struct blob *blobs,
+				int num_blobs, dmat3 *camera_matrix,
+				const struct distortion *distortion,
+				const dquat *rot,
+				const dvec3 *trans);
+
+#endif /* __REPROJECTION_H__ */
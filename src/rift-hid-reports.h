@@ -129,6 +129,8 @@ struct rift_serial_report {
 
 #define RIFT_TRACKING_EXPOSURE_US_DK2		350
 #define RIFT_TRACKING_EXPOSURE_US_CV1		399
+/* shorter LED flashes while steady, blobs are brighter without blinking */
+#define RIFT_TRACKING_EXPOSURE_US_STEADY	200
 #define RIFT_TRACKING_PERIOD_US_DK2		16666
 #define RIFT_TRACKING_PERIOD_US_CV1		19200
 #define RIFT_TRACKING_VSYNC_OFFSET		0
@@ -12,9 +12,12 @@
 #include "rift-hid-reports.h"
 #include "rift-radio.h"
 #include "buttons.h"
+#include "cache.h"
+#include "fusion.h"
 #include "hidraw.h"
 #include "imu.h"
 #include "json.h"
+#include "pose-shm.h"
 #include "telemetry.h"
 #include "tracking-model.h"
 
@@ -66,102 +69,143 @@ static int rift_radio_read(int fd, uint8_t a, uint8_t b, uint8_t c,
 	return hid_get_feature_report(fd, report, sizeof(*report));
 }
 
-static int rift_radio_write(int fd, uint8_t a, uint8_t b, uint8_t c,
-			    struct rift_radio_data_report *report)
+/*
+ * Appends a command to the radio command queue. The caller fills in the data
+ * report for writes and flash reads. The completion callback is called from
+ * rift_radio_process_queue() once the command has finished or failed.
+ *
+ * Returns the queued command, or NULL if the queue is full.
+ */
+static struct rift_radio_command *
+rift_radio_queue_command(struct rift_radio *radio,
+			 enum rift_radio_command_type type,
+			 uint8_t a, uint8_t b, uint8_t c,
+			 rift_radio_command_cb complete,
+			 struct rift_wireless_device *dev)
 {
-	int ret;
-
-	if (report->id != RIFT_RADIO_DATA_REPORT_ID)
-		return -EINVAL;
+	struct rift_radio_queue *q = &radio->queue;
+	struct rift_radio_command *cmd;
 
-	ret = hid_send_feature_report(fd, report, sizeof(*report));
-	if (ret < 0)
-		return ret;
+	if (q->count == RIFT_RADIO_QUEUE_LENGTH) {
+		g_print("Rift: Radio command queue full\n");
+		return NULL;
+	}
 
-	return rift_radio_transfer(fd, a, b, c);
+	cmd = &q->commands[(q->head + q->count) % RIFT_RADIO_QUEUE_LENGTH];
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->type = type;
+	cmd->control[0] = a;
+	cmd->control[1] = b;
+	cmd->control[2] = c;
+	cmd->report.id = RIFT_RADIO_DATA_REPORT_ID;
+	cmd->complete = complete;
+	cmd->dev = dev;
+	q->count++;
+
+	return cmd;
 }
 
-static int rift_radio_read_flash(int fd, uint8_t device_type,
-				 struct rift_radio_data_report *report)
+/*
+ * Drops all queued commands for the given device. This must only be called
+ * from a completion callback, when no command is in progress.
+ */
+static void rift_radio_cancel_commands(struct rift_radio *radio,
+				       struct rift_wireless_device *dev)
 {
-	int ret;
+	struct rift_radio_queue *q = &radio->queue;
+	unsigned int i, n = 0;
 
-	ret = hid_send_feature_report(fd, report, sizeof(*report));
-	if (ret < 0)
-		return ret;
+	for (i = 0; i < q->count; i++) {
+		struct rift_radio_command *cmd;
 
-	ret = rift_radio_transfer(fd, 0x03, RIFT_RADIO_READ_FLASH_CONTROL,
-				  device_type);
-	if (ret < 0)
-		return ret;
-
-	return hid_get_feature_report(fd, report, sizeof(*report));
+		cmd = &q->commands[(q->head + i) % RIFT_RADIO_QUEUE_LENGTH];
+		if (cmd->dev != dev)
+			q->commands[(q->head + n++) % RIFT_RADIO_QUEUE_LENGTH] = *cmd;
+	}
+	q->count = n;
 }
 
-static int rift_radio_read_calibration_hash(int fd, uint8_t device_type,
-					    uint8_t hash[16])
-{
-	struct rift_radio_data_report report = {
-		.id = RIFT_RADIO_DATA_REPORT_ID,
-		.flash.offset = __cpu_to_le16(0x1bf0),
-		.flash.length = 16,
-	};
-	int ret;
-
-	ret = rift_radio_read_flash(fd, device_type, &report);
-	if (ret < 0)
-		return ret;
-
-	memcpy(hash, report.flash.data, 16);
-
-	return 0;
-}
+/*
+ * Longest time a radio command may stay busy, in queue steps.
+ */
+#define RIFT_RADIO_MAX_POLLS		500
 
-static int rift_radio_read_calibration(int fd, uint8_t device_type, char **json,
-				       uint16_t *length)
+/*
+ * Advances the command at the head of the radio command queue by a single
+ * feature report transfer, so that radio housekeeping can be interleaved with
+ * reading IMU reports instead of blocking them for the whole round trip.
+ */
+void rift_radio_process_queue(struct rift_radio *radio, int fd)
 {
-	struct rift_radio_data_report report = {
-		.id = RIFT_RADIO_DATA_REPORT_ID,
+	struct rift_radio_queue *q = &radio->queue;
+	struct rift_radio_control_report control = {
+		.id = RIFT_RADIO_CONTROL_REPORT_ID,
 	};
-	uint16_t offset;
-	uint16_t size;
-	char *tmp;
-	int ret;
+	struct rift_radio_command *cmd;
+	struct rift_radio_command done;
+	bool finished = false;
+	int ret = 0;
 
-	report.flash.offset = __cpu_to_le16(0);
-	report.flash.length = __cpu_to_le16(20);
-	ret = rift_radio_read_flash(fd, device_type, &report);
-	if (ret < 0)
-		return ret;
-
-	if (__le16_to_cpup((__le16 *)&report.flash.data[0]) != 1)
-		return -EINVAL;
-
-	size = __le16_to_cpup((__le16 *)&report.flash.data[2]);
-
-	tmp = g_malloc(size + 1);
+	if (!q->count)
+		return;
 
-	memcpy(tmp, report.flash.data + 4, 16);
+	cmd = &q->commands[q->head];
+	if (q->state == RIFT_RADIO_QUEUE_IDLE) {
+		q->state = (cmd->type == RIFT_RADIO_COMMAND_READ) ?
+			   RIFT_RADIO_QUEUE_SEND_CONTROL :
+			   RIFT_RADIO_QUEUE_SEND_DATA;
+	}
 
-	for (offset = 20; offset < size + 4; offset += 20) {
-		report.flash.offset = __cpu_to_le16(offset);
-		report.flash.length = __cpu_to_le16(20);
-		ret = rift_radio_read_flash(fd, device_type, &report);
-		if (ret < 0) {
-			g_free(tmp);
-			return ret;
+	switch (q->state) {
+	case RIFT_RADIO_QUEUE_SEND_DATA:
+		ret = hid_send_feature_report(fd, &cmd->report,
+					      sizeof(cmd->report));
+		q->state = RIFT_RADIO_QUEUE_SEND_CONTROL;
+		break;
+	case RIFT_RADIO_QUEUE_SEND_CONTROL:
+		memcpy(control.unknown, cmd->control, 3);
+		ret = hid_send_feature_report(fd, &control, sizeof(control));
+		q->state = RIFT_RADIO_QUEUE_POLL;
+		q->polls = 0;
+		break;
+	case RIFT_RADIO_QUEUE_POLL:
+		ret = hid_get_feature_report(fd, &control, sizeof(control));
+		if (ret < 0)
+			break;
+		if (control.unknown[0] & 0x80) {
+			if (++q->polls > RIFT_RADIO_MAX_POLLS)
+				ret = -ETIMEDOUT;
+			break;
 		}
-
-		memcpy(tmp + offset - 4, report.flash.data,
-		       (offset - 4 + 20 <= size) ? 20 :
-		       (size - (offset - 4)));
+		if (control.unknown[0] & 0x08) {
+			ret = -EIO;
+			break;
+		}
+		if (cmd->type == RIFT_RADIO_COMMAND_WRITE)
+			finished = true;
+		else
+			q->state = RIFT_RADIO_QUEUE_GET_DATA;
+		break;
+	case RIFT_RADIO_QUEUE_GET_DATA:
+		ret = hid_get_feature_report(fd, &cmd->report,
+					     sizeof(cmd->report));
+		finished = true;
+		break;
+	default:
+		break;
 	}
-	tmp[size] = 0;
 
-	*json = tmp;
-	*length = size;
+	if (ret >= 0 && !finished)
+		return;
 
-	return 0;
+	/* Dequeue before completion, the callback may queue new commands */
+	done = *cmd;
+	q->head = (q->head + 1) % RIFT_RADIO_QUEUE_LENGTH;
+	q->count--;
+	q->state = RIFT_RADIO_QUEUE_IDLE;
+
+	if (done.complete)
+		done.complete(radio, &done, ret < 0 ? ret : 0);
 }
 
 int rift_radio_get_address(int fd, uint32_t *address)
@@ -190,7 +234,11 @@ int rift_radio_get_address(int fd, uint32_t *address)
 	return 0;
 }
 
-int rift_get_firmware_version(int fd)
+/*
+ * Reads the HMD firmware version string into version, which must have space
+ * for at least 11 characters.
+ */
+int rift_get_firmware_version(int fd, char *version)
 {
 	struct rift_radio_data_report report = {
 		.id = RIFT_RADIO_DATA_REPORT_ID,
@@ -203,56 +251,11 @@ int rift_get_firmware_version(int fd)
 	if (ret < 0)
 		return ret;
 
-	g_print("Rift: Firmware version ");
 	for (i = 14; i < 24 && g_ascii_isalnum(report.payload[i]); i++)
-		g_print("%c", report.payload[i]);
-	g_print("\n");
-
-	return 0;
-}
-
-static int rift_radio_get_serial(int fd, int device_type,
-				 uint32_t *address, char *serial)
-{
-	struct rift_radio_data_report report = {
-		.id = RIFT_RADIO_DATA_REPORT_ID,
-	};
-	int ret;
-	int i;
-
-	ret = rift_radio_read(fd, 0x03, RIFT_RADIO_SERIAL_NUMBER_CONTROL,
-			      device_type, &report);
-	if (ret < 0)
-		return ret;
-
-	*address = __le32_to_cpu(report.serial.address);
-
-	for (i = 0; i < 14 && g_ascii_isalnum(report.serial.number[i]); i++)
-		serial[i] = report.serial.number[i];
-
-	return 0;
-}
-
-static int rift_radio_get_firmware_version(int fd, int device_type,
-					   char *firmware_date,
-					   char *firmware_version)
-{
-	struct rift_radio_data_report report = {
-		.id = RIFT_RADIO_DATA_REPORT_ID,
-	};
-	int ret;
-	int i;
+		version[i - 14] = report.payload[i];
+	version[i - 14] = '\0';
 
-	ret = rift_radio_read(fd, 0x03, RIFT_RADIO_FIRMWARE_VERSION_CONTROL,
-			      device_type, &report);
-	if (ret < 0)
-		return ret;
-
-	for (i = 0; i < 11 && g_ascii_isprint(report.firmware.date[i]); i++)
-		firmware_date[i] = report.firmware.date[i];
-
-	for (i = 0; i < 10 && g_ascii_isalnum(report.firmware.version[i]); i++)
-		firmware_version[i] = report.firmware.version[i];
+	g_print("Rift: Firmware version %s\n", version);
 
 	return 0;
 }
@@ -295,6 +298,11 @@ static const struct button_map touch_right_button_map[4] = {
 	{ RIFT_TOUCH_CONTROLLER_BUTTON_STICK, OUVRT_BUTTON_JOYSTICK },
 };
 
+/*
+ * Longest interval between two IMU samples, in µs, that is still integrated.
+ */
+#define RIFT_TOUCH_MAX_IMU_INTERVAL	50000
+
 static void rift_decode_touch_message(struct rift_touch_controller *touch,
 				      const struct rift_radio_message *message)
 {
@@ -318,16 +326,21 @@ static void rift_decode_touch_message(struct rift_touch_controller *touch,
 	};
 	uint16_t adc_value = __le16_to_cpu(message->touch.adc_value);
 	int32_t dt = timestamp - touch->last_timestamp;
+	bool first = touch->last_timestamp == 0;
+	bool integrate = !first;
 
 	if (dt > 1000 - 25 && dt < 1000 + 25) {
 		/* 1 ms */
 	} else if (dt > 2000 - 25 && dt < 2000 + 25) {
 		/* 2 ms */
-	} else if (dt > 3000 - 25 || dt < 3000 + 25) {
+	} else if (dt > 3000 - 25 && dt < 3000 + 25) {
 		/* 3 ms */
-	} else {
+	} else if (integrate) {
 		g_print("%s: %d µs since last IMU sample\n", touch->base.name,
 			dt);
+		/* Do not integrate across dropped messages or a lost link */
+		if (dt < 0 || dt > RIFT_TOUCH_MAX_IMU_INTERVAL)
+			integrate = false;
 	}
 	touch->last_timestamp = timestamp;
 
@@ -348,26 +361,39 @@ static void rift_decode_touch_message(struct rift_touch_controller *touch,
 		2.0 / 2048 * gyro[1],
 		2.0 / 2048 * gyro[2],
 	};
+	/*
+	 * The calibration is stored as a 3x3 scale and misalignment matrix
+	 * followed by a 3-element offset vector.
+	 */
 	const double ax = c->acc_calibration[0] * a[0] +
 			  c->acc_calibration[1] * a[1] +
-			  c->acc_calibration[2] * a[2];
+			  c->acc_calibration[2] * a[2] +
+			  c->acc_calibration[9];
 	const double ay = c->acc_calibration[3] * a[0] +
 			  c->acc_calibration[4] * a[1] +
-			  c->acc_calibration[5] * a[2];
+			  c->acc_calibration[5] * a[2] +
+			  c->acc_calibration[10];
 	const double az = c->acc_calibration[6] * a[0] +
 			  c->acc_calibration[7] * a[1] +
-			  c->acc_calibration[8] * a[2];
+			  c->acc_calibration[8] * a[2] +
+			  c->acc_calibration[11];
 	const double gx = c->gyro_calibration[0] * g[0] +
 			  c->gyro_calibration[1] * g[1] +
-			  c->gyro_calibration[2] * g[2];
+			  c->gyro_calibration[2] * g[2] +
+			  c->gyro_calibration[9];
 	const double gy = c->gyro_calibration[3] * g[0] +
 			  c->gyro_calibration[4] * g[1] +
-			  c->gyro_calibration[5] * g[2];
+			  c->gyro_calibration[5] * g[2] +
+			  c->gyro_calibration[10];
 	const double gz = c->gyro_calibration[6] * g[0] +
 			  c->gyro_calibration[7] * g[1] +
-			  c->gyro_calibration[8] * g[2];
+			  c->gyro_calibration[8] * g[2] +
+			  c->gyro_calibration[11];
 
-	sample->time = timestamp;
+	/* Extend the 32-bit µs timestamp and convert to seconds */
+	if (!first && dt > 0)
+		touch->time += dt;
+	sample->time = 1e-6 * touch->time;
 	sample->acceleration.x = ax;
 	sample->acceleration.y = ay;
 	sample->acceleration.z = az;
@@ -377,10 +403,19 @@ static void rift_decode_touch_message(struct rift_touch_controller *touch,
 
 	telemetry_send_imu_sample(touch->base.dev_id, sample);
 
-	const double dt_s = 1e-6 * dt;
+	if (touch->fusion) {
+		struct imu_state state;
 
-	pose_update(dt_s, &touch->imu.pose, sample);
+		fusion_add_imu_sample(touch->fusion, sample->time, sample);
+		if (fusion_get_state(touch->fusion, &state) &&
+		    state.sample.time == sample->time)
+			touch->imu = state;
+	} else if (integrate) {
+		pose_update(1e-6 * dt, &touch->imu.pose, sample);
+	}
 
+	pose_shm_write(__atomic_load_n(&touch->pose_shm, __ATOMIC_ACQUIRE),
+		       &touch->imu);
 	telemetry_send_pose(touch->base.dev_id, &touch->imu.pose);
 
 	float t;
@@ -564,22 +599,132 @@ static int rift_touch_parse_calibration(struct rift_touch_controller *touch,
 	return 0;
 }
 
-static int rift_touch_get_calibration(struct rift_touch_controller *touch,
-				      int fd)
+/*
+ * Aborts the activation of a wireless device. It will be retried with the
+ * next message received from the device.
+ */
+static void rift_radio_activation_failed(struct rift_wireless_device *dev,
+					 const char *what, int ret)
 {
-	struct rift_wireless_device *dev = &touch->base;
-	uint8_t hash[16];
-	char hash_string[33];
-	gboolean success;
+	g_print("Rift: %s: Failed to read %s: %d\n", dev->name, what, ret);
+	dev->busy = false;
+}
+
+/*
+ * Parses the Touch controller calibration and marks the controller active.
+ */
+static void rift_touch_activated(struct rift_touch_controller *touch,
+				 char *json)
+{
+	rift_touch_parse_calibration(touch, json, &touch->calibration);
+	g_free(json);
+
+	touch->base.active = true;
+	touch->base.busy = false;
+}
+
+/*
+ * Copies a chunk of the calibration data read from flash. The flash offset
+ * is taken from the request in cmd->arg, as the device overwrites the
+ * report. The first chunk starts with a version and the data size.
+ */
+static void rift_touch_calibration_done(struct rift_radio *radio,
+					const struct rift_radio_command *cmd,
+					int ret)
+{
+	struct rift_touch_controller *touch = (void *)cmd->dev;
+	const uint8_t *data = cmd->report.flash.data;
+	unsigned int offset = cmd->arg;
+	struct rift_radio_command *next;
+	unsigned int size;
+	unsigned int len;
 	char *path;
-	char *filename;
+
+	if (ret < 0)
+		goto err;
+
+	if (offset == 0) {
+		if (__le16_to_cpup((__le16 *)&data[0]) != 1) {
+			ret = -EINVAL;
+			goto err;
+		}
+
+		size = __le16_to_cpup((__le16 *)&data[2]);
+		len = MIN(size, 16);
+		g_free(touch->calibration_json);
+		touch->calibration_size = size;
+		touch->calibration_json = g_malloc(size + 1);
+		memcpy(touch->calibration_json, data + 4, len);
+	} else {
+		size = touch->calibration_size;
+		if (!touch->calibration_json || offset < 4 ||
+		    offset - 4 >= size) {
+			ret = -EINVAL;
+			goto err;
+		}
+		len = MIN(size - (offset - 4), 20);
+		memcpy(touch->calibration_json + offset - 4, data, len);
+	}
+
+	offset += 20;
+	if (offset < size + 4) {
+		next = rift_radio_queue_command(radio,
+						RIFT_RADIO_COMMAND_READ_FLASH,
+						0x03, RIFT_RADIO_READ_FLASH_CONTROL,
+						touch->base.id,
+						rift_touch_calibration_done,
+						&touch->base);
+		if (!next) {
+			ret = -ENOSPC;
+			goto err;
+		}
+		next->report.flash.offset = __cpu_to_le16(offset);
+		next->report.flash.length = __cpu_to_le16(20);
+		next->arg = offset;
+		return;
+	}
+	touch->calibration_json[size] = 0;
+
+	path = ouvrt_cache_path("%s", touch->calibration_cache);
+	ouvrt_cache_save_async(path, touch->calibration_json, size);
+	g_free(path);
+	g_hash_table_replace(radio->calibration_cache,
+			     g_strdup(touch->calibration_cache),
+			     g_strdup(touch->calibration_json));
+
+	g_print("Rift: %s: writing calibration data cache\n",
+		touch->base.name);
+
+	g_free(touch->calibration_cache);
+	touch->calibration_cache = NULL;
+	rift_touch_activated(touch, touch->calibration_json);
+	touch->calibration_json = NULL;
+	return;
+
+err:
+	g_free(touch->calibration_json);
+	touch->calibration_json = NULL;
+	g_free(touch->calibration_cache);
+	touch->calibration_cache = NULL;
+	rift_radio_activation_failed(&touch->base, "calibration data", ret);
+}
+
+static void rift_touch_calibration_hash_done(struct rift_radio *radio,
+					     const struct rift_radio_command *cmd,
+					     int ret)
+{
+	struct rift_wireless_device *dev = cmd->dev;
+	struct rift_touch_controller *touch = (void *)dev;
+	const uint8_t *hash = cmd->report.flash.data;
+	struct rift_radio_command *next;
+	char hash_string[33];
 	char *json;
-	int ret;
 	int i;
 
-	ret = rift_radio_read_calibration_hash(fd, dev->id, hash);
-	if (ret < 0)
-		return ret;
+	if (ret < 0) {
+		rift_radio_activation_failed(dev, "calibration hash", ret);
+		return;
+	}
 
 	for (i = 0; i < 32; i++) {
 		uint8_t nibble = (i % 2) ? (hash[i / 2] & 0xf) :
@@ -591,92 +736,184 @@ static int rift_touch_get_calibration(struct rift_touch_controller *touch,
 
 	g_print("Rift: %s: calibration hash: %s\n", dev->name, hash_string);
 
-	path = g_strdup_printf("%s/ouvrt", g_get_user_cache_dir());
+	g_free(touch->calibration_cache);
+	touch->calibration_cache = g_strdup_printf("%.14s_%s.%ctouch",
+			dev->serial, hash_string,
+			(dev->id == RIFT_TOUCH_CONTROLLER_LEFT) ? 'l' : 'r');
 
-	filename = g_strdup_printf("%s/%.14s_%s.%ctouch", path, dev->serial,
-				   hash_string,
-				   (dev->id == RIFT_TOUCH_CONTROLLER_LEFT) ? 'l' : 'r');
-
-	success = g_file_get_contents(filename, &json, NULL, NULL);
-	if (success) {
+	json = g_hash_table_lookup(radio->calibration_cache,
+				   touch->calibration_cache);
+	if (json) {
 		g_print("Rift: %s: read cached calibration data\n", dev->name);
-	} else {
-		uint16_t length;
+		g_free(touch->calibration_cache);
+		touch->calibration_cache = NULL;
+		rift_touch_activated(touch, g_strdup(json));
+		return;
+	}
 
-		g_print("Rift: %s: reading calibration data\n", dev->name);
+	g_print("Rift: %s: reading calibration data\n", dev->name);
 
-		ret = rift_radio_read_calibration(fd, dev->id, &json, &length);
-		if (ret < 0) {
-			g_free(filename);
-			g_free(path);
-			return ret;
-		}
+	next = rift_radio_queue_command(radio, RIFT_RADIO_COMMAND_READ_FLASH,
+					0x03, RIFT_RADIO_READ_FLASH_CONTROL,
+					dev->id, rift_touch_calibration_done,
+					dev);
+	if (!next) {
+		g_free(touch->calibration_cache);
+		touch->calibration_cache = NULL;
+		rift_radio_activation_failed(dev, "calibration data", -ENOSPC);
+		return;
+	}
+	next->report.flash.offset = __cpu_to_le16(0);
+	next->report.flash.length = __cpu_to_le16(20);
+}
 
-		g_mkdir_with_parents(path, 0755);
-		g_file_set_contents(filename, json, length, NULL);
+static void rift_radio_firmware_version_done(struct rift_radio *radio,
+					     const struct rift_radio_command *cmd,
+					     int ret)
+{
+	struct rift_wireless_device *dev = cmd->dev;
+	const struct rift_radio_data_report *report = &cmd->report;
+	struct rift_radio_command *next;
+	int i;
 
-		g_print("Rift: %s: wrote calibration data cache\n", dev->name);
+	if (ret < 0) {
+		rift_radio_activation_failed(dev, "firmware version", ret);
+		return;
 	}
 
-	g_free(filename);
-	g_free(path);
+	for (i = 0; i < 11 && g_ascii_isprint(report->firmware.date[i]); i++)
+		dev->firmware_date[i] = report->firmware.date[i];
 
-	rift_touch_parse_calibration(touch, json, &touch->calibration);
+	for (i = 0; i < 10 && g_ascii_isalnum(report->firmware.version[i]); i++)
+		dev->firmware_version[i] = report->firmware.version[i];
 
-	g_free(json);
+	g_print("Rift: %s: Firmware version %.10s\n", dev->name,
+		dev->firmware_version);
 
-	return 0;
+	if (dev->id == RIFT_REMOTE) {
+		dev->active = true;
+		dev->busy = false;
+		return;
+	}
+
+	next = rift_radio_queue_command(radio, RIFT_RADIO_COMMAND_READ_FLASH,
+					0x03, RIFT_RADIO_READ_FLASH_CONTROL,
+					dev->id,
+					rift_touch_calibration_hash_done, dev);
+	if (!next) {
+		rift_radio_activation_failed(dev, "calibration hash", -ENOSPC);
+		return;
+	}
+	next->report.flash.offset = __cpu_to_le16(0x1bf0);
+	next->report.flash.length = __cpu_to_le16(16);
 }
 
-static int rift_radio_activate(struct rift_wireless_device *dev, int fd)
+static void rift_radio_serial_done(struct rift_radio *radio,
+				   const struct rift_radio_command *cmd,
+				   int ret)
 {
-	int ret;
+	struct rift_wireless_device *dev = cmd->dev;
+	const struct rift_radio_data_report *report = &cmd->report;
+	int i;
 
-	ret = rift_radio_get_serial(fd, dev->id, &dev->address, dev->serial);
 	if (ret < 0) {
-		g_print("Rift: Failed to read %s serial number\n", dev->name);
-		return ret;
+		rift_radio_activation_failed(dev, "serial number", ret);
+		return;
 	}
 
+	dev->address = __le32_to_cpu(report->serial.address);
+
+	for (i = 0; i < 14 && g_ascii_isalnum(report->serial.number[i]); i++)
+		dev->serial[i] = report->serial.number[i];
+
 	g_print("Rift: %s: Serial %.14s\n", dev->name, dev->serial);
 
-	ret = rift_radio_get_firmware_version(fd, dev->id, dev->firmware_date,
-					      dev->firmware_version);
+	if (!rift_radio_queue_command(radio, RIFT_RADIO_COMMAND_READ, 0x03,
+				      RIFT_RADIO_FIRMWARE_VERSION_CONTROL,
+				      dev->id, rift_radio_firmware_version_done,
+				      dev))
+		rift_radio_activation_failed(dev, "firmware version", -ENOSPC);
+}
+
+/*
+ * Starts reading serial number, firmware version, and for Touch controllers
+ * the calibration data, from a wireless device. The device is marked active
+ * once all commands have completed.
+ */
+static void rift_radio_activate(struct rift_radio *radio,
+				struct rift_wireless_device *dev)
+{
+	if (dev->busy)
+		return;
+
+	if (rift_radio_queue_command(radio, RIFT_RADIO_COMMAND_READ, 0x03,
+				     RIFT_RADIO_SERIAL_NUMBER_CONTROL, dev->id,
+				     rift_radio_serial_done, dev))
+		dev->busy = true;
+}
+
+static void rift_radio_pairing_step_done(struct rift_radio *radio,
+					 const struct rift_radio_command *cmd,
+					 int ret)
+{
+	struct rift_wireless_device *dev = cmd->dev;
+
 	if (ret < 0) {
-		g_print("Rift: Failed to read firmware version\n");
-		return ret;
+		g_print("Rift: Pairing %s %08x failed: %d\n", dev->name,
+			cmd->arg, ret);
+		rift_radio_cancel_commands(radio, dev);
+		dev->busy = false;
 	}
+}
 
-	g_print("Rift: %s: Firmware version %.10s\n", dev->name,
-		dev->firmware_version);
-
-	if (dev->id != RIFT_REMOTE) {
-		struct rift_touch_controller *touch;
+static void rift_radio_pairing_done(struct rift_radio *radio,
+				    const struct rift_radio_command *cmd,
+				    int ret)
+{
+	struct rift_wireless_device *dev = cmd->dev;
 
-		touch = (struct rift_touch_controller *)dev;
-		ret = rift_touch_get_calibration(touch, fd);
-		if (ret < 0)
-			return ret;
+	dev->busy = false;
+	if (ret < 0) {
+		g_print("Rift: Pairing %s %08x failed: %d\n", dev->name,
+			cmd->arg, ret);
+		return;
 	}
 
-	dev->active = true;
+	dev->address = cmd->arg;
 
-	return 0;
+	g_print("Rift: Pairing %s %08x finished\n", dev->name, dev->address);
+}
+
+/*
+ * Queues a radio data report write as part of the pairing sequence.
+ */
+static struct rift_radio_command *
+rift_radio_queue_pairing_write(struct rift_radio *radio, uint8_t b,
+			       struct rift_wireless_device *dev,
+			       uint32_t device_address,
+			       rift_radio_command_cb complete)
+{
+	struct rift_radio_command *cmd;
+
+	cmd = rift_radio_queue_command(radio, RIFT_RADIO_COMMAND_WRITE, 0x04,
+				       b, 0x05, complete, dev);
+	if (cmd)
+		cmd->arg = device_address;
+
+	return cmd;
 }
 
-int rift_decode_pairing_message(struct rift_radio *radio, int fd,
+int rift_decode_pairing_message(struct rift_radio *radio,
 				const struct rift_radio_message *message)
 {
-	struct rift_radio_data_report report = {
-		.id = RIFT_RADIO_DATA_REPORT_ID,
-	};
 	uint8_t device_type = message->pairing.device_type;
 	uint32_t device_address = __le32_to_cpu(message->pairing.id[0]);
 	uint32_t radio_address = __le32_to_cpu(message->pairing.id[1]);
 	struct rift_wireless_device *dev;
+	struct rift_radio_command *cmd[4];
 	uint16_t maybe_channel;
+	uint8_t *payload;
 	unsigned int i;
-	int ret;
 
 	for (i = 0; i < sizeof *message; i++) {
 		if (((char *)message)[i])
@@ -725,64 +962,64 @@ int rift_decode_pairing_message(struct rift_radio *radio, int fd,
 		return -EINVAL;
 	}
 
+	/* Pairing messages keep arriving while the pairing is in progress */
+	if (dev->address == device_address || dev->busy)
+		return 0;
+
 	g_print("Rift: Detected %s %08x: %s paired to %08x, firmware %s, rssi(?) %u\n",
 		dev->name, device_address,
 		(radio_address == radio->address) ? "already" : "currently",
 		radio_address, message->pairing.firmware,
 		message->pairing.maybe_rssi);
 
-	if (dev->address == device_address)
+	if (radio->queue.count + 4 > RIFT_RADIO_QUEUE_LENGTH)
 		return 0;
 
 	g_print("Rift: Pairing %s %08x to headset radio %08x, channel(?) %u ...\n",
 		dev->name, device_address, radio->address, maybe_channel);
 
 	/* Step 1: set device address */
-	memset(report.payload, 0, sizeof(report.payload));
-	*(__le32 *)report.payload = __cpu_to_le32(device_address);
-	ret = rift_radio_write(fd, 0x04, 0x07, 0x05, &report);
-	if (ret < 0)
-		return ret;
+	cmd[0] = rift_radio_queue_pairing_write(radio, 0x07, dev,
+						device_address,
+						rift_radio_pairing_step_done);
+	payload = cmd[0]->report.payload;
+	*(__le32 *)payload = __cpu_to_le32(device_address);
 
 	/* Step 2: configure device target address and channel(?) */
-	memset(report.payload, 0, sizeof(report.payload));
-	report.payload[0] = 0x11;
-	report.payload[1] = 0x05;
-	report.payload[2] = device_type;
-	*(__le32 *)(report.payload + 3) = __cpu_to_le32(radio->address);
-	*(__le32 *)(report.payload + 7) = __cpu_to_le32(radio->address);
-	report.payload[11] = 0x8c;
-	*(__le16 *)(report.payload + 12) = __cpu_to_le16(maybe_channel);
-	*(__le16 *)(report.payload + 16) = __cpu_to_le16(2000);
-	ret = rift_radio_write(fd, 0x04, 0x09, 0x05, &report);
-	if (ret < 0)
-		return ret;
+	cmd[1] = rift_radio_queue_pairing_write(radio, 0x09, dev,
+						device_address,
+						rift_radio_pairing_step_done);
+	payload = cmd[1]->report.payload;
+	payload[0] = 0x11;
+	payload[1] = 0x05;
+	payload[2] = device_type;
+	*(__le32 *)(payload + 3) = __cpu_to_le32(radio->address);
+	*(__le32 *)(payload + 7) = __cpu_to_le32(radio->address);
+	payload[11] = 0x8c;
+	*(__le16 *)(payload + 12) = __cpu_to_le16(maybe_channel);
+	*(__le16 *)(payload + 16) = __cpu_to_le16(2000);
 
 	/* Step 3: tell device to stop pairing */
-	memset(report.payload, 0, sizeof(report.payload));
-	report.payload[0] = 0x21;
-	ret = rift_radio_write(fd, 0x04, 0x09, 0x05, &report);
-	if (ret < 0)
-		return ret;
+	cmd[2] = rift_radio_queue_pairing_write(radio, 0x09, dev,
+						device_address,
+						rift_radio_pairing_step_done);
+	cmd[2]->report.payload[0] = 0x21;
 
 	/* Step 4: finish pairing */
-	memset(report.payload, 0, sizeof(report.payload));
-	ret = rift_radio_write(fd, 0x04, 0x08, 0x05, &report);
-	if (ret < 0)
-		return ret;
-
-	dev->address = device_address;
+	cmd[3] = rift_radio_queue_pairing_write(radio, 0x08, dev,
+						device_address,
+						rift_radio_pairing_done);
 
-	g_print("Rift: Pairing %s %08x finished\n", dev->name, dev->address);
+	dev->busy = true;
 
 	return 0;
 }
 
-int rift_decode_radio_message(struct rift_radio *radio, int fd,
+int rift_decode_radio_message(struct rift_radio *radio,
 			       const struct rift_radio_message *message)
 {
 	if (radio->pairing)
-		return rift_decode_pairing_message(radio, fd, message);
+		return rift_decode_pairing_message(radio, message);
 
 	if (message->unknown[0] == 0)
 		return 0;
@@ -801,8 +1038,10 @@ int rift_decode_radio_message(struct rift_radio *radio, int fd,
 			radio->touch[0].base.present = true;
 		}
 		if (!radio->touch[0].base.active && message->touch.timestamp)
-			rift_radio_activate(&radio->touch[0].base, fd);
-		rift_decode_touch_message(&radio->touch[0], message);
+			rift_radio_activate(radio, &radio->touch[0].base);
+		/* The IMU samples are meaningless without calibration */
+		if (radio->touch[0].base.active)
+			rift_decode_touch_message(&radio->touch[0], message);
 	} else if (message->device_type == RIFT_TOUCH_CONTROLLER_RIGHT) {
 		if (!radio->touch[1].base.present) {
 			g_print("Rift: %s present (%sactive)\n",
@@ -811,8 +1050,10 @@ int rift_decode_radio_message(struct rift_radio *radio, int fd,
 			radio->touch[1].base.present = true;
 		}
 		if (!radio->touch[1].base.active && message->touch.timestamp)
-			rift_radio_activate(&radio->touch[1].base, fd);
-		rift_decode_touch_message(&radio->touch[1], message);
+			rift_radio_activate(radio, &radio->touch[1].base);
+		/* The IMU samples are meaningless without calibration */
+		if (radio->touch[1].base.active)
+			rift_decode_touch_message(&radio->touch[1], message);
 	} else {
 		g_print("%s: unknown device %02x:", radio->name,
 			message->device_type);
@@ -822,7 +1063,7 @@ int rift_decode_radio_message(struct rift_radio *radio, int fd,
 	return 0;
 }
 
-void rift_decode_radio_report(struct rift_radio *radio, int fd,
+void rift_decode_radio_report(struct rift_radio *radio,
 			      const unsigned char *buf, size_t len)
 {
 	const struct rift_radio_report *report = (const void *)buf;
@@ -831,7 +1072,7 @@ void rift_decode_radio_report(struct rift_radio *radio, int fd,
 
 	if (report->id == RIFT_RADIO_REPORT_ID) {
 		for (i = 0; i < 2; i++) {
-			ret = rift_decode_radio_message(radio, fd,
+			ret = rift_decode_radio_message(radio,
 							&report->message[i]);
 			if (ret < 0) {
 				rift_dump_report(buf, len);
@@ -859,4 +1100,65 @@ void rift_radio_init(struct rift_radio *radio)
 	radio->touch[1].base.name = "Touch Controller R";
 	radio->touch[1].base.id = RIFT_TOUCH_CONTROLLER_RIGHT;
 	radio->touch[1].imu.pose.rotation.w = 1.0;
+	radio->touch[0].fusion = fusion_new();
+	radio->touch[1].fusion = fusion_new();
+	radio->calibration_cache = g_hash_table_new_full(g_str_hash,
+							 g_str_equal, g_free,
+							 g_free);
+}
+
+/*
+ * Reads all cached Touch controller calibrations, so that the radio thread
+ * can look them up when a controller is activated without blocking on the
+ * file system. Called from the device start function.
+ */
+void rift_radio_load_cache(struct rift_radio *radio)
+{
+	char **names;
+	char *path;
+	char *json;
+	int i;
+
+	g_hash_table_remove_all(radio->calibration_cache);
+
+	names = ouvrt_cache_list("touch");
+	for (i = 0; names[i]; i++) {
+		path = ouvrt_cache_path("%s", names[i]);
+		if (ouvrt_cache_load(path, &json, NULL)) {
+			g_hash_table_replace(radio->calibration_cache,
+					     g_strdup(names[i]), json);
+		}
+		g_free(path);
+	}
+	g_strfreev(names);
+}
+
+/*
+ * Frees the Touch controller fusion filters and pose outputs.
+ */
+void rift_radio_fini(struct rift_radio *radio)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		fusion_free(radio->touch[i].fusion);
+		radio->touch[i].fusion = NULL;
+		pose_shm_free(radio->touch[i].pose_shm);
+		radio->touch[i].pose_shm = NULL;
+		g_free(radio->touch[i].calibration_cache);
+		radio->touch[i].calibration_cache = NULL;
+		g_free(radio->touch[i].calibration_json);
+		radio->touch[i].calibration_json = NULL;
+	}
+	g_hash_table_destroy(radio->calibration_cache);
+	radio->calibration_cache = NULL;
+}
+
+/*
+ * Returns a file descriptor for the shared memory pose output of the Touch
+ * controller, which is created on first use and then updated at radio rate.
+ */
+int rift_touch_get_pose_fd(struct rift_touch_controller *touch)
+{
+	return pose_shm_open(&touch->pose_shm);
 }
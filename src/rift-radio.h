@@ -6,12 +6,17 @@
 #ifndef __RIFT_RADIO_H__
 #define __RIFT_RADIO_H__
 
+#include <glib.h>
 #include <unistd.h>
 #include <stdbool.h>
 
 #include "imu.h"
+#include "rift-hid-reports.h"
 #include "tracking-model.h"
 
+struct fusion;
+struct pose_shm;
+
 struct rift_wireless_device {
 	unsigned long dev_id;
 	const char *name;
@@ -19,6 +24,7 @@ struct rift_wireless_device {
 	uint8_t id;
 	bool present;
 	bool active;
+	bool busy;
 	char firmware_date[11+1];
 	char firmware_version[10+1];
 	char serial[14+1];
@@ -57,7 +63,13 @@ struct rift_touch_controller {
 	struct rift_touch_calibration calibration;
 	struct tracking_model model;
 	struct imu_state imu;
+	struct fusion *fusion;
+	struct pose_shm *pose_shm;
+	char *calibration_cache;
+	char *calibration_json;
+	uint16_t calibration_size;
 	uint32_t last_timestamp;
+	uint64_t time;
 	float trigger;
 	float grip;
 	float stick[2];
@@ -70,19 +82,71 @@ struct rift_touch_controller {
 	uint8_t buttons;
 };
 
+struct rift_radio;
+struct rift_radio_command;
+
+typedef void (*rift_radio_command_cb)(struct rift_radio *radio,
+				      const struct rift_radio_command *cmd,
+				      int ret);
+
+enum rift_radio_command_type {
+	RIFT_RADIO_COMMAND_READ,
+	RIFT_RADIO_COMMAND_WRITE,
+	RIFT_RADIO_COMMAND_READ_FLASH,
+};
+
+/*
+ * A radio command consists of a control report transfer, preceded by sending
+ * the data report for writes and flash reads, and followed by reading back
+ * the data report for reads.
+ */
+struct rift_radio_command {
+	enum rift_radio_command_type type;
+	uint8_t control[3];
+	struct rift_radio_data_report report;
+	rift_radio_command_cb complete;
+	struct rift_wireless_device *dev;
+	uint32_t arg;
+};
+
+enum rift_radio_queue_state {
+	RIFT_RADIO_QUEUE_IDLE,
+	RIFT_RADIO_QUEUE_SEND_DATA,
+	RIFT_RADIO_QUEUE_SEND_CONTROL,
+	RIFT_RADIO_QUEUE_POLL,
+	RIFT_RADIO_QUEUE_GET_DATA,
+};
+
+#define RIFT_RADIO_QUEUE_LENGTH		8
+
+struct rift_radio_queue {
+	struct rift_radio_command commands[RIFT_RADIO_QUEUE_LENGTH];
+	unsigned int head;
+	unsigned int count;
+	enum rift_radio_queue_state state;
+	unsigned int polls;
+};
+
 struct rift_radio {
 	const char *name;
 	uint32_t address;
 	bool pairing;
 	struct rift_remote remote;
 	struct rift_touch_controller touch[2];
+	struct rift_radio_queue queue;
+	/* cached Touch calibrations by file name, see rift_radio_load_cache */
+	GHashTable *calibration_cache;
 };
 
 int rift_radio_get_address(int fd, uint32_t *address);
-int rift_get_firmware_version(int fd);
+int rift_get_firmware_version(int fd, char *version);
 
-void rift_decode_radio_report(struct rift_radio *radio, int fd,
+void rift_decode_radio_report(struct rift_radio *radio,
 			      const unsigned char *buf, size_t len);
+void rift_radio_process_queue(struct rift_radio *radio, int fd);
 void rift_radio_init(struct rift_radio *radio);
+void rift_radio_load_cache(struct rift_radio *radio);
+void rift_radio_fini(struct rift_radio *radio);
+int rift_touch_get_pose_fd(struct rift_touch_controller *touch);
 
 #endif /* __RIFT_RADIO_H__ */
@@ -6,6 +6,7 @@
 #include <asm/byteorder.h>
 #include <errno.h>
 #include <libusb.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -16,9 +17,21 @@
 
 #include "rift-sensor.h"
 #include "device.h"
+#include "distortion.h"
 #include "esp770u.h"
 #include "ar0134.h"
+#include "cache.h"
+#include "clock-sync.h"
+#include "exposure.h"
+#include "frame-memory.h"
+#include "frame-pool.h"
+#include "frame-queue.h"
+#include "log.h"
+#include "recording.h"
+#include "remote-camera.h"
 #include "usb-ids.h"
+#include "stats.h"
+#include "trace.h"
 #include "uvc.h"
 #include "debug.h"
 
@@ -26,47 +39,196 @@
 #define RIFT_SENSOR_HEIGHT	960
 #define RIFT_SENSOR_FRAME_SIZE	(RIFT_SENSOR_WIDTH * RIFT_SENSOR_HEIGHT)
 #define RIFT_SENSOR_FRAMERATE	52
+#define RIFT_SENSOR_NUM_FRAMES	4
+/* maximum number of frames held by the debug stream */
+#define RIFT_SENSOR_DEBUG_FRAMES	1
+/* frames waiting for the frame processing thread */
+#define RIFT_SENSOR_QUEUE_DEPTH	1
 
 #define RIFT_SENSOR_VS_PROBE_CONTROL_SIZE	26
 
 #define UVC_INTERFACE_CONTROL	0
 #define UVC_INTERFACE_DATA	1
 
+#define RIFT_SENSOR_ENDPOINT		(1 | LIBUSB_ENDPOINT_IN)
+#define RIFT_SENSOR_NUM_PACKETS		32
+#define RIFT_SENSOR_MAX_TRANSFERS	16
+#define RIFT_SENSOR_STATS_INTERVAL	10000000000ULL
+
+/* minimum number of identified blobs to crop the sensor window */
+#define RIFT_SENSOR_WINDOW_MIN_BLOBS	4
+#define RIFT_SENSOR_WINDOW_MARGIN	64
+/* frames until the full frame is scanned again for other objects */
+#define RIFT_SENSOR_FULL_FRAME_INTERVAL	(4 * RIFT_SENSOR_FRAMERATE)
+
+/*
+ * Exposure limits in lines of 1388 pixel clocks at 74.25 MHz (~18.7 µs),
+ * and global gain limits in 1/32 steps (1x to 4x)
+ */
+#define RIFT_SENSOR_EXPOSURE		26
+#define RIFT_SENSOR_EXPOSURE_MIN	4
+#define RIFT_SENSOR_EXPOSURE_MAX	52
+#define RIFT_SENSOR_FINE_EXPOSURE	646
+#define RIFT_SENSOR_GAIN		0x20
+#define RIFT_SENSOR_GAIN_MIN		0x20
+#define RIFT_SENSOR_GAIN_MAX		0x80
+
+/*
+ * Sensor window in full frame coordinates
+ */
+struct rift_sensor_window {
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+/*
+ * Frame buffer handed from the USB thread to the frame processing thread.
+ * Frames received with a cropped sensor window are stored at the window
+ * position in a full size buffer that is black outside of the window.
+ */
+struct rift_sensor_frame {
+	unsigned char *data;
+	struct rift_sensor_window window;
+	struct blob *blobs;
+	int num_blobs;
+	/* set if the tracker was active when the frame started */
+	bool tracking;
+	uint64_t time;
+	double timestamps[4];
+};
+
+/*
+ * Tracking state kept across restarts, in host byte order
+ */
+struct rift_sensor_state {
+	uint64_t pts_ext;
+	struct clock_sync clock;
+	bool has_camera;
+	struct tracker_camera_snapshot camera;
+};
+
 struct _OuvrtRiftSensor {
 	OuvrtDevice dev;
 
 	libusb_device_handle *devh;
 	int num_transfers;
+	int active_transfers;
+	/* cleared to retire the transfers instead of resubmitting them */
+	bool streaming;
+	int transfer_size;
+	unsigned char *buffers;
+	bool dev_mem;
 	struct libusb_transfer **transfer;
 	uint8_t endpoint;
 
 	char *version;
 	bool sync;
 
-	unsigned char *frame;
-	int frame_size;
-	int payload_size;
-	int frame_id;
-	uint32_t pts;
+	/* frame ring, written by the USB thread */
+	struct rift_sensor_frame frames[RIFT_SENSOR_NUM_FRAMES];
+	struct rift_sensor_frame *frame;
+	/* completed frames handed over to the frame processing thread */
+	struct frame_queue *queue;
+	/* frames lent to the debug stream are not overwritten until released */
+	struct frame_pool *pool;
+	GMutex frame_lock;
+	GCond frame_cond;
+	GThread *frame_thread;
+	struct frame_latency latency;
+	unsigned int num_frames;
+	unsigned int num_dropped;
+	unsigned int num_packet_errors;
+	unsigned int num_transfer_errors;
+	unsigned int last_errors;
+	uint64_t last_stats_time;
+
+	/* sensor window of the frame being received, and the next one */
+	struct rift_sensor_window window;
+	struct rift_sensor_window next_window;
+	bool window_pending;
+	/* written by the frame processing thread */
+	struct rift_sensor_window requested_window;
+	int cropped_frames;
+	/* written by the frame processing thread */
+	struct exposure_control exposure;
+
+	struct uvc_stream uvc;
+	uint64_t pts_ext;
 	uint64_t time;
 	int64_t dt;
+	struct clock_sync clock;
+
+	dmat3 camera_matrix;
+	struct distortion distortion;
+	bool calibrated;
 
 	OuvrtTracker *tracker;
+	int tracker_camera;
 	uint32_t radio_id;
+	/* connection to the central tracker in remote camera node mode */
+	struct remote_camera *remote;
 	struct debug_stream *debug;
+	int recording_stream;
+
+	/* latest state for the checkpoint, protected by frame_lock */
+	struct rift_sensor_state state;
+	/* restored camera state, applied once the tracker camera is added */
+	bool restore_camera;
 };
 
 G_DEFINE_TYPE(OuvrtRiftSensor, ouvrt_rift_sensor, OUVRT_TYPE_USB_DEVICE)
 
+/*
+ * Reads the 128-byte calibration block at flash address 0x1d000 from the
+ * cache, keyed by the sensor serial number, or from flash, in which case the
+ * cache is written.
+ */
+static int rift_sensor_read_calibration(OuvrtRiftSensor *self, uint8_t *buf)
+{
+	OuvrtDevice *dev = OUVRT_DEVICE(self);
+	gchar *cached = NULL;
+	char *filename;
+	size_t length;
+	int ret;
+
+	if (!dev->serial)
+		return esp770u_flash_read(self->devh, 0x1d000, buf, 128);
+
+	filename = ouvrt_cache_path("%s.sensor", dev->serial);
+
+	if (ouvrt_cache_load(filename, &cached, &length) && length == 128) {
+		memcpy(buf, cached, 128);
+		g_print("%s: Read cached calibration data\n", dev->name);
+		ret = 0;
+	} else {
+		ret = esp770u_flash_read(self->devh, 0x1d000, buf, 128);
+		if (ret >= 0 && ouvrt_cache_save(filename, buf, 128))
+			g_print("%s: Wrote calibration data cache\n",
+				dev->name);
+	}
+
+	g_free(cached);
+	g_free(filename);
+
+	return ret;
+}
+
+/*
+ * Initializes the camera matrix and the fisheye distortion coefficients from
+ * the calibration block.
+ */
 static int rift_sensor_get_calibration(OuvrtRiftSensor *self)
 {
+	double * const A = self->camera_matrix.m;
+	double * const k = self->distortion.k;
 	uint8_t buf[128];
 	double fx, fy, cx, cy;
 	double k1, k2, k3, k4;
 	int ret;
 
-	/* Read a 128-byte block at EEPROM address 0x1d000 */
-	ret = esp770u_flash_read(self->devh, 0x1d000, buf, sizeof buf);
+	ret = rift_sensor_read_calibration(self, buf);
 	if (ret < 0)
 		return ret;
 
@@ -82,6 +244,24 @@ static int rift_sensor_get_calibration(OuvrtRiftSensor *self)
 	g_print(" f = [ %7.3f %7.3f ], c = [ %7.3f %7.3f ]\n", fx, fy, cx, cy);
 	g_print(" k = [ %9.6f %9.6f %9.6f %9.6f ]\n", k1, k2, k3 ,k4);
 
+	/*
+	 *     ⎡ fx 0  cx ⎤
+	 * A = ⎢ 0  fy cy ⎥
+	 *     ⎣ 0  0  1  ⎦
+	 */
+	A[0] = fx;  A[1] = 0.0; A[2] = cx;
+	A[3] = 0.0; A[4] = fy;  A[5] = cy;
+	A[6] = 0.0; A[7] = 0.0; A[8] = 1.0;
+
+	/*
+	 * k = [ k₁ k₂ k₃ k₄ ]
+	 */
+	self->distortion.model = DISTORTION_FISHEYE;
+	k[0] = k1; k[1] = k2; k[2] = k3; k[3] = k4; k[4] = 0.0;
+	distortion_init_map(&self->distortion, &self->camera_matrix,
+			    RIFT_SENSOR_WIDTH, RIFT_SENSOR_HEIGHT);
+	self->calibrated = true;
+
 	return 0;
 }
 
@@ -147,127 +327,529 @@ static int rift_sensor_open(OuvrtDevice *dev)
 	return 0;
 }
 
-static void default_frame_callback(OuvrtRiftSensor *self)
+/*
+ * Returns true if the window a fully contains the window b.
+ */
+static bool rift_sensor_window_contains(const struct rift_sensor_window *a,
+					const struct rift_sensor_window *b)
 {
-	struct timespec tp;
-	double timestamps[4] = {};
+	return b->x >= a->x && b->y >= a->y &&
+	       b->x + b->width <= a->x + a->width &&
+	       b->y + b->height <= a->y + a->height;
+}
 
-	clock_gettime(CLOCK_MONOTONIC, &tp);
-	timestamps[1] = tp.tv_sec + 1e-9 * tp.tv_nsec;
+/*
+ * Returns the bounding box of all blobs identified as LEDs, grown by margin
+ * and aligned to 16 pixels horizontally for the scanline search kernels, or
+ * the full frame if there are too few identified blobs.
+ */
+static struct rift_sensor_window
+rift_sensor_blob_window(struct blobservation *ob, int margin)
+{
+	struct rift_sensor_window window = {
+		0, 0, RIFT_SENSOR_WIDTH, RIFT_SENSOR_HEIGHT
+	};
+	int x0 = RIFT_SENSOR_WIDTH, y0 = RIFT_SENSOR_HEIGHT;
+	int x1 = 0, y1 = 0;
+	int num_identified = 0;
+	int i;
+
+	for (i = 0; ob && i < ob->num_blobs; i++) {
+		struct blob *b = &ob->blobs[i];
+
+		if (b->led_id < 0)
+			continue;
+
+		x0 = MIN(x0, b->x - b->width / 2);
+		y0 = MIN(y0, b->y - b->height / 2);
+		x1 = MAX(x1, b->x + b->width / 2 + 1);
+		y1 = MAX(y1, b->y + b->height / 2 + 1);
+		num_identified++;
+	}
+
+	if (num_identified < RIFT_SENSOR_WINDOW_MIN_BLOBS)
+		return window;
+
+	x0 = MAX(x0 - margin, 0) & ~15;
+	y0 = MAX(y0 - margin, 0);
+	x1 = (MIN(x1 + margin, RIFT_SENSOR_WIDTH) + 15) & ~15;
+	y1 = MIN(y1 + margin, RIFT_SENSOR_HEIGHT);
+
+	window.x = x0;
+	window.y = y0;
+	window.width = x1 - x0;
+	window.height = y1 - y0;
+
+	return window;
+}
+
+/*
+ * While enough LEDs are identified, crops the sensor window around them to
+ * reduce USB bandwidth and blob detection cost. Returns to the full frame on
+ * track loss, and periodically to find other tracked objects. The window is
+ * only changed if the LEDs approach its border or if it can shrink by half,
+ * as the frames received during a switch are lost. Called from the frame
+ * processing thread.
+ */
+static void rift_sensor_update_window(OuvrtRiftSensor *self,
+				      struct blobservation *ob)
+{
+	struct rift_sensor_window *current = &self->requested_window;
+	struct rift_sensor_window window, inner;
+	int ret;
+
+	window = rift_sensor_blob_window(ob, RIFT_SENSOR_WINDOW_MARGIN);
+	inner = rift_sensor_blob_window(ob, RIFT_SENSOR_WINDOW_MARGIN / 2);
+
+	if (window.width == RIFT_SENSOR_WIDTH &&
+	    window.height == RIFT_SENSOR_HEIGHT) {
+		self->cropped_frames = 0;
+	} else if (++self->cropped_frames > RIFT_SENSOR_FULL_FRAME_INTERVAL) {
+		window = (struct rift_sensor_window){
+			0, 0, RIFT_SENSOR_WIDTH, RIFT_SENSOR_HEIGHT
+		};
+		self->cropped_frames = 0;
+	} else if (rift_sensor_window_contains(current, &inner) &&
+		   2 * window.width * window.height >
+		   current->width * current->height) {
+		return;
+	}
+
+	if (memcmp(&window, current, sizeof(window)) == 0)
+		return;
+
+	ret = ar0134_set_window(self->devh, window.x, window.y,
+				window.x + window.width - 1,
+				window.y + window.height - 1);
+	if (ret < 0) {
+		g_print("%s: Failed to set sensor window: %d\n",
+			self->dev.name, ret);
+		return;
+	}
+
+	*current = window;
+
+	g_mutex_lock(&self->frame_lock);
+	self->next_window = window;
+	self->window_pending = true;
+	g_mutex_unlock(&self->frame_lock);
+}
+
+/*
+ * Resets exposure and gain to the synchronised exposure defaults.
+ */
+static int rift_sensor_reset_exposure(OuvrtRiftSensor *self)
+{
+	struct exposure_control *ctl = &self->exposure;
+
+	exposure_control_init(ctl, RIFT_SENSOR_EXPOSURE,
+			      RIFT_SENSOR_EXPOSURE_MIN,
+			      RIFT_SENSOR_EXPOSURE_MAX, RIFT_SENSOR_GAIN,
+			      RIFT_SENSOR_GAIN_MIN, RIFT_SENSOR_GAIN_MAX);
+
+	return ar0134_set_exposure_gain(self->devh, ctl->exposure,
+					RIFT_SENSOR_FINE_EXPOSURE, ctl->gain);
+}
+
+/*
+ * Adjusts exposure and gain to keep the LED blobs small and bright.
+ */
+static void rift_sensor_update_exposure(OuvrtRiftSensor *self,
+					struct rift_sensor_frame *frame,
+					struct blobservation *ob)
+{
+	struct exposure_control *ctl = &self->exposure;
+	int ret;
+
+	if (!ob || !exposure_control_update(ctl, frame->data,
+					    RIFT_SENSOR_WIDTH,
+					    RIFT_SENSOR_HEIGHT, ob->blobs,
+					    ob->num_blobs))
+		return;
+
+	ret = ar0134_set_exposure_gain(self->devh, ctl->exposure,
+				       RIFT_SENSOR_FINE_EXPOSURE, ctl->gain);
+	if (ret < 0)
+		g_print("%s: Failed to set exposure: %d\n", self->dev.name, ret);
+}
+
+/*
+ * Sends the blobs of a frame to the central tracker, and synchronises the
+ * exposures to the radio address it reports.
+ */
+static void rift_sensor_send_remote(OuvrtRiftSensor *self,
+				    struct rift_sensor_frame *frame,
+				    struct blobservation *ob)
+{
+	uint32_t radio_id;
+	int ret;
+
+	remote_camera_send(self->remote, frame->time,
+			   self->calibrated ? &self->camera_matrix : NULL,
+			   &self->distortion, ob->blobs, ob->num_blobs);
+
+	radio_id = remote_camera_get_radio_address(self->remote);
+	if (radio_id && radio_id != self->radio_id) {
+		ret = esp770u_setup_radio(self->devh, radio_id);
+		if (ret < 0) {
+			g_print("%s: Failed to set up radio: %d\n",
+				self->dev.name, ret);
+			return;
+		}
+		self->radio_id = radio_id;
+	}
+}
+
+/*
+ * Adds the sensor to the tracker, restoring the camera state saved before a
+ * restart, if there is any.
+ */
+static void rift_sensor_add_tracker_camera(OuvrtRiftSensor *self)
+{
+	self->tracker_camera = ouvrt_tracker_add_camera(self->tracker,
+							RIFT_SENSOR_WIDTH,
+							RIFT_SENSOR_HEIGHT,
+							BLOBWATCH_FORMAT_GREY);
+	if (self->tracker_camera < 0 || !self->restore_camera)
+		return;
+
+	g_mutex_lock(&self->frame_lock);
+	ouvrt_tracker_restore_camera_snapshot(self->tracker,
+					      self->tracker_camera,
+					      &self->state.camera);
+	self->restore_camera = false;
+	g_mutex_unlock(&self->frame_lock);
+}
+
+/*
+ * Tracks the blobs detected in a frame, estimates the pose, and pushes the
+ * frame into the debug stream. Called from the frame processing thread.
+ */
+static void rift_sensor_process_frame(OuvrtRiftSensor *self,
+				      struct rift_sensor_frame *frame)
+{
+	struct debug_imu_fifo *imu_fifo;
+	struct frame_pool_ref *ref;
+	struct timespec tp;
+	double *timestamps = frame->timestamps;
 
 	/*
-	 * Find bright blobs in the camera image and identify individual LEDs
-	 * using the estimated pose at time of exposure or, if that is not
-	 * available, using the LED blinking pattern.
+	 * Identify individual LEDs using the estimated pose at time of
+	 * exposure or, if that is not available, using the LED blinking
+	 * pattern.
 	 */
 	struct blobservation *ob = NULL;
-	if (self->tracker) {
-		ouvrt_tracker_process_frame(self->tracker,
-					    self->frame, RIFT_SENSOR_WIDTH,
-					    RIFT_SENSOR_HEIGHT, self->time,
-					    &ob);
+	if (frame->tracking) {
+		ouvrt_tracker_track_blobs(self->tracker, self->tracker_camera,
+					  frame->blobs, frame->num_blobs,
+					  frame->time,
+					  self->calibrated ?
+					  &self->camera_matrix : NULL,
+					  &self->distortion, &ob);
+		rift_sensor_update_window(self, ob);
+		rift_sensor_update_exposure(self, frame, ob);
 	}
 
+	if (ob && self->remote)
+		rift_sensor_send_remote(self, frame, ob);
+
 	clock_gettime(CLOCK_MONOTONIC, &tp);
 	timestamps[2] = tp.tv_sec + 1e-9 * tp.tv_nsec;
 
 	dquat rot = {};
 	dvec3 trans = {};
 
-	/* TODO: calculate pose */
+	/*
+	 * Calculate the pose from the identified blobs, the intrinsic camera
+	 * parameters, and the known LED positions.
+	 */
+	if (ob && self->calibrated) {
+		ouvrt_tracker_process_blobs(self->tracker, self->tracker_camera,
+					    ob->blobs, ob->num_blobs,
+					    frame->time, &self->camera_matrix,
+					    &self->distortion, &rot, &trans);
+
+		g_mutex_lock(&self->frame_lock);
+		ouvrt_tracker_get_camera_snapshot(self->tracker,
+						  self->tracker_camera,
+						  &self->state.camera);
+		self->state.has_camera = true;
+		g_mutex_unlock(&self->frame_lock);
+	}
 
 	clock_gettime(CLOCK_MONOTONIC, &tp);
 	timestamps[3] = tp.tv_sec + 1e-9 * tp.tv_nsec;
+	frame_latency_add(&self->latency, timestamps);
+
+	/*
+	 * Lend the frame to the debug stream unless it already holds one, in
+	 * which case the debug frame is dropped.
+	 */
+	if (!debug_stream_connected(self->debug))
+		return;
+	imu_fifo = ouvrt_tracker_get_debug_imu_fifo(self->tracker);
+	ref = frame_pool_acquire(self->pool, frame - self->frames);
+	if (ref && !debug_stream_frame_push(self->debug, frame->data,
+					    RIFT_SENSOR_WIDTH *
+					    RIFT_SENSOR_HEIGHT +
+					    sizeof(struct ouvrt_debug_attachment),
+					    RIFT_SENSOR_WIDTH * RIFT_SENSOR_HEIGHT,
+					    ob, &rot, &trans, timestamps,
+					    imu_fifo, frame_pool_release, ref))
+		frame_pool_release(ref);
+}
 
-	debug_stream_frame_push(self->debug, self->frame,
-				RIFT_SENSOR_WIDTH * RIFT_SENSOR_HEIGHT +
-				sizeof(struct ouvrt_debug_attachment),
-				RIFT_SENSOR_WIDTH * RIFT_SENSOR_HEIGHT,
-				ob, &rot, &trans, timestamps);
+/*
+ * Takes frames handed over by the USB thread and processes them.
+ */
+static gpointer rift_sensor_frame_thread(gpointer data)
+{
+	OuvrtRiftSensor *self = data;
+	struct rift_sensor_frame *frame;
+
+	while ((frame = frame_queue_pop(self->queue))) {
+		rift_sensor_process_frame(self, frame);
+		frame_queue_done(self->queue);
+	}
+
+	return NULL;
 }
 
-enum process_payload_return {
-	PAYLOAD_EMPTY,
-	PAYLOAD_INVALID,
-	PAYLOAD_OVERFLOW,
-	PAYLOAD_FRAME_PARTIAL,
-	PAYLOAD_FRAME_COMPLETE
-};
+static void rift_sensor_print_stats(OuvrtRiftSensor *self)
+{
+	g_print("%s: %u frames, %u dropped, %u short, %u packet errors, %u transfer errors\n",
+		self->dev.name, self->num_frames, self->num_dropped,
+		self->uvc.num_short, self->num_packet_errors,
+		self->num_transfer_errors);
+}
+
+/*
+ * Periodically reports the frame statistics while frames are lost to short
+ * frames or transfer errors. Called from the USB thread.
+ */
+static void rift_sensor_update_stats(OuvrtRiftSensor *self, uint64_t time)
+{
+	unsigned int errors = self->uvc.num_short + self->num_packet_errors +
+			      self->num_transfer_errors;
+
+	if (time - self->last_stats_time < RIFT_SENSOR_STATS_INTERVAL)
+		return;
+
+	if (errors != self->last_errors)
+		rift_sensor_print_stats(self);
 
-enum process_payload_return process_payload(OuvrtRiftSensor *self,
-					    unsigned char *payload, size_t len)
+	self->last_errors = errors;
+	self->last_stats_time = time;
+}
+
+/*
+ * Finishes blob detection on the completely received frame and hands it over
+ * to the frame processing thread. If the frame processing thread falls
+ * behind, the queue policy decides whether an older frame or this frame is
+ * dropped, or whether the USB thread waits. Called from the USB thread.
+ */
+static void rift_sensor_frame_complete(OuvrtRiftSensor *self)
 {
-	struct uvc_payload_header *h = (struct uvc_payload_header *)payload;
-	int payload_len;
-	int frame_id;
-	uint32_t pts;
-	bool error;
+	struct rift_sensor_frame *frame = self->frame;
+	struct rift_sensor_frame *dropped;
+	struct timespec tp;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	frame->timestamps[0] = 0;
+	frame->timestamps[1] = tp.tv_sec + 1e-9 * tp.tv_nsec;
+	frame->time = self->time;
 
-	if (len == 0 || len == sizeof(struct uvc_payload_header))
-		return PAYLOAD_EMPTY;
+	recording_write_frame(RECORDING_CHUNK_SENSOR_FRAME,
+			      self->recording_stream, 0, RIFT_SENSOR_WIDTH,
+			      RIFT_SENSOR_HEIGHT, RECORDING_FOURCC_GREY,
+			      self->pts_ext, frame->data,
+			      RIFT_SENSOR_FRAME_SIZE);
 
-	if (h->bHeaderLength == 0) {
-		/* This happens when unplugging the camera */
-		return PAYLOAD_INVALID;
+	/*
+	 * Find bright blobs in the camera image. Most of the lines have
+	 * already been processed while the frame was received.
+	 */
+	frame->num_blobs = 0;
+	if (frame->tracking) {
+		if (!frame->blobs) {
+			int max_blobs = ouvrt_tracker_get_max_blobs(self->tracker,
+							self->tracker_camera);
+
+			for (i = 0; i < RIFT_SENSOR_NUM_FRAMES; i++)
+				self->frames[i].blobs = g_new(struct blob,
+							      max_blobs);
+		}
+		frame->num_blobs = ouvrt_tracker_end_frame(self->tracker,
+							   self->tracker_camera,
+							   frame->blobs);
 	}
 
-	if (h->bHeaderLength != 12) {
-		g_print("%s: Invalid header length: %u (%ld)\n", self->dev.name,
-			h->bHeaderLength, len);
-		return PAYLOAD_INVALID;
+	dropped = frame_queue_push(self->queue, frame);
+
+	g_mutex_lock(&self->frame_lock);
+	self->num_frames++;
+	if (dropped)
+		self->num_dropped++;
+
+	/*
+	 * Continue with a frame buffer that is neither queued, being
+	 * processed, nor held by the debug stream.
+	 */
+	for (i = 0; i < RIFT_SENSOR_NUM_FRAMES; i++) {
+		if (!frame_queue_contains(self->queue, &self->frames[i]) &&
+		    !frame_pool_is_held(self->pool, i))
+			break;
 	}
+	self->frame = &self->frames[i];
+	g_mutex_unlock(&self->frame_lock);
 
-	payload += h->bHeaderLength;
-	payload_len = len - h->bHeaderLength;
-	frame_id = h->bmHeaderInfo & 0x01;
-	error = h->bmHeaderInfo & 0x40;
+	rift_sensor_update_stats(self, frame->time);
+}
 
-	if (error) {
-		g_print("%s: Frame error\n", self->dev.name);
-		return PAYLOAD_INVALID;
+/*
+ * Copies payload data of a frame received with a cropped sensor window to
+ * the window position in the full size frame buffer.
+ */
+static void rift_sensor_copy_payload(OuvrtRiftSensor *self, int offset,
+				     const unsigned char *payload, int len)
+{
+	const struct rift_sensor_window *w = &self->window;
+
+	if (w->width == RIFT_SENSOR_WIDTH) {
+		memcpy(self->frame->data + w->y * RIFT_SENSOR_WIDTH + offset,
+		       payload, len);
+		return;
 	}
 
-	pts = __le32_to_cpu(h->dwPresentationTime);
-	if (self->payload_size == 0)
-		self->pts = pts;
+	while (len > 0) {
+		int row = offset / w->width;
+		int col = offset % w->width;
+		int n = MIN(len, w->width - col);
 
-	if (frame_id != self->frame_id) {
-		struct timespec ts;
-		uint64_t time;
+		memcpy(self->frame->data + (w->y + row) * RIFT_SENSOR_WIDTH +
+		       w->x + col, payload, n);
+		payload += n;
+		offset += n;
+		len -= n;
+	}
+}
 
-		if (self->payload_size != self->frame_size) {
-			g_print("%s: Dropping short frame: %u\n",
-				self->dev.name, self->payload_size);
-		}
+/*
+ * Timestamps a new frame and switches to a newly requested sensor window.
+ * Returns the size of the new frame.
+ */
+static int rift_sensor_frame_start(void *data, uint32_t pts)
+{
+	OuvrtRiftSensor *self = data;
+	struct timespec ts;
+	uint64_t time;
+	int frame_size;
 
-		/* Start of new frame */
-		clock_gettime(CLOCK_MONOTONIC, &ts);
-		time = ts.tv_sec * 1000000000 + ts.tv_nsec;
-		self->dt = time - self->time;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	time = ts.tv_sec * 1000000000 + ts.tv_nsec;
 
-		self->frame_id = frame_id;
-		self->pts = pts;
-		self->time = time;
-		self->payload_size = 0;
-	} else {
-		if (pts != self->pts) {
-			g_print("%s: PTS changed in-frame at %u!\n",
-				self->dev.name, self->payload_size);
-			self->pts = pts;
+	/*
+	 * The presentation time stamps the start of exposure in
+	 * device time, convert it into host time.
+	 */
+	self->pts_ext += (int32_t)(pts - (uint32_t)self->pts_ext);
+	clock_sync_add_sample(&self->clock, self->pts_ext, time);
+	time = clock_sync_to_host(&self->clock, self->pts_ext);
+	self->dt = time - self->time;
+	self->time = time;
+
+	OUVRT_TRACE3(rift_sensor_frame_start, self->dev.id, self->pts_ext,
+		     time);
+
+	/* Switch to a newly requested sensor window between frames */
+	g_mutex_lock(&self->frame_lock);
+	self->state.pts_ext = self->pts_ext;
+	self->state.clock = self->clock;
+	if (self->window_pending) {
+		self->window = self->next_window;
+		self->window_pending = false;
+	}
+	frame_size = self->window.width * self->window.height;
+	g_mutex_unlock(&self->frame_lock);
+
+	return frame_size;
+}
+
+/*
+ * Stores image data of the current frame and passes completed lines on to
+ * the tracker.
+ */
+static void rift_sensor_payload(void *data, int offset,
+				const uint8_t *payload, int len)
+{
+	OuvrtRiftSensor *self = data;
+
+	if (offset == 0) {
+		if (memcmp(&self->frame->window, &self->window,
+			   sizeof(self->window)) != 0) {
+			/* Clear everything outside of a new cropped window once */
+			if (self->uvc.frame_size != RIFT_SENSOR_FRAME_SIZE)
+				memset(self->frame->data, 0,
+				       RIFT_SENSOR_FRAME_SIZE);
+			self->frame->window = self->window;
 		}
+
+		/* Resting devices are tracked at a reduced frame rate */
+		self->frame->tracking = self->tracker &&
+					ouvrt_tracker_is_active(self->tracker) &&
+					!ouvrt_tracker_skip_frame(self->tracker,
+							self->tracker_camera,
+							self->time);
 	}
 
-	if (self->payload_size + payload_len > self->frame_size) {
-		g_print("%s: Frame buffer overflow: %u %u %u\n", self->dev.name,
-		       self->payload_size, payload_len, self->frame_size);
-		return PAYLOAD_OVERFLOW;
+	if (self->frame->tracking && offset == 0) {
+		if (self->tracker_camera < 0)
+			rift_sensor_add_tracker_camera(self);
+		ouvrt_tracker_begin_frame(self->tracker, self->tracker_camera,
+					  self->frame->data);
 	}
 
-	memcpy(self->frame + self->payload_size, payload, payload_len);
-	self->payload_size += payload_len;
+	rift_sensor_copy_payload(self, offset, payload, len);
 
-	return (self->payload_size == self->frame_size) ?
-	       PAYLOAD_FRAME_COMPLETE : PAYLOAD_FRAME_PARTIAL;
+	/* Detect blobs in the lines completed by this payload */
+	if (self->frame->tracking) {
+		ouvrt_tracker_process_lines(self->tracker, self->tracker_camera,
+					    self->window.y + (offset + len) /
+					    self->window.width);
+	}
+}
+
+static const struct uvc_stream_ops rift_sensor_uvc_ops = {
+	.frame_start = rift_sensor_frame_start,
+	.payload = rift_sensor_payload,
+};
+
+static enum uvc_payload_result process_payload(OuvrtRiftSensor *self,
+					       unsigned char *payload,
+					       size_t len)
+{
+	enum uvc_payload_result ret;
+
+	ret = uvc_stream_process_payload(&self->uvc, payload, len);
+	if (ret == UVC_PAYLOAD_FRAME_COMPLETE) {
+		OUVRT_TRACE3(rift_sensor_frame_complete, self->dev.id,
+			     self->time, self->uvc.payload_size);
+	}
+
+	return ret;
+}
+
+/*
+ * Drops a transfer that is not resubmitted anymore and wakes up stop once
+ * the last one is gone.
+ */
+static void rift_sensor_transfer_done(OuvrtRiftSensor *self)
+{
+	g_mutex_lock(&self->frame_lock);
+	if (--self->active_transfers == 0)
+		g_cond_broadcast(&self->frame_cond);
+	g_mutex_unlock(&self->frame_lock);
 }
 
 static void iso_transfer_cb(struct libusb_transfer *transfer)
@@ -277,42 +859,132 @@ static void iso_transfer_cb(struct libusb_transfer *transfer)
 	int ret;
 	int i;
 
+	if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+		rift_sensor_transfer_done(self);
+		return;
+	}
+
 	if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
 		if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
 			if (dev->active)
 				g_print("%s: Device vanished\n", dev->name);
-			dev->active = false;
+			ouvrt_usb_device_deactivate(OUVRT_USB_DEVICE(dev));
+			__atomic_store_n(&self->streaming, false,
+					 __ATOMIC_RELEASE);
 		} else {
 			g_print("%s: Transfer error: %d (%s)\n",
 				dev->name, transfer->status,
 				libusb_error_name(transfer->status));
+			self->num_transfer_errors++;
 		}
+		rift_sensor_transfer_done(self);
 		return;
 	}
 
 	/* Handle contained isochronous packets */
 	for (i = 0; i < transfer->num_iso_packets; i++) {
-		enum process_payload_return ret;
+		enum uvc_payload_result ret;
 		unsigned char *payload;
 		size_t payload_len;
 
+		/* Skip damaged packets, the frame will be dropped as short */
+		if (transfer->iso_packet_desc[i].status !=
+		    LIBUSB_TRANSFER_COMPLETED) {
+			self->num_packet_errors++;
+			continue;
+		}
+
 		payload = libusb_get_iso_packet_buffer_simple(transfer, i);
 		payload_len = transfer->iso_packet_desc[i].actual_length;
 		ret = process_payload(self, payload, payload_len);
 
-		if (ret == PAYLOAD_FRAME_COMPLETE)
-			default_frame_callback(self);
+		if (ret == UVC_PAYLOAD_FRAME_COMPLETE)
+			rift_sensor_frame_complete(self);
 	}
 
+	if (!__atomic_load_n(&self->streaming, __ATOMIC_ACQUIRE)) {
+		rift_sensor_transfer_done(self);
+		return;
+	}
 
 	/* Resubmit transfer */
 	ret = libusb_submit_transfer(transfer);
 	if (ret < 0) {
 		g_print("%s: Failed to resubmit: %d\n", dev->name, ret);
-		dev->active = false;
+		rift_sensor_transfer_done(self);
 	}
 }
 
+/*
+ * Allocates the buffers of all transfers in one block, preferably from the
+ * usbfs mmap area so that the kernel can transfer into it without copying.
+ */
+static int rift_sensor_alloc_buffers(OuvrtRiftSensor *self, size_t size)
+{
+#ifdef HAVE_LIBUSB_DEV_MEM_ALLOC
+	self->buffers = libusb_dev_mem_alloc(self->devh, size);
+	self->dev_mem = self->buffers != NULL;
+	if (self->buffers)
+		return 0;
+#endif
+	/* The kernel or libusb do not support usbfs mmap, fall back */
+	self->dev_mem = false;
+	self->buffers = frame_memory_alloc(size);
+
+	return self->buffers ? 0 : -ENOMEM;
+}
+
+static void rift_sensor_free_buffers(OuvrtRiftSensor *self, size_t size)
+{
+#ifdef HAVE_LIBUSB_DEV_MEM_ALLOC
+	if (self->dev_mem)
+		libusb_dev_mem_free(self->devh, self->buffers, size);
+	else
+#endif
+		frame_memory_free(self->buffers);
+	self->buffers = NULL;
+}
+
+/*
+ * Cancels all submitted transfers, waits until they are returned from the
+ * USB event thread, and frees them together with their buffers.
+ */
+static void rift_sensor_free_transfers(OuvrtRiftSensor *self)
+{
+	gint64 end_time = g_get_monotonic_time() + G_TIME_SPAN_SECOND;
+	int i;
+
+	if (!self->transfer)
+		return;
+
+	__atomic_store_n(&self->streaming, false, __ATOMIC_RELEASE);
+	for (i = 0; i < self->num_transfers; i++) {
+		if (self->transfer[i])
+			libusb_cancel_transfer(self->transfer[i]);
+	}
+
+	g_mutex_lock(&self->frame_lock);
+	while (self->active_transfers > 0) {
+		if (!g_cond_wait_until(&self->frame_cond, &self->frame_lock,
+				       end_time)) {
+			g_print("%s: Timeout waiting for %d transfers\n",
+				self->dev.name, self->active_transfers);
+			g_mutex_unlock(&self->frame_lock);
+			/* Leak the remaining transfers, they may still complete */
+			return;
+		}
+	}
+	g_mutex_unlock(&self->frame_lock);
+
+	for (i = 0; i < self->num_transfers; i++)
+		libusb_free_transfer(self->transfer[i]);
+	rift_sensor_free_buffers(self, self->num_transfers *
+				 self->transfer_size);
+	free(self->transfer);
+	self->transfer = NULL;
+	self->num_transfers = 0;
+}
+
 /*
  * Starts streaming and sets up the sensor for the exposure synchronization
  * signal from the Rift CV1.
@@ -323,9 +995,8 @@ static int rift_sensor_start(OuvrtDevice *dev)
 {
 	OuvrtRiftSensor *self = OUVRT_RIFT_SENSOR(dev);
 	libusb_device_handle *devh = self->devh;
-	const int num_packets = 24;
-	const int packet_size = 16384;
-	const int alt_setting = 2;
+	int num_packets = RIFT_SENSOR_NUM_PACKETS;
+	int alt_setting, packet_size;
 	struct uvc_probe_commit_control probe = {
 		.bFormatIndex = 1,
 		.bFrameIndex = 4,
@@ -355,13 +1026,13 @@ static int rift_sensor_start(OuvrtDevice *dev)
 	ret = uvc_set_cur(devh, 1, 0, VS_PROBE_CONTROL, &probe, len);
 	if (ret < 0) {
 		g_print("%s: Failed to set PROBE: %d\n", dev->name, ret);
-		return ret;
+		goto err_release;
 	}
 
 	ret = uvc_get_cur(devh, 1, 0, VS_PROBE_CONTROL, &commit, len);
 	if (ret < 0) {
 		g_print("%s: Failed to get PROBE: %d\n", dev->name, ret);
-		return ret;
+		goto err_release;
 	}
 
 	if (memcmp(&expect, &commit, len) != 0) {
@@ -386,46 +1057,135 @@ static int rift_sensor_start(OuvrtDevice *dev)
 	ret = uvc_set_cur(devh, 1, 0, VS_COMMIT_CONTROL, &commit, len);
 	if (ret < 0) {
 		g_print("%s: Failed to set COMMIT\n", dev->name);
-		return ret;
+		goto err_release;
+	}
+
+	/*
+	 * Use the alternate setting with the least bandwidth that still fits
+	 * the negotiated payload size, to leave room for more sensors on the
+	 * same host controller.
+	 */
+	alt_setting = uvc_find_alt_setting(devh, UVC_INTERFACE_DATA,
+				RIFT_SENSOR_ENDPOINT,
+				__le32_to_cpu(commit.dwMaxPayloadTransferSize),
+				&packet_size);
+	if (alt_setting < 0) {
+		g_print("%s: Failed to find streaming alt setting: %d\n",
+			dev->name, alt_setting);
+		ret = alt_setting;
+		goto err_release;
 	}
 
 	ret = libusb_set_interface_alt_setting(devh, 1, alt_setting);
 	if (ret) {
 		g_print("%s: Failed to set interface alt setting\n", dev->name);
-		return ret;
+		goto err_release;
 	}
 
-	self->frame_size = RIFT_SENSOR_FRAME_SIZE;
-	self->frame = calloc(1, self->frame_size +
-			     sizeof(struct ouvrt_debug_attachment));
-	if (!self->frame)
-		return -ENOMEM;
+	self->window = (struct rift_sensor_window){
+		0, 0, RIFT_SENSOR_WIDTH, RIFT_SENSOR_HEIGHT
+	};
+	self->requested_window = self->window;
+	self->window_pending = false;
+	uvc_stream_init(&self->uvc, dev->name, RIFT_SENSOR_FRAME_SIZE,
+			&rift_sensor_uvc_ops, self);
+	for (int i = 0; i < RIFT_SENSOR_NUM_FRAMES; i++) {
+		if (!self->frames[i].data)
+			self->frames[i].data = frame_memory_alloc(
+					RIFT_SENSOR_FRAME_SIZE +
+					sizeof(struct ouvrt_debug_attachment));
+		if (!self->frames[i].data) {
+			ret = -ENOMEM;
+			goto err_release;
+		}
+		self->frames[i].window = self->window;
+	}
+	self->frame = &self->frames[0];
+	if (!self->queue) {
+		enum frame_queue_policy policy;
+
+		/*
+		 * The queue is filled from the libusb event thread, which must
+		 * never block, as the frame thread waits for it to complete
+		 * sensor register writes.
+		 */
+		policy = frame_queue_get_default_policy();
+		if (policy == FRAME_QUEUE_BLOCK)
+			policy = FRAME_QUEUE_DROP_OLDEST;
+		self->queue = frame_queue_new(dev->name,
+					      RIFT_SENSOR_QUEUE_DEPTH, policy);
+		if (!self->queue) {
+			ret = -ENOMEM;
+			goto err_release;
+		}
+		/* Drop frames until the frame processing thread is running */
+		frame_queue_close(self->queue);
+	}
+
+	/* Set up the blob detector before the first frame arrives */
+	if (self->tracker && self->tracker_camera < 0)
+		rift_sensor_add_tracker_camera(self);
+
+	/*
+	 * Queue enough transfers to buffer a complete frame, unless a number
+	 * was chosen via the tracking parameters.
+	 */
+	self->transfer_size = num_packets * packet_size;
+	self->num_transfers = CLAMP((RIFT_SENSOR_FRAME_SIZE + self->transfer_size - 1) /
+				    self->transfer_size + 1, 2,
+				    RIFT_SENSOR_MAX_TRANSFERS);
+	if (self->tracker) {
+		struct tracker_params params;
 
-	self->num_transfers = 7; /* enough for a single frame */
+		ouvrt_tracker_get_params(self->tracker, &params);
+		if (params.num_transfers > 0)
+			self->num_transfers = CLAMP(params.num_transfers, 2,
+						    RIFT_SENSOR_MAX_TRANSFERS);
+	}
 	self->transfer = calloc(self->num_transfers, sizeof(*self->transfer));
-	if (!self->transfer)
-		return -ENOMEM;
+	if (!self->transfer) {
+		ret = -ENOMEM;
+		goto err_remove_camera;
+	}
 
-	for (int i = 0; i < self->num_transfers; i++) {
-		self->transfer[i] = libusb_alloc_transfer(32);
-		if (!self->transfer[i])
-			return -ENOMEM;
+	g_print("%s: Alt setting %d, %d transfers of %d x %d bytes\n",
+		dev->name, alt_setting, self->num_transfers, num_packets,
+		packet_size);
 
-		uint8_t bEndpointAddress = 1 | LIBUSB_ENDPOINT_IN;
+	ret = rift_sensor_alloc_buffers(self, self->num_transfers *
+					self->transfer_size);
+	if (ret < 0)
+		goto err_free;
+	if (!self->dev_mem)
+		g_print("%s: No zero-copy transfer buffers\n", dev->name);
+
+	for (int i = 0; i < self->num_transfers; i++) {
+		self->transfer[i] = libusb_alloc_transfer(num_packets);
+		if (!self->transfer[i]) {
+			ret = -ENOMEM;
+			goto err_free;
+		}
 
-		int transfer_size = num_packets * packet_size;
-		void *buf = malloc(transfer_size);
 		libusb_fill_iso_transfer(self->transfer[i], devh,
-					 bEndpointAddress, buf, transfer_size,
-					 num_packets, iso_transfer_cb, self,
-					 1000);
+					 RIFT_SENSOR_ENDPOINT,
+					 self->buffers + i * self->transfer_size,
+					 self->transfer_size, num_packets,
+					 iso_transfer_cb, self, 1000);
 		libusb_set_iso_packet_lengths(self->transfer[i], packet_size);
+	}
 
+	__atomic_store_n(&self->streaming, true, __ATOMIC_RELEASE);
+	for (int i = 0; i < self->num_transfers; i++) {
+		/* Count the transfer first, it may complete right away */
+		g_mutex_lock(&self->frame_lock);
+		self->active_transfers++;
+		g_mutex_unlock(&self->frame_lock);
 		ret = libusb_submit_transfer(self->transfer[i]);
 		if (ret < 0) {
 			g_print("%s: Failed to submit iso transfer %d\n",
 				dev->name, i);
-			return ret;
+			rift_sensor_transfer_done(self);
+			goto err_free;
 		}
 	}
 
@@ -433,6 +1193,22 @@ static int rift_sensor_start(OuvrtDevice *dev)
 				       RIFT_SENSOR_FRAMERATE);
 
 	return 0;
+
+err_free:
+	rift_sensor_free_transfers(self);
+err_remove_camera:
+	/* The frame buffers and the queue are kept for the next start */
+	if (self->tracker && self->tracker_camera >= 0) {
+		ouvrt_tracker_remove_camera(self->tracker,
+					    self->tracker_camera);
+		self->tracker_camera = -1;
+		g_mutex_lock(&self->frame_lock);
+		self->restore_camera = self->state.has_camera;
+		g_mutex_unlock(&self->frame_lock);
+	}
+err_release:
+	libusb_release_interface(devh, UVC_INTERFACE_DATA);
+	return ret;
 }
 
 /*
@@ -459,6 +1235,10 @@ static void rift_sensor_thread(OuvrtDevice *dev)
 		if (ret < 0)
 			return;
 
+		ret = rift_sensor_reset_exposure(self);
+		if (ret < 0)
+			return;
+
 		self->radio_id = ouvrt_tracker_get_radio_address(self->tracker);
 		if (self->radio_id) {
 			ret = esp770u_setup_radio(self->devh,
@@ -473,7 +1253,26 @@ static void rift_sensor_thread(OuvrtDevice *dev)
 			return;
 	}
 
+	frame_latency_init(&self->latency, dev->name);
+	self->recording_stream = recording_add_stream(dev->name,
+						      RECORDING_INDEX_FRAMES,
+						      -1);
+	if (remote_camera_enabled())
+		self->remote = remote_camera_new(dev->serial, RIFT_SENSOR_WIDTH,
+						 RIFT_SENSOR_HEIGHT);
+	frame_queue_reopen(self->queue);
+	self->frame_thread = g_thread_new(NULL, rift_sensor_frame_thread, self);
+
 	OUVRT_DEVICE_CLASS(ouvrt_rift_sensor_parent_class)->thread(dev);
+
+	frame_queue_close(self->queue);
+	g_thread_join(self->frame_thread);
+	self->frame_thread = NULL;
+	remote_camera_free(self->remote);
+	self->remote = NULL;
+	frame_latency_fini(&self->latency);
+
+	rift_sensor_print_stats(self);
 }
 
 static void rift_sensor_stop(OuvrtDevice *dev)
@@ -482,10 +1281,61 @@ static void rift_sensor_stop(OuvrtDevice *dev)
 
 	g_print("%s: Stop\n", dev->name);
 
+	rift_sensor_free_transfers(self);
+
+	/* Keep the camera state to restore when streaming starts again */
+	if (self->tracker && self->tracker_camera >= 0) {
+		ouvrt_tracker_remove_camera(self->tracker,
+					    self->tracker_camera);
+		self->tracker_camera = -1;
+		g_mutex_lock(&self->frame_lock);
+		self->restore_camera = self->state.has_camera;
+		g_mutex_unlock(&self->frame_lock);
+	}
 	debug_stream_unref(self->debug);
 	libusb_release_interface(self->devh, UVC_INTERFACE_CONTROL);
 }
 
+/*
+ * Saves the clock model and the camera and object poses, so that tracking
+ * resumes quickly after a restart.
+ */
+static gsize rift_sensor_save_state(OuvrtDevice *dev, void *buf, gsize size)
+{
+	OuvrtRiftSensor *self = OUVRT_RIFT_SENSOR(dev);
+	struct rift_sensor_state *state = buf;
+
+	if (size < sizeof(*state))
+		return 0;
+
+	g_mutex_lock(&self->frame_lock);
+	*state = self->state;
+	g_mutex_unlock(&self->frame_lock);
+
+	return state->clock.valid ? sizeof(*state) : 0;
+}
+
+/*
+ * Restores the saved state before the sensor is started. A stale clock
+ * model is discarded by the clock synchronization on the first frames.
+ */
+static void rift_sensor_restore_state(OuvrtDevice *dev, const void *buf,
+				      gsize len)
+{
+	OuvrtRiftSensor *self = OUVRT_RIFT_SENSOR(dev);
+	const struct rift_sensor_state *state = buf;
+
+	if (len != sizeof(*state))
+		return;
+
+	g_mutex_lock(&self->frame_lock);
+	self->state = *state;
+	self->pts_ext = state->pts_ext;
+	self->clock = state->clock;
+	self->restore_camera = state->has_camera;
+	g_mutex_unlock(&self->frame_lock);
+}
+
 /*
  * Frees common fields of the device structure. To be called from the device
  * specific free operation.
@@ -493,7 +1343,19 @@ static void rift_sensor_stop(OuvrtDevice *dev)
 static void ouvrt_rift_sensor_finalize(GObject *object)
 {
 	OuvrtRiftSensor *self = OUVRT_RIFT_SENSOR(object);
+	int i;
 
+	/* Frames still held by the debug stream can not be freed */
+	if (frame_pool_free(self->pool)) {
+		for (i = 0; i < RIFT_SENSOR_NUM_FRAMES; i++)
+			frame_memory_free(self->frames[i].data);
+	}
+	for (i = 0; i < RIFT_SENSOR_NUM_FRAMES; i++)
+		g_free(self->frames[i].blobs);
+	frame_queue_free(self->queue);
+	g_cond_clear(&self->frame_cond);
+	g_mutex_clear(&self->frame_lock);
+	distortion_free_map(&self->distortion);
 	g_object_unref(self->tracker);
 }
 
@@ -505,6 +1367,11 @@ static void ouvrt_rift_sensor_class_init(OuvrtRiftSensorClass *klass)
 	OUVRT_DEVICE_CLASS(klass)->start = rift_sensor_start;
 	OUVRT_DEVICE_CLASS(klass)->thread = rift_sensor_thread;
 	OUVRT_DEVICE_CLASS(klass)->stop = rift_sensor_stop;
+	OUVRT_DEVICE_CLASS(klass)->save_state = rift_sensor_save_state;
+	OUVRT_DEVICE_CLASS(klass)->restore_state = rift_sensor_restore_state;
+	OUVRT_DEVICE_CLASS(klass)->sched_policy = SCHED_RR;
+	OUVRT_DEVICE_CLASS(klass)->sched_priority = 10;
+	OUVRT_DEVICE_CLASS(klass)->lock_memory = TRUE;
 }
 
 static void ouvrt_rift_sensor_init(OuvrtRiftSensor *self)
@@ -512,6 +1379,14 @@ static void ouvrt_rift_sensor_init(OuvrtRiftSensor *self)
 	ouvrt_usb_device_set_vid_pid(OUVRT_USB_DEVICE(self), VID_OCULUSVR,
 				     PID_RIFT_SENSOR);
 	self->sync = false;
+	self->tracker_camera = -1;
+	self->recording_stream = -1;
+	/* assume a 1 MHz presentation time clock, the fit tracks deviations */
+	clock_sync_init(&self->clock, 1e6);
+	g_mutex_init(&self->frame_lock);
+	g_cond_init(&self->frame_cond);
+	self->pool = frame_pool_new(RIFT_SENSOR_NUM_FRAMES,
+				    RIFT_SENSOR_DEBUG_FRAMES);
 }
 
 /*
@@ -530,6 +1405,13 @@ OuvrtDevice *rift_sensor_new(G_GNUC_UNUSED const char *devnode)
 	return OUVRT_DEVICE(camera);
 }
 
+/*
+ * Switches between free-running automatic exposure and exposure triggered by
+ * the HMD radio sync. All synchronised sensors are triggered by the same
+ * radio message at the start of the LED flash, and the AR0134 has no trigger
+ * delay, so exposures of multiple sensors can not be offset against each
+ * other within the LED frame cycle.
+ */
 void ouvrt_rift_sensor_set_sync_exposure(OuvrtRiftSensor *self, gboolean sync)
 {
 	int ret;
@@ -550,6 +1432,10 @@ void ouvrt_rift_sensor_set_sync_exposure(OuvrtRiftSensor *self, gboolean sync)
 		ret = ar0134_set_sync(self->devh, true);
 		if (ret < 0)
 			return;
+
+		ret = rift_sensor_reset_exposure(self);
+		if (ret < 0)
+			return;
 	} else {
 		ret = ar0134_set_sync(self->devh, false);
 		if (ret < 0)
@@ -582,5 +1468,7 @@ void ouvrt_rift_sensor_set_tracker(OuvrtRiftSensor *self, OuvrtTracker *tracker)
 			ouvrt_rift_sensor_set_sync_exposure(self, false);
 		}
 	}
+	if (tracker != self->tracker)
+		self->tracker_camera = -1;
 	g_set_object(&self->tracker, tracker);
 }
@@ -5,7 +5,7 @@
  */
 #include <asm/byteorder.h>
 #include <errno.h>
-#include <poll.h>
+#include <sched.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -16,18 +16,33 @@
 #include "rift.h"
 #include "rift-hid-reports.h"
 #include "rift-radio.h"
+#include "cache.h"
+#include "camera-dk2.h"
+#include "clock-sync.h"
 #include "debug.h"
 #include "device.h"
 #include "hidraw.h"
 #include "imu.h"
+#include "latency-probe.h"
 #include "maths.h"
 #include "leds.h"
+#include "log.h"
+#include "stats.h"
 #include "telemetry.h"
+#include "trace.h"
 #include "tracker.h"
 
 /* 44 LEDs + 1 IMU on CV1 */
 #define MAX_POSITIONS	45
 
+#define RIFT_LEDS_CACHE_MAGIC	0x53444c52	/* "RLDS" */
+
+/* LED on and off times in ns while measuring latency */
+#define RIFT_LATENCY_LEDS_ON_TIME	1900000000ULL
+#define RIFT_LATENCY_LEDS_OFF_TIME	100000000ULL
+/* time in ns the tracker must keep the pose before the LEDs stop blinking */
+#define RIFT_LEDS_STEADY_DELAY		500000000ULL
+
 enum rift_type {
 	RIFT_DK2,
 	RIFT_CV1,
@@ -40,17 +55,55 @@ struct _OuvrtRift {
 	enum rift_type type;
 	struct leds leds;
 	vec3 imu_position;
+	char firmware_version[11];
+	/* checks the cached LEDs against the device after a fast start */
+	GThread *revalidate_thread;
 
 	unsigned char uuid[20];
 	int report_rate;
 	int report_interval;
+	int keepalive_count;
 	gboolean flicker;
+	/* set while the tracking LEDs are enabled */
+	bool leds_enabled;
+	/*
+	 * set while the LEDs are kept steady because the tracker holds the
+	 * pose, and host time in ns since when it does
+	 */
+	bool leds_steady;
+	uint64_t tracking_time;
+	/* DK2 camera frame rate the LED period was last programmed for */
+	int camera_framerate;
+	/* host time in ns the LEDs were last toggled to measure latency */
+	uint64_t leds_toggle_time;
 	uint64_t last_message_time;
+	struct histogram *report_interval_stats;
 	uint64_t last_sample_timestamp;
 	uint32_t last_exposure_timestamp;
 	int32_t last_exposure_count;
 	struct rift_radio radio;
 	struct imu_state imu;
+	struct clock_sync clock;
+};
+
+/*
+ * Cached LED constellation, blinking patterns, and IMU position, stored in
+ * host byte order.
+ */
+struct rift_leds_cache {
+	uint32_t magic;
+	uint32_t num_points;
+	vec3 imu_position;
+	vec3 points[MAX_POSITIONS];
+	vec3 normals[MAX_POSITIONS];
+	uint16_t patterns[MAX_POSITIONS];
+};
+
+/*
+ * Tracking state kept across restarts, in host byte order
+ */
+struct rift_state {
+	struct fusion_snapshot fusion;
 };
 
 G_DEFINE_TYPE(OuvrtRift, ouvrt_rift, OUVRT_TYPE_DEVICE)
@@ -68,6 +121,37 @@ static void unpack_3x21bit(float scale, __be64 *buf, vec3 *v)
 	v->z = scale * ((int64_t)(xyz << 42) >> 43);
 }
 
+/*
+ * Unpacks three big-endian signed 21-bit values packed into 8 bytes
+ * without scaling.
+ */
+static void unpack_3x21bit_raw(__be64 *buf, int32_t v[3])
+{
+	uint64_t xyz = __be64_to_cpup(buf);
+
+	v[0] = (int64_t)xyz >> 43;
+	v[1] = (int64_t)(xyz << 21) >> 43;
+	v[2] = (int64_t)(xyz << 42) >> 43;
+}
+
+/*
+ * Acceleration is reported in units of 10⁻⁴ m/s², angular velocity in units
+ * of 10⁻⁴ rad/s, already in the common coordinate system if onboard
+ * calibration is enabled.
+ */
+static const struct imu_calibration rift_imu_calibration = {
+	.acc_matrix = {
+		{ 1e-4, 0, 0 },
+		{ 0, 1e-4, 0 },
+		{ 0, 0, 1e-4 },
+	},
+	.gyro_matrix = {
+		{ 1e-4, 0, 0 },
+		{ 0, 1e-4, 0 },
+		{ 0, 0, 1e-4 },
+	},
+};
+
 /*
  * Returns the current sensor configuration.
  */
@@ -211,7 +295,8 @@ static int rift_get_ranges(OuvrtRift *rift)
  * left  |/
  *    x--+
  */
-static int rift_get_positions(OuvrtRift *rift)
+static int rift_get_positions(OuvrtRift *rift, struct leds *leds,
+			      vec3 *imu_position)
 {
 	struct rift_position_report report = {
 		.id = RIFT_POSITION_REPORT_ID,
@@ -232,7 +317,7 @@ static int rift_get_positions(OuvrtRift *rift)
 	if (num > MAX_POSITIONS)
 		return -1;
 
-	leds_init(&rift->leds, num - 1);
+	leds_init(leds, num - 1);
 
 	for (i = 0; ; i++) {
 		index = __le16_to_cpu(report.index);
@@ -247,16 +332,16 @@ static int rift_get_positions(OuvrtRift *rift)
 		pos.z = 1e-6f * (int32_t)__le32_to_cpu(report.pos[2]);
 
 		if (type == 0) {
-			rift->leds.model.points[index] = pos;
+			leds->model.points[index] = pos;
 
 			/* Direction, magnitude in unknown units */
 			dir.x = (int16_t)__le16_to_cpu(report.dir[0]);
 			dir.y = (int16_t)__le16_to_cpu(report.dir[1]);
 			dir.z = (int16_t)__le16_to_cpu(report.dir[2]);
 			vec3_normalize(&dir);
-			rift->leds.model.normals[index] = dir;
+			leds->model.normals[index] = dir;
 		} else if (type == 1) {
-			rift->imu_position = pos;
+			*imu_position = pos;
 		}
 
 		/* Break out before reading the first report again */
@@ -274,7 +359,7 @@ static int rift_get_positions(OuvrtRift *rift)
 /*
  * Obtains the blinking patterns of the IR LEDs from the Rift.
  */
-static int rift_get_led_patterns(OuvrtRift *rift)
+static int rift_get_led_patterns(OuvrtRift *rift, struct leds *leds)
 {
 	struct rift_led_pattern_report report = {
 		.id = RIFT_LED_PATTERN_REPORT_ID,
@@ -292,7 +377,7 @@ static int rift_get_led_patterns(OuvrtRift *rift)
 		return ret;
 
 	num = __le16_to_cpu(report.num);
-	if (num > rift->leds.model.num_points)
+	if (num > leds->model.num_points)
 		return -1;
 
 	for (i = 0; ; i++) {
@@ -331,7 +416,7 @@ static int rift_get_led_patterns(OuvrtRift *rift)
 		pattern |= pattern >> 8;
 		pattern = (pattern >> 1) & 0x3ff;
 
-		rift->leds.patterns[index] = pattern;
+		leds->patterns[index] = pattern;
 
 		/* Break out before reading the first report again */
 		if (i + 1 == num)
@@ -380,7 +465,8 @@ static int rift_send_keepalive(OuvrtRift *rift)
 }
 
 /*
- * Sends a tracking report to enable the IR tracking LEDs.
+ * Sends a tracking report to enable the IR tracking LEDs. While the LEDs are
+ * kept steady for tracking, they flash shorter to keep the blobs small.
  */
 static int rift_send_tracking(OuvrtRift *rift, bool blink)
 {
@@ -390,12 +476,22 @@ static int rift_send_tracking(OuvrtRift *rift, bool blink)
 		.duty_cycle = RIFT_TRACKING_DUTY_CYCLE,
 	};
 
-	if (rift->type == RIFT_CV1) {
+	if (rift->leds_steady) {
+		report.exposure_us =
+			__cpu_to_le16(RIFT_TRACKING_EXPOSURE_US_STEADY);
+	} else if (rift->type == RIFT_CV1) {
 		report.exposure_us = __cpu_to_le16(RIFT_TRACKING_EXPOSURE_US_CV1);
-		report.period_us = __cpu_to_le16(RIFT_TRACKING_PERIOD_US_CV1);
 	} else {
 		report.exposure_us = __cpu_to_le16(RIFT_TRACKING_EXPOSURE_US_DK2);
-		report.period_us = __cpu_to_le16(RIFT_TRACKING_PERIOD_US_DK2);
+	}
+
+	if (rift->type == RIFT_CV1) {
+		report.period_us = __cpu_to_le16(RIFT_TRACKING_PERIOD_US_CV1);
+	} else {
+		/* Follow the DK2 camera mode, 60 Hz or 120 Hz binned */
+		rift->camera_framerate = camera_dk2_get_framerate();
+		report.period_us = __cpu_to_le16(RIFT_TRACKING_PERIOD_US_DK2 * 60 /
+						 rift->camera_framerate);
 	}
 
 	if (blink) {
@@ -412,6 +508,103 @@ static int rift_send_tracking(OuvrtRift *rift, bool blink)
 	return hid_send_feature_report(rift->dev.fd, &report, sizeof(report));
 }
 
+/*
+ * Reads back the tracking report and clears the enable flag to turn off the
+ * IR tracking LEDs.
+ */
+static int rift_disable_tracking(OuvrtRift *rift)
+{
+	struct rift_tracking_report report = {
+		.id = RIFT_TRACKING_REPORT_ID,
+	};
+	int ret;
+
+	ret = hid_get_feature_report(rift->dev.fd, &report, sizeof(report));
+	if (ret < 0)
+		return ret;
+
+	report.flags &= ~RIFT_TRACKING_ENABLE;
+
+	return hid_send_feature_report(rift->dev.fd, &report, sizeof(report));
+}
+
+/*
+ * Blinks the LEDs, if enabled, while the tracker needs their patterns to
+ * identify them, and keeps them steady once it holds the pose, identifying
+ * the blobs by reprojection. Switching to steady LEDs waits until the pose
+ * is held for a while, switching back to blinking is immediate.
+ */
+static void rift_update_leds_mode(OuvrtRift *rift)
+{
+	bool steady = false;
+
+	if (rift->flicker && ouvrt_tracker_is_tracking(rift->tracker)) {
+		struct timespec tp;
+		uint64_t now;
+
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		now = tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+		if (!rift->tracking_time)
+			rift->tracking_time = now;
+		steady = now - rift->tracking_time >= RIFT_LEDS_STEADY_DELAY;
+	} else {
+		rift->tracking_time = 0;
+	}
+
+	if (steady == rift->leds_steady)
+		return;
+
+	rift->leds_steady = steady;
+	blobwatch_set_leds_steady(steady);
+	if (rift->leds_enabled)
+		rift_send_tracking(rift, !steady);
+}
+
+/*
+ * Turns the IR tracking LEDs on or off to follow the tracker state, so that
+ * they are dark while no client uses the tracker. While measuring latency,
+ * the LEDs are periodically switched off for a short time.
+ */
+static void rift_update_leds(OuvrtRift *rift)
+{
+	bool active = ouvrt_tracker_is_active(rift->tracker);
+	struct latency_probe *probe;
+
+	rift_update_leds_mode(rift);
+
+	probe = ouvrt_tracker_get_latency_probe(rift->tracker);
+	if (active && probe) {
+		struct timespec tp;
+		uint64_t now;
+
+		clock_gettime(CLOCK_MONOTONIC, &tp);
+		now = tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+		if (now - rift->leds_toggle_time <
+		    (rift->leds_enabled ? RIFT_LATENCY_LEDS_ON_TIME :
+					  RIFT_LATENCY_LEDS_OFF_TIME))
+			return;
+
+		active = !rift->leds_enabled;
+		rift->leds_toggle_time = now;
+		latency_probe_led_toggle(probe, active, now);
+	}
+
+	if (active == rift->leds_enabled) {
+		/* Reprogram the period if the DK2 camera changed its mode */
+		if (active && rift->type == RIFT_DK2 &&
+		    rift->camera_framerate != camera_dk2_get_framerate())
+			rift_send_tracking(rift, rift->flicker &&
+					   !rift->leds_steady);
+		return;
+	}
+
+	if (active)
+		rift_send_tracking(rift, rift->flicker && !rift->leds_steady);
+	else
+		rift_disable_tracking(rift);
+	rift->leds_enabled = active;
+}
+
 /*
  * Sends a display report to set up low persistence and pixel readback
  * for latency measurement.
@@ -507,7 +700,7 @@ static int rift_cv1_power_down(OuvrtRift *rift, uint8_t components)
  */
 static void rift_decode_sensor_message(OuvrtRift *rift,
 				       const unsigned char *buf,
-				       size_t len, struct timespec *ts)
+				       size_t len, uint64_t message_time)
 {
 	struct rift_sensor_message *message = (void *)buf;
 	uint8_t num_samples;
@@ -521,15 +714,19 @@ static void rift_decode_sensor_message(OuvrtRift *rift,
 	uint8_t led_pattern_phase;
 	uint16_t exposure_count;
 	uint32_t exposure_timestamp;
-	uint64_t message_time;
+	struct raw_imu_sample raw[2];
+	struct imu_sample samples[2];
 	struct imu_sample sample;
+	struct latency_probe *probe;
+	struct dpose pose;
 	int32_t dt;
 	int i;
 
 	if (len < sizeof(*message))
 		return;
 
-	message_time = ts->tv_sec * 1000000000 + ts->tv_nsec;
+	OUVRT_TRACE3(rift_decode_sensor_message, rift->dev.id, message_time,
+		     __le32_to_cpu(message->timestamp));
 
 	num_samples = message->num_samples;
 	sample_count = __le16_to_cpu(message->sample_count);
@@ -537,29 +734,38 @@ static void rift_decode_sensor_message(OuvrtRift *rift,
 	temperature = __le16_to_cpu(message->temperature);
 	sample.temperature = 0.01f * temperature;
 
-	sample_timestamp = __le32_to_cpu(message->timestamp);
 	/* µs, wraps every ~72 min */
-	sample.time = 1e-6 * sample_timestamp;
+	sample_timestamp = __le32_to_cpu(message->timestamp);
 
 	dt = sample_timestamp - rift->last_sample_timestamp;
 	/* µs, wraps every ~600k years */
 	rift->last_sample_timestamp += dt;
 
+	clock_sync_add_sample(&rift->clock, rift->last_sample_timestamp,
+			      message_time);
+
+	if (rift->last_message_time) {
+		histogram_add_us(rift->report_interval_stats,
+				 (message_time - rift->last_message_time) /
+				 1000);
+	}
+
 	if ((dt < num_samples * rift->report_interval - 75) ||
 	    (dt > num_samples * rift->report_interval + 75)) {
 		rift->last_message_time = message_time;
 		if (rift->last_sample_timestamp - dt == 0)
 			return;
 		if (dt < 0)
-			g_print("Rift: got %u samples after %d µs\n",
-				num_samples, dt);
+			log_ratelimited("Rift: got %u samples after %d µs\n",
+					num_samples, dt);
 		else if (dt + 1 >= (num_samples + 1) * rift->report_interval)
-			g_print("Rift: got %u samples after %d µs, %u samples lost\n",
-				num_samples, dt,
-				(dt + 1) / rift->report_interval - num_samples);
+			log_ratelimited("Rift: got %u samples after %d µs, %u samples lost\n",
+					num_samples, dt,
+					(dt + 1) / rift->report_interval -
+					num_samples);
 		else
-			g_print("Rift: got %u samples after %d µs, too much jitter\n",
-				num_samples, dt);
+			log_ratelimited("Rift: got %u samples after %d µs, too much jitter\n",
+					num_samples, dt);
 		return;
 	}
 
@@ -579,31 +785,52 @@ static void rift_decode_sensor_message(OuvrtRift *rift,
 
 	num_samples = num_samples > 1 ? 2 : 1;
 	for (i = 0; i < num_samples; i++) {
-		/* 10⁻⁴ m/s² */
-		unpack_3x21bit(1e-4f, &message->sample[i].accel,
-			       &sample.acceleration);
-		/* 10⁻⁴ rad/s */
-		unpack_3x21bit(1e-4f, &message->sample[i].gyro,
-			       &sample.angular_velocity);
+		unpack_3x21bit_raw(&message->sample[i].accel, raw[i].acc);
+		unpack_3x21bit_raw(&message->sample[i].gyro, raw[i].gyro);
+	}
+
+	imu_calibrate_samples(&rift_imu_calibration, raw, samples,
+			      num_samples);
+
+	for (i = 0; i < num_samples; i++) {
+		sample.acceleration = samples[i].acceleration;
+		sample.angular_velocity = samples[i].angular_velocity;
+		/* Samples are spaced by the report interval, newest last */
+		sample.time = 1e-6 * (rift->last_sample_timestamp -
+				      (num_samples - 1 - i) *
+				      rift->report_interval);
 
 		telemetry_send_imu_sample(rift->dev.id, &sample);
 
-		pose_update(1e-6 * dt, &rift->imu.pose, &sample);
+		probe = ouvrt_tracker_get_latency_probe(rift->tracker);
+		if (probe) {
+			latency_probe_imu_sample(probe, &sample,
+				clock_sync_to_host(&rift->clock,
+					rift->last_sample_timestamp -
+					(num_samples - 1 - i) *
+					rift->report_interval));
+		}
+
+		ouvrt_tracker_add_imu_sample(rift->tracker, sample.time,
+					     &sample);
+		ouvrt_tracker_get_imu_state(rift->tracker, -1.0, &rift->imu);
+		ouvrt_tracker_get_predicted_pose(rift->tracker, &pose);
 
-		telemetry_send_pose(rift->dev.id, &rift->imu.pose);
+		telemetry_send_pose(rift->dev.id, &pose);
 
-		debug_imu_fifo_in(&rift->imu, 1);
+		debug_imu_fifo_in(ouvrt_tracker_get_debug_imu_fifo(rift->tracker),
+				  &rift->imu, 1);
 	}
 
 	if (exposure_count != rift->last_exposure_count) {
 		int32_t sample_expo_dt = (int32_t)sample_timestamp -
 					 exposure_timestamp;
-		uint64_t exposure_time = message_time - (message_time -
-					 rift->last_message_time) *
-					 sample_expo_dt / dt;
+		uint64_t exposure_time = clock_sync_to_host(&rift->clock,
+				rift->last_sample_timestamp - sample_expo_dt);
 
 		ouvrt_tracker_add_exposure(rift->tracker, exposure_timestamp,
-					   exposure_time, led_pattern_phase);
+					   exposure_time, led_pattern_phase,
+					   exposure_count);
 
 		rift->last_exposure_timestamp = exposure_timestamp;
 		rift->last_exposure_count = exposure_count;
@@ -675,12 +902,164 @@ static int rift_read_flash(OuvrtRift *rift, uint8_t index, unsigned char *buf)
 	return 0;
 }
 
+/*
+ * Reads the IMU calibration, the LED and IMU positions, and the LED blinking
+ * patterns from the device.
+ */
+static int rift_read_calibration(OuvrtRift *rift, struct leds *leds,
+				 vec3 *imu_position)
+{
+	int ret;
+
+	ret = rift_get_imu_calibration(rift);
+	if (ret < 0)
+		return ret;
+
+	ret = rift_get_positions(rift, leds, imu_position);
+	if (ret < 0) {
+		g_print("Rift: Error reading factory calibrated positions\n");
+		return ret;
+	}
+
+	if (rift->type == RIFT_CV1) {
+		unsigned char index[6] = { 0, 5, 3, 4, 36, 33 };
+		unsigned char buf[64];
+		int i;
+
+		for (i = 0; i < 6; i++) {
+			ret = rift_read_flash(rift, index[i], buf);
+			if (ret < 0)
+				return ret;
+			/* TODO: figure out what to do with these */
+		}
+	}
+
+	ret = rift_get_led_patterns(rift, leds);
+	if (ret < 0) {
+		g_print("Rift: Error reading IR LED blinking patterns\n");
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the LED cache file name, keyed by HMD serial number and firmware
+ * version, or NULL if either is unknown.
+ */
+static char *rift_leds_cache_filename(OuvrtRift *rift)
+{
+	if (!rift->dev.serial ||
+	    (rift->type == RIFT_CV1 && !rift->firmware_version[0]))
+		return NULL;
+
+	return ouvrt_cache_path("%s_%s.rift", rift->dev.serial,
+				rift->type == RIFT_CV1 ?
+				rift->firmware_version : "dk2");
+}
+
+static void rift_leds_cache_fill(struct rift_leds_cache *cache,
+				 struct leds *leds, vec3 *imu_position)
+{
+	int n = leds->model.num_points;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->magic = RIFT_LEDS_CACHE_MAGIC;
+	cache->num_points = n;
+	cache->imu_position = *imu_position;
+	memcpy(cache->points, leds->model.points, n * sizeof(vec3));
+	memcpy(cache->normals, leds->model.normals, n * sizeof(vec3));
+	memcpy(cache->patterns, leds->patterns, n * sizeof(uint16_t));
+}
+
+/*
+ * Initializes the LEDs and IMU position from the cache.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+static int rift_load_leds_cache(OuvrtRift *rift)
+{
+	struct rift_leds_cache *cache;
+	char *filename;
+	size_t length;
+	int n;
+
+	filename = rift_leds_cache_filename(rift);
+	if (!filename)
+		return -ENOENT;
+	if (!ouvrt_cache_load(filename, &cache, &length)) {
+		g_free(filename);
+		return -ENOENT;
+	}
+	g_free(filename);
+
+	if (length != sizeof(*cache) || cache->magic != RIFT_LEDS_CACHE_MAGIC ||
+	    cache->num_points == 0 || cache->num_points >= MAX_POSITIONS) {
+		g_free(cache);
+		return -EINVAL;
+	}
+
+	n = cache->num_points;
+	leds_init(&rift->leds, n);
+	memcpy(rift->leds.model.points, cache->points, n * sizeof(vec3));
+	memcpy(rift->leds.model.normals, cache->normals, n * sizeof(vec3));
+	memcpy(rift->leds.patterns, cache->patterns, n * sizeof(uint16_t));
+	rift->imu_position = cache->imu_position;
+	g_free(cache);
+
+	return 0;
+}
+
+static void rift_store_leds_cache(OuvrtRift *rift,
+				  struct rift_leds_cache *cache)
+{
+	char *filename;
+
+	filename = rift_leds_cache_filename(rift);
+	if (!filename)
+		return;
+
+	if (ouvrt_cache_save(filename, cache, sizeof(*cache)))
+		g_print("Rift: Wrote LED calibration cache\n");
+
+	g_free(filename);
+}
+
+/*
+ * Reads the calibration from the device after a start from the cache, and
+ * updates the cache if it is stale. The tracker keeps its own copy of the
+ * LEDs, so a changed calibration is only used from the next start on.
+ */
+static gpointer rift_revalidate_thread(gpointer data)
+{
+	OuvrtRift *rift = data;
+	struct rift_leds_cache cached, current;
+	struct leds leds = { 0 };
+	vec3 imu_position;
+
+	if (rift_read_calibration(rift, &leds, &imu_position) == 0) {
+		rift_leds_cache_fill(&cached, &rift->leds, &rift->imu_position);
+		rift_leds_cache_fill(&current, &leds, &imu_position);
+		if (memcmp(&cached, &current, sizeof(cached)) != 0) {
+			g_print("Rift: LED calibration changed since caching\n");
+			rift_store_leds_cache(rift, &current);
+		}
+	}
+
+	leds_fini(&leds);
+
+	return NULL;
+}
+
 /*
  * Enables the IR tracking LEDs and registers them with the tracker.
  */
 static int rift_start(OuvrtDevice *dev)
 {
 	OuvrtRift *rift = OUVRT_RIFT(dev);
+	struct rift_leds_cache cache;
+	bool cached = false;
+	char *name;
 	int ret;
 
 	if (rift->type == RIFT_CV1) {
@@ -695,6 +1074,7 @@ static int rift_start(OuvrtDevice *dev)
 
 		ouvrt_tracker_set_radio_address(rift->tracker,
 						rift->radio.address);
+		rift_radio_load_cache(&rift->radio);
 	}
 
 	ret = rift_get_uuid(rift);
@@ -705,41 +1085,27 @@ static int rift_start(OuvrtDevice *dev)
 
 	if (rift->type == RIFT_CV1) {
 		ret = rift_get_boot_mode(rift);
+		rift->firmware_version[0] = '\0';
 		if (ret == RIFT_BOOT_NORMAL)
-			rift_get_firmware_version(dev->fds[0]);
+			rift_get_firmware_version(dev->fds[0],
+						  rift->firmware_version);
 	}
 
 	ret = rift_get_ranges(rift);
 	if (ret < 0)
 		return ret;
 
-	ret = rift_get_imu_calibration(rift);
-	if (ret < 0)
-		return ret;
-
-	ret = rift_get_positions(rift);
-	if (ret < 0) {
-		g_print("Rift: Error reading factory calibrated positions\n");
-		return ret;
-	}
-
-	if (rift->type == RIFT_CV1) {
-		unsigned char index[6] = { 0, 5, 3, 4, 36, 33 };
-		unsigned char buf[64];
-		int i;
-
-		for (i = 0; i < 6; i++) {
-			ret = rift_read_flash(rift, index[i], buf);
-			if (ret < 0)
-				return ret;
-			/* TODO: figure out what to do with these */
-		}
-	}
+	if (rift_load_leds_cache(rift) == 0) {
+		g_print("Rift: Read cached LED calibration\n");
+		cached = true;
+	} else {
+		ret = rift_read_calibration(rift, &rift->leds,
+					    &rift->imu_position);
+		if (ret < 0)
+			return ret;
 
-	ret = rift_get_led_patterns(rift);
-	if (ret < 0) {
-		g_print("Rift: Error reading IR LED blinking patterns\n");
-		return ret;
+		rift_leds_cache_fill(&cache, &rift->leds, &rift->imu_position);
+		rift_store_leds_cache(rift, &cache);
 	}
 	if ((rift->type == RIFT_DK2 && rift->leds.model.num_points != 40) ||
 	    (rift->type == RIFT_CV1 && rift->leds.model.num_points != 44)) {
@@ -755,9 +1121,17 @@ static int rift_start(OuvrtDevice *dev)
 	if (ret < 0)
 		return ret;
 
+	name = g_strdup_printf("%s IMU report interval", dev->name);
+	rift->report_interval_stats = histogram_new(name);
+	g_free(name);
+
 	ret = rift_send_tracking(rift, TRUE);
 	if (ret < 0)
 		return ret;
+	rift->leds_enabled = true;
+
+	if (latency_probe_enabled())
+		ouvrt_tracker_enable_latency_probe(rift->tracker, dev->name);
 
 	ret = rift_send_display(rift, TRUE, TRUE);
 	if (ret < 0)
@@ -773,98 +1147,133 @@ static int rift_start(OuvrtDevice *dev)
 
 	ouvrt_tracker_register_leds(rift->tracker, &rift->leds);
 
+	g_print("Rift: Sending keepalive\n");
+	rift_send_keepalive(rift);
+	rift->keepalive_count = 0;
+
+	if (cached) {
+		rift->revalidate_thread = g_thread_new("rift-revalidate",
+						       rift_revalidate_thread,
+						       rift);
+	}
+
 	return 0;
 }
 
 /*
- * Keeps the Rift active.
+ * Registers the LEDs of a Touch controller with the tracker, so that it is
+ * tracked in the same sensor frames as the headset.
  */
-static void rift_thread(OuvrtDevice *dev)
+static void rift_register_touch(OuvrtRift *rift,
+				struct rift_touch_controller *touch)
 {
-	OuvrtRift *rift = OUVRT_RIFT(dev);
-	unsigned char buf[64];
-	struct pollfd fds[2];
-	struct timespec ts;
-	int count;
+	struct leds leds = { 0 };
 	int ret;
 
-	g_print("Rift: Sending keepalive\n");
-	rift_send_keepalive(rift);
-	count = 0;
-
-	while (dev->active) {
-		fds[0].fd = dev->fds[0];
-		fds[0].events = POLLIN;
-		fds[0].revents = 0;
-		fds[1].fd = dev->fds[1];
-		fds[1].events = POLLIN;
-		fds[1].revents = 0;
-
-		ret = poll(fds, 2, 1000);
-		clock_gettime(CLOCK_MONOTONIC, &ts);
-		if (ret == -1 || ret == 0 ||
-		    count > 9 * rift->report_rate) {
-			if (ret == -1 || ret == 0)
-				g_print("Rift: Resending keepalive\n");
-			rift_send_keepalive(rift);
-			count = 0;
-			continue;
-		}
+	if (!touch->model.num_points)
+		return;
 
-		if ((fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) ||
-		    (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)))
-			break;
+	/* The blinking patterns of the Touch LEDs are not known yet */
+	tracking_model_copy(&leds.model, &touch->model);
+	ret = ouvrt_tracker_register_object(rift->tracker, &leds);
+	leds_fini(&leds);
+	if (ret < 0) {
+		g_print("Rift: %s: Failed to register LEDs: %d\n",
+			touch->base.name, ret);
+	}
+}
 
-		if (fds[0].revents & POLLIN) {
-			ret = read(dev->fds[0], buf, sizeof(buf));
-			if (ret == -1) {
-				g_print("%s: Read error: %d\n", dev->name,
-					errno);
-				continue;
-			}
-			if (ret < 64) {
+/*
+ * Handles all pending reports from the Rift HID device or the radio, and
+ * keeps the Rift active.
+ */
+static void rift_dispatch(OuvrtDevice *dev, int index,
+			  const struct timespec *ts)
+{
+	OuvrtRift *rift = OUVRT_RIFT(dev);
+	struct rift_wireless_device *c;
+	struct hid_report_batch batch;
+	int ret, i;
+
+	ret = hid_read_batch(dev->fds[index], &batch);
+	if (ret < 0) {
+		g_print("%s: Read error: %d\n", dev->name, ret);
+		return;
+	}
+
+	if (index == 0) {
+		/* ns, used to timestamp reports queued behind the last one */
+		uint64_t interval = rift->report_interval * 1000ULL;
+
+		rift_update_leds(rift);
+
+		for (i = 0; i < batch.num; i++) {
+			if (batch.len[i] < 64) {
 				g_print("%s: Error, invalid %d-byte report 0x%02x\n",
-					dev->name, ret, buf[0]);
+					dev->name, batch.len[i],
+					batch.buf[i][0]);
 				continue;
 			}
 
-			rift_decode_sensor_message(rift, buf, sizeof(buf), &ts);
-			count++;
+			rift_decode_sensor_message(rift, batch.buf[i], 64,
+					hid_batch_report_time(&batch, i, ts,
+							      interval));
 		}
-		if (fds[1].revents & POLLIN) {
-			ret = read(dev->fds[1], buf, sizeof(buf));
-			if (ret == -1) {
-				g_print("%s: Read error: %d\n", dev->name,
-					errno);
-				continue;
-			}
 
-			if (ret != 64 ||
-			    (buf[0] != RIFT_RADIO_REPORT_ID &&
-			     buf[0] != RIFT_RADIO_UNKNOWN_MESSAGE_ID)) {
-				g_print("%s: Error, invalid %d-byte report 0x%02x\n",
-						dev->name, ret, buf[0]);
-				continue;
-			}
+		rift->keepalive_count += batch.num;
+		if (rift->keepalive_count > 9 * rift->report_rate) {
+			rift_send_keepalive(rift);
+			rift->keepalive_count = 0;
+		}
 
-			rift_decode_radio_report(&rift->radio, dev->fds[1],
-						 buf, sizeof(buf));
+		/* Interleave radio commands with IMU report processing */
+		rift_radio_process_queue(&rift->radio, dev->fds[1]);
+		return;
+	}
 
-			struct rift_wireless_device *c;
+	for (i = 0; i < batch.num; i++) {
+		unsigned char *buf = batch.buf[i];
 
-			c = &rift->radio.remote.base;
-			if (c->active && !c->dev_id)
-				c->dev_id = ouvrt_device_claim_id(dev, c->serial);
-			c = &rift->radio.touch[0].base;
-			if (c->active && !c->dev_id)
-				c->dev_id = ouvrt_device_claim_id(dev, c->serial);
-			c = &rift->radio.touch[1].base;
-			if (c->active && !c->dev_id)
-				c->dev_id = ouvrt_device_claim_id(dev, c->serial);
+		if (batch.len[i] != 64 ||
+		    (buf[0] != RIFT_RADIO_REPORT_ID &&
+		     buf[0] != RIFT_RADIO_UNKNOWN_MESSAGE_ID)) {
+			g_print("%s: Error, invalid %d-byte report 0x%02x\n",
+				dev->name, batch.len[i], buf[0]);
+			continue;
 		}
+
+		rift_decode_radio_report(&rift->radio, buf, 64);
+	}
+
+	rift_radio_process_queue(&rift->radio, dev->fds[1]);
+
+	c = &rift->radio.remote.base;
+	if (c->active && !c->dev_id)
+		c->dev_id = ouvrt_device_claim_id(dev, c->serial);
+	c = &rift->radio.touch[0].base;
+	if (c->active && !c->dev_id) {
+		c->dev_id = ouvrt_device_claim_id(dev, c->serial);
+		rift_register_touch(rift, &rift->radio.touch[0]);
+	}
+	c = &rift->radio.touch[1].base;
+	if (c->active && !c->dev_id) {
+		c->dev_id = ouvrt_device_claim_id(dev, c->serial);
+		rift_register_touch(rift, &rift->radio.touch[1]);
 	}
 }
 
+/*
+ * Resends the keepalive if the Rift stopped sending reports.
+ */
+static void rift_timeout(OuvrtDevice *dev)
+{
+	OuvrtRift *rift = OUVRT_RIFT(dev);
+
+	g_print("Rift: Resending keepalive\n");
+	rift_send_keepalive(rift);
+	rift->keepalive_count = 0;
+}
+
 /*
  * Disables the IR tracking LEDs and unregisters model from the
  * tracker.
@@ -872,13 +1281,16 @@ static void rift_thread(OuvrtDevice *dev)
 static void rift_stop(OuvrtDevice *dev)
 {
 	OuvrtRift *rift = OUVRT_RIFT(dev);
-	struct rift_tracking_report report = {
-		.id = RIFT_TRACKING_REPORT_ID,
-	};
-	int fd = rift->dev.fd;
+
+	if (rift->revalidate_thread) {
+		g_thread_join(rift->revalidate_thread);
+		rift->revalidate_thread = NULL;
+	}
 
 	ouvrt_tracker_unregister_leds(rift->tracker, &rift->leds);
 	g_clear_object(&rift->tracker);
+	histogram_free(rift->report_interval_stats);
+	rift->report_interval_stats = NULL;
 
 	if (rift->type == RIFT_CV1) {
 		rift_cv1_power_down(rift, RIFT_CV1_POWER_DISPLAY |
@@ -886,13 +1298,39 @@ static void rift_stop(OuvrtDevice *dev)
 					  RIFT_CV1_POWER_LEDS);
 	}
 
-	hid_get_feature_report(fd, &report, sizeof(report));
-	report.flags &= ~RIFT_TRACKING_ENABLE;
-	hid_send_feature_report(fd, &report, sizeof(report));
+	rift_disable_tracking(rift);
+	rift->leds_enabled = false;
 
 	rift_set_report_rate(rift, 50);
 }
 
+/*
+ * Saves the IMU biases and last fused pose, so that tracking does not start
+ * from scratch after a restart.
+ */
+static gsize rift_save_state(OuvrtDevice *dev, void *buf, gsize size)
+{
+	OuvrtRift *rift = OUVRT_RIFT(dev);
+	struct rift_state *state = buf;
+
+	if (size < sizeof(*state) || !rift->tracker ||
+	    !ouvrt_tracker_get_snapshot(rift->tracker, &state->fusion))
+		return 0;
+
+	return sizeof(*state);
+}
+
+static void rift_restore_state(OuvrtDevice *dev, const void *buf, gsize len)
+{
+	OuvrtRift *rift = OUVRT_RIFT(dev);
+	const struct rift_state *state = buf;
+
+	if (len != sizeof(*state) || !rift->tracker)
+		return;
+
+	ouvrt_tracker_restore_snapshot(rift->tracker, &state->fusion);
+}
+
 /*
  * Frees the device structure and its contents.
  */
@@ -901,6 +1339,7 @@ static void ouvrt_rift_finalize(GObject *object)
 	OuvrtRift *rift = OUVRT_RIFT(object);
 
 	g_clear_object(&rift->tracker);
+	rift_radio_fini(&rift->radio);
 	G_OBJECT_CLASS(ouvrt_rift_parent_class)->finalize(object);
 }
 
@@ -908,8 +1347,13 @@ static void ouvrt_rift_class_init(OuvrtRiftClass *klass)
 {
 	G_OBJECT_CLASS(klass)->finalize = ouvrt_rift_finalize;
 	OUVRT_DEVICE_CLASS(klass)->start = rift_start;
-	OUVRT_DEVICE_CLASS(klass)->thread = rift_thread;
+	OUVRT_DEVICE_CLASS(klass)->dispatch = rift_dispatch;
+	OUVRT_DEVICE_CLASS(klass)->timeout = rift_timeout;
 	OUVRT_DEVICE_CLASS(klass)->stop = rift_stop;
+	OUVRT_DEVICE_CLASS(klass)->save_state = rift_save_state;
+	OUVRT_DEVICE_CLASS(klass)->restore_state = rift_restore_state;
+	OUVRT_DEVICE_CLASS(klass)->sched_policy = SCHED_FIFO;
+	OUVRT_DEVICE_CLASS(klass)->sched_priority = 20;
 }
 
 static void ouvrt_rift_init(OuvrtRift *self)
@@ -919,6 +1363,7 @@ static void ouvrt_rift_init(OuvrtRift *self)
 	self->last_sample_timestamp = 0;
 	rift_radio_init(&self->radio);
 	self->imu.pose.rotation.w = 1.0;
+	clock_sync_init(&self->clock, 1e6);
 }
 
 /*
@@ -958,8 +1403,11 @@ void ouvrt_rift_set_flicker(OuvrtRift *rift, gboolean flicker)
 
 	rift->flicker = flicker;
 	blobwatch_set_flicker(flicker);
+	blobwatch_set_leds_steady(false);
+	rift->leds_steady = false;
+	rift->tracking_time = 0;
 
-	if (rift->dev.active)
+	if (rift->dev.active && rift->leds_enabled)
 		rift_send_tracking(rift, flicker);
 }
 
@@ -967,3 +1415,18 @@ OuvrtTracker *ouvrt_rift_get_tracker(OuvrtRift *rift)
 {
 	return rift->tracker;
 }
+
+/*
+ * Returns a file descriptor for the shared memory pose output of the HMD
+ * for index 0, or of the left and right Touch controllers for index 1 and
+ * 2, or a negative error code.
+ */
+int ouvrt_rift_get_pose_fd(OuvrtRift *rift, unsigned int index)
+{
+	if (index == 0)
+		return ouvrt_tracker_get_pose_fd(rift->tracker);
+	if (index > G_N_ELEMENTS(rift->radio.touch))
+		return -EINVAL;
+
+	return rift_touch_get_pose_fd(&rift->radio.touch[index - 1]);
+}
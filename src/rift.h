@@ -22,5 +22,6 @@ OuvrtDevice *rift_cv1_new(const char *devnode);
 
 void ouvrt_rift_set_flicker(OuvrtRift *camera, gboolean flicker);
 OuvrtTracker *ouvrt_rift_get_tracker(OuvrtRift *rift);
+int ouvrt_rift_get_pose_fd(OuvrtRift *rift, unsigned int index);
 
 #endif /* __RIFT_H__ */
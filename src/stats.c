@@ -0,0 +1,198 @@
+/*
+ * Lock-free latency histograms
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Histograms with fixed logarithmic buckets that can be updated from device
+ * threads with a few relaxed atomic increments. All histograms are kept in
+ * a registry, so that they can be dumped or exported via D-Bus.
+ */
+#include <glib.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+struct histogram {
+	char *name;
+	uint64_t count;
+	uint64_t sum_us;
+	uint32_t max_us;
+	uint32_t buckets[HISTOGRAM_NUM_BUCKETS];
+};
+
+/* protects the registry, not the histogram contents */
+static GMutex stats_lock;
+static GList *histograms;
+
+static const char *frame_latency_names[FRAME_LATENCY_STAGES] = {
+	"receive",
+	"blobs",
+	"pose",
+};
+
+/*
+ * Creates a new, registered histogram.
+ *
+ * Returns the histogram, or NULL on failure.
+ */
+struct histogram *histogram_new(const char *name)
+{
+	struct histogram *h;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+
+	h->name = strdup(name);
+
+	g_mutex_lock(&stats_lock);
+	histograms = g_list_append(histograms, h);
+	g_mutex_unlock(&stats_lock);
+
+	return h;
+}
+
+void histogram_free(struct histogram *h)
+{
+	if (!h)
+		return;
+
+	g_mutex_lock(&stats_lock);
+	histograms = g_list_remove(histograms, h);
+	g_mutex_unlock(&stats_lock);
+
+	free(h->name);
+	free(h);
+}
+
+/*
+ * Adds a value in µs. Safe to call concurrently from multiple threads, but
+ * usually each histogram is only updated from a single device thread.
+ */
+void histogram_add_us(struct histogram *h, uint64_t us)
+{
+	uint32_t max;
+	int bucket;
+
+	if (!h)
+		return;
+
+	bucket = us ? 64 - __builtin_clzll(us) : 0;
+	if (bucket >= HISTOGRAM_NUM_BUCKETS)
+		bucket = HISTOGRAM_NUM_BUCKETS - 1;
+	if (us > UINT32_MAX)
+		us = UINT32_MAX;
+
+	__atomic_add_fetch(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->sum_us, us, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+	while (us > max &&
+	       !__atomic_compare_exchange_n(&h->max_us, &max, us, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * Creates one histogram for each stage of frame processing, named after
+ * the device.
+ */
+void frame_latency_init(struct frame_latency *fl, const char *name)
+{
+	char *stage_name;
+	int i;
+
+	for (i = 0; i < FRAME_LATENCY_STAGES; i++) {
+		stage_name = g_strdup_printf("%s %s", name,
+					     frame_latency_names[i]);
+		fl->stage[i] = histogram_new(stage_name);
+		g_free(stage_name);
+	}
+}
+
+void frame_latency_fini(struct frame_latency *fl)
+{
+	int i;
+
+	for (i = 0; i < FRAME_LATENCY_STAGES; i++) {
+		histogram_free(fl->stage[i]);
+		fl->stage[i] = NULL;
+	}
+}
+
+/*
+ * Adds the latencies between the capture, receive, blob detection, and pose
+ * estimation timestamps of a frame, in seconds. Stages starting at a zero
+ * timestamp are skipped.
+ */
+void frame_latency_add(struct frame_latency *fl, const double timestamps[4])
+{
+	double dt;
+	int i;
+
+	for (i = 0; i < FRAME_LATENCY_STAGES; i++) {
+		if (timestamps[i] == 0.0)
+			continue;
+		dt = timestamps[i + 1] - timestamps[i];
+		histogram_add_us(fl->stage[i], dt > 0.0 ? dt * 1e6 : 0);
+	}
+}
+
+/*
+ * Calls func with a snapshot of each registered histogram. The histograms
+ * may be updated concurrently, so the sums may be slightly inconsistent.
+ */
+void stats_foreach(stats_func func, void *data)
+{
+	struct histogram_stats stats;
+	struct histogram *h;
+	GList *l;
+	int i;
+
+	g_mutex_lock(&stats_lock);
+	for (l = histograms; l; l = l->next) {
+		h = l->data;
+		stats.name = h->name;
+		stats.count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+		stats.sum_us = __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED);
+		stats.max_us = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+		for (i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+			stats.buckets[i] = __atomic_load_n(&h->buckets[i],
+							   __ATOMIC_RELAXED);
+		}
+		func(&stats, data);
+	}
+	g_mutex_unlock(&stats_lock);
+}
+
+static void stats_print(const struct histogram_stats *stats,
+			G_GNUC_UNUSED void *data)
+{
+	int i, last = 0;
+
+	for (i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+		if (stats->buckets[i])
+			last = i;
+
+	g_print("%s: %" G_GUINT64_FORMAT " samples, mean %" G_GUINT64_FORMAT
+		" µs, max %u µs\n", stats->name, stats->count,
+		stats->count ? stats->sum_us / stats->count : 0,
+		stats->max_us);
+	for (i = 0; i <= last && stats->count; i++) {
+		if (i == 0)
+			g_print("  < 1 µs: %u\n", stats->buckets[i]);
+		else
+			g_print("  < %u µs: %u\n", 1u << i, stats->buckets[i]);
+	}
+}
+
+/*
+ * Prints all registered histograms.
+ */
+void stats_dump(void)
+{
+	stats_foreach(stats_print, NULL);
+}
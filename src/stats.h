@@ -0,0 +1,53 @@
+/*
+ * Lock-free latency histograms
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+
+/*
+ * Bucket 0 counts values below 1 µs, bucket n values in [2ⁿ⁻¹, 2ⁿ) µs. The
+ * last bucket also counts all larger values.
+ */
+#define HISTOGRAM_NUM_BUCKETS	24
+
+struct histogram;
+
+/* stages between the timestamps[0..3] of a processed camera frame */
+#define FRAME_LATENCY_RECEIVE	0
+#define FRAME_LATENCY_BLOBS	1
+#define FRAME_LATENCY_POSE	2
+#define FRAME_LATENCY_STAGES	3
+
+struct frame_latency {
+	struct histogram *stage[FRAME_LATENCY_STAGES];
+};
+
+/*
+ * Snapshot of a histogram, passed to stats_foreach callbacks.
+ */
+struct histogram_stats {
+	const char *name;
+	uint64_t count;
+	uint64_t sum_us;
+	uint32_t max_us;
+	uint32_t buckets[HISTOGRAM_NUM_BUCKETS];
+};
+
+typedef void (*stats_func)(const struct histogram_stats *stats, void *data);
+
+struct histogram *histogram_new(const char *name);
+void histogram_free(struct histogram *h);
+void histogram_add_us(struct histogram *h, uint64_t us);
+
+void frame_latency_init(struct frame_latency *fl, const char *name);
+void frame_latency_fini(struct frame_latency *fl);
+void frame_latency_add(struct frame_latency *fl, const double timestamps[4]);
+
+void stats_foreach(stats_func func, void *data);
+void stats_dump(void);
+
+#endif /* __STATS_H__ */
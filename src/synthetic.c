@@ -0,0 +1,166 @@
+/*
+ * Synthetic LED constellation frames
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Renders the LEDs of tracked objects as they would appear in a greyscale
+ * tracking camera frame: projected through the camera matrix and radial and
+ * tangential distortion, culled if facing away from the camera, and lit
+ * according to their blinking pattern in the current LED pattern phase.
+ * This allows to load blob detection and pose estimation with many more
+ * blobs, objects, and pixels than the supported hardware produces.
+ */
+#include <string.h>
+
+#include "leds.h"
+#include "synthetic.h"
+
+/* brightness of the dim LED state relative to the bright state */
+#define SYNTHETIC_DIM_SCALE	0.6
+/* offset of reflections below their LED, in normalized image coordinates */
+#define SYNTHETIC_REFLECTION_DROP	0.15
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+/*
+ * Projects a single LED of an object into the frame.
+ *
+ * Returns false if the LED is behind the camera or facing away from it.
+ */
+bool synthetic_project(const struct synthetic_camera *camera,
+		       const struct synthetic_object *object, int led,
+		       double *u, double *v, double *z)
+{
+	const vec3 *point = &object->leds->model.points[led];
+	const vec3 *normal = &object->leds->model.normals[led];
+	dvec3 p = { point->x, point->y, point->z };
+	dvec3 n = { normal->x, normal->y, normal->z };
+	double xd, yd;
+
+	dquat_rotate(&p, &object->rotation, &p);
+	p.x += object->translation.x;
+	p.y += object->translation.y;
+	p.z += object->translation.z;
+	if (p.z <= 0.0)
+		return false;
+
+	/* The camera looks along +z, so visible LEDs face towards -p */
+	dquat_rotate(&n, &object->rotation, &n);
+	if (dvec3_dot(&n, &p) >= 0.0)
+		return false;
+
+	distortion_distort(&camera->distortion, p.x / p.z, p.y / p.z, &xd,
+			   &yd);
+	*u = camera->camera_matrix.m[0] * xd + camera->camera_matrix.m[2];
+	*v = camera->camera_matrix.m[4] * yd + camera->camera_matrix.m[5];
+	*z = p.z;
+
+	return true;
+}
+
+/*
+ * Adds a round blob with a soft edge, saturating at 255.
+ */
+static void draw_blob(const struct synthetic_camera *camera, uint8_t *frame,
+		      double u, double v, double radius, double brightness)
+{
+	int x0 = (int)(u - radius - 1), x1 = (int)(u + radius + 1);
+	int y0 = (int)(v - radius - 1), y1 = (int)(v + radius + 1);
+	int x, y;
+
+	if (x1 < 0 || y1 < 0 || x0 >= camera->width || y0 >= camera->height)
+		return;
+	if (x0 < 0)
+		x0 = 0;
+	if (y0 < 0)
+		y0 = 0;
+	if (x1 >= camera->width)
+		x1 = camera->width - 1;
+	if (y1 >= camera->height)
+		y1 = camera->height - 1;
+
+	for (y = y0; y <= y1; y++) {
+		uint8_t *line = frame + y * camera->width;
+
+		for (x = x0; x <= x1; x++) {
+			double dx = x - u, dy = y - v;
+			double d = sqrt(dx * dx + dy * dy);
+			double falloff = radius + 0.5 - d;
+			int value;
+
+			if (falloff <= 0.0)
+				continue;
+			if (falloff > 1.0)
+				falloff = 1.0;
+
+			value = line[x] + (int)(255.0 * brightness * falloff);
+			line[x] = value > 255 ? 255 : value;
+		}
+	}
+}
+
+/*
+ * Renders all objects into a greyscale frame of camera->width *
+ * camera->height bytes. LEDs are bright in the pattern phases in which their
+ * blinking pattern bit is set, and dim otherwise, so that flicker detection
+ * recovers leds->patterns.
+ *
+ * Returns the number of visible LEDs.
+ */
+int synthetic_render(struct synthetic_camera *camera,
+		     const struct synthetic_object *objects, int num_objects,
+		     uint8_t led_pattern_phase, uint8_t *frame)
+{
+	const double focal_length = 0.5 * (camera->camera_matrix.m[0] +
+					   camera->camera_matrix.m[4]);
+	int num_visible = 0;
+	int i, j;
+
+	if (camera->noise > 0) {
+		int size = camera->width * camera->height;
+
+		for (i = 0; i < size; i++)
+			frame[i] = xorshift32(&camera->seed) %
+				   (camera->noise + 1);
+	} else {
+		memset(frame, 0, camera->width * camera->height);
+	}
+
+	for (i = 0; i < num_objects; i++) {
+		const struct synthetic_object *object = &objects[i];
+		const struct leds *leds = object->leds;
+
+		for (j = 0; j < (int)leds->model.num_points; j++) {
+			double u, v, z, radius, scale = 1.0;
+
+			if (!synthetic_project(camera, object, j, &u, &v, &z))
+				continue;
+
+			if (leds->patterns &&
+			    !((leds->patterns[j] >> led_pattern_phase) & 1))
+				scale = SYNTHETIC_DIM_SCALE;
+
+			radius = 0.5 * camera->led_size * focal_length / z;
+			draw_blob(camera, frame, u, v, radius * scale, 1.0);
+			num_visible++;
+
+			if (camera->reflection > 0.0) {
+				draw_blob(camera, frame, u, v +
+					  SYNTHETIC_REFLECTION_DROP *
+					  focal_length, 1.5 * radius * scale,
+					  camera->reflection);
+			}
+		}
+	}
+
+	return num_visible;
+}
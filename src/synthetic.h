@@ -0,0 +1,51 @@
+/*
+ * Synthetic LED constellation frames
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __SYNTHETIC_H__
+#define __SYNTHETIC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "distortion.h"
+#include "maths.h"
+
+struct leds;
+
+/*
+ * A tracked object to be rendered at the given pose in camera space.
+ */
+struct synthetic_object {
+	struct leds *leds;
+	dquat rotation;
+	dvec3 translation;
+};
+
+/*
+ * Camera model and image degradations applied to synthetic frames. The LED
+ * size is the diameter of the LED in meters, noise is the maximum amplitude
+ * of the uniform per-pixel noise, and reflection is the relative brightness
+ * of the mirror image that each LED casts onto a surface below it, or 0.
+ * The noise generator state is advanced with every rendered frame.
+ */
+struct synthetic_camera {
+	int width;
+	int height;
+	dmat3 camera_matrix;
+	struct distortion distortion;
+	double led_size;
+	int noise;
+	double reflection;
+	uint32_t seed;
+};
+
+bool synthetic_project(const struct synthetic_camera *camera,
+		       const struct synthetic_object *object, int led,
+		       double *u, double *v, double *z);
+int synthetic_render(struct synthetic_camera *camera,
+		     const struct synthetic_object *objects, int num_objects,
+		     uint8_t led_pattern_phase, uint8_t *frame);
+
+#endif /* __SYNTHETIC_H__ */
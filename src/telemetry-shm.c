@@ -0,0 +1,174 @@
+/*
+ * Shared memory telemetry ring
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * Alternative telemetry backend for local consumers. Records are written
+ * into a memfd backed ring buffer that any number of readers can map and
+ * follow without syscalls. Multiple writer threads reserve space with a
+ * compare-and-swap on the ring head, so writing a record costs a memcpy.
+ * Readers that fall behind lose records instead of blocking the writers.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "telemetry-shm.h"
+
+#define TELEMETRY_RING_ALIGN(x)	(((x) + 7) & ~(size_t)7)
+
+static struct telemetry_ring *ring;
+static uint8_t *ring_data;
+static size_t ring_map_size;
+static int ring_fd = -1;
+
+/*
+ * Creates the ring with a data area of the given size, rounded up to a power
+ * of two.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int telemetry_shm_init(size_t size)
+{
+	size_t page_size = getpagesize();
+	size_t n = page_size;
+	void *map;
+	int fd;
+
+	if (ring)
+		return -EBUSY;
+
+	while (n < size)
+		n <<= 1;
+
+	fd = memfd_create("ouvrt-telemetry", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -errno;
+
+	ring_map_size = page_size + n;
+	if (ftruncate(fd, ring_map_size) < 0 ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+		close(fd);
+		return -errno;
+	}
+
+	map = mmap(NULL, ring_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		   0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return -errno;
+	}
+
+	ring = map;
+	ring->magic = TELEMETRY_RING_MAGIC;
+	ring->version = TELEMETRY_RING_VERSION;
+	ring->size = n;
+	ring->offset = page_size;
+	__atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+	ring_data = (uint8_t *)map + page_size;
+	ring_fd = fd;
+
+	return 0;
+}
+
+void telemetry_shm_deinit(void)
+{
+	if (!ring)
+		return;
+
+	munmap(ring, ring_map_size);
+	close(ring_fd);
+	ring = NULL;
+	ring_data = NULL;
+	ring_fd = -1;
+}
+
+/*
+ * Returns a new read-only file descriptor for the ring, to be passed to a
+ * reader, or a negative error code if the ring is not enabled.
+ */
+int telemetry_shm_get_fd(void)
+{
+	char path[32];
+	int fd;
+
+	if (ring_fd < 0)
+		return -ENODEV;
+
+	/* Reopen the memfd, so that readers can not write into the ring */
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", ring_fd);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	return fd < 0 ? -errno : fd;
+}
+
+/*
+ * Returns the size of the mapping readers need, 0 if the ring is disabled.
+ */
+size_t telemetry_shm_get_size(void)
+{
+	return ring ? ring_map_size : 0;
+}
+
+static void telemetry_shm_commit(struct telemetry_ring_record *record,
+				 uint64_t pos)
+{
+	__atomic_store_n(&record->seq, (uint32_t)(pos / 8 + 1),
+			 __ATOMIC_RELEASE);
+}
+
+/*
+ * Writes a record into the ring. Can be called from any thread.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int telemetry_shm_write(uint8_t type, uint8_t dev_id, const void *header,
+			size_t header_len, const void *payload, size_t len)
+{
+	size_t record_len = sizeof(struct telemetry_ring_record) +
+			    header_len + len;
+	size_t need = TELEMETRY_RING_ALIGN(record_len);
+	struct telemetry_ring_record *record;
+	uint64_t pos, next;
+	size_t offset, pad;
+
+	if (!ring)
+		return -ENODEV;
+	if (record_len > UINT16_MAX || need > ring->size / 4)
+		return -ENOSPC;
+
+	/* Reserve space, skipping to the start if the record would wrap */
+	pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	do {
+		offset = pos & (ring->size - 1);
+		pad = ring->size - offset < need ? ring->size - offset : 0;
+		next = pos + pad + need;
+	} while (!__atomic_compare_exchange_n(&ring->head, &pos, next, false,
+					      __ATOMIC_ACQ_REL,
+					      __ATOMIC_RELAXED));
+
+	if (pad) {
+		record = (void *)(ring_data + offset);
+		record->len = pad;
+		record->type = TELEMETRY_RING_PADDING;
+		record->dev_id = 0;
+		telemetry_shm_commit(record, pos);
+		pos += pad;
+		offset = 0;
+	}
+
+	record = (void *)(ring_data + offset);
+	record->len = record_len;
+	record->type = type;
+	record->dev_id = dev_id;
+	memcpy(record + 1, header, header_len);
+	memcpy((uint8_t *)(record + 1) + header_len, payload, len);
+	telemetry_shm_commit(record, pos);
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Shared memory telemetry ring
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ */
+#ifndef __TELEMETRY_SHM_H__
+#define __TELEMETRY_SHM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TELEMETRY_RING_MAGIC		0x54525654 /* "TVRT" */
+#define TELEMETRY_RING_VERSION		1
+#define TELEMETRY_RING_DEFAULT_SIZE	(1 << 20)
+
+/* record type that fills the space up to the end of the data area */
+#define TELEMETRY_RING_PADDING		0xff
+
+/*
+ * Layout of the shared memory region. The data area of size bytes, a power
+ * of two, starts at offset. head is the number of bytes reserved by writers
+ * since the ring was created.
+ *
+ * Readers start at the current head and follow it. A record at position pos
+ * is complete when its seq field equals pos / 8 + 1, truncated to 32 bits.
+ * After copying a record, readers must check that head - pos is still not
+ * larger than size; otherwise the record was overwritten while reading and
+ * the reader has to skip ahead to the current head.
+ */
+struct telemetry_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t offset;
+	uint64_t head;
+};
+
+/*
+ * Record header, followed by the payload of a TELEMETRY_PACKET_* packet.
+ * Records start at 8 byte aligned positions and never wrap around the end of
+ * the data area. len includes the header but not the alignment padding.
+ */
+struct telemetry_ring_record {
+	uint32_t seq;
+	uint16_t len;
+	uint8_t type;
+	uint8_t dev_id;
+};
+
+int telemetry_shm_init(size_t size);
+void telemetry_shm_deinit(void);
+int telemetry_shm_get_fd(void);
+size_t telemetry_shm_get_size(void);
+int telemetry_shm_write(uint8_t type, uint8_t dev_id, const void *header,
+			size_t header_len, const void *payload, size_t len);
+
+#endif /* __TELEMETRY_SHM_H__ */
@@ -3,7 +3,10 @@
  * Copyright 2017 Philipp Zabel
  * SPDX-License-Identifier:	LGPL-2.0+
  */
+#define _GNU_SOURCE
+#include <asm/byteorder.h>
 #include <errno.h>
+#include <glib.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -11,141 +14,477 @@
 
 #include "imu.h"
 #include "lighthouse.h"
+#include "maths.h"
 #include "telemetry.h"
+#include "telemetry-shm.h"
+#include "trace.h"
 
 #define TELEMETRY_ADDRESS			INADDR_LOOPBACK
 
+/* maximum size of a single datagram, fits into an ethernet frame */
+#define TELEMETRY_DATAGRAM_SIZE			1400
+/* maximum number of datagrams sent with a single sendmmsg call */
+#define TELEMETRY_BATCH_SIZE			16
+/* maximum time in µs that records are buffered */
+#define TELEMETRY_FLUSH_INTERVAL		10000
+/* number of single packet types that can be subscribed to */
+#define TELEMETRY_NUM_TYPES			TELEMETRY_PACKET_MULTI
+/* maximum number of delta timestamps between absolute timestamps */
+#define TELEMETRY_COMPACT_KEY_INTERVAL		64
+
+/* compact time field flag: absolute __le64 µs instead of __le16 µs delta */
+#define TELEMETRY_COMPACT_ABSOLUTE_TIME		0x01
+
+/*
+ * Compact IMU sample, followed by the sample time in µs, either as absolute
+ * __le64 value or as __le16 delta to the previous sample of the same device
+ * if TELEMETRY_COMPACT_ABSOLUTE_TIME is not set in flags. The wrapping
+ * sequence number is incremented for each sample of a device, so receivers
+ * can tell that a delta is relative to a sample they missed, and wait for
+ * the next absolute time.
+ */
+struct telemetry_compact_imu_sample {
+	__u8 version;
+	__u8 flags;
+	__u8 seq;
+	__le16 acceleration[3];
+	__le16 angular_velocity[3];
+	__le16 magnetic_field[3];
+	__le16 temperature;
+} __attribute__((packed));
+
+/* Compact pose, as half floats */
+struct telemetry_compact_pose {
+	__u8 version;
+	__le16 rotation[4];
+	__le16 translation[3];
+} __attribute__((packed));
+
+/*
+ * Compact lighthouse frame, followed by one struct telemetry_compact_sweep
+ * for each bit set in sweep_ids, in ascending order.
+ */
+struct telemetry_compact_lighthouse_frame {
+	__u8 version;
+	__le32 sync_timestamp;
+	__le16 sync_duration;
+	__le32 sync_ids;
+	__le32 sweep_ids;
+	__le32 frame_duration;
+} __attribute__((packed));
+
+struct telemetry_compact_sweep {
+	__le32 offset;
+	__le16 duration;
+} __attribute__((packed));
+
+/*
+ * Last IMU sample time sent per device, the number of deltas sent since the
+ * last absolute time, and the next sequence number. Each device sends its
+ * samples from a single thread.
+ */
+struct telemetry_compact_time {
+	uint64_t time;
+	int num_deltas;
+	uint8_t seq;
+};
+
+/*
+ * Datagrams buffered by a single thread. Each datagram is a multi-record
+ * container: a TELEMETRY_PACKET_MULTI byte and the number of records,
+ * followed by the records. Each record is a little-endian 16-bit length
+ * followed by a packet in the single packet format: the packet type, the
+ * device id, and the payload.
+ */
+struct telemetry_batch {
+	int num;
+	size_t len[TELEMETRY_BATCH_SIZE];
+	gint64 first_time;
+	uint8_t buf[TELEMETRY_BATCH_SIZE][TELEMETRY_DATAGRAM_SIZE];
+};
+
 static struct sockaddr_in telemetry_addr;
 static int telemetry_fd;
 
-int telemetry_send_raw_buffer(uint8_t dev_id, const char *buf, size_t len)
+static bool telemetry_compact;
+static struct telemetry_compact_time telemetry_compact_time[256];
+
+uint8_t telemetry_subscribed[256];
+uint8_t telemetry_subscribed_all;
+bool telemetry_udp;
+
+/*
+ * Number of subscribers per device and packet type, the last row counts
+ * subscriptions for all devices. The subscription masks read by the device
+ * threads are derived from these.
+ */
+static GMutex telemetry_subscribers_lock;
+static unsigned int telemetry_subscribers[257][TELEMETRY_NUM_TYPES];
+
+static void telemetry_batch_free(gpointer data);
+
+/* Each device thread buffers its own records, so no locking is needed */
+static GPrivate telemetry_batch = G_PRIVATE_INIT(telemetry_batch_free);
+
+/*
+ * Sends all buffered datagrams of the batch.
+ */
+static int telemetry_batch_flush(struct telemetry_batch *batch)
 {
-	char packet[256];
+	struct mmsghdr msgs[TELEMETRY_BATCH_SIZE];
+	struct iovec iov[TELEMETRY_BATCH_SIZE];
+	int ret = 0;
+	int i;
 
-	if (telemetry_fd <= 0)
+	if (!batch->num)
 		return 0;
 
-	if (len > sizeof(buf) - 2)
-		return -ENOSPC;
+	for (i = 0; i < batch->num; i++) {
+		iov[i].iov_base = batch->buf[i];
+		iov[i].iov_len = batch->len[i];
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &telemetry_addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(telemetry_addr);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
 
-	packet[0] = TELEMETRY_PACKET_RAW_BUFFER;
-	packet[1] = dev_id;
-	memcpy(packet + 2, buf, len);
+	if (telemetry_fd > 0) {
+		ret = sendmmsg(telemetry_fd, msgs, batch->num, 0);
+		if (ret < 0)
+			ret = -errno;
+	}
+	batch->num = 0;
 
-	return sendto(telemetry_fd, packet, len, 0,
-		      (struct sockaddr *)&telemetry_addr,
-		      sizeof(telemetry_addr));
+	return ret;
 }
 
-int telemetry_send_raw_imu_sample(uint8_t dev_id, struct raw_imu_sample *raw)
+static void telemetry_batch_free(gpointer data)
+{
+	struct telemetry_batch *batch = data;
+
+	telemetry_batch_flush(batch);
+	g_free(batch);
+}
+
+/*
+ * Appends a record to the calling thread's batch. The batch is sent when it
+ * is full, or when the oldest record has been buffered for too long.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+static int telemetry_queue(uint8_t type, uint8_t dev_id, const void *header,
+			   size_t header_len, const void *payload, size_t len)
 {
-	char packet[2 + sizeof(*raw)];
-	const size_t len = sizeof(packet);
+	struct telemetry_batch *batch;
+	size_t record_len = 2 + header_len + len;
+	gint64 now;
+	uint8_t *p;
+	int ret;
+
+	if (!telemetry_wants(dev_id, type & ~TELEMETRY_PACKET_COMPACT))
+		return 0;
+
+	OUVRT_TRACE3(telemetry_send, dev_id, type, header_len + len);
+
+	if (telemetry_shm_get_size())
+		return telemetry_shm_write(type, dev_id, header, header_len,
+					   payload, len);
 
 	if (telemetry_fd <= 0)
 		return 0;
 
-	packet[0] = TELEMETRY_PACKET_RAW_IMU_SAMPLE;
-	packet[1] = dev_id;
-	memcpy(packet + 2, raw, sizeof(*raw));
+	if (2 + 2 + record_len > TELEMETRY_DATAGRAM_SIZE)
+		return -ENOSPC;
+
+	batch = g_private_get(&telemetry_batch);
+	if (!batch) {
+		batch = g_new0(struct telemetry_batch, 1);
+		g_private_set(&telemetry_batch, batch);
+	}
+
+	now = g_get_monotonic_time();
+
+	/* Start a new datagram if the current one is full */
+	if (!batch->num ||
+	    batch->len[batch->num - 1] + 2 + record_len >
+	    TELEMETRY_DATAGRAM_SIZE ||
+	    batch->buf[batch->num - 1][1] == UINT8_MAX) {
+		if (batch->num == TELEMETRY_BATCH_SIZE) {
+			ret = telemetry_batch_flush(batch);
+			if (ret < 0)
+				return ret;
+		}
+		if (!batch->num)
+			batch->first_time = now;
+		batch->buf[batch->num][0] = TELEMETRY_PACKET_MULTI;
+		batch->buf[batch->num][1] = 0;
+		batch->len[batch->num] = 2;
+		batch->num++;
+	}
+
+	p = batch->buf[batch->num - 1];
+	p[batch->len[batch->num - 1]++] = record_len & 0xff;
+	p[batch->len[batch->num - 1]++] = record_len >> 8;
+	p[batch->len[batch->num - 1]++] = type;
+	p[batch->len[batch->num - 1]++] = dev_id;
+	memcpy(p + batch->len[batch->num - 1], header, header_len);
+	batch->len[batch->num - 1] += header_len;
+	memcpy(p + batch->len[batch->num - 1], payload, len);
+	batch->len[batch->num - 1] += len;
+	p[1]++;
+
+	if (now - batch->first_time >= TELEMETRY_FLUSH_INTERVAL) {
+		ret = telemetry_batch_flush(batch);
+		if (ret < 0)
+			return ret;
+	}
 
-	return sendto(telemetry_fd, packet, len, 0,
-		      (struct sockaddr *)&telemetry_addr,
-		      sizeof(telemetry_addr));
+	return 0;
 }
 
-int telemetry_send_imu_sample(uint8_t dev_id, struct imu_sample *sample)
+/*
+ * Sends all records buffered by the calling thread. Device threads call this
+ * after handling each report.
+ *
+ * Returns the number of datagrams sent or a negative error code.
+ */
+int telemetry_flush(void)
 {
-	char packet[2 + sizeof(*sample)];
-	const size_t len = sizeof(packet);
+	struct telemetry_batch *batch;
 
 	if (telemetry_fd <= 0)
 		return 0;
 
-	packet[0] = TELEMETRY_PACKET_IMU_SAMPLE;
-	packet[1] = dev_id;
-	memcpy(packet + 2, sample, sizeof(*sample));
+	batch = g_private_get(&telemetry_batch);
+	if (!batch)
+		return 0;
 
-	return sendto(telemetry_fd, packet, len, 0,
-		      (struct sockaddr *)&telemetry_addr,
-		      sizeof(telemetry_addr));
+	return telemetry_batch_flush(batch);
 }
 
-int telemetry_send_lighthouse_frame(uint8_t dev_id,
-				    struct lighthouse_frame *frame)
+static void telemetry_update_subscription(int dev_id, uint32_t types,
+					  bool subscribe)
 {
-	char packet[2 + sizeof(*frame)];
-	const size_t len = sizeof(packet);
+	unsigned int *count;
+	uint8_t mask = 0;
+	int type;
+
+	if (dev_id < TELEMETRY_ALL_DEVICES || dev_id > UINT8_MAX)
+		return;
+
+	count = telemetry_subscribers[dev_id == TELEMETRY_ALL_DEVICES ?
+				      256 : dev_id];
+
+	g_mutex_lock(&telemetry_subscribers_lock);
+	for (type = 0; type < TELEMETRY_NUM_TYPES; type++) {
+		if (types & (1 << type)) {
+			if (subscribe)
+				count[type]++;
+			else if (count[type])
+				count[type]--;
+		}
+		if (count[type])
+			mask |= 1 << type;
+	}
+	if (dev_id == TELEMETRY_ALL_DEVICES)
+		__atomic_store_n(&telemetry_subscribed_all, mask,
+				 __ATOMIC_RELAXED);
+	else
+		__atomic_store_n(&telemetry_subscribed[dev_id], mask,
+				 __ATOMIC_RELAXED);
+	g_mutex_unlock(&telemetry_subscribers_lock);
+}
 
-	if (telemetry_fd <= 0)
-		return 0;
+/*
+ * Subscribes to the packet types in the types bitmask, either of a single
+ * device or of all devices. Subscriptions are counted, each call must be
+ * balanced by a call to telemetry_unsubscribe.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int telemetry_subscribe(int dev_id, uint32_t types)
+{
+	if (dev_id < TELEMETRY_ALL_DEVICES || dev_id > UINT8_MAX ||
+	    types >= (1 << TELEMETRY_NUM_TYPES))
+		return -EINVAL;
 
-	packet[0] = TELEMETRY_PACKET_LIGHTHOUSE_FRAME;
-	packet[1] = dev_id;
-	memcpy(packet + 2, frame, sizeof(*frame));
+	telemetry_update_subscription(dev_id, types, true);
 
-	return sendto(telemetry_fd, packet, len, 0,
-		      (struct sockaddr *)&telemetry_addr,
-		      sizeof(telemetry_addr));
+	return 0;
 }
 
-int telemetry_send_pose(uint8_t dev_id, struct dpose *pose)
+/*
+ * Drops a subscription made with telemetry_subscribe.
+ */
+void telemetry_unsubscribe(int dev_id, uint32_t types)
 {
-	char packet[2 + sizeof(*pose)];
-	const size_t len = sizeof(packet);
+	telemetry_update_subscription(dev_id, types, false);
+}
 
-	if (telemetry_fd <= 0)
-		return 0;
+int telemetry_send_raw_buffer(uint8_t dev_id, const char *buf, size_t len)
+{
+	return telemetry_queue(TELEMETRY_PACKET_RAW_BUFFER, dev_id, NULL, 0,
+			       buf, len);
+}
 
-	packet[0] = TELEMETRY_PACKET_POSE;
-	packet[1] = dev_id;
-	memcpy(packet + 2, pose, sizeof(*pose));
+int telemetry_send_raw_imu_sample(uint8_t dev_id, struct raw_imu_sample *raw)
+{
+	return telemetry_queue(TELEMETRY_PACKET_RAW_IMU_SAMPLE, dev_id, NULL, 0,
+			       raw, sizeof(*raw));
+}
 
-	return sendto(telemetry_fd, packet, len, 0,
-		      (struct sockaddr *)&telemetry_addr,
-		      sizeof(telemetry_addr));
+static inline __le16 __float_to_le16(float f)
+{
+	return __cpu_to_le16(float_to_f16(f));
 }
 
-int telemetry_send_axis(uint8_t dev_id, int index, float *axis, int num_axis)
+static int telemetry_send_compact_imu_sample(uint8_t dev_id,
+					     struct imu_sample *sample)
 {
-	char packet[2 + 1 + num_axis * sizeof(float)];
-	const size_t len = sizeof(packet);
+	struct telemetry_compact_time *last = &telemetry_compact_time[dev_id];
+	struct telemetry_compact_imu_sample c = {
+		.version = TELEMETRY_COMPACT_VERSION,
+		.seq = last->seq++,
+		.acceleration = {
+			__float_to_le16(sample->acceleration.x),
+			__float_to_le16(sample->acceleration.y),
+			__float_to_le16(sample->acceleration.z),
+		},
+		.angular_velocity = {
+			__float_to_le16(sample->angular_velocity.x),
+			__float_to_le16(sample->angular_velocity.y),
+			__float_to_le16(sample->angular_velocity.z),
+		},
+		.magnetic_field = {
+			__float_to_le16(sample->magnetic_field.x),
+			__float_to_le16(sample->magnetic_field.y),
+			__float_to_le16(sample->magnetic_field.z),
+		},
+		.temperature = __float_to_le16(sample->temperature),
+	};
+	uint64_t time = sample->time * 1e6;
+	uint64_t delta = time - last->time;
+	__le64 abs_time;
+	__le16 delta_time;
+
+	bool absolute = time < last->time || delta > UINT16_MAX ||
+			last->num_deltas >= TELEMETRY_COMPACT_KEY_INTERVAL;
+
+	last->time = time;
+	if (absolute) {
+		last->num_deltas = 0;
+		c.flags = TELEMETRY_COMPACT_ABSOLUTE_TIME;
+		abs_time = __cpu_to_le64(time);
+		return telemetry_queue(TELEMETRY_PACKET_IMU_SAMPLE |
+				       TELEMETRY_PACKET_COMPACT, dev_id,
+				       &c, sizeof(c), &abs_time,
+				       sizeof(abs_time));
+	}
 
-	if (telemetry_fd <= 0)
-		return 0;
+	last->num_deltas++;
+	delta_time = __cpu_to_le16(delta);
+	return telemetry_queue(TELEMETRY_PACKET_IMU_SAMPLE |
+			       TELEMETRY_PACKET_COMPACT, dev_id, &c, sizeof(c),
+			       &delta_time, sizeof(delta_time));
+}
 
-	if (num_axis == 0)
-		return 0;
+int telemetry_send_imu_sample(uint8_t dev_id, struct imu_sample *sample)
+{
+	if (telemetry_compact)
+		return telemetry_send_compact_imu_sample(dev_id, sample);
 
-	packet[0] = TELEMETRY_PACKET_AXIS;
-	packet[1] = dev_id;
-	packet[2] = index;
-	memcpy(packet + 3, axis, num_axis * sizeof(float));
+	return telemetry_queue(TELEMETRY_PACKET_IMU_SAMPLE, dev_id, NULL, 0,
+			       sample, sizeof(*sample));
+}
 
-	return sendto(telemetry_fd, packet, len, 0,
-		      (struct sockaddr *)&telemetry_addr,
-		      sizeof(telemetry_addr));
+static int telemetry_send_compact_lighthouse_frame(uint8_t dev_id,
+					struct lighthouse_frame *frame)
+{
+	struct telemetry_compact_lighthouse_frame c = {
+		.version = TELEMETRY_COMPACT_VERSION,
+		.sync_timestamp = __cpu_to_le32(frame->sync_timestamp),
+		.sync_duration = __cpu_to_le16(frame->sync_duration),
+		.sync_ids = __cpu_to_le32(frame->sync_ids),
+		.sweep_ids = __cpu_to_le32(frame->sweep_ids),
+		.frame_duration = __cpu_to_le32(frame->frame_duration),
+	};
+	struct telemetry_compact_sweep sweeps[32];
+	int num = 0;
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		if (!(frame->sweep_ids & (1u << i)))
+			continue;
+		sweeps[num].offset = __cpu_to_le32(frame->sweep_offset[i]);
+		sweeps[num].duration = __cpu_to_le16(frame->sweep_duration[i]);
+		num++;
+	}
+
+	return telemetry_queue(TELEMETRY_PACKET_LIGHTHOUSE_FRAME |
+			       TELEMETRY_PACKET_COMPACT, dev_id, &c, sizeof(c),
+			       sweeps, num * sizeof(sweeps[0]));
 }
 
+int telemetry_send_lighthouse_frame(uint8_t dev_id,
+				    struct lighthouse_frame *frame)
+{
+	if (telemetry_compact)
+		return telemetry_send_compact_lighthouse_frame(dev_id, frame);
+
+	return telemetry_queue(TELEMETRY_PACKET_LIGHTHOUSE_FRAME, dev_id,
+			       NULL, 0, frame, sizeof(*frame));
+}
 
-int telemetry_send_buttons(uint8_t dev_id, uint8_t *buttons, int num_buttons)
+int telemetry_send_pose(uint8_t dev_id, struct dpose *pose)
 {
-	char packet[2 + num_buttons];
-	const size_t len = sizeof(packet);
+	struct telemetry_compact_pose c;
 
-	if (telemetry_fd <= 0)
+	if (!telemetry_compact) {
+		return telemetry_queue(TELEMETRY_PACKET_POSE, dev_id, NULL, 0,
+				       pose, sizeof(*pose));
+	}
+
+	c.version = TELEMETRY_COMPACT_VERSION;
+	c.rotation[0] = __float_to_le16(pose->rotation.x);
+	c.rotation[1] = __float_to_le16(pose->rotation.y);
+	c.rotation[2] = __float_to_le16(pose->rotation.z);
+	c.rotation[3] = __float_to_le16(pose->rotation.w);
+	c.translation[0] = __float_to_le16(pose->translation.x);
+	c.translation[1] = __float_to_le16(pose->translation.y);
+	c.translation[2] = __float_to_le16(pose->translation.z);
+
+	return telemetry_queue(TELEMETRY_PACKET_POSE | TELEMETRY_PACKET_COMPACT,
+			       dev_id, &c, sizeof(c), NULL, 0);
+}
+
+int telemetry_send_axis(uint8_t dev_id, int index, float *axis, int num_axis)
+{
+	uint8_t header = index;
+
+	if (num_axis == 0)
 		return 0;
 
+	return telemetry_queue(TELEMETRY_PACKET_AXIS, dev_id, &header, 1,
+			       axis, num_axis * sizeof(float));
+}
+
+int telemetry_send_buttons(uint8_t dev_id, uint8_t *buttons, int num_buttons)
+{
 	if (num_buttons == 0)
 		return 0;
 
-	packet[0] = TELEMETRY_PACKET_BUTTONS;
-	packet[1] = dev_id;
-	memcpy(packet + 2, buttons, num_buttons);
+	return telemetry_queue(TELEMETRY_PACKET_BUTTONS, dev_id, NULL, 0,
+			       buttons, num_buttons);
+}
 
-	return sendto(telemetry_fd, packet, len, 0,
-		      (struct sockaddr *)&telemetry_addr,
-		      sizeof(telemetry_addr));
+/*
+ * Selects the compact encoding for IMU samples, poses, and lighthouse
+ * frames. This must be called before devices start sending telemetry.
+ */
+void telemetry_set_compact(bool compact)
+{
+	telemetry_compact = compact;
 }
 
 /*
@@ -181,6 +520,7 @@ int telemetry_init(int *argc, char **argv[])
 	telemetry_addr.sin_addr.s_addr = htonl(TELEMETRY_ADDRESS);
 
 	telemetry_fd = fd;
+	__atomic_store_n(&telemetry_udp, true, __ATOMIC_RELAXED);
 
 	return 0;
 }
@@ -191,6 +531,7 @@ int telemetry_init(int *argc, char **argv[])
 void telemetry_deinit()
 {
 	if (telemetry_fd > 0) {
+		__atomic_store_n(&telemetry_udp, false, __ATOMIC_RELAXED);
 		close(telemetry_fd);
 		telemetry_fd = 0;
 	}
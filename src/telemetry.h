@@ -3,6 +3,7 @@
  * Copyright 2017 Philipp Zabel
  * SPDX-License-Identifier:	LGPL-2.0+
  */
+#include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
 
@@ -15,12 +16,47 @@
 #define TELEMETRY_PACKET_LIGHTHOUSE_FRAME	4
 #define TELEMETRY_PACKET_BUTTONS		5
 #define TELEMETRY_PACKET_AXIS			6
+/* container of multiple length-prefixed packets of the above types */
+#define TELEMETRY_PACKET_MULTI			7
+/*
+ * Flag set on the packet type of compactly encoded IMU_SAMPLE, POSE, and
+ * LIGHTHOUSE_FRAME packets. The payload starts with an encoding version.
+ */
+#define TELEMETRY_PACKET_COMPACT		0x80
+#define TELEMETRY_COMPACT_VERSION		1
+
+/* subscribes to matching packets of all devices */
+#define TELEMETRY_ALL_DEVICES			-1
+
+/* bitmask of subscribed packet types, per device and for all devices */
+extern uint8_t telemetry_subscribed[256];
+extern uint8_t telemetry_subscribed_all;
+/* set while all packets are broadcast over UDP, regardless of subscribers */
+extern bool telemetry_udp;
 
 struct imu_sample;
 struct raw_imu_sample;
 struct lighthouse_frame;
 struct dpose;
 
+/*
+ * Returns true if packets of the given type from the given device are sent
+ * over UDP, or if anybody subscribed to them over D-Bus. Decoders can use
+ * this to skip building telemetry records.
+ */
+static inline bool telemetry_wants(uint8_t dev_id, uint8_t type)
+{
+	if (__atomic_load_n(&telemetry_udp, __ATOMIC_RELAXED))
+		return true;
+
+	return (__atomic_load_n(&telemetry_subscribed[dev_id],
+				__ATOMIC_RELAXED) |
+		__atomic_load_n(&telemetry_subscribed_all,
+				__ATOMIC_RELAXED)) & (1 << type);
+}
+
+int telemetry_subscribe(int dev_id, uint32_t types);
+void telemetry_unsubscribe(int dev_id, uint32_t types);
 int telemetry_send_raw_buffer(uint8_t dev_id, const char *buf, size_t len);
 int telemetry_send_raw_imu_sample(uint8_t dev_id, struct raw_imu_sample *raw);
 int telemetry_send_imu_sample(uint8_t dev_id, struct imu_sample *sample);
@@ -29,5 +65,7 @@ int telemetry_send_lighthouse_frame(uint8_t dev_id,
 int telemetry_send_pose(uint8_t dev_id, struct dpose *pose);
 int telemetry_send_buttons(uint8_t dev_id, uint8_t *buttons, int num_buttons);
 int telemetry_send_axis(uint8_t dev_id, int index, float *axis, int num_axis);
+int telemetry_flush(void);
+void telemetry_set_compact(bool compact);
 int telemetry_init();
 void telemetry_deinit();
@@ -0,0 +1,29 @@
+/*
+ * Static tracepoints
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
+ *
+ * USDT probes in the "ouvrt" provider, for use with perf, bpftrace, or
+ * SystemTap. Each probe site compiles to a single nop unless a tracer is
+ * attached. Without <sys/sdt.h>, the probes and their arguments vanish.
+ *
+ * List them with: perf list 'sdt_ouvrt:*' after perf buildid-cache --add.
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define OUVRT_TRACE1(name, a)			DTRACE_PROBE1(ouvrt, name, a)
+#define OUVRT_TRACE2(name, a, b)		DTRACE_PROBE2(ouvrt, name, a, b)
+#define OUVRT_TRACE3(name, a, b, c)		DTRACE_PROBE3(ouvrt, name, a, b, c)
+#define OUVRT_TRACE4(name, a, b, c, d)		DTRACE_PROBE4(ouvrt, name, a, b, c, d)
+#else
+#define OUVRT_TRACE1(name, a)			do { } while (0)
+#define OUVRT_TRACE2(name, a, b)		do { } while (0)
+#define OUVRT_TRACE3(name, a, b, c)		do { } while (0)
+#define OUVRT_TRACE4(name, a, b, c, d)		do { } while (0)
+#endif
+
+#endif /* __TRACE_H__ */
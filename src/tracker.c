@@ -3,38 +3,352 @@
  * Copyright 2015 Philipp Zabel
  * SPDX-License-Identifier:	LGPL-2.0+ or BSL-1.0
  */
+#include <errno.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "blobwatch.h"
+#include "constellation.h"
 #include "debug.h"
+#include "extrinsics.h"
+#include "fusion.h"
+#include "imu.h"
+#include "imu-history.h"
+#include "jobs.h"
+#include "latency-probe.h"
 #include "leds.h"
+#include "log.h"
 #include "maths.h"
-#include "opencv.h"
+#include "opencl.h"
+#include "pnp.h"
+#include "pose-merger.h"
+#include "pose-shm.h"
+#include "recording.h"
+#include "reprojection.h"
 #include "tracker.h"
 
+#define TRACKER_MAX_CAMERAS	8
+/* enough to match frames processed a few frames late */
+#define TRACKER_MAX_EXPOSURES	16
+/* IMU samples buffered for the debug stream, ~64 ms at 1 kHz */
+#define TRACKER_DEBUG_IMU_SAMPLES	64
+/* maximum time in ns that a frame may appear to start before its exposure */
+#define TRACKER_EXPOSURE_SLACK	2000000
+
+/* pose refinement iterations per frame while tracking */
+#define TRACKER_REFINE_ITERATIONS	3
+/* RMS reprojection error in pixels above which tracking is lost */
+#define TRACKER_MAX_REPROJECTION_ERROR	1.5
+/* maximum time in seconds to extrapolate the fused pose, see Tracker1 xml */
+#define TRACKER_MAX_PREDICTION		0.1
+/* maximum distance in pixels between blobs and LEDs projected at last pose */
+#define TRACKER_INLIER_DISTANCE		8.0
+/* maximum number of transfers in flight per camera stream */
+#define TRACKER_MAX_TRANSFERS		16
+
+/* angular velocity in rad/s and acceleration in m/s² of a resting device */
+#define TRACKER_REST_ANGULAR_VELOCITY	0.05
+#define TRACKER_REST_ACCELERATION	0.2
+/* time in seconds a device must rest before the optical rate is reduced */
+#define TRACKER_REST_TIME		0.5
+/* minimum time in ns between the frames processed at the reduced rate */
+#define TRACKER_REST_FRAME_INTERVAL	100000000ULL
+/* blob motion in pixels per processed frame that restores the full rate */
+#define TRACKER_REST_BLOB_MOTION	2
+/* time in seconds without optical pose after which tracking is lost */
+#define TRACKER_TRACKING_TIMEOUT	0.2
+/* time in seconds optical poses wait for older poses from other cameras */
+#define TRACKER_POSE_REORDER_WINDOW	0.01
+
+/*
+ * A single exposure of the tracking camera, as reported by the tracked device
+ */
+struct tracker_exposure {
+	uint32_t device_timestamp;
+	uint64_t time;
+	uint8_t led_pattern_phase;
+};
+
+/*
+ * Slot of the exposure ring, seq is odd while the IMU thread is writing
+ */
+struct tracker_exposure_slot {
+	uint32_t seq;
+	struct tracker_exposure exposure;
+};
+
+/*
+ * Camera space pose of a tracked object, only accessed by the jobs processing
+ * the frames of that camera, which run one frame after another
+ */
+struct tracker_object_camera {
+	/* last pose, valid while tracking */
+	bool tracking;
+	dquat rot;
+	dvec3 trans;
+};
+
+/*
+ * Correspondences of a single object in a single camera frame
+ */
+struct tracker_view {
+	struct pnp_problem pnp;
+	bool inliers[PNP_MAX_POINTS];
+	int num_inliers;
+	/* camera and camera space object pose, for extrinsic calibration */
+	int camera;
+	dquat rot;
+	dvec3 trans;
+	/* camera pose and object pose seen by this camera, in world space */
+	struct dpose camera_pose;
+	struct dpose pose;
+};
+
+/*
+ * Views of a single object in the same exposure by multiple cameras
+ */
+struct tracker_observation {
+	uint32_t device_timestamp;
+	double time;
+	uint32_t camera_mask;
+	int num_views;
+	struct tracker_view views[TRACKER_MAX_CAMERAS];
+};
+
+/*
+ * A constellation of LEDs with its own blinking pattern namespace. Object 0
+ * is the tracked device itself, whose pose is fused with its IMU. The world
+ * space pose of other objects is taken directly from the optical tracking.
+ */
+struct tracker_object {
+	/* set once leds is initialized */
+	bool active;
+	struct leds leds;
+	/* index of LED triplets for pose acquisition without LED ids */
+	struct constellation *constellation;
+	struct tracker_object_camera cameras[TRACKER_MAX_CAMERAS];
+	/* serializes access to pose and observation */
+	GMutex lock;
+	bool has_pose;
+	struct dpose pose;
+	/* cameras that saw the object in the last and current exposure */
+	uint32_t camera_mask;
+	uint32_t seen_timestamp;
+	uint32_t seen_mask;
+	/* views of the current exposure, not yet applied */
+	struct tracker_observation observation;
+};
+
+/*
+ * Pose solve of a single object in a single frame
+ */
+struct tracker_solve {
+	struct job job;
+	struct tracker_object *object;
+	struct tracker_object_camera *state;
+	int object_id;
+	struct blob *blobs;
+	int num_blobs;
+	dmat3 *camera_matrix;
+	const struct distortion *distortion;
+	/* copied from the camera, which may switch parameters meanwhile */
+	struct pnp_params params;
+	/* set if the pose was searched from scratch */
+	bool acquired;
+	int ret;
+};
+
+/*
+ * A frame submitted for processing, as a graph of jobs: blob detection,
+ * followed by blob identification, which starts the pose solves of all
+ * objects in parallel, followed by fusion of the resulting poses.
+ */
+struct tracker_frame {
+	OuvrtTracker *tracker;
+	int index;
+	uint8_t *frame;
+	uint64_t sof_time;
+	dmat3 *camera_matrix;
+	const struct distortion *distortion;
+	ouvrt_tracker_frame_func done;
+	void *data;
+	struct blobservation *ob;
+	struct tracker_solve solves[TRACKER_MAX_OBJECTS];
+	int num_solves;
+	bool in_flight;
+	struct job detect;
+	struct job identify;
+	struct job fuse;
+};
+
+/*
+ * Blob detector state of a single camera
+ */
+struct tracker_camera {
+	/* set while the slot is used, written under the tracker lock */
+	bool in_use;
+	struct blobwatch *bw;
+	int width;
+	int height;
+	/* serializes access to the observation history */
+	GMutex lock;
+	struct reprojection *rp;
+	/*
+	 * transform from camera to fusion world space, once known, written by
+	 * the frame jobs under lock
+	 */
+	bool extrinsics;
+	struct dpose camera_pose;
+	/* generation of the last refined camera pose that was applied */
+	unsigned int extrinsics_generation;
+
+	/* optional GPU offload of the per-pixel blob detection pass */
+	struct opencl_compute *cl;
+	struct blobwatch_run *runs;
+	uint16_t *num_runs;
+	struct blob *blobs;
+
+	/* start of the last frame, for IMU predicted blob motion */
+	uint64_t last_sof_time;
+	/*
+	 * start of the last frame not skipped, and whether its blobs moved,
+	 * only accessed by the submitting thread and the frame jobs
+	 */
+	uint64_t last_processed_sof_time;
+	bool blob_motion;
+
+	/*
+	 * parameters applied at the start of the current frame, written by
+	 * the frame jobs under lock
+	 */
+	struct tracker_params params;
+	unsigned int params_generation;
+	/* generation of the blob detector parameters, see update_scan_params */
+	unsigned int scan_params_generation;
+
+	/* frames in flight, only accessed by the submitting thread */
+	struct tracker_frame frames[TRACKER_MAX_FRAMES_IN_FLIGHT];
+	int next_frame;
+};
+
 struct _OuvrtTracker {
 	GObject parent_instance;
-	struct blobwatch *bw;
-	struct leds leds;
+	GMutex lock;
+	struct tracker_camera cameras[TRACKER_MAX_CAMERAS];
+	/* number of slots ever used, written under lock */
+	int num_cameras;
+	struct tracker_object objects[TRACKER_MAX_OBJECTS];
+	int num_objects;
+	/*
+	 * serializes access to the fusion filter, which is only updated by the
+	 * IMU thread, against snapshots
+	 */
+	GMutex fusion_lock;
+	struct fusion *fusion;
+	/* optical poses of the tracked device, per camera, for the IMU thread */
+	struct pose_merger pose_merger;
+	/* IMU time of the last optical pose applied by the IMU thread */
+	double pose_time;
+	/* set while optical poses arrive, written by the IMU thread */
+	bool tracking;
+	/* background refinement of the camera extrinsics */
+	struct extrinsics *extrinsics;
+	/* fused states, written by the IMU thread and read without locking */
+	struct imu_history imu_history;
+	/* time in seconds from the last IMU sample to photon emission */
+	double prediction_horizon;
+	/* IMU time since which the tracked device rests, written by the IMU */
+	double rest_time;
+	/* set if the last IMU sample showed motion */
+	bool moving;
+	bool resting;
 	uint32_t radio_address;
 
-	uint64_t exposure_timestamp;
-	uint64_t exposure_time;
-	uint8_t led_pattern_phase;
+	/*
+	 * ring of the most recent exposures, written by the IMU thread only,
+	 * and the number of exposures ever written
+	 */
+	struct tracker_exposure_slot exposures[TRACKER_MAX_EXPOSURES];
+	unsigned int exposure_head;
+
+	/* IMU states of the tracked device for the debug stream */
+	struct debug_imu_fifo *debug_imu_fifo;
 
-	uint64_t last_exposure_timestamp;
-	uint64_t last_exposure_time;
-	uint8_t last_led_pattern_phase;
+	/* latest fused state for applications, created on demand */
+	struct pose_shm *pose_shm;
+
+	/* motion-to-photon latency measurement, if enabled */
+	struct latency_probe *latency_probe;
+
+	/* tunable parameters, the generation is incremented on each change */
+	struct tracker_params params;
+	unsigned int params_generation;
+
+	/* number of clients that acquired the tracker */
+	int num_clients;
 };
 
 G_DEFINE_TYPE(OuvrtTracker, ouvrt_tracker, G_TYPE_OBJECT)
 
+/* if set, trackers are only active while acquired by a client */
+static bool tracker_on_demand;
+
+/*
+ * Copies the LEDs into the given object and makes it visible to the frame
+ * processing threads.
+ */
+static void ouvrt_tracker_init_object(OuvrtTracker *tracker, int index,
+				      struct leds *leds)
+{
+	struct tracker_object *object = &tracker->objects[index];
+
+	leds_copy(&object->leds, leds);
+	object->constellation = constellation_new(&object->leds.model);
+	__atomic_store_n(&object->active, true, __ATOMIC_RELEASE);
+	if (tracker->num_objects <= index)
+		__atomic_store_n(&tracker->num_objects, index + 1,
+				 __ATOMIC_RELEASE);
+}
+
+/*
+ * Registers the LEDs of the tracked device itself, whose pose is fused with
+ * the IMU samples passed to ouvrt_tracker_add_imu_sample().
+ */
 void ouvrt_tracker_register_leds(OuvrtTracker *tracker, struct leds *leds)
 {
-	if (!tracker || tracker->leds.model.num_points)
+	if (!tracker)
 		return;
 
-	leds_copy(&tracker->leds, leds);
+	g_mutex_lock(&tracker->lock);
+	if (!tracker->objects[0].active)
+		ouvrt_tracker_init_object(tracker, 0, leds);
+	g_mutex_unlock(&tracker->lock);
+}
+
+/*
+ * Registers the LEDs of an additional object, such as a controller, that is
+ * tracked in the same camera frames as the tracked device.
+ *
+ * Returns the object index, or a negative error code.
+ */
+int ouvrt_tracker_register_object(OuvrtTracker *tracker, struct leds *leds)
+{
+	int index;
+
+	if (!tracker || !leds->model.num_points)
+		return -EINVAL;
+
+	g_mutex_lock(&tracker->lock);
+	index = MAX(tracker->num_objects, 1);
+	if (index == TRACKER_MAX_OBJECTS) {
+		g_mutex_unlock(&tracker->lock);
+		return -ENOSPC;
+	}
+	ouvrt_tracker_init_object(tracker, index, leds);
+	g_mutex_unlock(&tracker->lock);
+
+	return index;
 }
 
 void ouvrt_tracker_unregister_leds(G_GNUC_UNUSED OuvrtTracker *tracker,
@@ -53,62 +367,1861 @@ uint32_t ouvrt_tracker_get_radio_address(OuvrtTracker *tracker)
 	return tracker->radio_address;
 }
 
+/*
+ * Returns the fifo that carries IMU states of the tracked device to the
+ * debug stream of one of the cameras.
+ */
+struct debug_imu_fifo *ouvrt_tracker_get_debug_imu_fifo(OuvrtTracker *tracker)
+{
+	return tracker ? tracker->debug_imu_fifo : NULL;
+}
+
+/*
+ * Lets trackers idle while no client has acquired them. This must be called
+ * before devices are started.
+ */
+void ouvrt_tracker_set_on_demand(bool on_demand)
+{
+	tracker_on_demand = on_demand;
+}
+
+/*
+ * Marks the tracker as used by one more client.
+ */
+void ouvrt_tracker_acquire(OuvrtTracker *tracker)
+{
+	__atomic_add_fetch(&tracker->num_clients, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Drops a client acquired with ouvrt_tracker_acquire.
+ */
+void ouvrt_tracker_release(OuvrtTracker *tracker)
+{
+	__atomic_sub_fetch(&tracker->num_clients, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns true if the tracking pipeline should run at full rate. Cameras
+ * skip blob detection and pose estimation, and devices turn off their LEDs
+ * while the tracker is inactive. Safe to call from any thread.
+ */
+bool ouvrt_tracker_is_active(OuvrtTracker *tracker)
+{
+	return !tracker_on_demand ||
+	       __atomic_load_n(&tracker->num_clients, __ATOMIC_ACQUIRE) > 0;
+}
+
+/*
+ * Returns true while the optical tracking delivers poses of the tracked
+ * device, so that its LEDs need not be identified by their blinking patterns.
+ */
+bool ouvrt_tracker_is_tracking(OuvrtTracker *tracker)
+{
+	return __atomic_load_n(&tracker->tracking, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Returns a new read-only file descriptor of the shared memory page that
+ * holds the latest fused state, creating the page on first use, or a
+ * negative error code.
+ */
+int ouvrt_tracker_get_pose_fd(OuvrtTracker *tracker)
+{
+	return pose_shm_open(&tracker->pose_shm);
+}
+
+/*
+ * Creates the latency histograms of the tracked device, named after it, and
+ * starts correlating frames and published poses with the events reported
+ * by the device.
+ */
+void ouvrt_tracker_enable_latency_probe(OuvrtTracker *tracker,
+					const char *name)
+{
+	g_mutex_lock(&tracker->lock);
+	if (!tracker->latency_probe) {
+		__atomic_store_n(&tracker->latency_probe,
+				 latency_probe_new(name), __ATOMIC_RELEASE);
+	}
+	g_mutex_unlock(&tracker->lock);
+}
+
+/*
+ * Returns the latency probe, or NULL if latency measurement is disabled.
+ */
+struct latency_probe *ouvrt_tracker_get_latency_probe(OuvrtTracker *tracker)
+{
+	return __atomic_load_n(&tracker->latency_probe, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Returns a copy of the current tracking parameters.
+ */
+void ouvrt_tracker_get_params(OuvrtTracker *tracker,
+			      struct tracker_params *params)
+{
+	g_mutex_lock(&tracker->lock);
+	*params = tracker->params;
+	g_mutex_unlock(&tracker->lock);
+}
+
+/*
+ * Replaces the tracking parameters. Each camera switches to the new
+ * parameters at the start of its next frame, so that no frame is processed
+ * with a mix of old and new values. The number of transfers only takes
+ * effect when the camera stream is restarted.
+ *
+ * Returns 0 on success or -EINVAL if a parameter is out of range.
+ */
+int ouvrt_tracker_set_params(OuvrtTracker *tracker,
+			     const struct tracker_params *params)
+{
+	if (params->threshold < 0 || params->threshold > 254 ||
+	    params->min_extent_length < 1 ||
+	    params->pnp.ransac_iterations < 1 ||
+	    params->pnp.reprojection_error <= 0.0 ||
+	    params->pnp.confidence <= 0.0 || params->pnp.confidence > 1.0 ||
+	    params->num_transfers < 0 ||
+	    params->num_transfers > TRACKER_MAX_TRANSFERS)
+		return -EINVAL;
+
+	g_mutex_lock(&tracker->lock);
+	tracker->params = *params;
+	__atomic_store_n(&tracker->params_generation,
+			 tracker->params_generation + 1, __ATOMIC_RELEASE);
+	g_mutex_unlock(&tracker->lock);
+
+	return 0;
+}
+
+/*
+ * Switches the camera to the latest tracking parameters, if they changed.
+ * Called from the frame jobs with the camera lock held, before the blobs of
+ * a frame are tracked.
+ */
+static void ouvrt_tracker_update_camera_params(OuvrtTracker *tracker,
+					       struct tracker_camera *camera)
+{
+	if (__atomic_load_n(&tracker->params_generation, __ATOMIC_ACQUIRE) ==
+	    camera->params_generation)
+		return;
+
+	g_mutex_lock(&tracker->lock);
+	camera->params = tracker->params;
+	camera->params_generation = tracker->params_generation;
+	g_mutex_unlock(&tracker->lock);
+}
+
+/*
+ * Switches the blob detector to the latest threshold, if it changed. Called
+ * from the thread that scans the camera's frames, before each frame, which
+ * is the USB thread for incremental detection.
+ */
+static void ouvrt_tracker_update_scan_params(OuvrtTracker *tracker,
+					     struct tracker_camera *camera)
+{
+	int threshold, min_extent_length;
+
+	if (__atomic_load_n(&tracker->params_generation, __ATOMIC_ACQUIRE) ==
+	    camera->scan_params_generation)
+		return;
+
+	g_mutex_lock(&tracker->lock);
+	threshold = tracker->params.threshold;
+	min_extent_length = tracker->params.min_extent_length;
+	camera->scan_params_generation = tracker->params_generation;
+	g_mutex_unlock(&tracker->lock);
+
+	blobwatch_set_threshold(camera->bw, threshold, min_extent_length);
+}
+
+/*
+ * Queues an exposure at the given device timestamp and host time, with the
+ * LED pattern phase active during the exposure. The oldest exposure in the
+ * ring is overwritten under its seqlock, so that the frame processing
+ * threads never see a torn exposure. Must only be called from a single
+ * thread.
+ */
 void ouvrt_tracker_add_exposure(OuvrtTracker *tracker,
-			        uint64_t device_timestamp, uint64_t time,
-			        uint8_t led_pattern_phase)
+				uint32_t device_timestamp, uint64_t time,
+				uint8_t led_pattern_phase, uint16_t count)
+{
+	struct tracker_exposure_slot *slot;
+	unsigned int head;
+	uint32_t seq;
+
+	head = __atomic_load_n(&tracker->exposure_head, __ATOMIC_RELAXED);
+	slot = &tracker->exposures[head % TRACKER_MAX_EXPOSURES];
+	seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->exposure.device_timestamp = device_timestamp;
+	slot->exposure.time = time;
+	slot->exposure.led_pattern_phase = led_pattern_phase;
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&tracker->exposure_head, head + 1, __ATOMIC_RELEASE);
+
+	if (recording_enabled()) {
+		struct recording_exposure rec = {
+			.device_timestamp = __cpu_to_le32(device_timestamp),
+			.count = __cpu_to_le16(count),
+			.led_pattern_phase = led_pattern_phase,
+		};
+
+		recording_write(RECORDING_CHUNK_EXPOSURE, RECORDING_NO_STREAM,
+				time, &rec, sizeof(rec));
+	}
+}
+
+/*
+ * Finds the exposure of a frame started at sof_time, which is the last
+ * exposure that started before the frame, allowing for some slack.
+ *
+ * Returns false if no matching exposure is queued.
+ */
+static bool ouvrt_tracker_find_exposure(OuvrtTracker *tracker,
+					uint64_t sof_time,
+					struct tracker_exposure *exposure)
 {
-	tracker->last_exposure_timestamp = tracker->exposure_timestamp;
-	tracker->last_exposure_time = tracker->exposure_time;
-	tracker->last_led_pattern_phase = tracker->led_pattern_phase;
-	tracker->exposure_timestamp = device_timestamp;
-	tracker->exposure_time = time;
-	tracker->led_pattern_phase = led_pattern_phase;
+	unsigned int head, index, n;
+
+restart:
+	head = __atomic_load_n(&tracker->exposure_head, __ATOMIC_ACQUIRE);
+	n = MIN(head, TRACKER_MAX_EXPOSURES);
+	for (index = head - 1; n > 0; index--, n--) {
+		const struct tracker_exposure_slot *slot =
+			&tracker->exposures[index % TRACKER_MAX_EXPOSURES];
+		uint32_t seq;
+
+		do {
+			seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+			if (seq & 1)
+				continue;
+			*exposure = slot->exposure;
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		} while ((seq & 1) ||
+			 seq != __atomic_load_n(&slot->seq, __ATOMIC_RELAXED));
+
+		/* Start over if the slot was reused for a newer exposure */
+		if (__atomic_load_n(&tracker->exposure_head, __ATOMIC_RELAXED) >
+		    index + TRACKER_MAX_EXPOSURES)
+			goto restart;
+
+		if (exposure->time <= sof_time + TRACKER_EXPOSURE_SLACK)
+			return true;
+	}
+
+	return false;
 }
 
-void ouvrt_tracker_process_frame(OuvrtTracker *tracker, uint8_t *frame,
-				 int width, int height, uint64_t sof_time,
-				 struct blobservation **ob)
+/*
+ * Adds a camera feeding frames of the given size and format into the tracker.
+ * Each camera gets its own blob detector and observation history. Cameras
+ * should be added when they start streaming, so that the blob detector, GPU
+ * kernels, and frame processing threads are set up before the first frame.
+ *
+ * Returns the camera index to be passed to the frame processing functions,
+ * or a negative error code. Indices of removed cameras are reused.
+ */
+int ouvrt_tracker_add_camera(OuvrtTracker *tracker, int width, int height,
+			     enum blobwatch_format format)
 {
-	uint8_t led_pattern_phase;
+	struct tracker_camera *camera;
+	int index;
+
+	g_mutex_lock(&tracker->lock);
+	for (index = 0; index < tracker->num_cameras; index++) {
+		if (!tracker->cameras[index].in_use)
+			break;
+	}
+	if (index == TRACKER_MAX_CAMERAS) {
+		g_mutex_unlock(&tracker->lock);
+		return -ENOSPC;
+	}
+	camera = &tracker->cameras[index];
+
+	camera->bw = blobwatch_new(width, height);
+	if (!camera->bw) {
+		g_mutex_unlock(&tracker->lock);
+		return -ENOMEM;
+	}
+	camera->rp = reprojection_new(width, height);
+	if (!camera->rp) {
+		blobwatch_free(camera->bw);
+		g_mutex_unlock(&tracker->lock);
+		return -ENOMEM;
+	}
+	blobwatch_set_format(camera->bw, format);
+	blobwatch_set_roi_tracking(camera->bw, true);
+	blobwatch_set_background_mask(camera->bw, true);
+	if (opencl_compute_enabled() && format == BLOBWATCH_FORMAT_GREY) {
+		camera->cl = opencl_compute_new(width, height);
+		if (camera->cl) {
+			camera->runs = g_new(struct blobwatch_run, height *
+					     OPENCL_MAX_RUNS_PER_LINE);
+			camera->num_runs = g_new(uint16_t, height);
+			camera->blobs = g_new(struct blob,
+					      blobwatch_get_max_blobs(camera->bw));
+		}
+	}
+	camera->width = width;
+	camera->height = height;
+	camera->params = tracker->params;
+	camera->params_generation = tracker->params_generation;
+	camera->scan_params_generation = tracker->params_generation;
+	blobwatch_set_threshold(camera->bw, camera->params.threshold,
+				camera->params.min_extent_length);
+	g_mutex_init(&camera->lock);
 
-	if (tracker->bw == NULL)
-		tracker->bw = blobwatch_new(width, height);
+	__atomic_store_n(&camera->in_use, true, __ATOMIC_RELEASE);
+	if (index == tracker->num_cameras)
+		__atomic_store_n(&tracker->num_cameras, index + 1,
+				 __ATOMIC_RELEASE);
+	g_mutex_unlock(&tracker->lock);
 
-	if (sof_time < tracker->exposure_time)
-		led_pattern_phase = tracker->last_led_pattern_phase;
-	else
-		led_pattern_phase = tracker->led_pattern_phase;
+	job_start_workers();
 
-	blobwatch_process(tracker->bw, frame, width, height, led_pattern_phase,
-			  &tracker->leds, ob);
+	return index;
 }
 
-void ouvrt_tracker_process_blobs(OuvrtTracker *tracker,
-				 struct blob *blobs, int num_blobs,
-				 dmat3 *camera_matrix, double dist_coeffs[5],
-				 dquat *rot, dvec3 *trans)
+static struct tracker_camera *ouvrt_tracker_get_camera(OuvrtTracker *tracker,
+						       int index)
 {
-	struct leds *leds = &tracker->leds;
+	if (index < 0 ||
+	    index >= __atomic_load_n(&tracker->num_cameras, __ATOMIC_ACQUIRE) ||
+	    !__atomic_load_n(&tracker->cameras[index].in_use, __ATOMIC_ACQUIRE))
+		return NULL;
 
-	if (leds == NULL)
+	return &tracker->cameras[index];
+}
+
+static void ouvrt_tracker_free_camera(struct tracker_camera *camera)
+{
+	blobwatch_free(camera->bw);
+	reprojection_free(camera->rp);
+	opencl_compute_free(camera->cl);
+	g_free(camera->runs);
+	g_free(camera->num_runs);
+	g_free(camera->blobs);
+	g_mutex_clear(&camera->lock);
+}
+
+/*
+ * Removes a camera added by ouvrt_tracker_add_camera(), after waiting for
+ * its frames in flight, so that its index can be reused. Must be called
+ * from the thread that submits the camera's frames, once it stopped.
+ */
+void ouvrt_tracker_remove_camera(OuvrtTracker *tracker, int index)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+	int i;
+
+	if (!camera)
 		return;
 
-	/*
-	 * Estimate initial pose without previously known [rot|trans].
-	 */
-	estimate_initial_pose(blobs, num_blobs, leds->model.points,
-			      leds->model.num_points,
-			      camera_matrix, dist_coeffs, rot, trans,
-			      true);
+	ouvrt_tracker_flush_frames(tracker, index);
+	pose_merger_remove_ring(&tracker->pose_merger, index);
+
+	g_mutex_lock(&tracker->lock);
+	__atomic_store_n(&camera->in_use, false, __ATOMIC_RELEASE);
+	for (i = 0; i < TRACKER_MAX_OBJECTS; i++) {
+		struct tracker_object *object = &tracker->objects[i];
+
+		g_mutex_lock(&object->lock);
+		object->cameras[index].tracking = false;
+		object->camera_mask &= ~(1 << index);
+		object->seen_mask &= ~(1 << index);
+		g_mutex_unlock(&object->lock);
+	}
+	extrinsics_remove_camera(tracker->extrinsics, index);
+	ouvrt_tracker_free_camera(camera);
+	memset(camera, 0, sizeof(*camera));
+	g_mutex_unlock(&tracker->lock);
+}
+
+/*
+ * Collects the LEDs of all objects, indexed by object id, for blinking
+ * pattern identification. Objects not yet registered have no LEDs.
+ *
+ * Returns the number of objects.
+ */
+static int ouvrt_tracker_get_leds(OuvrtTracker *tracker, struct leds **leds)
+{
+	static struct leds no_leds;
+	int num_objects;
+	int i;
+
+	num_objects = __atomic_load_n(&tracker->num_objects, __ATOMIC_ACQUIRE);
+	for (i = 0; i < num_objects; i++) {
+		struct tracker_object *object = &tracker->objects[i];
+
+		leds[i] = __atomic_load_n(&object->active, __ATOMIC_ACQUIRE) ?
+			  &object->leds : &no_leds;
+	}
+
+	return num_objects;
 }
 
-static void ouvrt_tracker_class_init(OuvrtTrackerClass *klass G_GNUC_UNUSED)
+/*
+ * Returns the LED pattern phase active during the exposure of a frame
+ * started at sof_time.
+ */
+static uint8_t ouvrt_tracker_led_pattern_phase(OuvrtTracker *tracker,
+					       uint64_t sof_time)
 {
+	struct tracker_exposure exposure;
+
+	if (!ouvrt_tracker_find_exposure(tracker, sof_time, &exposure))
+		return 0;
+
+	return exposure.led_pattern_phase;
 }
 
-static void ouvrt_tracker_init(OuvrtTracker *self)
+/*
+ * Returns the device time in seconds of the exposure of a frame started at
+ * sof_time, extending the 32-bit microsecond exposure timestamp by the
+ * device time of the last IMU sample.
+ */
+static double ouvrt_tracker_exposure_time(OuvrtTracker *tracker,
+					  uint64_t sof_time)
+{
+	struct tracker_exposure exposure;
+	struct imu_state state;
+	int32_t dt;
+
+	if (!ouvrt_tracker_find_exposure(tracker, sof_time, &exposure) ||
+	    !imu_history_get_latest(&tracker->imu_history, &state))
+		return 0.0;
+
+	dt = exposure.device_timestamp -
+	     (uint32_t)llround(state.sample.time * 1e6);
+
+	return state.sample.time + 1e-6 * dt;
+}
+
+/*
+ * Stores the IMU biases and last pose of the tracked device in snapshot, to
+ * be restored after a restart.
+ *
+ * Returns false if there is no fused state yet.
+ */
+bool ouvrt_tracker_get_snapshot(OuvrtTracker *tracker,
+				struct fusion_snapshot *snapshot)
+{
+	bool valid;
+
+	if (!tracker->fusion)
+		return false;
+
+	g_mutex_lock(&tracker->fusion_lock);
+	valid = fusion_get_snapshot(tracker->fusion, snapshot);
+	g_mutex_unlock(&tracker->fusion_lock);
+
+	return valid;
+}
+
+/*
+ * Starts fusion from a snapshot taken before a restart. Must be called
+ * before the first IMU sample is added.
+ */
+void ouvrt_tracker_restore_snapshot(OuvrtTracker *tracker,
+				    const struct fusion_snapshot *snapshot)
+{
+	if (!tracker->fusion)
+		return;
+
+	g_mutex_lock(&tracker->fusion_lock);
+	fusion_restore_snapshot(tracker->fusion, snapshot);
+	g_mutex_unlock(&tracker->fusion_lock);
+}
+
+/*
+ * Stores the camera pose and the camera space object poses of a camera in
+ * snapshot. Must be called from the thread that processes the camera's
+ * frames, while no frame is in flight.
+ */
+void ouvrt_tracker_get_camera_snapshot(OuvrtTracker *tracker, int index,
+				       struct tracker_camera_snapshot *snapshot)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+	int i;
+
+	memset(snapshot, 0, sizeof(*snapshot));
+	if (!camera)
+		return;
+
+	snapshot->extrinsics = camera->extrinsics;
+	snapshot->camera_pose = camera->camera_pose;
+	for (i = 0; i < TRACKER_MAX_OBJECTS; i++) {
+		struct tracker_object_camera *state =
+			&tracker->objects[i].cameras[index];
+
+		snapshot->tracking[i] = state->tracking;
+		snapshot->poses[i].rotation = state->rot;
+		snapshot->poses[i].translation = state->trans;
+	}
+}
+
+/*
+ * Restores the camera pose and the camera space object poses of a camera
+ * from a snapshot taken before a restart. Must be called after the camera
+ * was added, before its first frame. The object poses may be stale, so they
+ * are restored with tracking cleared, and the objects are acquired again.
+ */
+void ouvrt_tracker_restore_camera_snapshot(OuvrtTracker *tracker, int index,
+				const struct tracker_camera_snapshot *snapshot)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+	int i;
+
+	if (!camera)
+		return;
+
+	g_mutex_lock(&camera->lock);
+	camera->extrinsics = snapshot->extrinsics;
+	camera->camera_pose = snapshot->camera_pose;
+	g_mutex_unlock(&camera->lock);
+	for (i = 0; i < TRACKER_MAX_OBJECTS; i++) {
+		struct tracker_object_camera *state =
+			&tracker->objects[i].cameras[index];
+
+		state->tracking = false;
+		state->rot = snapshot->poses[i].rotation;
+		state->trans = snapshot->poses[i].translation;
+	}
+}
+
+/*
+ * Returns the world space pose of a camera, as refined by the background
+ * calibration.
+ *
+ * Returns 0 on success, -EAGAIN if the camera pose is not known yet, or
+ * -EINVAL if there is no such camera.
+ */
+int ouvrt_tracker_get_camera_pose(OuvrtTracker *tracker, int index,
+				  struct dpose *pose)
+{
+	struct tracker_camera *camera;
+	int ret = -EAGAIN;
+
+	/* Keeps the camera from being removed meanwhile */
+	g_mutex_lock(&tracker->lock);
+	camera = ouvrt_tracker_get_camera(tracker, index);
+	if (!camera) {
+		g_mutex_unlock(&tracker->lock);
+		return -EINVAL;
+	}
+
+	g_mutex_lock(&camera->lock);
+	if (camera->extrinsics) {
+		*pose = camera->camera_pose;
+		ret = 0;
+	}
+	g_mutex_unlock(&camera->lock);
+	g_mutex_unlock(&tracker->lock);
+
+	return ret;
+}
+
+/*
+ * Notes whether the tracked device has been resting for a while, according
+ * to the angular velocity and acceleration of the fused state. Called from
+ * the IMU thread.
+ */
+static void ouvrt_tracker_update_rest(OuvrtTracker *tracker,
+				      const struct imu_state *state)
 {
-	leds_fini(&self->leds);
+	bool moving;
+
+	moving = vec3_norm(&state->angular_velocity) >
+		 TRACKER_REST_ANGULAR_VELOCITY ||
+		 vec3_norm(&state->linear_acceleration) >
+		 TRACKER_REST_ACCELERATION;
+	if (moving || tracker->moving)
+		tracker->rest_time = state->sample.time;
+	tracker->moving = moving;
+
+	__atomic_store_n(&tracker->resting, !moving &&
+			 state->sample.time - tracker->rest_time >=
+			 TRACKER_REST_TIME, __ATOMIC_RELEASE);
+}
+
+/*
+ * Updates the fused pose with an IMU sample taken at the given device time,
+ * in seconds, and appends the new state to the IMU state history. Optical
+ * poses queued by the cameras are applied first, in order of exposure time,
+ * so that the fusion filter is only ever updated from the IMU thread.
+ */
+void ouvrt_tracker_add_imu_sample(OuvrtTracker *tracker, double time,
+				  const struct imu_sample *sample)
+{
+	struct pose_event event;
+	struct imu_state state;
+	bool valid;
+
+	if (!tracker->fusion)
+		return;
+
+	g_mutex_lock(&tracker->fusion_lock);
+	while (pose_merger_pop(&tracker->pose_merger,
+			       time - TRACKER_POSE_REORDER_WINDOW, &event)) {
+		/* Late poses are applied by replaying the IMU samples */
+		fusion_add_pose(tracker->fusion, event.time, &event.pose);
+		if (event.time > tracker->pose_time)
+			tracker->pose_time = event.time;
+	}
+	fusion_add_imu_sample(tracker->fusion, time, sample);
+	valid = fusion_get_state(tracker->fusion, &state);
+	g_mutex_unlock(&tracker->fusion_lock);
+
+	if (valid && state.sample.time == time) {
+		ouvrt_tracker_update_rest(tracker, &state);
+		__atomic_store_n(&tracker->tracking,
+				 time - tracker->pose_time <
+				 TRACKER_TRACKING_TIMEOUT, __ATOMIC_RELEASE);
+		imu_history_push(&tracker->imu_history, &state);
+		pose_shm_write(__atomic_load_n(&tracker->pose_shm,
+					       __ATOMIC_ACQUIRE), &state);
+		latency_probe_pose_published(
+			ouvrt_tracker_get_latency_probe(tracker));
+	}
+}
+
+/*
+ * Looks up the fused IMU state at the given device time, in seconds,
+ * interpolating between samples. A negative time returns the most recent
+ * state. This does not block the IMU thread and may be called from any
+ * thread.
+ *
+ * Returns false if no state is available for the given time.
+ */
+bool ouvrt_tracker_get_imu_state(OuvrtTracker *tracker, double time,
+				 struct imu_state *state)
+{
+	if (time < 0.0)
+		return imu_history_get_latest(&tracker->imu_history, state);
+
+	return imu_history_lookup(&tracker->imu_history, time, state);
+}
+
+/*
+ * Stores the most recent fused pose in pose.
+ *
+ * Returns false if no pose is available yet.
+ */
+bool ouvrt_tracker_get_pose(OuvrtTracker *tracker, struct dpose *pose)
+{
+	struct imu_state state;
+
+	if (!imu_history_get_latest(&tracker->imu_history, &state))
+		return false;
+
+	*pose = state.pose;
+
+	return true;
+}
+
+/*
+ * Stores the world space pose of the given object in pose. For object 0,
+ * this is the most recent fused pose, for other objects it is the most recent
+ * optical pose.
+ *
+ * Returns false if no pose is available yet.
+ */
+bool ouvrt_tracker_get_object_pose(OuvrtTracker *tracker, int index,
+				   struct dpose *pose)
+{
+	struct tracker_object *object;
+	bool has_pose;
+
+	if (index == 0)
+		return ouvrt_tracker_get_pose(tracker, pose);
+	if (index < 0 || index >= tracker->num_objects)
+		return false;
+
+	object = &tracker->objects[index];
+	g_mutex_lock(&object->lock);
+	has_pose = object->has_pose;
+	if (has_pose)
+		*pose = object->pose;
+	g_mutex_unlock(&object->lock);
+
+	return has_pose;
+}
+
+/*
+ * Sets how far, in seconds, ouvrt_tracker_get_predicted_pose() extrapolates
+ * from the most recent IMU sample. This should cover the latency from IMU
+ * sample to photon emission of the display. The horizon is clamped to
+ * [0, TRACKER_MAX_PREDICTION], invalid values disable the prediction.
+ *
+ * Returns the horizon in effect.
+ */
+double ouvrt_tracker_set_prediction_horizon(OuvrtTracker *tracker,
+					    double horizon)
+{
+	if (!isfinite(horizon))
+		horizon = 0.0;
+	horizon = CLAMP(horizon, 0.0, TRACKER_MAX_PREDICTION);
+	__atomic_store(&tracker->prediction_horizon, &horizon,
+		       __ATOMIC_RELAXED);
+
+	return horizon;
+}
+
+/*
+ * Extrapolates the fused pose to the given device time, in seconds, using
+ * the angular and linear velocity of the most recent IMU state.
+ *
+ * Returns false if no pose is available yet.
+ */
+bool ouvrt_tracker_predict_pose(OuvrtTracker *tracker, double time,
+				struct dpose *pose)
+{
+	struct imu_state state;
+	double dt;
+
+	if (!imu_history_get_latest(&tracker->imu_history, &state))
+		return false;
+
+	dt = time - state.sample.time;
+	dt = isfinite(dt) ? CLAMP(dt, 0.0, TRACKER_MAX_PREDICTION) : 0.0;
+	imu_state_predict(&state, dt, pose);
+
+	return true;
+}
+
+/*
+ * Extrapolates the fused pose by the configured prediction horizon.
+ *
+ * Returns false if no pose is available yet.
+ */
+bool ouvrt_tracker_get_predicted_pose(OuvrtTracker *tracker,
+				      struct dpose *pose)
+{
+	struct imu_state state;
+	double horizon;
+
+	if (!imu_history_get_latest(&tracker->imu_history, &state))
+		return false;
+
+	__atomic_load(&tracker->prediction_horizon, &horizon,
+		      __ATOMIC_RELAXED);
+	imu_state_predict(&state, horizon, pose);
+
+	return true;
+}
+
+/*
+ * Predicts the camera space pose of the device at the exposure of a frame
+ * started at sof_time from the fused IMU state history.
+ *
+ * Returns false if the camera extrinsics or the fused state are unknown.
+ */
+static bool ouvrt_tracker_predict_camera_pose(OuvrtTracker *tracker,
+					      struct tracker_camera *camera,
+					      uint64_t sof_time, dquat *rot,
+					      dvec3 *trans)
+{
+	struct dpose *extrinsics = &camera->camera_pose;
+	dquat ext_inv = { -extrinsics->rotation.x, -extrinsics->rotation.y,
+			  -extrinsics->rotation.z, extrinsics->rotation.w };
+	struct imu_state state;
+	dvec3 t;
+
+	if (!camera->extrinsics)
+		return false;
+
+	if (!imu_history_lookup(&tracker->imu_history,
+				ouvrt_tracker_exposure_time(tracker, sof_time),
+				&state))
+		return false;
+
+	dquat_mult(rot, &ext_inv, &state.pose.rotation);
+	dquat_normalize(rot);
+	t.x = state.pose.translation.x - extrinsics->translation.x;
+	t.y = state.pose.translation.y - extrinsics->translation.y;
+	t.z = state.pose.translation.z - extrinsics->translation.z;
+	dquat_rotate(trans, &ext_inv, &t);
+
+	return true;
+}
+
+/*
+ * Projects the LED with the given model point and normal at a camera space
+ * pose into the image.
+ *
+ * Returns false if the LED is behind the camera or faces away from it.
+ */
+static bool ouvrt_tracker_project_led(const dmat3 *camera_matrix,
+				      const struct distortion *distortion,
+				      const dquat *rot, const dvec3 *trans,
+				      const vec3 *point, const vec3 *normal,
+				      float *u, float *v)
+{
+	const dvec3 op = { point->x, point->y, point->z };
+	const dvec3 on = { normal->x, normal->y, normal->z };
+	dvec3 p, n;
+	double x, y;
+
+	dquat_rotate(&p, rot, &op);
+	p.x += trans->x;
+	p.y += trans->y;
+	p.z += trans->z;
+	if (p.z <= 0.0)
+		return false;
+
+	dquat_rotate(&n, rot, &on);
+	if (dvec3_dot(&n, &p) >= 0.0)
+		return false;
+
+	distortion_distort(distortion, p.x / p.z, p.y / p.z, &x, &y);
+	*u = camera_matrix->m[0] * x + camera_matrix->m[2];
+	*v = camera_matrix->m[4] * y + camera_matrix->m[5];
+
+	return true;
+}
+
+/*
+ * Predicts how the LEDs of the tracked device move in the image between the
+ * last frame and the frame started at sof_time, from the device motion
+ * integrated by the IMU, and hands the shifts to the blob tracker to guide
+ * the search and association of blobs during fast rotations.
+ */
+static void ouvrt_tracker_predict_blob_motion(OuvrtTracker *tracker,
+					      struct tracker_camera *camera,
+					      struct leds *leds,
+					      uint64_t sof_time,
+					      const dmat3 *camera_matrix,
+					      const struct distortion *distortion)
+{
+	struct blobwatch_led_shift shifts[BLOBWATCH_MAX_LED_SHIFTS];
+	uint64_t last_sof_time = camera->last_sof_time;
+	dquat rot0, rot1;
+	dvec3 trans0, trans1;
+	int num_leds = 0;
+	int i;
+
+	camera->last_sof_time = sof_time;
+
+	if (leds && camera_matrix && last_sof_time &&
+	    ouvrt_tracker_predict_camera_pose(tracker, camera, last_sof_time,
+					      &rot0, &trans0) &&
+	    ouvrt_tracker_predict_camera_pose(tracker, camera, sof_time,
+					      &rot1, &trans1))
+		num_leds = MIN((int)leds->model.num_points,
+			       BLOBWATCH_MAX_LED_SHIFTS);
+
+	for (i = 0; i < num_leds; i++) {
+		const vec3 *point = &leds->model.points[i];
+		const vec3 *normal = &leds->model.normals[i];
+		struct blobwatch_led_shift *shift = &shifts[i];
+		float u, v;
+
+		shift->valid = ouvrt_tracker_project_led(camera_matrix,
+							 distortion, &rot0,
+							 &trans0, point,
+							 normal, &shift->x,
+							 &shift->y) &&
+			       ouvrt_tracker_project_led(camera_matrix,
+							 distortion, &rot1,
+							 &trans1, point,
+							 normal, &u, &v);
+		shift->dx = shift->valid ? u - shift->x : 0.0f;
+		shift->dy = shift->valid ? v - shift->y : 0.0f;
+	}
+
+	blobwatch_set_led_shifts(camera->bw, 0, shifts, num_leds);
+}
+
+/*
+ * Transforms a camera space pose into world space using the camera
+ * extrinsics.
+ */
+static void ouvrt_tracker_camera_to_world(struct tracker_camera *camera,
+					  const dquat *rot, const dvec3 *trans,
+					  struct dpose *pose)
+{
+	struct dpose *extrinsics = &camera->camera_pose;
+
+	dquat_mult(&pose->rotation, &extrinsics->rotation, rot);
+	dquat_rotate(&pose->translation, &extrinsics->rotation, trans);
+	pose->translation.x += extrinsics->translation.x;
+	pose->translation.y += extrinsics->translation.y;
+	pose->translation.z += extrinsics->translation.z;
+}
+
+/*
+ * Queues the optical pose measured at the given device time, in seconds, by
+ * the camera with the given index, to correct the fused pose of the tracked
+ * device. Must only be called from the jobs processing that camera's frames.
+ */
+static void ouvrt_tracker_queue_pose(OuvrtTracker *tracker, int index,
+				     double time, const struct dpose *pose)
+{
+	struct pose_event event = {
+		.time = time,
+		.pose = *pose,
+	};
+
+	if (!pose_merger_push(&tracker->pose_merger, index, &event))
+		log_ratelimited("Tracker: Dropped optical pose of camera %d\n",
+				index);
+}
+
+/*
+ * Corrects the fused pose with the optical pose of the device in camera
+ * space, measured at the exposure of a frame started at sof_time. The
+ * camera pose in world space is initialized from the first measurement.
+ */
+static void ouvrt_tracker_correct_pose(OuvrtTracker *tracker,
+				       struct tracker_camera *camera,
+				       int index, uint64_t sof_time,
+				       const dquat *rot, const dvec3 *trans)
+{
+	struct dpose extrinsics;
+	struct dpose pose;
+	double time;
+
+	if (!tracker->fusion)
+		return;
+
+	time = ouvrt_tracker_exposure_time(tracker, sof_time);
+
+	if (!camera->extrinsics) {
+		dquat rot_inv = { -rot->x, -rot->y, -rot->z, rot->w };
+		struct imu_state state;
+		dvec3 t;
+
+		if (!imu_history_lookup(&tracker->imu_history, time, &state))
+			return;
+		pose = state.pose;
+
+		dquat_mult(&extrinsics.rotation, &pose.rotation, &rot_inv);
+		dquat_normalize(&extrinsics.rotation);
+		dquat_rotate(&t, &extrinsics.rotation, trans);
+		extrinsics.translation.x = pose.translation.x - t.x;
+		extrinsics.translation.y = pose.translation.y - t.y;
+		extrinsics.translation.z = pose.translation.z - t.z;
+
+		g_mutex_lock(&camera->lock);
+		camera->camera_pose = extrinsics;
+		camera->extrinsics = true;
+		g_mutex_unlock(&camera->lock);
+	}
+
+	ouvrt_tracker_camera_to_world(camera, rot, trans, &pose);
+	ouvrt_tracker_queue_pose(tracker, index, time, &pose);
+
+	latency_probe_optical_pose(ouvrt_tracker_get_latency_probe(tracker),
+				   sof_time);
+}
+
+/*
+ * Notes whether the blobs of a processed frame moved or appeared, which
+ * restores the full optical rate for objects without IMU.
+ */
+static void ouvrt_tracker_update_blob_motion(struct tracker_camera *camera,
+					     const struct blobservation *ob)
+{
+	int i;
+
+	for (i = 0; i < ob->num_blobs; i++) {
+		const struct blob *b = &ob->blobs[i];
+
+		if (b->age == 0 || abs(b->vx) >= TRACKER_REST_BLOB_MOTION ||
+		    abs(b->vy) >= TRACKER_REST_BLOB_MOTION)
+			break;
+	}
+	__atomic_store_n(&camera->blob_motion, i < ob->num_blobs,
+			 __ATOMIC_RELEASE);
+}
+
+/*
+ * Detects blobs in a full frame started at sof_time and compares them with
+ * the observation history.
+ */
+static void ouvrt_tracker_detect_blobs(OuvrtTracker *tracker,
+				       struct tracker_camera *camera,
+				       uint8_t *frame, uint64_t sof_time,
+				       const dmat3 *camera_matrix,
+				       const struct distortion *distortion,
+				       struct blobservation **ob)
+{
+	struct leds *leds[TRACKER_MAX_OBJECTS];
+	uint8_t led_pattern_phase;
+	int num_objects;
+	int num_blobs;
+
+	led_pattern_phase = ouvrt_tracker_led_pattern_phase(tracker, sof_time);
+	num_objects = ouvrt_tracker_get_leds(tracker, leds);
+
+	g_mutex_lock(&camera->lock);
+	ouvrt_tracker_update_camera_params(tracker, camera);
+	ouvrt_tracker_update_scan_params(tracker, camera);
+	ouvrt_tracker_predict_blob_motion(tracker, camera,
+					  num_objects ? leds[0] : NULL,
+					  sof_time, camera_matrix, distortion);
+	/*
+	 * The GPU only collects bright runs, which skips the background mask
+	 * and region of interest tracking. Fall back to the CPU on errors.
+	 */
+	if (camera->cl &&
+	    opencl_compute_find_runs(camera->cl, frame,
+				     camera->width * camera->height,
+				     camera->params.threshold,
+				     camera->params.min_extent_length,
+				     camera->runs, camera->num_runs) == 0) {
+		num_blobs = blobwatch_process_runs(camera->bw, camera->runs,
+						   OPENCL_MAX_RUNS_PER_LINE,
+						   camera->num_runs,
+						   camera->blobs);
+		blobwatch_process_blobs(camera->bw, camera->blobs, num_blobs,
+					led_pattern_phase, leds, num_objects,
+					ob);
+	} else {
+		blobwatch_process(camera->bw, frame, camera->width,
+				  camera->height, led_pattern_phase, leds,
+				  num_objects, ob);
+	}
+	g_mutex_unlock(&camera->lock);
+
+	if (*ob) {
+		ouvrt_tracker_update_blob_motion(camera, *ob);
+		latency_probe_frame(ouvrt_tracker_get_latency_probe(tracker),
+				    sof_time, (*ob)->blobs, (*ob)->num_blobs);
+	}
+}
+
+/*
+ * Returns true if the camera may skip blob detection and pose estimation on
+ * a frame started at sof_time, because the tracked device has been resting
+ * for a while according to its IMU, and the blobs did not move in the last
+ * processed frame. Resting devices are tracked at a reduced optical rate.
+ * Must be called from the thread that submits the camera's frames, before
+ * any tracking work on the frame.
+ */
+bool ouvrt_tracker_skip_frame(OuvrtTracker *tracker, int index,
+			      uint64_t sof_time)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+
+	if (!camera)
+		return false;
+
+	if (__atomic_load_n(&tracker->resting, __ATOMIC_ACQUIRE) &&
+	    !__atomic_load_n(&camera->blob_motion, __ATOMIC_ACQUIRE) &&
+	    sof_time - camera->last_processed_sof_time <
+	    TRACKER_REST_FRAME_INTERVAL)
+		return true;
+
+	camera->last_processed_sof_time = sof_time;
+
+	return false;
+}
+
+/*
+ * Starts incremental blob detection on a frame that is still being received.
+ * The incremental detection functions must only be called from a single
+ * thread per camera.
+ */
+void ouvrt_tracker_begin_frame(OuvrtTracker *tracker, int index,
+			       uint8_t *frame)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+
+	if (!camera)
+		return;
+
+	ouvrt_tracker_update_scan_params(tracker, camera);
+	blobwatch_begin_frame(camera->bw, frame);
+}
+
+/*
+ * Detects blobs in the first num_lines complete lines of the current frame.
+ */
+void ouvrt_tracker_process_lines(OuvrtTracker *tracker, int index,
+				 int num_lines)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+
+	if (camera)
+		blobwatch_process_lines(camera->bw, num_lines);
+}
+
+/*
+ * Finishes incremental blob detection after the last line was received and
+ * stores the detected blobs in the array blobs, which must be able to hold
+ * ouvrt_tracker_get_max_blobs() elements.
+ *
+ * Returns the number of blobs detected.
+ */
+int ouvrt_tracker_end_frame(OuvrtTracker *tracker, int index,
+			    struct blob *blobs)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+
+	if (!camera)
+		return 0;
+
+	return blobwatch_end_frame(camera->bw, blobs);
+}
+
+/*
+ * Returns the maximum number of blobs detected per frame by the camera.
+ */
+int ouvrt_tracker_get_max_blobs(OuvrtTracker *tracker, int index)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+
+	if (!camera)
+		return 0;
+
+	return blobwatch_get_max_blobs(camera->bw);
+}
+
+/*
+ * Tracks blobs detected in a frame started at sof_time over time.
+ */
+void ouvrt_tracker_track_blobs(OuvrtTracker *tracker, int index,
+			       struct blob *blobs, int num_blobs,
+			       uint64_t sof_time, const dmat3 *camera_matrix,
+			       const struct distortion *distortion,
+			       struct blobservation **ob)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+	struct leds *leds[TRACKER_MAX_OBJECTS];
+	uint8_t led_pattern_phase;
+	int num_objects;
+
+	if (!camera) {
+		*ob = NULL;
+		return;
+	}
+
+	led_pattern_phase = ouvrt_tracker_led_pattern_phase(tracker, sof_time);
+	num_objects = ouvrt_tracker_get_leds(tracker, leds);
+
+	g_mutex_lock(&camera->lock);
+	ouvrt_tracker_update_camera_params(tracker, camera);
+	ouvrt_tracker_predict_blob_motion(tracker, camera,
+					  num_objects ? leds[0] : NULL,
+					  sof_time, camera_matrix, distortion);
+	blobwatch_process_blobs(camera->bw, blobs, num_blobs,
+				led_pattern_phase, leds, num_objects, ob);
+	g_mutex_unlock(&camera->lock);
+
+	if (*ob) {
+		ouvrt_tracker_update_blob_motion(camera, *ob);
+		latency_probe_frame(ouvrt_tracker_get_latency_probe(tracker),
+				    sof_time, (*ob)->blobs, (*ob)->num_blobs);
+	}
+}
+
+/*
+ * Refines the last pose of the object with the blobs identified as its LEDs.
+ *
+ * Returns the number of inliers, or a negative error code if the last pose
+ * does not explain the blobs anymore.
+ */
+static int ouvrt_tracker_refine_pose(struct tracker_object_camera *state,
+				     int object_id, struct leds *leds,
+				     struct blob *blobs, int num_blobs,
+				     dmat3 *camera_matrix,
+				     const struct distortion *distortion)
+{
+	struct pnp_problem pnp;
+	dquat rot = state->rot;
+	dvec3 trans = state->trans;
+	bool inliers[PNP_MAX_POINTS];
+	double error;
+	int num_inliers;
+
+	if (pnp_problem_init(&pnp, blobs, num_blobs, object_id,
+			     leds->model.points, leds->model.num_points,
+			     camera_matrix, distortion) < 4)
+		return -EINVAL;
+
+	/*
+	 * Only refine using blobs that are close to where the last pose would
+	 * project their LEDs, so that misidentified blobs don't pull it away.
+	 */
+	num_inliers = pnp_count_inliers(&pnp, &rot, &trans,
+					TRACKER_INLIER_DISTANCE, inliers);
+	if (num_inliers < 4 || 2 * num_inliers < pnp.num_points)
+		return -ERANGE;
+
+	error = pnp_refine(&pnp, &rot, &trans, inliers,
+			   TRACKER_REFINE_ITERATIONS);
+	if (error > TRACKER_MAX_REPROJECTION_ERROR)
+		return -ERANGE;
+
+	state->rot = rot;
+	state->trans = trans;
+
+	return num_inliers;
+}
+
+/*
+ * Refines the pose of a single object while tracking, and starts a full pose
+ * search initially or if the refined pose exceeds the reprojection error
+ * threshold. This only reads the blobs, so that the solves of multiple
+ * objects can run in parallel.
+ */
+static void ouvrt_tracker_solve(struct tracker_solve *solve)
+{
+	struct tracker_object_camera *state = solve->state;
+	struct leds *leds = &solve->object->leds;
+	int ret = -EINVAL;
+
+	if (state->tracking) {
+		ret = ouvrt_tracker_refine_pose(state, solve->object_id, leds,
+						solve->blobs, solve->num_blobs,
+						solve->camera_matrix,
+						solve->distortion);
+	}
+
+	solve->acquired = false;
+	if (ret < 0) {
+		/*
+		 * Estimate initial pose without previously known
+		 * [rot|trans].
+		 */
+		ret = estimate_pose(solve->blobs, solve->num_blobs,
+				    solve->object_id, leds->model.points,
+				    leds->model.num_points,
+				    solve->camera_matrix, solve->distortion,
+				    &solve->params, &state->rot, &state->trans,
+				    false);
+		/*
+		 * Without enough LEDs identified by their blinking patterns,
+		 * match the blob constellation against the LED model.
+		 */
+		if (ret < 0) {
+			ret = constellation_search(solve->object->constellation,
+						   solve->blobs,
+						   solve->num_blobs,
+						   solve->object_id,
+						   solve->camera_matrix,
+						   solve->distortion,
+						   &state->rot, &state->trans);
+		}
+		state->tracking = ret >= 0;
+		solve->acquired = state->tracking;
+	}
+
+	solve->ret = ret;
+}
+
+static void ouvrt_tracker_solve_job(void *data)
+{
+	ouvrt_tracker_solve(data);
+}
+
+/*
+ * Runs the pose solves of all objects as jobs, running the first on the
+ * calling thread, and waits until they are finished.
+ */
+static void ouvrt_tracker_run_solves(struct tracker_solve *solves,
+				     int num_solves)
+{
+	int i;
+
+	if (num_solves == 0)
+		return;
+
+	for (i = 1; i < num_solves; i++) {
+		job_init(&solves[i].job, ouvrt_tracker_solve_job, &solves[i]);
+		job_submit(&solves[i].job);
+	}
+
+	ouvrt_tracker_solve(&solves[0]);
+
+	for (i = 1; i < num_solves; i++)
+		job_wait(&solves[i].job);
+}
+
+/*
+ * Hands the views of the tracked device in an exposure seen by multiple
+ * cameras, with its jointly refined pose, to the background calibration.
+ */
+static void ouvrt_tracker_add_calibration(OuvrtTracker *tracker,
+					  const struct tracker_observation *obs,
+					  const struct dpose *pose)
+{
+	struct extrinsics_view views[TRACKER_MAX_CAMERAS];
+	int i;
+
+	for (i = 0; i < obs->num_views; i++) {
+		const struct tracker_view *v = &obs->views[i];
+
+		views[i].camera = v->camera;
+		views[i].camera_pose = v->camera_pose;
+		views[i].rot = v->rot;
+		views[i].trans = v->trans;
+		views[i].num_inliers = v->num_inliers;
+	}
+
+	extrinsics_add_observation(tracker->extrinsics, views, obs->num_views,
+				   pose);
+}
+
+/*
+ * Applies the observations of an object in a single exposure. If multiple
+ * cameras observed the object, its world space pose is refined jointly over
+ * the blobs in all cameras, starting from the pose seen by the camera with
+ * the most inliers. The pose of the tracked device itself corrects the IMU
+ * sensor fusion filter at the time of exposure.
+ */
+static void ouvrt_tracker_apply_observation(OuvrtTracker *tracker,
+					    int object_id, int index,
+					    struct tracker_observation *obs)
+{
+	struct tracker_object *object = &tracker->objects[object_id];
+	struct tracker_view *best = &obs->views[0];
+	struct dpose pose;
+	int i;
+
+	for (i = 1; i < obs->num_views; i++) {
+		if (obs->views[i].num_inliers > best->num_inliers)
+			best = &obs->views[i];
+	}
+	pose = best->pose;
+
+	if (obs->num_views > 1) {
+		struct pnp_view views[TRACKER_MAX_CAMERAS];
+		dquat rot = pose.rotation;
+		dvec3 trans = pose.translation;
+		double error;
+
+		for (i = 0; i < obs->num_views; i++) {
+			struct tracker_view *v = &obs->views[i];
+
+			views[i].pnp = &v->pnp;
+			views[i].inliers = v->inliers;
+			views[i].camera_rotation = v->camera_pose.rotation;
+			views[i].camera_translation = v->camera_pose.translation;
+		}
+
+		error = pnp_refine_views(views, obs->num_views, &rot, &trans,
+					 TRACKER_REFINE_ITERATIONS);
+		if (error <= TRACKER_MAX_REPROJECTION_ERROR) {
+			pose.rotation = rot;
+			pose.translation = trans;
+			if (object_id == 0)
+				ouvrt_tracker_add_calibration(tracker, obs,
+							      &pose);
+		}
+	}
+
+	if (object_id == 0) {
+		ouvrt_tracker_queue_pose(tracker, index, obs->time, &pose);
+		return;
+	}
+
+	g_mutex_lock(&object->lock);
+	object->pose = pose;
+	object->has_pose = true;
+	g_mutex_unlock(&object->lock);
+}
+
+/*
+ * Switches the camera to its latest refined pose, if the background
+ * calibration updated it. Called at the start of the pose solves.
+ */
+static void ouvrt_tracker_update_camera_extrinsics(OuvrtTracker *tracker,
+						   struct tracker_camera *camera,
+						   int index)
+{
+	struct dpose pose;
+
+	if (!camera->extrinsics ||
+	    !extrinsics_get_camera(tracker->extrinsics, index, &pose,
+				   &camera->extrinsics_generation))
+		return;
+
+	g_mutex_lock(&camera->lock);
+	camera->camera_pose = pose;
+	g_mutex_unlock(&camera->lock);
+}
+
+/*
+ * Adds the camera space pose of an object, observed by a camera with known
+ * extrinsics in a frame started at sof_time, to the observations of the
+ * same exposure by other cameras. Observations are applied once all cameras
+ * that saw the object in the previous exposure have reported, or when the
+ * first observation of a later exposure arrives.
+ */
+static void ouvrt_tracker_add_observation(OuvrtTracker *tracker,
+					  int object_id,
+					  struct tracker_camera *camera,
+					  int index, uint64_t sof_time,
+					  struct blob *blobs, int num_blobs,
+					  dmat3 *camera_matrix,
+					  const struct distortion *distortion,
+					  const dquat *rot, const dvec3 *trans)
+{
+	struct tracker_object *object = &tracker->objects[object_id];
+	struct tracker_observation *obs = &object->observation;
+	struct tracker_observation ready;
+	struct tracker_exposure exposure;
+	struct tracker_view *view;
+	bool flush_late = false;
+	bool flush = false;
+	dquat r = *rot;
+	dvec3 t = *trans;
+	double time;
+
+	if (!camera->extrinsics)
+		return;
+
+	if (!ouvrt_tracker_find_exposure(tracker, sof_time, &exposure))
+		exposure.device_timestamp = 0;
+	time = ouvrt_tracker_exposure_time(tracker, sof_time);
+
+	g_mutex_lock(&object->lock);
+
+	if (object->seen_timestamp != exposure.device_timestamp) {
+		object->camera_mask = object->seen_mask;
+		object->seen_timestamp = exposure.device_timestamp;
+		object->seen_mask = 0;
+	}
+	object->seen_mask |= 1 << index;
+
+	if (obs->num_views &&
+	    (obs->device_timestamp != exposure.device_timestamp ||
+	     obs->camera_mask & (1 << index))) {
+		/* A later exposure arrived before all cameras reported */
+		ready = *obs;
+		obs->num_views = 0;
+		flush_late = true;
+	}
+	if (obs->num_views == 0) {
+		obs->device_timestamp = exposure.device_timestamp;
+		obs->time = time;
+		obs->camera_mask = 0;
+	}
+
+	view = &obs->views[obs->num_views];
+	view->camera = index;
+	view->rot = *rot;
+	view->trans = *trans;
+	view->camera_pose = camera->camera_pose;
+	ouvrt_tracker_camera_to_world(camera, rot, trans, &view->pose);
+	pnp_problem_init(&view->pnp, blobs, num_blobs, object_id,
+			 object->leds.model.points,
+			 object->leds.model.num_points, camera_matrix,
+			 distortion);
+	view->num_inliers = pnp_count_inliers(&view->pnp, &r, &t,
+					      TRACKER_INLIER_DISTANCE,
+					      view->inliers);
+	obs->num_views++;
+	obs->camera_mask |= 1 << index;
+
+	g_mutex_unlock(&object->lock);
+
+	if (flush_late)
+		ouvrt_tracker_apply_observation(tracker, object_id, index,
+						&ready);
+
+	g_mutex_lock(&object->lock);
+	if (obs->num_views &&
+	    (obs->camera_mask & object->camera_mask) == object->camera_mask) {
+		ready = *obs;
+		obs->num_views = 0;
+		flush = true;
+	}
+	g_mutex_unlock(&object->lock);
+
+	if (flush)
+		ouvrt_tracker_apply_observation(tracker, object_id, index,
+						&ready);
+}
+
+/*
+ * Prepares the pose solves of all tracked objects in a frame started at
+ * sof_time. While tracking, blobs not yet identified by their blinking
+ * pattern are assigned to the closest LED projected at the pose predicted
+ * from the IMU state at exposure time, or at the last pose.
+ *
+ * Returns the number of solves.
+ */
+static int ouvrt_tracker_identify_blobs(OuvrtTracker *tracker,
+					struct tracker_camera *camera,
+					int index, struct blob *blobs,
+					int num_blobs, uint64_t sof_time,
+					dmat3 *camera_matrix,
+					const struct distortion *distortion,
+					struct tracker_solve *solves)
+{
+	int num_objects, num_solves = 0;
+	int i;
+
+	num_objects = __atomic_load_n(&tracker->num_objects, __ATOMIC_ACQUIRE);
+	for (i = 0; i < num_objects; i++) {
+		struct tracker_object *object = &tracker->objects[i];
+		struct tracker_object_camera *state = &object->cameras[index];
+		struct tracker_solve *solve = &solves[num_solves];
+
+		if (!__atomic_load_n(&object->active, __ATOMIC_ACQUIRE))
+			continue;
+
+		/*
+		 * Predict the pose at the time of exposure from the IMU, which
+		 * also allows to reacquire the pose after tracking was lost.
+		 */
+		if (i == 0 &&
+		    ouvrt_tracker_predict_camera_pose(tracker, camera,
+						      sof_time, &state->rot,
+						      &state->trans))
+			state->tracking = true;
+
+		/*
+		 * Identify blobs sequentially, in object order, before the
+		 * solves run in parallel.
+		 */
+		if (state->tracking) {
+			reprojection_identify_blobs(camera->rp, i,
+						    &object->leds, blobs,
+						    num_blobs, camera_matrix,
+						    distortion, &state->rot,
+						    &state->trans);
+		}
+
+		solve->object = object;
+		solve->state = state;
+		solve->object_id = i;
+		solve->blobs = blobs;
+		solve->num_blobs = num_blobs;
+		solve->camera_matrix = camera_matrix;
+		solve->distortion = distortion;
+		solve->params = camera->params.pnp;
+		num_solves++;
+	}
+
+	return num_solves;
+}
+
+/*
+ * Combines the results of finished pose solves with the observations of the
+ * same exposure by other cameras. The pose of the tracked device itself
+ * corrects the IMU sensor fusion filter at the time of exposure, and its
+ * camera space pose is returned in rot and trans.
+ *
+ * Returns the number of inliers of the tracked device, or a negative error
+ * code if its pose could not be found.
+ */
+static int ouvrt_tracker_fuse_solves(OuvrtTracker *tracker,
+				     struct tracker_camera *camera, int index,
+				     struct tracker_solve *solves,
+				     int num_solves, struct blob *blobs,
+				     int num_blobs, uint64_t sof_time,
+				     dmat3 *camera_matrix,
+				     const struct distortion *distortion,
+				     dquat *rot, dvec3 *trans)
+{
+	int ret = -EINVAL;
+	int i;
+
+	for (i = 0; i < num_solves; i++) {
+		struct tracker_solve *solve = &solves[i];
+		struct tracker_object_camera *state = solve->state;
+
+		if (solve->ret < 0)
+			continue;
+
+		if (solve->acquired) {
+			reprojection_identify_blobs(camera->rp,
+						    solve->object_id,
+						    &solve->object->leds, blobs,
+						    num_blobs, camera_matrix,
+						    distortion, &state->rot,
+						    &state->trans);
+		}
+
+		/*
+		 * The first pose of the tracked device seen by a camera
+		 * determines the camera extrinsics.
+		 */
+		if (solve->object_id == 0 && !camera->extrinsics) {
+			ouvrt_tracker_correct_pose(tracker, camera, index,
+						   sof_time, &state->rot,
+						   &state->trans);
+		} else {
+			ouvrt_tracker_add_observation(tracker, solve->object_id,
+						      camera, index, sof_time,
+						      blobs, num_blobs,
+						      camera_matrix,
+						      distortion, &state->rot,
+						      &state->trans);
+		}
+
+		if (solve->object_id != 0)
+			continue;
+
+		*rot = state->rot;
+		*trans = state->trans;
+		ret = solve->ret;
+	}
+
+	return ret;
+}
+
+/*
+ * Estimates the camera space poses of all tracked objects from the blobs
+ * identified as their LEDs. While tracking, blobs are identified at the
+ * predicted or last pose, and these poses are then refined with a few
+ * iterations. A full pose search is only started initially and if the
+ * refined pose exceeds the reprojection error threshold. The solves of
+ * multiple objects run in parallel on the same blobs. The resulting poses
+ * are combined with the observations of the same exposure by other cameras,
+ * and the pose of the tracked device itself corrects the IMU sensor fusion
+ * filter at the time of exposure. Its camera space pose is returned in rot
+ * and trans.
+ *
+ * Returns the number of inliers of the tracked device, or a negative error
+ * code if its pose could not be found.
+ */
+int ouvrt_tracker_process_blobs(OuvrtTracker *tracker, int index,
+				struct blob *blobs, int num_blobs,
+				uint64_t sof_time, dmat3 *camera_matrix,
+				const struct distortion *distortion,
+				dquat *rot, dvec3 *trans)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+	struct tracker_solve solves[TRACKER_MAX_OBJECTS];
+	int num_solves;
+
+	if (!camera)
+		return -EINVAL;
+
+	ouvrt_tracker_update_camera_extrinsics(tracker, camera, index);
+
+	num_solves = ouvrt_tracker_identify_blobs(tracker, camera, index,
+						  blobs, num_blobs, sof_time,
+						  camera_matrix, distortion,
+						  solves);
+	ouvrt_tracker_run_solves(solves, num_solves);
+
+	return ouvrt_tracker_fuse_solves(tracker, camera, index, solves,
+					 num_solves, blobs, num_blobs,
+					 sof_time, camera_matrix, distortion,
+					 rot, trans);
+}
+
+static void ouvrt_tracker_detect_job(void *data)
+{
+	struct tracker_frame *f = data;
+	struct tracker_camera *camera = &f->tracker->cameras[f->index];
+
+	ouvrt_tracker_detect_blobs(f->tracker, camera, f->frame, f->sof_time,
+				   f->camera_matrix, f->distortion, &f->ob);
+}
+
+/*
+ * Identifies the detected blobs and starts the pose solves of all objects,
+ * followed by the fusion job once all solves are finished.
+ */
+static void ouvrt_tracker_identify_job(void *data)
+{
+	struct tracker_frame *f = data;
+	struct tracker_camera *camera = &f->tracker->cameras[f->index];
+	int i;
+
+	f->num_solves = 0;
+	if (f->ob) {
+		f->num_solves = ouvrt_tracker_identify_blobs(f->tracker, camera,
+				f->index, f->ob->blobs, f->ob->num_blobs,
+				f->sof_time, f->camera_matrix, f->distortion,
+				f->solves);
+	}
+
+	for (i = 0; i < f->num_solves; i++) {
+		job_init(&f->solves[i].job, ouvrt_tracker_solve_job,
+			 &f->solves[i]);
+		job_add_dependency(&f->fuse, &f->solves[i].job);
+	}
+	for (i = 0; i < f->num_solves; i++)
+		job_submit(&f->solves[i].job);
+	job_submit(&f->fuse);
+}
+
+/*
+ * Applies the poses found in the frame and reports the result.
+ */
+static void ouvrt_tracker_fuse_job(void *data)
+{
+	struct tracker_frame *f = data;
+	struct tracker_camera *camera = &f->tracker->cameras[f->index];
+	dquat rot;
+	dvec3 trans;
+	int ret = -EINVAL;
+
+	if (f->ob) {
+		ret = ouvrt_tracker_fuse_solves(f->tracker, camera, f->index,
+						f->solves, f->num_solves,
+						f->ob->blobs, f->ob->num_blobs,
+						f->sof_time, f->camera_matrix,
+						f->distortion, &rot, &trans);
+	}
+
+	if (f->done) {
+		f->done(f->ob, ret >= 0 ? &rot : NULL,
+			ret >= 0 ? &trans : NULL, f->data);
+	}
+}
+
+/*
+ * Submits a full frame started at sof_time for blob detection, LED
+ * identification, and pose estimation of all tracked objects, using the
+ * camera's intrinsic parameters. The stages run as jobs on the shared
+ * worker threads, and frames of different cameras are processed in
+ * parallel. Frames of the same camera are processed in order, one after
+ * another. Once the frame is processed, done is called from a worker thread
+ * with the observation, the camera space pose of the tracked device if it
+ * was found, and data. The frame must stay valid until then.
+ *
+ * If there are too many frames of this camera in flight, this waits for the
+ * oldest one to finish, running other jobs in the meantime. Frames of a
+ * camera must only be submitted from a single thread.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int ouvrt_tracker_process_frame(OuvrtTracker *tracker, int index,
+				uint8_t *frame, uint64_t sof_time,
+				dmat3 *camera_matrix,
+				const struct distortion *distortion,
+				ouvrt_tracker_frame_func done, void *data)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+	struct tracker_frame *prev;
+	struct tracker_frame *f;
+
+	if (!camera)
+		return -EINVAL;
+
+	f = &camera->frames[camera->next_frame];
+	prev = &camera->frames[(camera->next_frame +
+				TRACKER_MAX_FRAMES_IN_FLIGHT - 1) %
+			       TRACKER_MAX_FRAMES_IN_FLIGHT];
+	if (f->in_flight)
+		job_wait(&f->fuse);
+
+	f->tracker = tracker;
+	f->index = index;
+	f->frame = frame;
+	f->sof_time = sof_time;
+	f->camera_matrix = camera_matrix;
+	f->distortion = distortion;
+	f->done = done;
+	f->data = data;
+	f->ob = NULL;
+	job_init(&f->detect, ouvrt_tracker_detect_job, f);
+	job_init(&f->identify, ouvrt_tracker_identify_job, f);
+	job_init(&f->fuse, ouvrt_tracker_fuse_job, f);
+
+	/*
+	 * Blob tracking and identification modify the observation history
+	 * that the next frame is compared against, so each frame waits for
+	 * the previous one.
+	 */
+	if (prev->in_flight)
+		job_add_dependency(&f->detect, &prev->fuse);
+	job_add_dependency(&f->identify, &f->detect);
+
+	f->in_flight = true;
+	camera->next_frame = (camera->next_frame + 1) %
+			     TRACKER_MAX_FRAMES_IN_FLIGHT;
+
+	job_submit(&f->identify);
+	job_submit(&f->detect);
+
+	return 0;
+}
+
+/*
+ * Waits until all frames submitted for the camera are processed.
+ */
+void ouvrt_tracker_flush_frames(OuvrtTracker *tracker, int index)
+{
+	struct tracker_camera *camera = ouvrt_tracker_get_camera(tracker,
+								 index);
+	int i;
+
+	if (!camera)
+		return;
+
+	for (i = 0; i < TRACKER_MAX_FRAMES_IN_FLIGHT; i++) {
+		if (camera->frames[i].in_flight)
+			job_wait(&camera->frames[i].fuse);
+	}
+}
+
+static void ouvrt_tracker_finalize(GObject *object)
+{
+	OuvrtTracker *self = OUVRT_TRACKER(object);
+	int i;
+
+	for (i = 0; i < self->num_cameras; i++) {
+		if (!self->cameras[i].in_use)
+			continue;
+		ouvrt_tracker_flush_frames(self, i);
+		ouvrt_tracker_free_camera(&self->cameras[i]);
+	}
+	for (i = 0; i < TRACKER_MAX_OBJECTS; i++) {
+		leds_fini(&self->objects[i].leds);
+		constellation_free(self->objects[i].constellation);
+		g_mutex_clear(&self->objects[i].lock);
+	}
+	extrinsics_free(self->extrinsics);
+	fusion_free(self->fusion);
+	debug_imu_fifo_free(self->debug_imu_fifo);
+	pose_shm_free(self->pose_shm);
+	latency_probe_free(self->latency_probe);
+	g_mutex_clear(&self->fusion_lock);
+	g_mutex_clear(&self->lock);
+	G_OBJECT_CLASS(ouvrt_tracker_parent_class)->finalize(object);
+}
+
+static void ouvrt_tracker_class_init(OuvrtTrackerClass *klass)
+{
+	G_OBJECT_CLASS(klass)->finalize = ouvrt_tracker_finalize;
+}
+
+static void ouvrt_tracker_init(OuvrtTracker *self)
+{
+	int i;
+
+	g_mutex_init(&self->lock);
+	g_mutex_init(&self->fusion_lock);
+	self->fusion = fusion_new();
+	pose_merger_init(&self->pose_merger);
+	self->pose_time = -INFINITY;
+	self->extrinsics = extrinsics_new();
+	imu_history_init(&self->imu_history);
+	self->debug_imu_fifo = debug_imu_fifo_new(TRACKER_DEBUG_IMU_SAMPLES);
+	for (i = 0; i < TRACKER_MAX_OBJECTS; i++)
+		g_mutex_init(&self->objects[i].lock);
+	self->params.threshold = BLOBWATCH_DEFAULT_THRESHOLD;
+	self->params.min_extent_length = BLOBWATCH_DEFAULT_MIN_EXTENT;
+	self->params.pnp = pnp_default_params;
+	/* Start resting only after the first IMU sample */
+	self->moving = true;
 }
 
 OuvrtTracker *ouvrt_tracker_new(void)
@@ -7,9 +7,19 @@
 #define __TRACKER_H__
 
 #include <glib-object.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "blobwatch.h"
+#include "distortion.h"
+#include "fusion.h"
 #include "maths.h"
+#include "pnp.h"
+
+/* frames per camera submitted while the previous ones are still processed */
+#define TRACKER_MAX_FRAMES_IN_FLIGHT	2
+/* the tracked device itself and two Touch controllers */
+#define TRACKER_MAX_OBJECTS		3
 
 #define OUVRT_TYPE_TRACKER (ouvrt_tracker_get_type())
 G_DECLARE_FINAL_TYPE(OuvrtTracker, ouvrt_tracker, OUVRT, TRACKER, GObject)
@@ -17,24 +27,124 @@ G_DECLARE_FINAL_TYPE(OuvrtTracker, ouvrt_tracker, OUVRT, TRACKER, GObject)
 struct leds;
 struct blob;
 struct blobservation;
+struct debug_imu_fifo;
+struct dpose;
+struct imu_sample;
+struct imu_state;
+struct latency_probe;
+
+/*
+ * Tunable parameters of the optical tracking pipeline. Changes are applied
+ * by each camera at the start of its next frame, all at once.
+ */
+struct tracker_params {
+	/* blob detection threshold and minimum bright run length in pixels */
+	int threshold;
+	int min_extent_length;
+	/* full pose search */
+	struct pnp_params pnp;
+	/* transfers in flight per camera stream, 0 for automatic */
+	int num_transfers;
+};
+
+/*
+ * Tracker state of a single camera that is kept across restarts: its world
+ * space pose, once known, and the camera space poses of the tracked objects.
+ */
+struct tracker_camera_snapshot {
+	bool extrinsics;
+	struct dpose camera_pose;
+	bool tracking[TRACKER_MAX_OBJECTS];
+	struct dpose poses[TRACKER_MAX_OBJECTS];
+};
+
+/*
+ * Called with the observation of a processed frame, and the camera space
+ * pose of the tracked device, or NULL if it was not found.
+ */
+typedef void (*ouvrt_tracker_frame_func)(struct blobservation *ob,
+					 const dquat *rot, const dvec3 *trans,
+					 void *data);
 
 void ouvrt_tracker_register_leds(OuvrtTracker *tracker, struct leds *leds);
 void ouvrt_tracker_unregister_leds(OuvrtTracker *tracker, struct leds *leds);
+int ouvrt_tracker_register_object(OuvrtTracker *tracker, struct leds *leds);
 
 void ouvrt_tracker_set_radio_address(OuvrtTracker *tracker, uint32_t address);
 uint32_t ouvrt_tracker_get_radio_address(OuvrtTracker *tracker);
+struct debug_imu_fifo *ouvrt_tracker_get_debug_imu_fifo(OuvrtTracker *tracker);
+int ouvrt_tracker_get_pose_fd(OuvrtTracker *tracker);
+void ouvrt_tracker_enable_latency_probe(OuvrtTracker *tracker,
+					const char *name);
+struct latency_probe *ouvrt_tracker_get_latency_probe(OuvrtTracker *tracker);
+void ouvrt_tracker_get_params(OuvrtTracker *tracker,
+			      struct tracker_params *params);
+int ouvrt_tracker_set_params(OuvrtTracker *tracker,
+			     const struct tracker_params *params);
+
+void ouvrt_tracker_set_on_demand(bool on_demand);
+void ouvrt_tracker_acquire(OuvrtTracker *tracker);
+void ouvrt_tracker_release(OuvrtTracker *tracker);
+bool ouvrt_tracker_is_active(OuvrtTracker *tracker);
+bool ouvrt_tracker_is_tracking(OuvrtTracker *tracker);
+bool ouvrt_tracker_skip_frame(OuvrtTracker *tracker, int camera,
+			      uint64_t sof_time);
 
 void ouvrt_tracker_add_exposure(OuvrtTracker *tracker,
-			        uint64_t device_timestamp, uint64_t time,
-			        uint8_t led_pattern_phase);
-
-void ouvrt_tracker_process_frame(OuvrtTracker *tracker, uint8_t *frame,
-				 int width, int height, uint64_t sof_time,
-				 struct blobservation **ob);
-void ouvrt_tracker_process_blobs(OuvrtTracker *tracker,
-				 struct blob *blobs, int num_blobs,
-				 dmat3 *camera_matrix, double dist_coeffs[5],
-				 dquat *rot, dvec3 *trans);
+				uint32_t device_timestamp, uint64_t time,
+				uint8_t led_pattern_phase, uint16_t count);
+
+bool ouvrt_tracker_get_snapshot(OuvrtTracker *tracker,
+				struct fusion_snapshot *snapshot);
+void ouvrt_tracker_restore_snapshot(OuvrtTracker *tracker,
+				    const struct fusion_snapshot *snapshot);
+void ouvrt_tracker_get_camera_snapshot(OuvrtTracker *tracker, int camera,
+				       struct tracker_camera_snapshot *snapshot);
+void ouvrt_tracker_restore_camera_snapshot(OuvrtTracker *tracker, int camera,
+				const struct tracker_camera_snapshot *snapshot);
+int ouvrt_tracker_get_camera_pose(OuvrtTracker *tracker, int camera,
+				  struct dpose *pose);
+
+void ouvrt_tracker_add_imu_sample(OuvrtTracker *tracker, double time,
+				  const struct imu_sample *sample);
+bool ouvrt_tracker_get_imu_state(OuvrtTracker *tracker, double time,
+				 struct imu_state *state);
+bool ouvrt_tracker_get_pose(OuvrtTracker *tracker, struct dpose *pose);
+bool ouvrt_tracker_get_object_pose(OuvrtTracker *tracker, int object,
+				   struct dpose *pose);
+double ouvrt_tracker_set_prediction_horizon(OuvrtTracker *tracker,
+					    double horizon);
+bool ouvrt_tracker_predict_pose(OuvrtTracker *tracker, double time,
+				struct dpose *pose);
+bool ouvrt_tracker_get_predicted_pose(OuvrtTracker *tracker,
+				      struct dpose *pose);
+
+int ouvrt_tracker_add_camera(OuvrtTracker *tracker, int width, int height,
+			     enum blobwatch_format format);
+void ouvrt_tracker_remove_camera(OuvrtTracker *tracker, int camera);
+int ouvrt_tracker_process_frame(OuvrtTracker *tracker, int camera,
+				uint8_t *frame, uint64_t sof_time,
+				dmat3 *camera_matrix,
+				const struct distortion *distortion,
+				ouvrt_tracker_frame_func done, void *data);
+void ouvrt_tracker_flush_frames(OuvrtTracker *tracker, int camera);
+void ouvrt_tracker_begin_frame(OuvrtTracker *tracker, int camera,
+			       uint8_t *frame);
+void ouvrt_tracker_process_lines(OuvrtTracker *tracker, int camera,
+				 int num_lines);
+int ouvrt_tracker_end_frame(OuvrtTracker *tracker, int camera,
+			    struct blob *blobs);
+int ouvrt_tracker_get_max_blobs(OuvrtTracker *tracker, int camera);
+void ouvrt_tracker_track_blobs(OuvrtTracker *tracker, int camera,
+			       struct blob *blobs, int num_blobs,
+			       uint64_t sof_time, const dmat3 *camera_matrix,
+			       const struct distortion *distortion,
+			       struct blobservation **ob);
+int ouvrt_tracker_process_blobs(OuvrtTracker *tracker, int camera,
+				struct blob *blobs, int num_blobs,
+				uint64_t sof_time, dmat3 *camera_matrix,
+				const struct distortion *distortion,
+				dquat *rot, dvec3 *trans);
 
 OuvrtTracker *ouvrt_tracker_new();
 
@@ -5,18 +5,42 @@
  */
 #include <errno.h>
 #include <libusb.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 
 #include "usb-device.h"
 
+/*
+ * libusb serializes event handling on a single context, so each event thread
+ * gets its own context, shared by all devices assigned to it. The event
+ * thread runs at the highest real-time priority requested by the device
+ * classes of these devices, so that their transfers are resubmitted in time.
+ */
+struct usb_event_context {
+	libusb_context *context;
+	GThread *thread;
+	int refcount;
+	int quit;
+	int sched_policy;
+	int sched_priority;
+	int sched_changed;
+};
+
 typedef struct {
 	uint16_t vid;
 	uint16_t pid;
-	libusb_context *context;
+	struct usb_event_context *event_context;
 	libusb_device_handle *devh;
-	int completed;
+	GMutex lock;
+	GCond cond;
 } OuvrtUSBDevicePrivate;
 
+static struct usb_event_context *usb_event_contexts[USB_MAX_EVENT_THREADS];
+static int usb_num_event_threads = 1;
+static int usb_next_event_context;
+static GMutex usb_event_lock;
+
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE(OuvrtUSBDevice, ouvrt_usb_device, \
 				    OUVRT_TYPE_DEVICE)
 
@@ -39,6 +63,148 @@ void ouvrt_usb_device_set_vid_pid(OuvrtUSBDevice *self, uint16_t vid,
 	priv->pid = pid;
 }
 
+/*
+ * Sets the number of shared event threads that handle USB transfers for all
+ * devices. Must be called before the first USB device is opened.
+ */
+void ouvrt_usb_device_set_num_event_threads(int num_threads)
+{
+	usb_num_event_threads = CLAMP(num_threads, 1, USB_MAX_EVENT_THREADS);
+}
+
+/*
+ * Wakes up the event thread, if it is blocked handling events.
+ */
+static void ouvrt_usb_event_context_interrupt(struct usb_event_context *ctx)
+{
+#ifdef HAVE_LIBUSB_INTERRUPT_EVENT_HANDLER
+	libusb_interrupt_event_handler(ctx->context);
+#else
+	(void)ctx;
+#endif
+}
+
+/*
+ * Applies the scheduling policy and priority requested for the event thread.
+ */
+static void ouvrt_usb_event_thread_setup(struct usb_event_context *ctx)
+{
+	struct sched_param param;
+	int policy;
+	int ret;
+
+	g_mutex_lock(&usb_event_lock);
+	policy = ctx->sched_policy;
+	param.sched_priority = ctx->sched_priority;
+	g_mutex_unlock(&usb_event_lock);
+
+	if (policy == SCHED_OTHER)
+		return;
+
+	ret = pthread_setschedparam(pthread_self(), policy, &param);
+	if (ret) {
+		g_print("libusb: Failed to set %s priority %d: %d, using normal priority\n",
+			policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR",
+			param.sched_priority, ret);
+	}
+}
+
+/*
+ * Handles USB transfers of all devices using this context.
+ */
+static gpointer ouvrt_usb_event_thread(gpointer data)
+{
+	struct usb_event_context *ctx = data;
+	struct timeval tv = {
+		.tv_sec = 1,
+	};
+	int ret;
+
+	while (!__atomic_load_n(&ctx->quit, __ATOMIC_ACQUIRE)) {
+		if (__atomic_exchange_n(&ctx->sched_changed, 0,
+					__ATOMIC_ACQ_REL))
+			ouvrt_usb_event_thread_setup(ctx);
+
+		ret = libusb_handle_events_timeout_completed(ctx->context, &tv,
+							     &ctx->quit);
+		if (ret != 0 && ret != LIBUSB_ERROR_INTERRUPTED) {
+			g_print("libusb_handle_events failed with: %d\n", ret);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns the next shared event context, distributing devices evenly over
+ * all event threads, and starts its event thread on first use. Raises the
+ * event thread priority to that of the device class, if it is higher.
+ */
+static struct usb_event_context *ouvrt_usb_event_context_get(OuvrtDevice *dev)
+{
+	OuvrtDeviceClass *klass = OUVRT_DEVICE_GET_CLASS(dev);
+	struct usb_event_context *ctx;
+	int index;
+	int ret;
+
+	g_mutex_lock(&usb_event_lock);
+	index = usb_next_event_context++ % usb_num_event_threads;
+	ctx = usb_event_contexts[index];
+	if (!ctx) {
+		ctx = g_new0(struct usb_event_context, 1);
+		ret = libusb_init(&ctx->context);
+		if (ret < 0) {
+			g_mutex_unlock(&usb_event_lock);
+			g_free(ctx);
+			return NULL;
+		}
+		ctx->sched_policy = SCHED_OTHER;
+		ctx->thread = g_thread_new("usb-events", ouvrt_usb_event_thread,
+					   ctx);
+		usb_event_contexts[index] = ctx;
+	}
+	if (klass->sched_policy != SCHED_OTHER &&
+	    (ctx->sched_policy == SCHED_OTHER ||
+	     klass->sched_priority > ctx->sched_priority)) {
+		ctx->sched_policy = klass->sched_policy;
+		ctx->sched_priority = klass->sched_priority;
+		__atomic_store_n(&ctx->sched_changed, 1, __ATOMIC_RELEASE);
+		ouvrt_usb_event_context_interrupt(ctx);
+	}
+	ctx->refcount++;
+	g_mutex_unlock(&usb_event_lock);
+
+	return ctx;
+}
+
+/*
+ * Drops a reference to the shared event context, stopping its event thread
+ * after the last device using it was closed. A device opened meanwhile gets
+ * a new context, so the old event thread is joined without holding the lock.
+ */
+static void ouvrt_usb_event_context_put(struct usb_event_context *ctx)
+{
+	int i;
+
+	g_mutex_lock(&usb_event_lock);
+	if (--ctx->refcount > 0) {
+		g_mutex_unlock(&usb_event_lock);
+		return;
+	}
+	for (i = 0; i < USB_MAX_EVENT_THREADS; i++) {
+		if (usb_event_contexts[i] == ctx)
+			usb_event_contexts[i] = NULL;
+	}
+	g_mutex_unlock(&usb_event_lock);
+
+	__atomic_store_n(&ctx->quit, 1, __ATOMIC_RELEASE);
+	ouvrt_usb_event_context_interrupt(ctx);
+	g_thread_join(ctx->thread);
+	libusb_exit(ctx->context);
+	g_free(ctx);
+}
+
 /*
  * Opens the USB device.
  */
@@ -63,15 +229,21 @@ static int ouvrt_usb_device_open(OuvrtDevice *dev)
 
 	address = g_ascii_strtoull(endp + 1, NULL, 10);
 
-	libusb_init(&priv->context);
+	priv->event_context = ouvrt_usb_event_context_get(dev);
+	if (!priv->event_context)
+		return -ENODEV;
 
-	num = libusb_get_device_list(priv->context, &devices);
-	if (num < 0)
-		return num;
+	num = libusb_get_device_list(priv->event_context->context, &devices);
+	if (num < 0) {
+		ret = num;
+		goto err_put;
+	}
 	for (i = 0; i < num; i++) {
 		ret = libusb_get_device_descriptor(devices[i], &desc);
-		if (ret < 0)
-			return ret;
+		if (ret < 0) {
+			libusb_free_device_list(devices, 1);
+			goto err_put;
+		}
 
 		if (desc.idVendor == priv->vid && desc.idProduct == priv->pid &&
 		    bus == libusb_get_bus_number(devices[i]) &&
@@ -80,7 +252,8 @@ static int ouvrt_usb_device_open(OuvrtDevice *dev)
 	}
 	if (i == num) {
 		libusb_free_device_list(devices, 1);
-		return -ENODEV;
+		ret = -ENODEV;
+		goto err_put;
 	}
 
 	int speed = libusb_get_device_speed(devices[i]);
@@ -102,34 +275,49 @@ static int ouvrt_usb_device_open(OuvrtDevice *dev)
 		} else {
 			g_print("%s: failed to open: %d\n", dev->name, ret);
 		}
-		return ret;
+		goto err_put;
 	}
 
 	return 0;
+
+err_put:
+	ouvrt_usb_event_context_put(priv->event_context);
+	priv->event_context = NULL;
+	return ret;
 }
 
 /*
- * Handles USB transfers.
+ * Clears the active flag of the device and wakes up its device thread. May
+ * be called from transfer callbacks on the event thread.
+ */
+void ouvrt_usb_device_deactivate(OuvrtUSBDevice *self)
+{
+	OuvrtUSBDevicePrivate *priv = ouvrt_usb_device_get_instance_private(self);
+
+	g_mutex_lock(&priv->lock);
+	OUVRT_DEVICE(self)->active = FALSE;
+	g_cond_broadcast(&priv->cond);
+	g_mutex_unlock(&priv->lock);
+}
+
+static void ouvrt_usb_device_wakeup(OuvrtDevice *dev)
+{
+	ouvrt_usb_device_deactivate(OUVRT_USB_DEVICE(dev));
+}
+
+/*
+ * Waits until the device is stopped or vanishes. The transfers of the device
+ * are handled by the shared event thread meanwhile.
  */
 static void ouvrt_usb_device_thread(OuvrtDevice *dev)
 {
 	OuvrtUSBDevice *self = OUVRT_USB_DEVICE(dev);
 	OuvrtUSBDevicePrivate *priv = ouvrt_usb_device_get_instance_private(self);
-	struct timeval tv = {
-		.tv_sec = 1,
-	};
-	int ret;
 
-	while (dev->active) {
-		ret = libusb_handle_events_timeout_completed(priv->context, &tv,
-							     &priv->completed);
-		if (ret != 0) {
-			g_print("libusb_handle_events failed with: %d\n", ret);
-			break;
-		}
-		if (priv->completed)
-			dev->active = false;
-	}
+	g_mutex_lock(&priv->lock);
+	while (dev->active)
+		g_cond_wait(&priv->cond, &priv->lock);
+	g_mutex_unlock(&priv->lock);
 }
 
 /*
@@ -140,8 +328,13 @@ static void ouvrt_usb_device_close(OuvrtDevice *dev)
 	OuvrtUSBDevice *self = OUVRT_USB_DEVICE(dev);
 	OuvrtUSBDevicePrivate *priv = ouvrt_usb_device_get_instance_private(self);
 
+	if (!priv->devh)
+		return;
+
 	libusb_close(priv->devh);
 	priv->devh = NULL;
+	ouvrt_usb_event_context_put(priv->event_context);
+	priv->event_context = NULL;
 }
 
 /*
@@ -149,6 +342,11 @@ static void ouvrt_usb_device_close(OuvrtDevice *dev)
  */
 static void ouvrt_usb_device_finalize(GObject *object)
 {
+	OuvrtUSBDevice *self = OUVRT_USB_DEVICE(object);
+	OuvrtUSBDevicePrivate *priv = ouvrt_usb_device_get_instance_private(self);
+
+	g_cond_clear(&priv->cond);
+	g_mutex_clear(&priv->lock);
 	G_OBJECT_CLASS(ouvrt_usb_device_parent_class)->finalize(object);
 }
 
@@ -157,9 +355,14 @@ static void ouvrt_usb_device_class_init(OuvrtUSBDeviceClass *klass)
 	G_OBJECT_CLASS(klass)->finalize = ouvrt_usb_device_finalize;
 	OUVRT_DEVICE_CLASS(klass)->open = ouvrt_usb_device_open;
 	OUVRT_DEVICE_CLASS(klass)->thread = ouvrt_usb_device_thread;
+	OUVRT_DEVICE_CLASS(klass)->wakeup = ouvrt_usb_device_wakeup;
 	OUVRT_DEVICE_CLASS(klass)->close = ouvrt_usb_device_close;
 }
 
-static void ouvrt_usb_device_init(G_GNUC_UNUSED OuvrtUSBDevice *self)
+static void ouvrt_usb_device_init(OuvrtUSBDevice *self)
 {
+	OuvrtUSBDevicePrivate *priv = ouvrt_usb_device_get_instance_private(self);
+
+	g_mutex_init(&priv->lock);
+	g_cond_init(&priv->cond);
 }
@@ -15,6 +15,8 @@
 
 G_BEGIN_DECLS
 
+#define USB_MAX_EVENT_THREADS	4
+
 #define OUVRT_TYPE_USB_DEVICE (ouvrt_usb_device_get_type())
 G_DECLARE_DERIVABLE_TYPE(OuvrtUSBDevice, ouvrt_usb_device, OUVRT, USB_DEVICE, \
 			 OuvrtDevice)
@@ -26,6 +28,8 @@ struct _OuvrtUSBDeviceClass {
 libusb_device_handle *ouvrt_usb_device_get_handle(OuvrtUSBDevice *self);
 void ouvrt_usb_device_set_vid_pid(OuvrtUSBDevice *self, uint16_t vid,
 				  uint16_t pid);
+void ouvrt_usb_device_set_num_event_threads(int num_threads);
+void ouvrt_usb_device_deactivate(OuvrtUSBDevice *self);
 
 G_END_DECLS
 
@@ -3,18 +3,20 @@
  * Copyright 2017 Philipp Zabel
  * SPDX-License-Identifier:	LGPL-2.0+
  */
+#include <asm/byteorder.h>
 #include <glib.h>
 #include <libusb.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "uvc.h"
 
 #define SET_CUR			0x01
 #define GET_CUR			0x81
 #define GET_LEN			0x85
 #define TIMEOUT			1000
 
-#define VS_PROBE_CONTROL	1
-#define VS_COMMIT_CONTROL	2
-
 int uvc_set_cur(libusb_device_handle *dev, uint8_t interface, uint8_t entity,
 		uint8_t selector, void *data, uint16_t wLength)
 {
@@ -75,3 +77,382 @@ int uvc_get_len(libusb_device_handle *dev, uint8_t interface, uint8_t entity,
 	}
 	return ret;
 }
+
+/*
+ * A sequence of UVC control requests that is submitted as asynchronous
+ * control transfers all at once, so that the requests are queued back to
+ * back on the default control endpoint instead of waiting for a full round
+ * trip each.
+ */
+struct uvc_control_batch {
+	libusb_device_handle *devh;
+	struct libusb_transfer *transfers[UVC_CONTROL_BATCH_MAX];
+	int num;
+	int pending;
+	int error;
+	GMutex lock;
+	GCond cond;
+};
+
+/*
+ * Allocates an empty control request batch. The device handle must belong
+ * to a libusb context that is serviced by an event thread.
+ */
+struct uvc_control_batch *uvc_control_batch_new(libusb_device_handle *devh)
+{
+	struct uvc_control_batch *batch;
+
+	batch = g_new0(struct uvc_control_batch, 1);
+	batch->devh = devh;
+	g_mutex_init(&batch->lock);
+	g_cond_init(&batch->cond);
+
+	return batch;
+}
+
+void uvc_control_batch_free(struct uvc_control_batch *batch)
+{
+	int i;
+
+	if (!batch)
+		return;
+
+	for (i = 0; i < batch->num; i++)
+		libusb_free_transfer(batch->transfers[i]);
+	g_mutex_clear(&batch->lock);
+	g_cond_clear(&batch->cond);
+	g_free(batch);
+}
+
+static void uvc_control_batch_callback(struct libusb_transfer *xfer)
+{
+	struct uvc_control_batch *batch = xfer->user_data;
+
+	g_mutex_lock(&batch->lock);
+	if (--batch->pending == 0)
+		g_cond_signal(&batch->cond);
+	g_mutex_unlock(&batch->lock);
+}
+
+/*
+ * Appends a control request to the batch. For SET_CUR requests, wLength bytes
+ * of data are copied into the transfer buffer.
+ *
+ * Returns the index of the request in the batch or a negative error code.
+ */
+static int uvc_control_batch_add(struct uvc_control_batch *batch,
+				 uint8_t bmRequestType, uint8_t bRequest,
+				 uint8_t interface, uint8_t entity,
+				 uint8_t selector, const void *data,
+				 uint16_t wLength)
+{
+	struct libusb_transfer *xfer;
+	uint8_t *buf;
+
+	if (batch->num == UVC_CONTROL_BATCH_MAX)
+		return LIBUSB_ERROR_OVERFLOW;
+
+	xfer = libusb_alloc_transfer(0);
+	if (!xfer)
+		return LIBUSB_ERROR_NO_MEM;
+
+	buf = g_malloc0(LIBUSB_CONTROL_SETUP_SIZE + wLength);
+	libusb_fill_control_setup(buf, bmRequestType, bRequest, selector << 8,
+				  entity << 8 | interface, wLength);
+	if (data)
+		memcpy(buf + LIBUSB_CONTROL_SETUP_SIZE, data, wLength);
+	libusb_fill_control_transfer(xfer, batch->devh, buf,
+				     uvc_control_batch_callback, batch,
+				     TIMEOUT);
+	/* Let libusb_free_transfer free the buffer as well */
+	xfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+
+	batch->transfers[batch->num] = xfer;
+
+	return batch->num++;
+}
+
+int uvc_control_batch_set_cur(struct uvc_control_batch *batch,
+			      uint8_t interface, uint8_t entity,
+			      uint8_t selector, const void *data,
+			      uint16_t wLength)
+{
+	return uvc_control_batch_add(batch, LIBUSB_ENDPOINT_OUT |
+				     LIBUSB_REQUEST_TYPE_CLASS |
+				     LIBUSB_RECIPIENT_INTERFACE, SET_CUR,
+				     interface, entity, selector, data,
+				     wLength);
+}
+
+int uvc_control_batch_get_cur(struct uvc_control_batch *batch,
+			      uint8_t interface, uint8_t entity,
+			      uint8_t selector, uint16_t wLength)
+{
+	return uvc_control_batch_add(batch, LIBUSB_ENDPOINT_IN |
+				     LIBUSB_REQUEST_TYPE_CLASS |
+				     LIBUSB_RECIPIENT_INTERFACE, GET_CUR,
+				     interface, entity, selector, NULL,
+				     wLength);
+}
+
+/*
+ * Submits all requests in the batch without waiting for them to complete.
+ * Requests of batches started one after the other are queued in order, so
+ * the next batch can be started before the previous one is waited for.
+ */
+void uvc_control_batch_start(struct uvc_control_batch *batch)
+{
+	int ret;
+	int i;
+
+	g_mutex_lock(&batch->lock);
+	batch->error = 0;
+	for (i = 0; i < batch->num; i++) {
+		batch->pending++;
+		ret = libusb_submit_transfer(batch->transfers[i]);
+		if (ret < 0) {
+			batch->pending--;
+			g_print("UVC: Failed to submit control request %d/%d: %d (%s)\n",
+				i, batch->num, ret, libusb_strerror(ret));
+			batch->error = ret;
+			break;
+		}
+	}
+	g_mutex_unlock(&batch->lock);
+}
+
+/*
+ * Waits until all requests of a started batch have completed.
+ *
+ * Returns 0 if all requests succeeded, or a negative error code.
+ */
+int uvc_control_batch_wait(struct uvc_control_batch *batch)
+{
+	int i;
+
+	/* The event thread completes the transfers */
+	g_mutex_lock(&batch->lock);
+	while (batch->pending)
+		g_cond_wait(&batch->cond, &batch->lock);
+	g_mutex_unlock(&batch->lock);
+
+	if (batch->error < 0)
+		return batch->error;
+
+	for (i = 0; i < batch->num; i++) {
+		struct libusb_transfer *xfer = batch->transfers[i];
+		const struct libusb_control_setup *setup;
+
+		if (xfer->status == LIBUSB_TRANSFER_COMPLETED)
+			continue;
+
+		setup = libusb_control_transfer_get_setup(xfer);
+		g_print("UVC: Failed to transfer %s CUR %u %u %u: status %d\n",
+			setup->bRequest == SET_CUR ? "SET" : "GET",
+			__le16_to_cpu(setup->wIndex) & 0xff,
+			__le16_to_cpu(setup->wIndex) >> 8,
+			__le16_to_cpu(setup->wValue) >> 8, xfer->status);
+		return (xfer->status == LIBUSB_TRANSFER_STALL) ?
+		       LIBUSB_ERROR_PIPE : LIBUSB_ERROR_IO;
+	}
+
+	return 0;
+}
+
+/*
+ * Submits all requests in the batch and waits until they have completed.
+ *
+ * Returns 0 if all requests succeeded, or a negative error code.
+ */
+int uvc_control_batch_submit(struct uvc_control_batch *batch)
+{
+	uvc_control_batch_start(batch);
+
+	return uvc_control_batch_wait(batch);
+}
+
+/*
+ * Returns the data stage buffer of the request at the given index. For
+ * GET_CUR requests this contains the received data after submission.
+ */
+const uint8_t *uvc_control_batch_get_data(struct uvc_control_batch *batch,
+					  int index)
+{
+	return libusb_control_transfer_get_data(batch->transfers[index]);
+}
+
+/*
+ * Returns the number of bytes the isochronous endpoint can transfer per
+ * service interval.
+ */
+static int
+uvc_endpoint_bytes_per_interval(const struct libusb_endpoint_descriptor *ep)
+{
+	struct libusb_ss_endpoint_companion_descriptor *comp;
+	int size;
+
+	if (libusb_get_ss_endpoint_companion_descriptor(NULL, ep, &comp) == 0) {
+		size = comp->wBytesPerInterval;
+		libusb_free_ss_endpoint_companion_descriptor(comp);
+		return size;
+	}
+
+	/* High-speed endpoints can transfer up to 3 packets per microframe */
+	return (ep->wMaxPacketSize & 0x7ff) *
+	       (((ep->wMaxPacketSize >> 11) & 0x3) + 1);
+}
+
+/*
+ * Selects the alternate setting of the streaming interface whose isochronous
+ * endpoint has the smallest bandwidth that still fits payload_size bytes per
+ * service interval, or the largest bandwidth if none does. This leaves as
+ * much bus bandwidth as possible to other devices.
+ *
+ * Returns the alternate setting and stores the bytes per service interval in
+ * packet_size, or returns a negative error code.
+ */
+int uvc_find_alt_setting(libusb_device_handle *devh, uint8_t interface,
+			 uint8_t endpoint, int payload_size, int *packet_size)
+{
+	struct libusb_config_descriptor *config;
+	const struct libusb_interface *intf;
+	int best = -1, best_size = 0;
+	int ret, i, j;
+
+	ret = libusb_get_active_config_descriptor(libusb_get_device(devh),
+						  &config);
+	if (ret < 0)
+		return ret;
+
+	if (interface >= config->bNumInterfaces) {
+		libusb_free_config_descriptor(config);
+		return LIBUSB_ERROR_NOT_FOUND;
+	}
+
+	intf = &config->interface[interface];
+	for (i = 0; i < intf->num_altsetting; i++) {
+		const struct libusb_interface_descriptor *alt;
+		int size = 0;
+
+		alt = &intf->altsetting[i];
+		for (j = 0; j < alt->bNumEndpoints; j++) {
+			if (alt->endpoint[j].bEndpointAddress == endpoint)
+				size = uvc_endpoint_bytes_per_interval(
+							&alt->endpoint[j]);
+		}
+		if (size == 0)
+			continue;
+
+		if (best < 0 ||
+		    (best_size < payload_size && size > best_size) ||
+		    (size >= payload_size && size < best_size)) {
+			best = alt->bAlternateSetting;
+			best_size = size;
+		}
+	}
+
+	libusb_free_config_descriptor(config);
+
+	if (best < 0)
+		return LIBUSB_ERROR_NOT_FOUND;
+
+	*packet_size = best_size;
+	return best;
+}
+
+/*
+ * Initializes frame reassembly for a stream of frames with the given initial
+ * size. The name is used in error messages.
+ */
+void uvc_stream_init(struct uvc_stream *stream, const char *name,
+		     int frame_size, const struct uvc_stream_ops *ops,
+		     void *data)
+{
+	stream->ops = ops;
+	stream->data = data;
+	stream->name = name;
+	stream->frame_id = 0;
+	stream->pts = 0;
+	stream->payload_size = 0;
+	stream->frame_size = frame_size;
+	stream->num_short = 0;
+}
+
+/*
+ * Parses the header of a single UVC payload, detects frame boundaries by the
+ * toggling frame id, and passes the image data on to the payload callback.
+ */
+enum uvc_payload_result uvc_stream_process_payload(struct uvc_stream *stream,
+						   const uint8_t *payload,
+						   size_t len)
+{
+	const struct uvc_payload_header *h = (const void *)payload;
+	int payload_len;
+	int frame_id;
+	uint32_t pts;
+	bool error;
+
+	if (len == 0 || len == sizeof(struct uvc_payload_header))
+		return UVC_PAYLOAD_EMPTY;
+
+	if (h->bHeaderLength == 0) {
+		/* This happens when unplugging the camera */
+		return UVC_PAYLOAD_INVALID;
+	}
+
+	if (h->bHeaderLength != 12) {
+		g_print("%s: Invalid header length: %u (%zu)\n", stream->name,
+			h->bHeaderLength, len);
+		return UVC_PAYLOAD_INVALID;
+	}
+
+	payload += h->bHeaderLength;
+	payload_len = len - h->bHeaderLength;
+	frame_id = h->bmHeaderInfo & 0x01;
+	error = h->bmHeaderInfo & 0x40;
+
+	if (error) {
+		g_print("%s: Frame error\n", stream->name);
+		return UVC_PAYLOAD_INVALID;
+	}
+
+	pts = __le32_to_cpu(h->dwPresentationTime);
+	if (stream->payload_size == 0)
+		stream->pts = pts;
+
+	if (frame_id != stream->frame_id) {
+		if (stream->payload_size != stream->frame_size) {
+			log_ratelimited("%s: Dropping short frame: %u\n",
+					stream->name, stream->payload_size);
+			stream->num_short++;
+		}
+
+		/* Start of new frame */
+		stream->frame_id = frame_id;
+		stream->pts = pts;
+		stream->payload_size = 0;
+		stream->frame_size = stream->ops->frame_start(stream->data,
+							      pts);
+	} else {
+		if (pts != stream->pts) {
+			log_ratelimited("%s: PTS changed in-frame at %u!\n",
+					stream->name, stream->payload_size);
+			stream->pts = pts;
+		}
+	}
+
+	if (stream->payload_size + payload_len > stream->frame_size) {
+		g_print("%s: Frame buffer overflow: %u %u %u\n", stream->name,
+			stream->payload_size, payload_len, stream->frame_size);
+		return UVC_PAYLOAD_OVERFLOW;
+	}
+
+	stream->ops->payload(stream->data, stream->payload_size, payload,
+			     payload_len);
+	stream->payload_size += payload_len;
+
+	if (stream->payload_size != stream->frame_size)
+		return UVC_PAYLOAD_FRAME_PARTIAL;
+
+	return UVC_PAYLOAD_FRAME_COMPLETE;
+}
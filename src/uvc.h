@@ -6,6 +6,7 @@
 #include <asm/byteorder.h>
 #include <libusb.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define VS_PROBE_CONTROL	1
@@ -44,9 +45,72 @@ struct uvc_payload_header {
 ASSERT_SIZE(uvc_probe_commit_control, 34);
 ASSERT_SIZE(uvc_payload_header, 12);
 
+enum uvc_payload_result {
+	UVC_PAYLOAD_EMPTY,
+	UVC_PAYLOAD_INVALID,
+	UVC_PAYLOAD_OVERFLOW,
+	UVC_PAYLOAD_FRAME_PARTIAL,
+	UVC_PAYLOAD_FRAME_COMPLETE
+};
+
+/*
+ * Frame assembly callbacks. frame_start is called when the frame id toggles,
+ * with the presentation time stamp of the new frame, and returns the size of
+ * the new frame. payload stores len bytes of image data at the given offset
+ * into the current frame.
+ */
+struct uvc_stream_ops {
+	int (*frame_start)(void *data, uint32_t pts);
+	void (*payload)(void *data, int offset, const uint8_t *payload,
+			int len);
+};
+
+/*
+ * Reassembles frames from the payloads of a bulk or isochronous UVC video
+ * stream.
+ */
+struct uvc_stream {
+	const struct uvc_stream_ops *ops;
+	void *data;
+	const char *name;
+	int frame_id;
+	uint32_t pts;
+	int payload_size;
+	int frame_size;
+	unsigned int num_short;
+};
+
 int uvc_set_cur(libusb_device_handle *dev, uint8_t interface, uint8_t entity,
 		uint8_t selector, void *data, uint16_t wLength);
 int uvc_get_cur(libusb_device_handle *dev, uint8_t interface, uint8_t entity,
 		uint8_t selector, void *data, uint16_t wLength);
 int uvc_get_len(libusb_device_handle *dev, uint8_t interface, uint8_t entity,
 		uint8_t selector, uint16_t *wLength);
+#define UVC_CONTROL_BATCH_MAX	64
+
+struct uvc_control_batch;
+
+struct uvc_control_batch *uvc_control_batch_new(libusb_device_handle *devh);
+void uvc_control_batch_free(struct uvc_control_batch *batch);
+int uvc_control_batch_set_cur(struct uvc_control_batch *batch,
+			      uint8_t interface, uint8_t entity,
+			      uint8_t selector, const void *data,
+			      uint16_t wLength);
+int uvc_control_batch_get_cur(struct uvc_control_batch *batch,
+			      uint8_t interface, uint8_t entity,
+			      uint8_t selector, uint16_t wLength);
+void uvc_control_batch_start(struct uvc_control_batch *batch);
+int uvc_control_batch_wait(struct uvc_control_batch *batch);
+int uvc_control_batch_submit(struct uvc_control_batch *batch);
+const uint8_t *uvc_control_batch_get_data(struct uvc_control_batch *batch,
+					  int index);
+
+int uvc_find_alt_setting(libusb_device_handle *devh, uint8_t interface,
+			 uint8_t endpoint, int payload_size, int *packet_size);
+
+void uvc_stream_init(struct uvc_stream *stream, const char *name,
+		     int frame_size, const struct uvc_stream_ops *ops,
+		     void *data);
+enum uvc_payload_result uvc_stream_process_payload(struct uvc_stream *stream,
+						   const uint8_t *payload,
+						   size_t len);
@@ -7,99 +7,159 @@
 #include <string.h>
 #include <zlib.h>
 
+#include "cache.h"
 #include "device.h"
 #include "hidraw.h"
 #include "vive-hid-reports.h"
 
 /*
- * Downloads configuration data stored in the Vive headset and controller.
+ * Reads the remaining configuration data reports, starting with the already
+ * received first report, and inflates the compressed data as it arrives.
+ *
+ * Returns the zero terminated JSON configuration, or NULL on error.
  */
-char *ouvrt_vive_get_config(OuvrtDevice *dev)
+static char *vive_config_read(OuvrtDevice *dev,
+			      struct vive_config_read_report *read_report)
 {
-	struct vive_config_start_report start_report = {
-		.id = VIVE_CONFIG_START_REPORT_ID,
-	};
-	struct vive_config_read_report read_report = {
-		.id = VIVE_CONFIG_READ_REPORT_ID,
-	};
+	gboolean finished = FALSE;
+	size_t size = 16384;
 	unsigned char *config_json;
-	void *config_z;
 	z_stream strm;
 	int count = 0;
 	int ret;
 
-	ret = hid_get_feature_report_timeout(dev->fd, &start_report,
-					     sizeof(start_report), 100);
-	if (ret < 0) {
-		g_print("%s: Read error 0x10: %d\n", dev->name, errno);
+	strm.zalloc = Z_NULL;
+	strm.zfree = Z_NULL;
+	strm.opaque = Z_NULL;
+	strm.avail_in = 0;
+	strm.next_in = Z_NULL;
+	ret = inflateInit(&strm);
+	if (ret != Z_OK) {
+		g_print("inflate_init failed: %d\n", ret);
 		return NULL;
 	}
 
-	config_z = g_malloc(4096);
-
-	do {
-		ret = hid_get_feature_report_timeout(dev->fd, &read_report,
-						     sizeof(read_report), 100);
-		if (ret < 0) {
-			g_print("%s: Read error after %d bytes: %d\n",
-				dev->name, count, errno);
-			g_free(config_z);
-			return NULL;
-		}
+	config_json = g_malloc(size);
+	strm.avail_out = size - 1;
+	strm.next_out = config_json;
 
-		if (read_report.len > 62) {
+	while (read_report->len) {
+		if (read_report->len > 62) {
 			g_print("%s: Invalid configuration data at %d\n",
 				dev->name, count);
-			g_free(config_z);
-			return NULL;
+			goto err;
 		}
 
-		if (count + read_report.len > 4096) {
+		if (count + read_report->len > 4096) {
 			g_print("%s: Configuration data too large\n",
 				dev->name);
-			g_free(config_z);
-			return NULL;
+			goto err;
+		}
+
+		strm.avail_in = read_report->len;
+		strm.next_in = read_report->payload;
+		while (strm.avail_in && !finished) {
+			/* Grow the output buffer, keeping space for the NUL */
+			if (strm.avail_out == 0) {
+				config_json = g_realloc(config_json, 2 * size);
+				strm.next_out = config_json + size - 1;
+				strm.avail_out = size;
+				size *= 2;
+			}
+
+			ret = inflate(&strm, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END) {
+				finished = TRUE;
+			} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+				g_print("%s: Failed to inflate configuration data: %d\n",
+					dev->name, ret);
+				goto err;
+			}
 		}
+		count += read_report->len;
 
-		memcpy(config_z + count, read_report.payload, read_report.len);
-		count += read_report.len;
-	} while (read_report.len);
+		ret = hid_get_feature_report_timeout(dev->fd, read_report,
+						     sizeof(*read_report), 100);
+		if (ret < 0) {
+			g_print("%s: Read error after %d bytes: %d\n",
+				dev->name, count, errno);
+			goto err;
+		}
+	}
 
 	g_debug("%s: Read configuration data: %d bytes\n", dev->name,
 		count);
 
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.avail_in = 0;
-	strm.next_in = Z_NULL;
-	ret = inflateInit(&strm);
-	if (ret != Z_OK) {
-		g_print("inflate_init failed: %d\n", ret);
-		g_free(config_z);
-		return NULL;
+	if (!finished) {
+		g_print("%s: Truncated configuration data\n", dev->name);
+		goto err;
 	}
 
-	config_json = g_malloc(32768);
+	g_debug("%s: Inflated configuration data: %lu bytes\n",
+		dev->name, strm.total_out);
 
-	strm.avail_in = count;
-	strm.next_in = config_z;
-	strm.avail_out = 32768;
-	strm.next_out = config_json;
+	inflateEnd(&strm);
+	config_json[strm.total_out] = '\0';
+
+	return g_realloc(config_json, strm.total_out + 1);
+
+err:
+	inflateEnd(&strm);
+	g_free(config_json);
+	return NULL;
+}
 
-	ret = inflate(&strm, Z_FINISH);
-	g_free(config_z);
-	if (ret != Z_STREAM_END) {
-		g_print("%s: Failed to inflate configuration data: %d\n",
-			dev->name, ret);
-		g_free(config_json);
+/*
+ * Downloads configuration data stored in the Vive headset and controller.
+ * The inflated configuration is cached, keyed by the device serial number
+ * and a checksum of the first configuration data report, so that only two
+ * reports have to be read if the configuration did not change.
+ */
+char *ouvrt_vive_get_config(OuvrtDevice *dev)
+{
+	struct vive_config_start_report start_report = {
+		.id = VIVE_CONFIG_START_REPORT_ID,
+	};
+	struct vive_config_read_report read_report = {
+		.id = VIVE_CONFIG_READ_REPORT_ID,
+	};
+	char *filename = NULL;
+	char *config_json;
+	int ret;
+
+	ret = hid_get_feature_report_timeout(dev->fd, &start_report,
+					     sizeof(start_report), 100);
+	if (ret < 0) {
+		g_print("%s: Read error 0x10: %d\n", dev->name, errno);
 		return NULL;
 	}
 
-	g_debug("%s: Inflated configuration data: %lu bytes\n",
-		dev->name, strm.total_out);
+	ret = hid_get_feature_report_timeout(dev->fd, &read_report,
+					     sizeof(read_report), 100);
+	if (ret < 0) {
+		g_print("%s: Read error after 0 bytes: %d\n", dev->name,
+			errno);
+		return NULL;
+	}
 
-	config_json[strm.total_out] = '\0';
+	if (dev->serial && read_report.len <= 62) {
+		filename = ouvrt_cache_path("%s_%08lx.vive", dev->serial,
+					    crc32(0, read_report.payload,
+						  read_report.len));
+		if (ouvrt_cache_load(filename, &config_json, NULL)) {
+			g_print("%s: Read cached configuration data\n",
+				dev->name);
+			g_free(filename);
+			return config_json;
+		}
+	}
 
-	return g_realloc(config_json, strm.total_out + 1);
+	config_json = vive_config_read(dev, &read_report);
+	if (config_json && filename &&
+	    ouvrt_cache_save(filename, config_json, -1))
+		g_print("%s: Wrote configuration data cache\n", dev->name);
+
+	g_free(filename);
+
+	return config_json;
 }
@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <json-glib/json-glib.h>
 #include <poll.h>
+#include <sched.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
@@ -111,6 +112,8 @@ static void vive_controller_decode_pulse_report(OuvrtViveControllerUSB *self,
 						const void *buf)
 {
 	const struct vive_controller_lighthouse_pulse_report *report = buf;
+	struct lighthouse_pulse pulses[7];
+	int num_pulses = 0;
 	unsigned int i;
 
 	/* The pulses may appear in arbitrary order */
@@ -138,9 +141,13 @@ static void vive_controller_decode_pulse_report(OuvrtViveControllerUSB *self,
 		timestamp = __le32_to_cpu(pulse->timestamp);
 		duration = __le16_to_cpu(pulse->duration);
 
-		lighthouse_watchman_handle_pulse(&self->watchman, sensor_id,
-						 duration, timestamp);
+		pulses[num_pulses].timestamp = timestamp;
+		pulses[num_pulses].duration = duration;
+		pulses[num_pulses].id = sensor_id;
+		num_pulses++;
 	}
+
+	lighthouse_watchman_handle_pulses(&self->watchman, pulses, num_pulses);
 }
 
 static const struct button_map vive_controller_usb_button_map[6] = {
@@ -310,6 +317,8 @@ static void ouvrt_vive_controller_usb_class_init(OuvrtViveControllerUSBClass *kl
 	OUVRT_DEVICE_CLASS(klass)->start = vive_controller_usb_start;
 	OUVRT_DEVICE_CLASS(klass)->thread = vive_controller_usb_thread;
 	OUVRT_DEVICE_CLASS(klass)->stop = vive_controller_usb_stop;
+	OUVRT_DEVICE_CLASS(klass)->sched_policy = SCHED_FIFO;
+	OUVRT_DEVICE_CLASS(klass)->sched_priority = 15;
 }
 
 static void ouvrt_vive_controller_usb_init(OuvrtViveControllerUSB *self)
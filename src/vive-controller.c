@@ -5,7 +5,7 @@
  */
 #include <asm/byteorder.h>
 #include <errno.h>
-#include <poll.h>
+#include <sched.h>
 #include <string.h>
 #include <stdint.h>
 #include <sys/fcntl.h>
@@ -328,6 +328,8 @@ vive_controller_decode_message(OuvrtViveController *self,
 	uint32_t mask = 0;
 	uint32_t duration[8];
 	uint32_t start[8];
+	struct lighthouse_pulse pulses[8];
+	int num_pulses = 0;
 	for (i = 0; i < num_edges / 2; i++) {
 		int falling = rising + 1 + (buf[i] & 7);
 		mask |= 1 << falling;
@@ -358,18 +360,23 @@ vive_controller_decode_message(OuvrtViveController *self,
 			    (abs(ts2 - ref) < abs(ts3 - ref)) ? ts2 :
 								ts3;
 
-		lighthouse_watchman_handle_pulse(&self->watchman,
-						 buf[i] >> 3, duration[i],
-						 timestamp);
+		pulses[num_pulses].timestamp = timestamp;
+		pulses[num_pulses].duration = duration[i];
+		pulses[num_pulses].id = buf[i] >> 3;
+		num_pulses++;
 	}
+
+	lighthouse_watchman_handle_pulses(&self->watchman, pulses, num_pulses);
 }
 
 /*
- * Opens the Wireless Receiver HID device descriptor.
+ * Opens the Wireless Receiver HID device descriptor and checks whether a
+ * controller is already connected.
  */
 static int vive_controller_start(OuvrtDevice *dev)
 {
 	OuvrtViveController *self = OUVRT_VIVE_CONTROLLER(dev);
+	int ret;
 
 	g_free(self->dev.name);
 	self->dev.name = g_strdup_printf("Vive Wireless Receiver %s",
@@ -377,19 +384,6 @@ static int vive_controller_start(OuvrtDevice *dev)
 
 	self->watchman.name = self->dev.name;
 
-	return 0;
-}
-
-/*
- * Keeps the controller active.
- */
-static void vive_controller_thread(OuvrtDevice *dev)
-{
-	OuvrtViveController *self = OUVRT_VIVE_CONTROLLER(dev);
-	unsigned char buf[64];
-	struct pollfd fds;
-	int ret;
-
 	ret = vive_get_firmware_version(dev);
 	if (ret < 0 && errno == EPIPE) {
 		g_print("%s: No connected controller found\n", dev->name);
@@ -407,78 +401,71 @@ static void vive_controller_thread(OuvrtDevice *dev)
 		}
 	}
 
-	while (dev->active) {
-		fds.fd = dev->fd;
-		fds.events = POLLIN;
-		fds.revents = 0;
+	return 0;
+}
 
-		ret = poll(&fds, 1, 1000);
-		if (ret == -1) {
-			g_print("%s: Poll failure: %d\n", dev->name, errno);
-			continue;
-		}
+/*
+ * Handles all pending controller reports and keeps the controller active.
+ */
+static void vive_controller_dispatch(OuvrtDevice *dev,
+				     G_GNUC_UNUSED int index,
+				     G_GNUC_UNUSED const struct timespec *ts)
+{
+	OuvrtViveController *self = OUVRT_VIVE_CONTROLLER(dev);
+	struct hid_report_batch batch;
+	int ret, i;
 
-		if (ret == 0) {
-			if (self->connected)
-				g_print("%s: Poll timeout\n", dev->name);
-			continue;
-		}
+	if (!self->connected) {
+		ret = vive_get_firmware_version(dev);
+		if (ret < 0)
+			return;
 
-		if (fds.revents & (POLLERR | POLLHUP | POLLNVAL))
-			break;
+		ret = vive_controller_get_config(self);
+		if (ret < 0)
+			return;
+
+		g_print("%s: Controller %s connected\n", dev->name,
+			self->serial);
+		g_free(dev->name);
+		dev->name = g_strdup_printf("Vive Controller %s",
+					    self->serial);
+		self->watchman.name = dev->name;
+		self->connected = TRUE;
+
+		vive_controller_haptic_pulse(self);
+	}
 
-		if (!(fds.revents & POLLIN)) {
-			g_print("%s: Unhandled poll event: 0x%x\n", dev->name,
-				fds.revents);
-			continue;
+	if (self->imu.gyro_range == 0.0) {
+		ret = vive_imu_get_range_modes(dev, &self->imu);
+		if (ret < 0) {
+			g_print("%s: Failed to get gyro/accelerometer range modes\n",
+				dev->name);
+			return;
 		}
+	}
 
-		if (!self->connected) {
-			ret = vive_get_firmware_version(dev);
-			if (ret < 0)
-				continue;
-
-			ret = vive_controller_get_config(self);
-			if (ret < 0)
-				continue;
-
-			g_print("%s: Controller %s connected\n", dev->name,
-				self->serial);
-			g_free(dev->name);
-			dev->name = g_strdup_printf("Vive Controller %s",
-						    self->serial);
-			self->watchman.name = dev->name;
-			self->connected = TRUE;
-
-			vive_controller_haptic_pulse(self);
-		}
+	ret = hid_read_batch(dev->fd, &batch);
+	if (ret < 0) {
+		g_print("%s: Read error: %d\n", dev->name, ret);
+		return;
+	}
 
-		if (self->imu.gyro_range == 0.0) {
-			ret = vive_imu_get_range_modes(dev, &self->imu);
-			if (ret < 0) {
-				g_print("%s: Failed to get gyro/accelerometer range modes\n",
-					dev->name);
-				continue;
-			}
-		}
+	for (i = 0; i < batch.num; i++) {
+		unsigned char *buf = batch.buf[i];
+		int len = batch.len[i];
 
-		ret = read(dev->fd, buf, sizeof(buf));
-		if (ret == -1) {
-			g_print("%s: Read error: %d\n", dev->name, errno);
-			continue;
-		}
-		if (ret == 30 && buf[0] == VIVE_CONTROLLER_REPORT1_ID) {
+		if (len == 30 && buf[0] == VIVE_CONTROLLER_REPORT1_ID) {
 			struct vive_controller_report1 *report = (void *)buf;
 
 			vive_controller_decode_message(self, &report->message);
-		} else if (ret == 59 && buf[0] == VIVE_CONTROLLER_REPORT2_ID) {
+		} else if (len == 59 && buf[0] == VIVE_CONTROLLER_REPORT2_ID) {
 			struct vive_controller_report2 *report = (void *)buf;
 
 			vive_controller_decode_message(self,
 						       &report->message[0]);
 			vive_controller_decode_message(self,
 						       &report->message[1]);
-		} else if (ret == 2 &&
+		} else if (len == 2 &&
 			   buf[0] == VIVE_CONTROLLER_DISCONNECT_REPORT_ID &&
 			   buf[1] == 0x01) {
 			g_free(dev->name);
@@ -490,11 +477,19 @@ static void vive_controller_thread(OuvrtDevice *dev)
 			self->connected = FALSE;
 		} else {
 			g_print("%s: Error, invalid %d-byte report 0x%02x\n",
-				dev->name, ret, buf[0]);
+				dev->name, len, buf[0]);
 		}
 	}
 }
 
+static void vive_controller_timeout(OuvrtDevice *dev)
+{
+	OuvrtViveController *self = OUVRT_VIVE_CONTROLLER(dev);
+
+	if (self->connected)
+		g_print("%s: Poll timeout\n", dev->name);
+}
+
 /*
  * Powers off the controller.
  */
@@ -517,8 +512,11 @@ static void ouvrt_vive_controller_class_init(OuvrtViveControllerClass *klass)
 {
 	G_OBJECT_CLASS(klass)->finalize = ouvrt_vive_controller_finalize;
 	OUVRT_DEVICE_CLASS(klass)->start = vive_controller_start;
-	OUVRT_DEVICE_CLASS(klass)->thread = vive_controller_thread;
+	OUVRT_DEVICE_CLASS(klass)->dispatch = vive_controller_dispatch;
+	OUVRT_DEVICE_CLASS(klass)->timeout = vive_controller_timeout;
 	OUVRT_DEVICE_CLASS(klass)->stop = vive_controller_stop;
+	OUVRT_DEVICE_CLASS(klass)->sched_policy = SCHED_FIFO;
+	OUVRT_DEVICE_CLASS(klass)->sched_priority = 15;
 }
 
 static void ouvrt_vive_controller_init(OuvrtViveController *self)
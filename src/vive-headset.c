@@ -6,7 +6,7 @@
 #include <asm/byteorder.h>
 #include <errno.h>
 #include <json-glib/json-glib.h>
-#include <poll.h>
+#include <sched.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
@@ -128,6 +128,8 @@ static void vive_headset_decode_pulse_report(OuvrtViveHeadset *self,
 					     const void *buf)
 {
 	const struct vive_headset_lighthouse_pulse_report *report = buf;
+	struct lighthouse_pulse pulses[9];
+	int num_pulses = 0;
 	unsigned int i;
 
 	/* The pulses may appear in arbitrary order */
@@ -157,10 +159,13 @@ static void vive_headset_decode_pulse_report(OuvrtViveHeadset *self,
 
 		duration = __le16_to_cpu(pulse->duration);
 
-		lighthouse_watchman_handle_pulse(&self->watchman,
-						 sensor_id, duration,
-						 timestamp);
+		pulses[num_pulses].timestamp = timestamp;
+		pulses[num_pulses].duration = duration;
+		pulses[num_pulses].id = sensor_id;
+		num_pulses++;
 	}
+
+	lighthouse_watchman_handle_pulses(&self->watchman, pulses, num_pulses);
 }
 
 /*
@@ -197,84 +202,51 @@ static int vive_headset_start(OuvrtDevice *dev)
 }
 
 /*
- * Handles IMU and Lighthouse Receiver messages.
+ * Handles all pending IMU or lighthouse pulse reports.
  */
-static void vive_headset_thread(OuvrtDevice *dev)
+static void vive_headset_dispatch(OuvrtDevice *dev, int index,
+				  G_GNUC_UNUSED const struct timespec *ts)
 {
 	OuvrtViveHeadset *self = OUVRT_VIVE_HEADSET(dev);
-	unsigned char buf[64];
-	struct pollfd fds[2];
-	int ret;
-
-	while (dev->active) {
-		fds[0].fd = dev->fds[0];
-		fds[0].events = POLLIN;
-		fds[0].revents = 0;
-		fds[1].fd = dev->fds[1];
-		fds[1].events = POLLIN;
-		fds[1].revents = 0;
-
-		ret = poll(fds, 2, 1000);
-		if (ret == -1) {
-			g_print("%s: Poll failure: %d\n", dev->name, errno);
-			continue;
-		}
-
-		if (ret == 0) {
-			g_print("%s: Poll timeout\n", dev->name);
-			continue;
-		}
-
-		if ((fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) ||
-		    (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL))) {
-			g_print("%s: Disconnected\n", dev->name);
-			dev->active = FALSE;
-			break;
+	struct hid_report_batch batch;
+	int ret, i;
+
+	if (self->imu.gyro_range == 0.0) {
+		ret = vive_imu_get_range_modes(dev, &self->imu);
+		if (ret < 0) {
+			g_print("%s: Failed to get gyro/accelerometer range modes\n",
+				dev->name);
+			return;
 		}
+	}
 
-		if (self->imu.gyro_range == 0.0) {
-			ret = vive_imu_get_range_modes(dev, &self->imu);
-			if (ret < 0) {
-				g_print("%s: Failed to get gyro/accelerometer range modes\n",
-					dev->name);
-				continue;
-			}
-		}
+	ret = hid_read_batch(dev->fds[index], &batch);
+	if (ret < 0) {
+		g_print("%s: Read error: %d\n", dev->name, ret);
+		return;
+	}
 
-		if (fds[0].revents & POLLIN) {
-			ret = read(dev->fds[0], buf, sizeof(buf));
-			if (ret == -1) {
-				g_print("%s: Read error: %d\n", dev->name,
-					errno);
-				continue;
-			}
-			if (ret != 52 || buf[0] != VIVE_IMU_REPORT_ID) {
-				g_print("%s: Error, invalid %d-byte report 0x%02x\n",
-					dev->name, ret, buf[0]);
-				continue;
-			}
+	for (i = 0; i < batch.num; i++) {
+		unsigned char *buf = batch.buf[i];
+		int len = batch.len[i];
 
+		if (index == 0 && len == 52 && buf[0] == VIVE_IMU_REPORT_ID) {
 			vive_imu_decode_message(dev, &self->imu, buf, 52);
-		}
-		if (fds[1].revents & POLLIN) {
-			ret = read(dev->fds[1], buf, sizeof(buf));
-			if (ret == -1) {
-				g_print("%s: Read error: %d\n", dev->name,
-					errno);
-				continue;
-			}
-			if (ret == 64 &&
-			    buf[0] == VIVE_HEADSET_LIGHTHOUSE_PULSE_REPORT_ID) {
-				vive_headset_decode_pulse_report(self, buf);
-			} else {
-				g_print("%s: Error, invalid %d-byte report 0x%02x\n",
-					dev->name, ret, buf[0]);
-				continue;
-			}
+		} else if (index == 1 && len == 64 &&
+			   buf[0] == VIVE_HEADSET_LIGHTHOUSE_PULSE_REPORT_ID) {
+			vive_headset_decode_pulse_report(self, buf);
+		} else {
+			g_print("%s: Error, invalid %d-byte report 0x%02x\n",
+				dev->name, len, buf[0]);
 		}
 	}
 }
 
+static void vive_headset_timeout(OuvrtDevice *dev)
+{
+	g_print("%s: Poll timeout\n", dev->name);
+}
+
 /*
  * Nothing to do here.
  */
@@ -294,8 +266,11 @@ static void ouvrt_vive_headset_class_init(OuvrtViveHeadsetClass *klass)
 {
 	G_OBJECT_CLASS(klass)->finalize = ouvrt_vive_headset_finalize;
 	OUVRT_DEVICE_CLASS(klass)->start = vive_headset_start;
-	OUVRT_DEVICE_CLASS(klass)->thread = vive_headset_thread;
+	OUVRT_DEVICE_CLASS(klass)->dispatch = vive_headset_dispatch;
+	OUVRT_DEVICE_CLASS(klass)->timeout = vive_headset_timeout;
 	OUVRT_DEVICE_CLASS(klass)->stop = vive_headset_stop;
+	OUVRT_DEVICE_CLASS(klass)->sched_policy = SCHED_FIFO;
+	OUVRT_DEVICE_CLASS(klass)->sched_priority = 20;
 }
 
 static void ouvrt_vive_headset_init(OuvrtViveHeadset *self)
@@ -6,6 +6,7 @@
 #include <asm/byteorder.h>
 #include <math.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "vive-imu.h"
@@ -24,6 +25,32 @@ static inline int oldest_sequence_index(uint8_t a, uint8_t b, uint8_t c)
 		return 0;
 }
 
+/*
+ * Combines range, scale and bias from the configuration data into the IMU
+ * calibration. The IMU y and z axes are swapped and all axes inverted to
+ * obtain the common coordinate system.
+ */
+static void vive_imu_init_calibration(struct vive_imu *imu)
+{
+	struct imu_calibration *c = &imu->calibration;
+	double acc = imu->accel_range / 32768.0;
+	double gyro = imu->gyro_range / 32768.0;
+
+	memset(c, 0, sizeof(*c));
+	c->acc_matrix[0][0] = -acc * imu->acc_scale.x;
+	c->acc_matrix[2][1] = -acc * imu->acc_scale.y;
+	c->acc_matrix[1][2] = -acc * imu->acc_scale.z;
+	c->acc_offset[0] = -imu->acc_bias.x;
+	c->acc_offset[2] = -imu->acc_bias.y;
+	c->acc_offset[1] = -imu->acc_bias.z;
+	c->gyro_matrix[0][0] = -gyro * imu->gyro_scale.x;
+	c->gyro_matrix[2][1] = -gyro * imu->gyro_scale.y;
+	c->gyro_matrix[1][2] = -gyro * imu->gyro_scale.z;
+	c->gyro_offset[0] = -imu->gyro_bias.x;
+	c->gyro_offset[2] = -imu->gyro_bias.y;
+	c->gyro_offset[1] = -imu->gyro_bias.z;
+}
+
 int vive_imu_get_range_modes(OuvrtDevice *dev, struct vive_imu *imu)
 {
 	struct vive_imu_range_modes_report report = {
@@ -62,6 +89,8 @@ int vive_imu_get_range_modes(OuvrtDevice *dev, struct vive_imu *imu)
 	imu->gyro_range = M_PI / 180.0 * (250 << report.gyro_range);
 	imu->accel_range = 9.80665 * (2 << report.accel_range);
 
+	vive_imu_init_calibration(imu);
+
 	return 0;
 }
 
@@ -74,7 +103,13 @@ void vive_imu_decode_message(OuvrtDevice *dev, struct vive_imu *imu,
 {
 	const struct vive_imu_report *report = buf;
 	const struct vive_imu_sample *sample = report->sample;
+	struct raw_imu_sample raw[3];
+	struct imu_sample s[3];
+	int32_t dt[3];
+	uint8_t seq[3];
 	uint8_t last_seq = imu->sequence;
+	uint64_t last_time = imu->time;
+	int num = 0;
 	int i, j;
 
 	(void)len;
@@ -87,65 +122,55 @@ void vive_imu_decode_message(OuvrtDevice *dev, struct vive_imu *imu,
 	 */
 	i = oldest_sequence_index(sample[0].seq, sample[1].seq, sample[2].seq);
 
-	/* From there, handle all new samples */
+	/* From there, collect all new samples */
 	for (j = 3; j; --j, i = (i + 1) % 3) {
-		struct raw_imu_sample raw;
-		struct imu_sample s;
+		struct raw_imu_sample *r = &raw[num];
 		uint32_t time;
-		double scale;
-		uint8_t seq;
-		int32_t dt;
 
 		sample = report->sample + i;
-		seq = sample->seq;
 
 		/* Skip already seen samples */
-		if (seq == last_seq ||
-		    seq == (uint8_t)(last_seq - 1) ||
-		    seq == (uint8_t)(last_seq - 2))
+		if (sample->seq == last_seq ||
+		    sample->seq == (uint8_t)(last_seq - 1) ||
+		    sample->seq == (uint8_t)(last_seq - 2))
 			continue;
 
-		raw.acc[0] = (int16_t)__le16_to_cpu(sample->acc[0]);
-		raw.acc[1] = (int16_t)__le16_to_cpu(sample->acc[1]);
-		raw.acc[2] = (int16_t)__le16_to_cpu(sample->acc[2]);
-		raw.gyro[0] = (int16_t)__le16_to_cpu(sample->gyro[0]);
-		raw.gyro[1] = (int16_t)__le16_to_cpu(sample->gyro[1]);
-		raw.gyro[2] = (int16_t)__le16_to_cpu(sample->gyro[2]);
+		r->acc[0] = (int16_t)__le16_to_cpu(sample->acc[0]);
+		r->acc[1] = (int16_t)__le16_to_cpu(sample->acc[1]);
+		r->acc[2] = (int16_t)__le16_to_cpu(sample->acc[2]);
+		r->gyro[0] = (int16_t)__le16_to_cpu(sample->gyro[0]);
+		r->gyro[1] = (int16_t)__le16_to_cpu(sample->gyro[1]);
+		r->gyro[2] = (int16_t)__le16_to_cpu(sample->gyro[2]);
 
 		time = __le32_to_cpu(sample->time);
-		dt = time - (uint32_t)imu->time;
-		raw.time = imu->time + dt;
+		dt[num] = time - (uint32_t)last_time;
+		r->time = last_time + dt[num];
+		seq[num] = sample->seq;
 
-		telemetry_send_raw_imu_sample(dev->id, &raw);
+		last_time = r->time;
+		num++;
+	}
 
-		scale = imu->accel_range / 32768.0;
-		s.acceleration.x = -scale * imu->acc_scale.x * raw.acc[0] -
-				   imu->acc_bias.x;
-		s.acceleration.z = -scale * imu->acc_scale.y * raw.acc[1] -
-				   imu->acc_bias.y;
-		s.acceleration.y = -scale * imu->acc_scale.z * raw.acc[2] -
-				   imu->acc_bias.z;
+	imu_calibrate_samples(&imu->calibration, raw, s, num);
 
-		scale = imu->gyro_range / 32768.0;
-		s.angular_velocity.x = -scale * imu->gyro_scale.x * raw.gyro[0] -
-				       imu->gyro_bias.x;
-		s.angular_velocity.z = -scale * imu->gyro_scale.y * raw.gyro[1] -
-				       imu->gyro_bias.y;
-		s.angular_velocity.y = -scale * imu->gyro_scale.z * raw.gyro[2] -
-				       imu->gyro_bias.z;
+	for (i = 0; i < num; i++) {
+		if (telemetry_wants(dev->id, TELEMETRY_PACKET_RAW_IMU_SAMPLE))
+			telemetry_send_raw_imu_sample(dev->id, &raw[i]);
 
-		s.time = (double)raw.time / 48e6;
+		s[i].time = (double)raw[i].time / 48e6;
 
-		telemetry_send_imu_sample(dev->id, &s);
+		if (telemetry_wants(dev->id, TELEMETRY_PACKET_IMU_SAMPLE))
+			telemetry_send_imu_sample(dev->id, &s[i]);
 
-		if ((dt > 47950 && dt < 48050) ||
-		    (dt > 190000 && dt < 194000)) {
-			pose_update(dt / 48e6, &imu->state.pose, &s);
+		if ((dt[i] > 47950 && dt[i] < 48050) ||
+		    (dt[i] > 190000 && dt[i] < 194000)) {
+			pose_update(dt[i] / 48e6, &imu->state.pose, &s[i]);
 
-			telemetry_send_pose(dev->id, &imu->state.pose);
+			if (telemetry_wants(dev->id, TELEMETRY_PACKET_POSE))
+				telemetry_send_pose(dev->id, &imu->state.pose);
 		}
 
-		imu->sequence = seq;
-		imu->time = raw.time;
+		imu->sequence = seq[i];
+		imu->time = raw[i].time;
 	}
 }
@@ -20,6 +20,7 @@ struct vive_imu {
 	vec3 acc_scale;
 	vec3 gyro_bias;
 	vec3 gyro_scale;
+	struct imu_calibration calibration;
 };
 
 int vive_imu_get_range_modes(OuvrtDevice *dev, struct vive_imu *imu);
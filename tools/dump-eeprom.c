@@ -1,16 +1,42 @@
 /*
- * Dumps the Oculus Positional Tracker DK2 EEPROM
- * Copyright 2014 Philipp Zabel
+ * Dumps the Oculus Positional Tracker DK2 EEPROM or the Rift sensor flash
+ * Copyright 2014-2018 Philipp Zabel
  * SPDX-License-Identifier:	GPL-2.0+
+ *
+ * The flash of all connected Rift sensors is dumped in parallel, one thread
+ * per sensor, using pipelined bulk reads that are written straight into the
+ * memory mapped output files.
  */
+#include <fcntl.h>
+#include <getopt.h>
+#include <libusb.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <sys/fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "esp570.h"
+#include "esp770u.h"
+#include "usb-ids.h"
 
-int main(int argc, char *argv[])
+#define DK2_EEPROM_SIZE		0x4000
+#define SENSOR_FLASH_SIZE	0x20000
+#define SENSOR_MAX_DEVICES	16
+
+struct sensor_dump {
+	pthread_t thread;
+	libusb_device_handle *devh;
+	char path[256];
+	uint32_t size;
+	int ret;
+};
+
+static int event_thread_quit;
+
+static int dump_dk2_eeprom(const char *path)
 {
 	char buf[0x20];
 	int fd = open("/dev/video0", O_RDWR);
@@ -18,27 +44,22 @@ int main(int argc, char *argv[])
 	int addr;
 	int ret;
 
-	if (argc != 2) {
-		fprintf(stderr, "usage: dump-eeprom <file.bin>\n");
-		return -1;
-	}
-
 	if (fd < 0) {
 		fprintf(stderr, "failed to open /dev/video0\n");
 		return -1;
 	}
 
-	if (argv[1][0] == '-' && argv[1][1] == '\0') {
+	if (path[0] == '-' && path[1] == '\0') {
 		outfd = 1;
 	} else {
-		outfd = open(argv[1], O_CREAT | O_WRONLY, 0664);
+		outfd = open(path, O_CREAT | O_WRONLY, 0664);
 		if (outfd < 0) {
-			fprintf(stderr, "failed to open '%s'\n", argv[1]);
+			fprintf(stderr, "failed to open '%s'\n", path);
 			return -1;
 		}
 	}
 
-	for (addr = 0; addr < 0x4000; addr += 0x20) {
+	for (addr = 0; addr < DK2_EEPROM_SIZE; addr += 0x20) {
 		ret = esp570_eeprom_read(fd, addr, 0x20, buf);
 		if (ret < 0) {
 			fprintf(stderr, "failed to read at address 0x%04x\n",
@@ -54,3 +75,206 @@ int main(int argc, char *argv[])
 
 	return 0;
 }
+
+static void *event_thread(void *data)
+{
+	libusb_context *ctx = data;
+	struct timeval tv = {
+		.tv_sec = 1,
+	};
+
+	while (!__atomic_load_n(&event_thread_quit, __ATOMIC_ACQUIRE)) {
+		if (libusb_handle_events_timeout_completed(ctx, &tv,
+							   &event_thread_quit))
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Reads the flash of a single sensor into its memory mapped output file.
+ */
+static void *sensor_dump_thread(void *data)
+{
+	struct sensor_dump *dump = data;
+	uint8_t *map;
+	int fd;
+
+	dump->ret = -1;
+
+	fd = open(dump->path, O_CREAT | O_RDWR | O_TRUNC, 0664);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open '%s'\n", dump->path);
+		return NULL;
+	}
+
+	if (ftruncate(fd, dump->size) < 0) {
+		fprintf(stderr, "failed to resize '%s'\n", dump->path);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, dump->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "failed to map '%s'\n", dump->path);
+		return NULL;
+	}
+
+	dump->ret = esp770u_flash_read_bulk(dump->devh, 0, map, dump->size);
+	if (dump->ret < 0)
+		fprintf(stderr, "failed to read flash into '%s': %d\n",
+			dump->path, dump->ret);
+	else
+		printf("%s\n", dump->path);
+
+	munmap(map, dump->size);
+
+	return NULL;
+}
+
+/*
+ * Opens a Rift sensor and claims its UVC control interface.
+ *
+ * Returns the device handle, or NULL on failure.
+ */
+static libusb_device_handle *sensor_open(libusb_device *device,
+					 const char *prefix, char *path,
+					 size_t len)
+{
+	struct libusb_device_descriptor desc;
+	libusb_device_handle *devh;
+	unsigned char serial[64];
+
+	if (libusb_get_device_descriptor(device, &desc) < 0 ||
+	    desc.idVendor != VID_OCULUSVR || desc.idProduct != PID_RIFT_SENSOR)
+		return NULL;
+
+	if (libusb_open(device, &devh) < 0) {
+		fprintf(stderr, "failed to open sensor %d-%d\n",
+			libusb_get_bus_number(device),
+			libusb_get_device_address(device));
+		return NULL;
+	}
+
+	if (libusb_set_auto_detach_kernel_driver(devh, 1) < 0 ||
+	    libusb_claim_interface(devh, 0) < 0) {
+		fprintf(stderr, "failed to claim sensor %d-%d\n",
+			libusb_get_bus_number(device),
+			libusb_get_device_address(device));
+		libusb_close(devh);
+		return NULL;
+	}
+
+	if (libusb_get_string_descriptor_ascii(devh, desc.iSerialNumber,
+					       serial, sizeof(serial)) > 0)
+		snprintf(path, len, "%s-%s.bin", prefix, serial);
+	else
+		snprintf(path, len, "%s-%d-%d.bin", prefix,
+			 libusb_get_bus_number(device),
+			 libusb_get_device_address(device));
+
+	return devh;
+}
+
+/*
+ * Dumps the flash of all connected Rift sensors in parallel, into files
+ * named after the prefix and each sensor's serial number.
+ */
+static int dump_sensor_flash(const char *prefix, uint32_t size)
+{
+	struct sensor_dump dumps[SENSOR_MAX_DEVICES];
+	libusb_device **devices;
+	libusb_context *ctx;
+	pthread_t events;
+	ssize_t num_devices;
+	int num = 0;
+	int ret = 0;
+	int i;
+
+	if (libusb_init(&ctx) < 0) {
+		fprintf(stderr, "failed to initialize libusb\n");
+		return -1;
+	}
+
+	num_devices = libusb_get_device_list(ctx, &devices);
+	for (i = 0; i < num_devices && num < SENSOR_MAX_DEVICES; i++) {
+		dumps[num].devh = sensor_open(devices[i], prefix,
+					      dumps[num].path,
+					      sizeof(dumps[num].path));
+		if (dumps[num].devh)
+			dumps[num++].size = size;
+	}
+	if (num_devices >= 0)
+		libusb_free_device_list(devices, 1);
+
+	if (!num) {
+		fprintf(stderr, "no Rift sensors found\n");
+		libusb_exit(ctx);
+		return -1;
+	}
+
+	pthread_create(&events, NULL, event_thread, ctx);
+
+	for (i = 0; i < num; i++)
+		pthread_create(&dumps[i].thread, NULL, sensor_dump_thread,
+			       &dumps[i]);
+	for (i = 0; i < num; i++) {
+		pthread_join(dumps[i].thread, NULL);
+		if (dumps[i].ret < 0)
+			ret = -1;
+	}
+
+	__atomic_store_n(&event_thread_quit, 1, __ATOMIC_RELEASE);
+	/* Closing a device wakes up the event thread */
+	for (i = 0; i < num; i++) {
+		libusb_release_interface(dumps[i].devh, 0);
+		libusb_close(dumps[i].devh);
+	}
+	pthread_join(events, NULL);
+	libusb_exit(ctx);
+
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: dump-eeprom [OPTIONS...] <file.bin>\n\n"
+		"Dumps the Positional Tracker DK2 EEPROM at /dev/video0 into\n"
+		"file.bin, or to stdout if file.bin is '-'.\n\n"
+		"  -a        Dump the flash of all connected Rift sensors in\n"
+		"            parallel, into <file>-<serial>.bin\n"
+		"  -n BYTES  Number of flash bytes to dump per sensor\n");
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t size = SENSOR_FLASH_SIZE;
+	int all_sensors = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "an:")) != -1) {
+		switch (c) {
+		case 'a':
+			all_sensors = 1;
+			break;
+		case 'n':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1 || size == 0) {
+		usage();
+		return -1;
+	}
+
+	if (all_sensors)
+		return dump_sensor_flash(argv[optind], size);
+
+	return dump_dk2_eeprom(argv[optind]);
+}
@@ -0,0 +1,259 @@
+/*
+ * Microbenchmarks of the quaternion math helpers
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	GPL-2.0+
+ *
+ * Times the maths.h primitives that run for every IMU sample, comparing the
+ * SIMD variants against plain scalar reference implementations, and checks
+ * that both agree. Throughput is measured over independent inputs, latency
+ * over a dependent chain of gyro integration steps as done by pose_update().
+ */
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "imu.h"
+#include "maths.h"
+
+#define BENCH_NUM_INPUTS	1024
+#define BENCH_DEFAULT_ROUNDS	10000
+
+static dquat quats[BENCH_NUM_INPUTS];
+static dquat results[BENCH_NUM_INPUTS];
+static vec3 gyros[BENCH_NUM_INPUTS];
+static dvec3 vecs[BENCH_NUM_INPUTS];
+static uint16_t halfs[BENCH_NUM_INPUTS];
+static volatile double sink;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double random_double(double min, double max)
+{
+	return min + (max - min) * rand() / RAND_MAX;
+}
+
+/* Scalar reference implementations */
+static void ref_dquat_normalize(dquat *q)
+{
+	const double inv_norm = 1.0 / sqrt(q->w * q->w + q->x * q->x +
+					   q->y * q->y + q->z * q->z);
+
+	q->w *= inv_norm;
+	q->x *= inv_norm;
+	q->y *= inv_norm;
+	q->z *= inv_norm;
+}
+
+static void ref_dquat_mult(dquat *r, const dquat *p, const dquat *q)
+{
+	r->w = p->w * q->w - p->x * q->x - p->y * q->y - p->z * q->z;
+	r->x = p->w * q->x + p->x * q->w + p->y * q->z - p->z * q->y;
+	r->y = p->w * q->y + p->y * q->w + p->z * q->x - p->x * q->z;
+	r->z = p->w * q->z + p->z * q->w + p->x * q->y - p->y * q->x;
+}
+
+static double dquat_error(const dquat *a, const dquat *b)
+{
+	return fabs(a->x - b->x) + fabs(a->y - b->y) + fabs(a->z - b->z) +
+	       fabs(a->w - b->w);
+}
+
+static void bench_init(void)
+{
+	int i;
+
+	srand(0x5eed);
+	for (i = 0; i < BENCH_NUM_INPUTS; i++) {
+		quats[i].x = random_double(-1.0, 1.0);
+		quats[i].y = random_double(-1.0, 1.0);
+		quats[i].z = random_double(-1.0, 1.0);
+		quats[i].w = random_double(-1.0, 1.0);
+		ref_dquat_normalize(&quats[i]);
+		/* Angular velocities of up to 10 rad/s */
+		gyros[i].x = random_double(-10.0, 10.0);
+		gyros[i].y = random_double(-10.0, 10.0);
+		gyros[i].z = random_double(-10.0, 10.0);
+		vecs[i].x = random_double(-1.0, 1.0);
+		vecs[i].y = random_double(-1.0, 1.0);
+		vecs[i].z = random_double(-1.0, 1.0);
+		halfs[i] = float_to_f16(random_double(-100.0, 100.0));
+	}
+}
+
+/*
+ * Returns the largest difference between the SIMD and reference variants.
+ */
+static double bench_check(void)
+{
+	double max_error = 0.0;
+	dquat a, b;
+	int i;
+
+	for (i = 0; i < BENCH_NUM_INPUTS; i++) {
+		const dquat *q = &quats[(i + 1) % BENCH_NUM_INPUTS];
+
+		dquat_mult(&a, &quats[i], q);
+		ref_dquat_mult(&b, &quats[i], q);
+		max_error = fmax(max_error, dquat_error(&a, &b));
+
+		a.x *= 1.5; a.y *= 1.5; a.z *= 1.5; a.w *= 1.5;
+		b = a;
+		dquat_normalize(&a);
+		ref_dquat_normalize(&b);
+		max_error = fmax(max_error, dquat_error(&a, &b));
+	}
+
+	return max_error;
+}
+
+static void print_result(const char *name, double t, long num)
+{
+	printf("%-28s %8.2f ns\n", name, t / num);
+}
+
+int main(int argc, char *argv[])
+{
+	const double dt = 1.0 / 1000.0;
+	long rounds = BENCH_DEFAULT_ROUNDS;
+	long num;
+	struct dpose pose = { .rotation = { 0.0, 0.0, 0.0, 1.0 } };
+	struct imu_sample sample = { .time = 0 };
+	double max_error, t;
+	dquat q, dq;
+	dvec3 v;
+	int opt, i;
+	long r;
+
+	while ((opt = getopt(argc, argv, "hn:")) != -1) {
+		switch (opt) {
+		case 'n':
+			rounds = atol(optarg);
+			break;
+		case 'h':
+		default:
+			fprintf(stderr, "usage: maths-bench [-n ROUNDS]\n");
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+	if (rounds <= 0)
+		return -1;
+
+	bench_init();
+	num = rounds * BENCH_NUM_INPUTS;
+
+	max_error = bench_check();
+	printf("%s variant, max. difference to reference %g\n",
+#if defined(__SSE2__)
+	       "SSE2",
+#elif defined(MATHS_NEON_F64)
+	       "NEON",
+#else
+	       "scalar",
+#endif
+	       max_error);
+	printf("%-28s %11s\n", "kernel", "time/op");
+
+	t = now_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_NUM_INPUTS; i++)
+			dquat_mult(&results[i], &quats[i],
+				   &quats[BENCH_NUM_INPUTS - 1 - i]);
+		sink = results[r % BENCH_NUM_INPUTS].w;
+	}
+	print_result("dquat_mult", now_ns() - t, num);
+
+	t = now_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_NUM_INPUTS; i++)
+			ref_dquat_mult(&results[i], &quats[i],
+				       &quats[BENCH_NUM_INPUTS - 1 - i]);
+		sink = results[r % BENCH_NUM_INPUTS].w;
+	}
+	print_result("dquat_mult (reference)", now_ns() - t, num);
+
+	t = now_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_NUM_INPUTS; i++) {
+			results[i] = quats[i];
+			dquat_normalize(&results[i]);
+		}
+		sink = results[r % BENCH_NUM_INPUTS].w;
+	}
+	print_result("dquat_normalize", now_ns() - t, num);
+
+	t = now_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_NUM_INPUTS; i++) {
+			results[i] = quats[i];
+			ref_dquat_normalize(&results[i]);
+		}
+		sink = results[r % BENCH_NUM_INPUTS].w;
+	}
+	print_result("dquat_normalize (reference)", now_ns() - t, num);
+
+	t = now_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_NUM_INPUTS; i++)
+			dquat_from_gyro(&results[i], &gyros[i], dt);
+		sink = results[r % BENCH_NUM_INPUTS].w;
+	}
+	print_result("dquat_from_gyro", now_ns() - t, num);
+
+	t = now_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_NUM_INPUTS; i++)
+			dquat_rotate(&v, &quats[i], &vecs[i]);
+		sink = v.x;
+	}
+	print_result("dquat_rotate", now_ns() - t, num);
+
+	t = now_ns();
+	for (r = 0; r < rounds; r++) {
+		float sum = 0.0f;
+
+		for (i = 0; i < BENCH_NUM_INPUTS; i++)
+			sum += f16_to_float(halfs[i]);
+		sink = sum;
+	}
+	print_result("f16_to_float", now_ns() - t, num);
+
+	/* Dependent chains, as for a stream of IMU samples */
+	t = now_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_NUM_INPUTS; i++) {
+			sample.angular_velocity = gyros[i];
+			pose_update(dt, &pose, &sample);
+		}
+	}
+	sink = pose.rotation.w;
+	print_result("pose_update (chained)", now_ns() - t, num);
+
+	q = (dquat){ 0.0, 0.0, 0.0, 1.0 };
+	t = now_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_NUM_INPUTS; i++) {
+			dquat tmp;
+
+			dquat_from_gyro(&dq, &gyros[i], dt);
+			ref_dquat_mult(&tmp, &q, &dq);
+			ref_dquat_normalize(&tmp);
+			q = tmp;
+		}
+	}
+	sink = q.w;
+	print_result("pose_update (reference)", now_ns() - t, num);
+
+	max_error = dquat_error(&q, &pose.rotation);
+	printf("integrated pose difference to reference %g\n", max_error);
+
+	return max_error < 1e-9 ? 0 : -1;
+}
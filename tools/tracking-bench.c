@@ -0,0 +1,513 @@
+/*
+ * Offline benchmark of the optical tracking pipeline
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	GPL-2.0+
+ *
+ * Runs blob detection, LED flicker identification, and pose estimation over
+ * synthetic frames of one or more blinking LED constellations, or over the
+ * camera frames of a session recorded with ouvrtd --record, optionally in
+ * sparse form, and reports the throughput, per-stage latency percentiles,
+ * and heap allocations per frame.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "blobwatch.h"
+#include "flicker.h"
+#include "leds.h"
+#include "maths.h"
+#include "pnp.h"
+#include "recording.h"
+#include "synthetic.h"
+
+#define BENCH_WIDTH		1280
+#define BENCH_HEIGHT		960
+#define BENCH_NUM_LEDS		40
+#define BENCH_MAX_LEDS		127
+#define BENCH_MAX_OBJECTS	64
+#define BENCH_DEFAULT_FRAMES	1000
+
+#define BENCH_FOURCC_YUYV	0x56595559
+
+#define MAX(a, b)		((a) > (b) ? (a) : (b))
+
+enum bench_stage {
+	STAGE_BLOBWATCH,
+	STAGE_FLICKER,
+	STAGE_POSE,
+	NUM_STAGES,
+};
+
+static const char *stage_names[NUM_STAGES] = {
+	"blobwatch_process",
+	"flicker_process",
+	"estimate_pose",
+};
+
+struct bench_frame {
+	uint8_t *data;
+	int width;
+	int height;
+	enum blobwatch_format format;
+};
+
+/*
+ * Heap allocations are counted by wrapping the glibc allocator while a stage
+ * is being timed.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static bool count_allocations;
+static unsigned long num_allocations;
+
+void *malloc(size_t size)
+{
+	if (count_allocations)
+		num_allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (count_allocations)
+		num_allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (count_allocations)
+		num_allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
+
+static double percentile(const double *sorted, int num, int p)
+{
+	int i = (num - 1) * p / 100;
+
+	return num ? sorted[i] : 0.0;
+}
+
+/*
+ * Places the LEDs on a spiral over the camera facing half of a sphere, and
+ * gives each a blinking pattern. Each object has its own pattern namespace,
+ * so the patterns are only offset to make the objects look different.
+ */
+static void bench_init_leds(struct leds *leds, int num_leds, int object)
+{
+	const double golden_angle = M_PI * (3.0 - sqrt(5.0));
+	int i;
+
+	leds_init(leds, num_leds);
+	for (i = 0; i < num_leds; i++) {
+		double z = -1.0 + (i + 0.5) / num_leds;
+		double r = sqrt(1.0 - z * z);
+		double phi = i * golden_angle;
+
+		leds->model.points[i].x = 0.06 * r * cos(phi);
+		leds->model.points[i].y = 0.06 * r * sin(phi);
+		leds->model.points[i].z = 0.06 * z;
+		leds->model.normals[i].x = r * cos(phi);
+		leds->model.normals[i].y = r * sin(phi);
+		leds->model.normals[i].z = z;
+		/* Spread the patterns over the 10-bit space */
+		leds->patterns[i] = ((i + object) * 0x3b5 + 0x2a) & 0x3ff;
+	}
+	leds_build_pattern_table(leds);
+}
+
+/*
+ * Moves the synthetic objects to their pose in frame n. The objects are
+ * arranged in a grid in front of the camera, each slowly swaying.
+ */
+static void bench_move_objects(struct synthetic_object *objects,
+			       int num_objects, int n)
+{
+	int cols = ceil(sqrt(num_objects));
+	dvec3 axis = { 0.3, 1.0, 0.1 };
+	int i;
+
+	dvec3_normalize(&axis);
+
+	for (i = 0; i < num_objects; i++) {
+		double t = n / 60.0 + i;
+		double depth = 0.6 + 0.25 * cols;
+
+		dquat_from_axis_angle(&objects[i].rotation, &axis,
+				      0.4 * sin(t));
+		objects[i].translation.x = 0.05 * sin(0.7 * t) +
+			(i % cols - 0.5 * (cols - 1)) * 0.2;
+		objects[i].translation.y = 0.03 * cos(0.5 * t) +
+			(i / cols - 0.5 * (cols - 1)) * 0.2;
+		objects[i].translation.z = depth + 0.1 * sin(0.3 * t);
+	}
+}
+
+/*
+ * Labels blobs that flicker could not identify yet with the LED projected
+ * closest to them, so that the pose stage always has work to do.
+ */
+static void bench_label_blobs(struct blob *blobs, int num_blobs,
+			      const struct synthetic_camera *camera,
+			      const struct synthetic_object *objects,
+			      int num_objects)
+{
+	int i, j, k;
+
+	for (i = 0; i < num_blobs; i++) {
+		double best = 16.0;
+
+		if (blobs[i].led_id >= 0)
+			continue;
+
+		for (k = 0; k < num_objects; k++) {
+			const struct leds *leds = objects[k].leds;
+
+			for (j = 0; j < (int)leds->model.num_points; j++) {
+				double u, v, z, d;
+
+				if (!synthetic_project(camera, &objects[k], j,
+						       &u, &v, &z))
+					continue;
+				d = (u - blobs[i].cx) * (u - blobs[i].cx) +
+				    (v - blobs[i].cy) * (v - blobs[i].cy);
+				if (d < best) {
+					best = d;
+					blobs[i].led_id = j;
+					blobs[i].object_id = k;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Loads all greyscale or YUYV camera frames from a recorded session.
+ *
+ * Returns the number of frames loaded, or a negative error code.
+ */
+static int bench_load_recording(const char *path, struct bench_frame **frames)
+{
+	struct recording_reader *reader;
+	const struct recording_chunk *chunk;
+	int num = 0;
+
+	reader = recording_reader_open(path);
+	if (!reader)
+		return -EINVAL;
+
+	*frames = NULL;
+	while ((chunk = recording_reader_next(reader))) {
+		const struct recording_frame *rec;
+		struct bench_frame *frame;
+		uint32_t type = __le32_to_cpu(chunk->type);
+		uint32_t fourcc;
+		size_t size;
+
+		if (type != RECORDING_CHUNK_SENSOR_FRAME &&
+		    type != RECORDING_CHUNK_V4L2_FRAME &&
+		    type != RECORDING_CHUNK_SPARSE_FRAME)
+			continue;
+
+		rec = recording_chunk_data(chunk);
+		fourcc = __le32_to_cpu(rec->fourcc);
+		if (fourcc != RECORDING_FOURCC_GREY &&
+		    fourcc != BENCH_FOURCC_YUYV)
+			continue;
+
+		size = __le16_to_cpu(rec->width) * __le16_to_cpu(rec->height) *
+		       (fourcc == BENCH_FOURCC_YUYV ? 2 : 1);
+		if (type != RECORDING_CHUNK_SPARSE_FRAME &&
+		    __le32_to_cpu(chunk->len) < sizeof(*rec) + size)
+			continue;
+
+		/* Only use frames of the first camera */
+		if (num && (__le16_to_cpu(rec->width) != (*frames)[0].width ||
+			    __le16_to_cpu(rec->height) != (*frames)[0].height))
+			continue;
+
+		*frames = realloc(*frames, (num + 1) * sizeof(**frames));
+		frame = &(*frames)[num++];
+		frame->width = __le16_to_cpu(rec->width);
+		frame->height = __le16_to_cpu(rec->height);
+		frame->format = fourcc == BENCH_FOURCC_YUYV ?
+				BLOBWATCH_FORMAT_YUYV : BLOBWATCH_FORMAT_GREY;
+		frame->data = malloc(size);
+		if (fourcc == BENCH_FOURCC_YUYV)
+			memcpy(frame->data, rec + 1, size);
+		else if (recording_decode_frame(chunk, frame->data, size) < 0)
+			free((*frames)[--num].data);
+	}
+
+	recording_reader_close(reader);
+
+	return num;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: tracking-bench [OPTIONS...] [RECORDING]\n\n"
+		"  -n FRAMES   Number of frames to process\n"
+		"  -o OBJECTS  Number of synthetic objects\n"
+		"  -l LEDS     Number of LEDs per synthetic object\n"
+		"  -f          Use an equidistant fisheye lens model\n"
+		"  -s WxH      Synthetic frame size\n"
+		"  -N NOISE    Synthetic per-pixel noise amplitude\n"
+		"  -r LEVEL    Synthetic reflection brightness (0-1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct synthetic_camera camera = {
+		.width = BENCH_WIDTH,
+		.height = BENCH_HEIGHT,
+		.led_size = 0.005,
+		.seed = 0x12345678,
+	};
+	struct synthetic_object synthetic_objects[BENCH_MAX_OBJECTS];
+	struct leds leds[BENCH_MAX_OBJECTS], *objects[BENCH_MAX_OBJECTS];
+	dquat rot[BENCH_MAX_OBJECTS];
+	dvec3 trans[BENCH_MAX_OBJECTS];
+	double *times[NUM_STAGES];
+	int num_timed[NUM_STAGES] = { 0 };
+	struct bench_frame synthetic;
+	struct bench_frame *frames = NULL;
+	struct blobwatch *bw;
+	unsigned long allocations = 0;
+	unsigned long num_blobs = 0;
+	int num_frames = BENCH_DEFAULT_FRAMES;
+	int num_objects = 1;
+	int num_leds = BENCH_NUM_LEDS;
+	int num_recorded = 0;
+	int num_poses = 0;
+	double position_error = 0.0;
+	double total = 0.0;
+	int opt, i, j, s;
+
+	while ((opt = getopt(argc, argv, "fhl:n:N:o:r:s:")) != -1) {
+		switch (opt) {
+		case 'f':
+			/* Mildly barrel distorting fisheye lens */
+			camera.distortion = (struct distortion){
+				.model = DISTORTION_FISHEYE,
+				.k = { -0.02, 0.005, 0.0, 0.0 },
+			};
+			break;
+		case 'l':
+			num_leds = atoi(optarg);
+			break;
+		case 'n':
+			num_frames = atoi(optarg);
+			break;
+		case 'N':
+			camera.noise = atoi(optarg);
+			break;
+		case 'o':
+			num_objects = atoi(optarg);
+			break;
+		case 'r':
+			camera.reflection = atof(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d", &camera.width,
+				   &camera.height) != 2)
+				camera.width = 0;
+			break;
+		case 'h':
+		default:
+			usage();
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+
+	if (num_frames <= 0 || num_objects <= 0 ||
+	    num_objects > BENCH_MAX_OBJECTS || num_leds < 4 ||
+	    num_leds > BENCH_MAX_LEDS || camera.width <= 0 ||
+	    camera.height <= 0) {
+		usage();
+		return -1;
+	}
+
+	/* Scale the focal length with the frame size */
+	camera.camera_matrix = (dmat3){ .m = {
+		715.0 * camera.width / BENCH_WIDTH, 0.0, camera.width / 2.0,
+		0.0, 715.0 * camera.width / BENCH_WIDTH, camera.height / 2.0,
+		0.0, 0.0, 1.0,
+	} };
+
+	for (i = 0; i < num_objects; i++) {
+		bench_init_leds(&leds[i], num_leds, i);
+		objects[i] = &leds[i];
+		synthetic_objects[i].leds = &leds[i];
+		rot[i] = (dquat){ 0.0, 0.0, 0.0, 1.0 };
+		trans[i] = (dvec3){ 0.0, 0.0, 0.0 };
+	}
+
+	if (optind < argc) {
+		num_recorded = bench_load_recording(argv[optind], &frames);
+		if (num_recorded <= 0) {
+			fprintf(stderr, "no usable frames in '%s'\n",
+				argv[optind]);
+			return -1;
+		}
+		printf("Loaded %d frames of %dx%d from %s\n", num_recorded,
+		       frames[0].width, frames[0].height, argv[optind]);
+	} else {
+		synthetic.width = camera.width;
+		synthetic.height = camera.height;
+		synthetic.format = BLOBWATCH_FORMAT_GREY;
+		synthetic.data = malloc(camera.width * camera.height);
+		frames = &synthetic;
+	}
+
+	bw = blobwatch_new_with_capacity(frames[0].width, frames[0].height,
+					 MAX(2 * num_objects * num_leds, 64),
+					 frames[0].width);
+	if (!bw) {
+		fprintf(stderr, "failed to create blobwatch\n");
+		return -1;
+	}
+	blobwatch_set_format(bw, frames[0].format);
+	/* Run flicker separately to time it on its own */
+	blobwatch_set_flicker(false);
+
+	times[STAGE_BLOBWATCH] = calloc(num_frames, sizeof(double));
+	times[STAGE_FLICKER] = calloc(num_frames, sizeof(double));
+	times[STAGE_POSE] = calloc(num_frames * num_objects, sizeof(double));
+
+	for (i = 0; i < num_frames; i++) {
+		struct bench_frame *frame = num_recorded ?
+					    &frames[i % num_recorded] :
+					    &synthetic;
+		uint8_t phase = i % 10;
+		struct blobservation *ob = NULL;
+		double t0, t1, t2, t3;
+		int ret;
+
+		if (!num_recorded) {
+			bench_move_objects(synthetic_objects, num_objects, i);
+			synthetic_render(&camera, synthetic_objects,
+					 num_objects, phase, frame->data);
+		}
+
+		count_allocations = true;
+		t0 = now_us();
+		blobwatch_process(bw, frame->data, frame->width,
+				  frame->height, phase, objects, num_objects,
+				  &ob);
+		t1 = now_us();
+		if (ob)
+			flicker_process(ob->blobs, ob->num_blobs, phase,
+					objects, num_objects);
+		t2 = now_us();
+		count_allocations = false;
+
+		times[STAGE_BLOBWATCH][num_timed[STAGE_BLOBWATCH]++] = t1 - t0;
+		times[STAGE_FLICKER][num_timed[STAGE_FLICKER]++] = t2 - t1;
+		total += t2 - t0;
+		if (!ob)
+			continue;
+		num_blobs += ob->num_blobs;
+
+		/* Recorded sessions do not contain the LED model */
+		if (num_recorded)
+			continue;
+
+		bench_label_blobs(ob->blobs, ob->num_blobs, &camera,
+				  synthetic_objects, num_objects);
+
+		for (j = 0; j < num_objects; j++) {
+			count_allocations = true;
+			t2 = now_us();
+			ret = estimate_pose(ob->blobs, ob->num_blobs, j,
+					    leds[j].model.points,
+					    leds[j].model.num_points,
+					    &camera.camera_matrix,
+					    &camera.distortion, NULL, &rot[j],
+					    &trans[j], true);
+			t3 = now_us();
+			count_allocations = false;
+
+			times[STAGE_POSE][num_timed[STAGE_POSE]++] = t3 - t2;
+			total += t3 - t2;
+			if (ret >= 0) {
+				dvec3 d = trans[j];
+
+				/* Distance to the synthetic ground truth */
+				d.x -= synthetic_objects[j].translation.x;
+				d.y -= synthetic_objects[j].translation.y;
+				d.z -= synthetic_objects[j].translation.z;
+				position_error += sqrt(d.x * d.x + d.y * d.y +
+						       d.z * d.z);
+				num_poses++;
+			}
+		}
+	}
+	allocations = num_allocations;
+
+	printf("%d frames, %.1f frames/s, %.1f blobs/frame, %d poses, %.2f allocations/frame\n",
+	       num_frames, total > 0.0 ? num_frames * 1e6 / total : 0.0,
+	       (double)num_blobs / num_frames, num_poses,
+	       (double)allocations / num_frames);
+	if (num_poses)
+		printf("mean position error %.3f mm\n",
+		       1000.0 * position_error / num_poses);
+	printf("%-18s %9s %9s %9s %9s %9s\n", "stage [us]", "mean", "p50",
+	       "p90", "p99", "max");
+
+	for (s = 0; s < NUM_STAGES; s++) {
+		double sum = 0.0;
+		int n = num_timed[s];
+
+		if (n) {
+			for (i = 0; i < n; i++)
+				sum += times[s][i];
+			qsort(times[s], n, sizeof(double), compare_double);
+
+			printf("%-18s %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+			       stage_names[s], sum / n,
+			       percentile(times[s], n, 50),
+			       percentile(times[s], n, 90),
+			       percentile(times[s], n, 99), times[s][n - 1]);
+		}
+		free(times[s]);
+	}
+
+	blobwatch_free(bw);
+	for (i = 0; i < num_objects; i++)
+		leds_fini(&leds[i]);
+	if (num_recorded) {
+		for (i = 0; i < num_recorded; i++)
+			free(frames[i].data);
+		free(frames);
+	} else {
+		free(synthetic.data);
+	}
+
+	return 0;
+}
@@ -0,0 +1,433 @@
+/*
+ * Offline benchmark of the UVC payload parser
+ * Copyright 2026 agent
+ * SPDX-License-Identifier:	GPL-2.0+
+ *
+ * Replays the isochronous or bulk video packets of a usbmon capture, in the
+ * packet sizes they were received with, through the UVC frame reassembly
+ * used by the Rift sensor driver, and reports the throughput and per-packet
+ * latency. Without a capture, synthesized Rift sensor payloads are replayed.
+ *
+ * Captures can be recorded with the usbmon Wireshark or tcpdump backends,
+ * for example: tcpdump -i usbmon1 -w sensor.pcap
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uvc.h"
+
+#define BENCH_WIDTH		1280
+#define BENCH_HEIGHT		960
+#define BENCH_ENDPOINT		0x81
+#define BENCH_PACKET_SIZE	3072
+#define BENCH_DEFAULT_FRAMES	100
+#define BENCH_DEFAULT_LOOPS	10
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NS		0xa1b23c4d
+#define LINKTYPE_USB_LINUX	189
+#define LINKTYPE_USB_LINUX_MMAPPED	220
+
+#define USB_TRANSFER_ISO	0
+#define USB_TRANSFER_BULK	3
+
+#define MIN(a, b)		((a) < (b) ? (a) : (b))
+
+struct pcap_header {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+} __attribute__((packed));
+
+struct pcap_record {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+} __attribute__((packed));
+
+/* Linux usbmon packet header, followed by iso descriptors for linktype 220 */
+struct usbmon_packet {
+	uint64_t id;
+	uint8_t type;
+	uint8_t xfer_type;
+	uint8_t epnum;
+	uint8_t devnum;
+	uint16_t busnum;
+	int8_t flag_setup;
+	int8_t flag_data;
+	int64_t ts_sec;
+	int32_t ts_usec;
+	int32_t status;
+	uint32_t length;
+	uint32_t len_cap;
+	union {
+		uint8_t setup[8];
+		struct {
+			int32_t error_count;
+			int32_t numdesc;
+		} iso;
+	} s;
+	/* linktype 220 only */
+	int32_t interval;
+	int32_t start_frame;
+	uint32_t xfer_flags;
+	uint32_t ndesc;
+} __attribute__((packed));
+
+#define USBMON_HEADER_SIZE	48
+#define USBMON_MMAPPED_HEADER_SIZE	64
+
+struct usbmon_iso_desc {
+	int32_t status;
+	uint32_t offset;
+	uint32_t len;
+	uint32_t pad;
+} __attribute__((packed));
+
+struct bench_packet {
+	const uint8_t *data;
+	uint32_t len;
+};
+
+struct bench_packets {
+	struct bench_packet *packets;
+	int num;
+	int size;
+	size_t bytes;
+};
+
+struct bench_stream {
+	uint8_t *frame;
+	int frame_size;
+	unsigned long num_frames;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t ua = *(const uint32_t *)a;
+	uint32_t ub = *(const uint32_t *)b;
+
+	return (ua > ub) - (ua < ub);
+}
+
+static void bench_add_packet(struct bench_packets *p, const uint8_t *data,
+			     uint32_t len)
+{
+	if (p->num == p->size) {
+		p->size = p->size ? 2 * p->size : 4096;
+		p->packets = realloc(p->packets,
+				     p->size * sizeof(*p->packets));
+		if (!p->packets) {
+			fprintf(stderr, "out of memory\n");
+			exit(-1);
+		}
+	}
+	p->packets[p->num].data = data;
+	p->packets[p->num].len = len;
+	p->num++;
+	p->bytes += len;
+}
+
+/*
+ * Splits a completed isochronous URB into its packets, using the iso
+ * descriptors captured with the mmapped usbmon header.
+ */
+static void bench_add_iso_urb(struct bench_packets *p,
+			      const struct usbmon_packet *urb,
+			      const uint8_t *end)
+{
+	const struct usbmon_iso_desc *desc = (const void *)((const uint8_t *)urb +
+					     USBMON_MMAPPED_HEADER_SIZE);
+	const uint8_t *data = (const uint8_t *)(desc + urb->ndesc);
+	uint32_t i;
+
+	if ((const uint8_t *)(desc + urb->ndesc) > end)
+		return;
+
+	for (i = 0; i < urb->ndesc; i++) {
+		/* Damaged packets are skipped by the driver as well */
+		if (desc[i].status != 0)
+			continue;
+		if (desc[i].offset + desc[i].len > urb->len_cap ||
+		    data + desc[i].offset + desc[i].len > end)
+			continue;
+		bench_add_packet(p, data + desc[i].offset, desc[i].len);
+	}
+}
+
+/*
+ * Collects the video packets received from the given endpoint.
+ *
+ * Returns the number of packets, or a negative error code.
+ */
+static int bench_load_pcap(const char *path, int endpoint,
+			   struct bench_packets *p)
+{
+	const struct pcap_header *header;
+	const uint8_t *map, *pos, *end;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "failed to open '%s': %d\n", path, errno);
+		return -errno;
+	}
+	if ((size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	header = (const struct pcap_header *)map;
+	if (header->magic != PCAP_MAGIC && header->magic != PCAP_MAGIC_NS) {
+		fprintf(stderr, "'%s' is not a little-endian pcap file\n",
+			path);
+		return -EINVAL;
+	}
+	if (header->linktype != LINKTYPE_USB_LINUX &&
+	    header->linktype != LINKTYPE_USB_LINUX_MMAPPED) {
+		fprintf(stderr, "'%s' is not a usbmon capture (linktype %u)\n",
+			path, header->linktype);
+		return -EINVAL;
+	}
+
+	pos = map + sizeof(*header);
+	end = map + st.st_size;
+	while (pos + sizeof(struct pcap_record) <= end) {
+		const struct pcap_record *record = (const void *)pos;
+		const struct usbmon_packet *urb;
+		const uint8_t *next;
+		size_t hdr_size;
+
+		pos += sizeof(*record);
+		next = pos + record->incl_len;
+		if (next > end)
+			break;
+
+		hdr_size = header->linktype == LINKTYPE_USB_LINUX_MMAPPED ?
+			   USBMON_MMAPPED_HEADER_SIZE : USBMON_HEADER_SIZE;
+		urb = (const void *)pos;
+		pos = next;
+		if (record->incl_len < hdr_size || urb->type != 'C' ||
+		    urb->epnum != endpoint || urb->status != 0 ||
+		    urb->flag_data != 0)
+			continue;
+
+		if (urb->xfer_type == USB_TRANSFER_ISO) {
+			/* The plain usbmon header lacks the iso descriptors */
+			if (header->linktype == LINKTYPE_USB_LINUX_MMAPPED)
+				bench_add_iso_urb(p, urb, next);
+		} else if (urb->xfer_type == USB_TRANSFER_BULK) {
+			/* Bulk transfers carry one payload each */
+			bench_add_packet(p, (const uint8_t *)urb + hdr_size,
+					 MIN(urb->len_cap, record->incl_len -
+					     hdr_size));
+		}
+	}
+
+	return p->num;
+}
+
+/*
+ * Synthesizes the payloads of num_frames Rift sensor frames, with the frame
+ * id toggling between frames and a 12-byte header on each packet.
+ */
+static int bench_synthesize(int frame_size, int num_frames,
+			    struct bench_packets *p)
+{
+	const int len = BENCH_PACKET_SIZE - sizeof(struct uvc_payload_header);
+	int packets_per_frame = (frame_size + len - 1) / len;
+	uint8_t *buf, *pos;
+	int i, j;
+
+	buf = malloc((size_t)num_frames * packets_per_frame *
+		     BENCH_PACKET_SIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	pos = buf;
+	for (i = 0; i < num_frames; i++) {
+		for (j = 0; j < frame_size; j += len) {
+			struct uvc_payload_header *h = (void *)pos;
+			int n = MIN(len, frame_size - j);
+
+			memset(h, 0, sizeof(*h));
+			h->bHeaderLength = sizeof(*h);
+			h->bmHeaderInfo = 0x80 | (i & 1);
+			if (j + n == frame_size)
+				h->bmHeaderInfo |= 0x02;
+			h->dwPresentationTime = __cpu_to_le32(i * 19230);
+			memset(pos + sizeof(*h), (i + j) & 0xff, n);
+			bench_add_packet(p, pos, sizeof(*h) + n);
+			pos += BENCH_PACKET_SIZE;
+		}
+	}
+
+	return p->num;
+}
+
+static int bench_frame_start(void *data, __attribute__((unused)) uint32_t pts)
+{
+	struct bench_stream *s = data;
+
+	return s->frame_size;
+}
+
+static void bench_payload(void *data, int offset, const uint8_t *payload,
+			  int len)
+{
+	struct bench_stream *s = data;
+
+	memcpy(s->frame + offset, payload, len);
+}
+
+static const struct uvc_stream_ops bench_ops = {
+	.frame_start = bench_frame_start,
+	.payload = bench_payload,
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: uvc-replay-bench [OPTIONS...] [CAPTURE]\n\n"
+		"  -e EP       Video streaming endpoint (default 0x81)\n"
+		"  -l LOOPS    Number of passes over the packets\n"
+		"  -n FRAMES   Number of synthesized frames\n"
+		"  -s WxH      Frame size\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_packets packets = { 0 };
+	struct bench_stream s = { 0 };
+	struct uvc_stream uvc;
+	unsigned long num_errors = 0;
+	int endpoint = BENCH_ENDPOINT;
+	int num_frames = BENCH_DEFAULT_FRAMES;
+	int num_loops = BENCH_DEFAULT_LOOPS;
+	int width = BENCH_WIDTH;
+	int height = BENCH_HEIGHT;
+	uint64_t total = 0, sum = 0;
+	uint32_t *times;
+	size_t num_times;
+	int opt, ret, i, j;
+
+	while ((opt = getopt(argc, argv, "e:hl:n:s:")) != -1) {
+		switch (opt) {
+		case 'e':
+			endpoint = strtol(optarg, NULL, 0);
+			break;
+		case 'l':
+			num_loops = atoi(optarg);
+			break;
+		case 'n':
+			num_frames = atoi(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d", &width, &height) != 2)
+				width = 0;
+			break;
+		case 'h':
+		default:
+			usage();
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+
+	if (num_loops <= 0 || num_frames <= 0 || width <= 0 || height <= 0) {
+		usage();
+		return -1;
+	}
+
+	s.frame_size = width * height;
+	s.frame = malloc(s.frame_size);
+	if (!s.frame)
+		return -1;
+
+	if (optind < argc) {
+		ret = bench_load_pcap(argv[optind], endpoint, &packets);
+		if (ret <= 0) {
+			fprintf(stderr, "no video packets from endpoint 0x%02x in '%s'\n",
+				endpoint, argv[optind]);
+			return -1;
+		}
+		printf("Loaded %d packets, %zu bytes from %s\n", packets.num,
+		       packets.bytes, argv[optind]);
+	} else {
+		ret = bench_synthesize(s.frame_size, num_frames, &packets);
+		if (ret <= 0)
+			return -1;
+	}
+
+	num_times = (size_t)packets.num * num_loops;
+	times = malloc(num_times * sizeof(*times));
+	if (!times)
+		return -1;
+
+	uvc_stream_init(&uvc, "uvc-replay-bench", s.frame_size, &bench_ops, &s);
+
+	for (j = 0; j < num_loops; j++) {
+		for (i = 0; i < packets.num; i++) {
+			const struct bench_packet *packet = &packets.packets[i];
+			uint64_t t0, t1;
+
+			t0 = now_ns();
+			ret = uvc_stream_process_payload(&uvc, packet->data,
+							 packet->len);
+			if (ret == UVC_PAYLOAD_FRAME_COMPLETE)
+				s.num_frames++;
+			t1 = now_ns();
+
+			if (ret == UVC_PAYLOAD_INVALID ||
+			    ret == UVC_PAYLOAD_OVERFLOW)
+				num_errors++;
+			times[(size_t)j * packets.num + i] = t1 - t0;
+			total += t1 - t0;
+		}
+	}
+
+	for (i = 0; (size_t)i < num_times; i++)
+		sum += times[i];
+	qsort(times, num_times, sizeof(*times), compare_u32);
+
+	printf("%zu packets, %lu frames, %u short, %lu errors\n", num_times,
+	       s.num_frames, uvc.num_short, num_errors);
+	printf("%.1f MB/s, %.1f kpackets/s, %.1f frames/s\n",
+	       total ? packets.bytes * num_loops * 1e3 / total : 0.0,
+	       total ? num_times * 1e6 / total : 0.0,
+	       total ? s.num_frames * 1e9 / total : 0.0);
+	printf("packet latency [ns]: mean %.0f, p50 %u, p99 %u, p99.9 %u, max %u\n",
+	       (double)sum / num_times, times[num_times / 2],
+	       times[(num_times - 1) * 99 / 100],
+	       times[(num_times - 1) * 999 / 1000], times[num_times - 1]);
+
+	return 0;
+}